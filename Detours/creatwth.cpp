@@ -46,13 +46,65 @@ const GUID DETOUR_EXE_HELPER_GUID = { /* ea0251b9-5cde-41b5-98d0-2af4a26b0fee */
     0xea0251b9, 0x5cde, 0x41b5,
     { 0x98, 0xd0, 0x2a, 0xf4, 0xa2, 0x6b, 0x0f, 0xee }};
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// The first page of an image holds all of its headers, in all but the most
+// unusual images.  Updating an image reads that page once, and then copies
+// each header from it, instead of reading each header from the process as
+// it is needed; the headers are read several times over otherwise.
+//
+typedef struct _DETOUR_HEADERS_PAGE
+{
+    DWORD   cbValid;
+    BYTE    rbPage[0x1000];
+} DETOUR_HEADERS_PAGE, *PDETOUR_HEADERS_PAGE;
+
+static VOID ReadHeadersPage(HANDLE hProcess, HMODULE hModule, DETOUR_HEADERS_PAGE& page)
+{
+    SIZE_T cbRead = 0;
+    if (!ReadProcessMemory(hProcess, hModule, page.rbPage, sizeof(page.rbPage), &cbRead)) {
+        DETOUR_TRACE(("ReadProcessMemory(headers@%p) failed: %d\n", hModule, GetLastError()));
+        cbRead = 0;
+    }
+    page.cbValid = (DWORD)cbRead;
+}
+
+// Same as ReadProcessMemory, except that what is in the headers page, when
+// there is one, is copied from it.  Partial reads fail.
+static BOOL ReadHeaders(HANDLE hProcess,
+                        HMODULE hModule,
+                        const DETOUR_HEADERS_PAGE *pPage,
+                        PBYTE pbAddress,
+                        PVOID pvBuffer,
+                        SIZE_T cbBuffer)
+{
+    if (pPage != NULL && pbAddress >= (PBYTE)hModule) {
+        SIZE_T obAddress = (SIZE_T)(pbAddress - (PBYTE)hModule);
+        if (obAddress <= pPage->cbValid && cbBuffer <= pPage->cbValid - obAddress) {
+            CopyMemory(pvBuffer, pPage->rbPage + obAddress, cbBuffer);
+            return TRUE;
+        }
+    }
+
+    SIZE_T cbRead = 0;
+    if (!ReadProcessMemory(hProcess, pbAddress, pvBuffer, cbBuffer, &cbRead)) {
+        return FALSE;
+    }
+    if (cbRead < cbBuffer) {
+        SetLastError(ERROR_PARTIAL_COPY);
+        return FALSE;
+    }
+    return TRUE;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Enumate through modules in the target process.
 //
 static BOOL WINAPI LoadNtHeaderFromProcess(HANDLE hProcess,
                                            HMODULE hModule,
-                                           PIMAGE_NT_HEADERS32 pNtHeader)
+                                           PIMAGE_NT_HEADERS32 pNtHeader,
+                                           const DETOUR_HEADERS_PAGE *pPage)
 {
     PBYTE pbModule = (PBYTE)hModule;
 
@@ -61,31 +113,37 @@ static BOOL WINAPI LoadNtHeaderFromProcess(HANDLE hProcess,
         return FALSE;
     }
 
-    MEMORY_BASIC_INFORMATION mbi;
-    ZeroMemory(&mbi, sizeof(mbi));
-
-    if (VirtualQueryEx(hProcess, hModule, &mbi, sizeof(mbi)) == 0) {
-        return FALSE;
-    }
-
     IMAGE_DOS_HEADER idh;
 
-    if (!ReadProcessMemory(hProcess, pbModule, &idh, sizeof(idh), NULL)) {
+    if (!ReadHeaders(hProcess, hModule, pPage, pbModule, &idh, sizeof(idh))) {
         DETOUR_TRACE(("ReadProcessMemory(idh@%p..%p) failed: %d\n",
                       pbModule, pbModule + sizeof(idh), GetLastError()));
         return FALSE;
     }
 
+    // The NT header must be in the region that starts at the image, which
+    // is at least as large as the part of the headers page that was read.
+    SIZE_T cbRegion = (pPage != NULL) ? pPage->cbValid : 0;
+    if ((DWORD)idh.e_lfanew >= cbRegion) {
+        MEMORY_BASIC_INFORMATION mbi;
+        ZeroMemory(&mbi, sizeof(mbi));
+
+        if (VirtualQueryEx(hProcess, hModule, &mbi, sizeof(mbi)) == 0) {
+            return FALSE;
+        }
+        cbRegion = mbi.RegionSize;
+    }
+
     if (idh.e_magic != IMAGE_DOS_SIGNATURE ||
-        (DWORD)idh.e_lfanew > mbi.RegionSize ||
+        (DWORD)idh.e_lfanew > cbRegion ||
         (DWORD)idh.e_lfanew < sizeof(idh)) {
 
         SetLastError(ERROR_BAD_EXE_FORMAT);
         return FALSE;
     }
 
-    if (!ReadProcessMemory(hProcess, pbModule + idh.e_lfanew,
-                           pNtHeader, sizeof(*pNtHeader), NULL)) {
+    if (!ReadHeaders(hProcess, hModule, pPage, pbModule + idh.e_lfanew,
+                     pNtHeader, sizeof(*pNtHeader))) {
         DETOUR_TRACE(("ReadProcessMemory(inh@%p..%p:%p) failed: %d\n",
                       pbModule + idh.e_lfanew,
                       pbModule + idh.e_lfanew + sizeof(*pNtHeader),
@@ -137,7 +195,7 @@ static HMODULE WINAPI EnumerateModulesInProcess(HANDLE hProcess,
             continue;
         }
 
-        if (LoadNtHeaderFromProcess(hProcess, (HMODULE)pbLast, pNtHeader)) {
+        if (LoadNtHeaderFromProcess(hProcess, (HMODULE)pbLast, pNtHeader, NULL)) {
             return (HMODULE)pbLast;
         }
     }
@@ -249,7 +307,8 @@ static inline HRESULT ReplaceOptionalSizeA(_Inout_z_count_(cchDest) LPSTR pszDes
     return S_OK;
 }
 
-static BOOL RecordExeRestore(HANDLE hProcess, HMODULE hModule, DETOUR_EXE_RESTORE& der)
+static BOOL RecordExeRestore(HANDLE hProcess, HMODULE hModule, DETOUR_EXE_RESTORE& der,
+                             const DETOUR_HEADERS_PAGE *pPage)
 {
     // Save the various headers for DetourRestoreAfterWith.
     ZeroMemory(&der, sizeof(der));
@@ -257,7 +316,7 @@ static BOOL RecordExeRestore(HANDLE hProcess, HMODULE hModule, DETOUR_EXE_RESTOR
 
     der.pidh = (PBYTE)hModule;
     der.cbidh = sizeof(der.idh);
-    if (!ReadProcessMemory(hProcess, der.pidh, &der.idh, sizeof(der.idh), NULL)) {
+    if (!ReadHeaders(hProcess, hModule, pPage, der.pidh, &der.idh, sizeof(der.idh))) {
         DETOUR_TRACE(("ReadProcessMemory(idh@%p..%p) failed: %d\n",
                       der.pidh, der.pidh + der.cbidh, GetLastError()));
         return FALSE;
@@ -268,7 +327,7 @@ static BOOL RecordExeRestore(HANDLE hProcess, HMODULE hModule, DETOUR_EXE_RESTOR
     // First we read just the Signature and FileHeader.
     der.pinh = der.pidh + der.idh.e_lfanew;
     der.cbinh = FIELD_OFFSET(IMAGE_NT_HEADERS, OptionalHeader);
-    if (!ReadProcessMemory(hProcess, der.pinh, &der.inh, der.cbinh, NULL)) {
+    if (!ReadHeaders(hProcess, hModule, pPage, der.pinh, &der.inh, der.cbinh)) {
         DETOUR_TRACE(("ReadProcessMemory(inh@%p..%p) failed: %d\n",
                       der.pinh, der.pinh + der.cbinh, GetLastError()));
         return FALSE;
@@ -283,7 +342,7 @@ static BOOL RecordExeRestore(HANDLE hProcess, HMODULE hModule, DETOUR_EXE_RESTOR
         return FALSE;
     }
 
-    if (!ReadProcessMemory(hProcess, der.pinh, &der.inh, der.cbinh, NULL)) {
+    if (!ReadHeaders(hProcess, hModule, pPage, der.pinh, &der.inh, der.cbinh)) {
         DETOUR_TRACE(("ReadProcessMemory(inh@%p..%p) failed: %d\n",
                       der.pinh, der.pinh + der.cbinh, GetLastError()));
         return FALSE;
@@ -485,7 +544,7 @@ static BOOL UpdateFrom32To64(HANDLE hProcess, HMODULE hModule, WORD machine,
     DETOUR_TRACE(("WriteProcessMemory(ish@%p..%p)\n", psects, psects + cb));
 
     // Record the updated headers.
-    if (!RecordExeRestore(hProcess, hModule, der)) {
+    if (!RecordExeRestore(hProcess, hModule, der, NULL)) {
         return FALSE;
     }
 
@@ -595,7 +654,15 @@ BOOL WINAPI DetourUpdateProcessWithDllEx(_In_ HANDLE hProcess,
 
     IMAGE_NT_HEADERS32 inh;
 
-    if (hModule == NULL || LoadNtHeaderFromProcess(hProcess, hModule, &inh) == NULL) {
+    if (hModule == NULL) {
+        SetLastError(ERROR_INVALID_OPERATION);
+        return FALSE;
+    }
+
+    DETOUR_HEADERS_PAGE page;
+    ReadHeadersPage(hProcess, hModule, page);
+
+    if (LoadNtHeaderFromProcess(hProcess, hModule, &inh, &page) == NULL) {
         SetLastError(ERROR_INVALID_OPERATION);
         return FALSE;
     }
@@ -617,7 +684,7 @@ BOOL WINAPI DetourUpdateProcessWithDllEx(_In_ HANDLE hProcess,
     //
     DETOUR_EXE_RESTORE der;
 
-    if (!RecordExeRestore(hProcess, hModule, der)) {
+    if (!RecordExeRestore(hProcess, hModule, der, &page)) {
         return FALSE;
     }
 
@@ -646,6 +713,9 @@ BOOL WINAPI DetourUpdateProcessWithDllEx(_In_ HANDLE hProcess,
             return FALSE;
         }
         bIs32BitExe = FALSE;
+
+        // The headers were just rewritten in the process.
+        page.cbValid = 0;
     }
 #endif // DETOURS_64BIT
 
@@ -654,7 +724,7 @@ BOOL WINAPI DetourUpdateProcessWithDllEx(_In_ HANDLE hProcess,
 #if defined(DETOURS_32BIT)
     if (bIs32BitProcess) {
         // 32-bit native or 32-bit managed process on any platform.
-        if (!UpdateImports32(hProcess, hModule, rlpDlls, nDlls)) {
+        if (!UpdateImports32(hProcess, hModule, rlpDlls, nDlls, &page)) {
             return FALSE;
         }
     }
@@ -676,7 +746,7 @@ BOOL WINAPI DetourUpdateProcessWithDllEx(_In_ HANDLE hProcess,
     }
     else {
         // 64-bit native or 64-bit managed process on any platform.
-        if (!UpdateImports64(hProcess, hModule, rlpDlls, nDlls)) {
+        if (!UpdateImports64(hProcess, hModule, rlpDlls, nDlls, &page)) {
             return FALSE;
         }
     }
@@ -863,48 +933,39 @@ BOOL WINAPI DetourCopyPayloadToProcess(_In_ HANDLE hProcess,
         return FALSE;
     }
 
-    PBYTE pbTarget = pbBase;
-    IMAGE_DOS_HEADER idh;
-    IMAGE_NT_HEADERS inh;
-    IMAGE_SECTION_HEADER ish;
-    DETOUR_SECTION_HEADER dsh;
-    DETOUR_SECTION_RECORD dsr;
-    SIZE_T cbWrote = 0;
-
-    ZeroMemory(&idh, sizeof(idh));
-    idh.e_magic = IMAGE_DOS_SIGNATURE;
-    idh.e_lfanew = sizeof(idh);
-    if (!WriteProcessMemory(hProcess, pbTarget, &idh, sizeof(idh), &cbWrote) ||
-        cbWrote != sizeof(idh)) {
-        DETOUR_TRACE(("WriteProcessMemory(idh) failed: %d\n", GetLastError()));
+    // The whole payload is put together here first, and then written to the
+    // target in one go, rather than with a write for each of its parts.
+    PBYTE pbStaged = new NOTHROW BYTE [cbTotal];
+    if (pbStaged == NULL) {
+        VirtualFreeEx(hProcess, pbBase, 0, MEM_RELEASE);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
         return FALSE;
     }
-    pbTarget += sizeof(idh);
-
-    ZeroMemory(&inh, sizeof(inh));
-    inh.Signature = IMAGE_NT_SIGNATURE;
-    inh.FileHeader.SizeOfOptionalHeader = sizeof(inh.OptionalHeader);
-    inh.FileHeader.Characteristics = IMAGE_FILE_DLL;
-    inh.FileHeader.NumberOfSections = 1;
-    inh.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR_MAGIC;
-    if (!WriteProcessMemory(hProcess, pbTarget, &inh, sizeof(inh), &cbWrote) ||
-        cbWrote != sizeof(inh)) {
-        return FALSE;
-    }
-    pbTarget += sizeof(inh);
-
-    ZeroMemory(&ish, sizeof(ish));
-    memcpy(ish.Name, ".detour", sizeof(ish.Name));
-    ish.VirtualAddress = (DWORD)((pbTarget + sizeof(ish)) - pbBase);
-    ish.SizeOfRawData = (sizeof(DETOUR_SECTION_HEADER) +
-                         sizeof(DETOUR_SECTION_RECORD) +
-                         cbData);
-    if (!WriteProcessMemory(hProcess, pbTarget, &ish, sizeof(ish), &cbWrote) ||
-        cbWrote != sizeof(ish)) {
-        return FALSE;
-    }
-    pbTarget += sizeof(ish);
+    ZeroMemory(pbStaged, cbTotal);
+
+    PBYTE pbTarget = pbStaged;
+    PIMAGE_DOS_HEADER pidh = (PIMAGE_DOS_HEADER)pbTarget;
+    pidh->e_magic = IMAGE_DOS_SIGNATURE;
+    pidh->e_lfanew = sizeof(*pidh);
+    pbTarget += sizeof(*pidh);
+
+    PIMAGE_NT_HEADERS pinh = (PIMAGE_NT_HEADERS)pbTarget;
+    pinh->Signature = IMAGE_NT_SIGNATURE;
+    pinh->FileHeader.SizeOfOptionalHeader = sizeof(pinh->OptionalHeader);
+    pinh->FileHeader.Characteristics = IMAGE_FILE_DLL;
+    pinh->FileHeader.NumberOfSections = 1;
+    pinh->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR_MAGIC;
+    pbTarget += sizeof(*pinh);
+
+    PIMAGE_SECTION_HEADER pish = (PIMAGE_SECTION_HEADER)pbTarget;
+    memcpy(pish->Name, ".detour", sizeof(pish->Name));
+    pish->VirtualAddress = (DWORD)((pbTarget + sizeof(*pish)) - pbStaged);
+    pish->SizeOfRawData = (sizeof(DETOUR_SECTION_HEADER) +
+                           sizeof(DETOUR_SECTION_RECORD) +
+                           cbData);
+    pbTarget += sizeof(*pish);
 
+    DETOUR_SECTION_HEADER dsh;
     ZeroMemory(&dsh, sizeof(dsh));
     dsh.cbHeaderSize = sizeof(dsh);
     dsh.nSignature = DETOUR_SECTION_HEADER_SIGNATURE;
@@ -912,30 +973,30 @@ BOOL WINAPI DetourCopyPayloadToProcess(_In_ HANDLE hProcess,
     dsh.cbDataSize = (sizeof(DETOUR_SECTION_HEADER) +
                       sizeof(DETOUR_SECTION_RECORD) +
                       cbData);
-    if (!WriteProcessMemory(hProcess, pbTarget, &dsh, sizeof(dsh), &cbWrote) ||
-        cbWrote != sizeof(dsh)) {
-        return FALSE;
-    }
+    CopyMemory(pbTarget, &dsh, sizeof(dsh));
     pbTarget += sizeof(dsh);
 
+    DETOUR_SECTION_RECORD dsr;
     ZeroMemory(&dsr, sizeof(dsr));
     dsr.cbBytes = cbData + sizeof(DETOUR_SECTION_RECORD);
     dsr.nReserved = 0;
     dsr.guid = rguid;
-    if (!WriteProcessMemory(hProcess, pbTarget, &dsr, sizeof(dsr), &cbWrote) ||
-        cbWrote != sizeof(dsr)) {
-        return FALSE;
-    }
+    CopyMemory(pbTarget, &dsr, sizeof(dsr));
     pbTarget += sizeof(dsr);
 
-    if (!WriteProcessMemory(hProcess, pbTarget, pvData, cbData, &cbWrote) ||
-        cbWrote != cbData) {
+    CopyMemory(pbTarget, pvData, cbData);
+
+    SIZE_T cbWrote = 0;
+    BOOL fWrote = WriteProcessMemory(hProcess, pbBase, pbStaged, cbTotal, &cbWrote) &&
+        cbWrote == cbTotal;
+    delete[] pbStaged;
+    if (!fWrote) {
+        DETOUR_TRACE(("WriteProcessMemory(payload) failed: %d\n", GetLastError()));
         return FALSE;
     }
-    pbTarget += cbData;
 
     DETOUR_TRACE(("Copied %d byte payload into target process at %p\n",
-                  cbTotal, pbTarget - cbTotal));
+                  cbTotal, pbBase));
     return TRUE;
 }
 
@@ -1325,6 +1325,18 @@ struct DetourOperation
     ULONG               dwPerm;
 };
 
+// True if the pages of pbInner..pbInner+cbInner are all among the pages of
+// pbOuter..pbOuter+cbOuter, and so had their protection changed along with them.
+static BOOL detour_same_pages(PBYTE pbOuter, ULONG cbOuter, PBYTE pbInner, ULONG cbInner)
+{
+    const ULONG_PTR cbPage = 0x1000;
+    ULONG_PTR nOuterLo = (ULONG_PTR)pbOuter & ~(cbPage - 1);
+    ULONG_PTR nOuterHi = ((ULONG_PTR)pbOuter + cbOuter - 1) & ~(cbPage - 1);
+    ULONG_PTR nInnerLo = (ULONG_PTR)pbInner & ~(cbPage - 1);
+    ULONG_PTR nInnerHi = ((ULONG_PTR)pbInner + cbInner - 1) & ~(cbPage - 1);
+    return nInnerLo >= nOuterLo && nInnerHi <= nOuterHi;
+}
+
 static BOOL                 s_fIgnoreTooSmall       = FALSE;
 static BOOL                 s_fRetainRegions        = FALSE;
 
@@ -1687,13 +1699,28 @@ typedef ULONG_PTR DETOURS_EIP_TYPE;
 #undef DETOURS_EIP
     }
 
-    // Restore all of the page permissions and flush the icache.
+    // Restore all of the page permissions and flush the icache.  Operations on
+    // targets that share pages with the one before them were already handled
+    // along with it.
     HANDLE hProcess = GetCurrentProcess();
+    PBYTE pbRestored = NULL;
+    ULONG cbRestored = 0;
+    ULONG dwRestored = 0;
     for (o = s_pPendingOperations; o != NULL;) {
-        // We don't care if this fails, because the code is still accessible.
-        DWORD dwOld;
-        VirtualProtect(o->pbTarget, o->pTrampoline->cbRestore, o->dwPerm, &dwOld);
-        FlushInstructionCache(hProcess, o->pbTarget, o->pTrampoline->cbRestore);
+        if (pbRestored == NULL || o->dwPerm != dwRestored ||
+            !detour_same_pages(pbRestored, cbRestored, o->pbTarget, o->pTrampoline->cbRestore)) {
+
+            // We don't care if this fails, because the code is still accessible.
+            DWORD dwOld;
+            pbRestored = o->pbTarget;
+            cbRestored = o->pTrampoline->cbRestore;
+            dwRestored = o->dwPerm;
+            VirtualProtect(pbRestored, cbRestored, dwRestored, &dwOld);
+            FlushInstructionCache(hProcess, pbRestored, cbRestored);
+        }
+        else {
+            FlushInstructionCache(hProcess, o->pbTarget, o->pTrampoline->cbRestore);
+        }
 
         if (o->fIsRemove && o->pTrampoline) {
             detour_free_trampoline(o->pTrampoline);
@@ -1948,6 +1975,10 @@ LONG WINAPI DetourAttachEx(_Inout_ PVOID *ppPointer,
     }
 #endif
 
+    // The decoded prologue is not kept for later attaches of the same target:
+    // once a detour is committed, the target starts with that detour's jump,
+    // which is all a later attach (e.g. of a stacked fixup) decodes and
+    // relocates, and within one transaction a target only takes one detour.
     while (cbTarget < cbJump) {
         PBYTE pbOp = pbSrc;
         LONG lExtra = 0;
@@ -2099,8 +2130,15 @@ LONG WINAPI DetourAttachEx(_Inout_ PVOID *ppPointer,
 
     (void)pbTrampoline;
 
+    // Targets that are attached in address order often share their pages with
+    // the target of the operation before them, which made them writable already.
     DWORD dwOld = 0;
-    if (!VirtualProtect(pbTarget, cbTarget, PAGE_EXECUTE_READWRITE, &dwOld)) {
+    DetourOperation *p = s_pPendingOperations;
+    if (p != NULL && p->pTrampoline != NULL &&
+        detour_same_pages(p->pbTarget, p->pTrampoline->cbRestore, pbTarget, cbTarget)) {
+        dwOld = p->dwPerm;
+    }
+    else if (!VirtualProtect(pbTarget, cbTarget, PAGE_EXECUTE_READWRITE, &dwOld)) {
         error = GetLastError();
         DETOUR_BREAK();
         goto fail;
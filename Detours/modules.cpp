@@ -164,6 +164,10 @@ PDETOUR_SYM_INFO DetourLoadImageHlp(VOID)
     return pSymInfo;
 }
 
+// Nothing here caches modules or exports: the loader already keeps the
+// export lookup behind GetProcAddress, the enumeration below only walks
+// regions for the few callers that ask for every module, and the PSF
+// runtime parses the executable's headers just once, while attaching.
 PVOID WINAPI DetourFindFunction(_In_ PCSTR pszModule,
                                 _In_ PCSTR pszFunction)
 {
@@ -845,19 +849,189 @@ PVOID WINAPI DetourFindPayload(_In_opt_ HMODULE hModule,
     }
 }
 
+//////////////////////////////////////////////////////////// Payload Directory.
+//
+// Payloads are copied into a process before it starts running, each in a
+// region of its own that can only be told apart from the rest of the address
+// space by walking all of it.  So that looking up the restore, helper and
+// configuration payloads while a process starts doesn't walk it once for
+// each (and all of it for each payload that isn't there), the first lookup
+// records every payload that it comes across, sorted by GUID, and the ones
+// after it binary search that.
+//
+// NOTE: The payloads of modules that are loaded after the first lookup are
+//       only found by DetourFindPayload, given their module.
+
+struct _DETOUR_PAYLOAD_ENTRY
+{
+    GUID    guid;
+    PBYTE   pbData;
+    DWORD   cbData;
+};
+
+struct _DETOUR_PAYLOAD_DIRECTORY
+{
+    DWORD                   cEntries;
+    _DETOUR_PAYLOAD_ENTRY * pEntries;
+};
+
+static _DETOUR_PAYLOAD_DIRECTORY * volatile s_pPayloadDirectory = NULL;
+
+static BOOL AddPayloadToDirectory(_DETOUR_PAYLOAD_DIRECTORY *pDirectory,
+                                  DWORD *pcAllocated,
+                                  const _DETOUR_PAYLOAD_ENTRY &entry)
+{
+    if (pDirectory->cEntries == *pcAllocated) {
+        DWORD cAllocated = (*pcAllocated == 0) ? 8 : *pcAllocated * 2;
+        _DETOUR_PAYLOAD_ENTRY *pEntries = new NOTHROW _DETOUR_PAYLOAD_ENTRY [cAllocated];
+        if (pEntries == NULL) {
+            return FALSE;
+        }
+        if (pDirectory->pEntries != NULL) {
+            CopyMemory(pEntries, pDirectory->pEntries,
+                       pDirectory->cEntries * sizeof(_DETOUR_PAYLOAD_ENTRY));
+            delete[] pDirectory->pEntries;
+        }
+        pDirectory->pEntries = pEntries;
+        *pcAllocated = cAllocated;
+    }
+
+    // Inserted after any others with the same GUID, so that a lookup finds
+    // the same payload that a walk of the modules in order would.
+    DWORD n = pDirectory->cEntries;
+    while (n > 0 && memcmp(&pDirectory->pEntries[n - 1].guid, &entry.guid, sizeof(GUID)) > 0) {
+        pDirectory->pEntries[n] = pDirectory->pEntries[n - 1];
+        n--;
+    }
+    pDirectory->pEntries[n] = entry;
+    pDirectory->cEntries++;
+    return TRUE;
+}
+
+static BOOL AddModulePayloadsToDirectory(_DETOUR_PAYLOAD_DIRECTORY *pDirectory,
+                                         DWORD *pcAllocated,
+                                         HMODULE hModule)
+{
+    PDETOUR_LOADED_BINARY pBinary = GetPayloadSectionFromModule(hModule);
+    if (pBinary == NULL) {
+        return TRUE;
+    }
+
+    __try {
+        DETOUR_SECTION_HEADER *pHeader = (DETOUR_SECTION_HEADER *)pBinary;
+        if (pHeader->cbHeaderSize < sizeof(DETOUR_SECTION_HEADER) ||
+            pHeader->nSignature != DETOUR_SECTION_HEADER_SIGNATURE) {
+            return TRUE;
+        }
+
+        PBYTE pbBeg = ((PBYTE)pHeader) + pHeader->nDataOffset;
+        PBYTE pbEnd = ((PBYTE)pHeader) + pHeader->cbDataSize;
+
+        for (PBYTE pbData = pbBeg; pbData < pbEnd;) {
+            DETOUR_SECTION_RECORD *pSection = (DETOUR_SECTION_RECORD *)pbData;
+            if (pSection->cbBytes < sizeof(*pSection)) {
+                break;
+            }
+
+            _DETOUR_PAYLOAD_ENTRY entry;
+            entry.guid = pSection->guid;
+            entry.pbData = (PBYTE)(pSection + 1);
+            entry.cbData = pSection->cbBytes - sizeof(*pSection);
+            if (!AddPayloadToDirectory(pDirectory, pcAllocated, entry)) {
+                return FALSE;
+            }
+
+            pbData = (PBYTE)pSection + pSection->cbBytes;
+        }
+        return TRUE;
+    }
+    __except(GetExceptionCode() == EXCEPTION_ACCESS_VIOLATION ?
+             EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return TRUE;
+    }
+}
+
+static _DETOUR_PAYLOAD_DIRECTORY * GetPayloadDirectory()
+{
+    _DETOUR_PAYLOAD_DIRECTORY *pDirectory = s_pPayloadDirectory;
+    if (pDirectory != NULL) {
+        return pDirectory;
+    }
+
+    pDirectory = new NOTHROW _DETOUR_PAYLOAD_DIRECTORY;
+    if (pDirectory == NULL) {
+        return NULL;
+    }
+    pDirectory->cEntries = 0;
+    pDirectory->pEntries = NULL;
+
+    DWORD cAllocated = 0;
+    for (HMODULE hMod = NULL; (hMod = DetourEnumerateModules(hMod)) != NULL;) {
+        if (!AddModulePayloadsToDirectory(pDirectory, &cAllocated, hMod)) {
+            delete[] pDirectory->pEntries;
+            delete pDirectory;
+            return NULL;
+        }
+    }
+
+    // Another thread may have built the directory at the same time.
+    _DETOUR_PAYLOAD_DIRECTORY *pExisting = (_DETOUR_PAYLOAD_DIRECTORY *)
+        InterlockedCompareExchangePointer((PVOID volatile *)&s_pPayloadDirectory,
+                                          pDirectory, NULL);
+    if (pExisting != NULL) {
+        delete[] pDirectory->pEntries;
+        delete pDirectory;
+        return pExisting;
+    }
+    return pDirectory;
+}
+
 _Writable_bytes_(*pcbData)
 _Readable_bytes_(*pcbData)
 _Success_(return != NULL)
 PVOID WINAPI DetourFindPayloadEx(_In_ REFGUID rguid,
                                  _Out_ DWORD * pcbData)
 {
-    for (HMODULE hMod = NULL; (hMod = DetourEnumerateModules(hMod)) != NULL;) {
-        PVOID pvData;
+    if (pcbData) {
+        *pcbData = 0;
+    }
+
+    _DETOUR_PAYLOAD_DIRECTORY *pDirectory = GetPayloadDirectory();
+    if (pDirectory == NULL) {
+        // Without the memory for the directory, fall back to walking the
+        // modules for this lookup alone.
+        for (HMODULE hMod = NULL; (hMod = DetourEnumerateModules(hMod)) != NULL;) {
+            PVOID pvData;
 
-        pvData = DetourFindPayload(hMod, rguid, pcbData);
-        if (pvData != NULL) {
-            return pvData;
+            pvData = DetourFindPayload(hMod, rguid, pcbData);
+            if (pvData != NULL) {
+                return pvData;
+            }
+        }
+        SetLastError(ERROR_MOD_NOT_FOUND);
+        return NULL;
+    }
+
+    // The first entry with the GUID, if there is one.
+    DWORD nLow = 0;
+    DWORD nHigh = pDirectory->cEntries;
+    while (nLow < nHigh) {
+        DWORD nMid = nLow + (nHigh - nLow) / 2;
+        if (memcmp(&pDirectory->pEntries[nMid].guid, &rguid, sizeof(GUID)) < 0) {
+            nLow = nMid + 1;
         }
+        else {
+            nHigh = nMid;
+        }
+    }
+
+    if (nLow < pDirectory->cEntries &&
+        memcmp(&pDirectory->pEntries[nLow].guid, &rguid, sizeof(GUID)) == 0 &&
+        pcbData) {
+
+        *pcbData = pDirectory->pEntries[nLow].cbData;
+        SetLastError(NO_ERROR);
+        return pDirectory->pEntries[nLow].pbData;
     }
     SetLastError(ERROR_MOD_NOT_FOUND);
     return NULL;
@@ -18,7 +18,8 @@
 static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
                               HMODULE hModule,
                               __in_ecount(nDlls) LPCSTR *plpDlls,
-                              DWORD nDlls)
+                              DWORD nDlls,
+                              const DETOUR_HEADERS_PAGE *pPage)
 {
     BOOL fSucceeded = FALSE;
     DWORD cbNew = 0;
@@ -32,8 +33,7 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
 
     IMAGE_DOS_HEADER idh;
     ZeroMemory(&idh, sizeof(idh));
-    if (!ReadProcessMemory(hProcess, pbModule, &idh, sizeof(idh), &cbRead)
-        || cbRead < sizeof(idh)) {
+    if (!ReadHeaders(hProcess, hModule, pPage, pbModule, &idh, sizeof(idh))) {
 
         DETOUR_TRACE(("ReadProcessMemory(idh@%p..%p) failed: %d\n",
                       pbModule, pbModule + sizeof(idh), GetLastError()));
@@ -49,8 +49,7 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
     IMAGE_NT_HEADERS_XX inh;
     ZeroMemory(&inh, sizeof(inh));
 
-    if (!ReadProcessMemory(hProcess, pbModule + idh.e_lfanew, &inh, sizeof(inh), &cbRead)
-        || cbRead < sizeof(inh)) {
+    if (!ReadHeaders(hProcess, hModule, pPage, pbModule + idh.e_lfanew, &inh, sizeof(inh))) {
         DETOUR_TRACE(("ReadProcessMemory(inh@%p..%p) failed: %d\n",
                       pbModule + idh.e_lfanew,
                       pbModule + idh.e_lfanew + sizeof(inh),
@@ -78,9 +77,8 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
         IMAGE_SECTION_HEADER ish;
         ZeroMemory(&ish, sizeof(ish));
 
-        if (!ReadProcessMemory(hProcess, pbModule + dwSec + sizeof(ish) * i, &ish,
-                               sizeof(ish), &cbRead)
-            || cbRead < sizeof(ish)) {
+        if (!ReadHeaders(hProcess, hModule, pPage, pbModule + dwSec + sizeof(ish) * i, &ish,
+                         sizeof(ish))) {
 
             DETOUR_TRACE(("ReadProcessMemory(ish@%p..%p) failed: %d\n",
                           pbModule + dwSec + sizeof(ish) * i,
@@ -244,12 +242,7 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
 
     inh.OptionalHeader.CheckSum = 0;
 
-    if (!WriteProcessMemory(hProcess, pbModule, &idh, sizeof(idh), NULL)) {
-        DETOUR_TRACE(("WriteProcessMemory(idh) failed: %d\n", GetLastError()));
-        goto finish;
-    }
-    DETOUR_TRACE(("WriteProcessMemory(idh:%p..%p)\n", pbModule, pbModule + sizeof(idh)));
-
+    // The DOS header is unchanged, so only the NT header is written back.
     if (!WriteProcessMemory(hProcess, pbModule + idh.e_lfanew, &inh, sizeof(inh), NULL)) {
         DETOUR_TRACE(("WriteProcessMemory(inh) failed: %d\n", GetLastError()));
         goto finish;
@@ -0,0 +1,429 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <windows.h>
+
+#include <compiled_config.h>
+#include <rapidjson/document.h>
+#include <rapidjson/encodedstream.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/filereadstream.h>
+#include <utilities.h>
+
+// Lays out the tables of a compiled config while walking the DOM. Strings and keys are pooled so that each distinct
+// string - e.g. the "dll" and "config" keys that every fixup has - is only stored once
+class config_compiler
+{
+public:
+    std::uint32_t add(const rapidjson::Value& value)
+    {
+        switch (value.GetType())
+        {
+        case rapidjson::kNullType:
+            return psf::make_compiled_config_value(psf::json_type::null, 0);
+
+        case rapidjson::kFalseType:
+        case rapidjson::kTrueType:
+            return psf::make_compiled_config_value(psf::json_type::boolean, value.GetBool() ? 1 : 0);
+
+        case rapidjson::kNumberType:
+            return make_value(psf::json_type::number, add_number(value));
+
+        case rapidjson::kStringType:
+            return make_value(psf::json_type::string, add_string(std::string_view(value.GetString(), value.GetStringLength())));
+
+        case rapidjson::kObjectType:
+            return make_value(psf::json_type::object, add_object(value));
+
+        case rapidjson::kArrayType:
+            return make_value(psf::json_type::array, add_array(value));
+        }
+
+        throw std::runtime_error("Unexpected JSON value type");
+    }
+
+    bool write(const std::filesystem::path& path, std::uint32_t root) const
+    {
+        psf::compiled_config_header header{};
+        header.magic = psf::compiled_config_magic;
+        header.version = psf::compiled_config_version;
+        header.root = root;
+        header.number_count = static_cast<std::uint32_t>(m_numbers.size());
+        header.string_count = static_cast<std::uint32_t>(m_strings.size());
+        header.object_count = static_cast<std::uint32_t>(m_objects.size());
+        header.array_count = static_cast<std::uint32_t>(m_arrays.size());
+        header.member_count = static_cast<std::uint32_t>(m_members.size());
+        header.element_count = static_cast<std::uint32_t>(m_elements.size());
+        header.wide_length = static_cast<std::uint32_t>(m_wide.size());
+        header.narrow_length = static_cast<std::uint32_t>(m_narrow.size());
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        auto writeTable = [&](const auto& table)
+        {
+            file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(table[0]));
+        };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeTable(m_numbers);
+        writeTable(m_strings);
+        writeTable(m_objects);
+        writeTable(m_arrays);
+        writeTable(m_members);
+        writeTable(m_elements);
+        writeTable(m_wide);
+        writeTable(m_narrow);
+
+        file.close();
+        return static_cast<bool>(file);
+    }
+
+    std::size_t value_count() const noexcept
+    {
+        return m_numbers.size() + m_strings.size() + m_objects.size() + m_arrays.size();
+    }
+
+private:
+    static std::uint32_t make_value(psf::json_type type, std::size_t index)
+    {
+        if (index > psf::compiled_config_max_index)
+        {
+            throw std::runtime_error("Too many values to compile");
+        }
+
+        return psf::make_compiled_config_value(type, static_cast<std::uint32_t>(index));
+    }
+
+    template <typename T>
+    static std::uint32_t checked_size(const T& table)
+    {
+        if (table.size() > std::numeric_limits<std::uint32_t>::max())
+        {
+            throw std::runtime_error("Config is too large to compile");
+        }
+
+        return static_cast<std::uint32_t>(table.size());
+    }
+
+    // Mirrors the PSF Runtime's parser, which stores non-negative integers as unsigned and negative ones as signed
+    std::size_t add_number(const rapidjson::Value& value)
+    {
+        psf::compiled_config_number number{};
+        if (value.IsDouble())
+        {
+            auto floatValue = value.GetDouble();
+            number.kind = 2;
+            std::memcpy(&number.bits, &floatValue, sizeof(number.bits));
+        }
+        else if (value.IsUint64())
+        {
+            number.kind = 1;
+            number.bits = value.GetUint64();
+        }
+        else
+        {
+            number.kind = 0;
+            number.bits = static_cast<std::uint64_t>(value.GetInt64());
+        }
+
+        m_numbers.push_back(number);
+        return m_numbers.size() - 1;
+    }
+
+    // Returns the offset of the string in the narrow table
+    std::uint32_t add_narrow(std::string_view str)
+    {
+        auto [itr, inserted] = m_narrowOffsets.emplace(std::string(str), checked_size(m_narrow));
+        if (inserted)
+        {
+            m_narrow.insert(m_narrow.end(), str.begin(), str.end());
+            m_narrow.push_back('\0');
+        }
+
+        return itr->second;
+    }
+
+    std::size_t add_string(std::string_view str)
+    {
+        if (auto itr = m_stringIndices.find(str); itr != m_stringIndices.end())
+        {
+            return itr->second;
+        }
+
+        auto wide = widen(str);
+        psf::compiled_config_string record{};
+        record.narrow_offset = add_narrow(str);
+        record.narrow_length = static_cast<std::uint32_t>(str.length());
+        record.wide_offset = checked_size(m_wide);
+        record.wide_length = static_cast<std::uint32_t>(wide.length());
+        m_wide.insert(m_wide.end(), wide.begin(), wide.end());
+        m_wide.push_back(L'\0');
+
+        m_strings.push_back(record);
+        m_stringIndices.emplace(std::string(str), m_strings.size() - 1);
+        return m_strings.size() - 1;
+    }
+
+    std::size_t add_object(const rapidjson::Value& value)
+    {
+        std::vector<const rapidjson::Value::Member*> members;
+        for (auto& member : value.GetObject())
+        {
+            members.push_back(&member);
+        }
+
+        auto keyOf = [](const rapidjson::Value::Member* member)
+        {
+            return std::string_view(member->name.GetString(), member->name.GetStringLength());
+        };
+        std::sort(members.begin(), members.end(), [&](auto lhs, auto rhs) { return keyOf(lhs) < keyOf(rhs); });
+
+        // Reserve the object's range of members before adding its values, which may add members of their own
+        auto index = m_objects.size();
+        auto first = checked_size(m_members);
+        m_objects.push_back(psf::compiled_config_container{ first, static_cast<std::uint32_t>(members.size()) });
+        m_members.resize(first + members.size());
+        for (std::size_t i = 0; i < members.size(); ++i)
+        {
+            auto key = keyOf(members[i]);
+            if ((i != 0) && (key == keyOf(members[i - 1])))
+            {
+                throw std::runtime_error("'" + std::string(key) + "' already exists in map");
+            }
+
+            auto memberValue = add(members[i]->value);
+            auto& member = m_members[first + i];
+            member.key_offset = add_narrow(key);
+            member.key_length = static_cast<std::uint32_t>(key.length());
+            member.value = memberValue;
+        }
+
+        return index;
+    }
+
+    std::size_t add_array(const rapidjson::Value& value)
+    {
+        auto index = m_arrays.size();
+        auto first = checked_size(m_elements);
+        m_arrays.push_back(psf::compiled_config_container{ first, value.Size() });
+        m_elements.resize(first + value.Size());
+        for (rapidjson::SizeType i = 0; i < value.Size(); ++i)
+        {
+            auto element = add(value[i]);
+            m_elements[first + i] = element;
+        }
+
+        return index;
+    }
+
+    std::vector<psf::compiled_config_number> m_numbers;
+    std::vector<psf::compiled_config_string> m_strings;
+    std::vector<psf::compiled_config_container> m_objects;
+    std::vector<psf::compiled_config_container> m_arrays;
+    std::vector<psf::compiled_config_member> m_members;
+    std::vector<psf::compiled_config_value> m_elements;
+    std::vector<wchar_t> m_wide;
+    std::vector<char> m_narrow;
+
+    std::map<std::string, std::uint32_t, std::less<>> m_narrowOffsets;
+    std::map<std::string, std::size_t, std::less<>> m_stringIndices;
+};
+
+// Checks the parts of the configuration that the PSF Runtime and PsfLauncher read, which they would otherwise only find
+// fault with at runtime, in every process: a missing or mistyped member makes the lookup that reaches it fail, and an
+// executable pattern that isn't a valid regular expression never matches anything
+class config_validator
+{
+public:
+    void validate(const rapidjson::Value& root)
+    {
+        if (auto applications = member(root, "applications", "applications"))
+        {
+            for_each_object(*applications, "applications", [&](const rapidjson::Value& application, const std::string& path)
+            {
+                required_string(application, "id", path);
+                required_string(application, "executable", path);
+            });
+        }
+
+        if (auto processes = member(root, "processes", "processes"))
+        {
+            for_each_object(*processes, "processes", [&](const rapidjson::Value& process, const std::string& path)
+            {
+                if (auto executable = required_string(process, "executable", path))
+                {
+                    validate_pattern(*executable, path + ".executable");
+                }
+
+                if (auto fixups = member(process, "fixups", path + ".fixups"))
+                {
+                    for_each_object(*fixups, path + ".fixups", [&](const rapidjson::Value& fixup, const std::string& fixupPath)
+                    {
+                        required_string(fixup, "dll", fixupPath);
+                    });
+                }
+            });
+        }
+    }
+
+    const std::vector<std::string>& errors() const noexcept
+    {
+        return m_errors;
+    }
+
+private:
+    // Returns the member if it's there, making sure that it's an array
+    const rapidjson::Value* member(const rapidjson::Value& object, const char* name, const std::string& path)
+    {
+        auto itr = object.FindMember(name);
+        if (itr == object.MemberEnd())
+        {
+            return nullptr;
+        }
+        else if (!itr->value.IsArray())
+        {
+            m_errors.push_back(path + " is not an array");
+            return nullptr;
+        }
+
+        return &itr->value;
+    }
+
+    template <typename Func>
+    void for_each_object(const rapidjson::Value& array, const std::string& path, Func&& func)
+    {
+        for (rapidjson::SizeType i = 0; i < array.Size(); ++i)
+        {
+            auto elementPath = path + "[" + std::to_string(i) + "]";
+            if (!array[i].IsObject())
+            {
+                m_errors.push_back(elementPath + " is not an object");
+                continue;
+            }
+            func(array[i], elementPath);
+        }
+    }
+
+    const rapidjson::Value* required_string(const rapidjson::Value& object, const char* name, const std::string& path)
+    {
+        auto itr = object.FindMember(name);
+        if (itr == object.MemberEnd())
+        {
+            m_errors.push_back(path + " has no '" + name + "'");
+            return nullptr;
+        }
+        else if (!itr->value.IsString())
+        {
+            m_errors.push_back(path + "." + name + " is not a string");
+            return nullptr;
+        }
+
+        return &itr->value;
+    }
+
+    // Compiled the same way as the PSF Runtime compiles it
+    void validate_pattern(const rapidjson::Value& pattern, const std::string& path)
+    {
+        auto wide = widen(std::string_view(pattern.GetString(), pattern.GetStringLength()));
+        try
+        {
+            std::wregex regex(wide.data(), wide.length());
+        }
+        catch (std::regex_error& e)
+        {
+            m_errors.push_back(path + " is not a valid regular expression: " + e.what());
+        }
+    }
+
+    std::vector<std::string> m_errors;
+};
+
+int wmain(int argc, wchar_t** argv)
+{
+    if ((argc < 2) || (argc > 3))
+    {
+        std::fwprintf(stderr, L"Usage: %ls <config.json path> [<output path>]\n", argv[0]);
+        std::fwprintf(stderr, L"    Compiles the configuration, by default to %ls in the same folder,\n", psf::compiled_config_file_name);
+        std::fwprintf(stderr, L"    so that the PSF Runtime does not need to parse it in every process.\n");
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::error_code ec;
+    auto configPath = std::filesystem::absolute(argv[1], ec);
+    auto outputPath = (argc == 3) ? std::filesystem::absolute(argv[2], ec) : (configPath.parent_path() / psf::compiled_config_file_name);
+
+#pragma warning(suppress:4996) // Nonsense warning; _wfopen is perfectly safe
+    auto file = _wfopen(configPath.c_str(), L"rb");
+    if (!file)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not open %ls\n", configPath.c_str());
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    // Read the same way as the PSF Runtime reads config.json, so that both accept the same files
+    char buffer[2048];
+    rapidjson::FileReadStream stream(file, buffer, std::size(buffer));
+    rapidjson::AutoUTFInputStream<char32_t, rapidjson::FileReadStream> autoStream(stream);
+
+    rapidjson::Document document;
+    document.ParseStream<rapidjson::kParseDefaultFlags, rapidjson::AutoUTF<char32_t>>(autoStream);
+    fclose(file);
+
+    if (document.HasParseError())
+    {
+        std::fwprintf(stderr, L"ERROR: %ls is not valid JSON: %hs (offset %zu)\n", configPath.c_str(),
+            rapidjson::GetParseError_En(document.GetParseError()), document.GetErrorOffset());
+        return ERROR_INVALID_DATA;
+    }
+    else if (!document.IsObject())
+    {
+        std::fwprintf(stderr, L"ERROR: The root of %ls is not an object\n", configPath.c_str());
+        return ERROR_INVALID_DATA;
+    }
+
+    config_validator validator;
+    validator.validate(document);
+    if (!validator.errors().empty())
+    {
+        for (auto& error : validator.errors())
+        {
+            std::fwprintf(stderr, L"ERROR: %hs\n", error.c_str());
+        }
+        std::fwprintf(stderr, L"ERROR: %ls is not a valid configuration\n", configPath.c_str());
+        return ERROR_INVALID_DATA;
+    }
+
+    config_compiler compiler;
+    std::uint32_t root = 0;
+    try
+    {
+        root = compiler.add(document);
+    }
+    catch (std::exception& e)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not compile %ls: %hs\n", configPath.c_str(), e.what());
+        return ERROR_INVALID_DATA;
+    }
+
+    if (!compiler.write(outputPath, root))
+    {
+        std::fwprintf(stderr, L"ERROR: Could not write %ls\n", outputPath.c_str());
+        return ERROR_WRITE_FAULT;
+    }
+
+    std::wprintf(L"Wrote %zu values to %ls\n", compiler.value_count(), outputPath.c_str());
+    return ERROR_SUCCESS;
+}
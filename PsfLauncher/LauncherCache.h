@@ -0,0 +1,349 @@
+#pragma once
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+
+#include <windows.h>
+#include <known_folders.h>
+#include <psf_runtime.h>
+#include <psf_utils.h>
+#include <utilities.h>
+#include <wil\resource.h>
+
+// Remembers what PsfLauncher found out about the machine and the package on earlier launches, so that later launches
+// don't have to probe for it all over again. The cache lives in the package's LocalCache, and so is per user. All of it
+// is thrown away when either the OS build or the package version changes, and the entries that could still change
+// without either of them changing are revalidated with a single file attribute query before they're used.
+class LauncherCache
+{
+public:
+    // NOTE: Only loaded on first use, so that launches that have nothing to look up don't pay for reading it, and saved
+    //       when the launcher exits
+    static LauncherCache& Instance()
+    {
+        static LauncherCache instance;
+        return instance;
+    }
+
+    LauncherCache(const LauncherCache&) = delete;
+    LauncherCache& operator=(const LauncherCache&) = delete;
+
+    ~LauncherCache()
+    {
+        Save();
+    }
+
+    // Where and how an application gets launched, with all of the variables in the configuration replaced
+    struct LaunchPlan
+    {
+        std::wstring executable;
+        std::wstring arguments;
+        std::wstring workingDirectory;
+    };
+
+    static std::filesystem::path CacheDirectory()
+    {
+        return KnownFolder(FOLDERID_LocalAppData) / L"Packages" / psf::current_package_family_name() / L"LocalCache";
+    }
+
+    // The full path of powershell.exe, or an empty string if PowerShell isn't installed
+    const std::wstring& PowershellPath()
+    {
+        // NOTE: Not finding PowerShell isn't remembered, since it's rare and PowerShell may still get installed
+        if (m_powershellPath.empty() || (::GetFileAttributesW(m_powershellPath.c_str()) == INVALID_FILE_ATTRIBUTES))
+        {
+            m_powershellPath = FindPowershell();
+            m_dirty = true;
+        }
+
+        return m_powershellPath;
+    }
+
+    // Whether the script exists, either as given or relative to 'currentDirectory'. Only scripts that are found within
+    // the package get remembered, since only those can't go away without the package version changing too
+    bool ScriptExists(const std::wstring& scriptPath, const std::filesystem::path& currentDirectory, const std::filesystem::path& packageRoot)
+    {
+        auto key = currentDirectory.native() + L"|" + scriptPath;
+        if (m_existingScripts.count(key))
+        {
+            return true;
+        }
+
+        //The file might be on a network drive.
+        std::filesystem::path powershellScriptPath(scriptPath);
+        if (std::filesystem::exists(powershellScriptPath))
+        {
+            if (powershellScriptPath.is_absolute() && IsWithin(powershellScriptPath, packageRoot))
+            {
+                Remember(std::move(key));
+            }
+            return true;
+        }
+
+        //Check on local computer.
+        auto localScriptPath = currentDirectory / powershellScriptPath;
+        if (std::filesystem::exists(localScriptPath))
+        {
+            if (IsWithin(localScriptPath, packageRoot))
+            {
+                Remember(std::move(key));
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    bool TryGetLaunchPlan(const std::wstring& applicationId, LaunchPlan& plan) const
+    {
+        auto itr = m_launchPlans.find(applicationId);
+        if (itr == m_launchPlans.end())
+        {
+            return false;
+        }
+
+        plan = itr->second;
+        return true;
+    }
+
+    void RememberLaunchPlan(const std::wstring& applicationId, const LaunchPlan& plan)
+    {
+        // The fields are separated by tabs in the file, so those that contain tabs just don't get remembered
+        for (auto field : { &applicationId, &plan.executable, &plan.arguments, &plan.workingDirectory })
+        {
+            if (field->find(L'\t') != std::wstring::npos)
+            {
+                return;
+            }
+        }
+
+        m_launchPlans[applicationId] = plan;
+        m_dirty = true;
+    }
+
+    // Records that the script has now run for this version of the package, telling whether it's the first time it has.
+    // Once recorded, this takes nothing more than one file attribute query, and since the marker is named after the
+    // package full name, a new version of the package runs the script again
+    HRESULT MarkScriptRun(std::wstring_view scriptName, bool& isFirstRun) noexcept try
+    {
+        isFirstRun = false;
+        auto marker = m_path.parent_path() / (L"PsfScriptHasRun-" + std::wstring(scriptName) + L"-" + m_packageFullName);
+        if (::GetFileAttributesW(marker.c_str()) != INVALID_FILE_ATTRIBUTES)
+        {
+            return S_OK;
+        }
+
+        // Launches before the markers existed recorded the same in the registry, with a single key for both scripts
+        std::wstring runOnceSubKey = L"SOFTWARE\\" + m_packageFullName + L"\\PSFScriptHasRun ";
+        wil::unique_hkey registryHandle;
+        bool hasRunBefore = (::RegOpenKeyExW(HKEY_CURRENT_USER, runOnceSubKey.c_str(), 0, KEY_READ, &registryHandle) == ERROR_SUCCESS);
+
+        std::error_code ec;
+        std::filesystem::create_directories(marker.parent_path(), ec);
+        wil::unique_hfile file(::CreateFileW(marker.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            // Another launch of the application may have just beaten us to it
+            RETURN_LAST_ERROR_IF(::GetLastError() != ERROR_FILE_EXISTS);
+            return S_OK;
+        }
+
+        isFirstRun = !hasRunBefore;
+        return S_OK;
+    }
+    CATCH_RETURN()
+
+private:
+
+    LauncherCache() :
+        m_path(CacheDirectory() / L"PsfLauncher.cache"),
+        m_buildNumber(std::to_wstring(GetBuildNumber())),
+        m_packageFullName(psf::current_package_full_name())
+    {
+        Load();
+    }
+
+    static DWORD GetBuildNumber() noexcept
+    {
+        // NOTE: Unlike GetVersionEx, RtlGetVersion doesn't depend on what the executable's manifest claims to support
+        using RtlGetVersionFn = LONG(WINAPI*)(PRTL_OSVERSIONINFOW);
+        auto rtlGetVersion = reinterpret_cast<RtlGetVersionFn>(::GetProcAddress(::GetModuleHandleW(L"ntdll.dll"), "RtlGetVersion"));
+
+        RTL_OSVERSIONINFOW info = { sizeof(info) };
+        if (rtlGetVersion && (rtlGetVersion(&info) == 0))
+        {
+            return info.dwBuildNumber;
+        }
+
+        return 0;
+    }
+
+    static std::wstring FindPowershell()
+    {
+        wil::unique_hkey registryHandle;
+        LSTATUS openResult = ::RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\PowerShell\\1", 0, KEY_READ, &registryHandle);
+        if (openResult == ERROR_FILE_NOT_FOUND)
+        {
+            // If the key cannot be found, powershell is not installed
+            return {};
+        }
+        else if (openResult != ERROR_SUCCESS)
+        {
+            THROW_HR_MSG(HRESULT_FROM_WIN32(openResult), "Error with getting the key to see if PowerShell is installed.");
+        }
+
+        DWORD valueFromRegistry = 0;
+        DWORD bufferSize = sizeof(valueFromRegistry);
+        THROW_IF_WIN32_ERROR_MSG(::RegGetValueW(registryHandle.get(), nullptr, L"Install", RRF_RT_REG_DWORD, nullptr, &valueFromRegistry, &bufferSize),
+            "Error with querying the key to see if PowerShell is installed.");
+        if (valueFromRegistry != 1)
+        {
+            return {};
+        }
+
+        wchar_t path[MAX_PATH];
+        bufferSize = sizeof(path);
+        if (::RegGetValueW(registryHandle.get(), L"ShellIds\\Microsoft.PowerShell", L"Path", RRF_RT_REG_SZ | RRF_RT_REG_EXPAND_SZ, nullptr, path, &bufferSize) == ERROR_SUCCESS)
+        {
+            return path;
+        }
+
+        // Older installations don't record the path, but Windows PowerShell has always lived here
+        return (KnownFolder(FOLDERID_System) / LR"(WindowsPowerShell\v1.0\powershell.exe)").native();
+    }
+
+    // Looked up through the PsfRuntime, which only does so once per process for all of its users
+    static std::filesystem::path KnownFolder(const GUID& id)
+    {
+        if (auto path = ::PSFQueryKnownFolder(id))
+        {
+            return path;
+        }
+
+        throw std::runtime_error("Failed to get known folder path");
+    }
+
+    static bool IsWithin(const std::filesystem::path& path, const std::filesystem::path& root) noexcept
+    {
+        auto& pathString = path.native();
+        auto& rootString = root.native();
+        return !rootString.empty() && (pathString.size() > rootString.size()) &&
+            (::_wcsnicmp(pathString.c_str(), rootString.c_str(), rootString.size()) == 0);
+    }
+
+    void Remember(std::wstring key)
+    {
+        m_existingScripts.insert(std::move(key));
+        m_dirty = true;
+    }
+
+    void Load()
+    {
+        std::ifstream file(m_path);
+        if (!file)
+        {
+            // First launch
+            m_dirty = true;
+            return;
+        }
+
+        std::wstring buildNumber;
+        std::wstring packageFullName;
+        std::wstring powershellPath;
+        std::set<std::wstring> existingScripts;
+        std::map<std::wstring, LaunchPlan> launchPlans;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            auto separator = line.find('=');
+            if (separator == std::string::npos)
+            {
+                continue;
+            }
+
+            auto name = std::string_view(line).substr(0, separator);
+            auto value = widen(std::string_view(line).substr(separator + 1));
+            if (name == "build")
+            {
+                buildNumber = std::move(value);
+            }
+            else if (name == "package")
+            {
+                packageFullName = std::move(value);
+            }
+            else if (name == "powershell")
+            {
+                powershellPath = std::move(value);
+            }
+            else if (name == "script")
+            {
+                existingScripts.insert(std::move(value));
+            }
+            else if (name == "launch")
+            {
+                // <application id>\t<executable>\t<arguments>\t<working directory>
+                auto first = value.find(L'\t');
+                auto second = (first == std::wstring::npos) ? first : value.find(L'\t', first + 1);
+                auto third = (second == std::wstring::npos) ? second : value.find(L'\t', second + 1);
+                if (third != std::wstring::npos)
+                {
+                    launchPlans[value.substr(0, first)] = LaunchPlan{
+                        value.substr(first + 1, second - first - 1),
+                        value.substr(second + 1, third - second - 1),
+                        value.substr(third + 1) };
+                }
+            }
+        }
+
+        if ((buildNumber != m_buildNumber) || (packageFullName != m_packageFullName))
+        {
+            // Left by an earlier OS build or package version
+            m_dirty = true;
+            return;
+        }
+
+        m_powershellPath = std::move(powershellPath);
+        m_existingScripts = std::move(existingScripts);
+        m_launchPlans = std::move(launchPlans);
+    }
+
+    void Save() noexcept try
+    {
+        if (!m_dirty)
+        {
+            return;
+        }
+
+        std::error_code ec;
+        std::filesystem::create_directories(m_path.parent_path(), ec);
+
+        std::ofstream file(m_path, std::ios::trunc);
+        file << "build=" << narrow(m_buildNumber) << "\n";
+        file << "package=" << narrow(m_packageFullName) << "\n";
+        file << "powershell=" << narrow(m_powershellPath) << "\n";
+        for (auto& script : m_existingScripts)
+        {
+            file << "script=" << narrow(script) << "\n";
+        }
+        for (auto& [applicationId, plan] : m_launchPlans)
+        {
+            file << "launch=" << narrow(applicationId) << "\t" << narrow(plan.executable) << "\t" <<
+                narrow(plan.arguments) << "\t" << narrow(plan.workingDirectory) << "\n";
+        }
+    }
+    catch (...)
+    {
+        // Failing to save just means that the next launch probes for everything again
+    }
+
+    std::filesystem::path m_path;
+    std::wstring m_buildNumber;
+    std::wstring m_packageFullName;
+    bool m_dirty = false;
+
+    std::wstring m_powershellPath;
+    std::set<std::wstring> m_existingScripts;
+    std::map<std::wstring, LaunchPlan> m_launchPlans;
+};
@@ -1,463 +1,623 @@
-#pragma once
-#include "psf_runtime.h"
-#include "StartProcessHelper.h"
-#include "Globals.h"
-#include <wil\resource.h>
-#include <known_folders.h>
-
-#ifndef SW_SHOW
-	#define SW_SHOW 5
-#endif
-
-#ifndef SW_HIDE
-	#define SW_HIDE 0
-#endif
-
-class PsfPowershellScriptRunner
-{
-public:
-	PsfPowershellScriptRunner() = default;
-
-	void Initialize(const psf::json_object* appConfig, const std::filesystem::path& currentDirectory, const std::filesystem::path& packageRootDirectory)
-	{
-		auto startScriptInformationObject = PSFQueryStartScriptInfo();
-		auto endScriptInformationObject = PSFQueryEndScriptInfo();
-
-		//If we want to run at least one script make sure powershell is installed on the computer.
-		if (startScriptInformationObject || endScriptInformationObject)
-		{
-			THROW_HR_IF_MSG(ERROR_NOT_SUPPORTED, !CheckIfPowershellIsInstalled(), "PowerShell is not installed.  Please install PowerShell to run scripts in PSF");
-		}
-
-		bool stopOnScriptError = false;
-		auto stopOnScriptErrorObject = appConfig->try_get("stopOnScriptError");
-		if (stopOnScriptErrorObject)
-		{
-			stopOnScriptError = stopOnScriptErrorObject->as_boolean().get();
-		}
-
-		std::wstring scriptExecutionMode = L"";
-		auto scriptExecutionModeObject = appConfig->try_get("scriptExecutionMode");  // supports options like "-ExecutionPolicy ByPass"
-		if (scriptExecutionModeObject)
-		{
-			scriptExecutionMode = scriptExecutionModeObject->as_string().wstring();
-		}
-
-		// Note: the following path must be kept in sync with the FileRedirectionFixup PathRedirection.cpp
-		std::filesystem::path writablePackageRootPath = psf::known_folder(FOLDERID_LocalAppData) / std::filesystem::path(L"Packages") / psf::current_package_family_name() / LR"(LocalCache\Local\Microsoft\WritablePackageRoot)";
-
-		if (startScriptInformationObject)
-		{
-			this->m_startingScriptInformation = MakeScriptInformation(startScriptInformationObject, stopOnScriptError, scriptExecutionMode, currentDirectory, packageRootDirectory, writablePackageRootPath);
-			this->m_startingScriptInformation.doesScriptExistInConfig = true;
-		}
-
-		if (endScriptInformationObject)
-		{
-			//Ending script ignores stopOnScriptError.  Keep it the default value
-			this->m_endingScriptInformation = MakeScriptInformation(endScriptInformationObject, false, scriptExecutionMode, currentDirectory, packageRootDirectory, writablePackageRootPath);
-			this->m_endingScriptInformation.doesScriptExistInConfig = true;
-
-			//Ending script ignores this value.  Keep true to make sure
-			//script runs on the current thread.
-			this->m_endingScriptInformation.waitForScriptToFinish = true;
-			this->m_endingScriptInformation.stopOnScriptError = false;
-		}
-	}
-
-	//RunStartingScript should return an error only if stopOnScriptError is true
-	void RunStartingScript()
-	{
-		LogString("StartingScript commandString", this->m_startingScriptInformation.commandString.c_str());
-		LogString("StartingScript currentDirectory", this->m_startingScriptInformation.currentDirectory.c_str());
-		if (this->m_startingScriptInformation.waitForScriptToFinish)
-		{
-			Log("StartingScript waitForScriptToFinish=true");
-		}
-		else
-		{
-			Log("StartingScript waitForScriptToFinish=false");
-		}
-		RunScript(this->m_startingScriptInformation);
-	}
-
-	void RunEndingScript()
-	{
-		LogString("EndingScript commandString", this->m_endingScriptInformation.commandString.c_str());
-		LogString("EndingScript currentDirectory", this->m_endingScriptInformation.currentDirectory.c_str());
-		RunScript(this->m_endingScriptInformation);
-	}
-
-private:
-   struct MyProcThreadAttributeList
-    {
-    private:
-        // To make sure the attribute value persists we cache it here.
-        // 0x02 is equivalent to PROCESS_CREATION_DESKTOP_APP_BREAKAWAY_DISABLE_PROCESS_TREE
-        // The documentation can be found here:
-        //https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-updateprocthreadattribute
-        // This attribute tells PSF to
-        // 1. Create Powershell in the same container as PSF.
-        // 2. Any windows Powershell makes will also be in the same container as PSF.
-        // This means that powershell, and any windows it makes, will have the same restrictions as PSF.
-        DWORD createInContainerAttribute = 0x02;
-        std::unique_ptr<_PROC_THREAD_ATTRIBUTE_LIST> attributeList;
-
-    public:
-
-        MyProcThreadAttributeList()
-        {
-            SIZE_T AttributeListSize{};
-            InitializeProcThreadAttributeList(nullptr, 1, 0, &AttributeListSize);
-
-            attributeList = std::unique_ptr<_PROC_THREAD_ATTRIBUTE_LIST>(reinterpret_cast<_PROC_THREAD_ATTRIBUTE_LIST*>(new char[AttributeListSize]));
-
-            THROW_LAST_ERROR_IF_MSG(
-                !InitializeProcThreadAttributeList(
-                    attributeList.get(),
-                    1,
-                    0,
-                    &AttributeListSize),
-                "Could not initialize the proc thread attribute list.");
-
-            // 18 stands for
-            // PROC_THREAD_ATTRIBUTE_DESKTOP_APP_POLICY
-            // this is the attribute value we want to add
-            THROW_LAST_ERROR_IF_MSG(
-                !UpdateProcThreadAttribute(
-                    attributeList.get(),
-                    0,
-                    ProcThreadAttributeValue(18, FALSE, TRUE, FALSE),
-                    &createInContainerAttribute,
-                    sizeof(createInContainerAttribute),
-                    nullptr,
-                    nullptr),
-                "Could not update Proc thread attribute.");
-        }
-
-        ~MyProcThreadAttributeList()
-        {
-            DeleteProcThreadAttributeList(attributeList.get());
-        }
-
-        LPPROC_THREAD_ATTRIBUTE_LIST get()
-        {
-            return attributeList.get();
-        }
-
-    };
-  
-	struct ScriptInformation
-	{
-		std::wstring scriptPath;
-		std::wstring commandString;
-		DWORD timeout = INFINITE;
-		bool shouldRunOnce = true;
-		int showWindowAction = SW_HIDE;
-		bool waitForScriptToFinish = true;
-		bool stopOnScriptError = false;
-		std::filesystem::path currentDirectory;
-		std::filesystem::path packageRoot;
-		bool doesScriptExistInConfig = false;
-	};
-
-	ScriptInformation m_startingScriptInformation;
-	ScriptInformation m_endingScriptInformation;
-	MyProcThreadAttributeList m_AttributeList;
-
-	void RunScript(ScriptInformation& script)
-	{
-		if (!script.doesScriptExistInConfig)
-		{
-			return;
-		}
-
-		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), !DoesScriptExist(script.scriptPath, script.currentDirectory));
-
-		bool canScriptRun = false;
-		THROW_IF_FAILED(CheckIfShouldRun(script.shouldRunOnce, canScriptRun));
-
-		if (!canScriptRun)
-		{
-			return;
-		}
-
-		if (script.waitForScriptToFinish)
-		{
-			HRESULT startScriptResult = StartProcess(nullptr, script.commandString.data(), script.currentDirectory.c_str(), script.showWindowAction, script.timeout, m_AttributeList.get());
-
-			if (script.stopOnScriptError)
-			{
-				THROW_IF_FAILED(startScriptResult);
-			}
-		}
-		else
-		{
-			//We don't want to stop on an error and we want to run async
-			std::thread(StartProcess, nullptr, script.commandString.data(), script.currentDirectory.c_str(), script.showWindowAction, script.timeout, m_AttributeList.get());
-		}
-	}
-
-	ScriptInformation MakeScriptInformation(const psf::json_object* scriptInformation, bool stopOnScriptError, std::wstring scriptExecutionMode, std::filesystem::path currentDirectory, std::filesystem::path packageRoot, std::filesystem::path packageWritableRoot)
-	{
-		ScriptInformation scriptStruct;
-		scriptStruct.scriptPath = ReplacePsuedoRootVariables(GetScriptPath(*scriptInformation), packageRoot, packageWritableRoot);
-		scriptStruct.commandString = ReplacePsuedoRootVariables(MakeCommandString(*scriptInformation, scriptExecutionMode, scriptStruct.scriptPath), packageRoot, packageWritableRoot);
-		scriptStruct.timeout = GetTimeout(*scriptInformation);
-		scriptStruct.shouldRunOnce = GetRunOnce(*scriptInformation);
-		scriptStruct.showWindowAction = GetShowWindowAction(*scriptInformation);
-		scriptStruct.waitForScriptToFinish = GetWaitForScriptToFinish(*scriptInformation);
-		scriptStruct.stopOnScriptError = stopOnScriptError;
-		scriptStruct.currentDirectory = currentDirectory;
-		scriptStruct.packageRoot = packageRoot;
-
-		//Async script run with a termination on failure is not a supported scenario.
-		//Supporting this scenario would mean force terminating an executing user process
-		//if the script fails.
-		if (stopOnScriptError && !scriptStruct.waitForScriptToFinish)
-		{
-			THROW_HR_MSG(HRESULT_FROM_WIN32(ERROR_BAD_CONFIGURATION), "PSF does not allow stopping on a script error and running asynchronously.  Please either remove stopOnScriptError or add a wait");
-		}
-
-		return scriptStruct;
-	}
-
-
-	std::wstring ReplacePsuedoRootVariables(std::wstring inString, std::filesystem::path packageRoot, std::filesystem::path packageWritableRoot)
-	{
-		//Allow for a substitution in the strings for a new pseudo variable %MsixPackageRoot% so that arguments can point to files
-		//inside the package using a syntax relative to the package root rather than rely on VFS pathing which can't kick in yet.
-		std::wstring outString = inString;
-		std::wstring var2rep1 = L"%MsixPackageRoot%";
-		std::wstring var2rep2 = L"%MsixWritablePackageRoot%";
-
-		std::wstring::size_type pos1 = 0u;
-		std::wstring repargs1 = packageRoot.c_str();
-		while ((pos1 = outString.find(var2rep1, pos1)) != std::string::npos) {
-			outString.replace(pos1, var2rep1.length(), repargs1);
-			pos1 += repargs1.length();
-		}
-		std::wstring::size_type pos2 = 0u;
-		std::wstring repargs2 = packageWritableRoot.c_str();
-		while ((pos2 = outString.find(var2rep2, pos2)) != std::string::npos) {
-			outString.replace(pos2, var2rep2.length(), repargs2);
-			pos2 += repargs2.length();
-		}
-		return outString;
-	}
-
-	std::wstring Dequote(std::wstring inString)
-	{
-		// Remove quotation-like marks around edges of a string reference to a file, if present.
-		if (inString.length() > 2)
-		{
-			if (inString[0] == L'\"' && inString[inString.length() - 1] == L'\"')
-			{
-				return inString.substr(1, inString.length() - 2);
-			}
-			if (inString[0] == L'\'' && inString[inString.length() - 1] == L'\'')
-			{
-				return inString.substr(1, inString.length() - 2);
-			}
-			if (inString.length() > 4)
-			{
-				// Check for Powershell style references too
-				if (inString[0] == L'`' && inString[1] == L'\'' && inString[inString.length() - 2] == L'`' && inString[inString.length() - 1] == L'\'')
-				{
-					return inString.substr(2, inString.length() - 4);
-				}
-				if (inString[0] == L'`' && inString[1] == L'\"' && inString[inString.length() - 2] == L'`' && inString[inString.length() - 1] == L'\"')
-				{
-					return inString.substr(2, inString.length() - 4);
-				}
-			}
-		}
-		return inString;
-	}
-
-	std::wstring EscapeFilenameForPowerShell(std::filesystem::path inputPath)
-	{
-		std::wstring outString = inputPath.c_str();
-		std::wstring::size_type pos = 0u;
-		std::wstring var2rep = L" ";
-		std::wstring repargs = L"` ";
-		while ((pos = outString.find(var2rep, pos)) != std::string::npos) {
-			outString.replace(pos, var2rep.length(), repargs);
-			pos += repargs.length();
-		}
-		return outString;
-
-	}
-
-	std::wstring MakeCommandString(const psf::json_object& scriptInformation, const std::wstring& scriptExecutionMode, const std::wstring& scriptPath)
-	{
-		std::wstring commandString = L"Powershell.exe ";
-		commandString.append(scriptExecutionMode);
-		commandString.append(L" -file StartingScriptWrapper.ps1 ");
-		commandString.append(L"\"");
-
-		// ScriptWrapper uses invoke-expression so we need the expression to launch another powershell to run a file with arguments.
-		commandString.append(L"Powershell.exe ");
-		commandString.append(scriptExecutionMode);
-		commandString.append(L" -file ");
-
-		const std::filesystem::path dequotedScriptPath = Dequote(scriptPath);
-		std::wstring fixed4PowerShell = dequotedScriptPath; // EscapeFilenameForPowerShell(dequotedScriptPath);
-		if (dequotedScriptPath.is_absolute())
-		{
-			commandString.append(L"\'");
-			commandString.append(fixed4PowerShell);
-			commandString.append(L"\'");
-		}
-		else
-		{
-			commandString.append(L"\'");
-			commandString.append(L".\\");
-			commandString.append(fixed4PowerShell);
-			commandString.append(L"\'");
-		}
-
-		//Script arguments are optional.
-		auto scriptArgumentsJObject = scriptInformation.try_get("scriptArguments");
-		if (scriptArgumentsJObject)
-		{
-			commandString.append(L" ");
-			commandString.append(scriptArgumentsJObject->as_string().wide());
-		}
-
-		//Add ending quote for the script inside a string literal.
-		commandString.append(L"\"");
-
-		return commandString;
-	}
-
-	const std::wstring GetScriptPath(const psf::json_object& scriptInformation) const
-	{
-		//.get throws if the key does not exist.
-		return scriptInformation.get("scriptPath").as_string().wide();
-	}
-
-	DWORD GetTimeout(const psf::json_object& scriptInformation)
-	{
-		auto timeoutObject = scriptInformation.try_get("timeout");
-		if (timeoutObject)
-		{
-			//Timout needs to be in milliseconds.
-			//Multiple seconds from config by milliseconds.
-			return (DWORD)(1000 * timeoutObject->as_number().get_unsigned());
-		}
-
-		return INFINITE;
-	}
-
-	bool DoesScriptExist(const std::wstring& scriptPath, std::filesystem::path currentDirectory)
-	{
-		std::filesystem::path powershellScriptPath(scriptPath);
-		bool doesScriptExist = false;
-		//The file might be on a network drive.
-		doesScriptExist = std::filesystem::exists(powershellScriptPath);
-
-		//Check on local computer.
-		if (!doesScriptExist)
-		{
-			doesScriptExist = std::filesystem::exists(currentDirectory / powershellScriptPath);
-		}
-
-		return doesScriptExist;
-	}
-
-	bool GetRunOnce(const psf::json_object& scriptInformation)
-	{
-		auto runOnceObject = scriptInformation.try_get("runOnce");
-		if (runOnceObject)
-		{
-			return runOnceObject->as_boolean().get();
-		}
-
-		return true;
-	}
-
-	int GetShowWindowAction(const psf::json_object& scriptInformation)
-	{
-		auto showWindowObject = scriptInformation.try_get("showWindow");
-		if (showWindowObject)
-		{
-			bool showWindow = showWindowObject->as_boolean().get();
-			if (showWindow)
-			{
-				//5 in SW_SHOW.
-				return SW_SHOW;
-			}
-		}
-
-		return SW_HIDE;
-	}
-
-	bool GetWaitForScriptToFinish(const psf::json_object& scriptInformation)
-	{
-		auto waitForStartingScriptToFinishObject = scriptInformation.try_get("waitForScriptToFinish");
-		if (waitForStartingScriptToFinishObject)
-		{
-			return waitForStartingScriptToFinishObject->as_boolean().get();
-		}
-
-		return true;
-	}
-
-	HRESULT CheckIfShouldRun(bool shouldRunOnce, bool& shouldScriptRun)
-	{
-		shouldScriptRun = true;
-		if (shouldRunOnce)
-		{
-			std::wstring runOnceSubKey = L"SOFTWARE\\";
-			runOnceSubKey.append(psf::current_package_full_name());
-			runOnceSubKey.append(L"\\PSFScriptHasRun ");
-
-			DWORD keyDisposition;
-			wil::unique_hkey registryHandle;
-			LSTATUS createResult = RegCreateKeyExW(HKEY_CURRENT_USER, runOnceSubKey.c_str(), 0, nullptr, REG_OPTION_NON_VOLATILE, KEY_ALL_ACCESS, nullptr, &registryHandle, &keyDisposition);
-
-			if (createResult != ERROR_SUCCESS)
-			{
-				return createResult;
-			}
-
-			if (keyDisposition == REG_OPENED_EXISTING_KEY)
-			{
-				shouldScriptRun = false;
-			}
-		}
-		
-		return S_OK;
-	}
-
-	bool CheckIfPowershellIsInstalled()
-	{
-		wil::unique_hkey registryHandle;
-		LSTATUS createResult = RegCreateKeyExW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\PowerShell\\1", 0, nullptr, REG_OPTION_NON_VOLATILE, KEY_READ, nullptr, &registryHandle, nullptr);
-
-		if (createResult == ERROR_FILE_NOT_FOUND)
-		{
-			// If the key cannot be found, powershell is not installed
-			return false;
-		}
-		else if (createResult != ERROR_SUCCESS)
-		{
-			THROW_HR_MSG(HRESULT_FROM_WIN32(createResult), "Error with getting the key to see if PowerShell is installed.");
-		}
-
-		DWORD valueFromRegistry = 0;
-		DWORD bufferSize = sizeof(DWORD);
-		DWORD type = REG_DWORD;
-		THROW_IF_WIN32_ERROR_MSG(RegQueryValueExW(registryHandle.get(), L"Install", nullptr, &type, reinterpret_cast<BYTE*>(&valueFromRegistry), &bufferSize),
-			"Error with querying the key to see if PowerShell is installed.");
-
-		if (valueFromRegistry != 1)
-		{
-			return false;
-		}
-
-		return true;
-	}
-
+#pragma once
+#include <thread>
+#include "psf_runtime.h"
+#include "StartProcessHelper.h"
+#include "Globals.h"
+#include "LauncherCache.h"
+#include <wil\resource.h>
+#include <known_folders.h>
+
+#ifndef SW_SHOW
+	#define SW_SHOW 5
+#endif
+
+#ifndef SW_HIDE
+	#define SW_HIDE 0
+#endif
+
+class PsfPowershellScriptRunner
+{
+public:
+	PsfPowershellScriptRunner() = default;
+
+	PsfPowershellScriptRunner(const PsfPowershellScriptRunner&) = delete;
+	PsfPowershellScriptRunner& operator=(const PsfPowershellScriptRunner&) = delete;
+
+	~PsfPowershellScriptRunner()
+	{
+		// A starting script that doesn't get waited for may well outlive the application, so it still gets to finish
+		// before the launcher exits
+		JoinStartingScript();
+
+		// Lets a script host that is still waiting for the ending script exit, e.g. when the application failed to launch
+		if (m_scriptHost)
+		{
+			m_skipEndingScript.SetEvent();
+		}
+	}
+
+	void Initialize(const psf::json_object* appConfig, const std::filesystem::path& currentDirectory, const std::filesystem::path& packageRootDirectory)
+	{
+		auto startScriptInformationObject = PSFQueryStartScriptInfo();
+		auto endScriptInformationObject = PSFQueryEndScriptInfo();
+
+		//If we want to run at least one script make sure powershell is installed on the computer.
+		if (startScriptInformationObject || endScriptInformationObject)
+		{
+			m_powershellPath = LauncherCache::Instance().PowershellPath();
+			THROW_HR_IF_MSG(ERROR_NOT_SUPPORTED, m_powershellPath.empty(), "PowerShell is not installed.  Please install PowerShell to run scripts in PSF");
+		}
+
+		bool stopOnScriptError = false;
+		auto stopOnScriptErrorObject = appConfig->try_get("stopOnScriptError");
+		if (stopOnScriptErrorObject)
+		{
+			stopOnScriptError = stopOnScriptErrorObject->as_boolean().get();
+		}
+
+		std::wstring scriptExecutionMode = L"";
+		auto scriptExecutionModeObject = appConfig->try_get("scriptExecutionMode");  // supports options like "-ExecutionPolicy ByPass"
+		if (scriptExecutionModeObject)
+		{
+			scriptExecutionMode = scriptExecutionModeObject->as_string().wstring();
+		}
+		this->m_scriptExecutionMode = scriptExecutionMode;
+
+		auto hostScriptsObject = appConfig->try_get("hostScripts");
+		if (hostScriptsObject)
+		{
+			this->m_hostScripts = hostScriptsObject->as_boolean().get();
+		}
+
+		if (startScriptInformationObject)
+		{
+			this->m_startingScriptInformation = MakeScriptInformation(startScriptInformationObject, stopOnScriptError, scriptExecutionMode, currentDirectory, packageRootDirectory);
+			this->m_startingScriptInformation.doesScriptExistInConfig = true;
+		}
+
+		if (endScriptInformationObject)
+		{
+			//Ending script ignores stopOnScriptError.  Keep it the default value
+			this->m_endingScriptInformation = MakeScriptInformation(endScriptInformationObject, false, scriptExecutionMode, currentDirectory, packageRootDirectory);
+			this->m_endingScriptInformation.doesScriptExistInConfig = true;
+
+			//Ending script ignores this value.  Keep true to make sure
+			//script runs on the current thread.
+			this->m_endingScriptInformation.waitForScriptToFinish = true;
+			this->m_endingScriptInformation.stopOnScriptError = false;
+		}
+	}
+
+	//RunStartingScript should return an error only if stopOnScriptError is true
+	void RunStartingScript()
+	{
+		LogString("StartingScript commandString", this->m_startingScriptInformation.commandString.c_str());
+		LogString("StartingScript currentDirectory", this->m_startingScriptInformation.currentDirectory.c_str());
+		if (this->m_startingScriptInformation.waitForScriptToFinish)
+		{
+			Log("StartingScript waitForScriptToFinish=true");
+		}
+		else
+		{
+			Log("StartingScript waitForScriptToFinish=false");
+		}
+
+		if (this->m_startingScriptInformation.waitForReadySignal)
+		{
+			// The script signals this event once whatever the application depends on is in place. It's inherited by the
+			// PowerShell processes through the environment, whose variables the script can read directly
+			auto readyEventName = L"Local\\PsfScriptReady-" + std::to_wstring(::GetCurrentProcessId());
+			m_startingScriptReady.create(wil::EventOptions::ManualReset, readyEventName.c_str());
+			::SetEnvironmentVariableW(script_ready_event_variable, readyEventName.c_str());
+		}
+
+		if (this->m_hostScripts)
+		{
+			RunHostedStartingScript();
+			return;
+		}
+
+		RunScript(this->m_startingScriptInformation);
+	}
+
+	// Holds off the launch of the application until a starting script that runs alongside it, and that was configured
+	// with waitForReadySignal, has signalled that it's ready, has finished, or has run for longer than its timeout.
+	// Returns immediately for all other scripts, which either have already finished or aren't waited for at all
+	void WaitForStartingScriptReady()
+	{
+		if (!m_startingScriptReady)
+		{
+			return;
+		}
+
+		//The script doesn't get started at all when it has already run once
+		if (m_startingScriptFinished)
+		{
+			HANDLE waitHandles[] = { m_startingScriptReady.get(), m_startingScriptFinished.get() };
+			auto waitResult = ::WaitForMultipleObjects(static_cast<DWORD>(std::size(waitHandles)), waitHandles, false, this->m_startingScriptInformation.timeout);
+			if (waitResult == WAIT_OBJECT_0)
+			{
+				Log("StartingScript signalled that it is ready");
+			}
+			else if (waitResult == (WAIT_OBJECT_0 + 1))
+			{
+				Log("StartingScript finished without signalling that it is ready");
+			}
+			else
+			{
+				Log("StartingScript did not signal that it is ready before its timeout");
+			}
+		}
+
+		// Other processes that the application starts have no use for it
+		::SetEnvironmentVariableW(script_ready_event_variable, nullptr);
+	}
+
+	void RunEndingScript()
+	{
+		// The ending script is meant to run last, even when the starting script is still going
+		JoinStartingScript();
+		LogString("EndingScript commandString", this->m_endingScriptInformation.commandString.c_str());
+		LogString("EndingScript currentDirectory", this->m_endingScriptInformation.currentDirectory.c_str());
+		if (m_scriptHost)
+		{
+			RunHostedEndingScript();
+			return;
+		}
+
+		RunScript(this->m_endingScriptInformation);
+	}
+
+private:
+   struct MyProcThreadAttributeList
+    {
+    private:
+        // To make sure the attribute value persists we cache it here.
+        // 0x02 is equivalent to PROCESS_CREATION_DESKTOP_APP_BREAKAWAY_DISABLE_PROCESS_TREE
+        // The documentation can be found here:
+        //https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-updateprocthreadattribute
+        // This attribute tells PSF to
+        // 1. Create Powershell in the same container as PSF.
+        // 2. Any windows Powershell makes will also be in the same container as PSF.
+        // This means that powershell, and any windows it makes, will have the same restrictions as PSF.
+        DWORD createInContainerAttribute = 0x02;
+        std::unique_ptr<_PROC_THREAD_ATTRIBUTE_LIST> attributeList;
+
+    public:
+
+        MyProcThreadAttributeList()
+        {
+            SIZE_T AttributeListSize{};
+            InitializeProcThreadAttributeList(nullptr, 1, 0, &AttributeListSize);
+
+            attributeList = std::unique_ptr<_PROC_THREAD_ATTRIBUTE_LIST>(reinterpret_cast<_PROC_THREAD_ATTRIBUTE_LIST*>(new char[AttributeListSize]));
+
+            THROW_LAST_ERROR_IF_MSG(
+                !InitializeProcThreadAttributeList(
+                    attributeList.get(),
+                    1,
+                    0,
+                    &AttributeListSize),
+                "Could not initialize the proc thread attribute list.");
+
+            // 18 stands for
+            // PROC_THREAD_ATTRIBUTE_DESKTOP_APP_POLICY
+            // this is the attribute value we want to add
+            THROW_LAST_ERROR_IF_MSG(
+                !UpdateProcThreadAttribute(
+                    attributeList.get(),
+                    0,
+                    ProcThreadAttributeValue(18, FALSE, TRUE, FALSE),
+                    &createInContainerAttribute,
+                    sizeof(createInContainerAttribute),
+                    nullptr,
+                    nullptr),
+                "Could not update Proc thread attribute.");
+        }
+
+        ~MyProcThreadAttributeList()
+        {
+            DeleteProcThreadAttributeList(attributeList.get());
+        }
+
+        LPPROC_THREAD_ATTRIBUTE_LIST get()
+        {
+            return attributeList.get();
+        }
+
+    };
+  
+	struct ScriptInformation
+	{
+		std::wstring scriptPath;
+		std::wstring commandString;
+		std::wstring invocationString;
+		DWORD timeout = INFINITE;
+		bool shouldRunOnce = true;
+		int showWindowAction = SW_HIDE;
+		bool waitForScriptToFinish = true;
+		bool waitForReadySignal = false;
+		bool stopOnScriptError = false;
+		std::filesystem::path currentDirectory;
+		std::filesystem::path packageRoot;
+		bool doesScriptExistInConfig = false;
+	};
+
+	ScriptInformation m_startingScriptInformation;
+	ScriptInformation m_endingScriptInformation;
+	MyProcThreadAttributeList m_AttributeList;
+
+	std::wstring m_powershellPath;
+
+	static constexpr wchar_t script_ready_event_variable[] = L"PSF_SCRIPT_READY_EVENT";
+
+	// Only the starting script ever runs asynchronously
+	std::thread m_startingScriptThread;
+	wil::unique_event m_startingScriptReady;
+	wil::unique_event m_startingScriptFinished;
+
+	// With hostScripts, both scripts run in the one PowerShell process that StartingScriptWrapper.ps1 hosts them in.
+	// It's started along with the starting script, and then waits for the launcher to tell it whether to run the ending
+	// script, so that the ending script doesn't pay for starting PowerShell
+	bool m_hostScripts = false;
+	std::wstring m_scriptExecutionMode;
+	wil::unique_handle m_scriptHost;
+	wil::unique_event m_startingScriptFailed;
+	wil::unique_event m_runEndingScript;
+	wil::unique_event m_skipEndingScript;
+
+	void JoinStartingScript()
+	{
+		if (m_startingScriptThread.joinable())
+		{
+			m_startingScriptThread.join();
+		}
+	}
+
+	bool ShouldRunScript(const ScriptInformation& script)
+	{
+		if (!script.doesScriptExistInConfig)
+		{
+			return false;
+		}
+
+		THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), !LauncherCache::Instance().ScriptExists(script.scriptPath, script.currentDirectory, script.packageRoot));
+
+		bool canScriptRun = false;
+		auto scriptName = (&script == &this->m_startingScriptInformation) ? L"StartingScript" : L"EndingScript";
+		THROW_IF_FAILED(CheckIfShouldRun(script.shouldRunOnce, scriptName, canScriptRun));
+		return canScriptRun;
+	}
+
+	void RunScript(ScriptInformation& script)
+	{
+		if (!ShouldRunScript(script))
+		{
+			return;
+		}
+
+		if (script.waitForScriptToFinish)
+		{
+			HRESULT startScriptResult = StartProcess(nullptr, script.commandString.data(), script.currentDirectory.c_str(), script.showWindowAction, script.timeout, m_AttributeList.get());
+
+			if (script.stopOnScriptError)
+			{
+				THROW_IF_FAILED(startScriptResult);
+			}
+		}
+		else
+		{
+			//We don't want to stop on an error and we want to run async
+			assert(&script == &this->m_startingScriptInformation);
+			m_startingScriptFinished.create(wil::EventOptions::ManualReset);
+			m_startingScriptThread = std::thread([this, &script]()
+			{
+				StartProcess(nullptr, script.commandString.data(), script.currentDirectory.c_str(), script.showWindowAction, script.timeout, m_AttributeList.get());
+				m_startingScriptFinished.SetEvent();
+			});
+		}
+	}
+
+	void RunHostedStartingScript()
+	{
+		auto& script = this->m_startingScriptInformation;
+		bool runStartingScript = ShouldRunScript(script);
+
+		//Whether the ending script runs is only decided once the application exits, so the host is kept around for it
+		if (!runStartingScript && !this->m_endingScriptInformation.doesScriptExistInConfig)
+		{
+			return;
+		}
+
+		auto eventPrefix = L"Local\\PsfScriptHost-" + std::to_wstring(::GetCurrentProcessId());
+		m_startingScriptFinished.create(wil::EventOptions::ManualReset, (eventPrefix + L"-StartDone").c_str());
+		m_startingScriptFailed.create(wil::EventOptions::ManualReset, (eventPrefix + L"-StartFailed").c_str());
+		m_runEndingScript.create(wil::EventOptions::ManualReset, (eventPrefix + L"-RunEnd").c_str());
+		m_skipEndingScript.create(wil::EventOptions::ManualReset, (eventPrefix + L"-SkipEnd").c_str());
+
+		std::wstring commandString = QuotedPowershellPath();
+		commandString.append(this->m_scriptExecutionMode);
+		commandString.append(L" -file StartingScriptWrapper.ps1 -EventPrefix ");
+		commandString.append(eventPrefix);
+		commandString.append(L" -LauncherId ");
+		commandString.append(std::to_wstring(::GetCurrentProcessId()));
+		if (runStartingScript)
+		{
+			commandString.append(L" -StartScript \"& ");
+			commandString.append(script.invocationString);
+			commandString.append(L"\"");
+		}
+
+		if (this->m_endingScriptInformation.doesScriptExistInConfig)
+		{
+			commandString.append(L" -EndScript \"& ");
+			commandString.append(this->m_endingScriptInformation.invocationString);
+			commandString.append(L"\"");
+		}
+
+		LogString("ScriptHost commandString", commandString.c_str());
+		auto& hostScript = runStartingScript ? script : this->m_endingScriptInformation;
+		HRESULT launchResult = LaunchProcess(nullptr, commandString.data(), hostScript.currentDirectory.c_str(), hostScript.showWindowAction, m_scriptHost, m_AttributeList.get());
+		if (FAILED(launchResult))
+		{
+			THROW_HR_IF(launchResult, runStartingScript && script.stopOnScriptError);
+			return;
+		}
+
+		//NOTE: The host signals that it's done with the starting script even when it has none to run
+		if (runStartingScript && script.waitForScriptToFinish)
+		{
+			HRESULT startScriptResult = S_OK;
+			HANDLE waitHandles[] = { m_startingScriptFinished.get(), m_scriptHost.get() };
+			auto waitResult = ::WaitForMultipleObjects(static_cast<DWORD>(std::size(waitHandles)), waitHandles, false, script.timeout);
+			if (waitResult == WAIT_TIMEOUT)
+			{
+				startScriptResult = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+			}
+			else if ((waitResult != WAIT_OBJECT_0) || m_startingScriptFailed.is_signaled())
+			{
+				//Either the script threw, or the host went away without running it
+				startScriptResult = HRESULT_FROM_WIN32(ERROR_ERRORS_ENCOUNTERED);
+			}
+
+			if (script.stopOnScriptError)
+			{
+				THROW_IF_FAILED(startScriptResult);
+			}
+		}
+	}
+
+	void RunHostedEndingScript()
+	{
+		if (!ShouldRunScript(this->m_endingScriptInformation))
+		{
+			m_skipEndingScript.SetEvent();
+			return;
+		}
+
+		//Errors of the ending script are ignored, just as when it's run on its own
+		m_runEndingScript.SetEvent();
+		::WaitForSingleObject(m_scriptHost.get(), this->m_endingScriptInformation.timeout);
+	}
+
+	ScriptInformation MakeScriptInformation(const psf::json_object* scriptInformation, bool stopOnScriptError, std::wstring scriptExecutionMode, std::filesystem::path currentDirectory, std::filesystem::path packageRoot)
+	{
+		ScriptInformation scriptStruct;
+		scriptStruct.scriptPath = ReplacePsuedoRootVariables(GetScriptPath(*scriptInformation));
+		scriptStruct.commandString = ReplacePsuedoRootVariables(MakeCommandString(*scriptInformation, scriptExecutionMode, scriptStruct.scriptPath));
+		scriptStruct.invocationString = ReplacePsuedoRootVariables(MakeInvocationString(*scriptInformation, scriptStruct.scriptPath));
+		scriptStruct.timeout = GetTimeout(*scriptInformation);
+		scriptStruct.shouldRunOnce = GetRunOnce(*scriptInformation);
+		scriptStruct.showWindowAction = GetShowWindowAction(*scriptInformation);
+		scriptStruct.waitForScriptToFinish = GetWaitForScriptToFinish(*scriptInformation);
+		scriptStruct.waitForReadySignal = GetWaitForReadySignal(*scriptInformation);
+		scriptStruct.stopOnScriptError = stopOnScriptError;
+		scriptStruct.currentDirectory = currentDirectory;
+		scriptStruct.packageRoot = packageRoot;
+
+		//Async script run with a termination on failure is not a supported scenario.
+		//Supporting this scenario would mean force terminating an executing user process
+		//if the script fails.
+		if (stopOnScriptError && !scriptStruct.waitForScriptToFinish)
+		{
+			THROW_HR_MSG(HRESULT_FROM_WIN32(ERROR_BAD_CONFIGURATION), "PSF does not allow stopping on a script error and running asynchronously.  Please either remove stopOnScriptError or add a wait");
+		}
+
+		//A script that is waited for is always ready by the time the application launches
+		if (scriptStruct.waitForScriptToFinish)
+		{
+			scriptStruct.waitForReadySignal = false;
+		}
+
+		return scriptStruct;
+	}
+
+
+	std::wstring ReplacePsuedoRootVariables(const std::wstring& inString)
+	{
+		//Allow for a substitution in the strings for a new pseudo variable %MsixPackageRoot% so that arguments can point to files
+		//inside the package using a syntax relative to the package root rather than rely on VFS pathing which can't kick in yet.
+		//Environment variables are left for PowerShell to expand.
+		return psf::expand_variables(inString.c_str(), false);
+	}
+
+	std::wstring Dequote(std::wstring inString)
+	{
+		// Remove quotation-like marks around edges of a string reference to a file, if present.
+		if (inString.length() > 2)
+		{
+			if (inString[0] == L'\"' && inString[inString.length() - 1] == L'\"')
+			{
+				return inString.substr(1, inString.length() - 2);
+			}
+			if (inString[0] == L'\'' && inString[inString.length() - 1] == L'\'')
+			{
+				return inString.substr(1, inString.length() - 2);
+			}
+			if (inString.length() > 4)
+			{
+				// Check for Powershell style references too
+				if (inString[0] == L'`' && inString[1] == L'\'' && inString[inString.length() - 2] == L'`' && inString[inString.length() - 1] == L'\'')
+				{
+					return inString.substr(2, inString.length() - 4);
+				}
+				if (inString[0] == L'`' && inString[1] == L'\"' && inString[inString.length() - 2] == L'`' && inString[inString.length() - 1] == L'\"')
+				{
+					return inString.substr(2, inString.length() - 4);
+				}
+			}
+		}
+		return inString;
+	}
+
+	std::wstring EscapeFilenameForPowerShell(std::filesystem::path inputPath)
+	{
+		std::wstring outString = inputPath.c_str();
+		std::wstring::size_type pos = 0u;
+		std::wstring var2rep = L" ";
+		std::wstring repargs = L"` ";
+		while ((pos = outString.find(var2rep, pos)) != std::string::npos) {
+			outString.replace(pos, var2rep.length(), repargs);
+			pos += repargs.length();
+		}
+		return outString;
+
+	}
+
+	std::wstring MakeCommandString(const psf::json_object& scriptInformation, const std::wstring& scriptExecutionMode, const std::wstring& scriptPath)
+	{
+		std::wstring commandString = QuotedPowershellPath();
+		commandString.append(scriptExecutionMode);
+		commandString.append(L" -file StartingScriptWrapper.ps1 ");
+		commandString.append(L"\"");
+
+		// ScriptWrapper uses invoke-expression so we need the expression to launch another powershell to run a file with arguments.
+		commandString.append(L"Powershell.exe ");
+		commandString.append(scriptExecutionMode);
+		commandString.append(L" -file ");
+		commandString.append(MakeInvocationString(scriptInformation, scriptPath));
+
+		//Add ending quote for the script inside a string literal.
+		commandString.append(L"\"");
+
+		return commandString;
+	}
+
+	//The quoted script path along with its arguments, as they follow either "-file" or "&"
+	std::wstring MakeInvocationString(const psf::json_object& scriptInformation, const std::wstring& scriptPath)
+	{
+		std::wstring invocationString;
+
+		const std::filesystem::path dequotedScriptPath = Dequote(scriptPath);
+		std::wstring fixed4PowerShell = dequotedScriptPath; // EscapeFilenameForPowerShell(dequotedScriptPath);
+		if (dequotedScriptPath.is_absolute())
+		{
+			invocationString.append(L"\'");
+			invocationString.append(fixed4PowerShell);
+			invocationString.append(L"\'");
+		}
+		else
+		{
+			invocationString.append(L"\'");
+			invocationString.append(L".\\");
+			invocationString.append(fixed4PowerShell);
+			invocationString.append(L"\'");
+		}
+
+		//Script arguments are optional.
+		auto scriptArgumentsJObject = scriptInformation.try_get("scriptArguments");
+		if (scriptArgumentsJObject)
+		{
+			invocationString.append(L" ");
+			invocationString.append(scriptArgumentsJObject->as_string().wide());
+		}
+
+		return invocationString;
+	}
+
+	const std::wstring GetScriptPath(const psf::json_object& scriptInformation) const
+	{
+		//.get throws if the key does not exist.
+		return scriptInformation.get("scriptPath").as_string().wide();
+	}
+
+	DWORD GetTimeout(const psf::json_object& scriptInformation)
+	{
+		auto timeoutObject = scriptInformation.try_get("timeout");
+		if (timeoutObject)
+		{
+			//Timout needs to be in milliseconds.
+			//Multiple seconds from config by milliseconds.
+			return (DWORD)(1000 * timeoutObject->as_number().get_unsigned());
+		}
+
+		return INFINITE;
+	}
+
+	//The wrapper is started by its full path, which spares CreateProcess from searching the path for it
+	std::wstring QuotedPowershellPath() const
+	{
+		return L"\"" + m_powershellPath + L"\" ";
+	}
+
+	bool GetRunOnce(const psf::json_object& scriptInformation)
+	{
+		auto runOnceObject = scriptInformation.try_get("runOnce");
+		if (runOnceObject)
+		{
+			return runOnceObject->as_boolean().get();
+		}
+
+		return true;
+	}
+
+	int GetShowWindowAction(const psf::json_object& scriptInformation)
+	{
+		auto showWindowObject = scriptInformation.try_get("showWindow");
+		if (showWindowObject)
+		{
+			bool showWindow = showWindowObject->as_boolean().get();
+			if (showWindow)
+			{
+				//5 in SW_SHOW.
+				return SW_SHOW;
+			}
+		}
+
+		return SW_HIDE;
+	}
+
+	bool GetWaitForScriptToFinish(const psf::json_object& scriptInformation)
+	{
+		auto waitForStartingScriptToFinishObject = scriptInformation.try_get("waitForScriptToFinish");
+		if (waitForStartingScriptToFinishObject)
+		{
+			return waitForStartingScriptToFinishObject->as_boolean().get();
+		}
+
+		return true;
+	}
+
+	bool GetWaitForReadySignal(const psf::json_object& scriptInformation)
+	{
+		auto waitForReadySignalObject = scriptInformation.try_get("waitForReadySignal");
+		if (waitForReadySignalObject)
+		{
+			return waitForReadySignalObject->as_boolean().get();
+		}
+
+		return false;
+	}
+
+	HRESULT CheckIfShouldRun(bool shouldRunOnce, const wchar_t* scriptName, bool& shouldScriptRun)
+	{
+		shouldScriptRun = true;
+		if (shouldRunOnce)
+		{
+			RETURN_IF_FAILED(LauncherCache::Instance().MarkScriptRun(scriptName, shouldScriptRun));
+		}
+
+		return S_OK;
+	}
+
 };
\ No newline at end of file
@@ -0,0 +1,210 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+#include <process_policy.h>
+#include <psf_constants.h>
+#include <psf_runtime.h>
+#include <wil\resource.h>
+#include <wil\result.h>
+#include "Logger.h"
+
+// An application's "resourcePolicy", which keeps it from starving the other applications on the machine. The application
+// gets started in a job object that holds its CPU rate, memory and affinity limits, and that every process it goes on to
+// create is in too. What's left are settings that Windows doesn't carry over from a process to its children, which the
+// PSF Runtime applies to each process of the tree as it's created (see psf::process_policy)
+struct ResourcePolicy
+{
+    DWORD cpuRatePercent = 0;
+    std::uint64_t memoryLimitMB = 0;
+    std::uint64_t affinity = 0;
+    psf::process_policy process;
+
+    bool NeedsJob() const noexcept
+    {
+        return (cpuRatePercent != 0) || (memoryLimitMB != 0) || (affinity != 0);
+    }
+
+    bool empty() const noexcept
+    {
+        return !NeedsJob() && process.empty();
+    }
+};
+
+template <typename T, std::size_t Size>
+T ResourcePolicySetting(const psf::json_object& config, const char* name, const std::pair<std::string_view, T> (&values)[Size], T defaultValue)
+{
+    auto value = config.try_get(name);
+    if (!value)
+    {
+        return defaultValue;
+    }
+
+    auto str = value->as_string().string();
+    for (auto& [valueName, setting] : values)
+    {
+        if (str == valueName)
+        {
+            return setting;
+        }
+    }
+
+    THROW_HR_MSG(E_INVALIDARG, "Error: resourcePolicy %s has an unknown value \"%.*s\"", name, static_cast<int>(str.length()), str.data());
+}
+
+// Maps the logical processor numbers that the configuration lists onto the ids that the CPU set functions use. Those
+// that the machine doesn't have are left out, so that the same configuration can be used on smaller machines
+std::vector<ULONG> CpuSetIds(const psf::json_array& processors)
+{
+    ULONG length = 0;
+    ::GetSystemCpuSetInformation(nullptr, 0, &length, ::GetCurrentProcess(), 0);
+    std::vector<char> buffer(length);
+    THROW_IF_WIN32_BOOL_FALSE_MSG(
+        ::GetSystemCpuSetInformation(reinterpret_cast<PSYSTEM_CPU_SET_INFORMATION>(buffer.data()), length, &length, ::GetCurrentProcess(), 0),
+        "Error: could not query the CPU sets of the machine");
+
+    std::vector<ULONG> result;
+    for (unsigned i = 0; i < processors.size(); ++i)
+    {
+        auto processor = processors.get_at(i).as_number().get<unsigned>();
+        bool found = false;
+        for (ULONG offset = 0; !found && (offset < length); )
+        {
+            auto info = reinterpret_cast<const SYSTEM_CPU_SET_INFORMATION*>(buffer.data() + offset);
+            if ((info->Type == CpuSetInformation) &&
+                ((info->CpuSet.Group * 64u) + info->CpuSet.LogicalProcessorIndex == processor))
+            {
+                result.push_back(info->CpuSet.Id);
+                found = true;
+            }
+            offset += info->Size;
+        }
+
+        if (!found)
+        {
+            Log("\tresourcePolicy cpuSets lists processor %u, which this machine doesn't have", processor);
+        }
+    }
+
+    return result;
+}
+
+ResourcePolicy ReadResourcePolicy(const psf::json_object& appConfig)
+{
+    ResourcePolicy policy;
+    auto policyValue = appConfig.try_get("resourcePolicy");
+    if (!policyValue)
+    {
+        return policy;
+    }
+
+    auto& config = policyValue->as_object();
+    if (auto value = config.try_get("cpuRatePercent"))
+    {
+        policy.cpuRatePercent = value->as_number().get<DWORD>();
+        THROW_HR_IF_MSG(E_INVALIDARG, (policy.cpuRatePercent == 0) || (policy.cpuRatePercent > 100),
+            "Error: resourcePolicy cpuRatePercent must be from 1 to 100");
+    }
+
+    if (auto value = config.try_get("memoryLimitMB"))
+    {
+        policy.memoryLimitMB = value->as_number().get<std::uint64_t>();
+    }
+
+    if (auto value = config.try_get("affinity"))
+    {
+        policy.affinity = value->as_number().get<std::uint64_t>();
+    }
+
+    if (auto value = config.try_get("cpuSets"))
+    {
+        policy.process.cpu_sets = CpuSetIds(value->as_array());
+    }
+
+    static constexpr std::pair<std::string_view, DWORD> priorities[] =
+    {
+        { "idle", IDLE_PRIORITY_CLASS },
+        { "belowNormal", BELOW_NORMAL_PRIORITY_CLASS },
+        { "normal", NORMAL_PRIORITY_CLASS },
+        { "aboveNormal", ABOVE_NORMAL_PRIORITY_CLASS },
+        { "high", HIGH_PRIORITY_CLASS },
+    };
+    policy.process.priority_class = ResourcePolicySetting(config, "priority", priorities, DWORD{ 0 });
+
+    static constexpr std::pair<std::string_view, int> ioPriorities[] =
+    {
+        { "veryLow", 0 },
+        { "low", 1 },
+        { "normal", 2 },
+    };
+    policy.process.io_priority = ResourcePolicySetting(config, "ioPriority", ioPriorities, -1);
+
+    static constexpr std::pair<std::string_view, int> memoryPriorities[] =
+    {
+        { "veryLow", MEMORY_PRIORITY_VERY_LOW },
+        { "low", MEMORY_PRIORITY_LOW },
+        { "medium", MEMORY_PRIORITY_MEDIUM },
+        { "belowNormal", MEMORY_PRIORITY_BELOW_NORMAL },
+        { "normal", MEMORY_PRIORITY_NORMAL },
+    };
+    policy.process.memory_priority = ResourcePolicySetting(config, "memoryPriority", memoryPriorities, -1);
+
+    if (auto value = config.try_get("ecoQoS"))
+    {
+        policy.process.eco_qos = value->as_boolean().get() ? 1 : 0;
+    }
+
+    return policy;
+}
+
+// The job that the application is started in. Processes that ask to be created outside of their parent's job are still
+// allowed to be, so that applications that do so keep working, but they aren't held to its limits
+wil::unique_handle CreateResourceJob(const ResourcePolicy& policy)
+{
+    wil::unique_handle job(::CreateJobObjectW(nullptr, nullptr));
+    THROW_LAST_ERROR_IF_MSG(!job, "Error: could not create the job object for the resourcePolicy");
+
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits{};
+    limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_BREAKAWAY_OK;
+    if (policy.memoryLimitMB != 0)
+    {
+        limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+        limits.JobMemoryLimit = static_cast<SIZE_T>(policy.memoryLimitMB * 1024 * 1024);
+    }
+    if (policy.affinity != 0)
+    {
+        limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_AFFINITY;
+        limits.BasicLimitInformation.Affinity = static_cast<ULONG_PTR>(policy.affinity);
+    }
+    THROW_IF_WIN32_BOOL_FALSE_MSG(::SetInformationJobObject(job.get(), JobObjectExtendedLimitInformation, &limits, sizeof(limits)),
+        "Error: could not set the limits of the resourcePolicy");
+
+    if (policy.cpuRatePercent != 0)
+    {
+        // The rate is in hundredths of a percent of all of the machine's processors
+        JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate{};
+        rate.ControlFlags = JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+        rate.CpuRate = policy.cpuRatePercent * 100;
+        THROW_IF_WIN32_BOOL_FALSE_MSG(::SetInformationJobObject(job.get(), JobObjectCpuRateControlInformation, &rate, sizeof(rate)),
+            "Error: could not set the CPU rate of the resourcePolicy");
+    }
+
+    return job;
+}
+
+// Hands the per process settings down to the application, or takes them away again once it has exited, so that the
+// scripts that run afterwards are left as they were
+void SetInheritedProcessPolicy(const ResourcePolicy* policy)
+{
+    if (policy && !policy->process.empty())
+    {
+        ::SetEnvironmentVariableW(psf::process_policy_variable, policy->process.to_string().c_str());
+    }
+    else
+    {
+        ::SetEnvironmentVariableW(psf::process_policy_variable, nullptr);
+    }
+}
@@ -4,7 +4,9 @@
 #include "Globals.h"
 #include <wil\resource.h>
 
-HRESULT StartProcess(LPCWSTR applicationName, LPWSTR commandLine, LPCWSTR currentDirectory, int cmdShow, DWORD timeout, LPPROC_THREAD_ATTRIBUTE_LIST attributeList = nullptr)
+// Creates the process without waiting for it, handing back its process handle. When given a job, the process is put in
+// it before it gets to run, so that it can't create any process that's outside of it
+HRESULT LaunchProcess(LPCWSTR applicationName, LPWSTR commandLine, LPCWSTR currentDirectory, int cmdShow, wil::unique_handle& process, LPPROC_THREAD_ATTRIBUTE_LIST attributeList = nullptr, HANDLE job = nullptr)
 {
 
     STARTUPINFOEXW startupInfoEx =
@@ -62,7 +64,7 @@ HRESULT StartProcess(LPCWSTR applicationName, LPWSTR commandLine, LPCWSTR curren
             commandLine,
             nullptr, nullptr, // Process/ThreadAttributes
             true, // InheritHandles
-            EXTENDED_STARTUPINFO_PRESENT, // CreationFlags
+            EXTENDED_STARTUPINFO_PRESENT | (job ? CREATE_SUSPENDED : 0), // CreationFlags
             nullptr, // Environment
             currentDirectory,
             (LPSTARTUPINFO)&startupInfoEx,
@@ -70,16 +72,35 @@ HRESULT StartProcess(LPCWSTR applicationName, LPWSTR commandLine, LPCWSTR curren
         "ERROR: Failed to create a process for %ws",
         applicationName);
 
+    if (job)
+    {
+        if (!::AssignProcessToJobObject(job, processInfo.hProcess))
+        {
+            Log("\tCould not put PID=%d in the resourcePolicy job err=0x%x", processInfo.dwProcessId, ::GetLastError());
+        }
+        ::ResumeThread(processInfo.hThread);
+    }
+
+    CloseHandle(processInfo.hThread);
     RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_INVALID_HANDLE), processInfo.hProcess == INVALID_HANDLE_VALUE);
-    DWORD waitResult = ::WaitForSingleObject(processInfo.hProcess, timeout);
+    process.reset(processInfo.hProcess);
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT StartProcess(LPCWSTR applicationName, LPWSTR commandLine, LPCWSTR currentDirectory, int cmdShow, DWORD timeout, LPPROC_THREAD_ATTRIBUTE_LIST attributeList = nullptr, HANDLE job = nullptr)
+{
+    wil::unique_handle process;
+    RETURN_IF_FAILED(LaunchProcess(applicationName, commandLine, currentDirectory, cmdShow, process, attributeList, job));
+
+    DWORD waitResult = ::WaitForSingleObject(process.get(), timeout);
     RETURN_LAST_ERROR_IF_MSG(waitResult != WAIT_OBJECT_0, "Waiting operation failed unexpectedly.");
-    CloseHandle(processInfo.hProcess);
-    CloseHandle(processInfo.hThread);
 
     return ERROR_SUCCESS;
 }
 
-void StartWithShellExecute(std::filesystem::path packageRoot, std::filesystem::path exeName, std::wstring exeArgString, LPCWSTR dirStr, int cmdShow, DWORD timeout)
+// NOTE: The shell creates the process, so when given a job, the process is only put in it once it's already running
+void StartWithShellExecute(std::filesystem::path packageRoot, std::filesystem::path exeName, std::wstring exeArgString, LPCWSTR dirStr, int cmdShow, DWORD timeout, HANDLE job = nullptr)
 {
 	// Non Exe case, use shell launching to pick up local FTA
 	auto nonExePath = packageRoot / exeName;
@@ -101,6 +122,10 @@ void StartWithShellExecute(std::filesystem::path packageRoot, std::filesystem::p
 		"ERROR: Failed to create detoured shell process");
 
 	THROW_LAST_ERROR_IF(shex.hProcess == INVALID_HANDLE_VALUE);
+	if (job && shex.hProcess && !::AssignProcessToJobObject(job, shex.hProcess))
+	{
+		Log("\tCould not put the shell launched process in the resourcePolicy job err=0x%x", ::GetLastError());
+	}
 	DWORD exitCode = ::WaitForSingleObject(shex.hProcess, timeout);
 	THROW_IF_WIN32_ERROR(GetExitCodeProcess(shex.hProcess, &exitCode));
 	THROW_IF_WIN32_ERROR(exitCode);
@@ -4,23 +4,116 @@
 	
 .PARAMETER $errorActionPreferenceForScript
     Sets the Error Action PRefrence for this script
+
+.PARAMETER StartScript
+	When PsfLauncher hosts the scripts, the expression that runs the starting script in this PowerShell.
+
+.PARAMETER EndScript
+	When PsfLauncher hosts the scripts, the expression that runs the ending script in this PowerShell, once PsfLauncher
+	asks for it after the application exits.
+
+.PARAMETER EventPrefix
+	When PsfLauncher hosts the scripts, the prefix of the names of the events used to talk to PsfLauncher.
+
+.PARAMETER LauncherId
+	When PsfLauncher hosts the scripts, the process id of PsfLauncher, so that the ending script isn't waited for
+	forever if PsfLauncher goes away.
 #>
 
 Param (
-    [Parameter(Mandatory=$true)]
-    [string]$ScriptPathAndArguments
+    [Parameter(Mandatory=$false, Position=0)]
+    [string]$ScriptPathAndArguments,
+
+    [Parameter(Mandatory=$false)]
+    [string]$StartScript,
+
+    [Parameter(Mandatory=$false)]
+    [string]$EndScript,
+
+    [Parameter(Mandatory=$false)]
+    [string]$EventPrefix,
+
+    [Parameter(Mandatory=$false)]
+    [int]$LauncherId
 )
 
-try
+function OpenLauncherEvent($name)
+{
+	return [System.Threading.EventWaitHandle]::OpenExisting("$EventPrefix-$name")
+}
+
+function InvokeHostedScript($expression)
 {
-	invoke-expression $scriptPathAndArguments
+	try
+	{
+		invoke-expression $expression | Out-Host
+		return $true
+	}
+	catch
+	{
+		write-host $_.Exception.Message
+		return $false
+	}
 }
-catch
+
+if (-not $EventPrefix)
+{
+	try
+	{
+		invoke-expression $scriptPathAndArguments
+	}
+	catch
+	{
+		write-host $_.Exception.Message
+		#ERROR 774 refers to ERROR_ERRORS_ENCOUNTERED.
+		#This error will be brought up the the user.
+		exit(774)
+	}
+
+	exit(0)
+}
+
+# Hosted: both scripts run in this one PowerShell, rather than each in a PowerShell of its own
+$succeeded = $true
+if ($StartScript)
+{
+	$succeeded = InvokeHostedScript $StartScript
+	if (-not $succeeded)
+	{
+		(OpenLauncherEvent "StartFailed").Set() | Out-Null
+	}
+}
+(OpenLauncherEvent "StartDone").Set() | Out-Null
+
+if ($EndScript)
+{
+	$waitHandles = New-Object System.Collections.Generic.List[System.Threading.WaitHandle]
+	$waitHandles.Add((OpenLauncherEvent "RunEnd"))
+	$waitHandles.Add((OpenLauncherEvent "SkipEnd"))
+	try
+	{
+		# NOTE: $launcher owns the process handle, and so must stay referenced for as long as it's waited on
+		$launcher = [System.Diagnostics.Process]::GetProcessById($LauncherId)
+		$launcherExited = New-Object System.Threading.ManualResetEvent $false
+		$launcherExited.SafeWaitHandle = New-Object Microsoft.Win32.SafeHandles.SafeWaitHandle ($launcher.Handle, $false)
+		$waitHandles.Add($launcherExited)
+	}
+	catch
+	{
+		# PsfLauncher has already gone away
+		exit(0)
+	}
+
+	if ([System.Threading.WaitHandle]::WaitAny($waitHandles.ToArray()) -eq 0)
+	{
+		$succeeded = (InvokeHostedScript $EndScript) -and $succeeded
+	}
+}
+
+if (-not $succeeded)
 {
-	write-host $_.Exception.Message
 	#ERROR 774 refers to ERROR_ERRORS_ENCOUNTERED.
-	#This error will be brought up the the user.
 	exit(774)
 }
 
-exit(0)
\ No newline at end of file
+exit(0)
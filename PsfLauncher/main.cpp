@@ -7,6 +7,7 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <thread>
 
 #include <windows.h>
 #include <shellapi.h>
@@ -17,6 +18,8 @@
 #include "StartProcessHelper.h"
 #include "Telemetry.h"
 #include "PsfPowershellScriptRunner.h"
+#include "LauncherCache.h"
+#include "ResourcePolicy.h"
 #include "Globals.h"
 #include <TraceLoggingProvider.h>
 #include <psf_constants.h>
@@ -39,14 +42,26 @@ using namespace std::literals;
 void LogApplicationAndProcessesCollection();
 int launcher_main(PCWSTR args, int cmdShow) noexcept;
 void GetAndLaunchMonitor(const psf::json_object& monitor, std::filesystem::path packageRoot, int cmdShow, LPCWSTR dirStr);
-void LaunchMonitorInBackground(std::filesystem::path packageRoot, const wchar_t executable[], const wchar_t arguments[], bool wait, bool asAdmin, int cmdShow, LPCWSTR dirStr);
+LauncherCache::LaunchPlan ResolveLaunchPlan(const psf::json_object& appConfig, const std::filesystem::path& packageRoot, bool& dependsOnEnvironment);
+void LaunchMonitorInBackground(std::filesystem::path packageRoot, const wchar_t executable[], const wchar_t arguments[], bool wait, bool asAdmin, DWORD readyTimeout, int cmdShow, LPCWSTR dirStr);
 bool IsCurrentOSRS2OrGreater();
-std::wstring ReplaceVariablesInString(std::wstring inputString, bool ReplaceEnvironmentVars, bool ReplacePseudoVars);
 
 static inline bool check_suffix_if(iwstring_view str, iwstring_view suffix) noexcept;
 
+static LARGE_INTEGER g_launcherStart;
+
+// Hands the launch's timestamps down to the application, whose PSF Runtime reports them along with its own timings
+static void set_launcher_timestamps()
+{
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+    auto value = std::to_wstring(g_launcherStart.QuadPart) + L";" + std::to_wstring(now.QuadPart);
+    ::SetEnvironmentVariableW(psf::launcher_timestamps_variable, value.c_str());
+}
+
 int __stdcall wWinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ PWSTR args, _In_ int cmdShow)
 {
+    ::QueryPerformanceCounter(&g_launcherStart);
     return launcher_main(args, cmdShow);
 }
 
@@ -57,25 +72,53 @@ int launcher_main(PCWSTR args, int cmdShow) noexcept try
     auto appConfig = PSFQueryCurrentAppLaunchConfig(true);
     THROW_HR_IF_MSG(ERROR_NOT_FOUND, !appConfig, "Error: could not find matching appid in config.json and appx manifest");
 
-    LogApplicationAndProcessesCollection();
+    // The telemetry walks the whole configuration, so it's kept off of the path to launching the application. It's only
+    // waited for when the launcher is about to exit anyway
+    std::thread telemetryThread;
+    if (TraceLoggingProviderEnabled(g_Log_ETW_ComponentProvider, 0, MICROSOFT_KEYWORD_CRITICAL_DATA))
+    {
+        telemetryThread = std::thread([]
+        {
+            ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+            LogApplicationAndProcessesCollection();
+        });
+    }
+    auto joinTelemetry = wil::scope_exit([&]
+    {
+        if (telemetryThread.joinable())
+        {
+            telemetryThread.join();
+        }
+    });
 
     auto dirPtr = appConfig->try_get("workingDirectory");
     auto dirStr = dirPtr ? dirPtr->as_string().wide() : L"";
 
     // At least for now, configured launch paths are relative to the package root
     std::filesystem::path packageRoot = PSFQueryPackageRootPath();
-    std::wstring dirWstr = dirStr;
-    dirWstr = ReplaceVariablesInString(dirWstr, true, true);
-    std::filesystem::path currentDirectory;
-    if (dirWstr.size() <2 ||  dirWstr[1] != L':')
+
+    // With warmStart, the resolved launch is remembered, so that later launches of the same version of the package can
+    // skip resolving it again
+    auto warmStartPtr = appConfig->try_get("warmStart");
+    bool warmStart = warmStartPtr && warmStartPtr->as_boolean().get();
+    std::wstring appId = appConfig->get("id").as_string().wide();
+    LauncherCache::LaunchPlan plan;
+    if (!warmStart || !LauncherCache::Instance().TryGetLaunchPlan(appId, plan))
     {
-        currentDirectory = (packageRoot / dirWstr);
+        bool dependsOnEnvironment = false;
+        plan = ResolveLaunchPlan(*appConfig, packageRoot, dependsOnEnvironment);
+        if (warmStart && !dependsOnEnvironment)
+        {
+            LauncherCache::Instance().RememberLaunchPlan(appId, plan);
+        }
     }
     else
     {
-        currentDirectory = dirWstr;
+        Log("\tUsing the remembered launch of %ls", appId.c_str());
     }
 
+    std::filesystem::path currentDirectory = plan.workingDirectory;
+
     PsfPowershellScriptRunner powershellScriptRunner;
 
     if (IsCurrentOSRS2OrGreater())
@@ -94,31 +137,34 @@ int launcher_main(PCWSTR args, int cmdShow) noexcept try
         GetAndLaunchMonitor(*monitor, packageRoot, cmdShow, dirStr);
     }
 
-    // Launch underlying application.
-    auto exeName = appConfig->get("executable").as_string().wide();
-    std::wstring exeWName = exeName;
-    exeWName = ReplaceVariablesInString(exeWName, true, true);
-    std::filesystem::path exePath;
-    if (exeWName[1] != L':')
+    // A starting script that runs alongside the monitor and application may still need to get things ready for the
+    // application first
+    if (IsCurrentOSRS2OrGreater())
     {
-        exePath = packageRoot / exeWName;
+        powershellScriptRunner.WaitForStartingScriptReady();
     }
-    else
+
+    // The resource policy only applies to the application and what it goes on to start, not to the monitor and scripts
+    auto resourcePolicy = ReadResourcePolicy(*appConfig);
+    wil::unique_handle resourceJob;
+    if (resourcePolicy.NeedsJob())
     {
-        exePath = exeWName;
+        resourceJob = CreateResourceJob(resourcePolicy);
     }
-    
-    auto exeArgs = appConfig->try_get("arguments"); 
-    std::wstring exeArgString = exeArgs ? exeArgs->as_string().wide() : (wchar_t*)L"";
-    exeArgString = ReplaceVariablesInString(exeArgString, true, true);
+    SetInheritedProcessPolicy(&resourcePolicy);
+
+    // Launch underlying application.
+    std::filesystem::path exePath = plan.executable;
+    std::wstring exeArgString = plan.arguments;
 
     // Keep these quotes here.  StartProcess assumes there are quotes around the exe file name
-    if (check_suffix_if(exeName, L".exe"_isv))
+    if (check_suffix_if(plan.executable.c_str(), L".exe"_isv))
     {
         std::wstring fullargs = (L"\"" + exePath.native() + L"\" " + exeArgString + L" " + args);
         LogString("Process Launch: ", fullargs.data());
         LogString("Working Directory: ", currentDirectory.c_str());
-        HRESULT hr = StartProcess(exePath.c_str(), fullargs.data(), currentDirectory.c_str(), cmdShow,  INFINITE);
+        set_launcher_timestamps();
+        HRESULT hr = StartProcess(exePath.c_str(), fullargs.data(), currentDirectory.c_str(), cmdShow,  INFINITE, nullptr, resourceJob.get());
         if (hr != ERROR_SUCCESS)
         {
             Log("Error return from launching process.");
@@ -129,8 +175,10 @@ int launcher_main(PCWSTR args, int cmdShow) noexcept try
         LogString("Shell Launch", exePath.c_str());
         LogString("   Arguments", exeArgString.c_str());
         LogString("Working Directory: ", currentDirectory.c_str());
-        StartWithShellExecute(packageRoot, exePath, exeArgString, currentDirectory.c_str(), cmdShow, INFINITE);
+        set_launcher_timestamps();
+        StartWithShellExecute(packageRoot, exePath, exeArgString, currentDirectory.c_str(), cmdShow, INFINITE, resourceJob.get());
     }
+    SetInheritedProcessPolicy(nullptr);
 
     if (IsCurrentOSRS2OrGreater())
     {
@@ -148,14 +196,55 @@ catch (...)
     return win32_from_caught_exception();
 }
 
+LauncherCache::LaunchPlan ResolveLaunchPlan(const psf::json_object& appConfig, const std::filesystem::path& packageRoot, bool& dependsOnEnvironment)
+{
+    LauncherCache::LaunchPlan plan;
+
+    // Only the pseudo-variables are known not to change between launches
+    auto replaceVariables = [&](const std::wstring& value)
+    {
+        dependsOnEnvironment = dependsOnEnvironment || (psf::expand_variables(value.c_str(), false).find(L'%') != std::wstring::npos);
+        return psf::expand_variables(value.c_str());
+    };
+
+    auto dirPtr = appConfig.try_get("workingDirectory");
+    std::wstring dirWstr = replaceVariables(dirPtr ? dirPtr->as_string().wide() : L"");
+    if (dirWstr.size() <2 ||  dirWstr[1] != L':')
+    {
+        plan.workingDirectory = (packageRoot / dirWstr).native();
+    }
+    else
+    {
+        plan.workingDirectory = dirWstr;
+    }
+
+    std::wstring exeWName = replaceVariables(appConfig.get("executable").as_string().wide());
+    if (exeWName[1] != L':')
+    {
+        plan.executable = (packageRoot / exeWName).native();
+    }
+    else
+    {
+        plan.executable = exeWName;
+    }
+
+    auto exeArgs = appConfig.try_get("arguments");
+    plan.arguments = replaceVariables(exeArgs ? exeArgs->as_string().wide() : L"");
+
+    return plan;
+}
+
 void GetAndLaunchMonitor(const psf::json_object& monitor, std::filesystem::path packageRoot, int cmdShow, LPCWSTR dirStr)
 {
     bool asAdmin = false;
     bool wait = false;
+    // By default, wait for as long as the launcher used to sleep for monitors that don't signal when they're ready
+    DWORD readyTimeout = 5000;
     auto monitorExecutable = monitor.try_get("executable");
     auto monitorArguments = monitor.try_get("arguments");
     auto monitorAsAdmin = monitor.try_get("asadmin");
     auto monitorWait = monitor.try_get("wait");
+    auto monitorReadyTimeout = monitor.try_get("readyTimeout");
     if (monitorAsAdmin)
     {
         asAdmin = monitorAsAdmin->as_boolean().get();
@@ -166,16 +255,34 @@ void GetAndLaunchMonitor(const psf::json_object& monitor, std::filesystem::path
         wait = monitorWait->as_boolean().get();
     }
 
+    if (monitorReadyTimeout)
+    {
+        // Timeout is given in seconds, like the timeouts of scripts
+        readyTimeout = static_cast<DWORD>(1000 * monitorReadyTimeout->as_number().get_unsigned());
+    }
+
     Log("\tCreating the monitor: %ls", monitorExecutable->as_string().wide());
-    LaunchMonitorInBackground(packageRoot, monitorExecutable->as_string().wide(), monitorArguments->as_string().wide(), wait, asAdmin, cmdShow, dirStr);
+    LaunchMonitorInBackground(packageRoot, monitorExecutable->as_string().wide(), monitorArguments->as_string().wide(), wait, asAdmin, readyTimeout, cmdShow, dirStr);
 }
 
-void LaunchMonitorInBackground(std::filesystem::path packageRoot, const wchar_t executable[], const wchar_t arguments[], bool wait, bool asAdmin, int cmdShow, LPCWSTR dirStr)
+void LaunchMonitorInBackground(std::filesystem::path packageRoot, const wchar_t executable[], const wchar_t arguments[], bool wait, bool asAdmin, DWORD readyTimeout, int cmdShow, LPCWSTR dirStr)
 {
     std::wstring cmd = L"\"" + (packageRoot / executable).native() + L"\"";
 
     if (asAdmin)
     {
+        // Due to elevation, the process starts, relaunches, and the main process ends in under 1ms, so neither its
+        // handle nor WaitForInputIdle tell us when the monitor is up. Instead, the monitor signals an event once it's
+        // tracing, whose name we hand it on the command line
+        std::wstring monitorArguments = arguments;
+        wil::unique_event readyEvent;
+        if (!wait)
+        {
+            auto readyEventName = L"Local\\PsfMonitorReady-"s + std::to_wstring(::GetCurrentProcessId());
+            readyEvent.create(wil::EventOptions::ManualReset, readyEventName.c_str());
+            monitorArguments += L" /readyEvent:" + readyEventName;
+        }
+
         // This happens when the program is requested for elevation.
         SHELLEXECUTEINFOW shExInfo =
         {
@@ -184,7 +291,7 @@ void LaunchMonitorInBackground(std::filesystem::path packageRoot, const wchar_t
             , 0           // hwnd
             , L"runas"    // lpVerb
             , cmd.c_str() // lpFile
-            , arguments   // lpParameters
+            , monitorArguments.c_str() // lpParameters
             , nullptr     // lpDirectory
             , 1           // nShow
             , 0           // hInstApp
@@ -200,10 +307,11 @@ void LaunchMonitorInBackground(std::filesystem::path packageRoot, const wchar_t
         }
         else
         {
-            WaitForInputIdle(shExInfo.hProcess, 1000);
-            // Due to elevation, the process starts, relaunches, and the main process ends in under 1ms.
-            // So we'll just toss in an ugly sleep here for now.
-            Sleep(5000);
+            CloseHandle(shExInfo.hProcess);
+            if (!readyEvent.wait(readyTimeout))
+            {
+                Log("\tMonitor did not signal that it was ready within %u ms; launching the application anyway", readyTimeout);
+            }
         }
 
         // Should not kill the intended app because the monitor elevated.
@@ -218,45 +326,6 @@ void LaunchMonitorInBackground(std::filesystem::path packageRoot, const wchar_t
 }
 
 
-// Replace all occurrences of requested environment and/or pseudo-environment variables in a string.
-std::wstring ReplaceVariablesInString(std::wstring inputString, bool ReplaceEnvironmentVars, bool ReplacePseudoVars)
-{
-    std::wstring outputString = inputString;
-    if (ReplacePseudoVars)
-    {
-        std::wstring::size_type pos = 0u;
-        std::wstring var2rep = L"%MsixPackageRoot%";
-        std::wstring repargs = PSFQueryPackageRootPath();
-        while ((pos = outputString.find(var2rep, pos)) != std::string::npos) {
-            outputString.replace(pos, var2rep.length(), repargs);
-            pos += repargs.length();
-        }
-
-        pos = 0u;
-        var2rep = L"%MsixWritablePackageRoot%";
-        std::filesystem::path writablePackageRootPath = psf::known_folder(FOLDERID_LocalAppData) / std::filesystem::path(L"Packages") / psf::current_package_family_name() / LR"(LocalCache\Local\Microsoft\WritablePackageRoot)";
-        repargs = writablePackageRootPath.c_str();
-        while ((pos = outputString.find(var2rep, pos)) != std::string::npos) {
-            outputString.replace(pos, var2rep.length(), repargs);
-            pos += repargs.length();
-        }
-    }
-    if (ReplaceEnvironmentVars)
-    {
-        // Potentially an environment variable that needs replacing. For Example: "%HomeDir%\\Documents"
-        DWORD nSizeBuff = 256;
-        LPWSTR buff = new wchar_t[nSizeBuff];
-        DWORD nSizeRet = ExpandEnvironmentStrings(outputString.c_str(), buff, nSizeBuff);
-        if (nSizeRet > 0)
-        {
-            outputString = std::wstring(buff);
-        }
-
-    }
-    return outputString;
-}
-
-
 static inline bool check_suffix_if(iwstring_view str, iwstring_view suffix) noexcept
 {
     return ((str.length() >= suffix.length()) && (str.substr(str.length() - suffix.length()) == suffix));
@@ -266,52 +335,62 @@ void LogApplicationAndProcessesCollection()
 {
     auto configRoot = PSFQueryConfigRoot();
 
+    // Summarized into one event per section, rather than one per entry, since configurations can list a good many
+    psf::telemetry_list applicationExecutables;
+    psf::telemetry_list applicationIds;
     if (auto applications = configRoot->as_object().try_get("applications"))
     {
         for (auto& applicationsConfig : applications->as_array())
         {
-            auto exeStr = applicationsConfig.as_object().try_get("executable")->as_string().wide();
-            auto idStr = applicationsConfig.as_object().try_get("id")->as_string().wide();
-            TraceLoggingWrite(
-                g_Log_ETW_ComponentProvider,
-                "ApplicationsConfigdata",
-                TraceLoggingWideString(exeStr, "applications_executable"),
-                TraceLoggingWideString(idStr, "applications_id"),
-                TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
-                TelemetryPrivacyDataTag(PDT_ProductAndServiceUsage),
-                TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+            applicationExecutables.add(applicationsConfig.as_object().try_get("executable")->as_string().wide());
+            applicationIds.add(applicationsConfig.as_object().try_get("id")->as_string().wide());
         }
     }
 
+    TraceLoggingWrite(
+        g_Log_ETW_ComponentProvider,
+        "ApplicationsConfigdata",
+        TraceLoggingUInt32(applicationIds.count(), "applications_count"),
+        TraceLoggingWideString(applicationExecutables.c_str(), "applications_executable"),
+        TraceLoggingWideString(applicationIds.c_str(), "applications_id"),
+        TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
+        TelemetryPrivacyDataTag(PDT_ProductAndServiceUsage),
+        TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+
+    // Each process's fixups are listed after its executable, separated by commas, e.g. "PsfLauncher.*;App.exe,FileRedirectionFixup.dll"
+    psf::telemetry_list processExecutables;
+    psf::telemetry_list processFixups;
+    std::uint32_t fixupCount = 0;
     if (auto processes = configRoot->as_object().try_get("processes"))
     {
         for (auto& processConfig : processes->as_array())
         {
-            auto exeStr = processConfig.as_object().get("executable").as_string().wide();
-            TraceLoggingWrite(
-                g_Log_ETW_ComponentProvider,
-                "ProcessesExecutableConfigdata",
-                TraceLoggingWideString(exeStr, "processes_executable"),
-                TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
-                TelemetryPrivacyDataTag(PDT_ProductAndServiceUsage),
-                TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+            std::wstring entry = processConfig.as_object().get("executable").as_string().wide();
+            processExecutables.add(entry);
 
             if (auto fixups = processConfig.as_object().try_get("fixups"))
             {
                 for (auto& fixupConfig : fixups->as_array())
                 {
-                    auto dllStr = fixupConfig.as_object().try_get("dll")->as_string().wide();
-                    TraceLoggingWrite(
-                        g_Log_ETW_ComponentProvider,
-                        "ProcessesFixUpConfigdata",
-                        TraceLoggingWideString(dllStr, "processes_fixups"),
-                        TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
-                        TelemetryPrivacyDataTag(PDT_ProductAndServiceUsage),
-                        TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+                    entry.push_back(L',');
+                    entry.append(fixupConfig.as_object().try_get("dll")->as_string().wide());
+                    ++fixupCount;
                 }
             }
+            processFixups.add(entry);
         }
     }
+
+    TraceLoggingWrite(
+        g_Log_ETW_ComponentProvider,
+        "ProcessesConfigdata",
+        TraceLoggingUInt32(processExecutables.count(), "processes_count"),
+        TraceLoggingUInt32(fixupCount, "processes_fixups_count"),
+        TraceLoggingWideString(processExecutables.c_str(), "processes_executable"),
+        TraceLoggingWideString(processFixups.c_str(), "processes_fixups"),
+        TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
+        TelemetryPrivacyDataTag(PDT_ProductAndServiceUsage),
+        TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
 }
 
 bool IsCurrentOSRS2OrGreater()
@@ -0,0 +1,188 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include <known_folders.h>
+#include <package_index.h>
+
+struct index_entry
+{
+    std::wstring path;
+    DWORD attributes;
+};
+
+static bool enumerate_layout(const std::filesystem::path& rootPath, std::vector<index_entry>& result)
+{
+    std::vector<std::wstring> pending{ std::wstring{} };
+    while (!pending.empty())
+    {
+        auto relativePath = std::move(pending.back());
+        pending.pop_back();
+
+        auto searchPath = rootPath.native();
+        if (!relativePath.empty())
+        {
+            searchPath.push_back(L'\\');
+            searchPath += relativePath;
+        }
+        searchPath += LR"(\*)";
+
+        WIN32_FIND_DATAW data;
+        auto findHandle = ::FindFirstFileExW(searchPath.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+        if (findHandle == INVALID_HANDLE_VALUE)
+        {
+            std::fwprintf(stderr, L"ERROR: Could not enumerate %ls (%lu)\n", searchPath.c_str(), ::GetLastError());
+            return false;
+        }
+
+        do
+        {
+            if ((wcscmp(data.cFileName, L".") == 0) || (wcscmp(data.cFileName, L"..") == 0))
+            {
+                continue;
+            }
+
+            auto entry = relativePath;
+            if (!entry.empty())
+            {
+                entry.push_back(L'\\');
+            }
+            entry += data.cFileName;
+
+            // Any previously generated index is replaced below
+            if (relativePath.empty() && (_wcsicmp(data.cFileName, psf::package_index_file_name) == 0))
+            {
+                continue;
+            }
+
+            // NOTE: Reparse points are recorded, but not followed, so that we never loop
+            if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            {
+                pending.push_back(entry);
+            }
+
+            psf::make_package_index_key(entry);
+            result.push_back(index_entry{ std::move(entry), data.dwFileAttributes });
+        }
+        while (::FindNextFileW(findHandle, &data));
+
+        auto err = ::GetLastError();
+        ::FindClose(findHandle);
+        if (err != ERROR_NO_MORE_FILES)
+        {
+            std::fwprintf(stderr, L"ERROR: Could not enumerate %ls (%lu)\n", searchPath.c_str(), err);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool write_index(const std::filesystem::path& outputPath, const std::vector<index_entry>& entries)
+{
+    std::size_t stringTableLength = 0;
+    for (auto& entry : entries)
+    {
+        stringTableLength += entry.path.length();
+    }
+
+    if ((entries.size() > std::numeric_limits<std::uint32_t>::max()) ||
+        (stringTableLength > std::numeric_limits<std::uint32_t>::max()))
+    {
+        std::fwprintf(stderr, L"ERROR: The package layout is too large to index\n");
+        return false;
+    }
+
+    psf::package_index_header header{};
+    header.magic = psf::package_index_magic;
+    header.version = psf::package_index_version;
+    header.entry_count = static_cast<std::uint32_t>(entries.size());
+    header.string_table_length = static_cast<std::uint32_t>(stringTableLength);
+
+    std::vector<psf::package_index_entry> table;
+    table.reserve(entries.size());
+    std::uint32_t offset = 0;
+    for (auto& entry : entries)
+    {
+        auto length = static_cast<std::uint32_t>(entry.path.length());
+        table.push_back(psf::package_index_entry{ offset, length, entry.attributes });
+        offset += length;
+    }
+
+    std::ofstream file(outputPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(table[0]));
+    for (auto& entry : entries)
+    {
+        file.write(reinterpret_cast<const char*>(entry.path.data()), entry.path.length() * sizeof(wchar_t));
+    }
+
+    file.close();
+    if (!file)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not write %ls\n", outputPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    if ((argc < 2) || (argc > 3))
+    {
+        std::fwprintf(stderr, L"Usage: %ls <package layout path> [<output path>]\n", argv[0]);
+        std::fwprintf(stderr, L"    Writes an index of every file and folder in the package layout, by default to\n");
+        std::fwprintf(stderr, L"    %ls in the root of the layout.\n", psf::package_index_file_name);
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::error_code ec;
+    auto rootPath = std::filesystem::absolute(argv[1], ec);
+    if (ec || !std::filesystem::is_directory(rootPath, ec))
+    {
+        std::fwprintf(stderr, L"ERROR: %ls is not a directory\n", argv[1]);
+        return ERROR_PATH_NOT_FOUND;
+    }
+    rootPath = psf::remove_trailing_path_separators(rootPath);
+
+    auto outputPath = (argc == 3) ? std::filesystem::absolute(argv[2], ec) : (rootPath / psf::package_index_file_name);
+
+    std::vector<index_entry> entries;
+    if (!enumerate_layout(rootPath, entries))
+    {
+        return ERROR_READ_FAULT;
+    }
+
+    // When written into the layout, the index is itself part of the package
+    if (_wcsicmp(outputPath.c_str(), (rootPath / psf::package_index_file_name).c_str()) == 0)
+    {
+        std::wstring key = psf::package_index_file_name;
+        psf::make_package_index_key(key);
+        entries.push_back(index_entry{ std::move(key), FILE_ATTRIBUTE_ARCHIVE });
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const index_entry& lhs, const index_entry& rhs)
+    {
+        return lhs.path < rhs.path;
+    });
+
+    if (!write_index(outputPath, entries))
+    {
+        return ERROR_WRITE_FAULT;
+    }
+
+    std::wprintf(L"Wrote %zu entries to %ls\n", entries.size(), outputPath.c_str());
+    return ERROR_SUCCESS;
+}
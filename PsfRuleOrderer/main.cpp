@@ -0,0 +1,336 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstdio>
+#include <cwchar>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <rule_order.h>
+#include <utilities.h>
+
+struct rule_profile
+{
+    std::wstring executable;
+    std::map<std::string, std::uint64_t> matches; // config_location -> matches
+};
+
+static bool read_profile(const std::filesystem::path& path, rule_profile& result)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not open %ls\n", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        auto tab = line.find('\t');
+        if (tab == std::string::npos)
+        {
+            continue;
+        }
+
+        auto value = line.substr(tab + 1);
+        if (line.compare(0, tab, "executable") == 0)
+        {
+            result.executable = widen(value);
+        }
+        else if ((tab != 0) && (line.find_first_not_of("0123456789") == tab))
+        {
+            result.matches[value] += std::stoull(line.substr(0, tab));
+        }
+    }
+
+    if (result.executable.empty())
+    {
+        std::fwprintf(stderr, L"ERROR: %ls is not a rule profile written by the File Redirection Fixup\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static std::wstring string_member(const rapidjson::Value& object, const char* name)
+{
+    if (!object.IsObject())
+    {
+        return {};
+    }
+    auto itr = object.FindMember(name);
+    return ((itr != object.MemberEnd()) && itr->value.IsString()) ? widen(itr->value.GetString()) : std::wstring{};
+}
+
+static bool bool_member(const rapidjson::Value& object, const char* name)
+{
+    if (!object.IsObject())
+    {
+        return false;
+    }
+    auto itr = object.FindMember(name);
+    return (itr != object.MemberEnd()) && itr->value.IsBool() && itr->value.GetBool();
+}
+
+// Puts the elements of 'array' into 'order', a list of their current indices
+static void permute(rapidjson::Value& array, const std::vector<std::size_t>& order, rapidjson::Document::AllocatorType& allocator)
+{
+    std::vector<rapidjson::Value> values;
+    values.reserve(array.Size());
+    for (auto& value : array.GetArray())
+    {
+        values.emplace_back(std::move(value));
+    }
+
+    array.Clear();
+    for (auto index : order)
+    {
+        array.PushBack(values[index], allocator);
+    }
+}
+
+// Reorders one array of redirection rules - e.g. "packageRelative" - and the patterns of each of its rules. 'location'
+// is the JSON pointer to the array, in the same form as the profile's config_location values. Returns the number of
+// rules whose position changed
+static std::size_t reorder_rules(rapidjson::Value& rules, const std::string& location, const rule_profile& profile,
+    rapidjson::Document::AllocatorType& allocator)
+{
+    if (!rules.IsArray())
+    {
+        return 0;
+    }
+
+    auto hitsOf = [&](const std::string& patternLocation) -> std::uint64_t
+    {
+        auto itr = profile.matches.find(patternLocation);
+        return (itr == profile.matches.end()) ? 0 : itr->second;
+    };
+
+    std::size_t moved = 0;
+    std::vector<std::uint64_t> ruleHits(rules.Size());
+    for (rapidjson::SizeType i = 0; i < rules.Size(); ++i)
+    {
+        auto& rule = rules[i];
+        if (!rule.IsObject())
+        {
+            continue;
+        }
+        auto patterns = rule.FindMember("patterns");
+        if ((patterns == rule.MemberEnd()) || !patterns->value.IsArray())
+        {
+            continue;
+        }
+
+        // All patterns of one rule share its base path and its effect, so any order of them gives the same result.
+        // Exclusions are left exactly as they were written
+        auto ruleLocation = location + "/" + std::to_string(i);
+        std::vector<std::uint64_t> patternHits(patterns->value.Size());
+        std::vector<std::size_t> order(patternHits.size());
+        for (std::size_t p = 0; p < patternHits.size(); ++p)
+        {
+            patternHits[p] = hitsOf(ruleLocation + "/patterns/" + std::to_string(p));
+            ruleHits[i] += patternHits[p];
+            order[p] = p;
+        }
+
+        if (!bool_member(rule, "isExclusion"))
+        {
+            psf::order_rules_by_hits(order, patternHits, [](std::size_t) { return false; }, [](std::size_t, std::size_t) { return true; });
+            for (std::size_t p = 0; p < order.size(); ++p)
+            {
+                moved += (order[p] != p) ? 1 : 0;
+            }
+            permute(patterns->value, order, allocator);
+        }
+    }
+
+    std::vector<std::size_t> order(rules.Size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+
+    // The same rules as the File Redirection Fixup's adaptive mode; see rule_order.h
+    psf::order_rules_by_hits(order, ruleHits,
+        [&](std::size_t index) { return bool_member(rules[static_cast<rapidjson::SizeType>(index)], "isExclusion"); },
+        [&](std::size_t lhs, std::size_t rhs)
+        {
+            auto& left = rules[static_cast<rapidjson::SizeType>(lhs)];
+            auto& right = rules[static_cast<rapidjson::SizeType>(rhs)];
+            return ((bool_member(left, "isReadOnly") == bool_member(right, "isReadOnly")) &&
+                (_wcsicmp(string_member(left, "redirectTargetBase").c_str(), string_member(right, "redirectTargetBase").c_str()) == 0)) ||
+                psf::base_paths_disjoint(string_member(left, "base"), string_member(right, "base"));
+        });
+
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        moved += (order[i] != i) ? 1 : 0;
+    }
+    permute(rules, order, allocator);
+    return moved;
+}
+
+// Finds the File Redirection Fixup's configuration for the first process whose "executable" matches, the same way that
+// the PsfRuntime picks the process configuration
+static rapidjson::Value* find_fixup_config(rapidjson::Document& document, const std::wstring& executable)
+{
+    if (!document.IsObject())
+    {
+        return nullptr;
+    }
+    auto processes = document.FindMember("processes");
+    if ((processes == document.MemberEnd()) || !processes->value.IsArray())
+    {
+        return nullptr;
+    }
+
+    for (auto& process : processes->value.GetArray())
+    {
+        auto pattern = string_member(process, "executable");
+        try
+        {
+            if (pattern.empty() || !std::regex_match(executable, std::wregex(pattern)))
+            {
+                continue;
+            }
+        }
+        catch (std::regex_error&)
+        {
+            std::fwprintf(stderr, L"WARNING: Skipping the process with the invalid executable pattern %ls\n", pattern.c_str());
+            continue;
+        }
+
+        auto fixups = process.FindMember("fixups");
+        if ((fixups == process.MemberEnd()) || !fixups->value.IsArray())
+        {
+            return nullptr;
+        }
+
+        for (auto& fixup : fixups->value.GetArray())
+        {
+            constexpr wchar_t dllPrefix[] = L"FileRedirectionFixup";
+            auto dll = string_member(fixup, "dll");
+            if (_wcsnicmp(dll.c_str(), dllPrefix, std::size(dllPrefix) - 1) == 0)
+            {
+                auto config = fixup.FindMember("config");
+                return (config != fixup.MemberEnd()) ? &config->value : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    return nullptr;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    if ((argc < 3) || (argc > 4))
+    {
+        std::fwprintf(stderr, L"Usage: %ls <config.json path> <profile path> [<output path>]\n", argv[0]);
+        std::fwprintf(stderr, L"    Reorders the File Redirection Fixup rules of the configuration, by default in place,\n");
+        std::fwprintf(stderr, L"    so that the rules that the profile shows to match most often are evaluated first.\n");
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::filesystem::path configPath = argv[1];
+    std::filesystem::path outputPath = (argc == 4) ? argv[3] : argv[1];
+
+    rule_profile profile;
+    if (!read_profile(argv[2], profile))
+    {
+        return ERROR_READ_FAULT;
+    }
+
+    std::ifstream configFile(configPath, std::ios::binary);
+    if (!configFile)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not open %ls\n", configPath.c_str());
+        return ERROR_FILE_NOT_FOUND;
+    }
+    std::stringstream configText;
+    configText << configFile.rdbuf();
+    configFile.close();
+
+    rapidjson::Document document;
+    document.Parse(configText.str().c_str());
+    if (document.HasParseError())
+    {
+        std::fwprintf(stderr, L"ERROR: %ls is not valid JSON: %hs (offset %zu)\n", configPath.c_str(),
+            rapidjson::GetParseError_En(document.GetParseError()), document.GetErrorOffset());
+        return ERROR_INVALID_DATA;
+    }
+
+    auto config = find_fixup_config(document, profile.executable);
+    if (!config || !config->IsObject())
+    {
+        std::fwprintf(stderr, L"ERROR: No File Redirection Fixup configuration applies to %ls\n", profile.executable.c_str());
+        return ERROR_NOT_FOUND;
+    }
+
+    std::size_t moved = 0;
+    auto& allocator = document.GetAllocator();
+    auto redirectedPaths = config->FindMember("redirectedPaths");
+    if ((redirectedPaths != config->MemberEnd()) && redirectedPaths->value.IsObject())
+    {
+        auto& paths = redirectedPaths->value;
+        for (auto name : { "packageRelative", "packageDriveRelative" })
+        {
+            auto rules = paths.FindMember(name);
+            if (rules != paths.MemberEnd())
+            {
+                moved += reorder_rules(rules->value, std::string("/redirectedPaths/") + name, profile, allocator);
+            }
+        }
+
+        auto knownFolders = paths.FindMember("knownFolders");
+        if ((knownFolders != paths.MemberEnd()) && knownFolders->value.IsArray())
+        {
+            for (rapidjson::SizeType i = 0; i < knownFolders->value.Size(); ++i)
+            {
+                auto& knownFolder = knownFolders->value[i];
+                if (!knownFolder.IsObject())
+                {
+                    continue;
+                }
+                auto rules = knownFolder.FindMember("relativePaths");
+                if (rules != knownFolder.MemberEnd())
+                {
+                    moved += reorder_rules(rules->value, "/redirectedPaths/knownFolders/" + std::to_string(i) + "/relativePaths", profile, allocator);
+                }
+            }
+        }
+    }
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.SetIndent(' ', 4);
+    document.Accept(writer);
+
+    std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+    output.write(buffer.GetString(), buffer.GetSize());
+    output.close();
+    if (!output)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not write %ls\n", outputPath.c_str());
+        return ERROR_WRITE_FAULT;
+    }
+
+    std::wprintf(L"Moved %zu rules and patterns for %ls; wrote %ls\n", moved, profile.executable.c_str(), outputPath.c_str());
+    return ERROR_SUCCESS;
+}
@@ -4,7 +4,10 @@
 //-------------------------------------------------------------------------------------------------------
 
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
+#include <iostream>
+#include <map>
 #include <string>
 
 #include <windows.h>
@@ -12,9 +15,13 @@
 
 using EntryPointProc = void (CALLBACK *)(HWND, HINSTANCE, LPSTR, int);
 
-int __stdcall WinMain(_In_ HINSTANCE, _In_ HINSTANCE, _In_opt_ PSTR cmdLine, _In_ int cmdShow)
+// Modules are loaded once per process and never freed, same as rundll32 does, so that batched requests for the same dll
+// only look up the entry point. Keyed by the path exactly as given, which is how the requests for one dll tend to name it
+static std::map<std::string, HMODULE> g_modules;
+
+static DWORD RunEntryPoint(char* cmdLine, int cmdShow)
 {
-    // RUNDLL.EXE <dllname>,<entrypoint> <optional arguments>
+    // <dllname>,<entrypoint> <optional arguments>
     auto dllPath = cmdLine;
 
     // The dll path can be a quoted string, in which case we should ignore commas until we find the closing quote
@@ -46,10 +53,16 @@ int __stdcall WinMain(_In_ HINSTANCE, _In_ HINSTANCE, _In_opt_ PSTR cmdLine, _In
         cmdLine = dummyString;
     }
 
-    auto mod = ::LoadLibraryA(dllPath);
+    auto& mod = g_modules[dllPath];
     if (!mod)
     {
-        return ::GetLastError();
+        mod = ::LoadLibraryA(dllPath);
+        if (!mod)
+        {
+            auto error = ::GetLastError();
+            g_modules.erase(dllPath);
+            return error;
+        }
     }
 
     EntryPointProc proc = nullptr;
@@ -72,3 +85,48 @@ int __stdcall WinMain(_In_ HINSTANCE, _In_ HINSTANCE, _In_opt_ PSTR cmdLine, _In
 
     return 0;
 }
+
+// "/batch" runs one request per line of standard input - each in the same form as PsfRunDll's command line - in this
+// one process, so that scripts that would otherwise start a rundll32 per call pay for starting a process, and for the
+// PSF Runtime being injected into it, just once. The result of each request, zero or a Win32 error, is written to
+// standard output as a line of its own, and processing continues with the next request regardless
+static DWORD RunBatch(int cmdShow)
+{
+    DWORD result = 0;
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        if (!line.empty() && (line.back() == '\r'))
+        {
+            line.pop_back();
+        }
+
+        if (line.empty())
+        {
+            continue;
+        }
+
+        auto error = RunEntryPoint(line.data(), cmdShow);
+        std::printf("%lu\n", error);
+        std::fflush(stdout);
+
+        if (!result)
+        {
+            result = error;
+        }
+    }
+
+    return result;
+}
+
+int __stdcall WinMain(_In_ HINSTANCE, _In_ HINSTANCE, _In_opt_ PSTR cmdLine, _In_ int cmdShow)
+{
+    // RUNDLL.EXE <dllname>,<entrypoint> <optional arguments>
+    // RUNDLL.EXE /batch
+    if (_stricmp(cmdLine, "/batch") == 0)
+    {
+        return static_cast<int>(RunBatch(cmdShow));
+    }
+
+    return static_cast<int>(RunEntryPoint(cmdLine, cmdShow));
+}
@@ -0,0 +1,360 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cwchar>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <detours.h>
+#include <TraceLoggingProvider.h>
+#include <psf_runtime.h>
+
+#include "AllocationTracking.h"
+
+void Log(const char* fmt, ...);
+
+// Defined along with the startup timings, which are written to the same provider
+TRACELOGGING_DECLARE_PROVIDER(g_Log_ETW_ComponentProvider);
+
+using HeapAlloc_t = LPVOID(WINAPI*)(HANDLE, DWORD, SIZE_T);
+using HeapReAlloc_t = LPVOID(WINAPI*)(HANDLE, DWORD, LPVOID, SIZE_T);
+
+struct tracked_detour
+{
+    void* fixup_fn;
+    void* target_fn;
+    std::uintptr_t code; // Where the detour's code starts, past any jump thunk (e.g. for incremental linking)
+    std::uintptr_t module_end;
+    std::atomic<std::uint64_t> allocations{ 0 };
+    std::atomic<std::uint64_t> bytes{ 0 };
+};
+
+static bool g_Enabled = false;
+static HeapAlloc_t g_HeapAlloc = nullptr;
+static HeapReAlloc_t g_HeapReAlloc = nullptr;
+
+// Sorted by where the detours' code starts. Detours are only added while fixups are being loaded, but fixups may already
+// have threads of their own that allocate by then
+static std::shared_mutex g_DetoursLock;
+static std::vector<std::unique_ptr<tracked_detour>> g_Detours;
+
+// Allocations that the tracked modules made outside of any detour, e.g. while loading their configuration
+static std::atomic<std::uint64_t> g_UnattributedAllocations{ 0 };
+static std::atomic<std::uint64_t> g_UnattributedBytes{ 0 };
+
+// Set while the thread is inside of the tracking code itself, which allocates while holding g_DetoursLock
+static thread_local bool t_Untracked = false;
+
+class untracked_scope
+{
+public:
+    untracked_scope() noexcept :
+        m_previous(t_Untracked)
+    {
+        t_Untracked = true;
+    }
+
+    untracked_scope(const untracked_scope&) = delete;
+    untracked_scope& operator=(const untracked_scope&) = delete;
+
+    ~untracked_scope()
+    {
+        t_Untracked = m_previous;
+    }
+
+private:
+    bool m_previous;
+};
+
+// Returns the detour whose code contains 'address', if any. Unwind data gives the exact start of the function on 64-bit
+// builds; 32-bit builds have none, so there the closest detour that starts before 'address', in the same module, is
+// assumed to contain it, which attributes helper functions that the linker placed after a detour to that detour
+static tracked_detour* find_detour(void* address) noexcept
+{
+    auto pc = reinterpret_cast<std::uintptr_t>(address);
+#if defined(_M_IX86)
+    auto itr = std::upper_bound(g_Detours.begin(), g_Detours.end(), pc, [](std::uintptr_t value, const std::unique_ptr<tracked_detour>& detour)
+    {
+        return value < detour->code;
+    });
+    if (itr == g_Detours.begin())
+    {
+        return nullptr;
+    }
+
+    auto& detour = *(itr - 1);
+    return (pc < detour->module_end) ? detour.get() : nullptr;
+#else
+    DWORD64 imageBase;
+    auto function = ::RtlLookupFunctionEntry(pc, &imageBase, nullptr);
+    if (!function)
+    {
+        return nullptr;
+    }
+
+    auto begin = static_cast<std::uintptr_t>(imageBase + function->BeginAddress);
+    auto itr = std::lower_bound(g_Detours.begin(), g_Detours.end(), begin, [](const std::unique_ptr<tracked_detour>& detour, std::uintptr_t value)
+    {
+        return detour->code < value;
+    });
+    return ((itr != g_Detours.end()) && ((*itr)->code == begin)) ? itr->get() : nullptr;
+#endif
+}
+
+// Attributes the allocation to the innermost detour on the stack. Must not allocate itself
+static void record_allocation(SIZE_T bytes) noexcept
+{
+    if (t_Untracked)
+    {
+        return;
+    }
+
+    void* frames[32];
+    auto frameCount = ::RtlCaptureStackBackTrace(2, static_cast<DWORD>(std::size(frames)), frames, nullptr);
+
+    std::shared_lock lock(g_DetoursLock);
+    for (USHORT i = 0; i < frameCount; ++i)
+    {
+        if (auto detour = find_detour(frames[i]))
+        {
+            detour->allocations.fetch_add(1, std::memory_order_relaxed);
+            detour->bytes.fetch_add(bytes, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    g_UnattributedAllocations.fetch_add(1, std::memory_order_relaxed);
+    g_UnattributedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+static LPVOID WINAPI TrackingHeapAlloc(HANDLE heap, DWORD flags, SIZE_T bytes)
+{
+    record_allocation(bytes);
+    return g_HeapAlloc(heap, flags, bytes);
+}
+
+static LPVOID WINAPI TrackingHeapReAlloc(HANDLE heap, DWORD flags, LPVOID memory, SIZE_T bytes)
+{
+    record_allocation(bytes);
+    return g_HeapReAlloc(heap, flags, memory, bytes);
+}
+
+void EnableAllocationTracking()
+{
+    // Both are forwarded to ntdll, so every import of them - whether through kernel32 or an API set - is resolved to the
+    // same address, which is what imports are compared against instead of their names
+    auto kernel32 = ::GetModuleHandleW(L"kernel32.dll");
+    g_HeapAlloc = reinterpret_cast<HeapAlloc_t>(::GetProcAddress(kernel32, "HeapAlloc"));
+    g_HeapReAlloc = reinterpret_cast<HeapReAlloc_t>(::GetProcAddress(kernel32, "HeapReAlloc"));
+    if (!g_HeapAlloc || !g_HeapReAlloc)
+    {
+        Log("Allocation tracking is not available: HeapAlloc could not be found");
+        return;
+    }
+
+    g_Enabled = true;
+    TrackModuleAllocations(::DetourGetContainingModule(reinterpret_cast<void*>(&EnableAllocationTracking)));
+}
+
+bool AllocationTrackingEnabled() noexcept
+{
+    return g_Enabled;
+}
+
+void TrackModuleAllocations(HMODULE module) noexcept
+{
+    if (!g_Enabled)
+    {
+        return;
+    }
+
+    ::DetourEnumerateImportsEx(module, nullptr, nullptr, [](void*, DWORD, LPCSTR, void** func) -> BOOL
+    {
+        void* replacement = nullptr;
+        if (func && (*func == reinterpret_cast<void*>(g_HeapAlloc)))
+        {
+            replacement = reinterpret_cast<void*>(&TrackingHeapAlloc);
+        }
+        else if (func && (*func == reinterpret_cast<void*>(g_HeapReAlloc)))
+        {
+            replacement = reinterpret_cast<void*>(&TrackingHeapReAlloc);
+        }
+
+        DWORD oldProtect;
+        if (replacement && ::VirtualProtect(func, sizeof(*func), PAGE_READWRITE, &oldProtect))
+        {
+            *func = replacement;
+            ::VirtualProtect(func, sizeof(*func), oldProtect, &oldProtect);
+        }
+
+        return TRUE;
+    });
+}
+
+void TrackDetour(void* implFn, void* fixupFn) noexcept try
+{
+    if (!g_Enabled)
+    {
+        return;
+    }
+
+    untracked_scope untracked;
+    auto detour = std::make_unique<tracked_detour>();
+    detour->fixup_fn = fixupFn;
+    detour->target_fn = implFn;
+    detour->code = reinterpret_cast<std::uintptr_t>(::DetourCodeFromPointer(fixupFn, nullptr));
+    if (auto module = ::DetourGetContainingModule(reinterpret_cast<void*>(detour->code)))
+    {
+        auto dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(module);
+        auto ntHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(reinterpret_cast<const std::byte*>(module) + dosHeader->e_lfanew);
+        detour->module_end = reinterpret_cast<std::uintptr_t>(module) + ntHeaders->OptionalHeader.SizeOfImage;
+    }
+
+    std::unique_lock lock(g_DetoursLock);
+    auto itr = std::upper_bound(g_Detours.begin(), g_Detours.end(), detour->code, [](std::uintptr_t value, const std::unique_ptr<tracked_detour>& existing)
+    {
+        return value < existing->code;
+    });
+    g_Detours.insert(itr, std::move(detour));
+}
+catch (...)
+{
+    // The detour's allocations just end up counted as unattributed
+}
+
+// The name that the module containing 'address' exports it under, if any
+static std::string export_name(void* address)
+{
+    struct context
+    {
+        void* address;
+        std::string name;
+    } data{ address, {} };
+
+    if (auto module = ::DetourGetContainingModule(address))
+    {
+        ::DetourEnumerateExports(module, &data, [](void* ctx, ULONG, LPCSTR name, void* code) -> BOOL
+        {
+            auto& found = *static_cast<context*>(ctx);
+            if (name && (code == found.address))
+            {
+                found.name = name;
+                return FALSE;
+            }
+            return TRUE;
+        });
+    }
+
+    if (data.name.empty())
+    {
+        char buffer[32];
+        std::snprintf(buffer, std::size(buffer), "%p", address);
+        data.name = buffer;
+    }
+
+    return data.name;
+}
+
+static std::wstring module_name(void* address)
+{
+    wchar_t path[MAX_PATH];
+    auto module = ::DetourGetContainingModule(address);
+    if (!module || !::GetModuleFileNameW(module, path, MAX_PATH))
+    {
+        return {};
+    }
+
+    auto name = std::wcsrchr(path, L'\\');
+    return name ? name + 1 : path;
+}
+
+void ReportAllocationStatistics() noexcept try
+{
+    if (!g_Enabled)
+    {
+        return;
+    }
+
+    untracked_scope untracked;
+    auto unattributedAllocations = g_UnattributedAllocations.load();
+    auto unattributedBytes = g_UnattributedBytes.load();
+    auto totalAllocations = unattributedAllocations;
+    auto totalBytes = unattributedBytes;
+
+    TraceLoggingRegister(g_Log_ETW_ComponentProvider);
+
+    std::shared_lock lock(g_DetoursLock);
+    for (auto& detour : g_Detours)
+    {
+        auto allocations = detour->allocations.load();
+        auto bytes = detour->bytes.load();
+        if (allocations == 0)
+        {
+            continue;
+        }
+
+        totalAllocations += allocations;
+        totalBytes += bytes;
+
+        auto function = export_name(detour->target_fn);
+        auto fixup = module_name(reinterpret_cast<void*>(detour->code));
+        Log("Allocations: %ls!%s: %llu allocations, %llu bytes", fixup.c_str(), function.c_str(), allocations, bytes);
+        TraceLoggingWrite(
+            g_Log_ETW_ComponentProvider,
+            "DetourAllocations",
+            TraceLoggingWideString(fixup.c_str(), "Fixup"),
+            TraceLoggingString(function.c_str(), "Function"),
+            TraceLoggingUInt64(allocations, "Allocations"),
+            TraceLoggingUInt64(bytes, "Bytes"));
+    }
+
+    Log("Allocations: %llu in total (%llu bytes), of which %llu (%llu bytes) outside of any detour",
+        totalAllocations, totalBytes, unattributedAllocations, unattributedBytes);
+    TraceLoggingWrite(
+        g_Log_ETW_ComponentProvider,
+        "AllocationTotals",
+        TraceLoggingUInt64(totalAllocations, "Allocations"),
+        TraceLoggingUInt64(totalBytes, "Bytes"),
+        TraceLoggingUInt64(unattributedAllocations, "UnattributedAllocations"),
+        TraceLoggingUInt64(unattributedBytes, "UnattributedBytes"));
+
+    TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
+}
+catch (...)
+{
+    // Only ever informational
+}
+
+PSFAPI unsigned __stdcall PSFQueryAllocationStatistics(_Out_writes_opt_(capacity) psf::allocation_statistics* statistics, unsigned capacity) noexcept
+{
+    if (!g_Enabled)
+    {
+        return 0;
+    }
+
+    std::shared_lock lock(g_DetoursLock);
+    auto count = static_cast<unsigned>(g_Detours.size() + 1);
+    for (unsigned i = 0; statistics && (i < std::min(count, capacity)); ++i)
+    {
+        if (i == 0)
+        {
+            statistics[i] = { nullptr, nullptr, g_UnattributedAllocations.load(), g_UnattributedBytes.load() };
+        }
+        else
+        {
+            auto& detour = *g_Detours[i - 1];
+            statistics[i] = { detour.fixup_fn, detour.target_fn, detour.allocations.load(), detour.bytes.load() };
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,22 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <windows.h>
+
+// Turns on counting the heap allocations of the PSF Runtime and of every fixup that is loaded afterwards, for processes
+// whose config sets "allocationTracking". Must be called before any detours are registered, since allocations are
+// attributed to the detour that they are made within
+void EnableAllocationTracking();
+bool AllocationTrackingEnabled() noexcept;
+
+// Counts the allocations that 'module' - along with its static CRT - makes from now on
+void TrackModuleAllocations(HMODULE module) noexcept;
+
+// Remembers a detour that is about to be attached, so that allocations made while it runs are attributed to it
+void TrackDetour(void* implFn, void* fixupFn) noexcept;
+
+// Writes the counts of every detour that allocated, along with the totals, to ETW and the debug output
+void ReportAllocationStatistics() noexcept;
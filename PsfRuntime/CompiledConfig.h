@@ -0,0 +1,631 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <windows.h>
+#include <compiled_config.h>
+#include <psf_config.h>
+
+#include "JsonConfig.h"
+
+class compiled_config;
+
+// The psf::json_value implementations for a compiled config, alongside json_string_impl, json_null_impl, and
+// json_boolean_impl. None of them own any memory; strings, keys, members, and elements all point into the mapped file,
+// and values refer to each other through the compiled_config that holds them
+struct compiled_number_impl : psf::json_number
+{
+    compiled_number_impl(const psf::compiled_config_number& number) noexcept : value(number) {}
+
+    virtual std::uint64_t get_unsigned() const noexcept override
+    {
+        return value_as<std::uint64_t>();
+    }
+
+    virtual std::int64_t get_signed() const noexcept override
+    {
+        return value_as<std::int64_t>();
+    }
+
+    virtual double get_float() const noexcept override
+    {
+        return value_as<double>();
+    }
+
+    template <typename T>
+    inline T value_as() const noexcept
+    {
+        switch (value.kind)
+        {
+        case 0: return static_cast<T>(static_cast<std::int64_t>(value.bits));
+        case 1: return static_cast<T>(value.bits);
+        }
+
+        double result;
+        std::memcpy(&result, &value.bits, sizeof(result));
+        return static_cast<T>(result);
+    }
+
+    const psf::compiled_config_number& value;
+};
+
+struct compiled_object_impl : psf::json_object
+{
+    compiled_object_impl(compiled_config& owner, const psf::compiled_config_member* first, std::uint32_t count) noexcept :
+        config(owner),
+        members(first),
+        member_count(count)
+    {
+    }
+
+    virtual json_value* try_get(_In_ const char* key) const noexcept override;
+    virtual enumeration_handle* begin_enumeration(_Out_ enumeration_data* data) const noexcept override;
+    virtual enumeration_handle* advance(_In_ enumeration_handle* handle, _Inout_ enumeration_data* data) const noexcept override;
+
+    virtual void cancel_enumeration(_In_ enumeration_handle*) const noexcept override
+    {
+        // Handles are just pointers to the current member, so there's nothing to free
+    }
+
+    const psf::compiled_config_member* fill(const psf::compiled_config_member* member, enumeration_data* data) const noexcept;
+
+    compiled_config& config;
+    const psf::compiled_config_member* members;
+    std::uint32_t member_count;
+};
+
+struct compiled_array_impl : psf::json_array
+{
+    compiled_array_impl(compiled_config& owner, const psf::compiled_config_value* first, std::uint32_t count) noexcept :
+        config(owner),
+        elements(first),
+        element_count(count)
+    {
+    }
+
+    virtual unsigned size() const noexcept override
+    {
+        return element_count;
+    }
+
+    virtual json_value* try_get_at(unsigned index) const noexcept override;
+
+    compiled_config& config;
+    const psf::compiled_config_value* elements;
+    std::uint32_t element_count;
+};
+
+// A read-only view of a compiled config file, along with the json_value objects that expose it. Those are created all
+// at once, one array per type, so opening the file allocates a handful of times no matter how large it is
+class compiled_config
+{
+public:
+    compiled_config() noexcept = default;
+    compiled_config(const compiled_config&) = delete;
+    compiled_config& operator=(const compiled_config&) = delete;
+
+    ~compiled_config()
+    {
+        close();
+    }
+
+    // Returns false if the file does not exist or is not a valid compiled config
+    bool open(const std::filesystem::path& path)
+    {
+        close();
+
+        auto file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER size{};
+        if (::GetFileSizeEx(file, &size) && (size.QuadPart >= static_cast<LONGLONG>(sizeof(psf::compiled_config_header))))
+        {
+            m_mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        ::CloseHandle(file);
+
+        if (m_mapping)
+        {
+            m_view = ::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+
+        return open_view(static_cast<std::uint64_t>(size.QuadPart));
+    }
+
+    // Same as above, but for a compiled config that is already in memory, which must outlive the object
+    bool open(const void* data, std::uint64_t size)
+    {
+        close();
+        if (size < sizeof(psf::compiled_config_header))
+        {
+            return false;
+        }
+
+        m_view = data;
+        return open_view(size);
+    }
+
+    void close() noexcept
+    {
+        m_strings.clear();
+        m_numbers.clear();
+        m_objects.clear();
+        m_arrays.clear();
+        m_header = nullptr;
+
+        if (m_view && m_mapping)
+        {
+            ::UnmapViewOfFile(m_view);
+        }
+        m_view = nullptr;
+        m_size = 0;
+
+        if (m_mapping)
+        {
+            ::CloseHandle(m_mapping);
+            m_mapping = nullptr;
+        }
+    }
+
+    // The whole of the compiled config, e.g. for handing it to another process as is
+    const void* data() const noexcept
+    {
+        return m_header ? m_view : nullptr;
+    }
+
+    std::uint64_t size() const noexcept
+    {
+        return m_header ? m_size : 0;
+    }
+
+    psf::json_value* root() noexcept
+    {
+        return m_header ? value(m_header->root) : nullptr;
+    }
+
+    psf::json_value* value(psf::compiled_config_value ref) noexcept
+    {
+        auto index = psf::compiled_config_value_index(ref);
+        switch (psf::compiled_config_value_type(ref))
+        {
+        case psf::json_type::null: return &m_null;
+        case psf::json_type::string: return &m_strings[index];
+        case psf::json_type::number: return &m_numbers[index];
+        case psf::json_type::boolean: return index ? &m_true : &m_false;
+        case psf::json_type::object: return &m_objects[index];
+        case psf::json_type::array: return &m_arrays[index];
+        }
+
+        assert(false); // Ruled out by validate
+        return nullptr;
+    }
+
+    std::string_view key(const psf::compiled_config_member& member) const noexcept
+    {
+        return std::string_view(m_narrow + member.key_offset, member.key_length);
+    }
+
+private:
+    bool open_view(std::uint64_t size)
+    {
+        if (!m_view || !validate(size))
+        {
+            close();
+            return false;
+        }
+
+        m_size = size;
+        build();
+        return true;
+    }
+
+    template <typename T>
+    const T* table(std::uint64_t& offset, std::uint32_t count) const noexcept
+    {
+        auto result = reinterpret_cast<const T*>(static_cast<const std::uint8_t*>(m_view) + offset);
+        offset += static_cast<std::uint64_t>(count) * sizeof(T);
+        return result;
+    }
+
+    bool valid_value(psf::compiled_config_value ref) const noexcept
+    {
+        auto index = psf::compiled_config_value_index(ref);
+        switch (psf::compiled_config_value_type(ref))
+        {
+        case psf::json_type::null: return index == 0;
+        case psf::json_type::string: return index < m_header->string_count;
+        case psf::json_type::number: return index < m_header->number_count;
+        case psf::json_type::boolean: return index <= 1;
+        case psf::json_type::object: return index < m_header->object_count;
+        case psf::json_type::array: return index < m_header->array_count;
+        }
+
+        return false;
+    }
+
+    // Checks every reference in the file up front, so that the json_value objects never have to
+    bool validate(std::uint64_t size) noexcept
+    {
+        m_header = static_cast<const psf::compiled_config_header*>(m_view);
+        auto& header = *m_header;
+        if ((header.magic != psf::compiled_config_magic) || (header.version != psf::compiled_config_version))
+        {
+            m_header = nullptr;
+            return false;
+        }
+
+        std::uint64_t offset = sizeof(psf::compiled_config_header);
+        m_numberTable = table<psf::compiled_config_number>(offset, header.number_count);
+        m_stringTable = table<psf::compiled_config_string>(offset, header.string_count);
+        m_objectTable = table<psf::compiled_config_container>(offset, header.object_count);
+        m_arrayTable = table<psf::compiled_config_container>(offset, header.array_count);
+        m_memberTable = table<psf::compiled_config_member>(offset, header.member_count);
+        m_elementTable = table<psf::compiled_config_value>(offset, header.element_count);
+        m_wide = table<wchar_t>(offset, header.wide_length);
+        m_narrow = table<char>(offset, header.narrow_length);
+        if ((offset != size) || !valid_value(header.root))
+        {
+            m_header = nullptr;
+            return false;
+        }
+
+        auto validString = [](const auto* strings, std::uint32_t tableLength, std::uint32_t stringOffset, std::uint32_t length)
+        {
+            return (static_cast<std::uint64_t>(stringOffset) + length < tableLength) && (strings[stringOffset + length] == 0);
+        };
+
+        bool valid = true;
+        for (std::uint32_t i = 0; valid && (i < header.number_count); ++i)
+        {
+            valid = m_numberTable[i].kind <= 2;
+        }
+        for (std::uint32_t i = 0; valid && (i < header.string_count); ++i)
+        {
+            auto& str = m_stringTable[i];
+            valid = validString(m_narrow, header.narrow_length, str.narrow_offset, str.narrow_length) &&
+                validString(m_wide, header.wide_length, str.wide_offset, str.wide_length);
+        }
+        for (std::uint32_t i = 0; valid && (i < header.object_count); ++i)
+        {
+            auto& obj = m_objectTable[i];
+            valid = static_cast<std::uint64_t>(obj.first) + obj.count <= header.member_count;
+            for (std::uint32_t j = 0; valid && (j < obj.count); ++j)
+            {
+                auto& member = m_memberTable[obj.first + j];
+                valid = validString(m_narrow, header.narrow_length, member.key_offset, member.key_length) &&
+                    valid_value(member.value) && ((j == 0) || (key(m_memberTable[obj.first + j - 1]) < key(member)));
+            }
+        }
+        for (std::uint32_t i = 0; valid && (i < header.array_count); ++i)
+        {
+            auto& arr = m_arrayTable[i];
+            valid = static_cast<std::uint64_t>(arr.first) + arr.count <= header.element_count;
+        }
+        for (std::uint32_t i = 0; valid && (i < header.element_count); ++i)
+        {
+            valid = valid_value(m_elementTable[i]);
+        }
+
+        if (!valid)
+        {
+            m_header = nullptr;
+        }
+        return valid;
+    }
+
+    void build()
+    {
+        auto& header = *m_header;
+        m_numbers.reserve(header.number_count);
+        for (std::uint32_t i = 0; i < header.number_count; ++i)
+        {
+            m_numbers.emplace_back(m_numberTable[i]);
+        }
+
+        m_strings.reserve(header.string_count);
+        for (std::uint32_t i = 0; i < header.string_count; ++i)
+        {
+            auto& str = m_stringTable[i];
+            m_strings.emplace_back(std::string_view(m_narrow + str.narrow_offset, str.narrow_length),
+                std::wstring_view(m_wide + str.wide_offset, str.wide_length));
+        }
+
+        m_objects.reserve(header.object_count);
+        for (std::uint32_t i = 0; i < header.object_count; ++i)
+        {
+            m_objects.emplace_back(*this, m_memberTable + m_objectTable[i].first, m_objectTable[i].count);
+        }
+
+        m_arrays.reserve(header.array_count);
+        for (std::uint32_t i = 0; i < header.array_count; ++i)
+        {
+            m_arrays.emplace_back(*this, m_elementTable + m_arrayTable[i].first, m_arrayTable[i].count);
+        }
+    }
+
+    HANDLE m_mapping = nullptr;
+    const void* m_view = nullptr;
+    std::uint64_t m_size = 0;
+
+    const psf::compiled_config_header* m_header = nullptr;
+    const psf::compiled_config_number* m_numberTable = nullptr;
+    const psf::compiled_config_string* m_stringTable = nullptr;
+    const psf::compiled_config_container* m_objectTable = nullptr;
+    const psf::compiled_config_container* m_arrayTable = nullptr;
+    const psf::compiled_config_member* m_memberTable = nullptr;
+    const psf::compiled_config_value* m_elementTable = nullptr;
+    const wchar_t* m_wide = nullptr;
+    const char* m_narrow = nullptr;
+
+    json_null_impl m_null;
+    json_boolean_impl m_false{ false };
+    json_boolean_impl m_true{ true };
+    std::vector<json_string_impl> m_strings;
+    std::vector<compiled_number_impl> m_numbers;
+    std::vector<compiled_object_impl> m_objects;
+    std::vector<compiled_array_impl> m_arrays;
+};
+
+// The reverse of compiled_config: lays out a DOM parsed from config.json in the compiled format, the same way that
+// PsfConfigCompiler does, so that it can be handed to child processes. Since every number of such a DOM is a
+// json_number_impl, the kind of each number is known exactly
+class compiled_config_writer
+{
+public:
+    std::vector<std::byte> write(const psf::json_value& root)
+    {
+        psf::compiled_config_header header{};
+        header.magic = psf::compiled_config_magic;
+        header.version = psf::compiled_config_version;
+        header.root = add(root);
+        header.number_count = static_cast<std::uint32_t>(m_numbers.size());
+        header.string_count = static_cast<std::uint32_t>(m_strings.size());
+        header.object_count = static_cast<std::uint32_t>(m_objects.size());
+        header.array_count = static_cast<std::uint32_t>(m_arrays.size());
+        header.member_count = static_cast<std::uint32_t>(m_members.size());
+        header.element_count = static_cast<std::uint32_t>(m_elements.size());
+        header.wide_length = static_cast<std::uint32_t>(m_wide.size());
+        header.narrow_length = static_cast<std::uint32_t>(m_narrow.size());
+
+        std::vector<std::byte> result;
+        auto append = [&](const void* data, std::size_t size)
+        {
+            auto bytes = static_cast<const std::byte*>(data);
+            result.insert(result.end(), bytes, bytes + size);
+        };
+        auto appendTable = [&](const auto& table)
+        {
+            append(table.data(), table.size() * sizeof(table[0]));
+        };
+        append(&header, sizeof(header));
+        appendTable(m_numbers);
+        appendTable(m_strings);
+        appendTable(m_objects);
+        appendTable(m_arrays);
+        appendTable(m_members);
+        appendTable(m_elements);
+        appendTable(m_wide);
+        appendTable(m_narrow);
+        return result;
+    }
+
+private:
+    psf::compiled_config_value add(const psf::json_value& value)
+    {
+        switch (value.type())
+        {
+        case psf::json_type::null:
+            return psf::make_compiled_config_value(psf::json_type::null, 0);
+
+        case psf::json_type::boolean:
+            return psf::make_compiled_config_value(psf::json_type::boolean, value.as_boolean().get() ? 1 : 0);
+
+        case psf::json_type::number:
+            return make_value(psf::json_type::number, add_number(static_cast<const json_number_impl&>(value.as_number())));
+
+        case psf::json_type::string:
+        {
+            unsigned length;
+            auto str = value.as_string().narrow(&length);
+            return make_value(psf::json_type::string, add_string(std::string_view(str, length)));
+        }
+
+        case psf::json_type::object:
+            return make_value(psf::json_type::object, add_object(value.as_object()));
+
+        case psf::json_type::array:
+            return make_value(psf::json_type::array, add_array(value.as_array()));
+        }
+
+        throw std::runtime_error("Unexpected JSON value type");
+    }
+
+    static psf::compiled_config_value make_value(psf::json_type type, std::size_t index)
+    {
+        if (index > psf::compiled_config_max_index)
+        {
+            throw std::runtime_error("Too many values to compile");
+        }
+
+        return psf::make_compiled_config_value(type, static_cast<std::uint32_t>(index));
+    }
+
+    std::size_t add_number(const json_number_impl& value)
+    {
+        // The variant's alternatives are in the same order as the kinds
+        psf::compiled_config_number number{};
+        number.kind = static_cast<std::uint32_t>(value.value.index());
+        switch (number.kind)
+        {
+        case 0: number.bits = static_cast<std::uint64_t>(std::get<std::int64_t>(value.value)); break;
+        case 1: number.bits = std::get<std::uint64_t>(value.value); break;
+        case 2: std::memcpy(&number.bits, &std::get<double>(value.value), sizeof(number.bits)); break;
+        }
+
+        m_numbers.push_back(number);
+        return m_numbers.size() - 1;
+    }
+
+    std::uint32_t add_narrow(std::string_view str)
+    {
+        auto [itr, inserted] = m_narrowOffsets.emplace(std::string(str), static_cast<std::uint32_t>(m_narrow.size()));
+        if (inserted)
+        {
+            m_narrow.insert(m_narrow.end(), str.begin(), str.end());
+            m_narrow.push_back('\0');
+        }
+
+        return itr->second;
+    }
+
+    std::size_t add_string(std::string_view str)
+    {
+        if (auto itr = m_stringIndices.find(str); itr != m_stringIndices.end())
+        {
+            return itr->second;
+        }
+
+        auto wide = widen(str);
+        psf::compiled_config_string record{};
+        record.narrow_offset = add_narrow(str);
+        record.narrow_length = static_cast<std::uint32_t>(str.length());
+        record.wide_offset = static_cast<std::uint32_t>(m_wide.size());
+        record.wide_length = static_cast<std::uint32_t>(wide.length());
+        m_wide.insert(m_wide.end(), wide.begin(), wide.end());
+        m_wide.push_back(L'\0');
+
+        m_strings.push_back(record);
+        m_stringIndices.emplace(std::string(str), m_strings.size() - 1);
+        return m_strings.size() - 1;
+    }
+
+    // Members already enumerate in key order, which is the order that the compiled format requires
+    std::size_t add_object(const psf::json_object& obj)
+    {
+        std::vector<std::pair<std::string_view, const psf::json_value*>> members;
+        for (auto&& [key, memberValue] : obj)
+        {
+            members.emplace_back(key, &memberValue);
+        }
+
+        // Reserve the object's range of members before adding its values, which may add members of their own
+        auto index = m_objects.size();
+        auto first = static_cast<std::uint32_t>(m_members.size());
+        m_objects.push_back(psf::compiled_config_container{ first, static_cast<std::uint32_t>(members.size()) });
+        m_members.resize(first + members.size());
+        for (std::size_t i = 0; i < members.size(); ++i)
+        {
+            auto memberValue = add(*members[i].second);
+            auto& member = m_members[first + i];
+            member.key_offset = add_narrow(members[i].first);
+            member.key_length = static_cast<std::uint32_t>(members[i].first.length());
+            member.value = memberValue;
+        }
+
+        return index;
+    }
+
+    std::size_t add_array(const psf::json_array& arr)
+    {
+        auto index = m_arrays.size();
+        auto first = static_cast<std::uint32_t>(m_elements.size());
+        m_arrays.push_back(psf::compiled_config_container{ first, arr.size() });
+        m_elements.resize(first + arr.size());
+        for (unsigned i = 0; i < arr.size(); ++i)
+        {
+            auto element = add(*arr.try_get_at(i));
+            m_elements[first + i] = element;
+        }
+
+        return index;
+    }
+
+    std::vector<psf::compiled_config_number> m_numbers;
+    std::vector<psf::compiled_config_string> m_strings;
+    std::vector<psf::compiled_config_container> m_objects;
+    std::vector<psf::compiled_config_container> m_arrays;
+    std::vector<psf::compiled_config_member> m_members;
+    std::vector<psf::compiled_config_value> m_elements;
+    std::vector<wchar_t> m_wide;
+    std::vector<char> m_narrow;
+
+    std::map<std::string, std::uint32_t, std::less<>> m_narrowOffsets;
+    std::map<std::string, std::size_t, std::less<>> m_stringIndices;
+};
+
+inline psf::json_value* compiled_object_impl::try_get(_In_ const char* key) const noexcept
+{
+    std::string_view target(key);
+    std::uint32_t low = 0;
+    std::uint32_t high = member_count;
+    while (low < high)
+    {
+        auto mid = low + (high - low) / 2;
+        auto cmp = config.key(members[mid]).compare(target);
+        if (cmp == 0)
+        {
+            return config.value(members[mid].value);
+        }
+        else if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return nullptr;
+}
+
+inline const psf::compiled_config_member* compiled_object_impl::fill(const psf::compiled_config_member* member, enumeration_data* data) const noexcept
+{
+    if (member == members + member_count)
+    {
+        *data = {};
+        return nullptr;
+    }
+
+    auto key = config.key(*member);
+    data->key = key.data();
+    data->key_length = static_cast<unsigned>(key.length());
+    data->value = config.value(member->value);
+    return member;
+}
+
+inline psf::json_object::enumeration_handle* compiled_object_impl::begin_enumeration(_Out_ enumeration_data* data) const noexcept
+{
+    return reinterpret_cast<enumeration_handle*>(const_cast<psf::compiled_config_member*>(fill(members, data)));
+}
+
+inline psf::json_object::enumeration_handle* compiled_object_impl::advance(_In_ enumeration_handle* handle, _Inout_ enumeration_data* data) const noexcept
+{
+    assert(handle);
+    auto member = reinterpret_cast<const psf::compiled_config_member*>(handle);
+    return reinterpret_cast<enumeration_handle*>(const_cast<psf::compiled_config_member*>(fill(member + 1, data)));
+}
+
+inline psf::json_value* compiled_array_impl::try_get_at(unsigned index) const noexcept
+{
+    if (index >= element_count)
+    {
+        return nullptr;
+    }
+
+    return config.value(elements[index]);
+}
@@ -3,18 +3,28 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include <algorithm>
 #include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
-#include <regex>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <sstream>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <windows.h>
+#include <compiled_pattern.h>
 #include <detours.h>
+#include <known_folders.h>
 #include <rapidjson/reader.h>
 #include <rapidjson/error/en.h>
 #include <rapidjson/filereadstream.h>
@@ -25,8 +35,13 @@
 #include <utilities.h>
 #include <wil\resource.h>
 
+#include "AllocationTracking.h"
+#include "CompiledConfig.h"
 #include "Config.h"
+#include "ImportHooks.h"
 #include "JsonConfig.h"
+#include "LocationCache.h"
+#include "StartupTimings.h"
 
 using namespace std::literals;
 
@@ -38,182 +53,17 @@ static std::filesystem::path g_PackageRootPath;
 static std::filesystem::path g_FinalPackageRootPath;
 static std::filesystem::path g_CurrentExecutable;
 
-// The object that constructs the JSON DOM and holds the root
-static struct
-{
-    bool on_value(std::unique_ptr<psf::json_value> value)
-    {
-        if (!state_stack.empty())
-        {
-            assert(root);
-            auto& current_value = state_stack.back();
-            switch (current_value.index())
-            {
-            case 0:
-            {
-                auto& map = std::get<0>(current_value)->values;
-                if (map.find(object_key) != map.end())
-                {
-                    error_message = "'" + object_key + "' already exists in map";
-                    return false;
-                }
+// Known folders that have been looked up by any of the fixups. Entries are never removed, so that the strings handed out
+// by PSFQueryKnownFolder remain valid for as long as the dll is loaded
+static std::shared_mutex g_KnownFoldersLock;
+static std::vector<std::pair<GUID, std::unique_ptr<std::wstring>>> g_KnownFolders;
 
-                return std::get<0>(current_value)->values.emplace(std::move(object_key), std::move(value)).second;
-            }   break;
+// Builds the DOM of config.json; see JsonConfig.h
+static json_dom_builder g_JsonHandler;
 
-            case 1:
-                std::get<1>(current_value)->values.emplace_back(std::move(value));
-                break;
-            }
-        }
-        else if (!root)
-        {
-            root = std::move(value);
-        }
-        else
-        {
-            error_message = "Can't have more than one root";
-            return false;
-        }
-
-        return true;
-    }
+// Set through the config's "enableReportError" property
+static bool g_EnableReportError = true;
 
-    bool Null()
-    {
-        return on_value(std::make_unique<json_null_impl>());
-    }
-
-    bool Bool(bool b)
-    {
-        return on_value(std::make_unique<json_boolean_impl>(b));
-    }
-
-    bool Int(std::int64_t value)
-    {
-        return on_value(std::make_unique<json_number_impl>(value));
-    }
-
-    bool Uint(std::uint64_t value)
-    {
-        return on_value(std::make_unique<json_number_impl>(value));
-    }
-
-    bool Int64(std::int64_t value)
-    {
-        return on_value(std::make_unique<json_number_impl>(value));
-    }
-
-    bool Uint64(std::uint64_t value)
-    {
-        return on_value(std::make_unique<json_number_impl>(value));
-    }
-
-    bool Double(double value)
-    {
-        return on_value(std::make_unique<json_number_impl>(value));
-    }
-
-    bool RawNumber(const char* /*str*/, rapidjson::SizeType /*length*/, bool /*copy*/)
-    {
-        // Provided only to satisfy compilation, but never called since we never pass kParseNumbersAsStringsFlag
-        // Consider: Update rapidjson to use if constexpr
-        assert(false);
-        return false;
-    }
-
-    bool String(const char* str, rapidjson::SizeType length, [[maybe_unused]] bool copy)
-    {
-        // Caller should always own the memory
-        assert(copy);
-        return on_value(std::make_unique<json_string_impl>(std::string_view(str, length)));
-    }
-
-    bool StartObject()
-    {
-        // NOTE: We must call 'on_value' before appending to 'state_stack', otherwise we'll try and add the object as a
-        //       child of itself
-        auto obj = std::make_unique<json_object_impl>();
-        auto objPtr = obj.get();
-        auto result = on_value(std::move(obj));
-        if (result)
-        {
-            state_stack.emplace_back(objPtr);
-        }
-
-        return result;
-    }
-
-    bool Key(const char* str, rapidjson::SizeType length, [[maybe_unused]] bool copy)
-    {
-        // Caller should always own the memory
-        assert(copy);
-        assert(object_key.empty());
-        object_key.assign(str, length);
-        return true;
-    }
-
-    bool EndObject([[maybe_unused]] rapidjson::SizeType memberCount)
-    {
-#ifndef NDEBUG
-        assert(!state_stack.empty());
-
-        auto current = state_stack.back();
-        assert(current.index() == 0);
-
-        auto ptr = std::get<0>(current);
-        assert(ptr->values.size() == memberCount);
-#endif
-
-        state_stack.pop_back();
-        return true;
-    }
-
-    bool StartArray()
-    {
-        // NOTE: We must call 'on_value' before appending to 'state_stack', otherwise we'll try and add the array as a
-        //       child of itself
-        auto arr = std::make_unique<json_array_impl>();
-        auto arrPtr = arr.get();
-        auto result = on_value(std::move(arr));
-        if (result)
-        {
-            state_stack.emplace_back(arrPtr);
-        }
-
-        return result;
-    }
-
-    bool EndArray([[maybe_unused]] rapidjson::SizeType elementCount)
-    {
-#ifndef NDEBUG
-        assert(!state_stack.empty());
-
-        auto current = state_stack.back();
-        assert(current.index() == 1);
-
-        auto ptr = std::get<1>(current);
-        assert(ptr->values.size() == elementCount);
-#endif
-
-        state_stack.pop_back();
-        return true;
-    }
-
-    // Root of the tree, filled in by the first object/array/string, etc. encountered
-    std::unique_ptr<psf::json_value> root;
-
-    // Since all we get are callbacks, we don't have the luxury of using stack memory to save state, so use the heap
-    // NOTE: Since we're immediately done processing strings, numbers, booleans, and null, we only need to save state
-    //       for objects and arrays
-    std::vector<std::variant<json_object_impl*, json_array_impl*>> state_stack;
-    std::string object_key;
-
-    // When non-empty, provides a more useful error message displayed to the user for invalid config.json files
-    std::string error_message;
-
-    bool enableReportError{ true };
-} g_JsonHandler;
 
 void Log(const char* fmt, ...)
 {
@@ -257,6 +107,30 @@ void LogCountedStringW(const char* name, const wchar_t* value, std::size_t lengt
 
 static const psf::json_object* g_CurrentExeConfig = nullptr;
 
+// The root of the configuration, which is either that of the compiled config, when the package has one, or that of the
+// DOM parsed from config.json
+static compiled_config g_CompiledConfig;
+static const psf::json_value* g_ConfigRoot = nullptr;
+
+bool load_compiled_config()
+{
+    auto path = g_PackageRootPath / psf::compiled_config_file_name;
+    if (!g_CompiledConfig.open(path))
+    {
+        return false;
+    }
+
+    if (!g_CompiledConfig.root()->try_as_object())
+    {
+        Log("Compiled config %ls has no root object; using config.json instead.", path.c_str());
+        g_CompiledConfig.close();
+        return false;
+    }
+
+    Log("Compiled config found at: %ls", path.c_str());
+    g_ConfigRoot = g_CompiledConfig.root();
+    return true;
+}
 
 void load_json()
 {
@@ -275,30 +149,23 @@ void load_json()
         else
         {
             Log("Config.json not found in executable folder of package %ls, continue looking elsewhere.", g_PackageRootPath.c_str());
-            // If not in those two locations, must check everywhere in package.
-            for (auto& dentry : std::filesystem::recursive_directory_iterator(g_PackageRootPath))
+            // If not in those two locations, must check everywhere in package; that result is cached per package version
+            auto path = FindPackageFile(L"config.json");
+            if (!path.empty())
             {
-                try
-                {
-                    if (dentry.is_regular_file())
-                    {
-                        if (dentry.path().filename().compare(L"config.json") == 0)
-                        {
-                            Log("Found config at: %ls", dentry.path().c_str());
+                Log("Found config at: %ls", path.c_str());
 #pragma warning(suppress:4996) // Nonsense warning; _wfopen is perfectly safe
-                            file = _wfopen(dentry.path().c_str(), L"rb, ccs=UTF-8");
-                            break;
-                        }
-                    }
-                }
-                catch (...)
-                {
-                    Log("Non-fatal error enumerating directories while looking for config.json.");
-                }
+                file = _wfopen(path.c_str(), L"rb, ccs=UTF-8");
             }
         }
     }
 
+    if (!file)
+    {
+        throw std::runtime_error("config.json not found in the package");
+    }
+
+    StartupTimings().config_read.end = StartupTimings().config_parse.start = startup_timestamp();
 
     char buffer[2048];
     rapidjson::FileReadStream stream(file, buffer, std::size(buffer));
@@ -329,57 +196,364 @@ void load_json()
     }
 
     assert(g_JsonHandler.state_stack.empty());
+    g_JsonHandler.finish();
+    g_ConfigRoot = g_JsonHandler.root;
+}
 
-    // Cache a pointer to the current executable's config, as we are most likely to reference that later
-    auto currentExe = g_CurrentExecutable.stem();
-    if (auto processes = g_JsonHandler.root->as_object().try_get("processes"))
+// The "executable" pattern of each process configuration, in order, compiled once after the config is loaded. Patterns
+// without any regular expression syntax in them are compared as plain strings, which is both exact and much cheaper, and
+// the rest are compiled the same way that the fixups compile theirs (see compiled_pattern.h)
+struct exe_pattern
+{
+    const psf::json_object* config;
+    std::wstring_view pattern;
+    bool is_literal;
+    bool is_valid;
+    compiled_pattern matcher;
+};
+static std::vector<exe_pattern> g_ExePatterns;
+
+// Nearly every pattern is just an executable's name, so those are looked up by name, mapped to the position of the first
+// process configuration with that pattern. Only the patterns that really are regular expressions get matched in order
+static std::unordered_map<std::wstring_view, std::size_t> g_LiteralExePatterns;
+static std::vector<std::size_t> g_RegexExePatterns;
+
+// Results of PSFQueryExeConfig by executable name. Processes only ever launch a handful of distinct executables, so the
+// cache is never trimmed
+static std::shared_mutex g_ExeConfigCacheLock;
+static std::unordered_map<std::wstring, const psf::json_object*> g_ExeConfigCache;
+
+// Application ids and dll names compare case insensitively, so they're hashed the same way that iwstring_view compares
+// them. That way the lookups below hash the caller's string where it is, without first making a folded copy of it
+struct folded_name_hash
+{
+    std::size_t operator()(iwstring_view name) const noexcept
     {
-        if (processes)
+        // 64-bit FNV-1a, with the high half mixed into the low one for 32-bit builds
+        std::uint64_t hash = 14695981039346656037ull;
+        for (auto ch : name)
         {
-            for (auto& processConfig : processes->as_array())
+            hash = (hash ^ details::fold_case(ch)) * 1099511628211ull;
+        }
+        return static_cast<std::size_t>(hash ^ (hash >> 32));
+    }
+};
+
+// The first application configuration with each id, indexed once after the config is loaded. Both the keys and the
+// values point into the config, which is never freed
+static std::unordered_map<iwstring_view, const psf::json_object*, folded_name_hash> g_ApplicationConfigs;
+
+// The "config" of the first fixup of each process configuration with each dll name, with the names indexed in the form
+// that find_config compares them in. The value is null for fixups that don't have any config
+struct fixup_config_key
+{
+    const psf::json_object* exe_config;
+    iwstring_view dll;
+
+    friend bool operator==(const fixup_config_key& lhs, const fixup_config_key& rhs) noexcept
+    {
+        return (lhs.exe_config == rhs.exe_config) && (lhs.dll == rhs.dll);
+    }
+};
+
+struct fixup_config_key_hash
+{
+    std::size_t operator()(const fixup_config_key& key) const noexcept
+    {
+        return folded_name_hash{}(key.dll) ^ (reinterpret_cast<std::uintptr_t>(key.exe_config) * 0x9E3779B9);
+    }
+};
+static std::unordered_map<fixup_config_key, const psf::json_value*, fixup_config_key_hash> g_FixupConfigs;
+
+static bool is_literal_pattern(std::wstring_view pattern) noexcept
+{
+    return pattern.find_first_of(LR"(\^$.|?*+()[]{})") == std::wstring_view::npos;
+}
+
+static void compile_exe_patterns()
+{
+    if (auto processes = g_ConfigRoot->as_object().try_get("processes"))
+    {
+        auto& processesArray = processes->as_array();
+        g_ExePatterns.reserve(processesArray.size());
+        for (auto& processConfig : processesArray)
+        {
+            auto& obj = processConfig.as_object();
+            auto exe = obj.get("executable").as_string().wstring();
+            auto index = g_ExePatterns.size();
+            auto& entry = g_ExePatterns.emplace_back(exe_pattern{ &obj, exe, is_literal_pattern(exe), false, {} });
+            if (entry.is_literal)
+            {
+                g_LiteralExePatterns.emplace(exe, index);
+            }
+            else
             {
-                auto& obj = processConfig.as_object();
-                auto exe = obj.get("executable").as_string().wstring();
-                if (!g_CurrentExeConfig && std::regex_match(currentExe.native(), std::wregex(exe.data(), exe.length())))
+                g_RegexExePatterns.push_back(index);
+                try
                 {
-                    g_CurrentExeConfig = &obj;
-                    LogCountedStringW("Processes config match", exe.data(), exe.length());
-                    break;
+                    entry.matcher.assign(exe.data(), exe.length());
+                    entry.is_valid = true;
                 }
-                else if (!g_CurrentExeConfig)
+                catch (std::regex_error&)
                 {
-                    //LogCountedStringW("Processes config notmatched", exe.data(), exe.length());
+                    LogCountedStringW("Invalid executable pattern, which never matches", exe.data(), exe.length());
                 }
             }
         }
-        else
+    }
+}
+
+// Returns the first process configuration whose pattern matches the whole of 'exeName', if any
+static const exe_pattern* match_exe_pattern(std::wstring_view exeName)
+{
+    // A regular expression only wins over a literal match when it comes before it
+    auto literal = g_LiteralExePatterns.find(exeName);
+    auto limit = (literal != g_LiteralExePatterns.end()) ? literal->second : g_ExePatterns.size();
+    for (auto index : g_RegexExePatterns)
+    {
+        if (index >= limit)
         {
-            Log("No processes to match; no fixups to load.");
+            break;
+        }
+
+        auto& entry = g_ExePatterns[index];
+        if (entry.is_valid && entry.matcher.match(exeName))
+        {
+            return &entry;
         }
     }
-    else
+
+    return (literal != g_LiteralExePatterns.end()) ? &g_ExePatterns[literal->second] : nullptr;
+}
+
+static inline constexpr iwstring_view remove_suffix_if(iwstring_view str, iwstring_view suffix)
+{
+    if ((str.length() >= suffix.length()) && (str.substr(str.length() - suffix.length()) == suffix))
+    {
+        str.remove_suffix(suffix.length());
+    }
+
+    return str;
+}
+
+// We consider two dll names to match if:
+//  (1) They compare identical
+//  (2) One name is of the form AAAAABB.dll and the other is of the form AAAAA.dll for some architecture bitness
+//      'BB' (32 or 64)
+// so both the names in the config and the names that are looked up are stripped down to AAAAA
+static inline constexpr iwstring_view dll_base_name(iwstring_view dll)
+{
+    return remove_suffix_if(remove_suffix_if(dll, L".dll"_isv), psf::warch_string);
+}
+
+static void index_configs()
+{
+    auto& root = g_ConfigRoot->as_object();
+    if (auto applications = root.try_get("applications"))
+    {
+        for (auto& app : applications->as_array())
+        {
+            auto& appObj = app.as_object();
+            auto appId = appObj.get("id").as_string().wstring();
+            g_ApplicationConfigs.emplace(iwstring_view(appId.data(), appId.length()), &appObj);
+        }
+    }
+
+    for (auto& entry : g_ExePatterns)
+    {
+        if (auto fixups = entry.config->try_get("fixups"))
+        {
+            for (auto& fixupConfig : fixups->as_array())
+            {
+                auto& fixupConfigObj = fixupConfig.as_object();
+                auto dllStr = fixupConfigObj.get("dll").as_string().wstring();
+
+                // NOTE: config is optional
+                auto dll = dll_base_name(iwstring_view(dllStr.data(), dllStr.length()));
+                g_FixupConfigs.emplace(fixup_config_key{ entry.config, dll }, fixupConfigObj.try_get("config"));
+            }
+        }
+    }
+}
+
+void process_config()
+{
+    compile_exe_patterns();
+    index_configs();
+
+    // Cache a pointer to the current executable's config, as we are most likely to reference that later
+    auto currentExe = g_CurrentExecutable.stem();
+    if (g_ExePatterns.empty())
     {
-        Log("No Processes to match; no fixups to load.");
+        Log("No processes to match; no fixups to load.");
+    }
+    else if (auto match = match_exe_pattern(currentExe.native()))
+    {
+        g_CurrentExeConfig = match->config;
+        LogCountedStringW("Processes config match", match->pattern.data(), match->pattern.length());
     }
 
     // Permit ReportError disabling iff basic config.json parse succeeded
-    auto enableReportError = g_JsonHandler.root->as_object().try_get("enableReportError");
+    auto enableReportError = g_ConfigRoot->as_object().try_get("enableReportError");
     if (enableReportError)
     {
-        g_JsonHandler.enableReportError = enableReportError->as_boolean().get();
+        g_EnableReportError = enableReportError->as_boolean().get();
+    }
+}
+
+// Child processes that CreateProcessFixup injects are handed what this process already found: the package paths, and
+// the configuration in the compiled format, whichever form it was read in. The payload is the header below, followed by
+// the package full name, root path, and final root path, each null terminated, and then by the compiled config
+// {6EE481DB-2321-4F85-94F1-EB2C73D8DE6C}
+static constexpr GUID config_payload_guid = { 0x6ee481db, 0x2321, 0x4f85, { 0x94, 0xf1, 0xeb, 0x2c, 0x73, 0xd8, 0xde, 0x6c } };
+
+struct config_payload_header
+{
+    std::uint32_t header_size; // Doubles as a version
+    std::uint32_t package_full_name_length;
+    std::uint32_t package_root_length;
+    std::uint32_t final_package_root_length;
+    std::uint32_t config_offset; // From the start of the payload
+    std::uint32_t config_size;
+};
+
+struct config_payload
+{
+    std::wstring_view package_root_path;
+    std::wstring_view final_package_root_path;
+    const void* config;
+    std::uint32_t config_size;
+};
+
+static std::vector<std::byte> make_config_payload()
+{
+    std::vector<std::byte> config;
+    const void* configData = g_CompiledConfig.data();
+    auto configSize = g_CompiledConfig.size();
+    if (!configData)
+    {
+        config = compiled_config_writer{}.write(*g_ConfigRoot);
+        configData = config.data();
+        configSize = config.size();
     }
+
+    config_payload_header header{};
+    header.header_size = sizeof(header);
+    header.package_full_name_length = static_cast<std::uint32_t>(g_PackageFullName.length());
+    header.package_root_length = static_cast<std::uint32_t>(g_PackageRootPath.native().length());
+    header.final_package_root_length = static_cast<std::uint32_t>(g_FinalPackageRootPath.native().length());
+    header.config_size = static_cast<std::uint32_t>(configSize);
+
+    std::vector<std::byte> result(sizeof(header));
+    auto appendString = [&](const std::wstring& str)
+    {
+        auto bytes = reinterpret_cast<const std::byte*>(str.c_str());
+        result.insert(result.end(), bytes, bytes + (str.length() + 1) * sizeof(wchar_t));
+    };
+    appendString(g_PackageFullName);
+    appendString(g_PackageRootPath.native());
+    appendString(g_FinalPackageRootPath.native());
+
+    // Keep the compiled config's tables aligned, relative to the start of the payload at least
+    result.resize((result.size() + 7) & ~std::size_t{ 7 });
+    header.config_offset = static_cast<std::uint32_t>(result.size());
+    auto configBytes = static_cast<const std::byte*>(configData);
+    result.insert(result.end(), configBytes, configBytes + configSize);
+
+    std::memcpy(result.data(), &header, sizeof(header));
+    return result;
+}
+
+void CopyConfigToProcess(HANDLE process) noexcept try
+{
+    static const auto payload = make_config_payload();
+    if (!::DetourCopyPayloadToProcess(process, config_payload_guid, const_cast<std::byte*>(payload.data()), static_cast<DWORD>(payload.size())))
+    {
+        Log("\tCould not copy the configuration to the child process; it will load its own. Error=0x%x", ::GetLastError());
+    }
+}
+catch (...)
+{
+    Log("\tCould not prepare the configuration for child processes; they will load their own");
+}
+
+// Returns the payload that the parent process left for this one, if any. Payloads that don't make sense, or that are
+// for a different package, are ignored in favor of loading the configuration as usual
+static std::optional<config_payload> find_config_payload()
+{
+    DWORD size = 0;
+    auto data = static_cast<const std::byte*>(::DetourFindPayloadEx(config_payload_guid, &size));
+    if (!data || (size < sizeof(config_payload_header)))
+    {
+        return std::nullopt;
+    }
+
+    config_payload_header header;
+    std::memcpy(&header, data, sizeof(header));
+    auto stringsSize = (static_cast<std::uint64_t>(header.package_full_name_length) + header.package_root_length +
+        header.final_package_root_length + 3) * sizeof(wchar_t);
+    if ((header.header_size != sizeof(header)) || (sizeof(header) + stringsSize > header.config_offset) ||
+        (static_cast<std::uint64_t>(header.config_offset) + header.config_size > size))
+    {
+        Log("Ignoring invalid configuration payload");
+        return std::nullopt;
+    }
+
+    auto strings = reinterpret_cast<const wchar_t*>(data + sizeof(header));
+    auto nextString = [&](std::uint32_t length)
+    {
+        std::wstring_view result(strings, length);
+        strings += length + 1;
+        return result;
+    };
+    auto packageFullName = nextString(header.package_full_name_length);
+    if (packageFullName != g_PackageFullName)
+    {
+        return std::nullopt;
+    }
+
+    config_payload result;
+    result.package_root_path = nextString(header.package_root_length);
+    result.final_package_root_path = nextString(header.final_package_root_length);
+    result.config = data + header.config_offset;
+    result.config_size = header.config_size;
+    return result;
+}
+
+bool load_payload_config(const config_payload& payload)
+{
+    if (!g_CompiledConfig.open(payload.config, payload.config_size) || !g_CompiledConfig.root()->try_as_object())
+    {
+        Log("Ignoring invalid configuration from the parent process");
+        g_CompiledConfig.close();
+        return false;
+    }
+
+    Log("Configuration handed down by the parent process");
+    g_ConfigRoot = g_CompiledConfig.root();
+    return true;
 }
 
 void LoadConfig()
 {
+    std::optional<config_payload> payload;
     if (psf::is_packaged())
     {
         g_PackageFullName = psf::current_package_full_name();
         g_PackageFamilyName = psf::current_package_family_name();
         g_ApplicationUserModelId = psf::current_application_user_model_id();
         g_ApplicationId = psf::application_id_from_application_user_model_id(g_ApplicationUserModelId);
-        g_PackageRootPath = psf::current_package_path();
-        g_FinalPackageRootPath = psf::get_final_path_name(g_PackageRootPath);
+        payload = find_config_payload();
+        if (payload)
+        {
+            g_PackageRootPath = payload->package_root_path;
+            g_FinalPackageRootPath = payload->final_package_root_path;
+        }
+        else
+        {
+            g_PackageRootPath = psf::current_package_path();
+            g_FinalPackageRootPath = psf::get_final_path_name(g_PackageRootPath);
+        }
         g_CurrentExecutable = psf::current_executable_path();
 
         LogCountedStringW("g_PackageFullName", g_PackageFullName.data(), g_PackageFullName.length());
@@ -397,7 +571,19 @@ void LoadConfig()
         std::terminate();
     }
 
-    load_json();
+    // A compiled config, when the package has one, saves parsing config.json in every process
+    auto& timings = StartupTimings();
+    timings.config_read.start = startup_timestamp();
+    if ((payload && load_payload_config(*payload)) || load_compiled_config())
+    {
+        timings.config_read.end = timings.config_parse.start = startup_timestamp();
+    }
+    else
+    {
+        load_json();
+    }
+    process_config();
+    timings.config_parse.end = startup_timestamp();
 }
 
 const std::wstring& PackageFullName() noexcept
@@ -433,14 +619,49 @@ const std::filesystem::path& FinalPackageRootPath() noexcept
 // API definitions
 PSFAPI DWORD __stdcall PSFRegister(_Inout_ void** implFn, _In_ void* fixupFn) noexcept
 {
+    TrackDetour(*implFn, fixupFn);
+    if (ImportHooksActive())
+    {
+        return RegisterImportHook(implFn, fixupFn);
+    }
     return ::DetourAttach(implFn, fixupFn);
 }
 
 PSFAPI DWORD __stdcall PSFUnregister(_Inout_ void** implFn, _In_ void* fixupFn) noexcept
 {
+    if (UnregisterImportHook(implFn, fixupFn))
+    {
+        return ERROR_SUCCESS;
+    }
     return ::DetourDetach(implFn, fixupFn);
 }
 
+PSFAPI DWORD __stdcall PSFRegisterMany(_In_reads_(count) const psf::detour_registration* detours, unsigned count) noexcept try
+{
+    std::vector<psf::detour_registration> sorted(detours, detours + count);
+    std::sort(sorted.begin(), sorted.end(), [](const psf::detour_registration& lhs, const psf::detour_registration& rhs)
+    {
+        return reinterpret_cast<std::uintptr_t>(*lhs.impl_fn) < reinterpret_cast<std::uintptr_t>(*rhs.impl_fn);
+    });
+
+    for (auto& detour : sorted)
+    {
+        TrackDetour(*detour.impl_fn, detour.fixup_fn);
+        auto err = ImportHooksActive() ? RegisterImportHook(detour.impl_fn, detour.fixup_fn) :
+            static_cast<DWORD>(::DetourAttach(detour.impl_fn, detour.fixup_fn));
+        if (err)
+        {
+            return err;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+catch (...)
+{
+    return win32_from_caught_exception();
+}
+
 PSFAPI const wchar_t* __stdcall PSFQueryPackageFullName() noexcept
 {
     return g_PackageFullName.c_str();
@@ -471,26 +692,200 @@ PSFAPI const wchar_t* __stdcall PSFQueryFinalPackageRootPath() noexcept
     return g_FinalPackageRootPath.c_str();
 }
 
-PSFAPI const psf::json_value* __stdcall PSFQueryConfigRoot() noexcept
+PSFAPI const wchar_t* __stdcall PSFQueryKnownFolder(_In_ const GUID& id) noexcept try
+{
+    auto find = [&]() -> const wchar_t*
+    {
+        for (auto& entry : g_KnownFolders)
+        {
+            if (::IsEqualGUID(entry.first, id))
+            {
+                return entry.second->c_str();
+            }
+        }
+        return nullptr;
+    };
+
+    {
+        std::shared_lock lock(g_KnownFoldersLock);
+        if (auto result = find())
+        {
+            return result;
+        }
+    }
+
+    // Failures aren't remembered, so the lookup is retried the next time the folder is asked for
+    auto path = std::make_unique<std::wstring>(psf::known_folder(id).native());
+
+    std::unique_lock lock(g_KnownFoldersLock);
+    if (auto result = find())
+    {
+        return result;
+    }
+    g_KnownFolders.emplace_back(id, std::move(path));
+    return g_KnownFolders.back().second->c_str();
+}
+catch (...)
 {
-    return g_JsonHandler.root.get();
+    return nullptr;
 }
 
-PSFAPI const psf::json_object* __stdcall PSFQueryAppLaunchConfig(_In_ const wchar_t* applicationId, bool verbose) noexcept try
+// Only worked out the first time that it's expanded, since most processes never need it
+static std::once_flag g_WritablePackageRootOnce;
+static std::wstring g_WritablePackageRootPath;
+
+static const psf::json_value* find_config(const psf::json_object* exeConfig, const wchar_t* dll);
+
+// The folder that the FileRedirectionFixup is configured to keep the redirected area below ("redirectRoot"), or an
+// empty string to keep it in LocalCache. The current executable's configuration is preferred, and otherwise that of the
+// first process to have one is used, since e.g. PsfLauncher doesn't load the fixup itself, and all processes of the
+// package share the redirected area anyway
+static std::wstring configured_redirect_root()
 {
-    for (auto& app : g_JsonHandler.root->as_object().get("applications").as_array())
+    auto redirectRoot = [](const psf::json_object* exeConfig) -> const psf::json_value*
+    {
+        auto config = find_config(exeConfig, L"FileRedirectionFixup");
+        auto configObject = config ? config->try_as_object() : nullptr;
+        return configObject ? configObject->try_get("redirectRoot") : nullptr;
+    };
+
+    auto value = redirectRoot(g_CurrentExeConfig);
+    if (!value && g_ConfigRoot)
     {
-        auto& appObj = app.as_object();
-        auto appId = appObj.get("id").as_string().wstring();
+        if (auto processes = g_ConfigRoot->as_object().try_get("processes"))
+        {
+            for (auto& process : processes->as_array())
+            {
+                if ((value = redirectRoot(&process.as_object())) != nullptr)
+                {
+                    break;
+                }
+            }
+        }
+    }
 
-        if (iwstring_view(appId.data(), appId.length()) == applicationId)
+    return value ? value->as_string().wstring() : std::wstring{};
+}
+
+static const std::wstring* pseudo_variable_value(std::wstring_view name)
+{
+    if (name == L"MsixPackageRoot"sv)
+    {
+        return &g_PackageRootPath.native();
+    }
+    else if (name == L"MsixWritablePackageRoot"sv)
+    {
+        // NOTE: An exception leaves the flag unset, so that the next expansion tries again
+        std::call_once(g_WritablePackageRootOnce, []
         {
-            if (verbose)
+            auto localAppData = PSFQueryKnownFolder(FOLDERID_LocalAppData);
+            if (!localAppData)
+            {
+                throw std::runtime_error("Failed to get known folder path");
+            }
+
+            // Note: the following paths must be kept in sync with the FileRedirectionFixup PathRedirection.cpp
+            auto redirectRoot = configured_redirect_root();
+            if (!redirectRoot.empty())
             {
-                LogCountedStringW("Json Application match against id", appId.data(), appId.length());
+                g_WritablePackageRootPath = (std::filesystem::path(redirectRoot) / g_PackageFamilyName /
+                    LR"(Microsoft\WritablePackageRoot)").native();
             }
-            return &appObj;
+            else
+            {
+                g_WritablePackageRootPath = (std::filesystem::path(localAppData) / L"Packages" / g_PackageFamilyName /
+                    LR"(LocalCache\Local\Microsoft\WritablePackageRoot)").native();
+            }
+        });
+        return &g_WritablePackageRootPath;
+    }
+
+    return nullptr;
+}
+
+static bool append_environment_variable(std::wstring_view name, std::wstring& result)
+{
+    std::wstring nameString(name);
+    auto offset = result.size();
+    DWORD capacity = 64;
+    while (true)
+    {
+        result.resize(offset + capacity);
+        auto size = ::GetEnvironmentVariableW(nameString.c_str(), result.data() + offset, capacity);
+        if (size < capacity)
+        {
+            result.resize(offset + size);
+            return (size != 0) || (::GetLastError() != ERROR_ENVVAR_NOT_FOUND);
+        }
+
+        // Too small, in which case the size includes the null terminator
+        capacity = size;
+    }
+}
+
+PSFAPI DWORD __stdcall PSFExpandVariables(_In_ const wchar_t* input, bool expandEnvironment, _Out_writes_opt_(capacity) wchar_t* buffer, DWORD capacity) noexcept try
+{
+    std::wstring result;
+    std::wstring_view remaining(input);
+    while (!remaining.empty())
+    {
+        auto start = remaining.find(L'%');
+        auto end = (start == std::wstring_view::npos) ? start : remaining.find(L'%', start + 1);
+        if (end == std::wstring_view::npos)
+        {
+            result.append(remaining);
+            break;
+        }
+
+        result.append(remaining.substr(0, start));
+        auto name = remaining.substr(start + 1, end - start - 1);
+        if (auto value = pseudo_variable_value(name))
+        {
+            result.append(*value);
+            remaining.remove_prefix(end + 1);
+            continue;
         }
+
+        auto offset = result.size();
+        if (expandEnvironment && !name.empty() && append_environment_variable(name, result))
+        {
+            remaining.remove_prefix(end + 1);
+            continue;
+        }
+
+        // Not a variable, in which case the closing '%' may well be the start of the next one
+        result.resize(offset);
+        result.append(remaining.substr(start, end - start));
+        remaining.remove_prefix(end);
+    }
+
+    auto size = static_cast<DWORD>(result.size() + 1);
+    if (buffer && (size <= capacity))
+    {
+        std::copy_n(result.c_str(), size, buffer);
+    }
+    return size;
+}
+catch (...)
+{
+    ::SetLastError(win32_from_caught_exception());
+    return 0;
+}
+
+PSFAPI const psf::json_value* __stdcall PSFQueryConfigRoot() noexcept
+{
+    return g_ConfigRoot;
+}
+
+PSFAPI const psf::json_object* __stdcall PSFQueryAppLaunchConfig(_In_ const wchar_t* applicationId, bool verbose) noexcept try
+{
+    if (auto itr = g_ApplicationConfigs.find(applicationId); itr != g_ApplicationConfigs.end())
+    {
+        if (verbose)
+        {
+            LogCountedStringW("Json Application match against id", itr->first.data(), itr->first.length());
+        }
+        return itr->second;
     }
 
     if (verbose)
@@ -552,34 +947,24 @@ PSFAPI const psf::json_object* __stdcall PSFQueryEndScriptInfo() noexcept
     return nullptr;
 }
 
-static inline constexpr iwstring_view remove_suffix_if(iwstring_view str, iwstring_view suffix)
-{
-    if ((str.length() >= suffix.length()) && (str.substr(str.length() - suffix.length()) == suffix))
-    {
-        str.remove_suffix(suffix.length());
-    }
-
-    return str;
-}
-
 PSFAPI const psf::json_object* __stdcall PSFQueryExeConfig(const wchar_t* executable) noexcept try
 {
     const auto exeName = remove_suffix_if(executable, L".exe"_isv);
-    if (auto processes = g_JsonHandler.root->as_object().try_get("processes"))
+    std::wstring key(exeName.data(), exeName.length());
     {
-        for (auto& processConfig : processes->as_array())
+        std::shared_lock lock(g_ExeConfigCacheLock);
+        if (auto itr = g_ExeConfigCache.find(key); itr != g_ExeConfigCache.end())
         {
-            auto& obj = processConfig.as_object();
-            auto exe = obj.get("executable").as_string().wstring();
-
-            if (std::regex_match(exeName.begin(), exeName.end(), std::wregex(exe.data(), exe.length())))
-            {
-                return &obj;
-            }
+            return itr->second;
         }
     }
 
-    return nullptr;
+    auto match = match_exe_pattern(key);
+    auto result = match ? match->config : nullptr;
+
+    std::unique_lock lock(g_ExeConfigCacheLock);
+    g_ExeConfigCache.emplace(std::move(key), result);
+    return result;
 }
 catch (...)
 {
@@ -591,36 +976,15 @@ PSFAPI const psf::json_object* __stdcall PSFQueryCurrentExeConfig() noexcept
     return g_CurrentExeConfig;
 }
 
-static inline const psf::json_value* find_config(const psf::json_object* exeConfig, const wchar_t* dll)
+static const psf::json_value* find_config(const psf::json_object* exeConfig, const wchar_t* dll)
 {
     if (!exeConfig)
     {
         return nullptr;
     }
 
-    // We consider two dll names to match if:
-    //  (1) They compare identical
-    //  (2) One name is of the form AAAAABB.dll and the other is of the form AAAAA.dll for some architecture bitness
-    //      'BB' (32 or 64)
-    auto targetDll = remove_suffix_if(remove_suffix_if(dll, L".dll"_isv), psf::warch_string);
-
-    if (auto fixups = exeConfig->try_get("fixups"))
-    {
-        for (auto& fixupConfig : fixups->as_array())
-        {
-            auto& fixupConfigObj = fixupConfig.as_object();
-
-            auto dllStr = fixupConfigObj.get("dll").as_string().wstring();
-            iwstring_view dllStrView(dllStr.data(), dllStr.length());
-            if (targetDll == remove_suffix_if(remove_suffix_if(dllStrView, L".dll"_isv), psf::warch_string))
-            {
-                // NOTE: config is optional
-                return fixupConfigObj.try_get("config");
-            }
-        }
-    }
-
-    return nullptr;
+    auto itr = g_FixupConfigs.find(fixup_config_key{ exeConfig, dll_base_name(dll) });
+    return (itr != g_FixupConfigs.end()) ? itr->second : nullptr;
 }
 
 PSFAPI const psf::json_value* __stdcall PSFQueryConfig(const wchar_t* executable, const wchar_t* dll) noexcept try
@@ -643,7 +1007,7 @@ catch (...)
 
 PSFAPI void __stdcall PSFReportError(const wchar_t* error) noexcept
 {
-    if (!g_JsonHandler.enableReportError)
+    if (!g_EnableReportError)
     {
         return;
     }
@@ -7,10 +7,17 @@
 #include <filesystem>
 #include <string>
 
+#include <windows.h>
+
 void LoadConfig();
 
+// Hands the configuration that this process loaded to a newly created child process, which has yet to run, so that it
+// doesn't need to load it again
+void CopyConfigToProcess(HANDLE process) noexcept;
+
 // Globals set by `LoadConfig`, to avoid continuously querying them
 const std::wstring& PackageFullName() noexcept;
+const std::wstring& PackageFamilyName() noexcept;
 const std::wstring& ApplicationUserModelId() noexcept;
 const std::wstring& ApplicationId() noexcept;
 const std::filesystem::path& PackageRootPath() noexcept;
@@ -0,0 +1,283 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstdint>
+#include <cwchar>
+#include <iterator>
+#include <mutex>
+#include <new>
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <psf_runtime.h>
+
+#include "CpuAccounting.h"
+
+void Log(const char* fmt, ...);
+
+// Defined along with the startup timings, which are written to the same provider
+TRACELOGGING_DECLARE_PROVIDER(g_Log_ETW_ComponentProvider);
+
+// The PSF Runtime and each of the fixup dlls; any more than that go unaccounted for
+constexpr std::size_t max_accounted_modules = 16;
+
+struct module_account
+{
+    std::atomic<HMODULE> module{ nullptr };
+    std::atomic<std::uint64_t> cycles{ 0 };
+    std::atomic<std::uint64_t> calls{ 0 };
+};
+
+// Only ever added to relaxed, without interlocked operations, by the thread that owns the account
+static void add_relaxed(std::atomic<std::uint64_t>& value, std::uint64_t amount) noexcept
+{
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+static module_account* find_account(module_account (&accounts)[max_accounted_modules], HMODULE module) noexcept
+{
+    for (auto& account : accounts)
+    {
+        auto accountModule = account.module.load(std::memory_order_relaxed);
+        if (accountModule == module)
+        {
+            return &account;
+        }
+        else if (!accountModule)
+        {
+            account.module.store(module, std::memory_order_relaxed);
+            return &account;
+        }
+    }
+
+    return nullptr;
+}
+
+// What one thread has been charged. Each thread only updates its own shard, so that accounting never contends, and the
+// shards are only summed up when reporting
+struct thread_shard
+{
+    module_account accounts[max_accounted_modules];
+    module_account* owner = nullptr; // Whichever module the thread is running the code of, if any
+    std::uint64_t last = 0; // When 'owner' last changed, as a cycle count
+    thread_shard* previous = nullptr;
+    thread_shard* next = nullptr;
+};
+
+static bool g_Enabled = false;
+
+// All of the shards of threads that are still running, along with what was charged to those that have exited
+static std::mutex g_ShardsLock;
+static thread_shard* g_Shards = nullptr;
+static module_account g_ExitedThreads[max_accounted_modules];
+
+static thread_local thread_shard* t_Shard = nullptr;
+static thread_local bool t_Unaccounted = false;
+
+static thread_shard* current_shard() noexcept
+{
+    if (!t_Shard && !t_Unaccounted)
+    {
+        // A fixup may detour the heap functions, and must not be accounted for while its own shard is being allocated
+        t_Unaccounted = true;
+        auto shard = new (std::nothrow) thread_shard;
+        t_Unaccounted = false;
+        if (shard)
+        {
+            std::lock_guard lock(g_ShardsLock);
+            shard->next = g_Shards;
+            if (g_Shards)
+            {
+                g_Shards->previous = shard;
+            }
+            g_Shards = shard;
+            t_Shard = shard;
+        }
+    }
+
+    return t_Shard;
+}
+
+void EnableCpuAccounting() noexcept
+{
+    g_Enabled = true;
+    Log("\tCPU accounting enabled\n");
+}
+
+void RetireCpuAccountingThread() noexcept
+{
+    // Anything that the thread runs from here on, e.g. in other dlls' DLL_THREAD_DETACH, goes unaccounted for
+    t_Unaccounted = true;
+    auto shard = t_Shard;
+    if (!shard)
+    {
+        return;
+    }
+
+    t_Shard = nullptr;
+    {
+        std::lock_guard lock(g_ShardsLock);
+        (shard->previous ? shard->previous->next : g_Shards) = shard->next;
+        if (shard->next)
+        {
+            shard->next->previous = shard->previous;
+        }
+
+        for (auto& account : shard->accounts)
+        {
+            auto module = account.module.load(std::memory_order_relaxed);
+            if (!module)
+            {
+                break;
+            }
+
+            if (auto total = find_account(g_ExitedThreads, module))
+            {
+                add_relaxed(total->cycles, account.cycles.load(std::memory_order_relaxed));
+                add_relaxed(total->calls, account.calls.load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+    delete shard;
+}
+
+// Sums up the shards of all threads, both running and exited, filling in 'totals'. Must hold g_ShardsLock
+static void sum_accounts(module_account (&totals)[max_accounted_modules]) noexcept
+{
+    auto add = [&](const module_account (&accounts)[max_accounted_modules])
+    {
+        for (auto& account : accounts)
+        {
+            auto module = account.module.load(std::memory_order_relaxed);
+            if (!module)
+            {
+                break;
+            }
+
+            if (auto total = find_account(totals, module))
+            {
+                add_relaxed(total->cycles, account.cycles.load(std::memory_order_relaxed));
+                add_relaxed(total->calls, account.calls.load(std::memory_order_relaxed));
+            }
+        }
+    };
+
+    add(g_ExitedThreads);
+    for (auto shard = g_Shards; shard; shard = shard->next)
+    {
+        add(shard->accounts);
+    }
+}
+
+void ReportCpuAccounting() noexcept try
+{
+    if (!g_Enabled)
+    {
+        return;
+    }
+
+    module_account totals[max_accounted_modules];
+    {
+        std::lock_guard lock(g_ShardsLock);
+        sum_accounts(totals);
+    }
+
+    TraceLoggingRegister(g_Log_ETW_ComponentProvider);
+    for (auto& total : totals)
+    {
+        auto module = total.module.load();
+        if (!module)
+        {
+            break;
+        }
+
+        wchar_t path[MAX_PATH];
+        const wchar_t* name = L"";
+        if (::GetModuleFileNameW(module, path, MAX_PATH))
+        {
+            auto separator = std::wcsrchr(path, L'\\');
+            name = separator ? separator + 1 : path;
+        }
+
+        auto cycles = total.cycles.load();
+        auto calls = total.calls.load();
+        Log("CPU accounting: %ls: %llu cycles in %llu calls", name, cycles, calls);
+        TraceLoggingWrite(
+            g_Log_ETW_ComponentProvider,
+            "FixupCpuCycles",
+            TraceLoggingWideString(name, "Fixup"),
+            TraceLoggingUInt64(cycles, "Cycles"),
+            TraceLoggingUInt64(calls, "Calls"));
+    }
+    TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
+}
+catch (...)
+{
+    // Only ever informational
+}
+
+PSFAPI bool __stdcall PSFCpuAccountingEnabled() noexcept
+{
+    return g_Enabled;
+}
+
+PSFAPI HMODULE __stdcall PSFCpuAccountingSwitch(_In_opt_ HMODULE module, bool isCall) noexcept
+{
+    auto now = ::ReadTimeStampCounter();
+    auto shard = current_shard();
+    if (!shard)
+    {
+        return nullptr;
+    }
+
+    auto previous = shard->owner;
+    if (previous)
+    {
+        add_relaxed(previous->cycles, now - shard->last);
+    }
+
+    shard->owner = module ? find_account(shard->accounts, module) : nullptr;
+    if (isCall && shard->owner)
+    {
+        add_relaxed(shard->owner->calls, 1);
+    }
+
+    shard->last = now;
+    return previous ? previous->module.load(std::memory_order_relaxed) : nullptr;
+}
+
+PSFAPI unsigned __stdcall PSFQueryCpuAccounting(_Out_writes_opt_(capacity) psf::cpu_accounting_statistics* statistics, unsigned capacity) noexcept
+{
+    if (!g_Enabled)
+    {
+        return 0;
+    }
+
+    module_account totals[max_accounted_modules];
+    {
+        std::lock_guard lock(g_ShardsLock);
+        sum_accounts(totals);
+    }
+
+    unsigned count = 0;
+    for (auto& total : totals)
+    {
+        auto module = total.module.load();
+        if (!module)
+        {
+            break;
+        }
+
+        if (statistics && (count < capacity))
+        {
+            statistics[count] = { module, total.cycles.load(), total.calls.load() };
+        }
+        ++count;
+    }
+
+    return count;
+}
@@ -0,0 +1,16 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+// Turns on charging the cycles spent in each fixup dll's detours to that dll, for processes whose config sets
+// "cpuAccounting". Must be called before any detours are registered, since psf::attach_all only wraps the detours it
+// registers while accounting is enabled
+void EnableCpuAccounting() noexcept;
+
+// Called from DLL_THREAD_DETACH, to add what the thread was charged to the totals of the threads that have exited
+void RetireCpuAccountingThread() noexcept;
+
+// Writes the cycles and calls of every fixup dll to ETW and the debug output
+void ReportCpuAccounting() noexcept;
@@ -3,33 +3,45 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 //
-// The PsfRuntime intercepts all CreateProcess[AW] calls so that fixups can be propagated to child processes. The
-// general call graph looks something like the following:
+// The PsfRuntime intercepts all CreateProcess[AW] and CreateProcessAsUser[AW] calls so that fixups can be propagated to
+// child processes; both go through CreateProcessWithRuntime, which injects the child. The general call graph looks
+// something like the following:
 //      * CreateProcessFixup gets called by application code; forwards arguments on to:
 //      * DetourCreateProcessWithDlls[AW], which calls:
 //      * CreateProcessInterceptRunDll32, which identifies attempts to launch rundll32 from System32/SysWOW64,
 //        redirecting those attempts to either PsfRunDll32.exe or PsfRunDll64.exe, and then calls:
 //      * The actual implementation of CreateProcess[AW]
 //
-// NOTE: Other CreateProcess variants (e.g. CreateProcessAsUser[AW]) aren't currently detoured as the Detours framework
-//       does not make it easy to accomplish that at this time.
+// NOTE: Other CreateProcess variants (e.g. CreateProcessWithLogonW/CreateProcessWithTokenW) aren't currently detoured,
+//       since the process is created by a service on behalf of the caller and can't be injected from here.
 //
 
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
 #include <string_view>
 #include <vector>
 
 #include <windows.h>
 #include <detours.h>
+#include <process_policy.h>
 #include <psf_constants.h>
 #include <psf_framework.h>
 
 #include "Config.h"
+#include "InjectionHelper.h"
+#include "LocationCache.h"
 
 using namespace std::literals;
 
 void Log(const char* fmt, ...);
 
 auto CreateProcessImpl = psf::detoured_string_function(&::CreateProcessA, &::CreateProcessW);
+auto CreateProcessAsUserImpl = psf::detoured_string_function(&::CreateProcessAsUserA, &::CreateProcessAsUserW);
 
 BOOL WINAPI CreateProcessWithPsfRunDll(
     [[maybe_unused]] _In_opt_ LPCWSTR applicationName,
@@ -68,161 +80,412 @@ catch (...)
     return FALSE;
 }
 
-template <typename CharT>
-using startup_info_t = std::conditional_t<std::is_same_v<CharT, char>, STARTUPINFOA, STARTUPINFOW>;
-
-template <typename CharT>
-BOOL WINAPI CreateProcessFixup(
-    _In_opt_ const CharT* applicationName,
-    _Inout_opt_ CharT* commandLine,
+// Creates processes as asked, for the persistent injection helper, which must not itself be injected like a child
+static BOOL WINAPI CreateProcessWithoutInjection(
+    _In_opt_ LPCWSTR applicationName,
+    _Inout_opt_ LPWSTR commandLine,
     _In_opt_ LPSECURITY_ATTRIBUTES processAttributes,
     _In_opt_ LPSECURITY_ATTRIBUTES threadAttributes,
     _In_ BOOL inheritHandles,
     _In_ DWORD creationFlags,
     _In_opt_ LPVOID environment,
-    _In_opt_ const CharT* currentDirectory,
-    _In_ startup_info_t<CharT>* startupInfo,
-    _Out_ LPPROCESS_INFORMATION processInformation) noexcept try
+    _In_opt_ LPCWSTR currentDirectory,
+    _In_ LPSTARTUPINFOW startupInfo,
+    _Out_ LPPROCESS_INFORMATION processInformation)
 {
-    // We can't detour child processes whose executables are located outside of the package as they won't have execute
-    // access to the fixup dlls. Instead of trying to replicate the executable search logic when determining the location
-    // of the target executable, create the process as suspended and let the system tell us where the executable is
-    PROCESS_INFORMATION pi;
-    if (!processInformation)
-    {
-        processInformation = &pi;
-    }
-
-    if (!CreateProcessImpl(
+    return CreateProcessImpl(
         applicationName,
         commandLine,
         processAttributes,
         threadAttributes,
         inheritHandles,
-        creationFlags | CREATE_SUSPENDED,
+        creationFlags,
         environment,
         currentDirectory,
         startupInfo,
-        processInformation))
+        processInformation);
+}
+
+// The "persistentInjectionHelper" process option, which keeps a single PsfRunDll helper running for all of the children
+// of the other architecture, instead of creating one per child
+static bool UsePersistentInjectionHelper() noexcept
+{
+    static const bool result = []
     {
-        return FALSE;
+        auto config = PSFQueryCurrentExeConfig();
+        auto value = config ? config->try_get("persistentInjectionHelper") : nullptr;
+        return value && value->try_as_boolean() && value->try_as_boolean()->get();
+    }();
+
+    return result;
+}
+
+// The dll injected into child processes. The PsfRuntime that is running in this process is the natural choice, since it
+// is in the package and of the same architecture, and using it needs no probing of the package at all; the path is
+// resolved once per process nonetheless, since build tools and the like may create thousands of children
+static const std::string& RuntimeDllPath()
+{
+    static const std::string path = []
+    {
+        std::filesystem::path result;
+        try
+        {
+            result = psf::current_module_path();
+        }
+        catch (...)
+        {
+            // Should never happen, but finding the dll by name is still an option
+            result = PackageRootPath() / psf::runtime_dll_name;
+            if (!std::filesystem::exists(result))
+            {
+                if (auto found = FindPackageFile(psf::runtime_dll_name); !found.empty())
+                {
+                    result = std::move(found);
+                }
+            }
+        }
+
+        Log("\tChild processes will be injected with %ls", result.c_str());
+        return result.string();
+    }();
+
+    return path;
+}
+
+// Detours can only rewrite the imports of a process of its own architecture, so children of the other architecture must
+// be injected through PsfRunDll instead. Knowing which one a child is up front saves a failed attempt per child, and
+// keeps an unrelated failure for a child of the same architecture from launching a helper that can't succeed either
+static bool IsSameArchitecture(HANDLE process) noexcept
+{
+    BOOL isWow64 = FALSE;
+    if (!::IsWow64Process(process, &isWow64))
+    {
+        // Let injection fail instead, if it's going to
+        return true;
+    }
+
+    static const BOOL isCurrentWow64 = []
+    {
+        BOOL result = FALSE;
+        ::IsWow64Process(::GetCurrentProcess(), &result);
+        return result;
+    }();
+
+    return isWow64 == isCurrentWow64;
+}
+
+#if defined(_M_ARM64)
+// IsWow64Process doesn't tell x64 processes, which ARM64 devices run under emulation, apart from ARM64 ones, and the
+// 64-bit binaries of an ARM64 build can't be loaded into them. Only the executable's headers tell which one it is
+static bool IsEmulatedExecutable(const wchar_t* path) noexcept
+{
+    auto file = ::CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        // Let injection fail instead, if it's going to
+        return false;
     }
 
-    iwstring path;
-    DWORD size = MAX_PATH;
-    path.resize(size - 1);
-    while (true)
+    IMAGE_DOS_HEADER dosHeader;
+    IMAGE_FILE_HEADER fileHeader = {};
+    DWORD signature = 0;
+    DWORD bytesRead;
+    LARGE_INTEGER offset = {};
+    if (::ReadFile(file, &dosHeader, sizeof(dosHeader), &bytesRead, nullptr) && (bytesRead == sizeof(dosHeader)) &&
+        (dosHeader.e_magic == IMAGE_DOS_SIGNATURE))
     {
-        if (::QueryFullProcessImageNameW(processInformation->hProcess, 0, path.data(), &size))
+        offset.QuadPart = dosHeader.e_lfanew;
+        if (::SetFilePointerEx(file, offset, nullptr, FILE_BEGIN) &&
+            ::ReadFile(file, &signature, sizeof(signature), &bytesRead, nullptr) && (bytesRead == sizeof(signature)))
         {
-            path.resize(size);
-            break;
+            ::ReadFile(file, &fileHeader, sizeof(fileHeader), &bytesRead, nullptr);
         }
-        else if (auto err = ::GetLastError(); err == ERROR_INSUFFICIENT_BUFFER)
+    }
+    ::CloseHandle(file);
+
+    // ARM64EC executables are x64 ones as far as the headers are concerned, and run as such
+    return (signature == IMAGE_NT_SIGNATURE) && (fileHeader.Machine == IMAGE_FILE_MACHINE_AMD64);
+}
+#endif
+
+template <typename CharT>
+using startup_info_t = std::conditional_t<std::is_same_v<CharT, char>, STARTUPINFOA, STARTUPINFOW>;
+
+// Where the executable of a process that has been created, but not yet run, is. Nearly always a single call, since
+// only paths longer than MAX_PATH need the second, and that one is as large as any path can be
+static std::optional<std::wstring> ProcessImagePath(HANDLE process)
+{
+    wchar_t buffer[MAX_PATH];
+    DWORD size = static_cast<DWORD>(std::size(buffer));
+    if (::QueryFullProcessImageNameW(process, 0, buffer, &size))
+    {
+        return std::wstring(buffer, size);
+    }
+    else if (::GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+    {
+        return std::nullopt;
+    }
+
+    std::wstring result(UNICODE_STRING_MAX_CHARS, L'\0');
+    size = static_cast<DWORD>(result.size() + 1);
+    if (!::QueryFullProcessImageNameW(process, 0, result.data(), &size))
+    {
+        return std::nullopt;
+    }
+
+    result.resize(size);
+    return result;
+}
+
+// Executables that children have been created from, and that turned out to be outside of the package, or to not need
+// the PSF Runtime (see NeedsRuntime). Build tools and the like create children from the same few system executables
+// (cmd.exe, git.exe, ...) over and over, and these can be created as asked, without suspending them or looking up where
+// their executable is. Only paths that were seen to be
+// the exact path of the created process' executable are remembered, and the package never changes, so an entry never
+// goes stale. Never trimmed, since there are only ever a handful of them
+static std::shared_mutex g_OutsidePackageLock;
+static std::set<iwstring, std::less<>> g_OutsidePackageExecutables;
+
+static bool IsKnownOutsidePackage(iwstring_view executable)
+{
+    std::shared_lock<std::shared_mutex> lock(g_OutsidePackageLock);
+    return g_OutsidePackageExecutables.find(executable) != g_OutsidePackageExecutables.end();
+}
+
+static void RememberOutsidePackage(iwstring_view executable)
+{
+    std::unique_lock<std::shared_mutex> lock(g_OutsidePackageLock);
+    g_OutsidePackageExecutables.emplace(executable);
+}
+
+static iwstring_view StripLocalDevicePrefix(iwstring_view path) noexcept
+{
+    if ((path.length() >= 4) && (path.substr(0, 4) == LR"(\\?\)"_isv))
+    {
+        path = path.substr(4);
+    }
+
+    return path;
+}
+
+// Children in the package whose config doesn't load any fixups only need the PSF Runtime so that it can inject their own
+// children in turn. Those whose config also sets "propagateFixups" to false don't need it at all, and are created as
+// asked, saving them the loading of the PSF Runtime and its configuration. Children that no config matches are still
+// injected, as are all children of processes that didn't get a config
+static bool NeedsRuntime(iwstring_view exePath)
+{
+    auto exeName = std::filesystem::path(std::wstring(exePath.data(), exePath.length())).stem();
+    auto config = PSFQueryExeConfig(exeName.c_str());
+    if (!config)
+    {
+        return true;
+    }
+
+    auto propagate = config->try_get("propagateFixups");
+    if (!propagate || propagate->as_boolean().get())
+    {
+        return true;
+    }
+
+    auto fixups = config->try_get("fixups");
+    return fixups && (fixups->as_array().size() != 0);
+}
+
+// The executable that CreateProcess will most likely use, as given by the caller: the application name when there is
+// one, and the first token of the command line otherwise. This is only ever used as a key, and only matches a
+// remembered executable when it is a full path, so no attempt is made to replicate the search that CreateProcess does
+template <typename CharT>
+static std::optional<std::wstring> RequestedExecutable(const CharT* applicationName, const CharT* commandLine)
+{
+    std::basic_string_view<CharT> result;
+    if (applicationName)
+    {
+        result = applicationName;
+    }
+    else if (commandLine)
+    {
+        result = commandLine;
+        if (!result.empty() && (result[0] == '"'))
         {
-            size *= 2;
-            path.resize(size - 1);
+            result = result.substr(1, result.find('"', 1) - 1);
         }
         else
         {
-            // Unexpected error
-            ::TerminateProcess(processInformation->hProcess, ~0u);
-            ::CloseHandle(processInformation->hProcess);
-            ::CloseHandle(processInformation->hThread);
-
-            ::SetLastError(err);
-            return FALSE;
+            auto end = std::find_if(result.begin(), result.end(), [](CharT ch) { return (ch == ' ') || (ch == '\t'); });
+            result = result.substr(0, end - result.begin());
         }
     }
 
-    // std::filesystem::path comparison doesn't seem to handle case-insensitivity or root-local device paths...
-    iwstring_view packagePath(PackageRootPath().native().c_str(), PackageRootPath().native().length());
-    iwstring_view finalPackagePath(FinalPackageRootPath().native().c_str(), FinalPackageRootPath().native().length());
-    iwstring_view exePath = path;
-    auto fixupPath = [](iwstring_view& p)
+    if (result.empty())
+    {
+        return std::nullopt;
+    }
+
+    // The narrow variants interpret strings in the active code page
+    return widen(std::basic_string<CharT>(result), CP_ACP);
+}
+
+// The settings of PsfLauncher's "resourcePolicy" that every process of the application's tree gets, if it has any. Read
+// for each process that's created, since PsfLauncher only sets them just before starting the application
+static std::optional<psf::process_policy> InheritedProcessPolicy()
+{
+    wchar_t buffer[256];
+    auto length = ::GetEnvironmentVariableW(psf::process_policy_variable, buffer, static_cast<DWORD>(std::size(buffer)));
+    if (length == 0)
     {
-        if ((p.length() >= 4) && (p.substr(0, 4) == LR"(\\?\)"_isv))
+        return std::nullopt;
+    }
+    else if (length < std::size(buffer))
+    {
+        return psf::process_policy::from_string(buffer);
+    }
+
+    // Long lists of CPU sets
+    std::wstring value(length, L'\0');
+    length = ::GetEnvironmentVariableW(psf::process_policy_variable, value.data(), length);
+    if ((length == 0) || (length >= value.size()))
+    {
+        return std::nullopt;
+    }
+    return psf::process_policy::from_string(value.c_str());
+}
+
+// The one place that child processes get injected, whichever variant of CreateProcess created them. 'create' is called
+// exactly once, with the caller's creation flags plus CREATE_SUSPENDED, and the process is resumed exactly once
+// afterwards, unless the caller asked for it to be created suspended. The inherited resource policy, if any, is applied
+// to it before then, whether or not it gets injected
+template <typename CreateFunc>
+static BOOL CreateProcessWithRuntime(
+    const std::optional<std::wstring>& requestedExecutable,
+    DWORD creationFlags,
+    LPPROCESS_INFORMATION processInformation,
+    CreateFunc&& create) noexcept try
+{
+    auto policy = InheritedProcessPolicy();
+    std::optional<iwstring_view> requestedPath;
+    if (requestedExecutable)
+    {
+        requestedPath = StripLocalDevicePrefix(iwstring_view(requestedExecutable->c_str(), requestedExecutable->length()));
+        if (IsKnownOutsidePackage(*requestedPath) && !policy)
         {
-            p = p.substr(4);
+            return create(creationFlags, processInformation);
         }
+    }
+
+    // We can't detour child processes whose executables are located outside of the package as they won't have execute
+    // access to the fixup dlls. Instead of trying to replicate the executable search logic when determining the location
+    // of the target executable, create the process as suspended and let the system tell us where the executable is
+    PROCESS_INFORMATION pi;
+    if (!processInformation)
+    {
+        processInformation = &pi;
+    }
+
+    if (!create(creationFlags | CREATE_SUSPENDED, processInformation))
+    {
+        return FALSE;
+    }
+
+    auto fail = [&](DWORD err)
+    {
+        ::TerminateProcess(processInformation->hProcess, ~0u);
+        ::CloseHandle(processInformation->hProcess);
+        ::CloseHandle(processInformation->hThread);
+
+        ::SetLastError(err);
+        return FALSE;
     };
-    fixupPath(packagePath);
-    fixupPath(finalPackagePath);
-    fixupPath(exePath);
+
+    if (policy)
+    {
+        // Not being able to doesn't keep the process from running, e.g. when it runs as another user
+        if (auto err = policy->apply(processInformation->hProcess); err != ERROR_SUCCESS)
+        {
+            Log("\tUnable to apply the resource policy to PID=%d err=0x%x", processInformation->dwProcessId, err);
+        }
+    }
+
+    auto path = ProcessImagePath(processInformation->hProcess);
+    if (!path)
+    {
+        // Unexpected error
+        return fail(::GetLastError());
+    }
+
+    // std::filesystem::path comparison doesn't seem to handle case-insensitivity or root-local device paths...
+    iwstring_view packagePath(PackageRootPath().native().c_str(), PackageRootPath().native().length());
+    iwstring_view finalPackagePath(FinalPackageRootPath().native().c_str(), FinalPackageRootPath().native().length());
+    packagePath = StripLocalDevicePrefix(packagePath);
+    finalPackagePath = StripLocalDevicePrefix(finalPackagePath);
+    auto exePath = StripLocalDevicePrefix(iwstring_view(path->c_str(), path->length()));
 
 #if _DEBUG
     Log("\tPossible injection to process %ls %d.\n", exePath.data(), processInformation->dwProcessId);
 #endif
-    if (((exePath.length() >= packagePath.length()) && (exePath.substr(0, packagePath.length()) == packagePath)) ||
-        ((exePath.length() >= finalPackagePath.length()) && (exePath.substr(0, finalPackagePath.length()) == finalPackagePath)))
+    bool inPackage = ((exePath.length() >= packagePath.length()) && (exePath.substr(0, packagePath.length()) == packagePath)) ||
+        ((exePath.length() >= finalPackagePath.length()) && (exePath.substr(0, finalPackagePath.length()) == finalPackagePath));
+    if (inPackage && !NeedsRuntime(exePath))
+    {
+        Log("\tNot injecting into PID=%d, whose config has no fixups and doesn't propagate them", processInformation->dwProcessId);
+        inPackage = false;
+    }
+#if defined(_M_ARM64)
+    if (inPackage && IsEmulatedExecutable(path->c_str()))
+    {
+        Log("\tNot injecting into PID=%d, which is an x64 process", processInformation->dwProcessId);
+        inPackage = false;
+    }
+#endif
+
+    if (inPackage)
     {
 #if _DEBUG
         Log("\tInject %ls into PID=%d", psf::runtime_dll_name, processInformation->dwProcessId);
 #endif
         // The target executable is in the package, so we _do_ want to fixup it
 
-        static const auto pathToPsfRuntime = (PackageRootPath() / psf::runtime_dll_name).string();
-        PCSTR targetDll = pathToPsfRuntime.c_str();
-        if (!std::filesystem::exists(targetDll))
-        {
-            // Possibly the dll is in the folder with the exe and not at the package root.
-            Log("\t%s not found at package root, try target folder.", targetDll);
-
-            std::filesystem::path altPathToExeRuntime = exePath.data();
-            static const auto altPathToPsfRuntime = (altPathToExeRuntime.parent_path() / psf::runtime_dll_name).string();
-            targetDll = altPathToPsfRuntime.c_str();
-#if _DEBUG
-            Log("\talt target filename is now %s", altPathToPsfRuntime.c_str());
-#endif
-        }
+        // NOTE: Registered on first use, since that is after the metrics section is created
+        static psf::metric_counter injectionCount("PsfRuntime.injections");
+        static psf::metric_counter injectionTicks("PsfRuntime.injectionTicks");
+        static psf::metric_counter injectionFailures("PsfRuntime.injectionFailures");
+        LARGE_INTEGER injectionStart;
+        ::QueryPerformanceCounter(&injectionStart);
 
-        if (!std::filesystem::exists(targetDll))
+        PCSTR targetDll = RuntimeDllPath().c_str();
+        Log("\tAttempt injection into %d using %s", processInformation->dwProcessId, targetDll);
+        BOOL injected;
+        if (IsSameArchitecture(processInformation->hProcess))
         {
-#if _DEBUG
-            Log("\tNot present there either, try elsewhere in package.");
-#endif
-            // If not in those two locations, must check everywhere in package.
-            // The child process might also be in another package folder, so look elsewhere in the package.
-            for (auto& dentry : std::filesystem::recursive_directory_iterator(PackageRootPath()))
+            injected = ::DetourUpdateProcessWithDll(processInformation->hProcess, &targetDll, 1);
+            if (injected)
             {
-                try
-                {
-                    if (dentry.path().filename().compare(psf::runtime_dll_name) == 0)
-                    {
-                        static const auto altDirPathToPsfRuntime = narrow(dentry.path().c_str());
-#if _DEBUG
-                        Log("\tFound match as %ls", dentry.path().c_str());
-#endif
-                        targetDll = altDirPathToPsfRuntime.c_str();
-                        break;
-                    }
-                }
-                catch (...)
-                {
-                    Log("Non-fatal error enumerating directories while looking for PsfRuntime.");
-                }
+                CopyConfigToProcess(processInformation->hProcess);
             }
         }
-      
-        Log("\tAttempt injection into %d using %s", processInformation->dwProcessId, targetDll);
-        if (!::DetourUpdateProcessWithDll(processInformation->hProcess, &targetDll, 1))
+        else
         {
-            Log("\t%s not found at target folder, try PsfRunDll.", targetDll);
-            // We failed to detour the created process. Assume that it the failure was due to an architecture mis-match
-            // and try the launch using PsfRunDll
-            if (!::DetourProcessViaHelperDllsW(processInformation->dwProcessId, 1, &targetDll, CreateProcessWithPsfRunDll))
-            {
-                // Could not detour the target process, so return failure
-                auto err = ::GetLastError();
-                Log("\tUnable to inject %ls into PID=%d err=0x%x\n", psf::runtime_dll_name, processInformation->dwProcessId, err);
-                ::TerminateProcess(processInformation->hProcess, ~0u);
-                ::CloseHandle(processInformation->hProcess);
-                ::CloseHandle(processInformation->hThread);
-
-                ::SetLastError(err);
-                return FALSE;
-            }
+            // PsfRunDll is of the other architecture, and Detours renames PsfRuntime32/64.dll to match it
+            Log("\tPID=%d is of the other architecture, using %s", processInformation->dwProcessId, psf::run_dll_name);
+            injected = (UsePersistentInjectionHelper() &&
+                InjectViaPersistentHelper(processInformation->dwProcessId, CreateProcessWithoutInjection)) ||
+                ::DetourProcessViaHelperDllsW(processInformation->dwProcessId, 1, &targetDll, CreateProcessWithPsfRunDll);
         }
+
+        if (!injected)
+        {
+            // Could not detour the target process, so return failure
+            auto err = ::GetLastError();
+            injectionFailures.increment();
+            Log("\tUnable to inject %ls into PID=%d err=0x%x\n", psf::runtime_dll_name, processInformation->dwProcessId, err);
+            return fail(err);
+        }
+
+        injectionCount.increment();
+        injectionTicks.add_ticks_since(injectionStart.QuadPart);
+    }
+    else if (requestedPath && (*requestedPath == exePath))
+    {
+        RememberOutsidePackage(exePath);
     }
 
     Log("\tInjected %ls into PID=%d\n", psf::runtime_dll_name, processInformation->dwProcessId);
@@ -247,4 +510,76 @@ catch (...)
     return FALSE;
 }
 
+template <typename CharT>
+BOOL WINAPI CreateProcessFixup(
+    _In_opt_ const CharT* applicationName,
+    _Inout_opt_ CharT* commandLine,
+    _In_opt_ LPSECURITY_ATTRIBUTES processAttributes,
+    _In_opt_ LPSECURITY_ATTRIBUTES threadAttributes,
+    _In_ BOOL inheritHandles,
+    _In_ DWORD creationFlags,
+    _In_opt_ LPVOID environment,
+    _In_opt_ const CharT* currentDirectory,
+    _In_ startup_info_t<CharT>* startupInfo,
+    _Out_ LPPROCESS_INFORMATION processInformation) noexcept try
+{
+    auto requestedExecutable = RequestedExecutable(applicationName, commandLine);
+    return CreateProcessWithRuntime(requestedExecutable, creationFlags, processInformation, [&](DWORD flags, LPPROCESS_INFORMATION info)
+    {
+        return CreateProcessImpl(
+            applicationName,
+            commandLine,
+            processAttributes,
+            threadAttributes,
+            inheritHandles,
+            flags,
+            environment,
+            currentDirectory,
+            startupInfo,
+            info);
+    });
+}
+catch (...)
+{
+    ::SetLastError(win32_from_caught_exception());
+    return FALSE;
+}
 DECLARE_STRING_FIXUP(CreateProcessImpl, CreateProcessFixup);
+
+template <typename CharT>
+BOOL WINAPI CreateProcessAsUserFixup(
+    _In_opt_ HANDLE token,
+    _In_opt_ const CharT* applicationName,
+    _Inout_opt_ CharT* commandLine,
+    _In_opt_ LPSECURITY_ATTRIBUTES processAttributes,
+    _In_opt_ LPSECURITY_ATTRIBUTES threadAttributes,
+    _In_ BOOL inheritHandles,
+    _In_ DWORD creationFlags,
+    _In_opt_ LPVOID environment,
+    _In_opt_ const CharT* currentDirectory,
+    _In_ startup_info_t<CharT>* startupInfo,
+    _Out_ LPPROCESS_INFORMATION processInformation) noexcept try
+{
+    auto requestedExecutable = RequestedExecutable(applicationName, commandLine);
+    return CreateProcessWithRuntime(requestedExecutable, creationFlags, processInformation, [&](DWORD flags, LPPROCESS_INFORMATION info)
+    {
+        return CreateProcessAsUserImpl(
+            token,
+            applicationName,
+            commandLine,
+            processAttributes,
+            threadAttributes,
+            inheritHandles,
+            flags,
+            environment,
+            currentDirectory,
+            startupInfo,
+            info);
+    });
+}
+catch (...)
+{
+    ::SetLastError(win32_from_caught_exception());
+    return FALSE;
+}
+DECLARE_STRING_FIXUP(CreateProcessAsUserImpl, CreateProcessAsUserFixup);
@@ -0,0 +1,291 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+#include <winternl.h>
+#include <detours.h>
+#include <psf_framework.h>
+#include <psf_utils.h>
+#include <utilities.h>
+
+#include "ImportHooks.h"
+
+void Log(const char* fmt, ...);
+
+namespace winternl
+{
+    // NOTE: The loader notification types are documented, but only declared in the DDK. The notification data is really a
+    //       union with the unloaded data, which has the same layout
+    struct LDR_DLL_NOTIFICATION_DATA
+    {
+        ULONG Flags;
+        PCUNICODE_STRING FullDllName;
+        PCUNICODE_STRING BaseDllName;
+        PVOID DllBase;
+        ULONG SizeOfImage;
+    };
+
+    constexpr ULONG LDR_DLL_NOTIFICATION_REASON_LOADED = 1;
+    constexpr ULONG LDR_DLL_NOTIFICATION_REASON_UNLOADED = 2;
+
+    using LDR_DLL_NOTIFICATION_FUNCTION = VOID(CALLBACK*)(ULONG NotificationReason, const LDR_DLL_NOTIFICATION_DATA* NotificationData, PVOID Context);
+    using LdrRegisterDllNotificationProc = NTSTATUS(__stdcall*)(ULONG Flags, LDR_DLL_NOTIFICATION_FUNCTION NotificationFunction, PVOID Context, PVOID* Cookie);
+}
+
+struct import_hook
+{
+    void** impl_fn;
+    void* fixup_fn;
+    void* target;           // What the import address table entries that get hooked point at
+    void* code;             // The function's code, which imports through API sets resolve to, if not 'target' itself
+    std::size_t scope;      // Index into g_ImportHookScopes
+};
+
+struct pending_module
+{
+    HMODULE module;
+    iwstring name;
+};
+
+// All guarded by g_ImportHooksLock, which is also taken within loader notifications, and so must never be held while
+// calling anything that takes the loader lock
+static std::mutex g_ImportHooksLock;
+static std::vector<std::vector<iwstring>> g_ImportHookScopes;
+static std::vector<import_hook> g_ImportHooks;
+static std::vector<pending_module> g_PendingModules;
+static bool g_LoaderNotificationsRegistered = false;
+
+// Lets LoadLibraryExWFixup get away with a single load when there's nothing to do
+static std::atomic<bool> g_HasPendingModules{ false };
+
+// Only touched by the thread that initializes the fixups
+static std::size_t g_CurrentScope = 0;
+static bool g_ImportHooksActive = false;
+static std::vector<HMODULE> g_CurrentModules;
+
+static bool in_scope(const std::vector<iwstring>& scope, iwstring_view name) noexcept
+{
+    return std::any_of(scope.begin(), scope.end(), [&](const iwstring& entry) { return entry == name; });
+}
+
+// Points the entries of the import address table of 'module' that hold 'from' - or 'code', when given - at 'to'
+static void patch_imports(HMODULE module, void* from, void* code, void* to) noexcept
+{
+    struct context
+    {
+        void* from;
+        void* code;
+        void* to;
+    } patchContext = { from, code, to };
+
+    ::DetourEnumerateImportsEx(module, &patchContext, nullptr, [](void* pContext, DWORD, LPCSTR, void** func) -> BOOL
+    {
+        auto& patch = *static_cast<context*>(pContext);
+        if (func && ((*func == patch.from) || (patch.code && (*func == patch.code))))
+        {
+            DWORD oldProtect;
+            if (::VirtualProtect(func, sizeof(*func), PAGE_READWRITE, &oldProtect))
+            {
+                *func = patch.to;
+                ::VirtualProtect(func, sizeof(*func), oldProtect, &oldProtect);
+            }
+        }
+
+        return TRUE;
+    });
+}
+
+static void CALLBACK on_dll_notification(ULONG reason, const winternl::LDR_DLL_NOTIFICATION_DATA* data, PVOID) noexcept try
+{
+    if (!data->BaseDllName)
+    {
+        return;
+    }
+
+    auto module = static_cast<HMODULE>(data->DllBase);
+    iwstring_view name(data->BaseDllName->Buffer, data->BaseDllName->Length / sizeof(wchar_t));
+
+    std::lock_guard lock(g_ImportHooksLock);
+    if (reason == winternl::LDR_DLL_NOTIFICATION_REASON_LOADED)
+    {
+        // Its imports may not be bound yet, so it's only hooked once the load is done
+        auto listed = std::any_of(g_ImportHookScopes.begin(), g_ImportHookScopes.end(), [&](const std::vector<iwstring>& scope)
+        {
+            return in_scope(scope, name);
+        });
+        if (listed)
+        {
+            g_PendingModules.push_back(pending_module{ module, iwstring(name) });
+            g_HasPendingModules.store(true, std::memory_order_release);
+        }
+    }
+    else if (reason == winternl::LDR_DLL_NOTIFICATION_REASON_UNLOADED)
+    {
+        g_PendingModules.erase(std::remove_if(g_PendingModules.begin(), g_PendingModules.end(), [&](const pending_module& pending)
+        {
+            return pending.module == module;
+        }), g_PendingModules.end());
+    }
+}
+catch (...)
+{
+    // The module just doesn't get hooked
+}
+
+static void hook_pending_modules() noexcept
+{
+    std::lock_guard lock(g_ImportHooksLock);
+    for (auto& pending : g_PendingModules)
+    {
+        for (auto& hook : g_ImportHooks)
+        {
+            if (in_scope(g_ImportHookScopes[hook.scope], pending.name))
+            {
+                patch_imports(pending.module, hook.target, hook.code, hook.fixup_fn);
+            }
+        }
+    }
+
+    g_PendingModules.clear();
+    g_HasPendingModules.store(false, std::memory_order_relaxed);
+}
+
+static void register_loader_notifications()
+{
+    if (g_LoaderNotificationsRegistered)
+    {
+        return;
+    }
+
+    auto registerNotification = reinterpret_cast<winternl::LdrRegisterDllNotificationProc>(
+        ::GetProcAddress(::GetModuleHandleW(L"ntdll.dll"), "LdrRegisterDllNotification"));
+    PVOID cookie;
+    if (!registerNotification || !NT_SUCCESS(registerNotification(0, &on_dll_notification, nullptr, &cookie)))
+    {
+        Log("\tImport hooks will not be applied to modules that are loaded later\n");
+        return;
+    }
+
+    g_LoaderNotificationsRegistered = true;
+}
+
+void BeginImportHooks(const psf::json_object& fixupConfig)
+{
+    auto modules = fixupConfig.try_get("importHookModules");
+    if (!modules || (modules->as_array().size() == 0))
+    {
+        return;
+    }
+
+    std::vector<iwstring> scope;
+    for (auto& module : modules->as_array())
+    {
+        scope.emplace_back(module.as_string().wide());
+    }
+
+    register_loader_notifications();
+
+    // Found before the lock is taken, since GetModuleFileNameW takes the loader lock. Listed modules that are loaded in
+    // the meantime end up pending too, and hooking a module twice leaves it as it was after the first time
+    g_CurrentModules.clear();
+    for (auto module = ::DetourEnumerateModules(nullptr); module; module = ::DetourEnumerateModules(module))
+    {
+        if (in_scope(scope, iwstring_view(psf::get_module_path(module).filename().c_str())))
+        {
+            g_CurrentModules.push_back(module);
+        }
+    }
+
+    std::lock_guard lock(g_ImportHooksLock);
+    g_CurrentScope = g_ImportHookScopes.size();
+    g_ImportHookScopes.push_back(std::move(scope));
+    g_ImportHooksActive = true;
+}
+
+void EndImportHooks() noexcept
+{
+    g_ImportHooksActive = false;
+    g_CurrentModules.clear();
+}
+
+bool ImportHooksActive() noexcept
+{
+    return g_ImportHooksActive;
+}
+
+DWORD RegisterImportHook(void** implFn, void* fixupFn) noexcept try
+{
+    auto target = *implFn;
+    auto code = ::DetourCodeFromPointer(target, nullptr);
+
+    std::lock_guard lock(g_ImportHooksLock);
+    g_ImportHooks.push_back(import_hook{ implFn, fixupFn, target, (code != target) ? code : nullptr, g_CurrentScope });
+    for (auto module : g_CurrentModules)
+    {
+        patch_imports(module, target, g_ImportHooks.back().code, fixupFn);
+    }
+
+    return ERROR_SUCCESS;
+}
+catch (...)
+{
+    return win32_from_caught_exception();
+}
+
+bool UnregisterImportHook(void** implFn, void* fixupFn) noexcept try
+{
+    std::vector<HMODULE> modules;
+    for (auto module = ::DetourEnumerateModules(nullptr); module; module = ::DetourEnumerateModules(module))
+    {
+        modules.push_back(module);
+    }
+
+    std::lock_guard lock(g_ImportHooksLock);
+    auto itr = std::find_if(g_ImportHooks.begin(), g_ImportHooks.end(), [&](const import_hook& hook)
+    {
+        return (hook.impl_fn == implFn) && (hook.fixup_fn == fixupFn);
+    });
+    if (itr == g_ImportHooks.end())
+    {
+        return false;
+    }
+
+    // Only entries that still point at the detour are put back, so there's no need to know which modules were hooked
+    for (auto module : modules)
+    {
+        patch_imports(module, itr->fixup_fn, nullptr, itr->target);
+    }
+
+    g_ImportHooks.erase(itr);
+    return true;
+}
+catch (...)
+{
+    // E.g. out of memory; the entries stay pointed at the detour, the same as a failed DetourDetach leaves it attached
+    return true;
+}
+
+// Hooks whatever listed modules the call loaded, now that their imports are bound
+auto LoadLibraryExWImpl = &::LoadLibraryExW;
+HMODULE __stdcall LoadLibraryExWFixup(_In_ LPCWSTR fileName, _Reserved_ HANDLE file, _In_ DWORD flags) noexcept
+{
+    auto result = LoadLibraryExWImpl(fileName, file, flags);
+    if (g_HasPendingModules.load(std::memory_order_acquire))
+    {
+        auto error = ::GetLastError();
+        hook_pending_modules();
+        ::SetLastError(error);
+    }
+
+    return result;
+}
+DECLARE_FIXUP(LoadLibraryExWImpl, LoadLibraryExWFixup);
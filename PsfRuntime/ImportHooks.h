@@ -0,0 +1,30 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <windows.h>
+#include <psf_config.h>
+
+// Detours are attached inline by default, i.e. the start of the detoured function is rewritten, so that every call to
+// it - from the application, from the other fixups, and from within Windows itself - goes through the detour. A fixup
+// whose config lists "importHookModules" instead gets its detours attached by pointing the import address table entries
+// of just those modules at them, so that calls from everywhere else don't pay for the detour at all. Listed modules
+// that are loaded later get hooked once the LoadLibraryExW call that loaded them returns.
+//
+// NOTE: Only calls made through the listed modules' imports are detoured. Functions that they look up through
+//       GetProcAddress or import through delay loading are not, and in modules that the import hooks of two fixups
+//       both list, a function that both of them detour is only detoured by the first
+
+// Makes the detours that the fixup registers from now on, until EndImportHooks is called, import hooks, if its config
+// asks for them
+void BeginImportHooks(const psf::json_object& fixupConfig);
+void EndImportHooks() noexcept;
+
+// Whether PSFRegister is to call RegisterImportHook rather than DetourAttach
+bool ImportHooksActive() noexcept;
+DWORD RegisterImportHook(void** implFn, void* fixupFn) noexcept;
+
+// Restores what the import hook that was registered with the same arguments replaced, returning false if there is none
+bool UnregisterImportHook(void** implFn, void* fixupFn) noexcept;
@@ -0,0 +1,241 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// The persistent injection helper is PsfRunDll, of the other architecture, running the PSFInjectionHelper entry point
+// of the PsfRuntime of its own architecture. The process that starts it creates a named pipe for the helper to connect
+// to, and then sends it one injection_request per child process, each answered by an injection_response. The helper
+// exits once the pipe is closed, i.e. when the process that started it does.
+//
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <detours.h>
+#include <psf_constants.h>
+#include <psf_utils.h>
+#include <utilities.h>
+#include <win32_error.h>
+
+#include "Config.h"
+#include "InjectionHelper.h"
+
+void Log(const char* fmt, ...);
+
+struct injection_request
+{
+    std::uint32_t process_id; // Created suspended
+};
+
+struct injection_response
+{
+    std::uint32_t error; // ERROR_SUCCESS once the helper's PsfRuntime has been injected
+};
+
+static std::mutex g_HelperLock;
+static HANDLE g_HelperPipe = INVALID_HANDLE_VALUE;
+static HANDLE g_HelperProcess = nullptr;
+static HANDLE g_HelperEvent = nullptr;
+static unsigned g_HelperStartCount = 0;
+
+static void close_helper() noexcept
+{
+    if (g_HelperPipe != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(g_HelperPipe);
+        g_HelperPipe = INVALID_HANDLE_VALUE;
+    }
+
+    if (g_HelperProcess)
+    {
+        // The helper exits on its own once the pipe is closed
+        ::CloseHandle(g_HelperProcess);
+        g_HelperProcess = nullptr;
+    }
+}
+
+// Finishes overlapped I/O on the helper's pipe, giving up should the helper exit before it completes
+static bool wait_for_helper(BOOL started, OVERLAPPED& overlapped) noexcept
+{
+    if (!started && (::GetLastError() != ERROR_IO_PENDING))
+    {
+        return false;
+    }
+
+    HANDLE handles[] = { overlapped.hEvent, g_HelperProcess };
+    if (::WaitForMultipleObjects(static_cast<DWORD>(std::size(handles)), handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+    {
+        ::CancelIoEx(g_HelperPipe, &overlapped);
+    }
+
+    DWORD transferred;
+    return ::GetOverlappedResult(g_HelperPipe, &overlapped, &transferred, TRUE) != FALSE;
+}
+
+static bool start_helper(PDETOUR_CREATE_PROCESS_ROUTINEW createProcess)
+{
+    if (!g_HelperEvent && !(g_HelperEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr)))
+    {
+        return false;
+    }
+
+    // Names are never reused, so that a pipe left behind by a helper that failed to start can't get in the way
+    auto pipeName = LR"(\\.\pipe\PsfInjectionHelper-)" + std::to_wstring(::GetCurrentProcessId()) + L"-" +
+        std::to_wstring(++g_HelperStartCount);
+    g_HelperPipe = ::CreateNamedPipeW(
+        pipeName.c_str(),
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE | FILE_FLAG_OVERLAPPED,
+        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        1,
+        sizeof(injection_request),
+        sizeof(injection_response),
+        0,
+        nullptr);
+    if (g_HelperPipe == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    // Same as the command line that Detours gives rundll32, aside from the entry point and its argument
+    auto helperDll = psf::current_module_path().parent_path() / psf::other_runtime_dll_name;
+    auto runDllPath = PackageRootPath() / psf::wrun_dll_name;
+    auto commandLine = std::wstring(psf::wrun_dll_name) + L" \"" + helperDll.native() + L"\",PSFInjectionHelper " + pipeName;
+
+    STARTUPINFOW startupInfo{};
+    startupInfo.cb = sizeof(startupInfo);
+    PROCESS_INFORMATION processInfo{};
+    if (!createProcess(runDllPath.c_str(), commandLine.data(), nullptr, nullptr, FALSE, CREATE_SUSPENDED, nullptr, nullptr,
+        &startupInfo, &processInfo))
+    {
+        return false;
+    }
+
+    // The helper's PsfRuntime must skip the initialization that it would otherwise do in every process, which Detours
+    // makes it do for its own helper processes that have this payload
+    auto dllName = narrow(helperDll.native(), CP_ACP);
+    std::vector<std::uint8_t> helperPayload(sizeof(DETOUR_EXE_HELPER) + dllName.length() + 1);
+    auto helper = reinterpret_cast<DETOUR_EXE_HELPER*>(helperPayload.data());
+    helper->cb = static_cast<DWORD>(helperPayload.size());
+    helper->pid = processInfo.dwProcessId;
+    helper->nDlls = 1;
+    std::memcpy(helper->rDlls, dllName.c_str(), dllName.length() + 1);
+
+    g_HelperProcess = processInfo.hProcess;
+    auto started = ::DetourCopyPayloadToProcess(processInfo.hProcess, DETOUR_EXE_HELPER_GUID, helper, helper->cb);
+    if (started)
+    {
+        ::ResumeThread(processInfo.hThread);
+    }
+    else
+    {
+        ::TerminateProcess(processInfo.hProcess, ~0u);
+    }
+    ::CloseHandle(processInfo.hThread);
+    if (!started)
+    {
+        return false;
+    }
+
+    OVERLAPPED overlapped{};
+    overlapped.hEvent = g_HelperEvent;
+    ::ResetEvent(g_HelperEvent);
+    auto connected = ::ConnectNamedPipe(g_HelperPipe, &overlapped);
+    if (!connected && (::GetLastError() != ERROR_PIPE_CONNECTED) && !wait_for_helper(connected, overlapped))
+    {
+        return false;
+    }
+
+    // Anyone else who connected first won't be receiving any requests
+    ULONG clientId = 0;
+    if (!::GetNamedPipeClientProcessId(g_HelperPipe, &clientId) || (clientId != processInfo.dwProcessId))
+    {
+        return false;
+    }
+
+    Log("\tStarted persistent injection helper PID=%d", processInfo.dwProcessId);
+    return true;
+}
+
+bool InjectViaPersistentHelper(DWORD processId, PDETOUR_CREATE_PROCESS_ROUTINEW createProcess)
+{
+    std::lock_guard<std::mutex> lock(g_HelperLock);
+
+    // A helper that has exited in the meantime is replaced once; beyond that, the caller falls back to the one-shot helper
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        if ((g_HelperPipe == INVALID_HANDLE_VALUE) && !start_helper(createProcess))
+        {
+            Log("\tCould not start the persistent injection helper. Error=0x%x", ::GetLastError());
+            close_helper();
+            return false;
+        }
+
+        injection_request request{ processId };
+        injection_response response{};
+        OVERLAPPED overlapped{};
+        overlapped.hEvent = g_HelperEvent;
+        ::ResetEvent(g_HelperEvent);
+        auto done = ::TransactNamedPipe(g_HelperPipe, &request, sizeof(request), &response, sizeof(response), nullptr, &overlapped);
+        if (done || wait_for_helper(done, overlapped))
+        {
+            ::SetLastError(response.error);
+            return response.error == ERROR_SUCCESS;
+        }
+
+        close_helper();
+    }
+
+    return false;
+}
+
+// The helper's side. 'pipeName' is the rest of PsfRunDll's command line
+extern "C" void CALLBACK PSFInjectionHelper(HWND, HINSTANCE, LPSTR pipeName, int) noexcept try
+{
+    auto pipe = ::CreateFileA(pipeName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (pipe == INVALID_HANDLE_VALUE)
+    {
+        ::ExitProcess(::GetLastError());
+    }
+
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    ::SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr);
+
+    // What the children need is the PsfRuntime of this process' architecture, i.e. this one
+    auto dll = narrow(psf::current_module_path().native(), CP_ACP);
+    PCSTR dlls[] = { dll.c_str() };
+
+    injection_request request;
+    DWORD transferred;
+    while (::ReadFile(pipe, &request, sizeof(request), &transferred, nullptr) && (transferred == sizeof(request)))
+    {
+        injection_response response{ ERROR_SUCCESS };
+        if (auto process = ::OpenProcess(PROCESS_ALL_ACCESS, FALSE, request.process_id))
+        {
+            if (!::DetourUpdateProcessWithDll(process, dlls, static_cast<DWORD>(std::size(dlls))))
+            {
+                response.error = ::GetLastError();
+            }
+            ::CloseHandle(process);
+        }
+        else
+        {
+            response.error = ::GetLastError();
+        }
+
+        if (!::WriteFile(pipe, &response, sizeof(response), &transferred, nullptr))
+        {
+            break;
+        }
+    }
+
+    ::ExitProcess(0);
+}
+catch (...)
+{
+    ::ExitProcess(win32_from_caught_exception());
+}
@@ -0,0 +1,14 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <windows.h>
+#include <detours.h>
+
+// Injects the PsfRuntime of the other architecture into the suspended process 'processId' through a PsfRunDll helper
+// that, unlike the one DetourProcessViaHelperDllsW creates for a single injection, is started once and then kept
+// running for as long as this process is. 'createProcess' must create processes without injecting into them. Returns
+// false when the helper can't be started or doesn't respond, so that the caller can fall back to the one-shot helper
+bool InjectViaPersistentHelper(DWORD processId, PDETOUR_CREATE_PROCESS_ROUTINEW createProcess);
@@ -4,11 +4,114 @@
 //-------------------------------------------------------------------------------------------------------
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
 #include <psf_config.h>
+#include <rapidjson/rapidjson.h>
+
+// All nodes of the DOM, along with their strings, member lists, and element lists, live in a single bump allocated
+// arena that is only ever freed as a whole. Nodes therefore must not own anything themselves, which is checked when
+// they are created
+class json_arena
+{
+public:
+    json_arena() noexcept = default;
+    json_arena(const json_arena&) = delete;
+    json_arena& operator=(const json_arena&) = delete;
+
+    void* allocate(std::size_t size, std::size_t alignment)
+    {
+        auto offset = (m_used + alignment - 1) & ~(alignment - 1);
+        if (m_blocks.empty() || (offset + size > m_blockSize))
+        {
+            // Anything larger than a block gets a block of its own
+            auto blockSize = std::max(size, block_size);
+            m_blocks.push_back(std::make_unique<std::byte[]>(blockSize));
+            m_blockSize = blockSize;
+            offset = 0;
+        }
+
+        m_used = offset + size;
+        return m_blocks.back().get() + offset;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena allocated objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Copies 'count' elements of 'data' into the arena. Returns null for an empty range
+    template <typename T>
+    const T* copy(const T* data, std::size_t count)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Arena allocated objects are never destroyed");
+        if (count == 0)
+        {
+            return nullptr;
+        }
+
+        auto result = static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+        std::memcpy(result, data, count * sizeof(T));
+        return result;
+    }
+
+    // Same as above, but the copy is null terminated, and so never null itself
+    template <typename CharT>
+    std::basic_string_view<CharT> copy_string(std::basic_string_view<CharT> str)
+    {
+        auto result = static_cast<CharT*>(allocate((str.length() + 1) * sizeof(CharT), alignof(CharT)));
+        std::memcpy(result, str.data(), str.length() * sizeof(CharT));
+        result[str.length()] = 0;
+        return { result, str.length() };
+    }
+
+private:
+    // Large enough that a typical config.json fits in a couple of blocks
+    static constexpr std::size_t block_size = 16 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+    std::size_t m_blockSize = 0;
+    std::size_t m_used = 0;
+};
+
+// Same as the above, except that it may be used from any thread. The DOM itself is immutable once parsed, so this only
+// holds what is created on demand afterwards
+class json_locked_arena
+{
+public:
+    template <typename CharT>
+    std::basic_string_view<CharT> copy_string(std::basic_string_view<CharT> str)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_arena.copy_string(str);
+    }
+
+private:
+    std::mutex m_lock;
+    json_arena m_arena;
+};
+
+// Where the UTF-16 versions of parsed strings go, as fixups ask for them
+inline json_locked_arena& json_wide_string_arena()
+{
+    static json_locked_arena arena;
+    return arena;
+}
 
 struct json_null_impl : psf::json_null
 {
@@ -16,7 +119,28 @@ struct json_null_impl : psf::json_null
 
 struct json_string_impl : psf::json_string
 {
-    json_string_impl(std::string_view value) : narrow_string(value), wide_string(widen(value)) {}
+    // Strings are expected to be null terminated and to outlive the object, e.g. by being in the same arena. Most string
+    // values are never read as UTF-16, so without a wide version up front one is only created on the first call to
+    // wide(), by whichever thread makes it
+    explicit json_string_impl(std::string_view narrowValue) noexcept :
+        narrow_string(narrowValue)
+    {
+    }
+
+    json_string_impl(std::string_view narrowValue, std::wstring_view wideValue) noexcept :
+        narrow_string(narrowValue),
+        wide_length(static_cast<unsigned>(wideValue.length())),
+        wide_data(wideValue.data())
+    {
+    }
+
+    // Only meant for use before the object is shared, e.g. when filling a vector
+    json_string_impl(const json_string_impl& other) noexcept :
+        narrow_string(other.narrow_string),
+        wide_length(other.wide_length.load(std::memory_order_relaxed)),
+        wide_data(other.wide_data.load(std::memory_order_relaxed))
+    {
+    }
 
     virtual const char* narrow(_Out_opt_ unsigned* length) const noexcept override
     {
@@ -25,21 +149,44 @@ struct json_string_impl : psf::json_string
             *length = static_cast<unsigned>(narrow_string.length());
         }
 
-        return narrow_string.c_str();
+        return narrow_string.data();
     }
 
     virtual const wchar_t* wide(_Out_opt_ unsigned* length) const noexcept override
     {
+        auto data = wide_data.load(std::memory_order_acquire);
+        if (!data)
+        {
+            data = publish_wide();
+        }
+
         if (length)
         {
-            *length = static_cast<unsigned>(wide_string.length());
+            *length = wide_length.load(std::memory_order_relaxed);
+        }
+
+        return data;
+    }
+
+    // Racing threads each convert the string, but all of them return the first copy that was published; the others are
+    // rare enough to leave in the arena. The length is the same for every copy and is stored before the pointer
+    const wchar_t* publish_wide() const noexcept
+    {
+        auto copy = json_wide_string_arena().copy_string<wchar_t>(widen(narrow_string));
+        wide_length.store(static_cast<unsigned>(copy.length()), std::memory_order_relaxed);
+
+        const wchar_t* expected = nullptr;
+        if (wide_data.compare_exchange_strong(expected, copy.data(), std::memory_order_release, std::memory_order_acquire))
+        {
+            return copy.data();
         }
 
-        return wide_string.c_str();
+        return expected;
     }
 
-    std::string narrow_string;
-    std::wstring wide_string;
+    std::string_view narrow_string;
+    mutable std::atomic<unsigned> wide_length{ 0 };
+    mutable std::atomic<const wchar_t*> wide_data{ nullptr };
 };
 
 struct json_number_impl : psf::json_number
@@ -91,130 +238,303 @@ struct json_boolean_impl : psf::json_boolean
     bool value;
 };
 
-struct json_object_impl : psf::json_object
+struct json_member
 {
-    using map_type = std::map<std::string, std::unique_ptr<psf::json_value>, std::less<>>;
-    using iterator_type = map_type::const_iterator;
+    std::string_view key; // Null terminated
+    psf::json_value* value;
+};
 
+struct json_object_impl : psf::json_object
+{
     virtual json_value* try_get(_In_ const char* key) const noexcept override
     {
-        if (auto itr = values.find(key); itr != values.end())
+        auto end = members + member_count;
+        auto itr = std::lower_bound(members, end, std::string_view(key), [](const json_member& member, std::string_view target)
+        {
+            return member.key < target;
+        });
+
+        if ((itr != end) && (itr->key == key))
         {
-            return itr->second.get();
+            return itr->value;
         }
 
         return nullptr;
     }
 
-    // We can elide allocations if the iterator fits within the size of a pointer (which should always be the case when
-    // building release)
-    static constexpr bool handle_requires_allocation = sizeof(iterator_type) > sizeof(enumeration_handle*);
-
+    // Handles are pointers to the current member, so enumeration never allocates
     virtual enumeration_handle* begin_enumeration(_Out_ enumeration_data* data) const noexcept override
     {
-        auto itr = values.begin();
-        if (itr == values.end())
-        {
-            *data = {};
-            return nullptr;
-        }
-
-        data->key = itr->first.c_str();
-        data->key_length = static_cast<unsigned>(itr->first.length());
-        data->value = itr->second.get();
-
-        if constexpr (handle_requires_allocation)
-        {
-            return reinterpret_cast<enumeration_handle*>(new iterator_type(itr));
-        }
-        else
-        {
-            return handle_from_iterator(itr);
-        }
+        return fill(members, data);
     }
 
     virtual enumeration_handle* advance(_In_ enumeration_handle* handle, _Inout_ enumeration_data* data) const noexcept override
     {
-        auto& itr = iterator_from_handle(handle);
-        assert(itr != values.end());
+        assert(handle);
+        return fill(reinterpret_cast<const json_member*>(handle) + 1, data);
+    }
 
-        ++itr;
-        if (itr == values.end())
-        {
-            if constexpr (handle_requires_allocation)
-            {
-                delete &itr;
-            }
+    virtual void cancel_enumeration(_In_ enumeration_handle*) const noexcept override
+    {
+    }
 
+    enumeration_handle* fill(const json_member* member, enumeration_data* data) const noexcept
+    {
+        if (member == members + member_count)
+        {
             *data = {};
             return nullptr;
         }
 
-        data->key = itr->first.c_str();
-        data->key_length = static_cast<unsigned>(itr->first.length());
-        data->value = itr->second.get();
+        data->key = member->key.data();
+        data->key_length = static_cast<unsigned>(member->key.length());
+        data->value = member->value;
+        return reinterpret_cast<enumeration_handle*>(const_cast<json_member*>(member));
+    }
+
+    // Sorted by key, the same way that std::string compares
+    const json_member* members = nullptr;
+    unsigned member_count = 0;
+};
 
-        return handle_from_iterator(itr);
+struct json_array_impl : psf::json_array
+{
+    virtual unsigned size() const noexcept override
+    {
+        return value_count;
     }
 
-    virtual void cancel_enumeration(_In_ enumeration_handle* handle) const noexcept override
+    virtual json_value* try_get_at(unsigned index) const noexcept override
     {
-        if constexpr (handle_requires_allocation)
+        if (index >= value_count)
         {
-            delete &iterator_from_handle(handle);
+            return nullptr;
         }
+
+        return values[index];
     }
 
-    iterator_type& iterator_from_handle(enumeration_handle*& handle) const noexcept
+    psf::json_value* const* values = nullptr;
+    unsigned value_count = 0;
+};
+
+// The rapidjson SAX handler that constructs the DOM and holds the root. All nodes are allocated from 'arena'; since the
+// DOM is never modified, identical strings and keys share a single copy, and all nulls and booleans share the same few
+// nodes. Used by the PSF Runtime to parse config.json, and by ConfigScalingBenchmark to time that parse
+struct json_dom_builder
+{
+    bool on_value(psf::json_value* value)
     {
-        assert(handle);
-        if constexpr (handle_requires_allocation)
+        if (!state_stack.empty())
+        {
+            assert(root);
+            if (state_stack.back().value.index() == 0)
+            {
+                member_scratch.push_back(json_member{ object_key, value });
+                object_key = {};
+            }
+            else
+            {
+                element_scratch.push_back(value);
+            }
+        }
+        else if (!root)
         {
-            // Allocation means that the handle pointer is actually a pointer to a map iterator
-            return *reinterpret_cast<iterator_type*>(handle);
+            root = value;
         }
         else
         {
-            // No allocation means that the handle pointer _is_ the map iterator, e.g. as if it were a union
-            return reinterpret_cast<iterator_type&>(handle);
+            error_message = "Can't have more than one root";
+            return false;
         }
+
+        return true;
     }
 
-    enumeration_handle* handle_from_iterator(iterator_type& itr) const noexcept
+    std::string_view intern(std::string_view str)
     {
-        assert(itr != values.end());
-        if constexpr (handle_requires_allocation)
+        if (auto itr = narrow_strings.find(str); itr != narrow_strings.end())
         {
-            // Allocation means that the handle pointer is actually a pointer to a map iterator
-            return reinterpret_cast<enumeration_handle*>(&itr);
+            return *itr;
         }
-        else
+
+        return *narrow_strings.insert(arena.copy_string(str)).first;
+    }
+
+    bool Null()
+    {
+        return on_value(&null_value);
+    }
+
+    bool Bool(bool b)
+    {
+        return on_value(b ? &true_value : &false_value);
+    }
+
+    bool Int(std::int64_t value)
+    {
+        return on_value(arena.make<json_number_impl>(value));
+    }
+
+    bool Uint(std::uint64_t value)
+    {
+        return on_value(arena.make<json_number_impl>(value));
+    }
+
+    bool Int64(std::int64_t value)
+    {
+        return on_value(arena.make<json_number_impl>(value));
+    }
+
+    bool Uint64(std::uint64_t value)
+    {
+        return on_value(arena.make<json_number_impl>(value));
+    }
+
+    bool Double(double value)
+    {
+        return on_value(arena.make<json_number_impl>(value));
+    }
+
+    bool RawNumber(const char* /*str*/, rapidjson::SizeType /*length*/, bool /*copy*/)
+    {
+        // Provided only to satisfy compilation, but never called since we never pass kParseNumbersAsStringsFlag
+        // Consider: Update rapidjson to use if constexpr
+        assert(false);
+        return false;
+    }
+
+    bool String(const char* str, rapidjson::SizeType length, [[maybe_unused]] bool copy)
+    {
+        // Caller should always own the memory
+        assert(copy);
+        std::string_view value(str, length);
+        auto& node = string_values[intern(value)];
+        if (!node)
         {
-            // No allocation means that the handle pointer _is_ the map iterator, e.g. as if it were a union
-            // NOTE: We can reinterpret_cast a pointer to a reference, but not the other way around...
-            return *reinterpret_cast<enumeration_handle**>(&itr);
+            node = arena.make<json_string_impl>(intern(value));
         }
+
+        return on_value(node);
     }
 
-    map_type values;
-};
+    bool StartObject()
+    {
+        // NOTE: We must call 'on_value' before appending to 'state_stack', otherwise we'll try and add the object as a
+        //       child of itself. The members are collected in 'member_scratch' and only moved into the object, sorted,
+        //       once it's complete
+        auto obj = arena.make<json_object_impl>();
+        auto result = on_value(obj);
+        if (result)
+        {
+            state_stack.push_back(open_container{ obj, member_scratch.size() });
+        }
 
-struct json_array_impl : psf::json_array
-{
-    virtual unsigned size() const noexcept override
+        return result;
+    }
+
+    bool Key(const char* str, rapidjson::SizeType length, [[maybe_unused]] bool copy)
     {
-        return static_cast<unsigned>(values.size());
+        // Caller should always own the memory
+        assert(copy);
+        assert(object_key.empty());
+        object_key = intern(std::string_view(str, length));
+        return true;
     }
 
-    virtual json_value* try_get_at(unsigned index) const noexcept override
+    bool EndObject([[maybe_unused]] rapidjson::SizeType memberCount)
     {
-        if (index >= values.size())
+        assert(!state_stack.empty());
+        auto current = state_stack.back();
+        assert(current.value.index() == 0);
+        state_stack.pop_back();
+
+        auto begin = member_scratch.begin() + current.first;
+        auto end = member_scratch.end();
+        assert(static_cast<rapidjson::SizeType>(end - begin) == memberCount);
+
+        std::sort(begin, end, [](const json_member& lhs, const json_member& rhs) { return lhs.key < rhs.key; });
+        auto duplicate = std::adjacent_find(begin, end, [](const json_member& lhs, const json_member& rhs) { return lhs.key == rhs.key; });
+        if (duplicate != end)
         {
-            return nullptr;
+            error_message = "'" + std::string(duplicate->key) + "' already exists in map";
+            return false;
+        }
+
+        auto obj = std::get<0>(current.value);
+        obj->member_count = static_cast<unsigned>(end - begin);
+        obj->members = arena.copy(member_scratch.data() + current.first, obj->member_count);
+        member_scratch.erase(begin, end);
+        return true;
+    }
+
+    bool StartArray()
+    {
+        // NOTE: We must call 'on_value' before appending to 'state_stack', otherwise we'll try and add the array as a
+        //       child of itself
+        auto arr = arena.make<json_array_impl>();
+        auto result = on_value(arr);
+        if (result)
+        {
+            state_stack.push_back(open_container{ arr, element_scratch.size() });
         }
 
-        return values[index].get();
+        return result;
     }
 
-    std::vector<std::unique_ptr<psf::json_value>> values;
+    bool EndArray([[maybe_unused]] rapidjson::SizeType elementCount)
+    {
+        assert(!state_stack.empty());
+        auto current = state_stack.back();
+        assert(current.value.index() == 1);
+        state_stack.pop_back();
+
+        auto count = element_scratch.size() - current.first;
+        assert(count == elementCount);
+
+        auto arr = std::get<1>(current.value);
+        arr->value_count = static_cast<unsigned>(count);
+        arr->values = arena.copy(element_scratch.data() + current.first, count);
+        element_scratch.resize(current.first);
+        return true;
+    }
+
+    // Frees everything that's only needed while parsing
+    void finish()
+    {
+        assert(state_stack.empty());
+        decltype(narrow_strings){}.swap(narrow_strings);
+        decltype(string_values){}.swap(string_values);
+        decltype(member_scratch){}.swap(member_scratch);
+        decltype(element_scratch){}.swap(element_scratch);
+    }
+
+    json_arena arena;
+
+    // Root of the tree, filled in by the first object/array/string, etc. encountered
+    psf::json_value* root = nullptr;
+
+    json_null_impl null_value;
+    json_boolean_impl false_value{ false };
+    json_boolean_impl true_value{ true };
+
+    // Since all we get are callbacks, we don't have the luxury of using stack memory to save state, so use the heap
+    // NOTE: Since we're immediately done processing strings, numbers, booleans, and null, we only need to save state
+    //       for objects and arrays, along with where their members/elements start in the scratch lists
+    struct open_container
+    {
+        std::variant<json_object_impl*, json_array_impl*> value;
+        std::size_t first;
+    };
+    std::vector<open_container> state_stack;
+    std::vector<json_member> member_scratch;
+    std::vector<psf::json_value*> element_scratch;
+    std::string_view object_key;
+
+    // Strings are interned while parsing; both sets point into 'arena'
+    std::unordered_set<std::string_view> narrow_strings;
+    std::unordered_map<std::string_view, json_string_impl*> string_values;
+
+    // When non-empty, provides a more useful error message displayed to the user for invalid config.json files
+    std::string error_message;
 };
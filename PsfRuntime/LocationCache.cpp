@@ -0,0 +1,164 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <utilities.h>
+
+#include "Config.h"
+#include "LocationCache.h"
+
+void Log(const char* fmt, ...);
+
+// The cache is a text file whose first line is the full name - and therefore the version - of the package that it
+// describes. Each following line is a file name, a tab, and the package relative path that the file was found at, which
+// is empty when the package has no file by that name
+static constexpr wchar_t location_cache_file_name[] = L"PsfLocations.txt";
+
+struct package_location
+{
+    std::wstring file_name;
+    std::wstring relative_path;
+};
+
+static std::mutex g_LocationCacheLock;
+static std::optional<std::vector<package_location>> g_Locations;
+
+static std::filesystem::path location_cache_path()
+{
+    // Read from the environment rather than with SHGetKnownFolderPath since config.json is looked for during DllMain
+    wchar_t buffer[MAX_PATH];
+    auto length = ::GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, static_cast<DWORD>(std::size(buffer)));
+    if ((length == 0) || (length >= std::size(buffer)) || PackageFamilyName().empty())
+    {
+        return {};
+    }
+
+    return std::filesystem::path(buffer) / L"Packages" / PackageFamilyName() / L"LocalCache" / location_cache_file_name;
+}
+
+static std::vector<package_location> read_locations(const std::filesystem::path& path)
+{
+    std::vector<package_location> result;
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || (widen(line) != PackageFullName()))
+    {
+        // Either nothing has been cached yet, or what was cached describes a different version of the package
+        return result;
+    }
+
+    while (std::getline(file, line))
+    {
+        auto tab = line.find('\t');
+        if (tab != std::string::npos)
+        {
+            result.push_back(package_location{ widen(line.substr(0, tab)), widen(line.substr(tab + 1)) });
+        }
+    }
+
+    return result;
+}
+
+static void write_locations(const std::filesystem::path& path, const std::vector<package_location>& locations)
+{
+    // Written to a file of this process' own first, so that other processes never read a partially written cache
+    auto tempPath = path;
+    tempPath.concat(L"." + std::to_wstring(::GetCurrentProcessId()));
+
+    std::ofstream file(tempPath, std::ios::trunc);
+    file << narrow(PackageFullName()) << "\n";
+    for (auto& location : locations)
+    {
+        file << narrow(location.file_name) << "\t" << narrow(location.relative_path) << "\n";
+    }
+    file.close();
+
+    if (!file || !::MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        // Not fatal; the next process will just need to look again
+        Log("Could not update the location cache %ls", path.c_str());
+        ::DeleteFileW(tempPath.c_str());
+    }
+}
+
+static std::filesystem::path walk_package(const std::filesystem::path& fileName)
+{
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator itr(PackageRootPath(), std::filesystem::directory_options::skip_permission_denied, ec);
+    for (; !ec && (itr != std::filesystem::recursive_directory_iterator()); itr.increment(ec))
+    {
+        std::error_code fileEc;
+        if ((_wcsicmp(itr->path().filename().c_str(), fileName.c_str()) == 0) && itr->is_regular_file(fileEc))
+        {
+            return itr->path();
+        }
+    }
+
+    if (ec)
+    {
+        Log("Non-fatal error enumerating directories while looking for %ls: %s", fileName.c_str(), ec.message().c_str());
+    }
+
+    return {};
+}
+
+std::filesystem::path FindPackageFile(const std::filesystem::path& fileName)
+{
+    std::lock_guard<std::mutex> lock(g_LocationCacheLock);
+
+    auto cachePath = location_cache_path();
+    if (!g_Locations)
+    {
+        g_Locations = cachePath.empty() ? std::vector<package_location>{} : read_locations(cachePath);
+    }
+
+    auto isFile = [&](const package_location& location)
+    {
+        return _wcsicmp(location.file_name.c_str(), fileName.c_str()) == 0;
+    };
+
+    auto itr = std::find_if(g_Locations->begin(), g_Locations->end(), isFile);
+    if (itr != g_Locations->end())
+    {
+        if (itr->relative_path.empty())
+        {
+            Log("Location cache: %ls is not in the package", fileName.c_str());
+            return {};
+        }
+
+        auto path = PackageRootPath() / itr->relative_path;
+        auto attributes = ::GetFileAttributesW(path.c_str());
+        if ((attributes != INVALID_FILE_ATTRIBUTES) && ((attributes & FILE_ATTRIBUTE_DIRECTORY) == 0))
+        {
+            Log("Location cache: %ls found at %ls", fileName.c_str(), path.c_str());
+            return path;
+        }
+
+        // Only expected when the package's files were changed in place, e.g. for a package registered from a folder
+        Log("Location cache: %ls is no longer at %ls, looking again", fileName.c_str(), path.c_str());
+    }
+
+    Log("Looking for %ls everywhere in the package", fileName.c_str());
+    auto path = walk_package(fileName);
+    auto relativePath = path.empty() ? std::wstring{} : path.lexically_relative(PackageRootPath()).native();
+    if (!cachePath.empty())
+    {
+        // Start from what is on disk now, so that what other processes have found in the meantime is kept
+        auto locations = read_locations(cachePath);
+        locations.erase(std::remove_if(locations.begin(), locations.end(), isFile), locations.end());
+        locations.push_back(package_location{ fileName.native(), relativePath });
+        write_locations(cachePath, locations);
+        g_Locations = std::move(locations);
+    }
+
+    return path;
+}
@@ -0,0 +1,13 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+
+// Returns the path of a file named 'fileName' anywhere in the package, or an empty path if the package has no such file.
+// The first lookup of a name walks the whole package, which for large packages takes seconds, so its result - found or
+// not - is remembered in the package's LocalCache folder. Since the contents of a package never change, later processes
+// trust the remembered result until the package is updated to a different version
+std::filesystem::path FindPackageFile(const std::filesystem::path& fileName);
@@ -0,0 +1,109 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cstring>
+#include <cwchar>
+#include <iterator>
+#include <mutex>
+
+#include <windows.h>
+#include <psf_runtime.h>
+
+#include "Metrics.h"
+
+void Log(const char* fmt, ...);
+
+static_assert(sizeof(psf::metrics_header) == 64, "The layout of the metrics section is shared with other processes");
+static_assert(sizeof(psf::metric_entry) == 64, "The layout of the metrics section is shared with other processes");
+
+// Along with the header, exactly four pages
+constexpr std::uint32_t metrics_capacity = 255;
+constexpr std::uint32_t metrics_section_size = sizeof(psf::metrics_header) + metrics_capacity * sizeof(psf::metric_entry);
+
+static psf::metrics_header* g_Metrics = nullptr;
+static psf::metric_entry* g_MetricEntries = nullptr;
+
+// Only taken to register counters, never to update them
+static std::mutex g_MetricsLock;
+
+void InitializeMetrics() noexcept
+{
+    wchar_t name[64];
+    std::swprintf(name, std::size(name), L"%ls%lu", psf::metrics_section_prefix, ::GetCurrentProcessId());
+
+    auto section = ::CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, metrics_section_size, name);
+    if (!section)
+    {
+        Log("\tMetrics aren't published, since their section could not be created: 0x%x\n", ::GetLastError());
+        return;
+    }
+    else if (::GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        // Not ours to write to, since process ids are only unique among the processes that are running
+        Log("\tMetrics aren't published, since their section already exists\n");
+        ::CloseHandle(section);
+        return;
+    }
+
+    // NOTE: The section is left open, and mapped, for as long as the process runs, since collectors may poll it until then
+    auto view = ::MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, metrics_section_size);
+    if (!view)
+    {
+        Log("\tMetrics aren't published, since their section could not be mapped: 0x%x\n", ::GetLastError());
+        ::CloseHandle(section);
+        return;
+    }
+
+    // The section starts out zeroed, which also holds 'count' at zero until the rest of the header is filled in
+    auto header = static_cast<psf::metrics_header*>(view);
+    LARGE_INTEGER frequency, now;
+    ::QueryPerformanceFrequency(&frequency);
+    ::QueryPerformanceCounter(&now);
+    header->header_size = sizeof(psf::metrics_header);
+    header->entry_size = sizeof(psf::metric_entry);
+    header->capacity = metrics_capacity;
+    header->process_id = ::GetCurrentProcessId();
+    header->frequency = frequency.QuadPart;
+    header->created = now.QuadPart;
+    ::MemoryBarrier();
+    header->version = psf::metrics_layout_version;
+
+    g_MetricEntries = reinterpret_cast<psf::metric_entry*>(header + 1);
+    g_Metrics = header;
+    Log("\tMetrics published as %ls\n", name);
+}
+
+PSFAPI volatile std::int64_t* __stdcall PSFRegisterMetric(_In_ const char* name) noexcept
+{
+    if (!g_Metrics || !name)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard lock(g_MetricsLock);
+    constexpr auto nameCapacity = sizeof(psf::metric_entry::name);
+    auto count = g_Metrics->count;
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        if (std::strncmp(g_MetricEntries[i].name, name, nameCapacity - 1) == 0)
+        {
+            return &g_MetricEntries[i].value;
+        }
+    }
+
+    if (count == metrics_capacity)
+    {
+        Log("\tMetric %s isn't published, since all %u entries are in use\n", name, metrics_capacity);
+        return nullptr;
+    }
+
+    auto& entry = g_MetricEntries[count];
+    ::strncpy_s(entry.name, name, _TRUNCATE);
+
+    // Readers only look at the entries below 'count', so the name must be in place first
+    ::MemoryBarrier();
+    g_Metrics->count = count + 1;
+    return &entry.value;
+}
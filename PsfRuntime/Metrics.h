@@ -0,0 +1,10 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+// Creates the shared memory section that PSFRegisterMetric hands out counters in, for processes whose config sets
+// "metrics". Must be called before any fixup is loaded, since fixups register their counters while being loaded. Until
+// then, and in processes that don't publish metrics, PSFRegisterMetric returns null
+void InitializeMetrics() noexcept;
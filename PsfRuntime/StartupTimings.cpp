@@ -0,0 +1,126 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cwchar>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <psf_constants.h>
+#include <psf_runtime.h>
+#include "Telemetry.h"
+
+#include "StartupTimings.h"
+
+TRACELOGGING_DECLARE_PROVIDER(g_Log_ETW_ComponentProvider);
+TRACELOGGING_DEFINE_PROVIDER(
+    g_Log_ETW_ComponentProvider,
+    "Microsoft.Windows.PSFRuntime",
+    (0xf7f4e8c4, 0x9981, 0x5221, 0xe6, 0xfb, 0xff, 0x9d, 0xd1, 0xcd, 0xa4, 0xe1),
+    TraceLoggingOptionMicrosoftTelemetry());
+
+static psf::startup_timings g_StartupTimings = [] {
+    psf::startup_timings result{};
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    result.frequency = frequency.QuadPart;
+    return result;
+}();
+static std::vector<psf::startup_fixup_timings> g_FixupTimings;
+
+psf::startup_timings& StartupTimings() noexcept
+{
+    return g_StartupTimings;
+}
+
+void ReadLauncherTimestamps() noexcept
+{
+    wchar_t buffer[64];
+    auto length = ::GetEnvironmentVariableW(psf::launcher_timestamps_variable, buffer, static_cast<DWORD>(std::size(buffer)));
+    if ((length == 0) || (length >= std::size(buffer)))
+    {
+        return;
+    }
+
+    wchar_t* end;
+    auto start = std::wcstoll(buffer, &end, 10);
+    if (*end == L';')
+    {
+        g_StartupTimings.launcher_start = start;
+        g_StartupTimings.launcher_create_process = std::wcstoll(end + 1, nullptr, 10);
+    }
+
+    // Only meant for the process that PsfLauncher created, not for any that it goes on to create itself
+    ::SetEnvironmentVariableW(psf::launcher_timestamps_variable, nullptr);
+}
+
+void ReserveFixupTimings(std::size_t count)
+{
+    g_FixupTimings.resize(count);
+}
+
+psf::startup_fixup_timings& FixupTimings(std::size_t index) noexcept
+{
+    return g_FixupTimings[index];
+}
+
+static std::uint64_t microseconds(const psf::startup_phase& phase) noexcept
+{
+    if (phase.end <= phase.start)
+    {
+        return 0;
+    }
+
+    return static_cast<std::uint64_t>((phase.end - phase.start) * 1000000 / g_StartupTimings.frequency);
+}
+
+void ReportStartupTimings() noexcept try
+{
+    g_StartupTimings.fixup_timings = g_FixupTimings.data();
+    g_StartupTimings.fixup_count = static_cast<unsigned>(g_FixupTimings.size());
+
+    std::wstring dlls;
+    std::vector<std::uint64_t> loadTimes;
+    std::vector<std::uint64_t> initializeTimes;
+    std::vector<std::uint64_t> commitTimes;
+    for (auto& fixup : g_FixupTimings)
+    {
+        dlls += dlls.empty() ? L"" : L";";
+        dlls += fixup.dll ? fixup.dll : L"";
+        loadTimes.push_back(microseconds(fixup.load) + microseconds(fixup.pre_initialize));
+        initializeTimes.push_back(microseconds(fixup.initialize));
+        commitTimes.push_back(microseconds(fixup.commit));
+    }
+    auto count = static_cast<UINT16>(g_FixupTimings.size());
+
+    TraceLoggingRegister(g_Log_ETW_ComponentProvider);
+    TraceLoggingWrite(
+        g_Log_ETW_ComponentProvider,
+        "StartupTimings",
+        TraceLoggingUInt64(microseconds(g_StartupTimings.config_read), "ConfigReadMicroseconds"),
+        TraceLoggingUInt64(microseconds(g_StartupTimings.config_parse), "ConfigParseMicroseconds"),
+        TraceLoggingUInt64(microseconds(g_StartupTimings.runtime_attach), "RuntimeAttachMicroseconds"),
+        TraceLoggingUInt64(microseconds({ g_StartupTimings.config_read.start, g_StartupTimings.fixups.start }), "TimeToFixupsMicroseconds"),
+        TraceLoggingUInt64(microseconds(g_StartupTimings.fixups), "FixupsMicroseconds"),
+        TraceLoggingUInt64(g_StartupTimings.launcher_start ? microseconds({ g_StartupTimings.launcher_start, g_StartupTimings.fixups.end }) : 0, "LaunchMicroseconds"),
+        TraceLoggingWideString(dlls.c_str(), "FixupDlls"),
+        TraceLoggingUInt64Array(loadTimes.data(), count, "FixupLoadMicroseconds"),
+        TraceLoggingUInt64Array(initializeTimes.data(), count, "FixupInitializeMicroseconds"),
+        TraceLoggingUInt64Array(commitTimes.data(), count, "FixupCommitMicroseconds"),
+        TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
+        TelemetryPrivacyDataTag(PDT_ProductAndServicePerformance),
+        TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+    TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
+}
+catch (...)
+{
+    // Timings are informational only; never fail the launch over them
+}
+
+PSFAPI const psf::startup_timings* __stdcall PSFQueryStartupTimings() noexcept
+{
+    return &g_StartupTimings;
+}
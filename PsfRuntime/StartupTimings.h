@@ -0,0 +1,52 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+
+#include <windows.h>
+#include <psf_runtime.h>
+
+inline std::int64_t startup_timestamp() noexcept
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+// Records the start and end of the phase around the lifetime of the object
+class startup_phase_timer
+{
+public:
+    explicit startup_phase_timer(psf::startup_phase& phase) noexcept :
+        m_phase(phase)
+    {
+        m_phase.start = startup_timestamp();
+    }
+
+    startup_phase_timer(const startup_phase_timer&) = delete;
+    startup_phase_timer& operator=(const startup_phase_timer&) = delete;
+
+    ~startup_phase_timer()
+    {
+        m_phase.end = startup_timestamp();
+    }
+
+private:
+    psf::startup_phase& m_phase;
+};
+
+psf::startup_timings& StartupTimings() noexcept;
+
+// Takes the launcher's timestamps from the environment, if PsfLauncher started the process
+void ReadLauncherTimestamps() noexcept;
+
+// Creates the timings of 'count' fixups, which are then written to concurrently when loading fixups in parallel, and so
+// must all exist beforehand
+void ReserveFixupTimings(std::size_t count);
+psf::startup_fixup_timings& FixupTimings(std::size_t index) noexcept;
+
+// Publishes the fixup timings through PSFQueryStartupTimings and writes all of the timings to ETW
+void ReportStartupTimings() noexcept;
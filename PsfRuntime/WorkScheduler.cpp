@@ -0,0 +1,117 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <new>
+
+#include <windows.h>
+#include <psf_runtime.h>
+
+#include "WorkScheduler.h"
+
+void Log(const char* fmt, ...);
+
+// Work runs on the process's default thread pool, which the application and Windows itself already keep sized to the
+// machine, rather than on a pool of the PSF Runtime's own. All of it is in one cleanup group, so that it can be drained
+// in one go when the PSF Runtime unloads, with one callback environment for each priority
+struct submitted_work
+{
+    PSFWorkProc callback = nullptr;
+    void* context = nullptr;
+};
+
+static std::once_flag g_WorkSchedulerOnce;
+static PTP_CLEANUP_GROUP g_WorkCleanupGroup = nullptr;
+static TP_CALLBACK_ENVIRON g_WorkEnvironments[3];
+static std::atomic<bool> g_WorkSchedulerShutDown{ false };
+
+static void initialize_work_scheduler() noexcept
+{
+    g_WorkCleanupGroup = ::CreateThreadpoolCleanupGroup();
+    if (!g_WorkCleanupGroup)
+    {
+        Log("\tPSFSubmitWork is unavailable, since its cleanup group could not be created: 0x%x\n", ::GetLastError());
+        return;
+    }
+
+    constexpr TP_CALLBACK_PRIORITY priorities[] = { TP_CALLBACK_PRIORITY_HIGH, TP_CALLBACK_PRIORITY_NORMAL, TP_CALLBACK_PRIORITY_LOW };
+    static_assert(std::size(priorities) == std::size(g_WorkEnvironments));
+    for (std::size_t i = 0; i < std::size(g_WorkEnvironments); ++i)
+    {
+        auto& environment = g_WorkEnvironments[i];
+        ::InitializeThreadpoolEnvironment(&environment);
+        ::SetThreadpoolCallbackPriority(&environment, priorities[i]);
+        ::SetThreadpoolCallbackCleanupGroup(&environment, g_WorkCleanupGroup, [](PVOID objectContext, PVOID) noexcept
+        {
+            // Work that was cancelled before it started
+            delete static_cast<submitted_work*>(objectContext);
+        });
+    }
+}
+
+static void CALLBACK run_work(PTP_CALLBACK_INSTANCE, PVOID context) noexcept
+{
+    auto work = static_cast<submitted_work*>(context);
+    auto callback = work->callback;
+    auto callbackContext = work->context;
+    delete work;
+
+    callback(callbackContext);
+}
+
+PSFAPI bool __stdcall PSFSubmitWork(_In_ PSFWorkProc callback, _In_opt_ void* context, psf::work_priority priority) noexcept
+{
+    auto index = static_cast<std::size_t>(priority);
+    if (!callback || (index >= std::size(g_WorkEnvironments)))
+    {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return false;
+    }
+
+    if (g_WorkSchedulerShutDown.load(std::memory_order_acquire))
+    {
+        ::SetLastError(ERROR_SHUTDOWN_IN_PROGRESS);
+        return false;
+    }
+
+    std::call_once(g_WorkSchedulerOnce, initialize_work_scheduler);
+    if (!g_WorkCleanupGroup)
+    {
+        ::SetLastError(ERROR_NOT_SUPPORTED);
+        return false;
+    }
+
+    auto work = new (std::nothrow) submitted_work{ callback, context };
+    if (!work)
+    {
+        ::SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return false;
+    }
+
+    if (!::TrySubmitThreadpoolCallback(run_work, work, &g_WorkEnvironments[index]))
+    {
+        delete work;
+        return false;
+    }
+
+    return true;
+}
+
+void ShutdownWorkScheduler() noexcept
+{
+    g_WorkSchedulerShutDown.store(true, std::memory_order_release);
+    if (g_WorkCleanupGroup)
+    {
+        ::CloseThreadpoolCleanupGroupMembers(g_WorkCleanupGroup, TRUE, nullptr);
+        ::CloseThreadpoolCleanupGroup(g_WorkCleanupGroup);
+        g_WorkCleanupGroup = nullptr;
+        for (auto& environment : g_WorkEnvironments)
+        {
+            ::DestroyThreadpoolEnvironment(&environment);
+        }
+    }
+}
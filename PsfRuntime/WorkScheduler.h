@@ -0,0 +1,9 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+// Cancels the work submitted through PSFSubmitWork that hasn't started yet, and waits for the work that has. Must be
+// called before any fixup is freed, since the work runs code of the fixup that submitted it
+void ShutdownWorkScheduler() noexcept;
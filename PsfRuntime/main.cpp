@@ -4,13 +4,21 @@
 //-------------------------------------------------------------------------------------------------------
 
 #include <algorithm>
+#include <future>
 #include <sstream>
 
 #include <detour_transaction.h>
 #include <psf_framework.h>
 #include <psf_runtime.h>
 
+#include "AllocationTracking.h"
+#include "CpuAccounting.h"
+#include "ImportHooks.h"
+#include "Metrics.h"
 #include "Config.h"
+#include "LocationCache.h"
+#include "StartupTimings.h"
+#include "WorkScheduler.h"
 
 void Log(const char* fmt, ...);
 
@@ -18,6 +26,7 @@ struct loaded_fixup
 {
     HMODULE module_handle = nullptr;
     PSFUninitializeProc uninitialize = nullptr;
+    PSFFlushProc flush = nullptr;
 
     loaded_fixup() = default;
     loaded_fixup(const loaded_fixup&) = delete;
@@ -31,6 +40,7 @@ struct loaded_fixup
     loaded_fixup& operator=(loaded_fixup&& other) noexcept
     {
         swap(other);
+        return *this;
     }
 
     ~loaded_fixup()
@@ -46,125 +56,326 @@ struct loaded_fixup
     {
         std::swap(module_handle, other.module_handle);
         std::swap(uninitialize, other.uninitialize);
+        std::swap(flush, other.flush);
     }
 };
 std::vector<loaded_fixup> loaded_fixups;
 
-void load_fixups()
+// Loads the fixup under the name it is configured with, or with the architecture bitness appended. The package root is
+// tried first, then each of the package relative folders listed in the root "fixupSearchPaths" array, and only then the
+// rest of the package. On return, 'path' is the last path tried
+static HMODULE load_fixup(const std::filesystem::path& dll, std::filesystem::path& path)
 {
-    using namespace std::literals;
+    auto suffixedName = dll.filename();
+    suffixedName.replace_extension();
+    suffixedName.concat((sizeof(void*) == 4) ? L"32.dll" : L"64.dll");
 
-    if (auto config = PSFQueryCurrentExeConfig())
+    DWORD error = ERROR_MOD_NOT_FOUND;
+    auto tryLoad = [&](std::filesystem::path candidate) -> HMODULE
     {
-        if (auto fixups = config->try_get("fixups"))
+        path = std::move(candidate);
+        auto module = ::LoadLibraryW(path.c_str());
+        if (!module)
         {
-            for (auto& fixupConfig : fixups->as_array())
-            {
-                auto& fixup = loaded_fixups.emplace_back();
+            error = ::GetLastError();
+        }
+        return module;
+    };
 
-                auto path = PackageRootPath() / fixupConfig.as_object().get("dll").as_string().wide();
-                fixup.module_handle = ::LoadLibraryW(path.c_str());
-                if (!fixup.module_handle)
-                {
-                    path.replace_extension();
-                    path.concat((sizeof(void*) == 4) ? L"32.dll" : L"64.dll");
-                    fixup.module_handle = ::LoadLibraryW(path.c_str());
+    auto rootPath = PackageRootPath() / dll;
+    if (auto module = tryLoad(rootPath))
+    {
+        return module;
+    }
+    if (auto module = tryLoad(rootPath.replace_filename(suffixedName)))
+    {
+        return module;
+    }
+
+    if (auto searchPaths = PSFQueryConfigRoot()->as_object().try_get("fixupSearchPaths"))
+    {
+        for (auto& searchPath : searchPaths->as_array())
+        {
+            auto directory = PackageRootPath() / searchPath.as_string().wide();
+            if (auto module = tryLoad(directory / dll.filename()))
+            {
+                return module;
+            }
+            if (auto module = tryLoad(directory / suffixedName))
+            {
+                return module;
+            }
+        }
+    }
 
-                    if (!fixup.module_handle)
-                    {
 #if _DEBUG
-                        Log("\tfixup not found at root of package, look elsewhere %ls.", path.filename().c_str());
+    Log("\tfixup not found at root of package, look elsewhere %ls.", suffixedName.c_str());
 #endif
-                        // just try to find it elsewhere as it isn't at the root
-                        for (auto& dentry : std::filesystem::recursive_directory_iterator(PackageRootPath()))
-                        {
-                            try
-                            {
-                                if (dentry.path().filename().compare(path.filename().c_str()) == 0)
-                                {
-                                    fixup.module_handle = ::LoadLibraryW(dentry.path().c_str());
-                                    if (!fixup.module_handle)
-                                    {
-                                        auto d2 = dentry.path();
-                                        d2.replace_extension();
-                                        d2.concat((sizeof(void*) == 4) ? L"32.dll" : L"64.dll");
-                                        fixup.module_handle = ::LoadLibraryW(d2.c_str());
-                                    }
-                                    if (fixup.module_handle)
-                                    {
+    // just try to find it elsewhere as it isn't at the root
+    for (auto& name : { suffixedName, dll.filename() })
+    {
+        auto found = FindPackageFile(name);
+        if (found.empty())
+        {
+            continue;
+        }
+
+        if (auto module = tryLoad(std::move(found)))
+        {
 #if _DEBUG
-                                        Log("\tfixup found at . %ls", dentry.path().c_str());
-#endif                            
-                                        path = dentry.path();
-                                        break;
-                                    }
-                                }
-                            }
-                            catch (...)
-                            {
-                                Log("Non-fatal error enumerating directories while looking for fixup.");
-                            }
-                        }
-                    }
-
-
-                    if (!fixup.module_handle)
+            Log("\tfixup found at . %ls", path.c_str());
+#endif
+            return module;
+        }
+    }
+
+    ::SetLastError(error);
+    return nullptr;
+}
+
+struct fixup_entry_points
+{
+    PSFInitializeProc initialize;
+    PSFUninitializeProc uninitialize;
+    const psf::json_object* config;
+};
+
+// Set when the current executable's config asks for all of its fixups to be initialized within a single transaction
+static bool batched_fixups = false;
+
+// Loads the fixup into 'fixup' and, if the fixup exports it, calls PSFPreInitialize. Only touches 'fixup', so that
+// different fixups may be loaded concurrently
+static fixup_entry_points load_fixup_module(const psf::json_object& fixupConfig, loaded_fixup& fixup, psf::startup_fixup_timings& timings)
+{
+    using namespace std::literals;
+
+    timings.dll = fixupConfig.get("dll").as_string().wide();
+    timings.load.start = startup_timestamp();
+    std::filesystem::path path;
+    fixup.module_handle = load_fixup(timings.dll, path);
+    if (!fixup.module_handle)
+    {
+        auto message = narrow(path.c_str());
+        throw_last_error(message.c_str());
+    }
+    Log("\tInject into current process: %ls\n", path.c_str());
+    TrackModuleAllocations(fixup.module_handle);
+
+    auto initialize = reinterpret_cast<PSFInitializeProc>(::GetProcAddress(fixup.module_handle, "PSFInitialize"));
+    if (!initialize)
+    {
+        auto message = "PSFInitialize export not found in "s + narrow(path.c_str());
+        throw_win32(ERROR_PROC_NOT_FOUND, message.c_str());
+    }
+    auto uninitialize = reinterpret_cast<PSFUninitializeProc>(::GetProcAddress(fixup.module_handle, "PSFUninitialize"));
+    if (!uninitialize)
+    {
+        auto message = "PSFUninitialize export not found in "s + narrow(path.c_str());
+        throw_win32(ERROR_PROC_NOT_FOUND, message.c_str());
+    }
+
+    fixup.flush = reinterpret_cast<PSFFlushProc>(::GetProcAddress(fixup.module_handle, "PSFFlush"));
+    timings.load.end = startup_timestamp();
+
+    // Optional; lets the fixup do whatever work it can - e.g. reading its configuration - before any detours are
+    // attached, and outside of the transaction
+    if (auto preInitialize = reinterpret_cast<PSFPreInitializeProc>(::GetProcAddress(fixup.module_handle, "PSFPreInitialize")))
+    {
+        startup_phase_timer timer(timings.pre_initialize);
+        check_win32(preInitialize());
+    }
+
+    return { initialize, uninitialize, &fixupConfig };
+}
+
+// Calls PSFInitialize for 'entryPoints', which belong to the fixups starting at loaded_fixups[first], all within one
+// transaction
+static void initialize_fixups(std::size_t first, const std::vector<fixup_entry_points>& entryPoints)
+{
+    auto transaction = detours::transaction();
+    check_win32(::DetourUpdateThread(::GetCurrentThread()));
+
+    for (std::size_t i = 0; i < entryPoints.size(); ++i)
+    {
+        startup_phase_timer timer(FixupTimings(first + i).initialize);
+        BeginImportHooks(*entryPoints[i].config);
+        auto result = entryPoints[i].initialize();
+        EndImportHooks();
+        check_win32(result);
+    }
+
+    psf::startup_phase commit;
+    {
+        startup_phase_timer timer(commit);
+        transaction.commit();
+    }
+
+    // Only set the uninitialize pointers if the transaction commits successfully since that's our cue to clean them up,
+    // which will attempt to call DetourDetach
+    for (std::size_t i = 0; i < entryPoints.size(); ++i)
+    {
+        loaded_fixups[first + i].uninitialize = entryPoints[i].uninitialize;
+        FixupTimings(first + i).commit = commit;
+    }
+}
+
+void load_fixups()
+{
+    if (auto config = PSFQueryCurrentExeConfig())
+    {
+        if (auto fixups = config->try_get("fixups"))
+        {
+            auto option = [&](const char* name)
+            {
+                auto value = config->try_get(name);
+                return value && value->as_boolean().get();
+            };
+            batched_fixups = option("batchFixupInitialization");
+            auto parallel = option("parallelFixupLoading");
+
+            auto& fixupList = fixups->as_array();
+            auto first = loaded_fixups.size();
+            ReserveFixupTimings(first + fixupList.size());
+            std::vector<fixup_entry_points> entryPoints;
+            if (parallel)
+            {
+                // Loading and pre-initializing one fixup doesn't depend on any other, so all of them are done at once.
+                // The slots are all created up front so that the vector doesn't move while the loads write to it
+                loaded_fixups.resize(first + fixupList.size());
+                std::vector<std::future<fixup_entry_points>> loads;
+                for (unsigned i = 0; i < fixupList.size(); ++i)
+                {
+                    loads.push_back(std::async(std::launch::async, [&, i]
                     {
-                        auto message = narrow(path.c_str());
-                        throw_last_error(message.c_str());
-                    }
+                        return load_fixup_module(fixupList.get_at(i).as_object(), loaded_fixups[first + i], FixupTimings(first + i));
+                    }));
                 }
-                Log("\tInject into current process: %ls\n", path.c_str());
 
-                auto initialize = reinterpret_cast<PSFInitializeProc>(::GetProcAddress(fixup.module_handle, "PSFInitialize"));
-                if (!initialize)
+                for (auto& load : loads)
                 {
-                    auto message = "PSFInitialize export not found in "s + narrow(path.c_str());
-                    throw_win32(ERROR_PROC_NOT_FOUND, message.c_str());
+                    entryPoints.push_back(load.get());
                 }
-                auto uninitialize = reinterpret_cast<PSFUninitializeProc>(::GetProcAddress(fixup.module_handle, "PSFUninitialize"));
-                if (!uninitialize)
+            }
+
+            for (unsigned i = 0; i < fixupList.size(); ++i)
+            {
+                if (!parallel)
                 {
-                    auto message = "PSFUninitialize export not found in "s + narrow(path.c_str());
-                    throw_win32(ERROR_PROC_NOT_FOUND, message.c_str());
+                    auto& fixupConfig = fixupList.get_at(i).as_object();
+                    entryPoints.push_back(load_fixup_module(fixupConfig, loaded_fixups.emplace_back(), FixupTimings(first + i)));
                 }
 
-                auto transaction = detours::transaction();
-                check_win32(::DetourUpdateThread(::GetCurrentThread()));
+                if (!batched_fixups)
+                {
+                    // Each fixup's detours are committed in order and, unless loading in parallel, before the next
+                    // fixup is even loaded
+                    initialize_fixups(first + i, { entryPoints[i] });
+                }
+            }
 
-                // Only set the uninitialize pointer if the transaction commits successfully since that's our cue to clean
-                // it up, which will attempt to call DetourDetach
-                check_win32(initialize());
-                transaction.commit();
-                fixup.uninitialize = uninitialize;
+            if (batched_fixups)
+            {
+                // Everything is loaded first, so that the threads are only suspended once for all of the fixups
+                initialize_fixups(first, entryPoints);
             }
         }
     }
 }
 
+static void uninitialize_fixup(const loaded_fixup& fixup)
+{
+    if (fixup.uninitialize)
+    {
+        [[maybe_unused]] auto result = fixup.uninitialize();
+        assert(result == ERROR_SUCCESS);
+    }
+}
+
 void unload_fixups()
 {
-    while (!loaded_fixups.empty())
+    // Submitted work runs the fixups' code, so none of it may be left once they're freed
+    ShutdownWorkScheduler();
+
+    if (batched_fixups)
     {
         auto transaction = detours::transaction();
         check_win32(::DetourUpdateThread(::GetCurrentThread()));
 
-        if (loaded_fixups.back().uninitialize)
+        std::for_each(loaded_fixups.rbegin(), loaded_fixups.rend(), uninitialize_fixup);
+
+        // The dlls can only be freed once their detours are gone
+        transaction.commit();
+        while (!loaded_fixups.empty())
         {
-            [[maybe_unused]] auto result = loaded_fixups.back().uninitialize();
-            assert(result == ERROR_SUCCESS);
+            loaded_fixups.pop_back();
         }
+        return;
+    }
+
+    while (!loaded_fixups.empty())
+    {
+        auto transaction = detours::transaction();
+        check_win32(::DetourUpdateThread(::GetCurrentThread()));
+
+        uninitialize_fixup(loaded_fixups.back());
 
         transaction.commit();
         loaded_fixups.pop_back();
     }
 }
 
+// When the process exits, its other threads are already gone and the address space is about to be, which leaves nothing
+// worth detaching or freeing. Fixups that can flush are only asked to do so, and those that can't are still uninitialized
+// in their own transaction, but no dll is freed
+static void flush_fixups()
+{
+    std::for_each(loaded_fixups.rbegin(), loaded_fixups.rend(), [](loaded_fixup& fixup)
+    {
+        if (fixup.uninitialize && fixup.flush)
+        {
+            [[maybe_unused]] auto result = fixup.flush();
+            assert(result == ERROR_SUCCESS);
+        }
+        else if (fixup.uninitialize)
+        {
+            auto transaction = detours::transaction();
+            check_win32(::DetourUpdateThread(::GetCurrentThread()));
+            uninitialize_fixup(fixup);
+            transaction.commit();
+        }
+
+        fixup.module_handle = nullptr;
+    });
+}
+
+static DWORD g_ReentrancySlot = TLS_OUT_OF_INDEXES;
+
+static void allocate_reentrancy_slot() noexcept
+{
+    // Only the first TLS_MINIMUM_AVAILABLE slots are in the TEB itself, which is where the guards read theirs from. Since
+    // slots are handed out in order, PsfRuntime being loaded early makes it unlikely to get a later one
+    g_ReentrancySlot = ::TlsAlloc();
+    if ((g_ReentrancySlot != TLS_OUT_OF_INDEXES) && (g_ReentrancySlot >= TLS_MINIMUM_AVAILABLE))
+    {
+        ::TlsFree(g_ReentrancySlot);
+        g_ReentrancySlot = TLS_OUT_OF_INDEXES;
+    }
+}
+
+PSFAPI DWORD __stdcall PSFQueryReentrancySlot() noexcept
+{
+    return g_ReentrancySlot;
+}
+
 using EntryPoint_t = int(__stdcall*)();
 EntryPoint_t ApplicationEntryPoint = nullptr;
 static int __stdcall FixupEntryPoint() noexcept try
 {
-    load_fixups();
+    {
+        startup_phase_timer timer(StartupTimings().fixups);
+        load_fixups();
+    }
+    ReportStartupTimings();
     return ApplicationEntryPoint();
 }
 catch (...)
@@ -174,13 +385,39 @@ catch (...)
 
 void attach()
 {
+    allocate_reentrancy_slot();
+    ReadLauncherTimestamps();
     LoadConfig();
 #if _DEBUG
     Log("PsfRuntime after load config");
 #endif
+    if (auto config = PSFQueryCurrentExeConfig())
+    {
+        // Before any detours are attached, including the PSF Runtime's own, since allocations are attributed to them
+        auto tracking = config->try_get("allocationTracking");
+        if (tracking && tracking->as_boolean().get())
+        {
+            EnableAllocationTracking();
+        }
+
+        // Also before any detours are attached, since only those attached afterwards are accounted for
+        auto accounting = config->try_get("cpuAccounting");
+        if (accounting && accounting->as_boolean().get())
+        {
+            EnableCpuAccounting();
+        }
+
+        auto metrics = config->try_get("metrics");
+        if (metrics && metrics->as_boolean().get())
+        {
+            InitializeMetrics();
+        }
+    }
+
     // Restore the contents of the in memory import table that DetourCreateProcessWithDll* modified
     ::DetourRestoreAfterWith();
 
+    startup_phase_timer timer(StartupTimings().runtime_attach);
     auto transaction = detours::transaction();
     check_win32(::DetourUpdateThread(::GetCurrentThread()));
 
@@ -206,8 +443,19 @@ void attach()
 #endif
 }
 
-void detach()
+void detach(bool processExiting)
 {
+    // While the fixups are still loaded, so that their functions can be named
+    ReportAllocationStatistics();
+    ReportCpuAccounting();
+
+    if (processExiting)
+    {
+        // The PSF Runtime's own detours, and its TLS slot, go away with the process
+        flush_fixups();
+        return;
+    }
+
     // Unload in the reverse order as we initialized
     unload_fixups();
 
@@ -215,9 +463,14 @@ void detach()
     check_win32(::DetourUpdateThread(::GetCurrentThread()));
     psf::detach_all();
     transaction.commit();
+
+    if (g_ReentrancySlot != TLS_OUT_OF_INDEXES)
+    {
+        ::TlsFree(g_ReentrancySlot);
+    }
 }
 
-BOOL APIENTRY DllMain(HMODULE, DWORD reason, LPVOID) noexcept try
+BOOL APIENTRY DllMain(HMODULE, DWORD reason, LPVOID reserved) noexcept try
 {
     // Per detours documentation, immediately return true if running in a helper process
     if (::DetourIsHelperProcess())
@@ -239,8 +492,13 @@ BOOL APIENTRY DllMain(HMODULE, DWORD reason, LPVOID) noexcept try
         }
         break;
 
+    case DLL_THREAD_DETACH:
+        RetireCpuAccountingThread();
+        break;
+
     case DLL_PROCESS_DETACH:
-        detach();
+        // NOTE: 'reserved' is only non-null when the process is exiting, as opposed to PsfRuntime being unloaded
+        detach(reserved != nullptr);
         break;
     }
 
@@ -57,10 +57,22 @@ namespace PsfMonitor
         public const string ProgramTitle = "PSFMonitor";
         public const string UnexpectedErrorPrompt = "An unexpected error had occurred. Click Cancel to close program";
 
+        // Set by PsfLauncher, which holds off launching the application until we signal it, so that none of its events
+        // are missed
+        private string ReadyEventName = null;
+
         public MainWindow()
         {
             InitializeComponent();
 
+            foreach (string arg in Environment.GetCommandLineArgs())
+            {
+                if (arg.StartsWith("/readyEvent:", StringComparison.OrdinalIgnoreCase))
+                {
+                    ReadyEventName = arg.Substring("/readyEvent:".Length);
+                }
+            }
+
             // This is done to enable ETW Kernel Debugging
             EventsGrid.ItemsSource = FilteredEventItems;
 
@@ -251,9 +263,30 @@ namespace PsfMonitor
                     myTraceEventSession.DisableProvider(etwp.guid);
                     EventTraceProviderEnablementResultCode = myTraceEventSession.EnableProvider(etwp.guid);
                 }
+                SignalReady();
                 EventTraceProviderSourceResultCode = myTraceEventSession.Source.Process();
             }
         } // Eventbgw_DoWork()
+
+        private void SignalReady()
+        {
+            if (ReadyEventName == null)
+            {
+                return;
+            }
+
+            try
+            {
+                using (EventWaitHandle readyEvent = EventWaitHandle.OpenExisting(ReadyEventName))
+                {
+                    readyEvent.Set();
+                }
+            }
+            catch
+            {
+                // The launcher only waits for a while, and may have given up and gone away already
+            }
+        } // SignalReady()
         private void AddToProcIDsList(int pid)
         {
             foreach (int match in ProcIDsOfTarget)
@@ -0,0 +1,1769 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <deque>
+#include <filesystem>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <windows.h>
+#include <dbghelp.h>
+#include <evntcons.h>
+#include <evntrace.h>
+
+#include <lz4_block.h>
+#include <utilities.h>
+
+#pragma comment(lib, "dbghelp.lib")
+
+using namespace std::literals;
+
+// The provider that the PSF Runtime and the fixups write their events with. Must be kept in sync with TraceFixup's main.cpp
+// {f7f4e8c4-9981-5221-e6fb-ff9dd1cda4e1}
+static constexpr GUID psf_provider_id = { 0xf7f4e8c4, 0x9981, 0x5221, { 0xe6, 0xfb, 0xff, 0x9d, 0xd1, 0xcd, 0xa4, 0xe1 } };
+
+// The keywords of TraceFixup's "ApiCall" events, which are its function_type values as bits. Events without a keyword,
+// such as the "TraceEvent" messages, are received whatever the keywords are
+static constexpr std::pair<std::wstring_view, std::uint64_t> keyword_names[] =
+{
+    { L"filesystem"sv, 0x1 },
+    { L"registry"sv, 0x2 },
+    { L"processAndThread"sv, 0x4 },
+    { L"dynamicLinkLibrary"sv, 0x8 },
+};
+
+namespace
+{
+    // The file format of TraceFixup's 'binary' trace method; see TraceRing.h in TraceFixup. Captures add a record kind
+    // of their own, since they hold the events of many processes
+#pragma pack(push, 1)
+    struct file_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t reserved;
+        std::int64_t frequency;
+    };
+
+    struct record_header
+    {
+        std::int64_t timestamp;
+        std::uint32_t thread_id;
+        std::uint16_t kind;
+        std::uint16_t reserved;
+        std::uint32_t length;
+    };
+
+    struct call_record
+    {
+        std::uint16_t function_id;
+        std::uint8_t result;
+        std::uint8_t flags;
+        std::uint32_t error;
+        std::int64_t ticks;
+        std::uint16_t arg_count;
+        std::uint16_t string_bytes;
+    };
+
+    // The file format of TraceFixup's 'traceFileSizeLimit' option, a ring of LZ4 compressed blocks of the same records;
+    // see TraceBlocks.h in TraceFixup
+    struct block_file_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t block_size;
+        std::uint32_t block_count;
+        std::uint32_t names_capacity;
+        std::int64_t frequency;
+        std::uint64_t data_offset;
+        std::uint32_t names_length;
+        std::uint32_t reserved;
+    };
+
+    struct block_index_entry
+    {
+        std::uint64_t sequence;
+        std::int64_t first_timestamp;
+        std::int64_t last_timestamp;
+        std::uint64_t thread_mask;
+        std::uint32_t stored_size;
+        std::uint32_t uncompressed_size;
+        std::uint32_t record_count;
+        std::uint32_t reserved;
+    };
+
+    struct chunk_header
+    {
+        std::uint32_t stored_size;
+        std::uint32_t uncompressed_size;
+    };
+#pragma pack(pop)
+
+    constexpr std::uint32_t chunk_stored_uncompressed = 0x80000000;
+    constexpr std::uint32_t max_block_size = 64 * 1024 * 1024;
+
+    constexpr std::uint16_t text_record = 0;
+    constexpr std::uint16_t function_record = 1;
+    constexpr std::uint16_t call_record_kind = 2;
+    constexpr std::uint16_t thread_record = 3;
+    constexpr std::uint8_t wide_string_flag = 1;
+
+    // TraceFixup's function_result
+    constexpr const wchar_t* result_names[] = { L"Success", L"Indeterminate", L"Expected", L"Failure" };
+    constexpr std::uint8_t expected_failure_result = 2;
+
+    template <typename T>
+    bool read_from(std::string_view data, std::size_t& offset, T& value)
+    {
+        if (data.size() - offset < sizeof(T))
+        {
+            return false;
+        }
+
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+}
+
+// Writes records in the same format as TraceFixup's 'binary' trace method. Records are buffered a megabyte at a time, so
+// that writing keeps up with the rate that ETW delivers events at
+class trace_writer
+{
+public:
+    trace_writer() = default;
+    trace_writer(const trace_writer&) = delete;
+    trace_writer& operator=(const trace_writer&) = delete;
+
+    ~trace_writer()
+    {
+        close();
+    }
+
+    bool open(const std::filesystem::path& path, std::int64_t frequency)
+    {
+#pragma warning(suppress:4996) // Nonsense warning; _wfopen is perfectly safe
+        m_file = _wfopen(path.c_str(), L"wb");
+        if (!m_file)
+        {
+            m_succeeded = false;
+            return false;
+        }
+
+        std::setvbuf(m_file, nullptr, _IOFBF, 1024 * 1024);
+        file_header header{ { 'P', 'S', 'F', 'T', 'R', 'A', 'C', 'E' }, 1, 0, frequency };
+        write(&header, sizeof(header));
+        return m_succeeded;
+    }
+
+    void write_record(std::int64_t timestamp, std::uint32_t threadId, std::uint16_t kind, std::initializer_list<std::string_view> parts)
+    {
+        std::size_t length = 0;
+        for (auto& part : parts)
+        {
+            length += part.length();
+        }
+
+        record_header header{ timestamp, threadId, kind, 0, static_cast<std::uint32_t>(length) };
+        write(&header, sizeof(header));
+        for (auto& part : parts)
+        {
+            write(part.data(), part.length());
+        }
+    }
+
+    // Returns false if anything could not be written
+    bool close()
+    {
+        if (m_file)
+        {
+            m_succeeded = (std::fclose(m_file) == 0) && m_succeeded;
+            m_file = nullptr;
+        }
+
+        return m_succeeded;
+    }
+
+private:
+    void write(const void* data, std::size_t length)
+    {
+        if (!m_file || (length && (std::fwrite(data, 1, length, m_file) != length)))
+        {
+            m_succeeded = false;
+        }
+    }
+
+    FILE* m_file = nullptr;
+    bool m_succeeded = true;
+};
+
+template <typename T>
+static std::string_view as_bytes(const T& value)
+{
+    return std::string_view(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Limits what read_trace reads. Block traces are only read as far as their index says that the blocks can hold matching
+// records, while other traces are read whole; either way, the handler still checks each record against 'from' and
+// 'thread_id', since the blocks also hold records that don't match
+struct trace_range
+{
+    double last_seconds = 0; // Only the final seconds of the trace, if non-zero
+    std::uint32_t thread_id = 0; // Only the records of the thread, if non-zero
+
+    // The earliest timestamp of the final 'last_seconds', which read_trace sets before it calls the handler
+    std::int64_t from = 0;
+};
+
+template <typename Handler>
+static void read_records(std::string_view data, Handler& handler)
+{
+    record_header record;
+    while (data.size() >= sizeof(record))
+    {
+        std::memcpy(&record, data.data(), sizeof(record));
+        data.remove_prefix(sizeof(record));
+        if (record.length > data.size())
+        {
+            break;
+        }
+
+        handler(record, data.substr(0, record.length));
+        data.remove_prefix(record.length);
+    }
+}
+
+// TraceFixup's 'traceFileSizeLimit' traces: the function records come first, and then the blocks, in the order that they
+// were written
+template <typename Handler>
+static int read_block_trace(FILE* file, const std::filesystem::path& path, std::int64_t& frequency, trace_range& range, Handler& handler)
+{
+    block_file_header header;
+    if ((_fseeki64(file, 0, SEEK_SET) != 0) ||
+        (std::fread(&header, sizeof(header), 1, file) != 1) ||
+        (header.version != 1) ||
+        (header.frequency <= 0) ||
+        (header.block_count == 0) ||
+        (header.block_size == 0) || (header.block_size > max_block_size) ||
+        (header.names_length > header.names_capacity))
+    {
+        std::fwprintf(stderr, L"ERROR: %ls is not a binary PSF trace\n", path.c_str());
+        return ERROR_BAD_FORMAT;
+    }
+    frequency = header.frequency;
+
+    std::vector<block_index_entry> index(header.block_count);
+    std::string names(header.names_length, '\0');
+    if ((std::fread(index.data(), sizeof(block_index_entry), index.size(), file) != index.size()) ||
+        (!names.empty() && (std::fread(names.data(), names.size(), 1, file) != 1)))
+    {
+        std::fwprintf(stderr, L"ERROR: %ls is not a binary PSF trace\n", path.c_str());
+        return ERROR_BAD_FORMAT;
+    }
+
+    // The slot of a block is its position in the index
+    std::vector<std::uint32_t> slots;
+    std::int64_t end = 0;
+    for (std::uint32_t slot = 0; slot < header.block_count; ++slot)
+    {
+        if (index[slot].sequence != 0)
+        {
+            slots.push_back(slot);
+            end = std::max(end, index[slot].last_timestamp);
+        }
+    }
+    std::sort(slots.begin(), slots.end(), [&](std::uint32_t lhs, std::uint32_t rhs) { return index[lhs].sequence < index[rhs].sequence; });
+
+    if (range.last_seconds > 0)
+    {
+        range.from = end - static_cast<std::int64_t>(range.last_seconds * static_cast<double>(header.frequency));
+    }
+    auto threadBit = std::uint64_t{ 1 } << ((range.thread_id / 4) % 64);
+
+    read_records(names, handler);
+
+    std::string block;
+    std::string chunk;
+    unsigned long long unreadable = 0;
+    for (auto slot : slots)
+    {
+        auto& entry = index[slot];
+        if ((range.from && (entry.last_timestamp < range.from)) ||
+            (range.thread_id && !(entry.thread_mask & threadBit)))
+        {
+            continue;
+        }
+
+        block.resize(entry.stored_size);
+        if ((entry.stored_size > header.block_size) ||
+            (_fseeki64(file, static_cast<long long>(header.data_offset + std::uint64_t{ slot } * header.block_size), SEEK_SET) != 0) ||
+            (!block.empty() && (std::fread(block.data(), block.size(), 1, file) != 1)))
+        {
+            ++unreadable;
+            continue;
+        }
+
+        std::string_view chunks = block;
+        while (chunks.size() >= sizeof(chunk_header))
+        {
+            chunk_header chunkHeader;
+            std::memcpy(&chunkHeader, chunks.data(), sizeof(chunkHeader));
+            chunks.remove_prefix(sizeof(chunkHeader));
+
+            bool raw = (chunkHeader.stored_size & chunk_stored_uncompressed) != 0;
+            auto storedSize = chunkHeader.stored_size & ~chunk_stored_uncompressed;
+            chunk.resize(chunkHeader.uncompressed_size);
+            if ((storedSize > chunks.size()) || (chunkHeader.uncompressed_size > header.block_size) ||
+                (raw ? (storedSize != chunkHeader.uncompressed_size) : !psf::lz4_decompress(chunks.data(), storedSize, chunk.data(), chunk.size())))
+            {
+                // Most likely overwritten while the trace was being read
+                ++unreadable;
+                break;
+            }
+
+            read_records(raw ? chunks.substr(0, storedSize) : std::string_view(chunk), handler);
+            chunks.remove_prefix(storedSize);
+        }
+    }
+
+    if (unreadable)
+    {
+        std::fwprintf(stderr, L"WARNING: %llu blocks of %ls could not be read\n", unreadable, path.c_str());
+    }
+    return ERROR_SUCCESS;
+}
+
+// Calls 'handler' with the header and payload of each record of a trace, which may have been written by TraceFixup or by
+// the capture command
+template <typename Handler>
+static int read_trace(const std::filesystem::path& path, std::int64_t& frequency, Handler&& handler, trace_range* range = nullptr)
+{
+    trace_range everything;
+    auto& limits = range ? *range : everything;
+
+#pragma warning(suppress:4996) // Nonsense warning; _wfopen is perfectly safe
+    auto file = _wfopen(path.c_str(), L"rb");
+    if (!file)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not open %ls\n", path.c_str());
+        return ERROR_FILE_NOT_FOUND;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+
+    file_header header;
+    if ((std::fread(&header, sizeof(header), 1, file) == 1) &&
+        (std::memcmp(header.magic, "PSFTRBLK", sizeof(header.magic)) == 0))
+    {
+        auto err = read_block_trace(file, path, frequency, limits, handler);
+        std::fclose(file);
+        return err;
+    }
+
+    if ((std::memcmp(header.magic, "PSFTRACE", sizeof(header.magic)) != 0) ||
+        (header.version != 1) ||
+        (header.frequency <= 0))
+    {
+        std::fclose(file);
+        std::fwprintf(stderr, L"ERROR: %ls is not a binary PSF trace\n", path.c_str());
+        return ERROR_BAD_FORMAT;
+    }
+    frequency = header.frequency;
+
+    record_header record;
+    if (limits.last_seconds > 0)
+    {
+        // The end of the trace is only known once it's been read; the headers alone are enough to find it
+        std::int64_t end = 0;
+        while ((std::fread(&record, sizeof(record), 1, file) == 1) && (_fseeki64(file, record.length, SEEK_CUR) == 0))
+        {
+            end = std::max(end, record.timestamp);
+        }
+        limits.from = end - static_cast<std::int64_t>(limits.last_seconds * static_cast<double>(frequency));
+        _fseeki64(file, sizeof(header), SEEK_SET);
+    }
+
+    std::string payload;
+    while (std::fread(&record, sizeof(record), 1, file) == 1)
+    {
+        payload.resize(record.length);
+        if (record.length && (std::fread(payload.data(), record.length, 1, file) != 1))
+        {
+            // The process was killed while the file was being written; everything before is still good
+            std::fwprintf(stderr, L"WARNING: %ls ends with an incomplete record\n", path.c_str());
+            break;
+        }
+
+        handler(record, std::string_view(payload));
+    }
+
+    std::fclose(file);
+    return ERROR_SUCCESS;
+}
+
+// TraceLogging events describe themselves: each carries the metadata of its event - the name, and the name and type of
+// each of its fields - in an extended data item, which is all that's needed to find the values in its payload. See
+// TraceLoggingProvider.h for the encoding
+namespace tl
+{
+    constexpr std::uint8_t type_mask = 0x1f;
+    constexpr std::uint8_t count_mask = 0x60;
+    constexpr std::uint8_t constant_count = 0x20;
+    constexpr std::uint8_t variable_count = 0x40;
+    constexpr std::uint8_t custom = 0x60;
+    constexpr std::uint8_t chain = 0x80;
+
+    enum type : std::uint8_t
+    {
+        null,
+        unicode_string,
+        ansi_string,
+        int8,
+        uint8,
+        int16,
+        uint16,
+        int32,
+        uint32,
+        int64,
+        uint64,
+        float32,
+        float64,
+        bool32,
+        binary,
+        guid,
+        pointer_unsupported,
+        filetime,
+        systemtime,
+        sid,
+        hex_int32,
+        hex_int64,
+        counted_string,
+        counted_ansi_string,
+        structure,
+    };
+
+    struct field
+    {
+        std::string_view name;
+        std::uint8_t type;
+        std::uint8_t count;
+        std::uint16_t constant_count;
+    };
+
+    // Reads a null terminated string at 'offset', leaving 'offset' past the terminator
+    inline bool read_string(std::string_view data, std::size_t& offset, std::string_view& result)
+    {
+        auto end = data.find('\0', offset);
+        if (end == std::string_view::npos)
+        {
+            return false;
+        }
+
+        result = data.substr(offset, end - offset);
+        offset = end + 1;
+        return true;
+    }
+
+    inline void skip_chain(std::string_view data, std::size_t& offset)
+    {
+        while ((offset < data.size()) && (static_cast<std::uint8_t>(data[offset++]) & chain))
+        {
+        }
+    }
+
+    // The size of the value of 'type' at the start of 'data'. False if the type isn't supported, or the value doesn't fit
+    inline bool value_size(std::uint8_t valueType, std::string_view data, std::size_t& size)
+    {
+        switch (valueType)
+        {
+        case null:
+        case structure:
+            // The members of a structure follow it as fields of their own
+            size = 0;
+            return true;
+
+        case unicode_string:
+            for (size = 0; size + sizeof(wchar_t) <= data.size(); size += sizeof(wchar_t))
+            {
+                if ((data[size] == '\0') && (data[size + 1] == '\0'))
+                {
+                    size += sizeof(wchar_t);
+                    return true;
+                }
+            }
+            return false;
+
+        case ansi_string:
+            size = data.find('\0');
+            if (size == std::string_view::npos)
+            {
+                return false;
+            }
+            ++size;
+            return true;
+
+        case int8:
+        case uint8:
+            size = 1;
+            break;
+
+        case int16:
+        case uint16:
+            size = 2;
+            break;
+
+        case int32:
+        case uint32:
+        case float32:
+        case bool32:
+        case hex_int32:
+            size = 4;
+            break;
+
+        case int64:
+        case uint64:
+        case float64:
+        case filetime:
+        case hex_int64:
+            size = 8;
+            break;
+
+        case guid:
+        case systemtime:
+            size = 16;
+            break;
+
+        case sid:
+            // Revision, sub authority count, identifier authority, and then the sub authorities
+            if (data.size() < 2)
+            {
+                return false;
+            }
+            size = 8 + 4 * static_cast<std::size_t>(static_cast<std::uint8_t>(data[1]));
+            break;
+
+        case binary:
+        case counted_string:
+        case counted_ansi_string:
+        {
+            std::uint16_t bytes;
+            std::size_t offset = 0;
+            if (!read_from(data, offset, bytes))
+            {
+                return false;
+            }
+            size = sizeof(bytes) + bytes;
+            break;
+        }
+
+        default:
+            return false;
+        }
+
+        return size <= data.size();
+    }
+}
+
+// The schema of an event, parsed once from its metadata for all the events that share it
+struct event_schema
+{
+    std::string metadata;
+    std::string_view name;
+    std::vector<tl::field> fields;
+    bool decodable = true;
+
+    // Positions in 'fields' of the values of TraceFixup's "ApiCall" event, when it is one
+    bool is_api_call = false;
+    std::size_t function_field = 0;
+    std::size_t path_field = 0;
+    std::size_t arguments_field = 0;
+    std::size_t error_field = 0;
+    std::size_t result_field = 0;
+    std::size_t start_field = 0;
+    std::size_t duration_field = 0;
+};
+
+static std::unique_ptr<event_schema> parse_schema(std::string_view metadata)
+{
+    auto result = std::make_unique<event_schema>();
+    result->metadata.assign(metadata.data(), metadata.size());
+    std::string_view data = result->metadata;
+
+    // UINT16 size, then the event's tags
+    std::size_t offset = sizeof(std::uint16_t);
+    tl::skip_chain(data, offset);
+    if (!tl::read_string(data, offset, result->name))
+    {
+        result->decodable = false;
+        return result;
+    }
+
+    while (offset < data.size())
+    {
+        tl::field field{};
+        if (!tl::read_string(data, offset, field.name) || (offset >= data.size()))
+        {
+            result->decodable = false;
+            break;
+        }
+
+        auto inType = static_cast<std::uint8_t>(data[offset++]);
+        field.type = inType & tl::type_mask;
+        field.count = inType & tl::count_mask;
+        if ((inType & tl::chain) && (offset < data.size()))
+        {
+            auto outType = static_cast<std::uint8_t>(data[offset++]);
+            if (outType & tl::chain)
+            {
+                tl::skip_chain(data, offset);
+            }
+        }
+
+        if (field.count == tl::constant_count)
+        {
+            if (!read_from(data, offset, field.constant_count))
+            {
+                result->decodable = false;
+                break;
+            }
+        }
+        else if (field.count == tl::custom)
+        {
+            std::uint16_t schemaSize = 0;
+            read_from(data, offset, schemaSize);
+            offset += schemaSize;
+            result->decodable = false;
+        }
+
+        if ((field.type == tl::structure) && field.count)
+        {
+            // Arrays of structures aren't used by any of PSF's events
+            result->decodable = false;
+        }
+        result->fields.push_back(field);
+    }
+
+    if (result->decodable && (result->name == "ApiCall"sv))
+    {
+        auto find = [&](std::string_view name, std::uint8_t type, std::uint8_t count, std::size_t& index)
+        {
+            for (index = 0; index < result->fields.size(); ++index)
+            {
+                auto& field = result->fields[index];
+                if (field.name == name)
+                {
+                    return (field.type == type) && (field.count == count);
+                }
+            }
+            return false;
+        };
+
+        result->is_api_call =
+            find("Function"sv, tl::ansi_string, 0, result->function_field) &&
+            find("Path"sv, tl::counted_string, 0, result->path_field) &&
+            find("Arguments"sv, tl::uint64, tl::variable_count, result->arguments_field) &&
+            find("Error"sv, tl::hex_int32, 0, result->error_field) &&
+            find("Result"sv, tl::uint8, 0, result->result_field) &&
+            find("Start"sv, tl::int64, 0, result->start_field) &&
+            find("Duration"sv, tl::int64, 0, result->duration_field);
+    }
+
+    return result;
+}
+
+// Finds where the value of each field of 'schema' is in 'payload'. Arrays of variable length include their count
+static bool split_values(const event_schema& schema, std::string_view payload, std::vector<std::string_view>& values)
+{
+    values.clear();
+    std::size_t offset = 0;
+    for (auto& field : schema.fields)
+    {
+        auto data = payload.substr(offset);
+        std::size_t size = 0;
+        if (field.count)
+        {
+            std::uint16_t count = field.constant_count;
+            if ((field.count == tl::variable_count) && !read_from(data, size, count))
+            {
+                return false;
+            }
+
+            for (std::uint16_t i = 0; i < count; ++i)
+            {
+                std::size_t elementSize;
+                if (!tl::value_size(field.type, data.substr(size), elementSize))
+                {
+                    return false;
+                }
+                size += elementSize;
+            }
+        }
+        else if (!tl::value_size(field.type, data, size))
+        {
+            return false;
+        }
+
+        values.push_back(data.substr(0, size));
+        offset += size;
+    }
+
+    return true;
+}
+
+template <typename T>
+static T value_as(std::string_view value)
+{
+    T result{};
+    std::memcpy(&result, value.data(), std::min(value.size(), sizeof(result)));
+    return result;
+}
+
+static void append_value(std::string& text, std::uint8_t type, std::string_view value)
+{
+    char buffer[64];
+    switch (type)
+    {
+    case tl::unicode_string:
+        text += narrow(std::wstring_view(reinterpret_cast<const wchar_t*>(value.data()), value.size() / sizeof(wchar_t) - 1));
+        return;
+
+    case tl::ansi_string:
+        text.append(value.data(), value.size() - 1);
+        return;
+
+    case tl::counted_string:
+        text += narrow(std::wstring_view(reinterpret_cast<const wchar_t*>(value.data() + 2), (value.size() - 2) / sizeof(wchar_t)));
+        return;
+
+    case tl::counted_ansi_string:
+        text.append(value.data() + 2, value.size() - 2);
+        return;
+
+    case tl::int8:
+        std::snprintf(buffer, std::size(buffer), "%d", static_cast<int>(value_as<std::int8_t>(value)));
+        break;
+
+    case tl::uint8:
+        std::snprintf(buffer, std::size(buffer), "%u", static_cast<unsigned>(value_as<std::uint8_t>(value)));
+        break;
+
+    case tl::int16:
+        std::snprintf(buffer, std::size(buffer), "%d", static_cast<int>(value_as<std::int16_t>(value)));
+        break;
+
+    case tl::uint16:
+        std::snprintf(buffer, std::size(buffer), "%u", static_cast<unsigned>(value_as<std::uint16_t>(value)));
+        break;
+
+    case tl::int32:
+        std::snprintf(buffer, std::size(buffer), "%d", value_as<std::int32_t>(value));
+        break;
+
+    case tl::uint32:
+        std::snprintf(buffer, std::size(buffer), "%u", value_as<std::uint32_t>(value));
+        break;
+
+    case tl::bool32:
+        std::snprintf(buffer, std::size(buffer), "%s", value_as<std::int32_t>(value) ? "true" : "false");
+        break;
+
+    case tl::hex_int32:
+        std::snprintf(buffer, std::size(buffer), "0x%08X", value_as<std::uint32_t>(value));
+        break;
+
+    case tl::int64:
+        std::snprintf(buffer, std::size(buffer), "%lld", value_as<long long>(value));
+        break;
+
+    case tl::uint64:
+    case tl::filetime:
+        std::snprintf(buffer, std::size(buffer), "%llu", value_as<unsigned long long>(value));
+        break;
+
+    case tl::hex_int64:
+        std::snprintf(buffer, std::size(buffer), "0x%016llX", value_as<unsigned long long>(value));
+        break;
+
+    case tl::float32:
+        std::snprintf(buffer, std::size(buffer), "%g", value_as<float>(value));
+        break;
+
+    case tl::float64:
+        std::snprintf(buffer, std::size(buffer), "%g", value_as<double>(value));
+        break;
+
+    default:
+        std::snprintf(buffer, std::size(buffer), "(%zu bytes)", value.size());
+        break;
+    }
+
+    text += buffer;
+}
+
+// The text that a text record holds for an event other than "ApiCall": the message, for the events that are just one, and
+// otherwise the name of the event followed by its fields
+static void format_event(const event_schema& schema, const std::vector<std::string_view>& values, std::string& text)
+{
+    text.clear();
+    auto isString = [](std::uint8_t type)
+    {
+        return (type == tl::unicode_string) || (type == tl::ansi_string) ||
+            (type == tl::counted_string) || (type == tl::counted_ansi_string);
+    };
+
+    if ((schema.fields.size() == 1) && !schema.fields[0].count && isString(schema.fields[0].type))
+    {
+        append_value(text, schema.fields[0].type, values[0]);
+        return;
+    }
+
+    text.assign(schema.name.data(), schema.name.size());
+    for (std::size_t i = 0; i < schema.fields.size(); ++i)
+    {
+        auto& field = schema.fields[i];
+        if (field.type == tl::structure)
+        {
+            continue;
+        }
+
+        text += ' ';
+        text.append(field.name.data(), field.name.size());
+        text += '=';
+        if (!field.count)
+        {
+            append_value(text, field.type, values[i]);
+            continue;
+        }
+
+        // Split back into elements the same way that split_values found the end of the array
+        auto data = values[i];
+        std::uint16_t count = field.constant_count;
+        std::size_t offset = 0;
+        if (field.count == tl::variable_count)
+        {
+            read_from(data, offset, count);
+        }
+
+        text += '[';
+        for (std::uint16_t index = 0; index < count; ++index)
+        {
+            std::size_t size = 0;
+            tl::value_size(field.type, data.substr(offset), size);
+            if (index)
+            {
+                text += ", ";
+            }
+            append_value(text, field.type, data.substr(offset, size));
+            offset += size;
+        }
+        text += ']';
+    }
+}
+
+// Turns the events of the real-time session into records. ETW calls back on the one thread that ProcessTrace runs on, so
+// nothing here is synchronized
+class event_collector
+{
+public:
+    explicit event_collector(trace_writer& writer) :
+        m_writer(writer)
+    {
+    }
+
+    void on_event(const EVENT_RECORD& record)
+    {
+        if (!::IsEqualGUID(record.EventHeader.ProviderId, psf_provider_id))
+        {
+            return;
+        }
+        ++m_events;
+
+        std::string_view metadata;
+        for (USHORT i = 0; i < record.ExtendedDataCount; ++i)
+        {
+            auto& item = record.ExtendedData[i];
+            if (item.ExtType == EVENT_HEADER_EXT_TYPE_EVENT_SCHEMA_TL)
+            {
+                metadata = std::string_view(reinterpret_cast<const char*>(static_cast<std::uintptr_t>(item.DataPtr)), item.DataSize);
+            }
+        }
+
+        auto& schema = find_schema(metadata);
+        std::string_view payload(static_cast<const char*>(record.UserData), record.UserDataLength);
+        if (metadata.empty() || !schema.decodable || !split_values(schema, payload, m_values))
+        {
+            ++m_undecodable;
+            return;
+        }
+
+        auto threadId = static_cast<std::uint32_t>(record.EventHeader.ThreadId);
+        auto timestamp = record.EventHeader.TimeStamp.QuadPart;
+        note_thread(timestamp, threadId, static_cast<std::uint32_t>(record.EventHeader.ProcessId));
+
+        if (schema.is_api_call)
+        {
+            write_call(schema, threadId);
+        }
+        else
+        {
+            format_event(schema, m_values, m_text);
+            m_writer.write_record(timestamp, threadId, text_record, { m_text });
+            ++m_texts;
+        }
+    }
+
+    void print_statistics() const
+    {
+        std::wprintf(L"Received %llu events: %llu calls, %llu text records, %llu that could not be decoded\n",
+            m_events, m_calls, m_texts, m_undecodable);
+    }
+
+private:
+    const event_schema& find_schema(std::string_view metadata)
+    {
+        if (auto itr = m_schemas.find(metadata); itr != m_schemas.end())
+        {
+            return *itr->second;
+        }
+
+        auto schema = parse_schema(metadata);
+        std::string_view key = schema->metadata;
+        return *m_schemas.emplace(key, std::move(schema)).first->second;
+    }
+
+    // Threads are mapped to their process the first time they're seen, or whenever the id has been reused
+    void note_thread(std::int64_t timestamp, std::uint32_t threadId, std::uint32_t processId)
+    {
+        auto [itr, inserted] = m_threads.emplace(threadId, processId);
+        if (inserted || (itr->second != processId))
+        {
+            itr->second = processId;
+            m_writer.write_record(timestamp, threadId, thread_record, { as_bytes(processId) });
+        }
+    }
+
+    std::uint16_t function_id(std::int64_t timestamp, std::uint32_t threadId, std::string_view name)
+    {
+        if (auto itr = m_functionIds.find(name); itr != m_functionIds.end())
+        {
+            return itr->second;
+        }
+
+        auto id = static_cast<std::uint16_t>(m_functionNames.size());
+        auto& stored = m_functionNames.emplace_back(name);
+        m_functionIds.emplace(stored, id);
+        m_writer.write_record(timestamp, threadId, function_record, { as_bytes(id), stored });
+        return id;
+    }
+
+    void write_call(const event_schema& schema, std::uint32_t threadId)
+    {
+        auto start = value_as<std::int64_t>(m_values[schema.start_field]);
+        auto function = m_values[schema.function_field];
+        function.remove_suffix(1); // Null terminator
+
+        // Both the path and the arguments are preceded by their UINT16 size, in bytes and in elements respectively
+        auto path = m_values[schema.path_field].substr(sizeof(std::uint16_t));
+        auto args = m_values[schema.arguments_field].substr(sizeof(std::uint16_t));
+
+        call_record call{
+            function_id(start, threadId, function),
+            value_as<std::uint8_t>(m_values[schema.result_field]),
+            wide_string_flag,
+            value_as<std::uint32_t>(m_values[schema.error_field]),
+            value_as<std::int64_t>(m_values[schema.duration_field]),
+            static_cast<std::uint16_t>(args.size() / sizeof(std::uint64_t)),
+            static_cast<std::uint16_t>(path.size()) };
+        m_writer.write_record(start, threadId, call_record_kind, { as_bytes(call), args, path });
+        ++m_calls;
+    }
+
+    trace_writer& m_writer;
+    std::unordered_map<std::string_view, std::unique_ptr<event_schema>> m_schemas;
+    std::unordered_map<std::uint32_t, std::uint32_t> m_threads;
+    std::deque<std::string> m_functionNames;
+    std::unordered_map<std::string_view, std::uint16_t> m_functionIds;
+    std::vector<std::string_view> m_values;
+    std::string m_text;
+
+    unsigned long long m_events = 0;
+    unsigned long long m_calls = 0;
+    unsigned long long m_texts = 0;
+    unsigned long long m_undecodable = 0;
+};
+
+// Arguments are all of the form "/name:value"; returns null when 'arg' isn't the named one
+static const wchar_t* option_value(const wchar_t* arg, std::wstring_view name)
+{
+    if ((arg[0] != L'/') || (std::wcsncmp(arg + 1, name.data(), name.length()) != 0))
+    {
+        return nullptr;
+    }
+
+    auto value = arg + 1 + name.length();
+    return (*value == L':') ? value + 1 : (*value ? nullptr : value);
+}
+
+static bool parse_keywords(const wchar_t* value, std::uint64_t& result)
+{
+    wchar_t* end;
+    result = std::wcstoull(value, &end, 0);
+    if ((end != value) && !*end)
+    {
+        return true;
+    }
+
+    result = 0;
+    for (std::wstring_view names = value; !names.empty();)
+    {
+        auto comma = names.find(L',');
+        auto name = names.substr(0, comma);
+        names = (comma == std::wstring_view::npos) ? std::wstring_view{} : names.substr(comma + 1);
+
+        auto itr = std::find_if(std::begin(keyword_names), std::end(keyword_names), [&](auto& entry) { return entry.first == name; });
+        if (itr == std::end(keyword_names))
+        {
+            return false;
+        }
+        result |= itr->second;
+    }
+
+    return true;
+}
+
+static HANDLE g_stopEvent = nullptr;
+
+static BOOL __stdcall console_control_handler(DWORD)
+{
+    ::SetEvent(g_stopEvent);
+    return TRUE;
+}
+
+static void __stdcall event_record_callback(PEVENT_RECORD record)
+{
+    static_cast<event_collector*>(record->UserContext)->on_event(*record);
+}
+
+// The session properties, followed by the session name that ETW copies its name into
+struct session_properties
+{
+    explicit session_properties(const std::wstring& name) :
+        buffer(sizeof(EVENT_TRACE_PROPERTIES) + (name.length() + 1) * sizeof(wchar_t))
+    {
+        auto props = get();
+        props->Wnode.BufferSize = static_cast<ULONG>(buffer.size());
+        props->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+    }
+
+    EVENT_TRACE_PROPERTIES* get() noexcept
+    {
+        return reinterpret_cast<EVENT_TRACE_PROPERTIES*>(buffer.data());
+    }
+
+    std::vector<char> buffer;
+};
+
+static int capture(int argc, wchar_t** argv)
+{
+    std::filesystem::path outputPath;
+    std::wstring sessionName = L"PsfTraceCollector";
+    ULONG bufferSize = 256;
+    ULONG bufferCount = 64;
+    std::uint64_t keywords = ~0ull;
+    DWORD duration = INFINITE;
+    for (int i = 2; i < argc; ++i)
+    {
+        const wchar_t* value;
+        if ((value = option_value(argv[i], L"session"sv)) != nullptr)
+        {
+            sessionName = value;
+        }
+        else if ((value = option_value(argv[i], L"bufferSize"sv)) != nullptr)
+        {
+            bufferSize = std::wcstoul(value, nullptr, 10);
+        }
+        else if ((value = option_value(argv[i], L"buffers"sv)) != nullptr)
+        {
+            bufferCount = std::wcstoul(value, nullptr, 10);
+        }
+        else if ((value = option_value(argv[i], L"keywords"sv)) != nullptr)
+        {
+            if (!parse_keywords(value, keywords))
+            {
+                std::fwprintf(stderr, L"ERROR: Unknown keywords: %ls\n", value);
+                return ERROR_INVALID_PARAMETER;
+            }
+        }
+        else if ((value = option_value(argv[i], L"duration"sv)) != nullptr)
+        {
+            duration = std::wcstoul(value, nullptr, 10) * 1000;
+        }
+        else if (argv[i][0] != L'/')
+        {
+            outputPath = argv[i];
+        }
+        else
+        {
+            std::fwprintf(stderr, L"ERROR: Unknown argument: %ls\n", argv[i]);
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    if (outputPath.empty() || !bufferSize || !bufferCount)
+    {
+        std::fwprintf(stderr, L"ERROR: The capture command needs an output path, and a non-zero buffer size and count\n");
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    // The session uses the QueryPerformanceCounter clock, and the timestamps are read raw, so that they're the same as
+    // the start times of the calls, and as those in traces that TraceFixup writes itself
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+
+    trace_writer writer;
+    if (!writer.open(outputPath, frequency.QuadPart))
+    {
+        std::fwprintf(stderr, L"ERROR: Could not create %ls\n", outputPath.c_str());
+        return ERROR_WRITE_FAULT;
+    }
+
+    session_properties properties(sessionName);
+    auto props = properties.get();
+    props->Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+    props->Wnode.ClientContext = 1;
+    props->BufferSize = bufferSize;
+    props->MinimumBuffers = bufferCount;
+    props->MaximumBuffers = bufferCount;
+    props->FlushTimer = 1;
+    props->LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+
+    TRACEHANDLE session = 0;
+    auto err = ::StartTraceW(&session, sessionName.c_str(), props);
+    if (err == ERROR_ALREADY_EXISTS)
+    {
+        // Left behind by a collector that didn't get to stop it
+        session_properties stale(sessionName);
+        ::ControlTraceW(0, sessionName.c_str(), stale.get(), EVENT_TRACE_CONTROL_STOP);
+        err = ::StartTraceW(&session, sessionName.c_str(), props);
+    }
+
+    if (err != ERROR_SUCCESS)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not start the %ls session (%lu)%ls\n", sessionName.c_str(), err,
+            (err == ERROR_ACCESS_DENIED) ? L"; run as an administrator or a member of Performance Log Users" : L"");
+        return static_cast<int>(err);
+    }
+
+    err = ::EnableTraceEx2(session, &psf_provider_id, EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_VERBOSE, keywords, 0, 0, nullptr);
+    if (err != ERROR_SUCCESS)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not enable the PSF provider (%lu)\n", err);
+        ::ControlTraceW(session, nullptr, props, EVENT_TRACE_CONTROL_STOP);
+        return static_cast<int>(err);
+    }
+
+    event_collector collector(writer);
+    EVENT_TRACE_LOGFILEW logFile{};
+    logFile.LoggerName = sessionName.data();
+    logFile.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD | PROCESS_TRACE_MODE_RAW_TIMESTAMP;
+    logFile.EventRecordCallback = event_record_callback;
+    logFile.Context = &collector;
+
+    auto consumer = ::OpenTraceW(&logFile);
+    if (consumer == INVALID_PROCESSTRACE_HANDLE)
+    {
+        err = ::GetLastError();
+        std::fwprintf(stderr, L"ERROR: Could not open the %ls session (%lu)\n", sessionName.c_str(), err);
+        ::ControlTraceW(session, nullptr, props, EVENT_TRACE_CONTROL_STOP);
+        return static_cast<int>(err);
+    }
+
+    std::thread consumerThread([&]()
+    {
+        ::ProcessTrace(&consumer, 1, nullptr, nullptr);
+    });
+
+    g_stopEvent = ::CreateEventW(nullptr, true, false, nullptr);
+    ::SetConsoleCtrlHandler(console_control_handler, true);
+    std::wprintf(L"Capturing the %ls session to %ls. Press Ctrl+C to stop\n", sessionName.c_str(), outputPath.c_str());
+    ::WaitForSingleObject(g_stopEvent, duration);
+
+    // Stopping the session delivers what's left in its buffers, after which ProcessTrace returns
+    ::ControlTraceW(session, nullptr, props, EVENT_TRACE_CONTROL_STOP);
+    consumerThread.join();
+    ::CloseTrace(consumer);
+    ::SetConsoleCtrlHandler(console_control_handler, false);
+    ::CloseHandle(g_stopEvent);
+
+    collector.print_statistics();
+    if (props->EventsLost || props->RealTimeBuffersLost)
+    {
+        std::wprintf(L"WARNING: The session lost %lu events and %lu buffers; use more or larger buffers\n",
+            props->EventsLost, props->RealTimeBuffersLost);
+    }
+
+    if (!writer.close())
+    {
+        std::fwprintf(stderr, L"ERROR: Could not write %ls\n", outputPath.c_str());
+        return ERROR_WRITE_FAULT;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+struct function_summary
+{
+    unsigned long long calls = 0;
+    unsigned long long results[std::size(result_names)] = {};
+    std::int64_t total_ticks = 0;
+    std::int64_t max_ticks = 0;
+};
+
+static int summary(int argc, wchar_t** argv)
+{
+    if (argc != 3)
+    {
+        std::fwprintf(stderr, L"ERROR: The summary command takes the path of a trace\n");
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::filesystem::path path = argv[2];
+    std::vector<std::string> functionNames;
+    std::vector<function_summary> functions;
+    std::unordered_map<std::uint32_t, std::uint32_t> threadProcesses;
+    std::map<std::uint32_t, unsigned long long> processCalls;
+    unsigned long long records = 0;
+    unsigned long long texts = 0;
+    std::int64_t first = INT64_MAX;
+    std::int64_t last = INT64_MIN;
+
+    std::int64_t frequency = 0;
+    auto err = read_trace(path, frequency, [&](const record_header& record, std::string_view payload)
+    {
+        ++records;
+        std::size_t offset = 0;
+        if (record.kind == thread_record)
+        {
+            std::uint32_t processId;
+            if (read_from(payload, offset, processId))
+            {
+                threadProcesses[record.thread_id] = processId;
+            }
+            return;
+        }
+
+        // TraceFixup writes function records, and the counts of the records it dropped, without a timestamp
+        if ((record.kind != function_record) && (record.timestamp != 0))
+        {
+            first = std::min(first, record.timestamp);
+            last = std::max(last, record.timestamp);
+        }
+
+        if (record.kind == text_record)
+        {
+            ++texts;
+        }
+        else if (record.kind == function_record)
+        {
+            std::uint16_t id;
+            if (read_from(payload, offset, id))
+            {
+                if (functionNames.size() <= id)
+                {
+                    functionNames.resize(id + 1);
+                    functions.resize(id + 1);
+                }
+                functionNames[id] = payload.substr(offset);
+            }
+        }
+        else if (record.kind == call_record_kind)
+        {
+            call_record call;
+            if (!read_from(payload, offset, call))
+            {
+                return;
+            }
+
+            if (functions.size() <= call.function_id)
+            {
+                functionNames.resize(call.function_id + 1);
+                functions.resize(call.function_id + 1);
+            }
+
+            auto& function = functions[call.function_id];
+            ++function.calls;
+            ++function.results[std::min<std::size_t>(call.result, std::size(result_names) - 1)];
+            function.total_ticks += call.ticks;
+            function.max_ticks = std::max(function.max_ticks, call.ticks);
+            if (auto itr = threadProcesses.find(record.thread_id); itr != threadProcesses.end())
+            {
+                ++processCalls[itr->second];
+            }
+        }
+    });
+
+    if (err != ERROR_SUCCESS)
+    {
+        return err;
+    }
+
+    auto seconds = (last > first) ? static_cast<double>(last - first) / static_cast<double>(frequency) : 0.0;
+    std::wprintf(L"%ls: %llu records over %.3f seconds, %llu of them text\n", path.c_str(), records, seconds, texts);
+
+    // Most expensive first, since that's what's worth looking into
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < functions.size(); ++i)
+    {
+        if (functions[i].calls)
+        {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](std::size_t lhs, std::size_t rhs)
+    {
+        return functions[lhs].total_ticks > functions[rhs].total_ticks;
+    });
+
+    std::wprintf(L"\n%-32ls %10ls", L"Function", L"Calls");
+    for (auto name : result_names)
+    {
+        std::wprintf(L" %13ls", name);
+    }
+    std::wprintf(L" %12ls %12ls %12ls\n", L"Total ms", L"Average us", L"Max us");
+
+    auto microseconds = [&](double ticks) { return ticks * 1000000.0 / static_cast<double>(frequency); };
+    for (auto index : order)
+    {
+        auto& function = functions[index];
+        auto name = functionNames[index].empty() ? "<unknown>"s : functionNames[index];
+        std::wprintf(L"%-32hs %10llu", name.c_str(), function.calls);
+        for (auto count : function.results)
+        {
+            std::wprintf(L" %13llu", count);
+        }
+        std::wprintf(L" %12.3f %12.3f %12.3f\n",
+            microseconds(static_cast<double>(function.total_ticks)) / 1000.0,
+            microseconds(static_cast<double>(function.total_ticks) / static_cast<double>(function.calls)),
+            microseconds(static_cast<double>(function.max_ticks)));
+    }
+
+    if (!processCalls.empty())
+    {
+        std::wprintf(L"\n%-12ls %10ls\n", L"Process", L"Calls");
+        for (auto& [processId, calls] : processCalls)
+        {
+            std::wprintf(L"%-12u %10llu\n", processId, calls);
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static int filter(int argc, wchar_t** argv)
+{
+    if (argc < 4)
+    {
+        std::fwprintf(stderr, L"ERROR: The filter command takes the paths of the trace and of the output\n");
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::filesystem::path inputPath = argv[2];
+    std::filesystem::path outputPath = argv[3];
+    std::uint32_t processId = 0;
+    std::string functionName;
+    std::wstring pathText;
+    bool failuresOnly = false;
+    double slowerThan = 0;
+    trace_range range;
+    for (int i = 4; i < argc; ++i)
+    {
+        const wchar_t* value;
+        if ((value = option_value(argv[i], L"process"sv)) != nullptr)
+        {
+            processId = static_cast<std::uint32_t>(std::wcstoul(value, nullptr, 10));
+        }
+        else if ((value = option_value(argv[i], L"function"sv)) != nullptr)
+        {
+            functionName = narrow(value);
+        }
+        else if ((value = option_value(argv[i], L"path"sv)) != nullptr)
+        {
+            pathText = value;
+        }
+        else if ((value = option_value(argv[i], L"failures"sv)) != nullptr)
+        {
+            failuresOnly = true;
+        }
+        else if ((value = option_value(argv[i], L"slowerThan"sv)) != nullptr)
+        {
+            slowerThan = std::wcstod(value, nullptr);
+        }
+        else if ((value = option_value(argv[i], L"thread"sv)) != nullptr)
+        {
+            range.thread_id = static_cast<std::uint32_t>(std::wcstoul(value, nullptr, 10));
+        }
+        else if ((value = option_value(argv[i], L"last"sv)) != nullptr)
+        {
+            range.last_seconds = std::wcstod(value, nullptr);
+        }
+        else
+        {
+            std::fwprintf(stderr, L"ERROR: Unknown argument: %ls\n", argv[i]);
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    // Text records aren't calls, so only filtering by process, thread and time keeps them
+    bool keepText = functionName.empty() && pathText.empty() && !failuresOnly && (slowerThan == 0);
+
+    trace_writer writer;
+    bool opened = false;
+    std::int64_t slowerThanTicks = 0;
+    std::vector<bool> functionMatches;
+    std::unordered_map<std::uint32_t, std::uint32_t> threadProcesses;
+    unsigned long long kept = 0;
+    unsigned long long total = 0;
+
+    std::int64_t frequency = 0;
+    auto err = read_trace(inputPath, frequency, [&](const record_header& record, std::string_view payload)
+    {
+        if (!opened)
+        {
+            opened = true;
+            slowerThanTicks = static_cast<std::int64_t>(slowerThan * static_cast<double>(frequency) / 1000.0);
+            writer.open(outputPath, frequency);
+        }
+
+        std::size_t offset = 0;
+        auto processMatches = [&]()
+        {
+            auto itr = threadProcesses.find(record.thread_id);
+            return !processId || ((itr != threadProcesses.end()) && (itr->second == processId));
+        };
+        auto inRange = [&]()
+        {
+            return (!range.thread_id || (record.thread_id == range.thread_id)) && (record.timestamp >= range.from);
+        };
+
+        bool keep = false;
+        if (record.kind == thread_record)
+        {
+            std::uint32_t threadProcess = 0;
+            read_from(payload, offset, threadProcess);
+            threadProcesses[record.thread_id] = threadProcess;
+            keep = processMatches() && (!range.thread_id || (record.thread_id == range.thread_id));
+        }
+        else if (record.kind == function_record)
+        {
+            // Kept whether or not any of the calls are, since they're small and the calls refer to them by id
+            std::uint16_t id;
+            if (read_from(payload, offset, id))
+            {
+                if (functionMatches.size() <= id)
+                {
+                    functionMatches.resize(id + 1);
+                }
+                auto name = payload.substr(offset);
+                functionMatches[id] = functionName.empty() ||
+                    ((name.size() == functionName.size()) && (_strnicmp(name.data(), functionName.c_str(), name.size()) == 0));
+            }
+            keep = true;
+        }
+        else if (record.kind == text_record)
+        {
+            ++total;
+            keep = keepText && processMatches() && inRange();
+            kept += keep ? 1 : 0;
+        }
+        else if (record.kind == call_record_kind)
+        {
+            ++total;
+            call_record call;
+            if (!read_from(payload, offset, call) ||
+                (payload.size() - offset < call.arg_count * sizeof(std::uint64_t) + call.string_bytes) ||
+                !processMatches() || !inRange() ||
+                (call.function_id >= functionMatches.size()) || !functionMatches[call.function_id] ||
+                (failuresOnly && (call.result < expected_failure_result)) ||
+                (call.ticks < slowerThanTicks))
+            {
+                return;
+            }
+
+            if (!pathText.empty())
+            {
+                auto string = payload.substr(offset + call.arg_count * sizeof(std::uint64_t), call.string_bytes);
+                auto path = (call.flags & wide_string_flag) ?
+                    std::wstring(reinterpret_cast<const wchar_t*>(string.data()), string.size() / sizeof(wchar_t)) :
+                    widen(string, CP_ACP);
+                if (iwstring_view(path.data(), path.length()).find(iwstring_view(pathText.data(), pathText.length())) == iwstring_view::npos)
+                {
+                    return;
+                }
+            }
+            keep = true;
+            ++kept;
+        }
+
+        if (keep)
+        {
+            writer.write_record(record.timestamp, record.thread_id, record.kind, { payload });
+        }
+    }, &range);
+
+    if (err != ERROR_SUCCESS)
+    {
+        return err;
+    }
+
+    // A trace without any records still gets its header
+    if (!opened)
+    {
+        writer.open(outputPath, frequency);
+    }
+
+    if (!writer.close())
+    {
+        std::fwprintf(stderr, L"ERROR: Could not write %ls\n", outputPath.c_str());
+        return ERROR_WRITE_FAULT;
+    }
+
+    std::wprintf(L"Kept %llu of %llu calls and text records\n", kept, total);
+    return ERROR_SUCCESS;
+}
+
+static bool read_text_file(const std::filesystem::path& path, std::string& contents)
+{
+#pragma warning(suppress:4996) // Nonsense warning; _wfopen is perfectly safe
+    auto file = _wfopen(path.c_str(), L"rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    std::size_t length;
+    while ((length = std::fread(buffer, 1, sizeof(buffer), file)) != 0)
+    {
+        contents.append(buffer, length);
+    }
+
+    auto result = !std::ferror(file);
+    std::fclose(file);
+    return result;
+}
+
+static std::wstring lower_file_name(std::wstring_view path)
+{
+    std::wstring result(path.substr(path.find_last_of(L"\\/"sv) + 1)); // npos + 1 is the whole path
+    std::transform(result.begin(), result.end(), result.begin(), [](wchar_t ch) { return static_cast<wchar_t>(std::towlower(ch)); });
+    return result;
+}
+
+// Resolves the module+offset frames of a TraceFixup stack profile (see 'profileStacks') to module!function, with the
+// symbols of the modules that the profile's ".modules" file lists. Stacks that then have the same frames, e.g. those that
+// only differ by where in a function they were called from, are merged
+static int symbolize(int argc, wchar_t** argv)
+{
+    if (argc < 4)
+    {
+        std::fwprintf(stderr, L"ERROR: The symbolize command takes the paths of the stack profile and of the output\n");
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::filesystem::path inputPath = argv[2];
+    std::filesystem::path outputPath = argv[3];
+    const wchar_t* symbolPath = nullptr; // _NT_SYMBOL_PATH, and then the folder of each module
+    for (int i = 4; i < argc; ++i)
+    {
+        const wchar_t* value;
+        if ((value = option_value(argv[i], L"symbols"sv)) != nullptr)
+        {
+            symbolPath = value;
+        }
+        else
+        {
+            std::fwprintf(stderr, L"ERROR: Unknown argument: %ls\n", argv[i]);
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    std::string profile;
+    std::string moduleList;
+    auto modulesPath = inputPath;
+    modulesPath += L".modules";
+    if (!read_text_file(inputPath, profile) || !read_text_file(modulesPath, moduleList))
+    {
+        std::fwprintf(stderr, L"ERROR: Could not read %ls and %ls\n", inputPath.c_str(), modulesPath.c_str());
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    auto process = ::GetCurrentProcess();
+    ::SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_FAIL_CRITICAL_ERRORS);
+    if (!::SymInitializeW(process, symbolPath, FALSE))
+    {
+        auto err = ::GetLastError();
+        std::fwprintf(stderr, L"ERROR: Could not initialize the symbol handler, error=%u\n", err);
+        return static_cast<int>(err);
+    }
+
+    // The modules aren't loaded, so each is given a range of addresses of its own. Frames only name the module's file
+    std::unordered_map<std::wstring, DWORD64> moduleBases;
+    DWORD64 nextBase = 0x10000000;
+    for (std::size_t start = 0; start < moduleList.size();)
+    {
+        auto end = std::min(moduleList.find('\n', start), moduleList.size());
+        auto modulePath = widen(std::string_view(moduleList).substr(start, end - start));
+        start = end + 1;
+        if (modulePath.empty())
+        {
+            continue;
+        }
+
+        if (auto base = ::SymLoadModuleExW(process, nullptr, modulePath.c_str(), nullptr, nextBase, 0, nullptr, 0))
+        {
+            moduleBases.emplace(lower_file_name(modulePath), base);
+            nextBase += 0x10000000;
+        }
+        else
+        {
+            std::fwprintf(stderr, L"WARNING: Could not load %ls, error=%u\n", modulePath.c_str(), ::GetLastError());
+        }
+    }
+
+    alignas(SYMBOL_INFOW) std::uint8_t symbolBuffer[sizeof(SYMBOL_INFOW) + MAX_SYM_NAME * sizeof(wchar_t)];
+    auto symbol = reinterpret_cast<SYMBOL_INFOW*>(symbolBuffer);
+    auto resolve = [&](std::string_view frame) -> std::string
+    {
+        auto plus = frame.rfind("+0x"sv);
+        if (plus == std::string_view::npos)
+        {
+            return std::string(frame);
+        }
+
+        auto moduleName = widen(frame.substr(0, plus));
+        auto module = moduleBases.find(lower_file_name(moduleName));
+        if (module == moduleBases.end())
+        {
+            return std::string(frame);
+        }
+
+        auto offset = std::strtoull(std::string(frame.substr(plus + 3)).c_str(), nullptr, 16);
+
+        // Return addresses are just past the call, which may be the first byte of the next function
+        std::memset(symbolBuffer, 0, sizeof(SYMBOL_INFOW));
+        symbol->SizeOfStruct = sizeof(SYMBOL_INFOW);
+        symbol->MaxNameLen = MAX_SYM_NAME;
+        DWORD64 displacement;
+        if ((offset == 0) || !::SymFromAddrW(process, module->second + offset - 1, &displacement, symbol))
+        {
+            return std::string(frame);
+        }
+
+        return narrow(moduleName) + "!" + narrow(std::wstring_view(symbol->Name, symbol->NameLen));
+    };
+
+    std::map<std::string, unsigned long long> stacks;
+    std::string stack;
+    for (std::size_t start = 0; start < profile.size();)
+    {
+        auto end = std::min(profile.find('\n', start), profile.size());
+        auto line = std::string_view(profile).substr(start, end - start);
+        start = end + 1;
+
+        auto space = line.rfind(' ');
+        if (space == std::string_view::npos)
+        {
+            continue;
+        }
+
+        // The last frame is the traced function, which is never an address
+        stack.clear();
+        auto frames = line.substr(0, space);
+        for (std::size_t frameStart = 0; frameStart <= frames.size();)
+        {
+            auto frameEnd = std::min(frames.find(';', frameStart), frames.size());
+            auto frame = resolve(frames.substr(frameStart, frameEnd - frameStart));
+            frameStart = frameEnd + 1;
+
+            if (!stack.empty())
+            {
+                stack.push_back(';');
+            }
+            stack += frame;
+        }
+
+        stacks[stack] += std::strtoull(std::string(line.substr(space + 1)).c_str(), nullptr, 10);
+    }
+    ::SymCleanup(process);
+
+#pragma warning(suppress:4996) // Nonsense warning; _wfopen is perfectly safe
+    auto output = _wfopen(outputPath.c_str(), L"wb");
+    if (!output)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not create %ls\n", outputPath.c_str());
+        return ERROR_CANNOT_MAKE;
+    }
+
+    for (auto& [frames, microseconds] : stacks)
+    {
+        std::fprintf(output, "%s %llu\n", frames.c_str(), microseconds);
+    }
+
+    if (std::fclose(output) != 0)
+    {
+        std::fwprintf(stderr, L"ERROR: Could not write %ls\n", outputPath.c_str());
+        return ERROR_WRITE_FAULT;
+    }
+
+    std::wprintf(L"%zu stacks, from %zu modules with symbols\n", stacks.size(), moduleBases.size());
+    return ERROR_SUCCESS;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    if (argc >= 2)
+    {
+        if (std::wcscmp(argv[1], L"capture") == 0)
+        {
+            return capture(argc, argv);
+        }
+        else if (std::wcscmp(argv[1], L"summary") == 0)
+        {
+            return summary(argc, argv);
+        }
+        else if (std::wcscmp(argv[1], L"filter") == 0)
+        {
+            return filter(argc, argv);
+        }
+        else if (std::wcscmp(argv[1], L"symbolize") == 0)
+        {
+            return symbolize(argc, argv);
+        }
+    }
+
+    std::fwprintf(stderr, L"Usage: %ls capture <output path> [/keywords:<names or mask>] [/buffers:<count>] [/bufferSize:<KB>]\n", argv[0]);
+    std::fwprintf(stderr, L"           [/duration:<seconds>] [/session:<name>]\n");
+    std::fwprintf(stderr, L"    Captures the events of the PSF provider, until Ctrl+C, to a binary trace. Keywords are any of\n");
+    std::fwprintf(stderr, L"    filesystem, registry, processAndThread, and dynamicLinkLibrary, separated by commas.\n");
+    std::fwprintf(stderr, L"       %ls summary <trace path>\n", argv[0]);
+    std::fwprintf(stderr, L"    Summarizes the calls of a trace by function and by process.\n");
+    std::fwprintf(stderr, L"       %ls filter <trace path> <output path> [/process:<id>] [/function:<name>] [/path:<text>]\n", argv[0]);
+    std::fwprintf(stderr, L"           [/failures] [/slowerThan:<ms>] [/thread:<id>] [/last:<seconds>]\n");
+    std::fwprintf(stderr, L"    Writes the calls of a trace that match all of the filters to a new trace.\n");
+    std::fwprintf(stderr, L"       %ls symbolize <stack profile path> <output path> [/symbols:<symbol path>]\n", argv[0]);
+    std::fwprintf(stderr, L"    Resolves the return addresses of a TraceFixup stack profile to function names.\n");
+    return ERROR_INVALID_PARAMETER;
+}
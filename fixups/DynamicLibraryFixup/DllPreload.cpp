@@ -0,0 +1,222 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <psf_framework.h>
+#include <psf_utils.h>
+#include <utilities.h>
+
+#include "DllPreload.h"
+#include "FunctionImplementations.h"
+#include "dll_location_spec.h"
+
+namespace
+{
+    // Loader notifications arrive with the loader lock held, as does the call to SaveDllLoadOrder on detach, so none of
+    // these need a lock of their own. The package root is folded for comparison with the loader's full DLL names
+    std::wstring g_foldedPackageRootPath;
+    std::vector<std::wstring> g_recordedLoadOrder;
+    bool g_recording = false;
+
+    // One list per executable, since each loads different DLLs. The first line is the full name - and therefore the
+    // version - of the package that the list is for, just as for PsfRuntime's location cache
+    std::filesystem::path load_order_path()
+    {
+        // Read from the environment rather than with SHGetKnownFolderPath since this runs during DllMain
+        wchar_t buffer[MAX_PATH];
+        auto length = ::GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, static_cast<DWORD>(std::size(buffer)));
+        if ((length == 0) || (length >= std::size(buffer)))
+        {
+            return {};
+        }
+
+        auto exeName = std::filesystem::path(psf::current_executable_path()).stem().native();
+        return std::filesystem::path(buffer) / L"Packages" / psf::current_package_family_name() / L"LocalCache" /
+            (L"PsfDllPreload." + exeName + L".txt");
+    }
+
+    std::vector<std::wstring> read_load_order(const std::filesystem::path& path)
+    {
+        std::vector<std::wstring> result;
+        std::ifstream file(path);
+        std::string line;
+        if (!std::getline(file, line) || (widen(line) != ::PSFQueryPackageFullName()))
+        {
+            return result;
+        }
+
+        while (std::getline(file, line))
+        {
+            if (!line.empty())
+            {
+                result.push_back(widen(line));
+            }
+        }
+
+        return result;
+    }
+
+    void CALLBACK on_dll_notification(ULONG reason, const winternl::LDR_DLL_LOADED_NOTIFICATION_DATA* data, PVOID) noexcept try
+    {
+        if ((reason != winternl::LDR_DLL_NOTIFICATION_REASON_LOADED) || !data->FullDllName)
+        {
+            return;
+        }
+
+        std::wstring path(data->FullDllName->Buffer, data->FullDllName->Length / sizeof(wchar_t));
+        if ((path.length() <= g_foldedPackageRootPath.length()) || (path[g_foldedPackageRootPath.length()] != L'\\'))
+        {
+            return;
+        }
+
+        auto root = path.substr(0, g_foldedPackageRootPath.length());
+        fold_dll_name(root.data(), root.length());
+        if (root == g_foldedPackageRootPath)
+        {
+            g_recordedLoadOrder.push_back(path.substr(g_foldedPackageRootPath.length() + 1));
+        }
+    }
+    catch (...)
+    {
+        // Only means a shorter list next time
+    }
+
+    // Mapping the file as an image gets the same section that the loader maps later, and so warms exactly the pages it is
+    // going to fault on. DLLs that can't be mapped that way, e.g. those of the other architecture, are at least read into
+    // the file cache.
+    void preload(const std::filesystem::path& path)
+    {
+        auto file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            Log("DynamicLibraryFixup could not preload %ls, error=%d", path.c_str(), ::GetLastError());
+            return;
+        }
+
+        bool prefetched = false;
+        if (auto section = ::CreateFileMappingW(file, nullptr, PAGE_READONLY | SEC_IMAGE, 0, 0, nullptr))
+        {
+            if (auto view = ::MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0))
+            {
+                // The image is one allocation; its size is the sum of the regions that it is made of
+                MEMORY_BASIC_INFORMATION info;
+                SIZE_T size = 0;
+                for (auto address = static_cast<std::byte*>(view);
+                    ::VirtualQuery(address, &info, sizeof(info)) && (info.AllocationBase == view);
+                    address += info.RegionSize)
+                {
+                    size += info.RegionSize;
+                }
+
+                WIN32_MEMORY_RANGE_ENTRY range{ view, size };
+                prefetched = (size != 0) && (::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0) != FALSE);
+                ::UnmapViewOfFile(view);
+            }
+            ::CloseHandle(section);
+        }
+
+        if (!prefetched)
+        {
+            auto buffer = std::make_unique<std::byte[]>(64 * 1024);
+            DWORD bytesRead;
+            while (::ReadFile(file, buffer.get(), 64 * 1024, &bytesRead, nullptr) && (bytesRead != 0))
+            {
+            }
+        }
+
+        ::CloseHandle(file);
+    }
+}
+
+void StartDllPreload(const std::filesystem::path& packageRootPath, std::vector<std::wstring> relativePaths)
+{
+    if (relativePaths.empty())
+    {
+        if (auto path = load_order_path(); !path.empty())
+        {
+            relativePaths = read_load_order(path);
+        }
+    }
+
+    if (relativePaths.empty())
+    {
+        Log("DynamicLibraryFixup has nothing to preload");
+        return;
+    }
+
+    // Behind other background work, since the app's own threads should never wait on the preloading
+    psf::submit_work([packageRootPath, relativePaths = std::move(relativePaths)]() noexcept
+    {
+        try
+        {
+            for (auto& relativePath : relativePaths)
+            {
+                preload(packageRootPath / relativePath);
+            }
+
+            Log("DynamicLibraryFixup preloaded dlls=%zu", relativePaths.size());
+        }
+        catch (...)
+        {
+            Log("DynamicLibraryFixup preload failed with an exception");
+        }
+    }, psf::work_priority::low);
+}
+
+void RecordDllLoadOrder(const std::filesystem::path& packageRootPath)
+{
+    g_foldedPackageRootPath = packageRootPath.native();
+    fold_dll_name(g_foldedPackageRootPath.data(), g_foldedPackageRootPath.length());
+
+    PVOID cookie;
+    if (!NT_SUCCESS(impl::LdrRegisterDllNotification(0, &on_dll_notification, nullptr, &cookie)))
+    {
+        Log("DynamicLibraryFixup could not record the DLL load order");
+        return;
+    }
+
+    g_recording = true;
+}
+
+void SaveDllLoadOrder() noexcept try
+{
+    if (!g_recording || g_recordedLoadOrder.empty())
+    {
+        return;
+    }
+
+    auto path = load_order_path();
+    if (path.empty())
+    {
+        return;
+    }
+
+    // Written to a file of this process' own first, so that other processes never read a partially written list
+    auto tempPath = path;
+    tempPath.concat(L"." + std::to_wstring(::GetCurrentProcessId()));
+
+    std::ofstream file(tempPath, std::ios::trunc);
+    file << narrow(::PSFQueryPackageFullName()) << "\n";
+    for (auto& relativePath : g_recordedLoadOrder)
+    {
+        file << narrow(relativePath) << "\n";
+    }
+    file.close();
+
+    if (!file || !::MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        Log("DynamicLibraryFixup could not save the DLL load order to %ls", path.c_str());
+        ::DeleteFileW(tempPath.c_str());
+    }
+}
+catch (...)
+{
+    // Not fatal; the next process records it again
+}
@@ -0,0 +1,24 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Apps that load many package DLLs at startup take a cold page fault on every one of them, one after another on the main
+// thread. Preloading reads the images of those DLLs into memory on a background thread while the app's entry point runs,
+// so that by the time the loader maps them, their pages are already in memory.
+//
+// The list is package relative and normally in load order. Without one in config.json, the list that RecordDllLoadOrder
+// saved for this executable, and this version of the package, is used
+void StartDllPreload(const std::filesystem::path& packageRootPath, std::vector<std::wstring> relativePaths);
+
+// Starts recording the package DLLs that this process loads, in order, and by any means - including static imports -
+// to be saved by SaveDllLoadOrder in the package's LocalCache folder
+void RecordDllLoadOrder(const std::filesystem::path& packageRootPath);
+
+// Writes what RecordDllLoadOrder has recorded, if anything. Called once the process is done loading, i.e. on detach
+void SaveDllLoadOrder() noexcept;
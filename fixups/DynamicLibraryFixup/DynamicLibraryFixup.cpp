@@ -4,13 +4,64 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <iterator>
+
 #include <psf_framework.h>
 #include "FunctionImplementations.h"
 #include "dll_location_spec.h"
+#include "PackageDllIndex.h"
+#include "ProcAddressCache.h"
 
 extern bool                  g_dynf_forcepackagedlluse;
 extern std::vector<dll_location_spec> g_dynf_dllSpecs;
 
+// Every load path - LoadLibrary[Ex] as well as direct and delay load callers of LdrLoadDll - resolves names the same way,
+// in O(1), against the specs from relativeDllPaths and then the package DLL index. The name is folded in a buffer on the
+// stack, so that looking it up never allocates; names too long for it can't be the name of a spec anyway
+static const dll_location_spec* FindDllSpec(const wchar_t* libFileName, std::size_t length) noexcept
+{
+    if (!libFileName || (length == 0) || (length >= MAX_PATH))
+    {
+        return nullptr;
+    }
+
+    wchar_t name[MAX_PATH];
+    std::copy(libFileName, libFileName + length, name);
+    fold_dll_name(name, length);
+    if (auto itr = g_dynf_dllIndex.find(std::wstring_view(name, length)); itr != g_dynf_dllIndex.end())
+    {
+        return itr->second;
+    }
+
+    return FindPackageDll(std::wstring_view(name, length));
+}
+
+template <typename CharT>
+static const dll_location_spec* FindDllSpec(const CharT* libFileName) noexcept
+{
+    if (!libFileName)
+    {
+        return nullptr;
+    }
+
+    if constexpr (psf::is_ansi<CharT>)
+    {
+        // Names that are too long, or that aren't valid in the code page, can't be the name of a spec either
+        wchar_t name[MAX_PATH];
+        auto length = try_widen(libFileName, name, std::size(name), CP_ACP);
+        if (!length)
+        {
+            return nullptr;
+        }
+        return FindDllSpec(name, *length);
+    }
+    else
+    {
+        return FindDllSpec(libFileName, ::wcsnlen(libFileName, MAX_PATH));
+    }
+}
+
 
 auto LoadLibraryImpl = psf::detoured_string_function(&::LoadLibraryA, &::LoadLibraryW);
 template <typename CharT>
@@ -28,34 +79,21 @@ HMODULE __stdcall LoadLibraryFixup(_In_ const CharT* libFileName)
         Log("LoadLibraryFixup unguarded.");
 #endif
         // Check against known dlls in package.
-        std::wstring libFileNameW = InterpretStringW(libFileName);
-
         if (g_dynf_forcepackagedlluse)
         {
 #if _DEBUG
             Log("LoadLibraryFixup forcepackagedlluse.");
 #endif
-            for (dll_location_spec spec : g_dynf_dllSpecs)
+            if (auto spec = FindDllSpec(libFileName))
             {
-#if _DEBUG
-                Log("LoadLibraryFixup test");
-#endif
-                try
-                {
-#if _DEBUG
-                    LogString("LoadLibraryFixup testing against", spec.filename.data());
-#endif
-                    if (spec.filename.compare(libFileNameW + L".dll") == 0 ||
-                        spec.filename.compare(libFileNameW) == 0)
-                    {
-                        LogString("LoadLibraryFixup using", spec.full_filepath.c_str());
-                        result = LoadLibraryImpl(spec.full_filepath.c_str());
-                        return result;
-                    }
-                }
-                catch (...)
+                LogString("LoadLibraryFixup using", spec->full_filepath.c_str());
+                result = LoadLibraryImpl(spec->full_filepath.c_str());
+
+                // A DLL that was found rather than listed may still be one that this process can't load, in which case
+                // the normal search order gets its chance
+                if (result || !spec->auto_indexed)
                 {
-                    Log("LoadLibraryFixup ERROR");
+                    return result;
                 }
             }
         }
@@ -82,29 +120,15 @@ HMODULE __stdcall LoadLibraryExFixup(_In_ const CharT* libFileName, _Reserved_ H
         Log("LoadLibraryExFixup unguarded.");
 #endif
         // Check against known dlls in package.
-        std::wstring libFileNameW = InterpretStringW(libFileName);
-        
         if (g_dynf_forcepackagedlluse)
         {
-            for (dll_location_spec spec : g_dynf_dllSpecs)
+            if (auto spec = FindDllSpec(libFileName))
             {
-                try
-                {
-#if _DEBUG
-                    //Log("LoadLibraryExFixup testing %ls against %ls", libFileNameW.c_str(), spec.full_filepath.native().c_str());
-                    LogString("LoadLibraryExFixup testing against", spec.filename.data());
-#endif
-                    if (spec.filename.compare(libFileNameW + L".dll") == 0 ||
-                        spec.filename.compare(libFileNameW) == 0)
-                    {
-                        LogString("LoadLibraryExFixup using", spec.full_filepath.c_str());
-                        result = LoadLibraryExImpl(spec.full_filepath.c_str(), file, flags);
-                        return result;
-                    }
-                }
-                catch (...)
+                LogString("LoadLibraryExFixup using", spec->full_filepath.c_str());
+                result = LoadLibraryExImpl(spec->full_filepath.c_str(), file, flags);
+                if (result || !spec->auto_indexed)
                 {
-                    Log("LoadLibraryExFixup Error");
+                    return result;
                 }
             }
         }
@@ -115,6 +139,62 @@ HMODULE __stdcall LoadLibraryExFixup(_In_ const CharT* libFileName, _Reserved_ H
 }
 DECLARE_STRING_FIXUP(LoadLibraryExImpl, LoadLibraryExFixup);
 
+// LoadLibrary[Ex] end up here too, but with the guard held, and so only what calls the loader directly - e.g. the delay
+// load helper and LoadPackagedLibrary - is resolved in this fixup. GetModuleHandle needs no fixup, since it never
+// searches: the loader matches modules that are already loaded by their base name, redirected or not
+NTSTATUS __stdcall LdrLoadDllFixup(
+    _In_opt_ PWSTR searchPath,
+    _In_opt_ PULONG dllCharacteristics,
+    _In_ PUNICODE_STRING dllName,
+    _Out_ PVOID* baseAddress)
+{
+    auto guard = g_reentrancyGuard.enter();
+    if (guard && g_dynf_forcepackagedlluse && dllName)
+    {
+        if (auto spec = FindDllSpec(dllName->Buffer, dllName->Length / sizeof(wchar_t)))
+        {
+#if _DEBUG
+            LogString("LdrLoadDllFixup using", spec->full_filepath.c_str());
+#endif
+            auto& path = spec->full_filepath.native();
+            UNICODE_STRING fullPath;
+            fullPath.Buffer = const_cast<PWSTR>(path.c_str());
+            fullPath.Length = static_cast<USHORT>(path.length() * sizeof(wchar_t));
+            fullPath.MaximumLength = fullPath.Length + sizeof(wchar_t);
+
+            auto result = impl::LdrLoadDll(searchPath, dllCharacteristics, &fullPath, baseAddress);
+            if (NT_SUCCESS(result) || !spec->auto_indexed)
+            {
+                return result;
+            }
+        }
+    }
+
+    return impl::LdrLoadDll(searchPath, dllCharacteristics, dllName, baseAddress);
+}
+DECLARE_FIXUP(impl::LdrLoadDll, LdrLoadDllFixup);
+
+// Only attached with the "cacheProcAddresses" option; see ProcAddressCache.h
+FARPROC __stdcall GetProcAddressFixup(_In_ HMODULE module, _In_ LPCSTR procName)
+{
+    auto guard = g_reentrancyGuard.enter();
+    if (!guard)
+    {
+        return impl::GetProcAddress(module, procName);
+    }
+
+    if (auto address = FindCachedProcAddress(module, procName))
+    {
+        return address;
+    }
+
+    auto generation = ProcAddressCacheGeneration();
+    auto result = impl::GetProcAddress(module, procName);
+    CacheProcAddress(module, procName, result, generation);
+    return result;
+}
+DECLARE_GROUPED_FIXUP(proc_address_cache_group, impl::GetProcAddress, GetProcAddressFixup);
+
 
 // NOTE: The following is a list of functions taken from https://msdn.microsoft.com/en-us/library/windows/desktop/ms682599(v=vs.85).aspx
 //       that are _not_ present above. This is just a convenient collection of what's missing; it is not a collection of
@@ -134,7 +214,6 @@ DECLARE_STRING_FIXUP(LoadLibraryExImpl, LoadLibraryExFixup);
 // GetDllDirectory
 // GetModuleFileName
 // GetModuleFileNameEx
-// GetModuleHandle
+// GetModuleHandle (never searches, see LdrLoadDllFixup)
 // GetModuleHandleEx
-// GetProcAddress
 // QueryOptionalDelayLoadedAPI
@@ -12,13 +12,74 @@
 #include <reentrancy_guard.h>
 #include <psf_framework.h>
 
+#include <cassert>
+#include <windows.h>
+#include <winternl.h>
+
 // A much bigger hammer to avoid reentrancy. Still, the impl::* functions are good to have around to prevent the
 // unnecessary invocation of the fixup
-inline thread_local psf::reentrancy_guard g_reentrancyGuard;
+inline const psf::shared_reentrancy_guard g_reentrancyGuard{ psf::reentrancy_owner::dynamic_library };
 
-namespace impl
+namespace winternl
 {
+    // NOTE: LdrLoadDll is neither documented nor declared; this is the declaration that everyone uses
+    NTSTATUS __stdcall LdrLoadDll(
+        PWSTR SearchPath,
+        PULONG DllCharacteristics,
+        PUNICODE_STRING DllName,
+        PVOID* BaseAddress);
+
+    // NOTE: The loader notification types are documented, but only declared in the DDK. The notification data is really a
+    //       union with the unloaded data, which has the same layout
+    struct LDR_DLL_LOADED_NOTIFICATION_DATA
+    {
+        ULONG Flags;
+        PCUNICODE_STRING FullDllName;
+        PCUNICODE_STRING BaseDllName;
+        PVOID DllBase;
+        ULONG SizeOfImage;
+    };
+
+    constexpr ULONG LDR_DLL_NOTIFICATION_REASON_LOADED = 1;
+    constexpr ULONG LDR_DLL_NOTIFICATION_REASON_UNLOADED = 2;
+
+    using LDR_DLL_NOTIFICATION_FUNCTION = VOID(CALLBACK*)(ULONG NotificationReason, const LDR_DLL_LOADED_NOTIFICATION_DATA* NotificationData, PVOID Context);
+
+    NTSTATUS __stdcall LdrRegisterDllNotification(
+        ULONG Flags,
+        LDR_DLL_NOTIFICATION_FUNCTION NotificationFunction,
+        PVOID Context,
+        PVOID* Cookie);
+
+    // NOTE: The functions in ntdll are not included in any import lib and therefore must be manually loaded in
+    template <typename Func>
+    inline Func GetNtDllInternalFunction(const char* functionName)
+    {
+        static auto mod = ::LoadLibraryW(L"ntdll.dll");
+        assert(mod);
 
+        // Ignore namespaces
+        for (auto ptr = functionName; *ptr; ++ptr)
+        {
+            if (*ptr == ':')
+            {
+                functionName = ptr + 1;
+            }
+        }
+
+        auto result = reinterpret_cast<Func>(::GetProcAddress(mod, functionName));
+        assert(result);
+        return result;
+    }
+}
+
+#define WINTERNL_FUNCTION(Name) (winternl::GetNtDllInternalFunction<decltype(&Name)>(#Name));
+
+namespace impl
+{
+    inline auto LdrLoadDll = WINTERNL_FUNCTION(winternl::LdrLoadDll);
+    inline auto LdrRegisterDllNotification = WINTERNL_FUNCTION(winternl::LdrRegisterDllNotification);
+    inline auto GetProcAddress = &::GetProcAddress;
 }
 
 
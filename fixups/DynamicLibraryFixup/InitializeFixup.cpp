@@ -4,6 +4,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include <algorithm>
 #include <regex>
 #include <vector>
 
@@ -16,17 +17,63 @@
 #include <filesystem>
 
 
+#include "DllPreload.h"
 #include "FunctionImplementations.h"
 #include "dll_location_spec.h"
+#include "PackageDllIndex.h"
+#include "ProcAddressCache.h"
 
 using namespace std::literals;
 
 std::filesystem::path g_dynf_packageRootPath;
 std::filesystem::path g_dynf_packageVfsRootPath;
 bool                  g_dynf_forcepackagedlluse = false;
+bool                  g_dynf_cacheProcAddresses = false;
 
 
 std::vector<dll_location_spec> g_dynf_dllSpecs;
+std::unordered_map<std::wstring_view, const dll_location_spec*> g_dynf_dllIndex;
+
+struct relative_dll_config
+{
+    std::wstring name;
+    std::wstring filepath;
+
+    static constexpr auto json_fields()
+    {
+        return std::make_tuple(
+            psf::json_field("name", &relative_dll_config::name, psf::json_required),
+            psf::json_field("filepath", &relative_dll_config::filepath, psf::json_required));
+    }
+};
+
+struct dynamic_library_config
+{
+    bool force_package_dll_use = false;
+    std::vector<relative_dll_config> relative_dll_paths;
+    bool auto_index_dlls = false;
+    std::vector<std::wstring> auto_index_precedence;
+    std::vector<std::wstring> preload;
+    bool record_preload = false;
+    bool use_dll_directories = false;
+    bool cache_proc_addresses = false;
+
+    static constexpr auto json_fields()
+    {
+        return std::make_tuple(
+            psf::json_field("forcePackageDllUse", &dynamic_library_config::force_package_dll_use),
+            psf::json_field("relativeDllPaths", &dynamic_library_config::relative_dll_paths),
+            psf::json_field("autoIndexDlls", &dynamic_library_config::auto_index_dlls),
+            psf::json_field("autoIndexPrecedence", &dynamic_library_config::auto_index_precedence),
+            psf::json_field("preload", &dynamic_library_config::preload),
+            psf::json_field("recordPreload", &dynamic_library_config::record_preload),
+            psf::json_field("useDllDirectories", &dynamic_library_config::use_dll_directories),
+            psf::json_field("cacheProcAddresses", &dynamic_library_config::cache_proc_addresses));
+    }
+};
+
+// Bound once; g_dynf_dllSpecs refers to its strings
+static dynamic_library_config g_dynf_config;
 
 void Log(const char* fmt, ...)
 {
@@ -132,49 +179,125 @@ void InitializeFixups()
 } // InitializePaths()
 
 
-void InitializeConfiguration()
+// The "useDllDirectories" option. Rather than redirecting every load by name, the folders of the relativeDllPaths are
+// added to the loader's own search, which then finds the DLLs in them on every path into the loader - including delay
+// loads and the loads that DLLs make while they're loaded - without any of them being looked up here. Only the specs
+// whose name isn't the name of their file still need redirecting, and are the only ones indexed.
+//
+// NOTE: The loader searches the application's folder before these, and no longer searches the current directory or
+//       the PATH at all, once the default directories are set
+static bool AddDllDirectories()
 {
-    Log("DynamicLibraryFixup InitializeConfiguration()");
-    if (auto rootConfig = ::PSFQueryCurrentDllConfig())
+    if (!::SetDefaultDllDirectories(LOAD_LIBRARY_SEARCH_DEFAULT_DIRS))
     {
-        auto& rootObject = rootConfig->as_object();
+        Log("DynamicLibraryFixup: SetDefaultDllDirectories failed with %d", ::GetLastError());
+        return false;
+    }
 
-        if (auto forceValue = rootObject.try_get("forcePackageDllUse"))  
+    std::vector<std::filesystem::path> added;
+    for (auto& spec : g_dynf_dllSpecs)
+    {
+        auto folder = spec.full_filepath.parent_path();
+        if (std::find_if(added.begin(), added.end(), [&](auto& path) { return _wcsicmp(path.c_str(), folder.c_str()) == 0; }) != added.end())
         {
-            if (forceValue)
-                g_dynf_forcepackagedlluse = forceValue->as_boolean().get();
-            else
-                g_dynf_forcepackagedlluse = false;
+            continue;
         }
 
+        // The directory stays added for the life of the process, so the cookie is never needed
+        if (!::AddDllDirectory(folder.c_str()))
+        {
+            Log(L"DynamicLibraryFixup: AddDllDirectory failed for %ls", folder.c_str());
+            continue;
+        }
+        Log(L"DynamicLibraryFixup: added DLL directory %ls", folder.c_str());
+        added.push_back(std::move(folder));
+    }
+
+    return true;
+}
+
+// Whether the loader would find the DLL of 'spec' by the name that it's listed by, without it being redirected
+static bool FoundByName(const dll_location_spec& spec)
+{
+    auto fileName = spec.full_filepath.filename().native();
+    fold_dll_name(fileName.data(), fileName.length());
+    std::wstring_view name = spec.folded_filename;
+    return (name == fileName) || ((fileName.length() > 4) && (std::wstring_view(fileName).substr(0, fileName.length() - 4) == name));
+}
+
+void InitializeConfiguration()
+{
+    Log("DynamicLibraryFixup InitializeConfiguration()");
+    if (auto rootConfig = ::PSFQueryCurrentDllConfig())
+    {
+        psf::json_bind(*rootConfig, g_dynf_config);
+        g_dynf_forcepackagedlluse = g_dynf_config.force_package_dll_use;
+
         if (g_dynf_forcepackagedlluse == true)
         {
             Log("DynamicLibraryFixup ForcePackageDllUse=true");
-            if (auto relativeDllsValue = rootObject.try_get("relativeDllPaths"))
+            for (auto& spec : g_dynf_config.relative_dll_paths)
+            {
+                g_dynf_dllSpecs.emplace_back();
+                g_dynf_dllSpecs.back().full_filepath = g_dynf_packageRootPath / spec.filepath;
+                g_dynf_dllSpecs.back().filename = spec.name;
+            }
+
+            // Indexed only once all specs are in place, since the index references their strings. When two specs have
+            // the same name, the first one is used, as it was when they were searched in order
+            for (auto& spec : g_dynf_dllSpecs)
+            {
+                spec.folded_filename = spec.filename;
+                fold_dll_name(spec.folded_filename.data(), spec.folded_filename.length());
+            }
+            auto useDllDirectories = g_dynf_config.use_dll_directories && AddDllDirectories();
+            for (auto& spec : g_dynf_dllSpecs)
             {
-                if (relativeDllsValue)
+                if (useDllDirectories && FoundByName(spec))
                 {
-                    const psf::json_array& dllArray = relativeDllsValue->as_array();
-                    int count = 0;
-                    for (auto& spec : dllArray)
-                    {
-                        auto& specObject = spec.as_object();
-
-                        auto filename = specObject.get("name").as_string().wstring();
-
-                        auto relpath = specObject.get("filepath").as_string().wstring();
-                        std::filesystem::path fullpath = g_dynf_packageRootPath / relpath;
-
-                        g_dynf_dllSpecs.emplace_back();
-                        g_dynf_dllSpecs.back().full_filepath = fullpath;
-                        g_dynf_dllSpecs.back().filename = filename;
-                        count++;
-                    };
-                    Log("DynamicLibraryFixup: %d relative items read.", count);
+                    continue;
+                }
+
+                std::wstring_view name = spec.folded_filename;
+                g_dynf_dllIndex.emplace(name, &spec);
+                if ((name.length() > 4) && (name.substr(name.length() - 4) == L".DLL"sv))
+                {
+                    g_dynf_dllIndex.emplace(name.substr(0, name.length() - 4), &spec);
                 }
             }
-            else
-                Log("DynamicLibraryFixup ForcePacageDllUse=false");
+            Log("DynamicLibraryFixup: %d relative items read.", static_cast<int>(g_dynf_dllSpecs.size()));
+
+            // DLLs listed in relativeDllPaths take precedence over those that are found in the package
+            if (g_dynf_config.auto_index_dlls)
+            {
+                Log("DynamicLibraryFixup AutoIndexDlls=true");
+                InitializePackageDllIndex(g_dynf_packageRootPath, g_dynf_config.auto_index_precedence);
+            }
+            else if (useDllDirectories && g_dynf_dllIndex.empty())
+            {
+                // The loader finds all of them by itself, so there's nothing left for the detours to do
+                Log("DynamicLibraryFixup: all relativeDllPaths are found through the DLL directories");
+                g_dynf_forcepackagedlluse = false;
+            }
+        }
+        else
+        {
+            Log("DynamicLibraryFixup ForcePackageDllUse=false");
+        }
+
+        // Preloading helps whether or not the DLLs are redirected, so it doesn't depend on forcePackageDllUse
+        if (g_dynf_config.record_preload)
+        {
+            Log("DynamicLibraryFixup RecordPreload=true");
+            RecordDllLoadOrder(g_dynf_packageRootPath);
+        }
+        StartDllPreload(g_dynf_packageRootPath, g_dynf_config.preload);
+
+        // Nor does caching GetProcAddress, which is the same whether or not the module came from the package
+        if (g_dynf_config.cache_proc_addresses)
+        {
+            Log("DynamicLibraryFixup CacheProcAddresses=true");
+            g_dynf_cacheProcAddresses = StartProcAddressCache();
         }
     }
 }
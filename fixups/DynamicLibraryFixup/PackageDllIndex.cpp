@@ -0,0 +1,236 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <package_index.h>
+#include <psf_framework.h>
+
+#include "FunctionImplementations.h"
+#include "PackageDllIndex.h"
+
+using namespace std::literals;
+
+namespace
+{
+    // Only read once g_packageDllIndexReady has been set, after which neither is ever modified. The keys of the index
+    // reference the specs' folded names
+    std::vector<dll_location_spec> g_packageDlls;
+    std::unordered_map<std::wstring_view, const dll_location_spec*> g_packageDllIndex;
+    std::atomic<bool> g_packageDllIndexReady{ false };
+
+#ifdef _WIN64
+    constexpr std::wstring_view other_architecture_folders[] = { L"VFS\\SYSTEMX86\\"sv, L"VFS\\PROGRAMFILESX86\\"sv };
+#else
+    constexpr std::wstring_view other_architecture_folders[] = { L"VFS\\SYSTEMX64\\"sv, L"VFS\\PROGRAMFILESX64\\"sv };
+#endif
+
+    bool starts_with(std::wstring_view value, std::wstring_view prefix) noexcept
+    {
+        return (value.length() >= prefix.length()) && (value.compare(0, prefix.length(), prefix) == 0);
+    }
+
+    class dll_index_builder
+    {
+    public:
+        explicit dll_index_builder(const std::vector<std::wstring>& precedence)
+        {
+            for (auto folder : precedence)
+            {
+                psf::make_package_index_key(folder);
+                if (!folder.empty())
+                {
+                    folder.push_back(L'\\');
+                    m_precedence.push_back(std::move(folder));
+                }
+            }
+        }
+
+        // 'path' is package relative and in the form produced by make_package_index_key
+        void add(std::wstring_view path)
+        {
+            if ((path.length() <= 4) || (path.substr(path.length() - 4) != L".DLL"sv))
+            {
+                return;
+            }
+
+            for (auto folder : other_architecture_folders)
+            {
+                if (starts_with(path, folder))
+                {
+                    return;
+                }
+            }
+
+            std::size_t rank = 0;
+            while ((rank < m_precedence.size()) && !starts_with(path, m_precedence[rank]))
+            {
+                ++rank;
+            }
+
+            std::size_t depth = 0;
+            for (auto ch : path)
+            {
+                depth += (ch == L'\\') ? 1 : 0;
+            }
+
+            auto name = path.substr(path.rfind(L'\\') + 1);
+            auto [itr, inserted] = m_dlls.try_emplace(std::wstring(name), candidate{ std::wstring(path), rank, depth });
+            auto& best = itr->second;
+            if (!inserted && (std::tie(rank, depth, path) < std::tie(best.rank, best.depth, best.path)))
+            {
+                best = candidate{ std::wstring(path), rank, depth };
+            }
+        }
+
+        void publish(const std::filesystem::path& packageRootPath)
+        {
+            g_packageDlls.reserve(m_dlls.size());
+            for (auto& [name, dll] : m_dlls)
+            {
+                g_packageDlls.emplace_back();
+                auto& spec = g_packageDlls.back();
+                spec.full_filepath = packageRootPath / dll.path;
+                spec.folded_filename = name;
+                spec.auto_indexed = true;
+            }
+
+            for (auto& spec : g_packageDlls)
+            {
+                std::wstring_view name = spec.folded_filename;
+                spec.filename = name;
+                g_packageDllIndex.emplace(name, &spec);
+                g_packageDllIndex.emplace(name.substr(0, name.length() - 4), &spec);
+            }
+
+            g_packageDllIndexReady.store(true, std::memory_order_release);
+        }
+
+    private:
+        struct candidate
+        {
+            std::wstring path;
+            std::size_t rank;
+            std::size_t depth;
+        };
+
+        std::vector<std::wstring> m_precedence;
+        std::unordered_map<std::wstring, candidate> m_dlls;
+    };
+
+    bool add_prebuilt_index(const std::filesystem::path& packageRootPath, dll_index_builder& builder)
+    {
+        psf::package_index index;
+        if (!index.open(packageRootPath / psf::package_index_file_name))
+        {
+            return false;
+        }
+
+        for (std::size_t i = 0; i < index.size(); ++i)
+        {
+            auto& entry = index.entry_at(i);
+            if ((entry.attributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            {
+                builder.add(index.path_of(entry));
+            }
+        }
+
+        Log("DynamicLibraryFixup using prebuilt package index, entries=%zu", index.size());
+        return true;
+    }
+
+    void add_package_files(const std::filesystem::path& packageRootPath, dll_index_builder& builder)
+    {
+        std::vector<std::wstring> pending{ std::wstring{} };
+        while (!pending.empty())
+        {
+            auto relativePath = std::move(pending.back());
+            pending.pop_back();
+
+            auto searchPath = packageRootPath.native();
+            if (!relativePath.empty())
+            {
+                searchPath.push_back(L'\\');
+                searchPath += relativePath;
+            }
+            searchPath += LR"(\*)";
+
+            WIN32_FIND_DATAW data;
+            auto findHandle = ::FindFirstFileExW(searchPath.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+            if (findHandle == INVALID_HANDLE_VALUE)
+            {
+                // Unlike a missing entry in FileRedirectionFixup's index, a missing DLL here only means a normal search
+                Log("DynamicLibraryFixup could not index %ls, error=%d", searchPath.c_str(), ::GetLastError());
+                continue;
+            }
+
+            do
+            {
+                if ((wcscmp(data.cFileName, L".") == 0) || (wcscmp(data.cFileName, L"..") == 0))
+                {
+                    continue;
+                }
+
+                auto entry = relativePath;
+                if (!entry.empty())
+                {
+                    entry.push_back(L'\\');
+                }
+                entry += data.cFileName;
+
+                // NOTE: Reparse points are not followed, so that we never loop
+                if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                {
+                    if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+                    {
+                        pending.push_back(std::move(entry));
+                    }
+                    continue;
+                }
+
+                psf::make_package_index_key(entry);
+                builder.add(entry);
+            }
+            while (::FindNextFileW(findHandle, &data));
+            ::FindClose(findHandle);
+        }
+    }
+}
+
+void InitializePackageDllIndex(const std::filesystem::path& packageRootPath, const std::vector<std::wstring>& precedence)
+{
+    psf::submit_work([packageRootPath, builder = dll_index_builder(precedence)]() mutable noexcept
+    {
+        try
+        {
+            if (!add_prebuilt_index(packageRootPath, builder))
+            {
+                add_package_files(packageRootPath, builder);
+            }
+
+            builder.publish(packageRootPath);
+            Log("DynamicLibraryFixup package DLL index ready, dlls=%zu", g_packageDlls.size());
+        }
+        catch (...)
+        {
+            Log("DynamicLibraryFixup package DLL index failed with an exception");
+        }
+    }, psf::work_priority::normal);
+}
+
+const dll_location_spec* FindPackageDll(std::wstring_view name) noexcept
+{
+    if (!g_packageDllIndexReady.load(std::memory_order_acquire))
+    {
+        return nullptr;
+    }
+
+    auto itr = g_packageDllIndex.find(name);
+    return (itr != g_packageDllIndex.end()) ? itr->second : nullptr;
+}
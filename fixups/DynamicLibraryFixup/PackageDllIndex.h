@@ -0,0 +1,27 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dll_location_spec.h"
+
+// Rather than having every DLL of the package listed in relativeDllPaths, the fixup can find them itself. Every .dll in
+// the package is indexed by name once, on a background thread, from the index that PsfPackageIndexer generated for the
+// package if it has one, and otherwise by walking the package. DLLs in the VFS folders of the other architecture are
+// left out, since this process could never load them.
+//
+// Where the package has several DLLs of the same name, the one in the earliest of the 'precedence' folders (package
+// relative, e.g. "VFS\ProgramFilesX64\Vendor") wins, then the one closest to the package root, and then the first by
+// path, so that the choice does not depend on the order that the files were found in
+
+void InitializePackageDllIndex(const std::filesystem::path& packageRootPath, const std::vector<std::wstring>& precedence);
+
+// Returns the spec of the package DLL named 'name', folded by fold_dll_name, with or without its ".dll" extension. Returns
+// null if the package has none by that name, or if it has not been indexed yet
+const dll_location_spec* FindPackageDll(std::wstring_view name) noexcept;
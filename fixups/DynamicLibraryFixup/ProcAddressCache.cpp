@@ -0,0 +1,136 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <psf_framework.h>
+
+#include "FunctionImplementations.h"
+#include "ProcAddressCache.h"
+
+// Once full, a module's cache is simply cleared
+static constexpr std::size_t max_cached_exports = 4096;
+
+// Names are views of 'storage', so that lookups can be made with the caller's name as is. Elements of a deque never move,
+// and so neither do the characters of its strings
+struct module_exports
+{
+    std::unordered_map<std::string_view, FARPROC> names;
+    std::unordered_map<WORD, FARPROC> ordinals;
+    std::deque<std::string> storage;
+};
+
+// NOTE: Never held while calling into the loader. The unload notification takes it under the loader lock, so a thread
+//       that holds it while waiting on the loader lock could deadlock
+static std::shared_mutex g_procAddressLock;
+static std::unordered_map<HMODULE, std::unique_ptr<module_exports>> g_moduleExports;
+static std::atomic<unsigned long> g_unloadGeneration{ 0 };
+
+// Handles of modules loaded as data or image resources have their low bits set, and have no exports to resolve
+static bool cacheable_module(HMODULE module) noexcept
+{
+    return module && ((reinterpret_cast<std::uintptr_t>(module) & 3) == 0);
+}
+
+static VOID CALLBACK on_dll_notification(ULONG reason, const winternl::LDR_DLL_LOADED_NOTIFICATION_DATA* data, PVOID) noexcept
+{
+    if (reason != winternl::LDR_DLL_NOTIFICATION_REASON_UNLOADED)
+    {
+        return;
+    }
+
+    std::unique_ptr<module_exports> forgotten;
+    {
+        std::unique_lock<std::shared_mutex> lock(g_procAddressLock);
+        g_unloadGeneration.fetch_add(1, std::memory_order_relaxed);
+        if (auto itr = g_moduleExports.find(static_cast<HMODULE>(data->DllBase)); itr != g_moduleExports.end())
+        {
+            forgotten = std::move(itr->second);
+            g_moduleExports.erase(itr);
+        }
+    }
+}
+
+bool StartProcAddressCache()
+{
+    PVOID cookie;
+    if (!NT_SUCCESS(impl::LdrRegisterDllNotification(0, &on_dll_notification, nullptr, &cookie)))
+    {
+        Log("DynamicLibraryFixup could not watch for modules being unloaded, so does not cache GetProcAddress");
+        return false;
+    }
+
+    return true;
+}
+
+FARPROC FindCachedProcAddress(HMODULE module, LPCSTR procName) noexcept
+{
+    if (!cacheable_module(module))
+    {
+        return nullptr;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(g_procAddressLock);
+    auto moduleItr = g_moduleExports.find(module);
+    if (moduleItr == g_moduleExports.end())
+    {
+        return nullptr;
+    }
+
+    auto& exports = *moduleItr->second;
+    if (IS_INTRESOURCE(procName))
+    {
+        auto itr = exports.ordinals.find(LOWORD(reinterpret_cast<std::uintptr_t>(procName)));
+        return (itr != exports.ordinals.end()) ? itr->second : nullptr;
+    }
+
+    auto itr = exports.names.find(procName);
+    return (itr != exports.names.end()) ? itr->second : nullptr;
+}
+
+unsigned long ProcAddressCacheGeneration() noexcept
+{
+    return g_unloadGeneration.load(std::memory_order_acquire);
+}
+
+void CacheProcAddress(HMODULE module, LPCSTR procName, FARPROC address, unsigned long generation) noexcept try
+{
+    if (!cacheable_module(module) || !address)
+    {
+        return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(g_procAddressLock);
+    if (g_unloadGeneration.load(std::memory_order_relaxed) != generation)
+    {
+        return;
+    }
+
+    auto& exports = g_moduleExports[module];
+    if (!exports || (exports->names.size() + exports->ordinals.size() >= max_cached_exports))
+    {
+        exports = std::make_unique<module_exports>();
+    }
+
+    if (IS_INTRESOURCE(procName))
+    {
+        exports->ordinals.emplace(LOWORD(reinterpret_cast<std::uintptr_t>(procName)), address);
+    }
+    else if (exports->names.find(procName) == exports->names.end())
+    {
+        exports->names.emplace(exports->storage.emplace_back(procName), address);
+    }
+}
+catch (...)
+{
+    // Not caching the address is always fine
+}
@@ -0,0 +1,29 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <windows.h>
+
+// The "cacheProcAddresses" option, for apps - usually those with many plugins - that resolve the same exports of the same
+// modules over and over. GetProcAddress searches the module's export table each time, and for a forwarded export, loads
+// and searches the module it is forwarded to as well. With the option, GetProcAddressFixup remembers what each name or
+// ordinal of a module resolved to, the first time that it resolves, so that resolving it again is a hash lookup. Only
+// successful resolutions are remembered. A module's exports are forgotten once its last reference is released and the
+// loader unloads it, since another module may later be loaded at the same address.
+//
+// The detour is in its own group, so that it is only attached when the option is set
+constexpr char proc_address_cache_group[] = "procAddressCache";
+
+// Starts watching for modules being unloaded. Must be called before the detour is attached
+bool StartProcAddressCache();
+
+// The address that 'procName' - a name, or an ordinal in the low word - was resolved to in 'module' before, or null
+FARPROC FindCachedProcAddress(HMODULE module, LPCSTR procName) noexcept;
+
+// The count of modules unloaded so far. Taken before resolving an export, and handed to CacheProcAddress, so that what's
+// resolved while its module is being unloaded is never cached
+unsigned long ProcAddressCacheGeneration() noexcept;
+
+void CacheProcAddress(HMODULE module, LPCSTR procName, FARPROC address, unsigned long generation) noexcept;
@@ -5,8 +5,28 @@
 //-------------------------------------------------------------------------------------------------------
 #pragma once
 
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <windows.h>
+#include <path_key.h>
+
 struct dll_location_spec
 {
     std::filesystem::path full_filepath;
     std::wstring_view filename;
-};
\ No newline at end of file
+    std::wstring folded_filename; // Upper cased, the same way that the file system compares names
+    bool auto_indexed = false; // Found by PackageDllIndex rather than listed in relativeDllPaths
+};
+
+// Upper cases 'name' in place, the same way that make_package_index_key does
+inline void fold_dll_name(wchar_t* name, std::size_t length) noexcept
+{
+    psf::fold_path(name, length);
+}
+
+// The specs by folded name, built once all of them have been read. A spec whose name ends in ".dll" is also found by its
+// name without the extension, just as before. The keys reference the specs' folded names, which don't change afterwards
+extern std::unordered_map<std::wstring_view, const dll_location_spec*> g_dynf_dllIndex;
\ No newline at end of file
@@ -4,16 +4,61 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
-#define PSF_DEFINE_EXPORTS
+#include <cstring>
+
 #include <psf_framework.h>
 
+#include "ProcAddressCache.h"
 
 void InitializeFixups();
 void InitializeConfiguration();
+void SaveDllLoadOrder() noexcept;
 void Log(const char* fmt, ...);
 
+extern bool g_dynf_cacheProcAddresses;
+
 extern "C" {
 
+    // DllMain has read the configuration by now, so the GetProcAddress detour is only attached when it's going to be used
+    int __stdcall PSFInitialize() noexcept try
+    {
+        psf::attach_all([](const char* group)
+        {
+            return (std::strcmp(group, proc_address_cache_group) != 0) || g_dynf_cacheProcAddresses;
+        });
+        return ERROR_SUCCESS;
+    }
+    catch (...)
+    {
+        return win32_from_caught_exception();
+    }
+
+    int __stdcall PSFUninitialize() noexcept try
+    {
+        psf::detach_all();
+        return ERROR_SUCCESS;
+    }
+    catch (...)
+    {
+        return win32_from_caught_exception();
+    }
+
+    // The DLL load order is saved on detach, so there is nothing else to persist when the process exits
+    int __stdcall PSFFlush() noexcept
+    {
+        return ERROR_SUCCESS;
+    }
+
+#ifdef _M_IX86
+#pragma comment(linker, "/EXPORT:PSFInitialize=_PSFInitialize@0")
+#pragma comment(linker, "/EXPORT:PSFUninitialize=_PSFUninitialize@0")
+#pragma comment(linker, "/EXPORT:PSFFlush=_PSFFlush@0")
+#else
+#pragma comment(linker, "/EXPORT:PSFInitialize=PSFInitialize")
+#pragma comment(linker, "/EXPORT:PSFUninitialize=PSFUninitialize")
+#pragma comment(linker, "/EXPORT:PSFFlush=PSFFlush")
+#endif
+
     BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
     {
         if (reason == DLL_PROCESS_ATTACH)
@@ -23,6 +68,10 @@ extern "C" {
             InitializeFixups();
             InitializeConfiguration();
         }
+        else if (reason == DLL_PROCESS_DETACH)
+        {
+            SaveDllLoadOrder();
+        }
 
         return TRUE;
     }
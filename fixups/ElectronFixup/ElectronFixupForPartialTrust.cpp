@@ -8,22 +8,46 @@
 #include <Windows.h>
 #include <fileapifromapp.h>
 
+constexpr std::size_t uwpPipePrefixLen = 9;
+
 ///
 // detectPipe
 // Given an input string, determines if the string could be a pipe.
 // - Checks for form: \\.\pipe\<token>
 // - Will only allow local pipes
 // - Will not look for local pipes using localhost or 127.0.0.1
-static bool detectPipe(std::wstring_view pipeName);
-static bool detectPipe(std::string_view  pipeName);
+// - Does not convert or allocate anything, so that paths that aren't pipes cost next to nothing
+template <typename CharT>
+static bool detectPipe(const CharT* pipeName) noexcept;
 
 ///
-// getLocalPipeName
+// local_pipe_name
 // Given an input string, prefixs the pipe path with a UWP accepted pipe path
 //  - Converts path: \\.\pipe\<token>
 //               to: \\.\pipe\LOCAL\<token>
-static wide_argument_string_with_buffer getLocalPipeName(LPCWSTR pipeName);
-static wide_argument_string_with_buffer getLocalPipeName(LPCSTR  pipeName);
+// The result is written to a buffer on the stack, since the whole of any pipe name - which can be up to 256 characters
+// long - fits. c_str() is null when the input isn't a local pipe
+class local_pipe_name
+{
+public:
+    template <typename CharT>
+    explicit local_pipe_name(const CharT* pipeName) noexcept;
+
+    local_pipe_name(const local_pipe_name&) = delete;
+    local_pipe_name& operator=(const local_pipe_name&) = delete;
+
+    const wchar_t* c_str() const noexcept
+    {
+        return m_name;
+    }
+
+private:
+    // \\.\pipe\LOCAL\ is 6 characters longer than \\.\pipe\, plus the null terminator
+    static constexpr std::size_t buffer_size = 256 + 6 + 1;
+
+    wchar_t m_buffer[buffer_size];
+    const wchar_t* m_name = nullptr;
+};
 
 template <typename CharT>
 HANDLE WINAPI CreateFileFixup(
@@ -39,10 +63,12 @@ HANDLE WINAPI CreateFileFixup(
     if (guard) 
     {
         // CreateFile also services pipes. Check if the input is a pipe first
-        auto newPipeName = getLocalPipeName(lpFileName);
+        local_pipe_name newPipeName(lpFileName);
         if (newPipeName.c_str())
         {
-            // Pipes must use the native API
+            // Pipes must use the native API. FileRedirectionFixup, when it's loaded too, never redirects pipes, so it's
+            // skipped rather than having it work through the same name again
+            auto bypass = psf::bypass_fixup(psf::reentrancy_owner::file_redirection);
             return impl::CreateFile(newPipeName.c_str(), dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
         }
 
@@ -296,7 +322,13 @@ HANDLE WINAPI CreateNamedPipeFixup(
     _In_ DWORD        nDefaultTimeOut,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
-    return impl::CreateNamedPipe(getLocalPipeName(lpName).c_str(), dwOpenMode, dwPipeMode, nMaxInstances, nOutBufferSize, nInBufferSize, nDefaultTimeOut, lpSecurityAttributes);
+    local_pipe_name localName(lpName);
+    if (localName.c_str())
+    {
+        return impl::CreateNamedPipe(localName.c_str(), dwOpenMode, dwPipeMode, nMaxInstances, nOutBufferSize, nInBufferSize, nDefaultTimeOut, lpSecurityAttributes);
+    }
+
+    return impl::CreateNamedPipe(lpName, dwOpenMode, dwPipeMode, nMaxInstances, nOutBufferSize, nInBufferSize, nDefaultTimeOut, lpSecurityAttributes);
 }
 DECLARE_STRING_FIXUP(impl::CreateNamedPipe, CreateNamedPipeFixup);
 
@@ -310,7 +342,13 @@ BOOL WINAPI CallNamedPipeFixup(
     _Out_ LPDWORD lpBytesRead,
     _In_  DWORD   nTimeOut)
 {
-    return impl::CallNamedPipe(getLocalPipeName(lpNamedPipeName).c_str(), lpInBuffer, nInBufferSize, lpOutBuffer, nOutBufferSize, lpBytesRead, nTimeOut);
+    local_pipe_name localName(lpNamedPipeName);
+    if (localName.c_str())
+    {
+        return impl::CallNamedPipe(localName.c_str(), lpInBuffer, nInBufferSize, lpOutBuffer, nOutBufferSize, lpBytesRead, nTimeOut);
+    }
+
+    return impl::CallNamedPipe(lpNamedPipeName, lpInBuffer, nInBufferSize, lpOutBuffer, nOutBufferSize, lpBytesRead, nTimeOut);
 }
 DECLARE_STRING_FIXUP(impl::CallNamedPipe, CallNamedPipeFixup);
 
@@ -319,68 +357,81 @@ BOOL WINAPI WaitNamedPipeFixup(
     _In_ const CharT* lpNamedPipeName,
     _In_ DWORD        nTimeOut)
 {
-    return impl::WaitNamedPipe(getLocalPipeName(lpNamedPipeName).c_str(), nTimeOut);
-}
-DECLARE_STRING_FIXUP(impl::WaitNamedPipe, WaitNamedPipeFixup);
-
-const static int uwpPipePrefixLen = 9;
-inline static wide_argument_string_with_buffer getLocalPipeName(LPCSTR pipeName)
-{
-    if (pipeName)
-    {
-        return getLocalPipeName(widen_argument(pipeName).c_str());
-    }
-    return wide_argument_string_with_buffer{};
-}
-
-static wide_argument_string_with_buffer getLocalPipeName(LPCWSTR pipeName)
-{
-    if (pipeName)
+    local_pipe_name localName(lpNamedPipeName);
+    if (localName.c_str())
     {
-        if (detectPipe(pipeName))
-        {
-            std::wstring_view name(pipeName);
-            std::wstring formattedPipe{ LR"(\\.\pipe\LOCAL\)" };
-            // Stomp on the server name. In an app container, pipe name must be as follows
-            formattedPipe.append(name.substr(uwpPipePrefixLen));
-            return wide_argument_string_with_buffer{ formattedPipe };
-        }
+        return impl::WaitNamedPipe(localName.c_str(), nTimeOut);
     }
 
-    // Not a valid pipe input so return empty string
-    return wide_argument_string_with_buffer();
-}
-
-inline static bool detectPipe(std::string_view pipeName)
-{
-    return detectPipe(widen(pipeName));
+    return impl::WaitNamedPipe(lpNamedPipeName, nTimeOut);
 }
+DECLARE_STRING_FIXUP(impl::WaitNamedPipe, WaitNamedPipeFixup);
 
-static bool detectPipe(std::wstring_view pipeName)
+template <typename CharT>
+static bool detectPipe(const CharT* pipeName) noexcept
 {
-    // Verify that the name can even fit
-    if (pipeName.size() <= uwpPipePrefixLen)
+    // Nearly all paths are ruled out by their first two characters alone, so check those before anything else
+    if (!psf::is_path_separator(pipeName[0]) || !psf::is_path_separator(pipeName[1]))
     {
         return false;
     }
 
     // Verify pipe path, makes assumptions on the input path as follows
-    auto pathType = psf::path_type(pipeName.data());
+    auto pathType = psf::path_type(pipeName);
     if ((pathType != psf::dos_path_type::local_device) &&
         (pathType != psf::dos_path_type::root_local_device))
     {
         return false;
     }
 
-    // Verify that the name after the path root is pipe/
+    // Verify that the name after the path root is pipe/, followed by at least one character. Comparing one character at
+    // a time never reads past the null terminator of a shorter name
     if (((pipeName[4] != 'p') && (pipeName[4] != 'P')) ||
         ((pipeName[5] != 'i') && (pipeName[5] != 'I')) ||
         ((pipeName[6] != 'p') && (pipeName[6] != 'P')) ||
         ((pipeName[7] != 'e') && (pipeName[7] != 'E')) ||
-        !psf::is_path_separator(pipeName[8]))
+        !psf::is_path_separator(pipeName[8]) ||
+        (pipeName[uwpPipePrefixLen] == '\0'))
     {
         return false;
     }
 
     return true;
 }
+
+template <typename CharT>
+local_pipe_name::local_pipe_name(const CharT* pipeName) noexcept
+{
+    if (!pipeName || !detectPipe(pipeName))
+    {
+        return;
+    }
+
+    // Stomp on the server name. In an app container, pipe name must be as follows
+    constexpr wchar_t localPipePrefix[] = LR"(\\.\pipe\LOCAL\)";
+    constexpr std::size_t localPipePrefixLen = std::size(localPipePrefix) - 1;
+    std::copy_n(localPipePrefix, localPipePrefixLen, m_buffer);
+
+    auto token = pipeName + uwpPipePrefixLen;
+    auto tokenBuffer = m_buffer + localPipePrefixLen;
+    constexpr auto tokenCapacity = buffer_size - localPipePrefixLen;
+    if constexpr (psf::is_ansi<CharT>)
+    {
+        if (::MultiByteToWideChar(CP_UTF8, 0, token, -1, tokenBuffer, static_cast<int>(tokenCapacity)) == 0)
+        {
+            // Either too long to be a valid pipe name, or not valid UTF-8; either way, left for the system to fail
+            return;
+        }
+    }
+    else
+    {
+        auto tokenLength = std::char_traits<wchar_t>::length(token);
+        if (tokenLength >= tokenCapacity)
+        {
+            return;
+        }
+        std::copy_n(token, tokenLength + 1, tokenBuffer);
+    }
+
+    m_name = m_buffer;
+}
@@ -0,0 +1,254 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_set>
+
+#include "AbsentPathCache.h"
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+#include "RedirectRootHandles.h"
+
+namespace
+{
+    std::size_t g_absentPathCacheSize = default_absent_path_cache_size;
+
+    std::shared_mutex g_absentPathsLock;
+    std::unordered_set<std::wstring> g_absentPaths;
+
+    // Incremented (under the exclusive lock) by every notification. A path is only remembered if no notification came in
+    // while its existence was being checked, since otherwise we could be remembering the absence of the very path that
+    // was just created
+    std::uint64_t g_absentPathsGeneration = 0;
+
+    std::shared_mutex g_knownDirectoriesLock;
+    std::unordered_set<std::wstring> g_knownDirectories;
+
+    std::wstring make_key(std::wstring_view path)
+    {
+        std::wstring result(path);
+        for (auto& ch : result)
+        {
+            if (ch == L'/')
+            {
+                ch = L'\\';
+            }
+        }
+
+        while (!result.empty() && (result.back() == L'\\'))
+        {
+            result.pop_back();
+        }
+
+        if (!result.empty())
+        {
+            ::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, result.data(), static_cast<int>(result.length()),
+                result.data(), static_cast<int>(result.length()), nullptr, nullptr, 0);
+        }
+
+        return result;
+    }
+}
+
+void InitializeAbsentPathCache(std::size_t size) noexcept
+{
+    g_absentPathCacheSize = size;
+    Log("\t\tFRF absent path cache size=%zu", size);
+}
+
+// Runs 'query', which returns false when nothing is at 'path', unless 'path' is already known to be absent
+template <typename QueryFn>
+static bool query_redirected_path(const wchar_t* path, QueryFn&& query) noexcept try
+{
+    if (!path || (g_absentPathCacheSize == 0))
+    {
+        return query();
+    }
+
+    auto key = make_key(path);
+    std::uint64_t generation;
+    {
+        std::shared_lock lock(g_absentPathsLock);
+        if (g_absentPaths.find(key) != g_absentPaths.end())
+        {
+            ::SetLastError(ERROR_FILE_NOT_FOUND);
+            return false;
+        }
+        generation = g_absentPathsGeneration;
+    }
+
+    if (query())
+    {
+        return true;
+    }
+
+    // Failures such as ERROR_ACCESS_DENIED say nothing about whether the path is there
+    auto err = ::GetLastError();
+    if ((err == ERROR_FILE_NOT_FOUND) || (err == ERROR_PATH_NOT_FOUND))
+    {
+        std::unique_lock lock(g_absentPathsLock);
+        if (generation == g_absentPathsGeneration)
+        {
+            if (g_absentPaths.size() >= g_absentPathCacheSize)
+            {
+                g_absentPaths.clear();
+            }
+            g_absentPaths.insert(std::move(key));
+        }
+    }
+
+    ::SetLastError(err);
+    return false;
+}
+catch (...)
+{
+    return query();
+}
+
+bool RedirectedPathExists(const wchar_t* path) noexcept
+{
+    return query_redirected_path(path, [&]() noexcept { return QueryRedirectedAttributes(path) != INVALID_FILE_ATTRIBUTES; });
+}
+
+DWORD RedirectedPathAttributes(const wchar_t* path) noexcept
+{
+    DWORD attributes = INVALID_FILE_ATTRIBUTES;
+    query_redirected_path(path, [&]() noexcept
+    {
+        attributes = QueryRedirectedAttributes(path);
+        return attributes != INVALID_FILE_ATTRIBUTES;
+    });
+    return attributes;
+}
+
+BOOL RedirectedPathAttributesEx(const wchar_t* path, GET_FILEEX_INFO_LEVELS infoLevelId, LPVOID fileInformation) noexcept
+{
+    return query_redirected_path(path, [&]() noexcept
+    {
+        return QueryRedirectedAttributesEx(path, infoLevelId, fileInformation) != FALSE;
+    }) ? TRUE : FALSE;
+}
+
+void NotifyRedirectedPathCreated(const wchar_t* path, bool mayHaveChildren) noexcept try
+{
+    if (!path || (g_absentPathCacheSize == 0))
+    {
+        return;
+    }
+
+    auto key = make_key(path);
+
+    std::unique_lock lock(g_absentPathsLock);
+    ++g_absentPathsGeneration;
+    if (g_absentPaths.empty())
+    {
+        return;
+    }
+
+    if (mayHaveChildren)
+    {
+        for (auto itr = g_absentPaths.begin(); itr != g_absentPaths.end(); )
+        {
+            if ((itr->length() > key.length()) && ((*itr)[key.length()] == L'\\') && (itr->compare(0, key.length(), key) == 0))
+            {
+                itr = g_absentPaths.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+    }
+
+    // Creating something implies that all of the folders above it exist too (e.g. ensure_directory_structure)
+    while (!key.empty())
+    {
+        g_absentPaths.erase(key);
+
+        auto pos = key.find_last_of(L'\\');
+        if (pos == std::wstring::npos)
+        {
+            break;
+        }
+        key.resize(pos);
+    }
+}
+catch (...)
+{
+    // Should never happen, but if it does we can no longer trust anything that we've remembered
+    std::unique_lock lock(g_absentPathsLock);
+    ++g_absentPathsGeneration;
+    g_absentPaths.clear();
+}
+
+bool IsKnownRedirectedDirectory(std::wstring_view path) noexcept try
+{
+    if (g_absentPathCacheSize == 0)
+    {
+        return false;
+    }
+
+    auto key = make_key(path);
+    std::shared_lock lock(g_knownDirectoriesLock);
+    return g_knownDirectories.find(key) != g_knownDirectories.end();
+}
+catch (...)
+{
+    return false;
+}
+
+void NotifyRedirectedDirectoryExists(const wchar_t* path) noexcept try
+{
+    if (!path || (g_absentPathCacheSize == 0))
+    {
+        return;
+    }
+
+    auto key = make_key(path);
+    std::unique_lock lock(g_knownDirectoriesLock);
+    if (g_knownDirectories.size() >= g_absentPathCacheSize)
+    {
+        g_knownDirectories.clear();
+    }
+    g_knownDirectories.insert(std::move(key));
+}
+catch (...)
+{
+    // Not remembering a directory is always safe
+}
+
+void NotifyRedirectedPathRemoved(const wchar_t* path) noexcept try
+{
+    NotifyRedirectRootHandlesRemoved(path);
+    if (!path || (g_absentPathCacheSize == 0))
+    {
+        return;
+    }
+
+    auto key = make_key(path);
+
+    // Whatever was removed may have been a directory with others below it (e.g. a directory that was moved elsewhere)
+    std::unique_lock lock(g_knownDirectoriesLock);
+    for (auto itr = g_knownDirectories.begin(); itr != g_knownDirectories.end(); )
+    {
+        if ((itr->length() >= key.length()) && (itr->compare(0, key.length(), key) == 0) &&
+            ((itr->length() == key.length()) || ((*itr)[key.length()] == L'\\')))
+        {
+            itr = g_knownDirectories.erase(itr);
+        }
+        else
+        {
+            ++itr;
+        }
+    }
+}
+catch (...)
+{
+    std::unique_lock lock(g_knownDirectoriesLock);
+    g_knownDirectories.clear();
+}
@@ -0,0 +1,54 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include <windows.h>
+
+// Most of the files that an application reads are never written, so the question "has a copy of this file been made
+// in the redirected area yet?" is asked over and over again with the answer always being "no". Paths in the
+// redirected area that are found to not exist are remembered so that subsequent checks don't need to go to the file
+// system. Only the absence of a path is remembered; whenever one of the fixups creates something in the redirected
+// area, it notifies the cache so that the path - and any folders above it - are forgotten.
+//
+// NOTE: Writes to the redirected area that don't go through this fixup (e.g. by another process in the package) are
+//       not observed unless the redirected area is watched (see ChangeWatcher.h), which is why the cache is bounded in
+//       size and may be disabled through configuration.
+//
+// Similarly, directories in the redirected area that are known to exist are remembered so that ensuring the directory
+// structure for a path only needs to create the folders that are missing, rather than calling CreateDirectory for
+// every component of the path. Fixups that remove or move something out of the redirected area notify the cache so
+// that the directory - and anything below it - is forgotten.
+
+constexpr std::size_t default_absent_path_cache_size = 4096;
+
+// Sets the maximum number of paths that are remembered (each of absent paths and known directories). A size of zero
+// disables the cache
+void InitializeAbsentPathCache(std::size_t size) noexcept;
+
+// Returns true if 'path' exists, remembering the path if it does not
+bool RedirectedPathExists(const wchar_t* path) noexcept;
+
+// The same as GetFileAttributes(Ex) on 'path', except that a path that's known to be absent fails with
+// ERROR_FILE_NOT_FOUND without going to the file system, and that a path that's found to be absent is remembered. Meant
+// for callers that need what's at the path and not just whether it's there, so that they don't have to ask twice
+DWORD RedirectedPathAttributes(const wchar_t* path) noexcept;
+BOOL RedirectedPathAttributesEx(const wchar_t* path, GET_FILEEX_INFO_LEVELS infoLevelId, LPVOID fileInformation) noexcept;
+
+// Must be called after successfully creating, copying, moving, or linking something at 'path' in the redirected area.
+// 'mayHaveChildren' should be true when the operation could have brought an entire directory tree into existence,
+// e.g. when moving or linking a directory
+void NotifyRedirectedPathCreated(const wchar_t* path, bool mayHaveChildren = false) noexcept;
+
+// Returns true if 'path' was previously reported as an existing directory in the redirected area
+bool IsKnownRedirectedDirectory(std::wstring_view path) noexcept;
+
+// Called once 'path' is known to be a directory in the redirected area, e.g. after creating it
+void NotifyRedirectedDirectoryExists(const wchar_t* path) noexcept;
+
+// Must be called after successfully removing, or moving away, something at 'path' in the redirected area
+void NotifyRedirectedPathRemoved(const wchar_t* path) noexcept;
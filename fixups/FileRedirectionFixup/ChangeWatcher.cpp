@@ -0,0 +1,196 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstddef>
+#include <cwchar>
+#include <memory>
+#include <string>
+
+#include <fancy_handle.h>
+#include <known_folders.h>
+
+#include "AbsentPathCache.h"
+#include "ChangeWatcher.h"
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+
+namespace
+{
+    using unique_file = std::unique_ptr<void, psf::handle_deleter<&::CloseHandle>>;
+
+    // Large enough that bursts of changes (e.g. extracting an archive) rarely overflow it, after which everything that
+    // is remembered about the redirected area has to be forgotten
+    constexpr DWORD change_buffer_size = 64 * 1024;
+
+    struct change_watcher
+    {
+        std::wstring directory;
+        std::vector<std::filesystem::path> roots;
+        unique_file handle;
+        PTP_IO io = nullptr;
+        OVERLAPPED overlapped = {};
+        alignas(DWORD) std::byte buffer[change_buffer_size] = {};
+    };
+
+    std::unique_ptr<change_watcher> g_watcher;
+    std::atomic<bool> g_watcherStopping{ false };
+
+    bool is_below_root(const change_watcher& watcher, const std::wstring& path) noexcept
+    {
+        for (auto& root : watcher.roots)
+        {
+            auto& rootString = root.native();
+            if ((path.length() >= rootString.length()) &&
+                (::_wcsnicmp(path.c_str(), rootString.c_str(), rootString.length()) == 0) &&
+                ((path.length() == rootString.length()) || (path[rootString.length()] == L'\\')))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void forget_everything(const change_watcher& watcher) noexcept
+    {
+        for (auto& root : watcher.roots)
+        {
+            NotifyRedirectedPathCreated(root.c_str(), true);
+            NotifyRedirectedPathRemoved(root.c_str());
+        }
+        InvalidateRedirectCache();
+    }
+
+    void handle_changes(const change_watcher& watcher, DWORD size)
+    {
+        std::wstring path;
+        DWORD offset = 0;
+        while (offset + sizeof(FILE_NOTIFY_INFORMATION) <= size)
+        {
+            auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(watcher.buffer + offset);
+            path.assign(watcher.directory);
+            path.push_back(L'\\');
+            path.append(info->FileName, info->FileNameLength / sizeof(wchar_t));
+
+            if (is_below_root(watcher, path))
+            {
+                switch (info->Action)
+                {
+                case FILE_ACTION_ADDED:
+                case FILE_ACTION_RENAMED_NEW_NAME:
+                    NotifyRedirectedPathCreated(path.c_str(), true);
+                    InvalidateRedirectCache(path.c_str());
+                    break;
+
+                case FILE_ACTION_REMOVED:
+                case FILE_ACTION_RENAMED_OLD_NAME:
+                    NotifyRedirectedPathRemoved(path.c_str());
+                    InvalidateRedirectCache(path.c_str());
+                    break;
+                }
+            }
+
+            if (info->NextEntryOffset == 0)
+            {
+                break;
+            }
+            offset += info->NextEntryOffset;
+        }
+    }
+
+    bool start_watching(change_watcher& watcher) noexcept
+    {
+        // NOTE: Only names are watched; what is remembered doesn't depend on the contents of files
+        ::StartThreadpoolIo(watcher.io);
+        if (!::ReadDirectoryChangesW(watcher.handle.get(), watcher.buffer, change_buffer_size, TRUE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME, nullptr, &watcher.overlapped, nullptr))
+        {
+            ::CancelThreadpoolIo(watcher.io);
+            return false;
+        }
+
+        return true;
+    }
+
+    void CALLBACK on_changes(PTP_CALLBACK_INSTANCE, PVOID context, PVOID, ULONG result, ULONG_PTR size, PTP_IO) noexcept try
+    {
+        auto& watcher = *static_cast<change_watcher*>(context);
+        if (g_watcherStopping.load(std::memory_order_acquire) || (result == ERROR_OPERATION_ABORTED))
+        {
+            return;
+        }
+
+        if ((result == NO_ERROR) && (size != 0))
+        {
+            handle_changes(watcher, static_cast<DWORD>(size));
+        }
+        else
+        {
+            // The buffer overflowed (ERROR_NOTIFY_ENUM_DIR or nothing returned), so what changed isn't known
+            forget_everything(watcher);
+        }
+
+        if (!start_watching(watcher))
+        {
+            Log("\t\tFRF stopped watching the redirected area, error=%d", ::GetLastError());
+            forget_everything(watcher);
+        }
+    }
+    catch (...)
+    {
+        forget_everything(*static_cast<change_watcher*>(context));
+    }
+}
+
+void InitializeChangeWatcher(const std::filesystem::path& directory, std::vector<std::filesystem::path> roots)
+{
+    // The redirected area may not have been created yet; it's made on first use otherwise
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    auto watcher = std::make_unique<change_watcher>();
+    watcher->directory = psf::remove_trailing_path_separators(directory).native();
+    watcher->roots = std::move(roots);
+    watcher->handle.reset(impl::CreateFile(watcher->directory.c_str(), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr));
+    if (!watcher->handle)
+    {
+        Log("\t\tFRF could not watch %ls, error=%d", watcher->directory.c_str(), ::GetLastError());
+        return;
+    }
+
+    watcher->io = ::CreateThreadpoolIo(watcher->handle.get(), on_changes, watcher.get(), nullptr);
+    if (!watcher->io)
+    {
+        Log("\t\tFRF could not watch %ls, error=%d", watcher->directory.c_str(), ::GetLastError());
+        return;
+    }
+
+    if (!start_watching(*watcher))
+    {
+        Log("\t\tFRF could not watch %ls, error=%d", watcher->directory.c_str(), ::GetLastError());
+        ::CloseThreadpoolIo(watcher->io);
+        return;
+    }
+
+    Log("\t\tFRF watching %ls for changes", watcher->directory.c_str());
+    g_watcher = std::move(watcher);
+}
+
+void UninitializeChangeWatcher() noexcept
+{
+    if (!g_watcher)
+    {
+        return;
+    }
+
+    g_watcherStopping.store(true, std::memory_order_release);
+    ::CancelIoEx(g_watcher->handle.get(), &g_watcher->overlapped);
+    ::WaitForThreadpoolIoCallbacks(g_watcher->io, FALSE);
+    ::CloseThreadpoolIo(g_watcher->io);
+    g_watcher.reset();
+}
@@ -0,0 +1,23 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+// What the fixup remembers about the redirected area - the paths that are absent, the directories that exist, and the
+// results of ShouldRedirect - is only kept up to date by the fixup's own changes to it. When enabled (through the
+// "watchRedirectedArea" config property), the redirected area is also watched for files and directories that are
+// added, removed, or renamed by anything else, e.g. a helper process of the package that doesn't run the PSF, or the
+// user in Explorer, and whatever is remembered about those paths is forgotten as soon as the change is reported.
+//
+// NOTE: Changes are reported asynchronously, so there is still a short window in which a change made elsewhere isn't
+//       seen. The fixup's own changes are reported as well, and forget what was remembered about them a second time
+
+// Starts watching 'directory', and everything below it, for changes below any of 'roots'
+void InitializeChangeWatcher(const std::filesystem::path& directory, std::vector<std::filesystem::path> roots);
+
+// Stops watching, waiting for a change that is being handled, if any
+void UninitializeChangeWatcher() noexcept;
@@ -3,8 +3,14 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
+#include "FileCopy.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("CopyFile");
 
 template <typename CharT>
 BOOL __stdcall CopyFileFixup(_In_ const CharT* existingFileName, _In_ const CharT* newFileName, _In_ BOOL failIfExists) noexcept
@@ -14,7 +20,8 @@ BOOL __stdcall CopyFileFixup(_In_ const CharT* existingFileName, _In_ const Char
     {
         if (guard)
         {
-            DWORD CopyFileInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD CopyFileInstance = psf::next_interception_id();
             LogString(CopyFileInstance,L"CopyFileFixup from", existingFileName);
             LogString(CopyFileInstance,L"CopyFileFixup to",   newFileName);
 
@@ -29,22 +36,41 @@ BOOL __stdcall CopyFileFixup(_In_ const CharT* existingFileName, _In_ const Char
             //       delete a file in its package path.
             auto [redirectSource, sourceRedirectPath,shouldReadonlySource] = ShouldRedirect(existingFileName, redirect_flags::check_file_presence);
             auto [redirectDest, destRedirectPath,shouldReadonlyDest] = ShouldRedirect(newFileName, redirect_flags::ensure_directory_structure);
+            if (redirectSource)
+            {
+                FlushPendingProfile(sourceRedirectPath.c_str());
+            }
+            if (redirectDest)
+            {
+                FlushPendingProfile(destRedirectPath.c_str());
+            }
+            std::wstring source;
             if (redirectSource )
             {
-                return impl::CopyFile(
-                    sourceRedirectPath.c_str(),
-                    redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str(),
-                    failIfExists);
+                source = sourceRedirectPath.native();
             }
             else
             {
-                auto path = widen(existingFileName, CP_ACP);
-                std::filesystem::path vfspath = GetPackageVFSPath(path.c_str());
-                return impl::CopyFile(
-                    vfspath.has_filename() ? vfspath.c_str() : path.c_str(),
-                    redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str(),
-                    failIfExists);
+                source = widen(existingFileName, CP_ACP);
+                std::filesystem::path vfspath = GetPackageVFSPath(source.c_str());
+                if (vfspath.has_filename())
+                {
+                    source = vfspath.native();
+                }
+            }
+
+            if (!redirectDest)
+            {
+                return impl::CopyFile(source.c_str(), widen_argument(newFileName).c_str(), failIfExists);
             }
+
+            // Copies into the redirected area can share the source's clusters when the volume allows it
+            auto result = CopyFileToRedirectedArea(source.c_str(), destRedirectPath.c_str(), failIfExists != FALSE);
+            if (result)
+            {
+                NotifyRedirectedPathCreated(destRedirectPath.c_str());
+            }
+            return result;
         }
     }
     catch (...)
@@ -70,7 +96,8 @@ BOOL __stdcall CopyFileExFixup(
     {
         if (guard)
         {
-            DWORD CopyFileExInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD CopyFileExInstance = psf::next_interception_id();
             LogString(CopyFileExInstance,L"CopyFileExFixup from", existingFileName);
             LogString(CopyFileExInstance,L"CopyFileExFixup to",   newFileName);
 
@@ -79,25 +106,71 @@ BOOL __stdcall CopyFileExFixup(
             auto [redirectDest, destRedirectPath,shouldReadonlyDest] = ShouldRedirect(newFileName, redirect_flags::ensure_directory_structure);
             if (redirectSource)
             {
-                return impl::CopyFileEx(
+                FlushPendingProfile(sourceRedirectPath.c_str());
+            }
+            if (redirectDest)
+            {
+                FlushPendingProfile(destRedirectPath.c_str());
+            }
+
+            // Plain copies into the redirected area can be cloned, but progress, cancellation, and the other copy
+            // flags are only supported by CopyFileEx itself
+            if (redirectDest && !progressRoutine && !cancel && ((copyFlags & ~COPY_FILE_FAIL_IF_EXISTS) == 0))
+            {
+                std::wstring source;
+                if (redirectSource)
+                {
+                    source = sourceRedirectPath.native();
+                }
+                else
+                {
+                    source = widen(existingFileName, CP_ACP);
+                    std::filesystem::path vfspath = GetPackageVFSPath(source.c_str());
+                    if (vfspath.has_filename())
+                    {
+                        source = vfspath.native();
+                    }
+                }
+
+                auto result = CopyFileToRedirectedArea(source.c_str(), destRedirectPath.c_str(), (copyFlags & COPY_FILE_FAIL_IF_EXISTS) != 0);
+                if (result)
+                {
+                    NotifyRedirectedPathCreated(destRedirectPath.c_str());
+                }
+                return result;
+            }
+
+            if (redirectSource)
+            {
+                auto result = impl::CopyFileEx(
                     sourceRedirectPath.c_str(),
                     redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str(),
                     progressRoutine,
                     data,
                     cancel,
                     copyFlags);
+                if (result && redirectDest)
+                {
+                    NotifyRedirectedPathCreated(destRedirectPath.c_str());
+                }
+                return result;
             }
             else
             {
                 auto path = widen(existingFileName, CP_ACP);
                 std::filesystem::path vfspath = GetPackageVFSPath(path.c_str());
-                return impl::CopyFileEx(
+                auto result = impl::CopyFileEx(
                     vfspath.has_filename() ? vfspath.c_str() : path.c_str(),
                     redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str(),
                     progressRoutine,
                     data,
                     cancel,
                     copyFlags);
+                if (result && redirectDest)
+                {
+                    NotifyRedirectedPathCreated(destRedirectPath.c_str());
+                }
+                return result;
             }
         }
     }
@@ -120,7 +193,8 @@ HRESULT __stdcall CopyFile2Fixup(
     {
         if (guard)
         {
-            DWORD CopyFile2Instance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD CopyFile2Instance = psf::next_interception_id();
             LogString(CopyFile2Instance,L"CopyFile2Fixup from", existingFileName);
             LogString(CopyFile2Instance,L"CopyFile2Fixup to",   newFileName);
 
@@ -129,20 +203,65 @@ HRESULT __stdcall CopyFile2Fixup(
             auto [redirectDest, destRedirectPath, shouldReadonlyDest] = ShouldRedirect(newFileName, redirect_flags::ensure_directory_structure);
             if (redirectSource)
             {
-                return impl::CopyFile2(
+                FlushPendingProfile(sourceRedirectPath.c_str());
+            }
+            if (redirectDest)
+            {
+                FlushPendingProfile(destRedirectPath.c_str());
+            }
+
+            // As with CopyFileEx, plain copies into the redirected area can be cloned
+            DWORD copyFlags = extendedParameters ? extendedParameters->dwCopyFlags : 0;
+            bool plainCopy = !extendedParameters ||
+                (!extendedParameters->pfCancel && !extendedParameters->pProgressRoutine && ((copyFlags & ~COPY_FILE_FAIL_IF_EXISTS) == 0));
+            if (redirectDest && plainCopy)
+            {
+                std::wstring source;
+                if (redirectSource)
+                {
+                    source = sourceRedirectPath.native();
+                }
+                else
+                {
+                    std::filesystem::path vfspath = GetPackageVFSPath(existingFileName);
+                    source = vfspath.has_filename() ? vfspath.native() : std::wstring(existingFileName);
+                }
+
+                if (!CopyFileToRedirectedArea(source.c_str(), destRedirectPath.c_str(), (copyFlags & COPY_FILE_FAIL_IF_EXISTS) != 0))
+                {
+                    return HRESULT_FROM_WIN32(::GetLastError());
+                }
+
+                NotifyRedirectedPathCreated(destRedirectPath.c_str());
+                return S_OK;
+            }
+
+            if (redirectSource)
+            {
+                auto result = impl::CopyFile2(
                     sourceRedirectPath.c_str(),
                     redirectDest ? destRedirectPath.c_str() : newFileName,
                     extendedParameters);
+                if (SUCCEEDED(result) && redirectDest)
+                {
+                    NotifyRedirectedPathCreated(destRedirectPath.c_str());
+                }
+                return result;
             }
 
             else
             {
                 auto path = widen(existingFileName, CP_ACP);
                 std::filesystem::path vfspath = GetPackageVFSPath(path.c_str());
-                return impl::CopyFile2(
+                auto result = impl::CopyFile2(
                     vfspath.has_filename() ? vfspath.c_str() : existingFileName,
                     redirectDest ? destRedirectPath.c_str() : newFileName,
                     extendedParameters);
+                if (SUCCEEDED(result) && redirectDest)
+                {
+                    NotifyRedirectedPathCreated(destRedirectPath.c_str());
+                }
+                return result;
             }
         }
     }
@@ -0,0 +1,330 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cwchar>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <package_index.h>
+#include <psf_utils.h>
+
+#include "CopyJournal.h"
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+
+namespace
+{
+    constexpr wchar_t copy_journal_file_name[] = L"PsfCopies.log";
+
+    // Journals larger than this are assumed to be corrupt, and are ignored
+    constexpr LONGLONG max_copy_journal_size = 16 * 1024 * 1024;
+
+    bool g_copyJournalEnabled = false;
+    std::filesystem::path g_copyJournalPath;
+
+    // Serializes changes to the journal with the other processes of the package, which share the redirected area
+    HANDLE g_copyJournalMutex = nullptr;
+
+    class copy_journal_lock
+    {
+    public:
+        copy_journal_lock() noexcept
+        {
+            if (g_copyJournalMutex)
+            {
+                // NOTE: An abandoned mutex is owned all the same, and lines are never left half written
+                auto result = ::WaitForSingleObject(g_copyJournalMutex, INFINITE);
+                m_owned = (result == WAIT_OBJECT_0) || (result == WAIT_ABANDONED);
+            }
+        }
+
+        ~copy_journal_lock()
+        {
+            if (m_owned)
+            {
+                ::ReleaseMutex(g_copyJournalMutex);
+            }
+        }
+
+        copy_journal_lock(const copy_journal_lock&) = delete;
+        copy_journal_lock& operator=(const copy_journal_lock&) = delete;
+
+    private:
+        bool m_owned = false;
+    };
+
+    // Each line is "+<process id> <path>" when a copy starts, and "-<process id> <path>" when it's done
+    struct journal_record
+    {
+        bool started = false;
+        DWORD processId = 0;
+        std::wstring path;
+    };
+
+    std::wstring format_record(wchar_t kind, DWORD processId, const std::wstring& path)
+    {
+        wchar_t prefix[16];
+        std::swprintf(prefix, std::size(prefix), L"%lc%lu ", kind, processId);
+        return prefix + path + L'\n';
+    }
+
+    bool parse_record(std::wstring_view line, journal_record& record)
+    {
+        if (line.empty() || ((line[0] != L'+') && (line[0] != L'-')))
+        {
+            return false;
+        }
+        record.started = (line[0] == L'+');
+
+        auto separator = line.find(L' ');
+        if ((separator == std::wstring_view::npos) || (separator < 2) || (separator + 1 >= line.length()))
+        {
+            return false;
+        }
+
+        record.processId = 0;
+        for (auto ch : line.substr(1, separator - 1))
+        {
+            if ((ch < L'0') || (ch > L'9'))
+            {
+                return false;
+            }
+            record.processId = record.processId * 10 + static_cast<DWORD>(ch - L'0');
+        }
+
+        record.path.assign(line.substr(separator + 1));
+        return true;
+    }
+
+    void read_journal(std::vector<journal_record>& records)
+    {
+        auto file = impl::CreateFile(g_copyJournalPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+
+        LARGE_INTEGER size{};
+        std::wstring contents;
+        if (::GetFileSizeEx(file, &size) && (size.QuadPart > 0) && (size.QuadPart <= max_copy_journal_size))
+        {
+            contents.resize(static_cast<std::size_t>(size.QuadPart) / sizeof(wchar_t));
+            DWORD bytesRead = 0;
+            if (!::ReadFile(file, contents.data(), static_cast<DWORD>(contents.length() * sizeof(wchar_t)), &bytesRead, nullptr))
+            {
+                bytesRead = 0;
+            }
+            contents.resize(bytesRead / sizeof(wchar_t));
+        }
+        ::CloseHandle(file);
+
+        std::size_t start = 0;
+        while (start < contents.length())
+        {
+            auto end = contents.find(L'\n', start);
+            if (end == std::wstring::npos)
+            {
+                // Only the last line can be incomplete, e.g. if the process that was writing it was terminated
+                break;
+            }
+
+            journal_record record;
+            if (parse_record(std::wstring_view(contents).substr(start, end - start), record))
+            {
+                records.push_back(std::move(record));
+            }
+            start = end + 1;
+        }
+    }
+
+    bool append_to_journal(const std::wstring& line)
+    {
+        auto openJournal = []
+        {
+            return impl::CreateFile(g_copyJournalPath.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        };
+
+        auto file = openJournal();
+        if ((file == INVALID_HANDLE_VALUE) && (::GetLastError() == ERROR_PATH_NOT_FOUND))
+        {
+            // Nothing has been redirected yet
+            std::error_code ec;
+            std::filesystem::create_directories(g_copyJournalPath.parent_path(), ec);
+            file = openJournal();
+        }
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        // Written in one go, so that other processes never see part of a line
+        DWORD bytesWritten = 0;
+        auto result = ::WriteFile(file, line.data(), static_cast<DWORD>(line.length() * sizeof(wchar_t)), &bytesWritten, nullptr);
+        ::CloseHandle(file);
+        return result && (bytesWritten == line.length() * sizeof(wchar_t));
+    }
+
+    // Replaces the journal with just 'lines', or deletes it if there are none
+    bool rewrite_journal(const std::vector<std::wstring>& lines)
+    {
+        if (lines.empty())
+        {
+            return impl::DeleteFile(g_copyJournalPath.c_str()) || (::GetLastError() == ERROR_FILE_NOT_FOUND);
+        }
+
+        std::wstring contents;
+        for (auto& line : lines)
+        {
+            contents += line;
+        }
+
+        auto tempPath = g_copyJournalPath.native() + L".new";
+        auto file = impl::CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        DWORD bytesWritten = 0;
+        auto written = ::WriteFile(file, contents.data(), static_cast<DWORD>(contents.length() * sizeof(wchar_t)), &bytesWritten, nullptr) &&
+            (bytesWritten == contents.length() * sizeof(wchar_t));
+        ::CloseHandle(file);
+
+        if (!written || !impl::MoveFileEx(tempPath.c_str(), g_copyJournalPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            impl::DeleteFile(tempPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    // NOTE: A process id that has since been reused by an unrelated process just means that the copy's record is kept
+    //       until a later replay
+    bool is_process_running(DWORD processId) noexcept
+    {
+        if (processId == ::GetCurrentProcessId())
+        {
+            // Left by an earlier process with the same id, since this one hasn't copied anything yet
+            return false;
+        }
+
+        auto process = ::OpenProcess(SYNCHRONIZE, FALSE, processId);
+        if (!process)
+        {
+            // Either gone, or not ours to look at, in which case it's not a process of the package
+            return ::GetLastError() == ERROR_ACCESS_DENIED;
+        }
+
+        auto running = ::WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+        ::CloseHandle(process);
+        return running;
+    }
+}
+
+void InitializeCopyJournal(const std::filesystem::path& directory)
+{
+    g_copyJournalPath = directory / copy_journal_file_name;
+    g_copyJournalMutex = ::CreateMutexW(nullptr, FALSE, (L"Local\\PsfCopyJournal-" + psf::current_package_family_name()).c_str());
+
+    // NOTE: This runs before the hooks are attached, so there's no concern about redirecting our own file access
+    copy_journal_lock lock;
+    std::vector<journal_record> records;
+    read_journal(records);
+
+    // The last copy to each path, keyed on the case folded path, if it was started but never finished. A copy that was
+    // cut short and then made again by another process is superseded by the later copy, which must be kept
+    std::map<std::wstring, const journal_record*> unfinished;
+    for (auto& record : records)
+    {
+        auto key = record.path;
+        psf::make_package_index_key(key);
+        if (record.started)
+        {
+            unfinished[std::move(key)] = &record;
+        }
+        else if (auto itr = unfinished.find(key); (itr != unfinished.end()) && (itr->second->processId == record.processId))
+        {
+            unfinished.erase(itr);
+        }
+    }
+
+    std::vector<std::wstring> inFlight;
+    std::size_t removed = 0;
+    for (auto& entry : unfinished)
+    {
+        auto record = entry.second;
+        if (is_process_running(record->processId))
+        {
+            inFlight.push_back(format_record(L'+', record->processId, record->path));
+        }
+        else if (impl::DeleteFile(record->path.c_str()) || (::GetLastError() == ERROR_FILE_NOT_FOUND))
+        {
+            ++removed;
+            LogString(L"\t\tFRF removed an unfinished copy", record->path.c_str());
+        }
+        else
+        {
+            // E.g. the file is in use; try again the next time
+            inFlight.push_back(format_record(L'+', record->processId, record->path));
+        }
+    }
+
+    if (!records.empty() && !rewrite_journal(inFlight))
+    {
+        Log("\t\tFRF copy journal could not be compacted, error=%d", ::GetLastError());
+    }
+
+    g_copyJournalEnabled = true;
+    Log("\t\tFRF copy journal: records=%zu unfinished copies removed=%zu in flight=%zu", records.size(), removed, inFlight.size());
+}
+
+journaled_copy::journaled_copy(const wchar_t* destination) noexcept
+{
+    if (!g_copyJournalEnabled || !destination)
+    {
+        return;
+    }
+
+    try
+    {
+        m_destination = destination;
+        copy_journal_lock lock;
+        m_recorded = append_to_journal(format_record(L'+', ::GetCurrentProcessId(), m_destination));
+        if (!m_recorded)
+        {
+            // The copy is made all the same, just without the protection
+            Log("\t\tFRF copy could not be journaled, error=%d", ::GetLastError());
+        }
+    }
+    catch (...)
+    {
+    }
+}
+
+journaled_copy::~journaled_copy()
+{
+    if (!m_recorded)
+    {
+        return;
+    }
+
+    // Must leave the outcome of the copy alone for the caller
+    auto err = ::GetLastError();
+    try
+    {
+        copy_journal_lock lock;
+        append_to_journal(format_record(L'-', ::GetCurrentProcessId(), m_destination));
+    }
+    catch (...)
+    {
+    }
+    ::SetLastError(err);
+}
@@ -0,0 +1,38 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+// Copying a package file into the redirected area isn't atomic. A process that is terminated part way through a copy
+// leaves a partial file behind, which from then on looks like a copy that the application made, so that the rest of the
+// package's file is never seen again. When enabled (through the "journalCopies" config property), every copy into the
+// redirected area is recorded in an append-only journal before it starts, and again once it's done. The first process
+// of the package to start afterwards replays the journal and deletes whatever was left by copies that never finished,
+// so that they are made again the next time they're needed.
+//
+// Copies are recorded along with the process that made them, so that copies that another process of the package is
+// still making aren't mistaken for ones that were cut short.
+
+// Replays the journal in 'directory', and from then on records the copies made by this process in it. Until this is
+// called, journaled_copy does nothing
+void InitializeCopyJournal(const std::filesystem::path& directory);
+
+// Records a copy to 'destination', a path in the redirected area, for as long as the object lives. Meant to be held
+// around the copy itself, after having made sure that the copy needs to be made
+class journaled_copy
+{
+public:
+    explicit journaled_copy(const wchar_t* destination) noexcept;
+    ~journaled_copy();
+
+    journaled_copy(const journaled_copy&) = delete;
+    journaled_copy& operator=(const journaled_copy&) = delete;
+
+private:
+    std::wstring m_destination;
+    bool m_recorded = false;
+};
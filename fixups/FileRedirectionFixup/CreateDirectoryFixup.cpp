@@ -3,8 +3,12 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("CreateDirectory");
 
 template <typename CharT>
 BOOL __stdcall CreateDirectoryFixup(_In_ const CharT* pathName, _In_opt_ LPSECURITY_ATTRIBUTES securityAttributes) noexcept
@@ -12,9 +16,10 @@ BOOL __stdcall CreateDirectoryFixup(_In_ const CharT* pathName, _In_opt_ LPSECUR
     auto guard = g_reentrancyGuard.enter();
     try
     {
-        if (guard)
+        if (guard && !IsRedirectionBypassed(pathName))
         {
-            DWORD CreateDirectoryInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD CreateDirectoryInstance = psf::next_interception_id();
             LogString(CreateDirectoryInstance,L"CreateDirectoryFixup for path", pathName);
             
             if (!IsUnderUserAppDataLocalPackages(pathName))
@@ -22,7 +27,12 @@ BOOL __stdcall CreateDirectoryFixup(_In_ const CharT* pathName, _In_opt_ LPSECUR
                 auto [shouldRedirect, redirectPath, shouldReadonlySource] = ShouldRedirect(pathName, redirect_flags::ensure_directory_structure, CreateDirectoryInstance);
                 if (shouldRedirect)
                 {
-                    return impl::CreateDirectory(redirectPath.c_str(), securityAttributes);
+                    auto result = impl::CreateDirectory(redirectPath.c_str(), securityAttributes);
+                    if (result)
+                    {
+                        NotifyRedirectedPathCreated(redirectPath.c_str());
+                    }
+                    return result;
                 }
             }
             else
@@ -38,7 +48,7 @@ BOOL __stdcall CreateDirectoryFixup(_In_ const CharT* pathName, _In_opt_ LPSECUR
 
     return impl::CreateDirectory(pathName, securityAttributes);
 }
-DECLARE_STRING_FIXUP(impl::CreateDirectory, CreateDirectoryFixup);
+DECLARE_WIDENED_STRING_FIXUP(impl::CreateDirectory, CreateDirectoryFixup);
 
 template <typename CharT>
 BOOL __stdcall CreateDirectoryExFixup(
@@ -51,7 +61,8 @@ BOOL __stdcall CreateDirectoryExFixup(
     {
         if (guard)
         {
-            DWORD CreateDirectoryExInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD CreateDirectoryExInstance = psf::next_interception_id();
 
             LogString(CreateDirectoryExInstance,L"CreateDirectoryExFixup for", templateDirectory);
             LogString(CreateDirectoryExInstance,L"CreateDirectoryExFixup to",  newDirectory);
@@ -60,10 +71,15 @@ BOOL __stdcall CreateDirectoryExFixup(
             auto [redirectDest, redirectDestPath,shouldReadonlyDest] = ShouldRedirect(newDirectory, redirect_flags::ensure_directory_structure, CreateDirectoryExInstance);
             if (redirectTemplate || redirectDest)
             {
-                return impl::CreateDirectoryEx(
+                auto result = impl::CreateDirectoryEx(
                     redirectTemplate ? redirectTemplatePath.c_str() : widen_argument(templateDirectory).c_str(),
                     redirectDest ? redirectDestPath.c_str() : widen_argument(newDirectory).c_str(),
                     securityAttributes);
+                if (result && redirectDest)
+                {
+                    NotifyRedirectedPathCreated(redirectDestPath.c_str());
+                }
+                return result;
             }
         }
     }
@@ -3,8 +3,19 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
+#include "CopyJournal.h"
+#include "FileCopy.h"
 #include "FunctionImplementations.h"
+#include "LazyLinks.h"
+#include "PackageContentIndex.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "ReadPrefetch.h"
+#include "RedirectionStatistics.h"
+#include "WhiteoutIndex.h"
+
+static fixup_statistics g_statistics("CreateFile");
 
 /// ConvertToReadOnlyAccess: Modify a file operation call if it requests write access to one without write access.
 DWORD inline ConvertToReadOnlyAccess(DWORD desiredAccess)
@@ -34,16 +45,79 @@ DWORD inline ConvertToReadOnlyAccess(DWORD desiredAccess)
     }
     if ((desiredAccess & FILE_WRITE_ATTRIBUTES) != 0)
     {
-        redirectedAccess &= FILE_WRITE_ATTRIBUTES;
+        redirectedAccess &= ~FILE_WRITE_ATTRIBUTES;
     }
     if ((desiredAccess & FILE_WRITE_EA) != 0)
     {
-        redirectedAccess &= FILE_WRITE_EA;
+        redirectedAccess &= ~FILE_WRITE_EA;
     }
     return redirectedAccess;
 }
 
+// With lazy copy-on-write, opens that cannot modify the file are served from the package in place
+bool inline IsReadOnlyOpen(DWORD desiredAccess, DWORD creationDisposition, DWORD flagsAndAttributes)
+{
+    constexpr DWORD writeAccess = GENERIC_WRITE | GENERIC_ALL | MAXIMUM_ALLOWED | FILE_WRITE_DATA | FILE_APPEND_DATA |
+        FILE_WRITE_ATTRIBUTES | FILE_WRITE_EA | DELETE | WRITE_DAC | WRITE_OWNER;
+    return (creationDisposition == OPEN_EXISTING) && ((desiredAccess & writeAccess) == 0) &&
+        ((flagsAndAttributes & FILE_FLAG_DELETE_ON_CLOSE) == 0);
+}
+
+// Opens that discard the contents of the file never need a copy of the package's version
+bool inline IsTruncatingOpen(DWORD creationDisposition)
+{
+    return (creationDisposition == CREATE_ALWAYS) || (creationDisposition == TRUNCATE_EXISTING);
+}
 
+// Opens of files under isReadOnly specs that can be served from the package without changing their outcome
+bool inline IsInPlaceDisposition(DWORD creationDisposition)
+{
+    return (creationDisposition == OPEN_EXISTING) || (creationDisposition == OPEN_ALWAYS);
+}
+
+// Chooses how much work ShouldRedirect needs to do for an open. Opens that truncate the file just need the directory
+// to exist. Otherwise any open copies the file into the redirected area, unless lazy copy-on-write is enabled, in which
+// case read-only opens don't need the file to be copied, or the file turns out to be under an isReadOnly spec and
+// read-only in place is enabled
+redirect_flags inline CreateFileRedirectFlags(DWORD desiredAccess, DWORD creationDisposition, DWORD flagsAndAttributes)
+{
+    if (IsTruncatingOpen(creationDisposition))
+    {
+        return redirect_flags::ensure_directory_structure;
+    }
+    else if (g_lazyCopyOnWrite && IsReadOnlyOpen(desiredAccess, creationDisposition, flagsAndAttributes))
+    {
+        return redirect_flags::none;
+    }
+    else if (g_readOnlyInPlace && IsInPlaceDisposition(creationDisposition))
+    {
+        return redirect_flags::copy_on_read | redirect_flags::read_only_in_place;
+    }
+
+    return redirect_flags::copy_on_read;
+}
+
+// The package's version of 'fileName', or an empty string if the package has no such file or the application has since
+// deleted it (see WhiteoutIndex.h)
+template <typename CharT>
+std::wstring VisiblePackageSourcePath(const CharT* fileName, const std::filesystem::path& redirectPath)
+{
+    return IsWhitedOut(redirectPath.native()) ? std::wstring{} : PackageSourcePath(fileName);
+}
+
+// Returns the package's version of a file under an isReadOnly spec that is to be opened in place, or an empty string if
+// the open needs to go to the redirected area, e.g. because the file was copied there before read-only in place was enabled
+template <typename CharT>
+std::wstring ReadOnlyInPlacePath(const CharT* fileName, redirect_flags redirectFlags, bool shouldReadonly, const std::filesystem::path& redirectPath)
+{
+    if (!shouldReadonly || !flag_set(redirectFlags, redirect_flags::read_only_in_place) || RedirectedPathExists(redirectPath.c_str()))
+    {
+        return {};
+    }
+
+    auto sourcePath = VisiblePackageSourcePath(fileName, redirectPath);
+    return (!sourcePath.empty() && impl::PathExists(sourcePath.c_str())) ? sourcePath : std::wstring{};
+}
 
 template <typename CharT>
 HANDLE __stdcall CreateFileFixup(
@@ -58,51 +132,99 @@ HANDLE __stdcall CreateFileFixup(
     auto guard = g_reentrancyGuard.enter();
     try
     {
-        if (guard)
+        if (guard && !IsRedirectionBypassed(fileName))
         {
-            DWORD CreateFileInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD CreateFileInstance = psf::next_interception_id();
 
-            LogString(CreateFileInstance, L"CreateFileFixup for fileName", widen(fileName, CP_ACP).c_str());
+            LogString(CreateFileInstance, L"CreateFileFixup for fileName", widen_argument(fileName, CP_ACP).c_str());
 
             if (!IsUnderUserAppDataLocalPackages(fileName))
             {
-                // FUTURE: If 'creationDisposition' is something like 'CREATE_ALWAYS', we could get away with something
-                //         cheaper than copy-on-read, but we'd also need to be mindful of ensuring the correct error if so
-                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read, CreateFileInstance);
+                auto redirectFlags = CreateFileRedirectFlags(desiredAccess, creationDisposition, flagsAndAttributes);
+                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirectFlags, CreateFileInstance);
                 if (shouldRedirect)
                 {
-                    if (IsUnderUserAppDataLocal(fileName))
+                    FlushPendingProfile(redirectPath.c_str());
+
+                    // Until something asks to write to it, lazy copy-on-write leaves the file in the package
+                    if ((redirectFlags == redirect_flags::none) && !RedirectedPathExists(redirectPath.c_str()))
+                    {
+                        if (auto sourcePath = VisiblePackageSourcePath(fileName, redirectPath); !sourcePath.empty())
+                        {
+                            LogString(CreateFileInstance, L"\tFRF CreateFile read-only open in place", sourcePath.c_str());
+                            return RecordReadOpen(impl::CreateFile(sourcePath.c_str(), desiredAccess, shareMode, securityAttributes, creationDisposition, flagsAndAttributes, templateFile),
+                                desiredAccess, creationDisposition);
+                        }
+                    }
+
+                    // Files under isReadOnly specs can't be modified anyway, so with read-only in place they are never copied
+                    if (auto sourcePath = ReadOnlyInPlacePath(fileName, redirectFlags, shouldReadonly, redirectPath); !sourcePath.empty())
+                    {
+                        LogString(CreateFileInstance, L"\tFRF CreateFile read-only spec open in place", sourcePath.c_str());
+                        HANDLE hRet = impl::CreateFile(sourcePath.c_str(), ConvertToReadOnlyAccess(desiredAccess), shareMode, securityAttributes, OPEN_EXISTING, flagsAndAttributes, templateFile);
+                        if ((hRet != INVALID_HANDLE_VALUE) && (creationDisposition == OPEN_ALWAYS))
+                        {
+                            ::SetLastError(ERROR_ALREADY_EXISTS);
+                        }
+                        return RecordReadOpen(hRet, desiredAccess, creationDisposition);
+                    }
+
+                    // When only the package has the file, truncating opens still need to behave as though it had been copied:
+                    // TRUNCATE_EXISTING must succeed, and CREATE_ALWAYS must report ERROR_ALREADY_EXISTS
+                    bool replacesPackageFile = false;
+                    auto redirectedDisposition = creationDisposition;
+                    if (IsTruncatingOpen(creationDisposition) && !RedirectedPathExists(redirectPath.c_str()))
+                    {
+                        auto sourcePath = VisiblePackageSourcePath(fileName, redirectPath);
+                        replacesPackageFile = !sourcePath.empty() && impl::PathExists(sourcePath.c_str());
+                        if (replacesPackageFile)
+                        {
+                            redirectedDisposition = CREATE_ALWAYS;
+                        }
+                    }
+
+                    bool copyFile = flag_set(redirectFlags, redirect_flags::copy_file);
+                    if (copyFile && IsUnderUserAppDataLocal(fileName))
                     {
                         Log(L"[%d]Under LocalAppData", CreateFileInstance);
                         // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
                         std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
                         if (wcslen(PackageVersion.c_str()) >= 0)
                         {
-                            if (impl::PathExists(PackageVersion.c_str()))
+                            if (PackagePathExists(PackageVersion.c_str()) && !IsWhitedOut(redirectPath.native()))
                             {
-                                if (!impl::PathExists(redirectPath.c_str()))
+                                if (!RedirectedPathExists(redirectPath.c_str()))
                                 {
                                     // Need to copy now
                                     LogString(CreateFileInstance, L"\tFRF CreateFile COA from ADL to", redirectPath.c_str());
-                                    impl::CopyFileW(PackageVersion.c_str(), redirectPath.c_str(), true);
+                                    journaled_copy journal(redirectPath.c_str());
+                                    if (CopyFileToRedirectedArea(PackageVersion.c_str(), redirectPath.c_str(), true))
+                                    {
+                                        NotifyRedirectedPathCreated(redirectPath.c_str());
+                                    }
                                 }
                             }
                         }
                     }
-                    else if (IsUnderUserAppDataRoaming(fileName))
+                    else if (copyFile && IsUnderUserAppDataRoaming(fileName))
                     {
                         Log(L"[%d]Under AppData(roaming)", CreateFileInstance);
                         // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
                         std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
                         if (wcslen(PackageVersion.c_str()) >= 0)
                         {
-                            if (impl::PathExists(PackageVersion.c_str()))
+                            if (PackagePathExists(PackageVersion.c_str()) && !IsWhitedOut(redirectPath.native()))
                             {
-                                if (!impl::PathExists(redirectPath.c_str()))
+                                if (!RedirectedPathExists(redirectPath.c_str()))
                                 {
                                     // Need to copy now
                                     LogString(CreateFileInstance, L"\tFRF CreateFile COA from ADR to", redirectPath.c_str());
-                                    impl::CopyFileW(PackageVersion.c_str(), redirectPath.c_str(), true);
+                                    journaled_copy journal(redirectPath.c_str());
+                                    if (CopyFileToRedirectedArea(PackageVersion.c_str(), redirectPath.c_str(), true))
+                                    {
+                                        NotifyRedirectedPathCreated(redirectPath.c_str());
+                                    }
                                 }
                             }
                         }
@@ -114,9 +236,22 @@ HANDLE __stdcall CreateFileFixup(
                         redirectedAccess = ConvertToReadOnlyAccess(desiredAccess);
                     }
                     Log(L"[%d]CreateFile pre create", CreateFileInstance);
-                    HANDLE hRet = impl::CreateFile(redirectPath.c_str(), desiredAccess, shareMode, securityAttributes, creationDisposition, flagsAndAttributes, templateFile);
+                    HANDLE hRet = impl::CreateFile(redirectPath.c_str(), desiredAccess, shareMode, securityAttributes, redirectedDisposition, flagsAndAttributes, templateFile);
+                    if ((hRet == INVALID_HANDLE_VALUE) && (::GetLastError() == ERROR_ACCESS_DENIED) && MaterializeLazyLink(redirectPath.c_str()))
+                    {
+                        // A link to the package's file, which now points at a copy that can be written to
+                        hRet = impl::CreateFile(redirectPath.c_str(), desiredAccess, shareMode, securityAttributes, redirectedDisposition, flagsAndAttributes, templateFile);
+                    }
+                    if (hRet != INVALID_HANDLE_VALUE)
+                    {
+                        NotifyRedirectedPathCreated(redirectPath.c_str());
+                        if (replacesPackageFile)
+                        {
+                            ::SetLastError((creationDisposition == CREATE_ALWAYS) ? ERROR_ALREADY_EXISTS : ERROR_SUCCESS);
+                        }
+                    }
                     Log(L"[%d]CreateFile post create. Handle=0x%x", CreateFileInstance,hRet);
-                    return hRet;
+                    return RecordReadOpen(hRet, desiredAccess, creationDisposition);
                 }
             }
             else
@@ -130,7 +265,8 @@ HANDLE __stdcall CreateFileFixup(
         // Fall back to assuming no redirection is necessary
     }
 
-    return impl::CreateFile(fileName, desiredAccess, shareMode, securityAttributes, creationDisposition, flagsAndAttributes, templateFile);
+    return RecordReadOpen(impl::CreateFile(fileName, desiredAccess, shareMode, securityAttributes, creationDisposition, flagsAndAttributes, templateFile),
+        desiredAccess, creationDisposition);
 }
 DECLARE_STRING_FIXUP(impl::CreateFile, CreateFileFixup);
 
@@ -144,51 +280,98 @@ HANDLE __stdcall CreateFile2Fixup(
     auto guard = g_reentrancyGuard.enter();
     try
     {
-        if (guard)
+        if (guard && !IsRedirectionBypassed(fileName))
         {
-            DWORD CreateFile2Instance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD CreateFile2Instance = psf::next_interception_id();
 
-            Log(L"[%d]CreateFile2Fixup for %ls", CreateFile2Instance, widen(fileName, CP_ACP).c_str());
+            Log(L"[%d]CreateFile2Fixup for %ls", CreateFile2Instance, widen_argument(fileName, CP_ACP).c_str());
 
             if (!IsUnderUserAppDataLocalPackages(fileName))
             {
-                // FUTURE: See comment in CreateFileFixup about using 'creationDisposition' to choose a potentially better
-            //         redirect flags value
-                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read, CreateFile2Instance);
+                auto redirectFlags = CreateFileRedirectFlags(desiredAccess, creationDisposition, createExParams ? createExParams->dwFileFlags : 0);
+                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirectFlags, CreateFile2Instance);
                 if (shouldRedirect)
                 {
-                    if (IsUnderUserAppDataLocal(fileName))
+                    FlushPendingProfile(redirectPath.c_str());
+
+                    // Until something asks to write to it, lazy copy-on-write leaves the file in the package
+                    if ((redirectFlags == redirect_flags::none) && !RedirectedPathExists(redirectPath.c_str()))
+                    {
+                        if (auto sourcePath = VisiblePackageSourcePath(fileName, redirectPath); !sourcePath.empty())
+                        {
+                            LogString(CreateFile2Instance, L"\tFRF CreateFile2 read-only open in place", sourcePath.c_str());
+                            return RecordReadOpen(impl::CreateFile2(sourcePath.c_str(), desiredAccess, shareMode, creationDisposition, createExParams), desiredAccess, creationDisposition);
+                        }
+                    }
+
+                    // Files under isReadOnly specs can't be modified anyway, so with read-only in place they are never copied
+                    if (auto sourcePath = ReadOnlyInPlacePath(fileName, redirectFlags, shouldReadonly, redirectPath); !sourcePath.empty())
+                    {
+                        LogString(CreateFile2Instance, L"\tFRF CreateFile2 read-only spec open in place", sourcePath.c_str());
+                        HANDLE hRet = impl::CreateFile2(sourcePath.c_str(), ConvertToReadOnlyAccess(desiredAccess), shareMode, OPEN_EXISTING, createExParams);
+                        if ((hRet != INVALID_HANDLE_VALUE) && (creationDisposition == OPEN_ALWAYS))
+                        {
+                            ::SetLastError(ERROR_ALREADY_EXISTS);
+                        }
+                        return RecordReadOpen(hRet, desiredAccess, creationDisposition);
+                    }
+
+                    // When only the package has the file, truncating opens still need to behave as though it had been copied:
+                    // TRUNCATE_EXISTING must succeed, and CREATE_ALWAYS must report ERROR_ALREADY_EXISTS
+                    bool replacesPackageFile = false;
+                    auto redirectedDisposition = creationDisposition;
+                    if (IsTruncatingOpen(creationDisposition) && !RedirectedPathExists(redirectPath.c_str()))
+                    {
+                        auto sourcePath = VisiblePackageSourcePath(fileName, redirectPath);
+                        replacesPackageFile = !sourcePath.empty() && impl::PathExists(sourcePath.c_str());
+                        if (replacesPackageFile)
+                        {
+                            redirectedDisposition = CREATE_ALWAYS;
+                        }
+                    }
+
+                    bool copyFile = flag_set(redirectFlags, redirect_flags::copy_file);
+                    if (copyFile && IsUnderUserAppDataLocal(fileName))
                     {
                         Log(L"[%d]Under LocalAppData", CreateFile2Instance);
                         // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
                         std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
                         if (wcslen(PackageVersion.c_str()) >= 0)
                         {
-                            if (impl::PathExists(PackageVersion.c_str()))
+                            if (PackagePathExists(PackageVersion.c_str()) && !IsWhitedOut(redirectPath.native()))
                             {
-                                if (!impl::PathExists(redirectPath.c_str()))
+                                if (!RedirectedPathExists(redirectPath.c_str()))
                                 {
                                     // Need to copy now
                                     LogString(CreateFile2Instance, L"\tFRF CreateFile2 COA from ADL to", redirectPath.c_str());
-                                    impl::CopyFileW(PackageVersion.c_str(), redirectPath.c_str(), true);
+                                    journaled_copy journal(redirectPath.c_str());
+                                    if (CopyFileToRedirectedArea(PackageVersion.c_str(), redirectPath.c_str(), true))
+                                    {
+                                        NotifyRedirectedPathCreated(redirectPath.c_str());
+                                    }
                                 }
                             }
                         }
                     }
-                    else if (IsUnderUserAppDataRoaming(fileName))
+                    else if (copyFile && IsUnderUserAppDataRoaming(fileName))
                     {
                         Log(L"[%d]Under AppData(roaming)", CreateFile2Instance);
                         // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
                         std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
                         if (wcslen(PackageVersion.c_str()) >= 0)
                         {
-                            if (impl::PathExists(PackageVersion.c_str()))
+                            if (PackagePathExists(PackageVersion.c_str()) && !IsWhitedOut(redirectPath.native()))
                             {
-                                if (!impl::PathExists(redirectPath.c_str()))
+                                if (!RedirectedPathExists(redirectPath.c_str()))
                                 {
                                     // Need to copy now
                                     LogString(CreateFile2Instance, L"\tFRF CreateFile2 COA from ADR to", redirectPath.c_str());
-                                    impl::CopyFileW(PackageVersion.c_str(), redirectPath.c_str(), true);
+                                    journaled_copy journal(redirectPath.c_str());
+                                    if (CopyFileToRedirectedArea(PackageVersion.c_str(), redirectPath.c_str(), true))
+                                    {
+                                        NotifyRedirectedPathCreated(redirectPath.c_str());
+                                    }
                                 }
                             }
                         }
@@ -199,7 +382,21 @@ HANDLE __stdcall CreateFile2Fixup(
                         redirectedAccess = ConvertToReadOnlyAccess(desiredAccess);
                     }
 
-                    return impl::CreateFile2(redirectPath.c_str(), desiredAccess, shareMode, creationDisposition, createExParams);
+                    HANDLE hRet = impl::CreateFile2(redirectPath.c_str(), desiredAccess, shareMode, redirectedDisposition, createExParams);
+                    if ((hRet == INVALID_HANDLE_VALUE) && (::GetLastError() == ERROR_ACCESS_DENIED) && MaterializeLazyLink(redirectPath.c_str()))
+                    {
+                        // A link to the package's file, which now points at a copy that can be written to
+                        hRet = impl::CreateFile2(redirectPath.c_str(), desiredAccess, shareMode, redirectedDisposition, createExParams);
+                    }
+                    if (hRet != INVALID_HANDLE_VALUE)
+                    {
+                        NotifyRedirectedPathCreated(redirectPath.c_str());
+                        if (replacesPackageFile)
+                        {
+                            ::SetLastError((creationDisposition == CREATE_ALWAYS) ? ERROR_ALREADY_EXISTS : ERROR_SUCCESS);
+                        }
+                    }
+                    return RecordReadOpen(hRet, desiredAccess, creationDisposition);
                 }
             }
             else
@@ -213,6 +410,6 @@ HANDLE __stdcall CreateFile2Fixup(
         // Fall back to assuming no redirection is necessary
     }
 
-    return impl::CreateFile2(fileName, desiredAccess, shareMode, creationDisposition, createExParams);
+    return RecordReadOpen(impl::CreateFile2(fileName, desiredAccess, shareMode, creationDisposition, createExParams), desiredAccess, creationDisposition);
 }
 DECLARE_FIXUP(impl::CreateFile2, CreateFile2Fixup);
@@ -3,8 +3,13 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
+#include "LazyLinks.h"
 #include "PathRedirection.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("CreateHardLink");
 
 template <typename CharT>
 BOOL __stdcall CreateHardLinkFixup(
@@ -17,6 +22,7 @@ BOOL __stdcall CreateHardLinkFixup(
     {
         if (guard)
         {
+            fixup_statistics_scope statisticsScope(g_statistics);
             LogString(L"CopyHardLinkFixup for",    fileName);
             LogString(L"CopyHardLinkFixup target", existingFileName);
             
@@ -28,13 +34,26 @@ BOOL __stdcall CreateHardLinkFixup(
             //       are trying to create a hard-link with the same path as a file inside the package, they had
             //       previously attempted to delete that file.
             auto [redirectLink, redirectPath, shouldReadonlySource] = ShouldRedirect(fileName, redirect_flags::ensure_directory_structure);
+
+            // With lazy links, a link to a package file that hasn't been copied yet is made as a symbolic link to the
+            // package's file instead, since a hard link can't be made to somewhere the application can't write to
+            if (redirectLink && TryCreateLazyLink(redirectPath.c_str(), existingFileName, 0))
+            {
+                return TRUE;
+            }
+
             auto [redirectTarget, redirectTargetPath, shouldReadonlyDest] = ShouldRedirect(existingFileName, redirect_flags::copy_on_read);
             if (redirectLink || redirectTarget)
             {
-                return impl::CreateHardLink(
+                auto result = impl::CreateHardLink(
                     redirectLink ? redirectPath.c_str() : widen_argument(fileName).c_str(),
                     redirectTarget ? redirectTargetPath.c_str() : widen_argument(existingFileName).c_str(),
                     securityAttributes);
+                if (result && redirectLink)
+                {
+                    NotifyRedirectedPathCreated(redirectPath.c_str());
+                }
+                return result;
             }
         }
     }
@@ -3,8 +3,13 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
+#include "LazyLinks.h"
 #include "PathRedirection.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("CreateSymbolicLink");
 
 template <typename CharT>
 BOOLEAN __stdcall CreateSymbolicLinkFixup(
@@ -17,10 +22,18 @@ BOOLEAN __stdcall CreateSymbolicLinkFixup(
     {
         if (guard)
         {
+            fixup_statistics_scope statisticsScope(g_statistics);
             Log("CreateSymbolicLinkFixup for", symlinkFileName);
             Log("CreateSymbolicLinkFixup target",  targetFileName);
 
             auto [redirectLink, redirectPath, shoudReadonlySource] = ShouldRedirect(symlinkFileName, redirect_flags::ensure_directory_structure);
+
+            // With lazy links, a link to a package file that hasn't been copied yet points at the package's file instead
+            if (redirectLink && TryCreateLazyLink(redirectPath.c_str(), targetFileName, flags))
+            {
+                return TRUE;
+            }
+
             auto [redirectTarget, redirectTargetPath, shoudReadonlyDest] = ShouldRedirect(targetFileName, redirect_flags::copy_on_read);
             if (redirectLink || redirectTarget)
             {
@@ -28,10 +41,16 @@ BOOLEAN __stdcall CreateSymbolicLinkFixup(
                 //       redirected location (since future accesses may want to read/write to files that originated from
                 //       the package). However, doing so would be quite a bit of work, so we'll defer doing so until
                 //       later when we have evidence that this could be an issue.
-                return impl::CreateSymbolicLink(
+                auto result = impl::CreateSymbolicLink(
                     redirectLink ? redirectPath.c_str() : widen_argument(symlinkFileName).c_str(),
                     redirectTarget ? redirectTargetPath.c_str() : widen_argument(targetFileName).c_str(),
                     flags);
+                if (result && redirectLink)
+                {
+                    // A directory link makes everything in the target visible beneath the link
+                    NotifyRedirectedPathCreated(redirectPath.c_str(), true);
+                }
+                return result;
             }
         }
     }
@@ -0,0 +1,130 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+
+#include "CurrentDirectoryCache.h"
+#include "FunctionImplementations.h"
+
+namespace
+{
+    std::shared_mutex g_currentDirectoryLock;
+
+    // An empty full_path means that the current directory needs to be read again
+    normalized_path g_currentDirectory;
+
+    // Incremented (under the exclusive lock) by every change of directory. What was read is only kept if the directory
+    // didn't change while it was being read, since it could otherwise be the directory from before the change
+    std::uint64_t g_currentDirectoryGeneration = 0;
+}
+
+// Reads and normalizes the current directory, keeping it unless it changed in the meantime
+static normalized_path read_current_directory()
+{
+    std::uint64_t generation;
+    {
+        std::shared_lock lock(g_currentDirectoryLock);
+        generation = g_currentDirectoryGeneration;
+    }
+
+    psf::path_buffer cwd;
+    if (!psf::current_directory(cwd))
+    {
+        return {};
+    }
+
+    // The same as FindFirstFileEx used to do with the directory each time: normalized, and then normalized once more
+    // from its drive absolute part so that a local device prefix doesn't carry through
+    auto result = NormalizePath(cwd.c_str());
+    if (result.drive_absolute_path && (result.drive_absolute_path != result.full_path.data()))
+    {
+        result = NormalizePath(result.drive_absolute_path);
+    }
+    Log(L"\t\tFRF current directory=%ls", result.full_path.c_str());
+
+    if (!result.full_path.empty())
+    {
+        std::unique_lock lock(g_currentDirectoryLock);
+        if (generation == g_currentDirectoryGeneration)
+        {
+            g_currentDirectory = result;
+        }
+    }
+
+    return result;
+}
+
+normalized_path CurrentDirectory()
+{
+    {
+        std::shared_lock lock(g_currentDirectoryLock);
+        if (!g_currentDirectory.full_path.empty())
+        {
+            return g_currentDirectory;
+        }
+    }
+
+    return read_current_directory();
+}
+
+bool ResolveRelativePath(const wchar_t* path, psf::path_buffer& result)
+{
+    assert(psf::path_type(path) == psf::dos_path_type::relative);
+
+    // Joined into a buffer of its own and then given to GetFullPathName, which takes care of the "." and ".."
+    // components, trailing dots and spaces, etc. the same as it would have for the relative path. Only now the path is
+    // absolute, so the current directory isn't needed
+    auto pathLength = std::wcslen(path);
+    psf::path_buffer joined;
+    auto join = [&](const std::wstring& directory)
+    {
+        std::size_t directoryLength = directory.length();
+        bool needsSeparator = !psf::is_path_separator(directory.back());
+        auto buffer = joined.reserve(directoryLength + (needsSeparator ? 1 : 0) + pathLength);
+        std::memcpy(buffer, directory.data(), directoryLength * sizeof(wchar_t));
+        if (needsSeparator)
+        {
+            buffer[directoryLength++] = L'\\';
+        }
+        std::memcpy(buffer + directoryLength, path, pathLength * sizeof(wchar_t));
+        joined.set_length(directoryLength + pathLength);
+    };
+
+    {
+        std::shared_lock lock(g_currentDirectoryLock);
+        if (!g_currentDirectory.full_path.empty())
+        {
+            join(g_currentDirectory.full_path);
+        }
+    }
+
+    if (!joined.length())
+    {
+        auto directory = read_current_directory();
+        if (directory.full_path.empty())
+        {
+            return false;
+        }
+        join(directory.full_path);
+    }
+
+    // Root local device paths aren't normalized, so there's nothing to resolve the dots of; leave those to the caller
+    if (joined.type() == psf::dos_path_type::root_local_device)
+    {
+        return false;
+    }
+
+    return psf::full_path(joined.c_str(), result);
+}
+
+void NotifyCurrentDirectoryChanged() noexcept
+{
+    std::unique_lock lock(g_currentDirectoryLock);
+    ++g_currentDirectoryGeneration;
+    g_currentDirectory = {};
+}
@@ -0,0 +1,30 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <dos_paths.h>
+
+#include "PathRedirection.h"
+
+// Relative paths - e.g. the "*" that an application enumerates its current directory with - are resolved against the
+// current directory, which GetCurrentDirectory and GetFullPathName read out of the PEB under the PEB lock that every
+// other thread resolving a relative path contends on. The fixup keeps its own copy instead, already normalized the way
+// NormalizePath would normalize it. It's read on first use, and forgotten whenever the application changes directory
+// through SetCurrentDirectory, which the fixup detours for that purpose.
+//
+// NOTE: Changes that don't go through SetCurrentDirectory (e.g. calling RtlSetCurrentDirectory_U directly) are not
+//       observed. Neither are the per drive current directories that drive relative paths (e.g. "C:foo") use, which are
+//       kept in the environment; those paths are still resolved by GetFullPathName
+
+// The normalized current directory. Empty if it couldn't be determined
+normalized_path CurrentDirectory();
+
+// Resolves 'path', which must be relative (see psf::dos_path_type::relative), against the current directory into
+// 'result', giving the same result that psf::full_path would. Returns false, leaving 'result' empty, if the current
+// directory isn't known, in which case the caller should fall back to psf::full_path
+bool ResolveRelativePath(const wchar_t* path, psf::path_buffer& result);
+
+// Must be called after the application successfully changes the current directory
+void NotifyCurrentDirectoryChanged() noexcept;
@@ -3,8 +3,14 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+#include "WhiteoutIndex.h"
+
+static fixup_statistics g_statistics("DeleteFile");
 
 template <typename CharT>
 BOOL __stdcall DeleteFileFixup(_In_ const CharT* fileName) noexcept
@@ -12,32 +18,42 @@ BOOL __stdcall DeleteFileFixup(_In_ const CharT* fileName) noexcept
     auto guard = g_reentrancyGuard.enter();
     try
     {
-        if (guard)
+        if (guard && !IsRedirectionBypassed(fileName))
         {
-            DWORD DeleteFileInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD DeleteFileInstance = psf::next_interception_id();
             LogString(DeleteFileInstance,L"DeleteFileFixup for fileName", fileName);
             
             if (!IsUnderUserAppDataLocalPackages(fileName))
             {
 
                 // NOTE: This will only delete the redirected file. If the file previously existed in the package path, then
-                //       it will remain there and a later attempt to open, etc. the file will succeed. In the future, if
-                //       this proves to be an issue, we could maintain a collection of package files that have been
-                //       "deleted" and then just pretend like they've been deleted. Such a change would be rather large and
-                //       disruptful and probably fairly inefficient as it would impact virtually every code path, so we'll
-                //       put it off for now.
+                //       it will remain there and, unless whiteouts are enabled (see WhiteoutIndex.h), a later attempt to
+                //       open, etc. the file will succeed.
                 auto [shouldRedirect, redirectPath, shoudReadonly] = ShouldRedirect(fileName, redirect_flags::none);
                 if (shouldRedirect)
                 {
-                    if (!impl::PathExists(redirectPath.c_str()) && impl::PathExists(fileName))
+                    FlushPendingProfile(redirectPath.c_str());
+                    // NOTE: Whether the package has the file too only matters after deleting a redirected copy if that
+                    //       leaves a whiteout
+                    bool redirected = RedirectedPathExists(redirectPath.c_str());
+                    bool showsThrough = (!redirected || WhiteoutsEnabled()) && ShowsThroughRedirect(fileName, redirectPath);
+                    if (!redirected && showsThrough)
                     {
                         // If the file does not exist in the redirected location, but does in the non-redirected location,
                         // then we want to give the "illusion" that the delete succeeded
+                        AddWhiteout(redirectPath.native());
                         return TRUE;
                     }
                     else
                     {
-                        return impl::DeleteFile(redirectPath.c_str());
+                        auto result = impl::DeleteFile(redirectPath.c_str());
+                        InvalidateRedirectCache(redirectPath.c_str());
+                        if (result && showsThrough)
+                        {
+                            AddWhiteout(redirectPath.native());
+                        }
+                        return result;
                     }
                 }
             }
@@ -54,4 +70,4 @@ BOOL __stdcall DeleteFileFixup(_In_ const CharT* fileName) noexcept
 
     return impl::DeleteFile(fileName);
 }
-DECLARE_STRING_FIXUP(impl::DeleteFile, DeleteFileFixup);
+DECLARE_WIDENED_STRING_FIXUP(impl::DeleteFile, DeleteFileFixup);
@@ -0,0 +1,82 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cwchar>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include <windows.h>
+
+// A compact list of the results of a directory enumeration. Each entry holds everything from WIN32_FIND_DATAW except
+// for the names, which are all kept in one buffer, so that listings of very large directories stay small.
+struct directory_listing
+{
+    struct entry
+    {
+        DWORD attributes;
+        FILETIME creation_time;
+        FILETIME last_access_time;
+        FILETIME last_write_time;
+        DWORD file_size_high;
+        DWORD file_size_low;
+        DWORD reserved0;
+        std::uint32_t name_offset;
+        std::uint32_t name_length;
+        std::uint32_t alternate_name_offset;
+        std::uint32_t alternate_name_length;
+    };
+
+    std::vector<entry> entries;
+    std::vector<wchar_t> names;
+
+    std::wstring_view name_of(const entry& value) const noexcept
+    {
+        return std::wstring_view(names.data() + value.name_offset, value.name_length);
+    }
+
+    std::wstring_view alternate_name_of(const entry& value) const noexcept
+    {
+        return std::wstring_view(names.data() + value.alternate_name_offset, value.alternate_name_length);
+    }
+
+    void append(const WIN32_FIND_DATAW& data)
+    {
+        entry value;
+        value.attributes = data.dwFileAttributes;
+        value.creation_time = data.ftCreationTime;
+        value.last_access_time = data.ftLastAccessTime;
+        value.last_write_time = data.ftLastWriteTime;
+        value.file_size_high = data.nFileSizeHigh;
+        value.file_size_low = data.nFileSizeLow;
+        value.reserved0 = data.dwReserved0;
+        value.name_offset = static_cast<std::uint32_t>(names.size());
+        value.name_length = static_cast<std::uint32_t>(wcsnlen(data.cFileName, std::size(data.cFileName)));
+        names.insert(names.end(), data.cFileName, data.cFileName + value.name_length);
+        value.alternate_name_offset = static_cast<std::uint32_t>(names.size());
+        value.alternate_name_length = static_cast<std::uint32_t>(wcsnlen(data.cAlternateFileName, std::size(data.cAlternateFileName)));
+        names.insert(names.end(), data.cAlternateFileName, data.cAlternateFileName + value.alternate_name_length);
+        entries.push_back(value);
+    }
+
+    void copy_entry(const entry& value, WIN32_FIND_DATAW& data) const noexcept
+    {
+        data.dwFileAttributes = value.attributes;
+        data.ftCreationTime = value.creation_time;
+        data.ftLastAccessTime = value.last_access_time;
+        data.ftLastWriteTime = value.last_write_time;
+        data.nFileSizeHigh = value.file_size_high;
+        data.nFileSizeLow = value.file_size_low;
+        data.dwReserved0 = value.reserved0;
+        data.dwReserved1 = 0;
+        std::copy_n(names.data() + value.name_offset, value.name_length, data.cFileName);
+        data.cFileName[value.name_length] = L'\0';
+        std::copy_n(names.data() + value.alternate_name_offset, value.alternate_name_length, data.cAlternateFileName);
+        data.cAlternateFileName[value.alternate_name_length] = L'\0';
+    }
+};
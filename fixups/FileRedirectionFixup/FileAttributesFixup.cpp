@@ -3,8 +3,45 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
+#include "PackageContentIndex.h"
 #include "PathRedirection.h"
+#include "RedirectionStatistics.h"
+#include "WhiteoutIndex.h"
+
+static fixup_statistics g_statistics("FileAttributes");
+
+// The attributes of a path are resolved one layer at a time - the redirected area, then the package, then the path as
+// the application gave it - stopping at the first layer that has something there. Each layer is only queried when the
+// ones above it are known to be empty, and a layer that the absent path cache or the package index can already tell is
+// empty isn't queried at all, so that an application's call costs at most one query in the common cases.
+
+// Queries 'path' in the package, unless the package index can tell that there's nothing there. A path that can't be
+// converted to look up in the index is left for the query to fail on
+template <typename CharT>
+static DWORD PackageLayerAttributes(const CharT* path) noexcept
+{
+    if (auto widePath = try_widen_argument(path, CP_ACP); (widePath.error == ERROR_SUCCESS) && PackagePathKnownAbsent(widePath.c_str()))
+    {
+        ::SetLastError(ERROR_FILE_NOT_FOUND);
+        return INVALID_FILE_ATTRIBUTES;
+    }
+
+    return impl::GetFileAttributes(path);
+}
+
+template <typename CharT>
+static BOOL PackageLayerAttributesEx(const CharT* path, GET_FILEEX_INFO_LEVELS infoLevelId, LPVOID fileInformation) noexcept
+{
+    if (auto widePath = try_widen_argument(path, CP_ACP); (widePath.error == ERROR_SUCCESS) && PackagePathKnownAbsent(widePath.c_str()))
+    {
+        ::SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+
+    return impl::GetFileAttributesEx(path, infoLevelId, fileInformation);
+}
 
 template <typename CharT>
 DWORD __stdcall GetFileAttributesFixup(_In_ const CharT* fileName) noexcept
@@ -12,43 +49,52 @@ DWORD __stdcall GetFileAttributesFixup(_In_ const CharT* fileName) noexcept
     auto guard = g_reentrancyGuard.enter();
     try
     {
-        if (guard)
+        if (guard && !IsRedirectionBypassed(fileName))
         {
-            DWORD GetFileAttributesInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD GetFileAttributesInstance = psf::next_interception_id();
             LogString(GetFileAttributesInstance,L"GetFileAttributesFixup for fileName", fileName);
 
-            if (!IsUnderUserAppDataLocalPackages(fileName))
+            auto appDataLocation = UserAppDataLocation(fileName);
+            if (appDataLocation != user_appdata_location::local_packages)
             {
-                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::check_file_presence, GetFileAttributesInstance);
+                // NOTE: Whether anything is there is found out below, so there's no need for ShouldRedirect to check
+                //       presence too, and without that check its answer can be cached
+                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::none, GetFileAttributesInstance);
                 if (shouldRedirect)
                 {
-                    DWORD attributes = impl::GetFileAttributes(redirectPath.c_str());
-                    if (attributes == INVALID_FILE_ATTRIBUTES)
+                    DWORD attributes = RedirectedPathAttributes(redirectPath.c_str());
+                    if ((attributes == INVALID_FILE_ATTRIBUTES) && IsWhitedOut(redirectPath.native()))
+                    {
+                        Log(L"[%d]GetFileAttributes: package version was deleted", GetFileAttributesInstance);
+                    }
+                    else if (attributes == INVALID_FILE_ATTRIBUTES)
                     {
                         // Might be file/dir has not been copied yet, but might also be funky ADL/ADR.
-                        if (IsUnderUserAppDataLocal(fileName) ||
-                            IsUnderUserAppDataRoaming(fileName))
+                        std::filesystem::path PackageVersion;
+                        if (appDataLocation != user_appdata_location::none)
+                        {
+                            // special case.  MSIX Runtime doesn't take care of these cases, so look for the package's version ourselves.
+                            PackageVersion = GetPackageVFSPath(fileName);
+                        }
+
+                        if (wcslen(PackageVersion.c_str()) > 0)
                         {
-                            // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
-                            std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
-                            if (wcslen(PackageVersion.c_str()) > 0)
+                            Log(L"[%d]GetFileAttributes: uncopied ADL/ADR case %ls", GetFileAttributesInstance,PackageVersion.c_str());
+                            attributes = PackageLayerAttributes(PackageVersion.c_str());
+                            if (attributes == INVALID_FILE_ATTRIBUTES)
                             {
-                                Log(L"[%d]GetFileAttributes: uncopied ADL/ADR case %ls", GetFileAttributesInstance,PackageVersion.c_str());
-                                attributes = impl::GetFileAttributes(PackageVersion.c_str());
-                                if (attributes == INVALID_FILE_ATTRIBUTES)
-                                {
-                                    Log(L"[%d]GetFileAttributes: fall back to original request location.", GetFileAttributesInstance);
-                                    attributes = impl::GetFileAttributes(fileName);
-                                }
+                                Log(L"[%d]GetFileAttributes: fall back to original request location.", GetFileAttributesInstance);
+                                attributes = impl::GetFileAttributes(fileName);
                             }
                         }
                         else
                         {
                             Log(L"[%d]GetFileAttributes: other not yet redirected case", GetFileAttributesInstance);
-                            attributes = impl::GetFileAttributes(fileName);
+                            attributes = PackageLayerAttributes(fileName);
                         }
                     }
-                    else if (attributes != INVALID_FILE_ATTRIBUTES)
+                    else
                     {
                         if (shouldReadonly)
                         {
@@ -77,7 +123,7 @@ DWORD __stdcall GetFileAttributesFixup(_In_ const CharT* fileName) noexcept
 
     return impl::GetFileAttributes(fileName);
 }
-DECLARE_STRING_FIXUP(impl::GetFileAttributes, GetFileAttributesFixup);
+DECLARE_WIDENED_STRING_FIXUP(impl::GetFileAttributes, GetFileAttributesFixup);
 
 template <typename CharT>
 BOOL __stdcall GetFileAttributesExFixup(
@@ -88,58 +134,61 @@ BOOL __stdcall GetFileAttributesExFixup(
     auto guard = g_reentrancyGuard.enter();
     try
     {
-        if (guard)
+        if (guard && !IsRedirectionBypassed(fileName))
         {
-            DWORD GetFileAttributesExInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD GetFileAttributesExInstance = psf::next_interception_id();
             LogString(GetFileAttributesExInstance,L"GetFileAttributesExFixup for fileName", fileName);
 
-            if (!IsUnderUserAppDataLocalPackages(fileName))
+            auto appDataLocation = UserAppDataLocation(fileName);
+            if (appDataLocation != user_appdata_location::local_packages)
             {
-                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::check_file_presence, GetFileAttributesExInstance);
+                // NOTE: As with GetFileAttributes, presence is found out below
+                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::none, GetFileAttributesExInstance);
                 if (shouldRedirect)
                 {
-                    BOOL retval = impl::GetFileAttributesEx(redirectPath.c_str(), infoLevelId, fileInformation);
-                    if (retval == 0)
+                    BOOL retval = RedirectedPathAttributesEx(redirectPath.c_str(), infoLevelId, fileInformation);
+                    if ((retval == 0) && IsWhitedOut(redirectPath.native()))
+                    {
+                        Log(L"[%d]GetFileAttributesEx: package version was deleted", GetFileAttributesExInstance);
+                    }
+                    else if (retval == 0)
                     {
-                        // We know it exists, so must be file/dir has not been copied yet.
-                        if (IsUnderUserAppDataLocal(fileName) ||
-                            IsUnderUserAppDataRoaming(fileName))
+                        // Might be file/dir has not been copied yet, but might also be funky ADL/ADR.
+                        std::filesystem::path PackageVersion;
+                        if (appDataLocation != user_appdata_location::none)
+                        {
+                            // special case.  MSIX Runtime doesn't take care of these cases, so look for the package's version ourselves.
+                            PackageVersion = GetPackageVFSPath(fileName);
+                        }
+
+                        if (wcslen(PackageVersion.c_str()) > 0)
                         {
-                            // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
-                            std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
-                            if (wcslen(PackageVersion.c_str()) > 0)
+                            Log(L"[%d]GetFileAttributesEx: uncopied ADL/ADR case %ls", GetFileAttributesExInstance,PackageVersion.c_str());
+                            retval = PackageLayerAttributesEx(PackageVersion.c_str(), infoLevelId, fileInformation);
+                            if (retval == 0)
                             {
-                                Log(L"[%d]GetFileAttributesEx: uncopied ADL/ADR case %ls", GetFileAttributesExInstance,PackageVersion.c_str());
-                                retval = impl::GetFileAttributesEx(PackageVersion.c_str(), infoLevelId, fileInformation);
-                                if (retval == 0)
-                                {
-                                    Log(L"[%d]GetFileAttributesEx: fall back to original location.", GetFileAttributesExInstance);
-                                    retval = impl::GetFileAttributesEx(fileName, infoLevelId, fileInformation);
-                                }
+                                Log(L"[%d]GetFileAttributesEx: fall back to original location.", GetFileAttributesExInstance);
+                                retval = impl::GetFileAttributesEx(fileName, infoLevelId, fileInformation);
                             }
                         }
                         else
                         {
                             Log(L"[%d]GetFileAttributesEx: uncopied other case", GetFileAttributesExInstance);
-                            retval = impl::GetFileAttributesEx(fileName, infoLevelId, fileInformation);
+                            retval = PackageLayerAttributesEx(fileName, infoLevelId, fileInformation);
                         }
                     }
-                    else if (retval != 0)
+                    else if (infoLevelId == GetFileExInfoStandard)
                     {
+                        auto data = static_cast<WIN32_FILE_ATTRIBUTE_DATA*>(fileInformation);
                         if (shouldReadonly)
                         {
-                            if (infoLevelId == GetFileExInfoStandard)
-                            {
-                                if ((((WIN32_FILE_ATTRIBUTE_DATA*)fileInformation)->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
-                                    ((WIN32_FILE_ATTRIBUTE_DATA*)fileInformation)->dwFileAttributes |= FILE_ATTRIBUTE_READONLY;
-                            }
+                            if ((data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+                                data->dwFileAttributes |= FILE_ATTRIBUTE_READONLY;
                         }
                         else
                         {
-                            if (infoLevelId == GetFileExInfoStandard)
-                            {
-                                ((WIN32_FILE_ATTRIBUTE_DATA*)fileInformation)->dwFileAttributes &= ~FILE_ATTRIBUTE_READONLY;
-                            }
+                            data->dwFileAttributes &= ~FILE_ATTRIBUTE_READONLY;
                         }
                     }
                     if (retval != 0)
@@ -174,9 +223,10 @@ BOOL __stdcall SetFileAttributesFixup(_In_ const CharT* fileName, _In_ DWORD fil
     auto guard = g_reentrancyGuard.enter();
     try
     {
-        if (guard)
+        if (guard && !IsRedirectionBypassed(fileName))
         {
-            DWORD SetFileAttributesInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD SetFileAttributesInstance = psf::next_interception_id();
             LogString(SetFileAttributesInstance,L"SetFileAttributesFixup for fileName", fileName);
 
             if (!IsUnderUserAppDataLocalPackages(fileName))
@@ -206,4 +256,4 @@ BOOL __stdcall SetFileAttributesFixup(_In_ const CharT* fileName, _In_ DWORD fil
 
     return impl::SetFileAttributes(fileName, fileAttributes);
 }
-DECLARE_STRING_FIXUP(impl::SetFileAttributes, SetFileAttributesFixup);
+DECLARE_WIDENED_STRING_FIXUP(impl::SetFileAttributes, SetFileAttributesFixup);
@@ -0,0 +1,265 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cwchar>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+#include <winioctl.h>
+
+#include <fancy_handle.h>
+
+#include "FileCopy.h"
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+
+namespace
+{
+    // Files smaller than this are copied with the normal, buffered, copy; the cost of not using the cache outweighs the
+    // benefit for small files
+    constexpr std::uint64_t unbuffered_copy_threshold = 8 * 1024 * 1024;
+
+    // ReFS limits how much can be cloned by a single FSCTL_DUPLICATE_EXTENTS_TO_FILE
+    constexpr std::uint64_t max_clone_length = 1ull << 30;
+
+    using unique_file = std::unique_ptr<void, psf::handle_deleter<&::CloseHandle>>;
+
+    std::mutex g_copiesInFlightLock;
+    std::condition_variable g_copyCompleted;
+    std::unordered_set<std::wstring> g_copiesInFlight;
+
+    bool has_alternate_data_streams(const wchar_t* path) noexcept
+    {
+        WIN32_FIND_STREAM_DATA data;
+        auto findHandle = ::FindFirstStreamW(path, FindStreamInfoStandard, &data, 0);
+        if (findHandle == INVALID_HANDLE_VALUE)
+        {
+            // E.g. the file system doesn't support streams at all
+            return false;
+        }
+
+        // The first stream is the unnamed data stream
+        bool result = ::FindNextStreamW(findHandle, &data) != FALSE;
+        ::FindClose(findHandle);
+        return result;
+    }
+
+    // Returns false, with the last error set, if the file could not be cloned. If the destination was created, it is
+    // deleted again, unless it already existed and 'failIfExists' is true, in which case the last error is
+    // ERROR_FILE_EXISTS
+    bool try_clone_file(const wchar_t* source, const wchar_t* destination, bool failIfExists) noexcept
+    {
+        unique_file sourceFile(impl::CreateFile(source, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+        if (!sourceFile)
+        {
+            return false;
+        }
+
+        DWORD fileSystemFlags = 0;
+        if (!::GetVolumeInformationByHandleW(sourceFile.get(), nullptr, 0, nullptr, nullptr, &fileSystemFlags, nullptr, 0) ||
+            !(fileSystemFlags & FILE_SUPPORTS_BLOCK_REFCOUNTING))
+        {
+            ::SetLastError(ERROR_NOT_SUPPORTED);
+            return false;
+        }
+
+        BY_HANDLE_FILE_INFORMATION sourceInfo;
+        if (!::GetFileInformationByHandle(sourceFile.get(), &sourceInfo) || has_alternate_data_streams(source))
+        {
+            ::SetLastError(ERROR_NOT_SUPPORTED);
+            return false;
+        }
+
+        FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity{};
+        DWORD bytesReturned;
+        if (!::DeviceIoControl(sourceFile.get(), FSCTL_GET_INTEGRITY_INFORMATION, nullptr, 0, &integrity, sizeof(integrity), &bytesReturned, nullptr))
+        {
+            return false;
+        }
+
+        // The attributes are applied once the data is in place, since e.g. FILE_ATTRIBUTE_READONLY would get in the way
+        unique_file destinationFile(impl::CreateFile(destination, GENERIC_READ | GENERIC_WRITE | DELETE, 0, nullptr,
+            failIfExists ? CREATE_NEW : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!destinationFile)
+        {
+            return false;
+        }
+
+        auto cloned = [&]() noexcept
+        {
+            BY_HANDLE_FILE_INFORMATION destinationInfo;
+            if (!::GetFileInformationByHandle(destinationFile.get(), &destinationInfo) ||
+                (destinationInfo.dwVolumeSerialNumber != sourceInfo.dwVolumeSerialNumber))
+            {
+                ::SetLastError(ERROR_NOT_SAME_DEVICE);
+                return false;
+            }
+
+            // The destination must match the source's sparseness and integrity settings for the clone to succeed
+            if (sourceInfo.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE)
+            {
+                if (!::DeviceIoControl(destinationFile.get(), FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytesReturned, nullptr))
+                {
+                    return false;
+                }
+            }
+
+            FSCTL_SET_INTEGRITY_INFORMATION_BUFFER setIntegrity{};
+            setIntegrity.ChecksumAlgorithm = integrity.ChecksumAlgorithm;
+            setIntegrity.Flags = integrity.Flags;
+            if (!::DeviceIoControl(destinationFile.get(), FSCTL_SET_INTEGRITY_INFORMATION, &setIntegrity, sizeof(setIntegrity), nullptr, 0, &bytesReturned, nullptr))
+            {
+                return false;
+            }
+
+            FILE_END_OF_FILE_INFO endOfFile;
+            endOfFile.EndOfFile.LowPart = sourceInfo.nFileSizeLow;
+            endOfFile.EndOfFile.HighPart = static_cast<LONG>(sourceInfo.nFileSizeHigh);
+            if (!::SetFileInformationByHandle(destinationFile.get(), FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)))
+            {
+                return false;
+            }
+
+            // The cloned region must be a multiple of the cluster size, which is fine for the last cluster since the
+            // end of the file has already been set
+            auto fileSize = static_cast<std::uint64_t>(endOfFile.EndOfFile.QuadPart);
+            auto clusterSize = static_cast<std::uint64_t>(integrity.ClusterSizeInBytes);
+            if (clusterSize == 0)
+            {
+                ::SetLastError(ERROR_NOT_SUPPORTED);
+                return false;
+            }
+            auto cloneSize = (fileSize + clusterSize - 1) / clusterSize * clusterSize;
+
+            DUPLICATE_EXTENTS_DATA extents{};
+            extents.FileHandle = sourceFile.get();
+            for (std::uint64_t offset = 0; offset < cloneSize; )
+            {
+                auto length = std::min(cloneSize - offset, max_clone_length);
+                extents.SourceFileOffset.QuadPart = static_cast<LONGLONG>(offset);
+                extents.TargetFileOffset.QuadPart = static_cast<LONGLONG>(offset);
+                extents.ByteCount.QuadPart = static_cast<LONGLONG>(length);
+                if (!::DeviceIoControl(destinationFile.get(), FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), nullptr, 0, &bytesReturned, nullptr))
+                {
+                    return false;
+                }
+                offset += length;
+            }
+
+            FILE_BASIC_INFO basicInfo{};
+            basicInfo.CreationTime.LowPart = sourceInfo.ftCreationTime.dwLowDateTime;
+            basicInfo.CreationTime.HighPart = static_cast<LONG>(sourceInfo.ftCreationTime.dwHighDateTime);
+            basicInfo.LastWriteTime.LowPart = sourceInfo.ftLastWriteTime.dwLowDateTime;
+            basicInfo.LastWriteTime.HighPart = static_cast<LONG>(sourceInfo.ftLastWriteTime.dwHighDateTime);
+            basicInfo.ChangeTime = basicInfo.LastWriteTime;
+            basicInfo.FileAttributes = sourceInfo.dwFileAttributes & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN |
+                FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED);
+            if (basicInfo.FileAttributes == 0)
+            {
+                basicInfo.FileAttributes = FILE_ATTRIBUTE_NORMAL;
+            }
+            return ::SetFileInformationByHandle(destinationFile.get(), FileBasicInfo, &basicInfo, sizeof(basicInfo)) != FALSE;
+        }();
+
+        if (!cloned)
+        {
+            auto err = ::GetLastError();
+            FILE_DISPOSITION_INFO disposition{ TRUE };
+            ::SetFileInformationByHandle(destinationFile.get(), FileDispositionInfo, &disposition, sizeof(disposition));
+            ::SetLastError(err);
+        }
+
+        return cloned;
+    }
+}
+
+BOOL CopyFileToRedirectedArea(const wchar_t* source, const wchar_t* destination, bool failIfExists) noexcept
+{
+    if (try_clone_file(source, destination, failIfExists))
+    {
+        Log(L"\t\tFRF cloned %ls to %ls", source, destination);
+        return TRUE;
+    }
+    else if (failIfExists && (::GetLastError() == ERROR_FILE_EXISTS))
+    {
+        return FALSE;
+    }
+
+    DWORD copyFlags = failIfExists ? COPY_FILE_FAIL_IF_EXISTS : 0;
+    WIN32_FILE_ATTRIBUTE_DATA sourceData;
+    if (::GetFileAttributesExW(source, GetFileExInfoStandard, &sourceData) &&
+        ((static_cast<std::uint64_t>(sourceData.nFileSizeHigh) << 32 | sourceData.nFileSizeLow) >= unbuffered_copy_threshold))
+    {
+        copyFlags |= COPY_FILE_NO_BUFFERING;
+    }
+
+    return impl::CopyFileEx(source, destination, nullptr, nullptr, nullptr, copyFlags);
+}
+
+redirected_copy_lock::redirected_copy_lock(const wchar_t* path) :
+    m_key(path)
+{
+    if (!m_key.empty())
+    {
+        ::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, m_key.data(), static_cast<int>(m_key.length()),
+            m_key.data(), static_cast<int>(m_key.length()), nullptr, nullptr, 0);
+    }
+
+    std::unique_lock lock(g_copiesInFlightLock);
+    g_copyCompleted.wait(lock, [&] { return g_copiesInFlight.find(m_key) == g_copiesInFlight.end(); });
+    g_copiesInFlight.insert(m_key);
+}
+
+redirected_copy_lock::~redirected_copy_lock()
+{
+    if (m_mutex)
+    {
+        ::ReleaseMutex(m_mutex);
+        ::CloseHandle(m_mutex);
+    }
+
+    {
+        std::lock_guard lock(g_copiesInFlightLock);
+        g_copiesInFlight.erase(m_key);
+    }
+    g_copyCompleted.notify_all();
+}
+
+void redirected_copy_lock::lock_across_processes() noexcept
+{
+    if (m_mutex)
+    {
+        return;
+    }
+
+    // Only a hash of the path fits in an object name; a collision just means two unrelated copies don't run at once
+    wchar_t name[64];
+    std::swprintf(name, std::size(name), L"Local\\PsfFileRedirectionCopy-%016llx",
+        static_cast<unsigned long long>(std::hash<std::wstring>{}(m_key)));
+
+    auto mutex = ::CreateMutexW(nullptr, FALSE, name);
+    if (!mutex)
+    {
+        Log("\t\tFRF could not create the copy lock %ls, error=%d", name, ::GetLastError());
+        return;
+    }
+
+    // An abandoned lock means that the process making the copy exited before it was done. CopyFileEx removes the
+    // partial file when it fails, but not when the process is terminated, so there's nothing more that can be done
+    auto waitResult = ::WaitForSingleObject(mutex, INFINITE);
+    if ((waitResult != WAIT_OBJECT_0) && (waitResult != WAIT_ABANDONED))
+    {
+        ::CloseHandle(mutex);
+        return;
+    }
+
+    m_mutex = mutex;
+}
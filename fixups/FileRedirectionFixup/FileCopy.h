@@ -0,0 +1,48 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+
+#include <windows.h>
+
+// Copies a file into the redirected area as cheaply as the volume allows. When the source and destination are on the
+// same volume and that volume supports block cloning (e.g. ReFS or a Dev Drive), the destination shares the source's
+// clusters and no data is copied at all. Otherwise the copy falls back to CopyFileEx, which uses copy offload when the
+// storage supports it, and unbuffered I/O for large files. Behaves like CopyFileW: returns FALSE with the last error
+// set on failure, including ERROR_FILE_EXISTS when 'failIfExists' is true and the destination already exists.
+//
+// NOTE: Cloned copies carry over the source's attributes and timestamps, but not alternate data streams, so sources
+//       that have any are always copied by CopyFileEx.
+// NOTE: Large files are still copied whole. Copying only the ranges that get written would mean serving reads of the
+//       rest from the package's file, and handles FRF returns are used by ReadFile, WriteFile, file mappings, etc.,
+//       none of which it hooks. Opens that truncate the file never copy it at all.
+BOOL CopyFileToRedirectedArea(const wchar_t* source, const wchar_t* destination, bool failIfExists) noexcept;
+
+// Held while deciding whether to copy - and then copying - a file to 'path' in the redirected area, so that threads
+// that race to copy the same file (e.g. an open on the application's thread and the pre-copy thread) wait for the copy
+// that is already in flight rather than copying twice, or reading a copy that is only partially written. Once the lock
+// is acquired, the caller should check again whether the copy still needs to be made.
+//
+// Other processes of the package (e.g. child processes) share the redirected area, so a caller that has found that it
+// does need to make the copy should also call 'lock_across_processes' and then check once more, this time against the
+// file system itself, since the absent path cache doesn't observe copies made by other processes
+class redirected_copy_lock
+{
+public:
+    explicit redirected_copy_lock(const wchar_t* path);
+    ~redirected_copy_lock();
+
+    redirected_copy_lock(const redirected_copy_lock&) = delete;
+    redirected_copy_lock& operator=(const redirected_copy_lock&) = delete;
+
+    // Waits for any other process in the session that holds the lock for the same path. If the lock cannot be created,
+    // the copy proceeds unsynchronized, as it would have before
+    void lock_across_processes() noexcept;
+
+private:
+    std::wstring m_key;
+    HANDLE m_mutex = nullptr;
+};
@@ -5,20 +5,33 @@
 //
 // The general design is roughly as follows. Redirection is set up as a base path and some pattern to match file name/
 // sub path. It would be fairly tricky to try and merge that pattern with the patterns that FindFirstFile supports, so
-// we instead: (1) enumerate files in the redirected directory, if the directory exists, then (2) enumerate the files in
-// the non-redirected directory, ignoring files that exist in the redirected directory. Note that this order is
-// important since it could be the case that a file gets copied to the redirected directory in the middle of enumeration
-// and we could otherwise return the same file twice.
-// NOTE: If we ever address the "delete package file" problem, we'll need to address that here, too
-
-#include <array>
+// we instead let FindFirstFileEx evaluate the pattern against each of the layers that make up the merged view of the
+// directory: (1) the redirected directory, (2) the package VFS equivalent of AppData/LocalAppData, and (3) the
+// non-redirected directory. Each layer is read in full when the enumeration starts, using large fetches, and the
+// results are merged into a single list that's sorted by name. When the same name appears in more than one layer, only
+// the entry from the first layer is kept. Names that have already been seen are tracked in a hash set, so that this
+// doesn't require probing the other layers for each entry. FindNextFile then just walks that list. Since the view is a snapshot, a file
+// that gets copied to the redirected directory in the middle of enumeration can't be returned twice. Entries of the
+// layers below the redirected directory that have been deleted (see WhiteoutIndex.h) are left out, as is everything
+// below it once the directory itself has been deleted.
+
+#include <algorithm>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
 
 #include <dos_paths.h>
 #include <fancy_handle.h>
 #include <psf_framework.h>
 
+#include "CurrentDirectoryCache.h"
+#include "DirectoryListing.h"
 #include "FunctionImplementations.h"
+#include "PackageListingCache.h"
 #include "PathRedirection.h"
+#include "WhiteoutIndex.h"
 
 struct find_deleter
 {
@@ -37,25 +50,78 @@ using unique_find_handle = std::unique_ptr<void, find_deleter>;
 
 struct find_data
 {
-    // Redirected path directory so that we can avoid returning duplicate filenames. This value will be empty if the
-    // path does not exist/match any existing files at the start of the enumeration, for a slight optimization
-    std::wstring redirect_path;
-    std::wstring package_vfs_path;
-    std::wstring requested_path;
-
-    // The first value is the find handle for the "redirected path" (typically to the user's profile). 
-    // The second value is for a "package VFS" location equivalent to the requested information when native AppData and LocalAppdata are used in the request.
-    // The third is the find handle for the non-redirected path as asked for by the app.
-    // The values are set to INVALID_HANDLE_VALUE as enumeration completes.
-    
-    // Note: When the original request was in the path of the package, the second handle is NULL.
-    //       When the original request was a path outside of package path, second handle is NULL if no equivalent VFS exists in package.
-    //       First handle is NULL when redirection has not happened yet.
-    //       We need the second handle only for VFS/AppData and VFS/LocalAppdata in the package because the underlying runtime doesn't layer those folders in when we use %Appdata% and %LocalAppData% for the third handle.
-    unique_find_handle find_handles[3];
-
-    // We need to hold on to the results of FindFirstFile for find_handles[1/2] 
-    WIN32_FIND_DATAW cached_data;
+    // The merged view of all layers, sorted by name. 'next_entry' is the index of the entry that the next call to
+    // FindNextFile will return
+    directory_listing view;
+    std::size_t next_entry = 0;
+
+    // Names only match case-sensitively if the caller asked for FIND_FIRST_EX_CASE_SENSITIVE
+    bool ignore_case = true;
+
+    // The (case folded, unless matching case-sensitively) names of every entry, so that the same name from a lower
+    // priority layer can be skipped in constant time. The names and the set's nodes are all allocated from the arena,
+    // which is released in one go when the enumeration is closed
+    std::pmr::monotonic_buffer_resource name_arena;
+    std::pmr::unordered_set<std::wstring_view> seen_names{ &name_arena };
+
+    // The redirected directory, with a trailing separator, once the layers below it are being read and whiteouts are
+    // enabled. Entries whose package version has been deleted are then skipped
+    std::wstring whiteout_directory;
+
+    // Returns false, without adding anything, if an entry with the same name has already been appended. Entries must
+    // therefore be appended in layer priority order
+    bool append(const WIN32_FIND_DATAW& data)
+    {
+        auto nameLength = wcsnlen(data.cFileName, std::size(data.cFileName));
+        wchar_t foldedName[MAX_PATH];
+        if (!ignore_case || !::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, data.cFileName, static_cast<int>(nameLength),
+            foldedName, static_cast<int>(std::size(foldedName)), nullptr, nullptr, 0))
+        {
+            std::copy_n(data.cFileName, nameLength, foldedName);
+        }
+
+        if (seen_names.find(std::wstring_view(foldedName, nameLength)) != seen_names.end())
+        {
+            return false;
+        }
+
+        if (!whiteout_directory.empty() && (wcscmp(data.cFileName, L".") != 0) && (wcscmp(data.cFileName, L"..") != 0) &&
+            IsWhitedOut(whiteout_directory + data.cFileName))
+        {
+            return false;
+        }
+
+        auto seenName = static_cast<wchar_t*>(name_arena.allocate(nameLength * sizeof(wchar_t), alignof(wchar_t)));
+        std::copy_n(foldedName, nameLength, seenName);
+        seen_names.emplace(seenName, nameLength);
+
+        view.append(data);
+        return true;
+    }
+
+    // Sorts the entries by name. Duplicates have already been removed by append
+    void merge()
+    {
+        // Like the file system, "." and ".." always come first
+        auto rank = [&](const directory_listing::entry& entry)
+        {
+            auto name = view.name_of(entry);
+            return (name == L".") ? 0 : (name == L"..") ? 1 : 2;
+        };
+
+        std::sort(view.entries.begin(), view.entries.end(), [&](const directory_listing::entry& lhs, const directory_listing::entry& rhs)
+        {
+            if (auto lhsRank = rank(lhs), rhsRank = rank(rhs); lhsRank != rhsRank)
+            {
+                return lhsRank < rhsRank;
+            }
+
+            auto lhsName = view.name_of(lhs);
+            auto rhsName = view.name_of(rhs);
+            return ::CompareStringOrdinal(lhsName.data(), static_cast<int>(lhsName.length()),
+                rhsName.data(), static_cast<int>(rhsName.length()), ignore_case) == CSTR_LESS_THAN;
+        });
+    }
 };
 
 template <typename CharT>
@@ -93,6 +159,135 @@ DWORD copy_find_data(const WIN32_FIND_DATAW& from, WIN32_FIND_DATAW& to) noexcep
     return ERROR_SUCCESS;
 }
 
+// Returns the entry following the one most recently returned in the form that the caller asked for, failing with
+// ERROR_NO_MORE_FILES once the merged view has been exhausted
+template <typename CharT>
+BOOL next_find_entry(find_data& data, win32_find_data_t<CharT>& findFileData) noexcept
+{
+    if (data.next_entry >= data.view.entries.size())
+    {
+        ::SetLastError(ERROR_NO_MORE_FILES);
+        return FALSE;
+    }
+
+    auto& entry = data.view.entries[data.next_entry++];
+    if constexpr (psf::is_ansi<CharT>)
+    {
+        WIN32_FIND_DATAW wideData;
+        data.view.copy_entry(entry, wideData);
+        if (copy_find_data(wideData, findFileData))
+        {
+            // NOTE: Last error set by caller
+            return FALSE;
+        }
+    }
+    else
+    {
+        data.view.copy_entry(entry, findFileData);
+    }
+
+    ::SetLastError(ERROR_SUCCESS);
+    return TRUE;
+}
+
+// Serves a search of a directory inside of the package from the package listing cache. Returns no value if the search
+// has to go to the file system instead, e.g. because the pattern uses wildcards that we don't evaluate ourselves
+std::optional<bool> read_cached_find_layer(
+    find_data& data,
+    const wchar_t* searchPath,
+    FINDEX_INFO_LEVELS infoLevelId,
+    FINDEX_SEARCH_OPS searchOp,
+    DWORD additionalFlags)
+{
+    // NOTE: FindExSearchLimitToDirectories is only advisory and, like most file systems, we ignore it
+    if (((infoLevelId != FindExInfoStandard) && (infoLevelId != FindExInfoBasic)) ||
+        ((searchOp != FindExSearchNameMatch) && (searchOp != FindExSearchLimitToDirectories)) ||
+        (additionalFlags & (FIND_FIRST_EX_CASE_SENSITIVE | FIND_FIRST_EX_ON_DISK_ENTRIES_ONLY)))
+    {
+        return std::nullopt;
+    }
+
+    std::wstring_view search(searchPath);
+    auto dirPos = search.find_last_of(LR"(\/)");
+    if ((dirPos == std::wstring_view::npos) || !IsSimpleFindPattern(search.substr(dirPos + 1)))
+    {
+        return std::nullopt;
+    }
+
+    auto listing = GetPackageDirectoryListing(search.substr(0, dirPos));
+    if (!listing)
+    {
+        return std::nullopt;
+    }
+
+    auto pattern = search.substr(dirPos + 1);
+    bool found = false;
+    WIN32_FIND_DATAW findData;
+    for (auto& entry : listing->entries)
+    {
+        if (MatchesFindPattern(pattern, listing->name_of(entry), listing->alternate_name_of(entry)))
+        {
+            listing->copy_entry(entry, findData);
+            if (infoLevelId == FindExInfoBasic)
+            {
+                findData.cAlternateFileName[0] = L'\0';
+            }
+
+            found = data.append(findData) || found;
+        }
+    }
+
+    if (!found)
+    {
+        ::SetLastError(ERROR_FILE_NOT_FOUND);
+    }
+    return found;
+}
+
+// Adds everything in a single layer that matches the search to the view, skipping names that an earlier layer already
+// had. Returns false if nothing matched, including when the directory does not exist, with the last error as set by
+// FindFirstFileEx, or ERROR_FILE_NOT_FOUND when all that matched has been deleted. Fails, so that the whole search does,
+// only if the layer could not be read to the end
+psf::win32_result<bool> read_find_layer(
+    find_data& data,
+    const wchar_t* searchPath,
+    FINDEX_INFO_LEVELS infoLevelId,
+    FINDEX_SEARCH_OPS searchOp,
+    LPVOID searchFilter,
+    DWORD additionalFlags)
+{
+    if (auto cached = read_cached_find_layer(data, searchPath, infoLevelId, searchOp, additionalFlags))
+    {
+        return *cached;
+    }
+
+    WIN32_FIND_DATAW findData;
+    unique_find_handle findHandle(impl::FindFirstFileEx(searchPath, infoLevelId, &findData, searchOp, searchFilter, additionalFlags | FIND_FIRST_EX_LARGE_FETCH));
+    if (!findHandle)
+    {
+        return false;
+    }
+
+    bool found = false;
+    do
+    {
+        found = data.append(findData) || found;
+    }
+    while (impl::FindNextFile(findHandle.get(), &findData));
+
+    if (::GetLastError() != ERROR_NO_MORE_FILES)
+    {
+        // Error due to something other than reaching the end
+        return psf::last_win32_failure();
+    }
+
+    if (!found)
+    {
+        ::SetLastError(ERROR_FILE_NOT_FOUND);
+    }
+    return found;
+}
+
 template <typename CharT>
 HANDLE __stdcall FindFirstFileExFixup(
     _In_ const CharT* fileName,
@@ -109,16 +304,24 @@ HANDLE __stdcall FindFirstFileExFixup(
 
         return impl::FindFirstFileEx(fileName, infoLevelId, findFileData, searchOp, searchFilter, additionalFlags);
     }
-    DWORD FindFirstFileExInstance = ++g_FileIntceptInstance;
+    DWORD FindFirstFileExInstance = psf::next_interception_id();
 
 
-    // Split the input into directory and pattern
-    auto path = widen(fileName, CP_ACP);
+    // Split the input into directory and pattern. A name that can't be converted fails the same way that it would have
+    // without the fixup
+    auto widePath = try_widen(fileName, CP_ACP);
+    if (!widePath)
+    {
+        ::SetLastError(widePath.error());
+        return INVALID_HANDLE_VALUE;
+    }
+    auto& path = *widePath;
     LogString(FindFirstFileExInstance,L"\tFindFirstFileEx: for fileName", path.c_str());
     Log(L"[%d]\tFindFirstFileEx: addtionalFlags=0x%x", FindFirstFileExInstance, additionalFlags);
 
     normalized_path dir;
     const wchar_t* pattern = nullptr;
+    bool cwdBased = false;
     if (auto dirPos = path.find_last_of(LR"(\/)"); dirPos != std::wstring::npos)
     {
         Log("[%d]\tFileFirstFileEx: has slash", FindFirstFileExInstance);
@@ -150,173 +353,137 @@ HANDLE __stdcall FindFirstFileExFixup(
         // so this comment is here to try to explain.
         //     dir = NormalizePath(L".");
         //     pattern = path.c_str();
-        std::filesystem::path cwd = std::filesystem::current_path();
-        Log("[%d]\tFileFirstFileEx: swap to cwd: %ls", FindFirstFileExInstance,cwd.c_str());
-        dir = NormalizePath(cwd.c_str()); 
+        // NOTE: The cached current directory has already been normalized the same way as below
+        dir = CurrentDirectory();
         pattern = path.c_str();
-        Log("[%d]\tFileFirstFileEx: no slash, assumed cwd based type=x%x dap=%ls", FindFirstFileExInstance, psf::path_type(cwd.c_str()),dir.drive_absolute_path);
+        cwdBased = true;
+        Log("[%d]\tFileFirstFileEx: no slash, assumed cwd based type=x%x dap=%ls", FindFirstFileExInstance, dir.path_type, dir.drive_absolute_path);
     }
     
-    // If you change the below logic, or
-	// you you change what goes into RedirectedPath
-	// you need to mirror all changes to ShouldRedirectImpl
-	// in PathRedirection.cpp
- 
-    //Basically, what goes into RedirectedPath here also needs to go into 
-    // RedirectedPath in PathRedirection.cpp
-    dir = NormalizePath(dir.drive_absolute_path);
-    dir = VirtualizePath(std::move(dir), FindFirstFileExInstance);
+    // The directory is redirected exactly as ShouldRedirect would redirect it, by way of the same resolution, which
+    // opens and attribute queries of the same directory share
+    if (!cwdBased)
+    {
+        dir = NormalizePath(dir.drive_absolute_path);
+    }
+    auto resolution = ResolvePath(dir, FindFirstFileExInstance);
 
     auto result = std::make_unique<find_data>();
+    result->ignore_case = (additionalFlags & FIND_FIRST_EX_CASE_SENSITIVE) == 0;
 
-    result->requested_path = path.c_str();
-    result->redirect_path = RedirectedPath(dir,false, FindFirstFileExInstance);
-    if (result->redirect_path.back() != L'\\')
+    auto redirectPath = resolution->redirect_path;
+    if (!redirectPath.empty() && (redirectPath.back() != L'\\'))
     {
-        result->redirect_path.push_back(L'\\');
+        redirectPath.push_back(L'\\');
     }
+    auto redirectDirectory = redirectPath;
+    redirectPath += pattern;
     Log(L"[%d]FindFirstFile redirected_path is", FindFirstFileExInstance);
-    Log(result->redirect_path.c_str());
-    
+    Log(redirectPath.c_str());
+
+    // NOTE: The package VFS path already includes the pattern
     std::filesystem::path vfspath = GetPackageVFSPath(path.c_str());
     if (wcslen(vfspath.c_str()) > 0)
     {
-        result->package_vfs_path = vfspath.c_str();
-        //if (result->package_vfs_path.back() != L'\\')
-        //{
-        //    result->package_vfs_path.push_back(L'\\');
-        //}
         Log(L"[%d]FindFirstFile package_vfs_path is", FindFirstFileExInstance);
-        Log(result->package_vfs_path.c_str());
+        Log(vfspath.c_str());
     }
     else
     {
         Log(L"[%d]FindFirstFile package_vfs_path is [empty]", FindFirstFileExInstance);
     }
 
-    [[maybe_unused]] auto ansiData = reinterpret_cast<WIN32_FIND_DATAA*>(findFileData);
-    [[maybe_unused]] auto wideData = reinterpret_cast<WIN32_FIND_DATAW*>(findFileData);
-    WIN32_FIND_DATAW* findData = psf::is_ansi<CharT> ? &result->cached_data : wideData;
+    // Short names are comparatively expensive for the file system to produce, and most applications never look at them
+    auto layerInfoLevel = infoLevelId;
+    if (!g_enumerateShortNames && (infoLevelId == FindExInfoStandard))
+    {
+        layerInfoLevel = FindExInfoBasic;
+        Log(L"[%d]FindFirstFile promoted to FindExInfoBasic", FindFirstFileExInstance);
+    }
 
     //
-    // Open the redirected find handle
-    auto revertSize = result->redirect_path.length();
-    result->redirect_path += pattern;
-    result->find_handles[0].reset(impl::FindFirstFileEx(result->redirect_path.c_str(), infoLevelId, findData, searchOp, searchFilter, additionalFlags));
-    result->redirect_path.resize(revertSize);
+    // Read the redirected layer (typically in the user's profile)
+    auto redirectedLayer = read_find_layer(*result, redirectPath.c_str(), layerInfoLevel, searchOp, searchFilter, additionalFlags);
+    if (!redirectedLayer)
+    {
+        ::SetLastError(redirectedLayer.error());
+        return INVALID_HANDLE_VALUE;
+    }
+    bool haveResults = *redirectedLayer;
 
     // Some applications really care about the failure reason. Try and make this the best that we can, preferring
     // something like "file not found" over "path does not exist"
-    auto initialFindError = ::GetLastError();
+    DWORD initialFindError = ERROR_SUCCESS;
+    if (!haveResults)
+    {
+        initialFindError = ::GetLastError();
+    }
+    Log(L"[%d]FindFirstFile[0] (from redirected): %ls", FindFirstFileExInstance, haveResults ? L"had results" : L"no results");
 
-    if (result->find_handles[0])
+    // Once the directory itself has been deleted, nothing below the redirected area shows through
+    bool lowerLayersDeleted = IsWhitedOut(redirectDirectory);
+    if (lowerLayersDeleted)
     {
-        if constexpr (psf::is_ansi<CharT>)
-        {
-            if (copy_find_data(*findData, *ansiData))
-            {
-                // NOTE: Last error set by caller
-                return INVALID_HANDLE_VALUE;
-            }
-        }
-        else
-        {
-            // No need to copy since we wrote directly into the output buffer
-            assert(findData == wideData);
-        }
-        Log(L"[%d]FindFirstFile[0] redirected (from redirected): had results", FindFirstFileExInstance);
+        Log(L"[%d]FindFirstFile package version of the directory was deleted", FindFirstFileExInstance);
     }
-    else
+    else if (WhiteoutsEnabled())
     {
-        // Path doesn't exist or match any files. We can safely get away without the redirected file exists check
-        result->redirect_path.clear();
-        Log(L"[%d]FindFirstFile[0] redirected (from redirected): no results", FindFirstFileExInstance);
+        result->whiteout_directory = std::move(redirectDirectory);
     }
 
-    findData = (result->find_handles[0] || psf::is_ansi<CharT>) ? &result->cached_data : wideData;
-
     //
-    // Open the package_vfsP_path handle if AppData or LocalAppData (letting the runtime handle other VFSs)
-    if (IsUnderUserAppDataLocal(path.c_str()) || IsUnderUserAppDataRoaming(path.c_str()))
-    {
-        ///auto vfspathSize = result->package_vfs_path.length();
-        ///result->package_vfs_path += pattern;
-        result->find_handles[1].reset(impl::FindFirstFileEx(result->package_vfs_path.c_str(), infoLevelId, findData, searchOp, searchFilter, additionalFlags));
-        ///result->package_vfs_path.resize(vfspathSize);
-        if (result->find_handles[1])
-        {
-            Log(L"[%d]FindFirstFile[1] (from vfs_path): had results", FindFirstFileExInstance);
-        }
-        else
-        {
-            result->package_vfs_path.clear();
-            Log(L"[%d]FindFirstFile[1] (from vfs_path): no results", FindFirstFileExInstance);
-        }
-        if (!result->find_handles[0])
+    // Read the package VFS layer if AppData or LocalAppData (letting the runtime handle other VFSs, since the runtime
+    // doesn't layer those folders in when we use %AppData% and %LocalAppData% for the requested path)
+    if (!lowerLayersDeleted && (UserAppDataLocation(path.c_str()) != user_appdata_location::none) && (wcslen(vfspath.c_str()) > 0))
+    {
+        auto vfsLayer = read_find_layer(*result, vfspath.c_str(), layerInfoLevel, searchOp, searchFilter, additionalFlags);
+        if (!vfsLayer)
         {
-            if constexpr (psf::is_ansi<CharT>)
-            {
-                if (copy_find_data(*findData, *ansiData))
-                {
-                    Log(L"[%d]FindFirstFile error set by caller", FindFirstFileExInstance);
-                    // NOTE: Last error set by caller
-                    return INVALID_HANDLE_VALUE;
-                }
-            }
-            else
-            {
-                // No need to copy since we wrote directly into the output buffer
-                assert(findData == wideData);
-            }
+            ::SetLastError(vfsLayer.error());
+            return INVALID_HANDLE_VALUE;
         }
+        bool vfsResults = *vfsLayer;
+        Log(L"[%d]FindFirstFile[1] (from vfs_path): %ls", FindFirstFileExInstance, vfsResults ? L"had results" : L"no results");
+        haveResults = haveResults || vfsResults;
     }
 
     //
-    // Open the non-redirected find handle
-    result->find_handles[2].reset(impl::FindFirstFileEx(result->requested_path.c_str(), infoLevelId, findData, searchOp, searchFilter, additionalFlags));
-    if (result->find_handles[2])
-    {
-        Log(L"[%d]FindFirstFile[2] (from origial): had results", FindFirstFileExInstance);
-    }
-    else
-    {
-        result->requested_path.clear();
-        Log(L"[%d]FindFirstFile[2] (from original): no results", FindFirstFileExInstance);
-    }
-    if (!result->find_handles[0] &&
-        !result->find_handles[1])
+    // Read the non-redirected layer as asked for by the app
+    bool requestedResults = false;
+    DWORD requestedFindError = initialFindError;
+    if (!lowerLayersDeleted)
     {
-        if (!result->find_handles[2])
+        auto requestedLayer = read_find_layer(*result, path.c_str(), layerInfoLevel, searchOp, searchFilter, additionalFlags);
+        if (!requestedLayer)
         {
-            // Neither path exists. The last error should still be set by FindFirstFileEx, but prefer the initial error
-            // if it indicates that the redirected directory structure exists
-            if (initialFindError == ERROR_FILE_NOT_FOUND)
-            {
-                Log(L"[%d]FindFirstFile error 0x%x", FindFirstFileExInstance, initialFindError);
-                ::SetLastError(initialFindError);
-            }
-
+            ::SetLastError(requestedLayer.error());
             return INVALID_HANDLE_VALUE;
         }
-        else
+        requestedResults = *requestedLayer;
+        requestedFindError = ::GetLastError();
+    }
+    Log(L"[%d]FindFirstFile[2] (from original): %ls", FindFirstFileExInstance, requestedResults ? L"had results" : L"no results");
+    if (!haveResults && !requestedResults)
+    {
+        // Neither path exists. Report the error from the requested path, but prefer the initial error if it indicates
+        // that the redirected directory structure exists
+        if (initialFindError == ERROR_FILE_NOT_FOUND)
         {
-            if constexpr (psf::is_ansi<CharT>)
-            {
-                if (copy_find_data(*findData, *ansiData))
-                {
-                    Log(L"[%d]FindFirstFile error set by caller", FindFirstFileExInstance);
-                    // NOTE: Last error set by caller
-                    return INVALID_HANDLE_VALUE;
-                }
-            }
-            else
-            {
-                // No need to copy since we wrote directly into the output buffer
-                assert(findData == wideData);
-            }
+            requestedFindError = initialFindError;
         }
+
+        Log(L"[%d]FindFirstFile error 0x%x", FindFirstFileExInstance, requestedFindError);
+        ::SetLastError(requestedFindError);
+        return INVALID_HANDLE_VALUE;
     }
 
+    result->merge();
+    Log(L"[%d]FindFirstFile merged view has %zu entries", FindFirstFileExInstance, result->view.entries.size());
+    if (!next_find_entry<CharT>(*result, *reinterpret_cast<win32_find_data_t<CharT>*>(findFileData)))
+    {
+        // NOTE: Last error set by caller
+        return INVALID_HANDLE_VALUE;
+    }
 
     ::SetLastError(ERROR_SUCCESS);
     return reinterpret_cast<HANDLE>(result.release());
@@ -338,7 +505,6 @@ HANDLE __stdcall FindFirstFileFixup(_In_ const CharT* fileName, _Out_ win32_find
 }
 DECLARE_STRING_FIXUP(impl::FindFirstFile, FindFirstFileFixup);
 
-
 template <typename CharT>
 BOOL __stdcall FindNextFileFixup(_In_ HANDLE findFile, _Out_ win32_find_data_t<CharT>* findFileData) noexcept try
 {
@@ -350,7 +516,7 @@ BOOL __stdcall FindNextFileFixup(_In_ HANDLE findFile, _Out_ win32_find_data_t<C
         return impl::FindNextFile(findFile, findFileData);
     }
 
-    DWORD FindNextFileInstance = ++g_FileIntceptInstance;
+    DWORD FindNextFileInstance = psf::next_interception_id();
 
     Log(L"[%d]FindNextFileFixup.", FindNextFileInstance);
 
@@ -362,183 +528,17 @@ BOOL __stdcall FindNextFileFixup(_In_ HANDLE findFile, _Out_ win32_find_data_t<C
     }
 
     auto data = reinterpret_cast<find_data*>(findFile);
-#if !_DEBUG
-    Log(L"[%d]FindNextFileFixup is against redir  =%ls", FindNextFileInstance, data->redirect_path.c_str());
-    Log(L"[%d]FindNextFileFixup is against pkgVfs =%ls", FindNextFileInstance, data->package_vfs_path.c_str());
-    Log(L"[%d]FindNextFileFixup is against request=%ls", FindNextFileInstance, data->requested_path.c_str());
-#endif
-
-    auto redirectedFileExists = [&](auto filename)
+    auto result = next_find_entry<CharT>(*data, *findFileData);
+    if (result)
     {
-        if (data->redirect_path.empty())
-        {
-            Log(L"[%d]FindNextFile redirectedFileExists returns false.", FindNextFileInstance);
-            return false;
-        }
-
-        auto revertSize = data->redirect_path.length();
-
-        // NOTE: 'is_ansi' evaluation not inline due to the bug:
-        //       https://developercommunity.visualstudio.com/content/problem/324366/illegal-indirection-error-when-the-evaluation-of-i.html
-        constexpr bool is_ansi = psf::is_ansi<std::decay_t<decltype(*filename)>>;
-        if constexpr (is_ansi)
-        {
-            data->redirect_path += widen(filename);
-        }
-        else
-        {
-            data->redirect_path += filename;
-        }
-
-        auto result = impl::PathExists(data->redirect_path.c_str());
-        data->redirect_path.resize(revertSize);
-        Log(L"[%d]FindNextFile redirectedFileExists returns %ls", FindNextFileInstance, data->redirect_path.c_str());
-        return result;
-    };
-    auto vfspathFileExists = [&](auto filename)
-    {
-        if (data->package_vfs_path.empty())
-        {
-            Log(L"[%d]FindNextFile vfspathFileExists returns false.", FindNextFileInstance);
-            return false;
-        }
-
-        auto revertSize = data->package_vfs_path.length();
-
-        // NOTE: 'is_ansi' evaluation not inline due to the bug:
-        //       https://developercommunity.visualstudio.com/content/problem/324366/illegal-indirection-error-when-the-evaluation-of-i.html
-        constexpr bool is_ansi = psf::is_ansi<std::decay_t<decltype(*filename)>>;
-        if constexpr (is_ansi)
-        {
-            data->package_vfs_path += widen(filename);
-        }
-        else
-        {
-            data->package_vfs_path += filename;
-        }
-
-        auto result = impl::PathExists(data->package_vfs_path.c_str());
-        data->package_vfs_path.resize(revertSize);
-        Log(L"[%d]FindNextFile vfspathFileExists returns %ls", FindNextFileInstance, data->package_vfs_path.c_str());
-        return result;
-    };
-
-    if (!data->redirect_path.empty())
-    {
-        if (data->find_handles[0])
-        {
-            Log(L"[%d]FindNextFile[0] to be checked.", FindNextFileInstance);
-            if (impl::FindNextFile(data->find_handles[0].get(), findFileData))
-            {
-                Log(L"[%d]FindNextFile[0] returns TRUE: %ls", FindNextFileInstance, data->cached_data.cFileName);
-                return TRUE;
-            }
-            else if (::GetLastError() == ERROR_NO_MORE_FILES)
-            {
-                Log(L"[%d]FindNextFile[0] had FALSE with ERROR_NO_MORE_FILES.", FindNextFileInstance);
-                data->find_handles[0].reset();
-
-                if (data->package_vfs_path.empty() || !data->find_handles[1])
-                {
-                    Log(L"[%d]FindNextFile[1] not in use.", FindNextFileInstance);
-                    if (data->requested_path.empty() || !data->find_handles[2])
-                    {
-                        Log(L"[%d]FindNextFile[2] not in use, so return ERROR_NO_MORE_FILES.", FindNextFileInstance);
-                        // NOTE: Last error scribbled over by closing find_handles[0]
-                        ::SetLastError(ERROR_NO_MORE_FILES);
-                        return FALSE;
-                    }
-                    // else check[1]
-                }
-
-                if (!redirectedFileExists(data->cached_data.cFileName))
-                {
-                    if (copy_find_data(data->cached_data, *findFileData))
-                    {
-                        Log(L"[%d]FindNextFile[0] returns FALSE with last error set by caller", FindNextFileInstance);
-                        // NOTE: Last error set by caller
-                        return FALSE;
-                    }
-
-                    LogString(FindNextFileInstance, L"FindNextFile[0] returns TRUE with ERROR_SUCCESS and file %ls", data->cached_data.cFileName);
-                    ::SetLastError(ERROR_SUCCESS);
-                    return TRUE;
-                }
-            }
-            else
-            {
-                // Error due to something other than reaching the end 
-                Log(L"[%d]FindNextFile[0] returns FALSE", FindNextFileInstance);
-                return FALSE;
-            }
-        }
+        auto name = data->view.name_of(data->view.entries[data->next_entry - 1]);
+        Log(L"[%d]FindNextFile returns TRUE with ERROR_SUCCESS and %.*ls", FindNextFileInstance, static_cast<int>(name.length()), name.data());
     }
-
-    if (!data->package_vfs_path.empty())
-    {
-        while (data->find_handles[1])
-        {
-            if (impl::FindNextFile(data->find_handles[1].get(), findFileData))
-            {
-                // Skip the file if it exists in the redirected path
-                if (!redirectedFileExists(findFileData->cFileName))
-                {
-                    LogString(FindNextFileInstance, L"FindNextFile[1] returns TRUE with ERROR_SUCCESS and %ls", findFileData->cFileName);
-                    ::SetLastError(ERROR_SUCCESS);
-                    return TRUE;
-                }
-                // Otherwise, skip this file and check the next one
-            }
-            else if (::GetLastError() == ERROR_NO_MORE_FILES)
-            {
-                Log(L"[%d]FindNextFile[1] returns FALSE with ERROR_NO_MORE_FILES_FOUND.", FindNextFileInstance);
-                data->find_handles[1].reset();
-                // now check [2]
-            }
-            else
-            {
-                Log(L"[%d]FindNextFile[1] returns FALSE", FindNextFileInstance);
-                // Error due to something other than reaching the end
-                return FALSE;
-            }
-        }
-    }
-
-    if (!data->requested_path.empty())
+    else
     {
-        while (data->find_handles[2])
-        {
-            if (impl::FindNextFile(data->find_handles[2].get(), findFileData))
-            {
-                // Skip the file if it exists in the redirected path
-                if (!redirectedFileExists(findFileData->cFileName) &&
-                    !vfspathFileExists(findFileData->cFileName))
-                {
-                    LogString(FindNextFileInstance, L"FindNextFile[2] returns TRUE with ERROR_SUCCESS and %ls", findFileData->cFileName);
-                    ::SetLastError(ERROR_SUCCESS);
-                    return TRUE;
-                }
-                // Otherwise, skip this file and check the next one
-            }
-            else if (::GetLastError() == ERROR_NO_MORE_FILES)
-            {
-                Log(L"[%d]FindNextFile[2] returns FALSE with ERROR_NO_MORE_FILES_FOUND.", FindNextFileInstance);
-                data->find_handles[2].reset();
-                ::SetLastError(ERROR_NO_MORE_FILES);
-                return FALSE;
-            }
-            else
-            {
-                Log(L"[%d]FindNextFile[2] returns FALSE", FindNextFileInstance);
-                // Error due to something other than reaching the end
-                return FALSE;
-            }
-        }
+        Log(L"[%d]FindNextFile returns FALSE with error 0x%x", FindNextFileInstance, ::GetLastError());
     }
-    // We ran out of data either on a previous call, or by ignoring files that have been redirected
-    ::SetLastError(ERROR_NO_MORE_FILES);
-    return FALSE;
-
+    return result;
 }
 catch (...)
 {
@@ -557,7 +557,7 @@ BOOL __stdcall FindCloseFixup(_Inout_ HANDLE findHandle) noexcept
         return impl::FindClose(findHandle);
     }
 
-//    DWORD FindCloseInstance = ++g_FileIntceptInstance;
+//    DWORD FindCloseInstance = psf::next_interception_id();
 
     if (findHandle == INVALID_HANDLE_VALUE)
     {
@@ -9,12 +9,50 @@
 // For example, CreateFileFixup could call kernelbase!CopyFileW, which could in turn call (the fixed) CreateFile again
 #pragma once
 
+#include <atomic>
+
 #include <reentrancy_guard.h>
 #include <psf_framework.h>
 
 // A much bigger hammer to avoid reentrancy. Still, the impl::* functions are good to have around to prevent the
 // unnecessary invocation of the fixup
-inline thread_local psf::reentrancy_guard g_reentrancyGuard;
+//
+// NOTE: This is also what keeps Win32 functions that call each other (e.g. CopyFile calling CreateFile) from being
+//       redirected twice: only the outermost call makes a redirect decision. The fixup stays at the Win32 level rather
+//       than hooking NtCreateFile and friends, since the decisions - copy on read, merged FindFirstFile listings, INI
+//       files, moves - are made on Win32 semantics that the NT calls don't carry
+//
+// Every detour enters the guard before it looks at anything that depends on the paths or the configuration, so the guard
+// is also where initialization that the "lazyInitialize" config property has deferred is finished, by the first call
+// that gets past it. Until then, and after, that's a single load
+extern std::atomic<bool> g_initializationDeferred;
+void FinishDeferredInitialization() noexcept;
+
+class file_redirection_guard
+{
+public:
+
+    explicit constexpr file_redirection_guard(psf::reentrancy_owner owner) noexcept :
+        m_guard(owner)
+    {
+    }
+
+    auto enter() const noexcept
+    {
+        auto guard = m_guard.enter();
+        if (guard && g_initializationDeferred.load(std::memory_order_acquire))
+        {
+            FinishDeferredInitialization();
+        }
+        return guard;
+    }
+
+private:
+
+    psf::shared_reentrancy_guard m_guard;
+};
+
+inline const file_redirection_guard g_reentrancyGuard{ psf::reentrancy_owner::file_redirection };
 
 namespace impl
 {
@@ -54,6 +92,8 @@ namespace impl
 
     inline auto ReplaceFile = psf::detoured_string_function(&::ReplaceFileA, &::ReplaceFileW);
 
+    inline auto SetCurrentDirectory = psf::detoured_string_function(&::SetCurrentDirectoryA, &::SetCurrentDirectoryW);
+
     inline auto SetFileAttributes = psf::detoured_string_function(&::SetFileAttributesA, &::SetFileAttributesW);
 
     inline auto WritePrivateProfileSection = psf::detoured_string_function(&::WritePrivateProfileSectionA, &::WritePrivateProfileSectionW);
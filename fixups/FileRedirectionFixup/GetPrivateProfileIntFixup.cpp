@@ -6,6 +6,10 @@
 #include <errno.h>
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("GetPrivateProfileInt");
 
 template <typename CharT>
 UINT __stdcall GetPrivateProfileIntFixup(
@@ -19,7 +23,8 @@ UINT __stdcall GetPrivateProfileIntFixup(
     {
         if (guard)
         {
-            DWORD GetPrivateProfileIntInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD GetPrivateProfileIntInstance = psf::next_interception_id();
             if constexpr (psf::is_ansi<CharT>)
             {
                 LogString(GetPrivateProfileIntInstance,L"GetPrivateProfileIntFixup for fileName", widen_argument(fileName).c_str());
@@ -39,6 +44,13 @@ UINT __stdcall GetPrivateProfileIntFixup(
                     auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        if (auto cachedRetval = GetCachedProfileInt(redirectPath.c_str(), sectionName, key, nDefault))
+                        {
+                            Log(L" [%d]Cached returned uint: %d ", GetPrivateProfileIntInstance, *cachedRetval);
+                            return *cachedRetval;
+                        }
+
+                        FlushPendingProfile(redirectPath.c_str());
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             UINT retval = impl::GetPrivateProfileIntW(widen_argument(sectionName).c_str(), widen_argument(key).c_str(), nDefault, redirectPath.c_str());
@@ -71,4 +83,4 @@ UINT __stdcall GetPrivateProfileIntFixup(
 
     return impl::GetPrivateProfileInt(sectionName, key, nDefault, fileName);
 }
-DECLARE_STRING_FIXUP(impl::GetPrivateProfileInt, GetPrivateProfileIntFixup);
+DECLARE_GROUPED_STRING_FIXUP(private_profile_hook_group, impl::GetPrivateProfileInt, GetPrivateProfileIntFixup);
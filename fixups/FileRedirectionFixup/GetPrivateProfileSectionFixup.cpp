@@ -6,6 +6,10 @@
 #include <errno.h>
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("GetPrivateProfileSection");
 
 template <typename CharT>
 DWORD __stdcall GetPrivateProfileSectionFixup(
@@ -19,8 +23,9 @@ DWORD __stdcall GetPrivateProfileSectionFixup(
     {
         if (guard)
         {
-            DWORD GetPrivateProfileSectionInstance = ++g_FileIntceptInstance;
-            LogString(GetPrivateProfileSectionInstance,L"GetPrivateProfileSectionFixup for fileName", widen(fileName, CP_ACP).c_str());
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD GetPrivateProfileSectionInstance = psf::next_interception_id();
+            LogString(GetPrivateProfileSectionInstance,L"GetPrivateProfileSectionFixup for fileName", widen_argument(fileName, CP_ACP).c_str());
             if (fileName != NULL)
             {
                 if (!IsUnderUserAppDataLocalPackages(fileName))
@@ -28,6 +33,7 @@ DWORD __stdcall GetPrivateProfileSectionFixup(
                     auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        FlushPendingProfile(redirectPath.c_str());
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             auto wideString = std::make_unique<wchar_t[]>(stringLength);
@@ -64,4 +70,4 @@ DWORD __stdcall GetPrivateProfileSectionFixup(
 
     return impl::GetPrivateProfileSection(appName, string, stringLength, fileName);
 }
-DECLARE_STRING_FIXUP(impl::GetPrivateProfileSection, GetPrivateProfileSectionFixup);
+DECLARE_GROUPED_STRING_FIXUP(private_profile_hook_group, impl::GetPrivateProfileSection, GetPrivateProfileSectionFixup);
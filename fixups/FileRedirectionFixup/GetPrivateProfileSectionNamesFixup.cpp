@@ -6,6 +6,10 @@
 #include <errno.h>
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("GetPrivateProfileSectionNames");
 
 template <typename CharT>
 DWORD __stdcall GetPrivateProfileSectionNamesFixup(
@@ -18,8 +22,9 @@ DWORD __stdcall GetPrivateProfileSectionNamesFixup(
     {
         if (guard)
         {
-            DWORD GetPrivateProfileSectionNamesInstance = ++g_FileIntceptInstance;
-            LogString(GetPrivateProfileSectionNamesInstance,L"GetPrivateProfileSectionNamesFixup for fileName", widen(fileName, CP_ACP).c_str());
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD GetPrivateProfileSectionNamesInstance = psf::next_interception_id();
+            LogString(GetPrivateProfileSectionNamesInstance,L"GetPrivateProfileSectionNamesFixup for fileName", widen_argument(fileName, CP_ACP).c_str());
             if (fileName != NULL)
             {
                 if (!IsUnderUserAppDataLocalPackages(fileName))
@@ -27,6 +32,7 @@ DWORD __stdcall GetPrivateProfileSectionNamesFixup(
                     auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        FlushPendingProfile(redirectPath.c_str());
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             auto wideString = std::make_unique<wchar_t[]>(stringLength);
@@ -62,4 +68,4 @@ DWORD __stdcall GetPrivateProfileSectionNamesFixup(
 
     return impl::GetPrivateProfileSectionNames(string, stringLength, fileName);
 }
-DECLARE_STRING_FIXUP(impl::GetPrivateProfileSectionNames, GetPrivateProfileSectionNamesFixup);
+DECLARE_GROUPED_STRING_FIXUP(private_profile_hook_group, impl::GetPrivateProfileSectionNames, GetPrivateProfileSectionNamesFixup);
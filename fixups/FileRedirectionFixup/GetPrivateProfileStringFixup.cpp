@@ -5,6 +5,10 @@
 
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("GetPrivateProfileString");
 
 template <typename CharT>
 DWORD __stdcall GetPrivateProfileStringFixup(
@@ -20,12 +24,13 @@ DWORD __stdcall GetPrivateProfileStringFixup(
     {
         if (guard)
         {
-            DWORD GetPrivateProfileStringInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD GetPrivateProfileStringInstance = psf::next_interception_id();
             if constexpr (psf::is_ansi<CharT>)
             {
                 if (fileName != NULL)
                 {
-                    LogString(GetPrivateProfileStringInstance,L"GetPrivateProfileStringFixup for fileName", widen(fileName, CP_ACP).c_str());
+                    LogString(GetPrivateProfileStringInstance,L"GetPrivateProfileStringFixup for fileName", widen_argument(fileName, CP_ACP).c_str());
                 }
                 if (appName != NULL)
                 {
@@ -41,7 +46,7 @@ DWORD __stdcall GetPrivateProfileStringFixup(
             {
                 if (fileName != NULL)
                 {
-                    LogString(GetPrivateProfileStringInstance,L"GetPrivateProfileStringFixup for fileName", widen(fileName, CP_ACP).c_str());
+                    LogString(GetPrivateProfileStringInstance,L"GetPrivateProfileStringFixup for fileName", widen_argument(fileName, CP_ACP).c_str());
                 }
                 if (appName != NULL)
                 {
@@ -60,6 +65,14 @@ DWORD __stdcall GetPrivateProfileStringFixup(
                     auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        if (auto cachedRetValue = GetCachedProfileString(redirectPath.c_str(), appName, keyName, defaultString, string, stringLength))
+                        {
+                            Log(L"[%d] Cached returned length=0x%x", GetPrivateProfileStringInstance, *cachedRetValue);
+                            LogString(GetPrivateProfileStringInstance, L" Cached returned string", string);
+                            return *cachedRetValue;
+                        }
+
+                        FlushPendingProfile(redirectPath.c_str());
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             
@@ -97,4 +110,4 @@ DWORD __stdcall GetPrivateProfileStringFixup(
 
     return impl::GetPrivateProfileString(appName, keyName, defaultString, string, stringLength, fileName);
 }
-DECLARE_STRING_FIXUP(impl::GetPrivateProfileString, GetPrivateProfileStringFixup);
+DECLARE_GROUPED_STRING_FIXUP(private_profile_hook_group, impl::GetPrivateProfileString, GetPrivateProfileStringFixup);
@@ -6,6 +6,10 @@
 #include <errno.h>
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("GetPrivateProfileStruct");
 
 template <typename CharT>
 BOOL __stdcall GetPrivateProfileStructFixup(
@@ -20,8 +24,9 @@ BOOL __stdcall GetPrivateProfileStructFixup(
     {
         if (guard)
         {
-            DWORD GetPrivateProfileStructInstance = ++g_FileIntceptInstance;
-            LogString(GetPrivateProfileStructInstance,L"GetPrivateProfileStructFixup for fileName", widen(fileName, CP_ACP).c_str());
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD GetPrivateProfileStructInstance = psf::next_interception_id();
+            LogString(GetPrivateProfileStructInstance,L"GetPrivateProfileStructFixup for fileName", widen_argument(fileName, CP_ACP).c_str());
             if (fileName != NULL)
             {
                 if (!IsUnderUserAppDataLocalPackages(fileName))
@@ -29,6 +34,7 @@ BOOL __stdcall GetPrivateProfileStructFixup(
                     auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        FlushPendingProfile(redirectPath.c_str());
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             return impl::GetPrivateProfileStructW(widen_argument(sectionName).c_str(), widen_argument(key).c_str(),
@@ -58,4 +64,4 @@ BOOL __stdcall GetPrivateProfileStructFixup(
 
     return impl::GetPrivateProfileStruct(sectionName, key, structArea, uSizeStruct, fileName);
 }
-DECLARE_STRING_FIXUP(impl::GetPrivateProfileStruct, GetPrivateProfileStructFixup);
\ No newline at end of file
+DECLARE_GROUPED_STRING_FIXUP(private_profile_hook_group, impl::GetPrivateProfileStruct, GetPrivateProfileStructFixup);
\ No newline at end of file
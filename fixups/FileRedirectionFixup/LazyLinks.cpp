@@ -0,0 +1,175 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <memory>
+#include <string>
+
+#include <fancy_handle.h>
+
+#include "AbsentPathCache.h"
+#include "FunctionImplementations.h"
+#include "LazyLinks.h"
+#include "PackageContentIndex.h"
+#include "PathRedirection.h"
+#include "WhiteoutIndex.h"
+
+namespace
+{
+    using unique_file = std::unique_ptr<void, psf::handle_deleter<&::CloseHandle>>;
+
+    // Links are only ever made to the package while creating them doesn't need any privilege that the application didn't
+    // already need to create the link that it asked for
+    constexpr DWORD lazy_link_flags = SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE;
+
+    std::wstring final_path(HANDLE file)
+    {
+        std::wstring result;
+        auto length = ::GetFinalPathNameByHandleW(file, nullptr, 0, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+        if (length == 0)
+        {
+            return result;
+        }
+
+        result.resize(length);
+        length = ::GetFinalPathNameByHandleW(file, result.data(), length, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+        result.resize((length < result.length()) ? length : 0);
+
+        constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
+        if (result.compare(0, 4, root_local_device_prefix) == 0)
+        {
+            result.erase(0, 4);
+        }
+        return result;
+    }
+
+    bool materialize_lazy_link(const wchar_t* linkPath)
+    {
+        auto attributes = impl::GetFileAttributes(linkPath);
+        if ((attributes == INVALID_FILE_ATTRIBUTES) || !(attributes & FILE_ATTRIBUTE_REPARSE_POINT) ||
+            (attributes & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            return false;
+        }
+
+        // Opening the link without FILE_FLAG_OPEN_REPARSE_POINT opens whatever it points at
+        std::wstring target;
+        {
+            unique_file file(impl::CreateFile(linkPath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr));
+            if (!file)
+            {
+                return false;
+            }
+            target = final_path(file.get());
+        }
+
+        if (target.empty() || !IsPackagePath(target.c_str()))
+        {
+            return false;
+        }
+
+        auto [redirectTarget, targetRedirectPath, shouldReadonly] = ShouldRedirect(target.c_str(), redirect_flags::copy_on_read);
+        if (!redirectTarget || !RedirectedPathExists(targetRedirectPath.c_str()))
+        {
+            return false;
+        }
+
+        // Swapped in rather than deleted and made again, so that there's never a moment without the link
+        auto temporaryPath = std::wstring(linkPath) + L".psflink";
+        if (!impl::CreateSymbolicLink(temporaryPath.c_str(), targetRedirectPath.c_str(), lazy_link_flags))
+        {
+            return false;
+        }
+        if (!impl::MoveFileEx(temporaryPath.c_str(), linkPath, MOVEFILE_REPLACE_EXISTING))
+        {
+            impl::DeleteFile(temporaryPath.c_str());
+            return false;
+        }
+
+        LogString(L"\t\tFRF materialized lazy link", linkPath);
+        LogString(L"\t\tFRF lazy link now points at", targetRedirectPath.c_str());
+        return true;
+    }
+}
+
+template <typename CharT>
+static bool TryCreateLazyLinkImpl(const wchar_t* linkPath, const CharT* targetFileName, DWORD flags) noexcept try
+{
+    // Relative targets are resolved against the folder of the link rather than the current directory, so those, along
+    // with links to directories, are always made as usual
+    if (!g_lazyLinks || (flags & SYMBOLIC_LINK_FLAG_DIRECTORY) ||
+        (psf::path_type(targetFileName) != psf::dos_path_type::drive_absolute))
+    {
+        return false;
+    }
+
+    auto [redirectTarget, targetRedirectPath, shouldReadonly] = ShouldRedirect(targetFileName, redirect_flags::none);
+    if (!redirectTarget || IsWhitedOut(targetRedirectPath.native()) || RedirectedPathExists(targetRedirectPath.c_str()))
+    {
+        return false;
+    }
+
+    // The package's own file, i.e. the package VFS equivalent of whatever the application named
+    auto packagePath = ResolvePath(NormalizePath(targetFileName))->virtualized;
+    if (!packagePath.drive_absolute_path || !IsPackagePath(packagePath.drive_absolute_path) ||
+        !PackagePathExists(packagePath.drive_absolute_path))
+    {
+        return false;
+    }
+
+    auto attributes = impl::GetFileAttributes(packagePath.drive_absolute_path);
+    if ((attributes == INVALID_FILE_ATTRIBUTES) || (attributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        return false;
+    }
+
+    if (!impl::CreateSymbolicLink(linkPath, packagePath.drive_absolute_path, (flags & ~SYMBOLIC_LINK_FLAG_DIRECTORY) | lazy_link_flags))
+    {
+        Log(L"\t\tFRF could not create a lazy link, error=%d", ::GetLastError());
+        return false;
+    }
+
+    NotifyRedirectedPathCreated(linkPath);
+    LogString(L"\t\tFRF created lazy link to", packagePath.drive_absolute_path);
+    return true;
+}
+catch (...)
+{
+    return false;
+}
+
+bool TryCreateLazyLink(const wchar_t* linkPath, const wchar_t* targetFileName, DWORD flags) noexcept
+{
+    return TryCreateLazyLinkImpl(linkPath, targetFileName, flags);
+}
+
+bool TryCreateLazyLink(const wchar_t* linkPath, const char* targetFileName, DWORD flags) noexcept
+{
+    return TryCreateLazyLinkImpl(linkPath, targetFileName, flags);
+}
+
+bool MaterializeLazyLink(const wchar_t* linkPath) noexcept
+{
+    if (!g_lazyLinks || !linkPath)
+    {
+        return false;
+    }
+
+    auto err = ::GetLastError();
+    bool result = false;
+    try
+    {
+        result = materialize_lazy_link(linkPath);
+    }
+    catch (...)
+    {
+    }
+
+    if (!result)
+    {
+        ::SetLastError(err);
+    }
+    return result;
+}
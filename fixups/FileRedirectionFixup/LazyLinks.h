@@ -0,0 +1,28 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <windows.h>
+
+// Linking to a file in the package normally copies that file into the redirected area first, since the application may
+// later write to it through the link. When enabled (through the "lazyLinks" config property), a link to a package file
+// that hasn't been copied is instead created as a symbolic link straight to the package's file, so that creating it
+// costs no more than the link itself. Reads through the link are served by the package. The first open of the link that
+// is denied access swaps it for a link to the redirected copy of the file, which is then made, and is tried again.
+//
+// NOTE: Until then, writes to the file through its own path go to its redirected copy as usual, and aren't seen through
+//       the link. Hard links to package files become symbolic links too, and fall back to copying the file when the
+//       process can't create symbolic links (i.e. outside of developer mode)
+
+// Creates a symbolic link at 'linkPath', a path in the redirected area, to the package's version of 'targetFileName',
+// if that's a file the package has and the application hasn't copied or deleted. Returns false, having done nothing,
+// when the link should be made as usual instead
+bool TryCreateLazyLink(const wchar_t* linkPath, const wchar_t* targetFileName, DWORD flags) noexcept;
+bool TryCreateLazyLink(const wchar_t* linkPath, const char* targetFileName, DWORD flags) noexcept;
+
+// If 'linkPath', a path in the redirected area, is a link created by TryCreateLazyLink that still points into the
+// package, copies the package's file into the redirected area and points the link at that copy. Returns true if the
+// link was changed, in which case whatever failed on it may be tried again, and otherwise leaves the last error alone
+bool MaterializeLazyLink(const wchar_t* linkPath) noexcept;
@@ -3,8 +3,79 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
+#include "CopyJournal.h"
+#include "FileCopy.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+#include "WhiteoutIndex.h"
+
+static fixup_statistics g_statistics("MoveFile");
+
+// Moves a file that has no copy in the redirected area yet - usually one that's only in the package - by cloning or
+// copying the package's version straight to the redirected destination. Copying it to the redirected source first,
+// only to then move it, would write the file out twice when the volume can't clone it, and would leave a copy behind
+// at the source for the rest of the session when the move fails. With whiteouts enabled, a whiteout then hides the
+// package's version at the source, which is all that moving it away from there takes. Returns false, without doing
+// anything, when the source has already been redirected or isn't a file, in which case the caller moves the redirected
+// copy as before.
+//
+// NOTE: A hard link to the package's version would be cheaper still, but for the package's ACLs it can rarely be
+//       created, and when it can, writes through it would reach the package's file
+template <typename CharT>
+static bool MoveUnredirectedFile(
+    const CharT* existingFileName,
+    const std::filesystem::path& existingRedirectPath,
+    const std::filesystem::path& destRedirectPath,
+    bool replaceExisting,
+    BOOL& result)
+{
+    // Writes to the source that are still pending in the profile cache would otherwise be lost
+    FlushPendingProfile(existingRedirectPath.c_str());
+    if (RedirectedPathExists(existingRedirectPath.c_str()))
+    {
+        return false;
+    }
+    else if (IsWhitedOut(existingRedirectPath.native()))
+    {
+        result = FALSE;
+        ::SetLastError(ERROR_FILE_NOT_FOUND);
+        return true;
+    }
+
+    auto sourcePath = PackageSourcePath(existingFileName);
+    if (sourcePath.empty())
+    {
+        return false;
+    }
+
+    auto attributes = impl::GetFileAttributes(sourcePath.c_str());
+    if ((attributes == INVALID_FILE_ATTRIBUTES) || ((attributes & FILE_ATTRIBUTE_DIRECTORY) != 0))
+    {
+        return false;
+    }
+
+    FlushPendingProfile(destRedirectPath.c_str());
+    {
+        journaled_copy journal(destRedirectPath.c_str());
+        result = CopyFileToRedirectedArea(sourcePath.c_str(), destRedirectPath.c_str(), !replaceExisting);
+    }
+    if (!result && (::GetLastError() == ERROR_FILE_EXISTS))
+    {
+        // What MoveFile reports for a destination that already exists
+        ::SetLastError(ERROR_ALREADY_EXISTS);
+    }
+
+    InvalidateRedirectCache(destRedirectPath.c_str());
+    if (result)
+    {
+        NotifyRedirectedPathCreated(destRedirectPath.c_str());
+        AddWhiteout(existingRedirectPath.native());
+    }
+    return true;
+}
 
 template <typename CharT>
 BOOL __stdcall MoveFileFixup(_In_ const CharT* existingFileName, _In_ const CharT* newFileName) noexcept
@@ -14,24 +85,60 @@ BOOL __stdcall MoveFileFixup(_In_ const CharT* existingFileName, _In_ const Char
     {
         if (guard)
         {
-            DWORD MoveFileInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD MoveFileInstance = psf::next_interception_id();
             LogString(MoveFileInstance,L"MoveFileFixup From", existingFileName);
             LogString(MoveFileInstance,L"MoveFileFixup To",   newFileName);
 
             // NOTE: MoveFile needs delete access to the existing file, but since we won't have delete access to the
-            //       file if it is in the package, we copy-on-read it here. This is slightly wasteful since we're
-            //       copying it only for it to immediately get deleted, but that's simpler than trying to roll our own
-            //       implementation of MoveFile. And of course, the same limitation for deleting files applies here as
-            //       well. Additionally, we don't copy-on-read the destination file for the same reason we don't do the
-            //       same for CopyFile: we give the application the benefit of the doubt that they previously tried to
-            //       delete the file if it exists in the package path.
-            auto [redirectExisting, existingRedirectPath, shouldReadonlSource] = ShouldRedirect(existingFileName, redirect_flags::copy_on_read);
+            //       file if it is in the package, we don't move the package's file itself. When the destination gets
+            //       redirected too, the package's version is put straight there (see MoveUnredirectedFile). Otherwise
+            //       the source gets copied-on-read and the copy gets moved. And of course, the same limitation for
+            //       deleting files applies here as well. Additionally, we don't copy-on-read the destination file for
+            //       the same reason we don't do the same for CopyFile: we give the application the benefit of the
+            //       doubt that they previously tried to delete the file if it exists in the package path.
+            auto [redirectExisting, existingRedirectPath, shouldReadonlSource] = ShouldRedirect(existingFileName, redirect_flags::none);
             auto [redirectDest, destRedirectPath, shouldReadonlyDest] = ShouldRedirect(newFileName, redirect_flags::ensure_directory_structure);
+            if (redirectExisting && redirectDest)
+            {
+                BOOL bRet = FALSE;
+                if (MoveUnredirectedFile(existingFileName, existingRedirectPath, destRedirectPath, false, bRet))
+                {
+                    Log(L"[%d]MoveFile of package file returns %d.", MoveFileInstance, bRet);
+                    return bRet;
+                }
+            }
+            if (redirectExisting)
+            {
+                redirectExisting = ShouldRedirect(existingFileName, redirect_flags::copy_on_read, MoveFileInstance).should_redirect;
+            }
+            if (redirectExisting)
+            {
+                FlushPendingProfile(existingRedirectPath.c_str());
+            }
+            if (redirectDest)
+            {
+                FlushPendingProfile(destRedirectPath.c_str());
+            }
             if (redirectExisting || redirectDest)
             {
                 BOOL bRet = impl::MoveFile(
                     redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str(),
                     redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str());
+                InvalidateRedirectCache(redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str());
+                InvalidateRedirectCache(redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str());
+                if (bRet && redirectExisting)
+                {
+                    NotifyRedirectedPathRemoved(existingRedirectPath.c_str());
+                    if (WhiteoutsEnabled() && ShowsThroughRedirect(existingFileName, existingRedirectPath))
+                    {
+                        AddWhiteout(existingRedirectPath.native());
+                    }
+                }
+                if (bRet && redirectDest)
+                {
+                    NotifyRedirectedPathCreated(destRedirectPath.c_str(), true);
+                }
                 if (bRet)
                     Log(L"[%d]MoveFile returns true.", MoveFileInstance);
                 else
@@ -61,21 +168,57 @@ BOOL __stdcall MoveFileExFixup(
     {
         if (guard)
         {
-            DWORD MoveFileExInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD MoveFileExInstance = psf::next_interception_id();
             LogString(MoveFileExInstance,L"MoveFileExFixup From", existingFileName);
             LogString(MoveFileExInstance,L"MoveFileExFixup To",   newFileName);
            
 
             // See note in MoveFile for commentary on copy-on-read functionality (though we could do better by checking
-            // flags for MOVEFILE_REPLACE_EXISTING)
-            auto [redirectExisting, existingRedirectPath, shouldReadonlySource] = ShouldRedirect(existingFileName, redirect_flags::copy_on_read);
+            // flags for MOVEFILE_REPLACE_EXISTING). Moves that are put off until the next reboot are left to the OS
+            auto [redirectExisting, existingRedirectPath, shouldReadonlySource] = ShouldRedirect(existingFileName, redirect_flags::none);
             auto [redirectDest, destRedirectPath, shouldReadonlyDest] = ShouldRedirect(newFileName, redirect_flags::ensure_directory_structure);
+            if (redirectExisting && redirectDest && ((flags & MOVEFILE_DELAY_UNTIL_REBOOT) == 0))
+            {
+                BOOL bRet = FALSE;
+                if (MoveUnredirectedFile(existingFileName, existingRedirectPath, destRedirectPath, (flags & MOVEFILE_REPLACE_EXISTING) != 0, bRet))
+                {
+                    Log(L"[%d]MoveFileEx of package file returns %d.", MoveFileExInstance, bRet);
+                    return bRet;
+                }
+            }
+            if (redirectExisting)
+            {
+                redirectExisting = ShouldRedirect(existingFileName, redirect_flags::copy_on_read, MoveFileExInstance).should_redirect;
+            }
+            if (redirectExisting)
+            {
+                FlushPendingProfile(existingRedirectPath.c_str());
+            }
+            if (redirectDest)
+            {
+                FlushPendingProfile(destRedirectPath.c_str());
+            }
             if (redirectExisting || redirectDest)
             {
                 BOOL bRet= impl::MoveFileEx(
                     redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str(),
                     redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str(),
                     flags);
+                InvalidateRedirectCache(redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str());
+                InvalidateRedirectCache(redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str());
+                if (bRet && redirectExisting)
+                {
+                    NotifyRedirectedPathRemoved(existingRedirectPath.c_str());
+                    if (WhiteoutsEnabled() && ShowsThroughRedirect(existingFileName, existingRedirectPath))
+                    {
+                        AddWhiteout(existingRedirectPath.native());
+                    }
+                }
+                if (bRet && redirectDest)
+                {
+                    NotifyRedirectedPathCreated(destRedirectPath.c_str(), true);
+                }
                 if (bRet)
                     Log(L"[%d]MoveFileEx returns true.", MoveFileExInstance);
                 else
@@ -0,0 +1,315 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <known_folders.h>
+#include <package_index.h>
+#include <psf_utils.h>
+
+#include "FunctionImplementations.h"
+#include "PackageContentIndex.h"
+#include "PathRedirection.h"
+
+namespace
+{
+    std::filesystem::path g_packageContentRootPath;
+
+    // Package relative paths of every file and directory in the package, e.g. "VFS\SYSTEMX86\FOO.DLL". Only read once
+    // g_packageContentReady has been set, after which it is never modified
+    std::unordered_set<std::wstring> g_packageContent;
+    std::atomic<bool> g_packageContentReady{ false };
+
+    // An index generated at packaging time by PsfPackageIndexer, if the package has one, or otherwise one shared by
+    // another process of the package. Used in place of g_packageContent
+    psf::package_index g_prebuiltPackageIndex;
+
+    // The section that this process shared its own index in, if any. Never closed, so that processes started at any
+    // time during the lifetime of this one can use it
+    HANDLE g_sharedPackageIndex = nullptr;
+
+    // The name is specific to both the version of the package and the location of its layout, so that processes of
+    // different versions (or differently registered layouts) never see each other's index. The path is hashed with
+    // FNV-1a rather than std::hash so that 32-bit and 64-bit processes agree on the name.
+    std::wstring shared_index_name(const std::filesystem::path& rootPath)
+    {
+        std::uint64_t hash = 0xcbf29ce484222325;
+        for (auto ch : rootPath.native())
+        {
+            hash = (hash ^ static_cast<std::uint16_t>(ch)) * 0x100000001b3;
+        }
+
+        wchar_t suffix[17];
+        swprintf_s(suffix, L"%016llx", static_cast<unsigned long long>(hash));
+        return L"Local\\PsfPackageContentIndex-" + psf::current_package_full_name() + L"-" + suffix;
+    }
+
+    // Writes 'content' to a new section named 'name', in the same layout as the file written by PsfPackageIndexer. Does
+    // nothing if another process already created the section
+    void share_index(const std::wstring& name, const std::unordered_set<std::wstring>& content)
+    {
+        std::vector<const std::wstring*> keys;
+        keys.reserve(content.size());
+        std::uint64_t stringTableLength = 0;
+        for (auto& key : content)
+        {
+            keys.push_back(&key);
+            stringTableLength += key.length();
+        }
+
+        if ((keys.size() > std::numeric_limits<std::uint32_t>::max()) ||
+            (stringTableLength > std::numeric_limits<std::uint32_t>::max()))
+        {
+            return;
+        }
+
+        std::sort(keys.begin(), keys.end(), [](const std::wstring* lhs, const std::wstring* rhs) { return *lhs < *rhs; });
+
+        auto size = sizeof(psf::package_index_header) + keys.size() * sizeof(psf::package_index_entry) +
+            static_cast<std::size_t>(stringTableLength) * sizeof(wchar_t);
+        auto mapping = ::CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(static_cast<std::uint64_t>(size) >> 32), static_cast<DWORD>(size), name.c_str());
+        if (!mapping)
+        {
+            Log("\t\tFRF could not share the package content index, error=%d", ::GetLastError());
+            return;
+        }
+        else if (::GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            ::CloseHandle(mapping);
+            return;
+        }
+
+        auto view = ::MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+        if (!view)
+        {
+            ::CloseHandle(mapping);
+            return;
+        }
+
+        auto header = static_cast<psf::package_index_header*>(view);
+        auto entries = reinterpret_cast<psf::package_index_entry*>(header + 1);
+        auto strings = reinterpret_cast<wchar_t*>(entries + keys.size());
+        std::uint32_t offset = 0;
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            auto length = static_cast<std::uint32_t>(keys[i]->length());
+            entries[i] = psf::package_index_entry{ offset, length, 0 };
+            std::copy_n(keys[i]->data(), length, strings + offset);
+            offset += length;
+        }
+
+        header->version = psf::package_index_version;
+        header->entry_count = static_cast<std::uint32_t>(keys.size());
+        header->string_table_length = static_cast<std::uint32_t>(stringTableLength);
+
+        // Other processes may be looking at the section already; the magic tells them that the rest is complete
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = psf::package_index_magic;
+
+        ::UnmapViewOfFile(view);
+        g_sharedPackageIndex = mapping;
+        Log("\t\tFRF shared the package content index as %ls", name.c_str());
+    }
+
+    // The file system treats names such as "foo\..\bar", "foo\\bar" or "bar. " as aliases of "bar", however the index only
+    // knows each path by one name. Keys that aren't in that form are left to the file system
+    bool is_canonical_key(const std::wstring& key) noexcept
+    {
+        std::size_t start = 0;
+        while (start <= key.length())
+        {
+            auto end = key.find(L'\\', start);
+            if (end == std::wstring::npos)
+            {
+                end = key.length();
+            }
+
+            if ((end == start) || (key[end - 1] == L'.') || (key[end - 1] == L' '))
+            {
+                return false;
+            }
+            start = end + 1;
+        }
+
+        return true;
+    }
+
+    bool build_index(const std::filesystem::path& rootPath, std::unordered_set<std::wstring>& result)
+    {
+        std::vector<std::wstring> pending{ std::wstring{} };
+        while (!pending.empty())
+        {
+            auto relativePath = std::move(pending.back());
+            pending.pop_back();
+
+            auto searchPath = rootPath.native();
+            if (!relativePath.empty())
+            {
+                searchPath.push_back(L'\\');
+                searchPath += relativePath;
+            }
+            searchPath += LR"(\*)";
+
+            WIN32_FIND_DATAW data;
+            auto findHandle = impl::FindFirstFileEx(searchPath.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+            if (findHandle == INVALID_HANDLE_VALUE)
+            {
+                // Any folder we can't see into leaves a hole in the index, which would give wrong answers
+                Log("\t\tFRF package content index failed on %ls, error=%d", searchPath.c_str(), ::GetLastError());
+                return false;
+            }
+
+            do
+            {
+                if ((wcscmp(data.cFileName, L".") == 0) || (wcscmp(data.cFileName, L"..") == 0))
+                {
+                    continue;
+                }
+
+                auto entry = relativePath;
+                if (!entry.empty())
+                {
+                    entry.push_back(L'\\');
+                }
+                entry += data.cFileName;
+
+                // NOTE: Reparse points are recorded, but not followed, so that we never loop
+                if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+                {
+                    pending.push_back(entry);
+                }
+
+                psf::make_package_index_key(entry);
+                result.insert(std::move(entry));
+            }
+            while (impl::FindNextFile(findHandle, &data));
+
+            auto err = ::GetLastError();
+            impl::FindClose(findHandle);
+            if (err != ERROR_NO_MORE_FILES)
+            {
+                Log("\t\tFRF package content index failed on %ls, error=%d", searchPath.c_str(), err);
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+void InitializePackageContentIndex(const std::filesystem::path& packageRootPath, bool share)
+{
+    g_packageContentRootPath = psf::remove_trailing_path_separators(packageRootPath);
+
+    // NOTE: This runs before the hooks are attached, so there's no concern about redirecting our own file access
+    if (g_prebuiltPackageIndex.open(g_packageContentRootPath / psf::package_index_file_name))
+    {
+        g_packageContentReady.store(true, std::memory_order_release);
+        Log("\t\tFRF using prebuilt package content index, entries=%zu", g_prebuiltPackageIndex.size());
+        return;
+    }
+
+    std::wstring sharedName;
+    if (share)
+    {
+        sharedName = shared_index_name(g_packageContentRootPath);
+        if (g_prebuiltPackageIndex.open_shared(sharedName.c_str()))
+        {
+            g_packageContentReady.store(true, std::memory_order_release);
+            Log("\t\tFRF using shared package content index, entries=%zu", g_prebuiltPackageIndex.size());
+            return;
+        }
+    }
+
+    psf::submit_work([sharedName = std::move(sharedName)]() noexcept
+    {
+        try
+        {
+            // The hooks may run on this thread once they're attached; the enumeration itself must not be redirected
+            auto guard = g_reentrancyGuard.enter();
+
+            std::unordered_set<std::wstring> content;
+            if (build_index(g_packageContentRootPath, content))
+            {
+                g_packageContent = std::move(content);
+                g_packageContentReady.store(true, std::memory_order_release);
+                Log("\t\tFRF package content index ready, entries=%zu", g_packageContent.size());
+
+                if (!sharedName.empty())
+                {
+                    share_index(sharedName, g_packageContent);
+                }
+            }
+        }
+        catch (...)
+        {
+            Log("\t\tFRF package content index failed with an exception");
+        }
+    }, psf::work_priority::low);
+}
+
+enum class index_answer
+{
+    present,
+    absent,
+    unknown,
+};
+
+static index_answer find_in_index(const wchar_t* path)
+{
+    if (path && g_packageContentReady.load(std::memory_order_acquire) && path_relative_to(path, g_packageContentRootPath))
+    {
+        auto relativePath = path + g_packageContentRootPath.native().length();
+        if (!relativePath[0])
+        {
+            return index_answer::present;
+        }
+
+        // Otherwise something like "${PackageRoot}x" for some non-path separator 'x', which is outside of the package
+        if (psf::is_path_separator(relativePath[0]))
+        {
+            std::wstring key(relativePath + 1);
+            psf::make_package_index_key(key);
+            if (key.empty())
+            {
+                return index_answer::present;
+            }
+            else if (is_canonical_key(key))
+            {
+                bool found = g_prebuiltPackageIndex ? (g_prebuiltPackageIndex.find(key) != nullptr) :
+                    (g_packageContent.find(key) != g_packageContent.end());
+                return found ? index_answer::present : index_answer::absent;
+            }
+        }
+    }
+
+    return index_answer::unknown;
+}
+
+bool PackagePathExists(const wchar_t* path) noexcept try
+{
+    auto answer = find_in_index(path);
+    return (answer == index_answer::unknown) ? impl::PathExists(path) : (answer == index_answer::present);
+}
+catch (...)
+{
+    return impl::PathExists(path);
+}
+
+bool PackagePathKnownAbsent(const wchar_t* path) noexcept try
+{
+    return find_in_index(path) == index_answer::absent;
+}
+catch (...)
+{
+    return false;
+}
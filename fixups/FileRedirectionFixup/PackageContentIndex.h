@@ -0,0 +1,29 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+
+// The contents of the package never change at runtime, yet deciding whether or not to redirect a path usually requires
+// asking whether the package's VFS equivalent of that path exists, often several times per call (the file, its parent
+// folder, and then once more by the caller). Rather than going to the file system each time, the fixup enumerates the
+// package once on a background thread and answers those questions from memory once that's done. Packages that include
+// an index generated by PsfPackageIndexer skip the enumeration entirely.
+//
+// Applications often start several processes of their own (e.g. helper or worker processes), each of which would
+// enumerate the package again. Unless sharing is disabled, the first process to finish the index publishes it in a
+// section of named shared memory, from which processes of the same package started later on map it read only.
+
+// Starts building the index of every file and directory beneath 'packageRootPath'. When 'share' is true, an index
+// already shared by another process of the package is used if there is one, and otherwise the new index gets shared
+void InitializePackageContentIndex(const std::filesystem::path& packageRootPath, bool share);
+
+// Returns true if 'path' exists. Paths inside of the package are answered from the index once it has been built; all
+// other paths - and all paths until the index is ready - are checked against the file system
+bool PackagePathExists(const wchar_t* path) noexcept;
+
+// Returns true only if the index says that 'path', which is inside of the package, does not exist. Callers that need to
+// query whatever is at a path can skip the query when this is true, since it would fail anyway
+bool PackagePathKnownAbsent(const wchar_t* path) noexcept;
@@ -0,0 +1,202 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <package_index.h>
+
+#include "FunctionImplementations.h"
+#include "PackageListingCache.h"
+#include "PathRedirection.h"
+
+namespace
+{
+    std::filesystem::path g_packageListingRootPath;
+    std::size_t g_packageListingCacheSize = default_package_listing_cache_size;
+
+    struct cached_listing
+    {
+        std::wstring key;
+        std::shared_ptr<const directory_listing> listing;
+    };
+
+    // Most recently used first. The index refers to the keys held by the list nodes
+    std::mutex g_packageListingsLock;
+    std::list<cached_listing> g_packageListings;
+    std::unordered_map<std::wstring_view, std::list<cached_listing>::iterator> g_packageListingIndex;
+    std::size_t g_packageListingEntryCount = 0;
+
+    constexpr wchar_t find_wildcards[] = L"*?<>\"";
+
+    bool equals_ignore_case(std::wstring_view lhs, std::wstring_view rhs) noexcept
+    {
+        return ::CompareStringOrdinal(lhs.data(), static_cast<int>(lhs.length()), rhs.data(), static_cast<int>(rhs.length()), TRUE) == CSTR_EQUAL;
+    }
+
+    bool matches(std::wstring_view pattern, std::wstring_view name) noexcept
+    {
+        if (name.empty())
+        {
+            return false;
+        }
+        else if ((pattern == L"*") || (pattern == L"*.*"))
+        {
+            return true;
+        }
+        else if (pattern.front() == L'*')
+        {
+            auto suffix = pattern.substr(1);
+            return (name.length() >= suffix.length()) && equals_ignore_case(name.substr(name.length() - suffix.length()), suffix);
+        }
+        else if (pattern.back() == L'*')
+        {
+            auto prefix = pattern.substr(0, pattern.length() - 1);
+            return (name.length() >= prefix.length()) && equals_ignore_case(name.substr(0, prefix.length()), prefix);
+        }
+
+        return equals_ignore_case(name, pattern);
+    }
+
+    std::shared_ptr<const directory_listing> read_listing(const std::wstring& directory)
+    {
+        auto searchPath = directory + LR"(\*)";
+
+        WIN32_FIND_DATAW data;
+        auto findHandle = impl::FindFirstFileEx(searchPath.c_str(), FindExInfoStandard, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+        if (findHandle == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+
+        auto result = std::make_shared<directory_listing>();
+        do
+        {
+            result->append(data);
+        }
+        while (impl::FindNextFile(findHandle, &data));
+
+        auto err = ::GetLastError();
+        impl::FindClose(findHandle);
+        if (err != ERROR_NO_MORE_FILES)
+        {
+            Log("\t\tFRF package listing failed on %ls, error=%d", searchPath.c_str(), err);
+            return nullptr;
+        }
+
+        return result;
+    }
+}
+
+void InitializePackageListingCache(const std::filesystem::path& packageRootPath, std::size_t size) noexcept
+{
+    g_packageListingRootPath = psf::remove_trailing_path_separators(packageRootPath);
+    g_packageListingCacheSize = size;
+    Log("\t\tFRF package listing cache size=%zu", size);
+}
+
+std::shared_ptr<const directory_listing> GetPackageDirectoryListing(std::wstring_view directory) noexcept try
+{
+    if ((g_packageListingCacheSize == 0) || g_packageListingRootPath.empty())
+    {
+        return nullptr;
+    }
+
+    std::wstring path(directory);
+    constexpr std::wstring_view root_local_device_prefix = LR"(\\?\)";
+    if (directory.substr(0, root_local_device_prefix.length()) == root_local_device_prefix)
+    {
+        path.erase(0, root_local_device_prefix.length());
+    }
+
+    if (!path_relative_to(path.c_str(), g_packageListingRootPath))
+    {
+        return nullptr;
+    }
+
+    // E.g. "${PackageRoot}x" for some non-path separator 'x' is outside of the package
+    auto rootLength = g_packageListingRootPath.native().length();
+    if ((path.length() > rootLength) && !psf::is_path_separator(path[rootLength]))
+    {
+        return nullptr;
+    }
+
+    auto key = path;
+    psf::make_package_index_key(key);
+    {
+        std::lock_guard lock(g_packageListingsLock);
+        if (auto itr = g_packageListingIndex.find(key); itr != g_packageListingIndex.end())
+        {
+            g_packageListings.splice(g_packageListings.begin(), g_packageListings, itr->second);
+            return itr->second->listing;
+        }
+    }
+
+    auto listing = read_listing(path);
+    if (!listing || (listing->entries.size() > g_packageListingCacheSize))
+    {
+        // Too large to remember, but still good enough for the caller to use this once
+        return listing;
+    }
+
+    std::lock_guard lock(g_packageListingsLock);
+    if (auto itr = g_packageListingIndex.find(key); itr != g_packageListingIndex.end())
+    {
+        // Another thread read the same directory at the same time
+        return itr->second->listing;
+    }
+
+    while (!g_packageListings.empty() && (g_packageListingEntryCount + listing->entries.size() > g_packageListingCacheSize))
+    {
+        auto& oldest = g_packageListings.back();
+        g_packageListingEntryCount -= oldest.listing->entries.size();
+        g_packageListingIndex.erase(oldest.key);
+        g_packageListings.pop_back();
+    }
+
+    g_packageListings.push_front(cached_listing{ std::move(key), listing });
+    g_packageListingIndex.emplace(g_packageListings.front().key, g_packageListings.begin());
+    g_packageListingEntryCount += listing->entries.size();
+    return listing;
+}
+catch (...)
+{
+    return nullptr;
+}
+
+bool IsSimpleFindPattern(std::wstring_view pattern) noexcept
+{
+    // Trailing dots and spaces, as well as the names "." and "..", have special meaning to the file system
+    if (pattern.empty() || (pattern.back() == L'.') || (pattern.back() == L' ') || (pattern.find_first_of(LR"(\/)") != std::wstring_view::npos))
+    {
+        return false;
+    }
+    else if ((pattern == L"*") || (pattern == L"*.*"))
+    {
+        return true;
+    }
+    else if (pattern.front() == L'*')
+    {
+        // "*.ext" only means "ends with '.ext'" when the '*' is followed by a period, since the file system treats a '*'
+        // before a period as "anything up to the last period in the name"
+        auto suffix = pattern.substr(1);
+        return (suffix.front() == L'.') && (suffix.find_first_of(find_wildcards) == std::wstring_view::npos);
+    }
+    else if (pattern.back() == L'*')
+    {
+        // A period before the '*' could also match the end of the name, e.g. "foo.*" matches "foo"
+        auto prefix = pattern.substr(0, pattern.length() - 1);
+        return (prefix.find_first_of(find_wildcards) == std::wstring_view::npos) && (prefix.find(L'.') == std::wstring_view::npos);
+    }
+
+    return pattern.find_first_of(find_wildcards) == std::wstring_view::npos;
+}
+
+bool MatchesFindPattern(std::wstring_view pattern, std::wstring_view name, std::wstring_view alternateName) noexcept
+{
+    return matches(pattern, name) || matches(pattern, alternateName);
+}
@@ -0,0 +1,36 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+#include "DirectoryListing.h"
+
+// Directories inside of the package never change while the application runs, yet applications tend to enumerate the
+// same ones over and over again. The complete listing of each package directory is read the first time that it is
+// enumerated and kept in memory, so that later enumerations - including ones using a different pattern - never need to
+// go to the file system. Listings are evicted least recently used first once the total number of entries across all
+// listings would exceed the configured size.
+
+constexpr std::size_t default_package_listing_cache_size = 65536;
+
+// Sets the root of the package and the maximum number of entries that are remembered. A size of zero disables the cache
+void InitializePackageListingCache(const std::filesystem::path& packageRootPath, std::size_t size) noexcept;
+
+// Returns the listing of everything in 'directory', or null if 'directory' is not inside of the package or could not be
+// enumerated, in which case the caller should go to the file system itself. The listing includes short names
+std::shared_ptr<const directory_listing> GetPackageDirectoryListing(std::wstring_view directory) noexcept;
+
+// Returns true if 'pattern' can be evaluated by MatchesFindPattern. Only patterns whose meaning is the same for the
+// file system's DOS wildcard semantics as it is for a plain match are considered simple: an exact name, "*", "*.*",
+// "*.ext", or "name*"
+bool IsSimpleFindPattern(std::wstring_view pattern) noexcept;
+
+// Returns true if 'name' (or 'alternateName', as the file system also matches against short names) matches the simple
+// 'pattern'. Matching is case insensitive
+bool MatchesFindPattern(std::wstring_view pattern, std::wstring_view name, std::wstring_view alternateName) noexcept;
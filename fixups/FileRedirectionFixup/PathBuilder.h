@@ -0,0 +1,117 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <dos_paths.h>
+
+// Builds a path in a single buffer, sized once up front, as opposed to concatenating std::filesystem::path objects,
+// which creates a new heap string for every '/', parent_path(), native(), etc. Paths into the redirected area are
+// built as root-local device (i.e. "\\?\") paths, which is what allows them to exceed MAX_PATH, e.g.:
+//      auto builder = path_builder::long_path(base.length() + relative.length() + 1);
+//      builder.append(base);
+//      builder.append_component(relative);
+//      return std::move(builder).str();
+class path_builder
+{
+public:
+    static constexpr std::wstring_view long_path_prefix = LR"(\\?\)";
+
+    // 'capacity' is the expected length of the complete path. Appending more than that works, but reallocates
+    explicit path_builder(std::size_t capacity)
+    {
+        m_path.reserve(capacity);
+    }
+
+    // Same as above, but the path starts out with the "\\?\" prefix, which 'capacity' need not account for
+    static path_builder long_path(std::size_t capacity)
+    {
+        path_builder result(long_path_prefix.length() + capacity);
+        result.m_path.assign(long_path_prefix);
+        return result;
+    }
+
+    void append(std::wstring_view str)
+    {
+        m_path.append(str);
+    }
+
+    void push_back(wchar_t ch)
+    {
+        m_path.push_back(ch);
+    }
+
+    // Appends 'component' - a relative path - after a path separator, unless the path already ends with one. Matches
+    // std::filesystem::path::operator/ for relative paths, including the trailing separator for an empty component
+    void append_component(std::wstring_view component)
+    {
+        if (!m_path.empty() && !psf::is_path_separator(m_path.back()))
+        {
+            m_path.push_back(L'\\');
+        }
+        m_path.append(component);
+    }
+
+    std::size_t length() const noexcept
+    {
+        return m_path.length();
+    }
+
+    const wchar_t* c_str() const noexcept
+    {
+        return m_path.c_str();
+    }
+
+    std::wstring_view view() const noexcept
+    {
+        return m_path;
+    }
+
+    // Invokes 'func' with the first 'prefixLength' characters of the path as a null terminated string, without copying
+    // them. E.g. to create each of the directories above the complete path
+    template <typename Func>
+    decltype(auto) with_prefix(std::size_t prefixLength, Func&& func)
+    {
+        assert(prefixLength <= m_path.length());
+        prefix_terminator terminator{ m_path, prefixLength };
+        return std::forward<Func>(func)(static_cast<const wchar_t*>(m_path.c_str()));
+    }
+
+    std::wstring str() &&
+    {
+        return std::move(m_path);
+    }
+
+private:
+    // Restores the character that was overwritten with a null terminator, even if 'func' throws
+    struct prefix_terminator
+    {
+        std::wstring& path;
+        std::size_t length;
+        wchar_t saved;
+
+        prefix_terminator(std::wstring& str, std::size_t strLength) noexcept :
+            path(str),
+            length(strLength),
+            saved(str[strLength])
+        {
+            str[strLength] = L'\0';
+        }
+
+        prefix_terminator(const prefix_terminator&) = delete;
+        prefix_terminator& operator=(const prefix_terminator&) = delete;
+
+        ~prefix_terminator()
+        {
+            path[length] = saved;
+        }
+    };
+
+    std::wstring m_path;
+};
@@ -0,0 +1,137 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <cwctype>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dos_paths.h>
+
+// A trie of path prefixes, keyed on path components. Components compare case-insensitively and either path separator
+// may be used, matching the semantics of psf::path_compare. A prefix only matches at component boundaries, so "C:\foo"
+// is a prefix of "C:\foo\bar.txt" but not of "C:\foobar.txt".
+template <typename T>
+class path_component_trie
+{
+public:
+    // Returns the value associated with 'path', default constructing it if there is none yet
+    T& insert(std::wstring_view path)
+    {
+        std::size_t node = 0;
+        while (!path.empty())
+        {
+            auto end = std::find_if(path.begin(), path.end(), psf::is_path_separator<wchar_t>);
+            std::wstring_view component(path.data(), end - path.begin());
+            path.remove_prefix(component.length() + ((end == path.end()) ? 0 : 1));
+
+            auto itr = m_nodes[node].children.find(component);
+            if (itr == m_nodes[node].children.end())
+            {
+                auto child = m_nodes.size();
+                m_nodes.emplace_back();
+                itr = m_nodes[node].children.emplace(std::wstring(component), child).first;
+            }
+            node = itr->second;
+        }
+
+        auto& value = m_nodes[node].value;
+        if (!value)
+        {
+            value.emplace();
+        }
+        return *value;
+    }
+
+    // Walks 'path' one component at a time, invoking 'func(value, remainder)' for each prefix of the path that has a
+    // value, shortest prefix first. 'remainder' points inside of 'path' just past the separator that follows the prefix
+    // (or at the null terminator for an exact match). Returning false from 'func' stops the walk.
+    template <typename Func>
+    void walk(const wchar_t* path, Func&& func) const
+    {
+        if (!path)
+        {
+            return;
+        }
+
+        // The root node corresponds to an empty prefix, which only matches when a separator (or nothing) follows
+        if (auto& rootValue = m_nodes[0].value)
+        {
+            if (psf::is_path_separator(path[0]))
+            {
+                if (!func(*rootValue, path + 1))
+                {
+                    return;
+                }
+            }
+            else if (!path[0])
+            {
+                if (!func(*rootValue, path))
+                {
+                    return;
+                }
+            }
+        }
+
+        std::size_t node = 0;
+        for (auto ptr = path; *ptr; )
+        {
+            auto end = ptr;
+            while (*end && !psf::is_path_separator(*end))
+            {
+                ++end;
+            }
+
+            auto& children = m_nodes[node].children;
+            auto itr = children.find(std::wstring_view(ptr, end - ptr));
+            if (itr == children.end())
+            {
+                break;
+            }
+
+            node = itr->second;
+            ptr = *end ? end + 1 : end;
+            if (auto& value = m_nodes[node].value)
+            {
+                if (!func(*value, static_cast<const wchar_t*>(ptr)))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    void clear()
+    {
+        m_nodes.clear();
+        m_nodes.emplace_back();
+    }
+
+private:
+    struct component_less
+    {
+        using is_transparent = void;
+
+        bool operator()(std::wstring_view lhs, std::wstring_view rhs) const
+        {
+            return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](wchar_t l, wchar_t r)
+            {
+                return std::towlower(l) < std::towlower(r);
+            });
+        }
+    };
+
+    struct trie_node
+    {
+        std::map<std::wstring, std::size_t, component_less> children;
+        std::optional<T> value;
+    };
+
+    std::vector<trie_node> m_nodes = std::vector<trie_node>(1);
+};
@@ -3,7 +3,16 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include <known_folders.h>
@@ -11,8 +20,26 @@
 #include <psf_framework.h>
 #include <utilities.h>
 
+#include "AbsentPathCache.h"
+#include "ChangeWatcher.h"
+#include "CopyJournal.h"
+#include "CurrentDirectoryCache.h"
+#include "FileCopy.h"
 #include "FunctionImplementations.h"
+#include "PackageContentIndex.h"
+#include "PackageListingCache.h"
+#include "PathBuilder.h"
+#include "PathComponentTrie.h"
 #include "PathRedirection.h"
+#include "PreCopy.h"
+#include "ProfileCache.h"
+#include "ReadPrefetch.h"
+#include "RedirectCache.h"
+#include "RedirectPrefixFilter.h"
+#include "RedirectRootHandles.h"
+#include "RedirectionRules.h"
+#include "RedirectionStatistics.h"
+#include "WhiteoutIndex.h"
 #include <TraceLoggingProvider.h>
 #include "Telemetry.h"
 #include "RemovePII.h"
@@ -31,8 +58,26 @@ std::filesystem::path g_packageVfsRootPath;
 std::filesystem::path g_redirectRootPath;
 std::filesystem::path g_writablePackageRootPath;
 std::filesystem::path g_finalPackageRootPath;
+std::wstring g_packageFamilyName;
 
-DWORD g_FileIntceptInstance = 0;
+// The known folders that are checked on every call, resolved once by InitializePaths
+std::filesystem::path g_localAppDataPath;
+std::filesystem::path g_localAppDataPackagesPath;
+std::filesystem::path g_roamingAppDataPath;
+
+// How many leading characters the local and roaming AppData folders have in common, e.g. "C:\Users\<user>\AppData\"
+std::size_t g_userAppDataCommonLength = 0;
+
+// Known folders are looked up by the PsfRuntime on behalf of all of the fixups in the process, and only once each
+static std::filesystem::path KnownFolder(const GUID& id)
+{
+    if (auto path = ::PSFQueryKnownFolder(id))
+    {
+        return path;
+    }
+
+    throw std::runtime_error("Failed to get known folder path");
+}
 
 struct vfs_folder_mapping
 {
@@ -41,6 +86,11 @@ struct vfs_folder_mapping
 };
 std::vector<vfs_folder_mapping> g_vfsFolderMappings;
 
+// Indices into g_vfsFolderMappings. When more than one mapping applies, the first one wins when de-virtualizing and the
+// last one wins when virtualizing, so each index records the position of the mapping that would have been chosen.
+path_component_trie<std::size_t> g_vfsFolderNameIndex; // package_vfs_relative_path -> first mapping
+path_component_trie<std::size_t> g_vfsFolderPathIndex; // path -> last mapping
+
 void InitializePaths()
 {
     // For path comparison's sake - and the fact that std::filesystem::path doesn't handle (root-)local device paths all
@@ -60,12 +110,23 @@ void InitializePaths()
 	auto finalPackageRootPath = std::wstring(::PSFQueryFinalPackageRootPath());
 	g_finalPackageRootPath = psf::remove_trailing_path_separators(finalPackageRootPath);
     
-    // Ensure that the redirected root path exists
-    g_redirectRootPath = psf::known_folder(FOLDERID_LocalAppData) / std::filesystem::path(L"Packages") / psf::current_package_family_name() / LR"(LocalCache\Local\VFS)";
-    std::filesystem::create_directories(g_redirectRootPath);
+    g_packageFamilyName = psf::current_package_family_name();
 
-    g_writablePackageRootPath = psf::known_folder(FOLDERID_LocalAppData) /std::filesystem::path(L"Packages") / psf::current_package_family_name() / LR"(LocalCache\Local\Microsoft\WritablePackageRoot)";
-    std::filesystem::create_directories(g_writablePackageRootPath);
+    g_localAppDataPath = KnownFolder(FOLDERID_LocalAppData);
+    g_localAppDataPackagesPath = g_localAppDataPath / L"Packages";
+    g_roamingAppDataPath = KnownFolder(FOLDERID_RoamingAppData);
+    {
+        auto& local = g_localAppDataPath.native();
+        auto& roaming = g_roamingAppDataPath.native();
+        auto mismatch = std::mismatch(local.begin(), local.end(), roaming.begin(), roaming.end(), psf::path_compare{});
+        g_userAppDataCommonLength = static_cast<std::size_t>(mismatch.first - local.begin());
+    }
+
+    // NOTE: These aren't created until something actually gets redirected; see EnsureRedirectRootsExist
+    g_redirectRootPath = g_localAppDataPackagesPath / g_packageFamilyName / LR"(LocalCache\Local\VFS)";
+    g_writablePackageRootPath = g_localAppDataPackagesPath / g_packageFamilyName / LR"(LocalCache\Local\Microsoft\WritablePackageRoot)";
+
+    auto systemPath = KnownFolder(FOLDERID_System);
 
     // Folder IDs and their desktop bridge packaged VFS location equivalents. Taken from:
     // https://docs.microsoft.com/en-us/windows/uwp/porting/desktop-to-uwp-behind-the-scenes
@@ -84,38 +145,49 @@ void InitializePaths()
     //      FOLDERID_System\driverstore     AppVSystem32Driverstore                         x86, amd64
     //      FOLDERID_System\logfiles        AppVSystem32Logfiles                            x86, amd64
     //      FOLDERID_System\spool           AppVSystem32Spool                               x86, amd64
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_SystemX86),                   LR"(SystemX86)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramFilesX86),             LR"(ProgramFilesX86)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramFilesCommonX86),       LR"(ProgramFilesCommonX86)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_SystemX86),             LR"(SystemX86)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_ProgramFilesX86),       LR"(ProgramFilesX86)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_ProgramFilesCommonX86), LR"(ProgramFilesCommonX86)"sv });
 #if !_M_IX86
     // FUTURE: We may want to consider the possibility of a 32-bit application trying to reference "%windir%\sysnative\"
     //         in which case we'll have to get smarter about how we resolve paths
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System), LR"(SystemX64)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ systemPath, LR"(SystemX64)"sv });
     // FOLDERID_ProgramFilesX64* not supported for 32-bit applications
     // FUTURE: We may want to consider the possibility of a 32-bit process trying to access this path anyway. E.g. a
     //         32-bit child process of a 64-bit process that set the current directory
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramFilesX64), LR"(ProgramFilesX64)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramFilesCommonX64), LR"(ProgramFilesCommonX64)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_ProgramFilesX64), LR"(ProgramFilesX64)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_ProgramFilesCommonX64), LR"(ProgramFilesCommonX64)"sv });
 #endif
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_Windows),                      LR"(Windows)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramData),                  LR"(Common AppData)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System),                       LR"(System)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(catroot)"sv,     LR"(AppVSystem32Catroot)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(catroot2)"sv,    LR"(AppVSystem32Catroot2)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(drivers\etc)"sv, LR"(AppVSystem32DriversEtc)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(driverstore)"sv, LR"(AppVSystem32Driverstore)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(logfiles)"sv,    LR"(AppVSystem32Logfiles)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(spool)"sv,       LR"(AppVSystem32Spool)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_Windows),               LR"(Windows)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_ProgramData),           LR"(Common AppData)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ systemPath,                                  LR"(System)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ systemPath / LR"(catroot)"sv,                LR"(AppVSystem32Catroot)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ systemPath / LR"(catroot2)"sv,               LR"(AppVSystem32Catroot2)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ systemPath / LR"(drivers\etc)"sv,            LR"(AppVSystem32DriversEtc)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ systemPath / LR"(driverstore)"sv,            LR"(AppVSystem32Driverstore)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ systemPath / LR"(logfiles)"sv,               LR"(AppVSystem32Logfiles)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ systemPath / LR"(spool)"sv,                  LR"(AppVSystem32Spool)"sv });
     
     // These are additional folders that may appear in MSIX packages and need help
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_LocalAppData),                 LR"(Local AppData)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_RoamingAppData),               LR"(AppData)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ g_localAppDataPath,                          LR"(Local AppData)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ g_roamingAppDataPath,                        LR"(AppData)"sv });
 
     //These are additional folders seen from App-V packages converted into MSIX (still looking for an official App-V list)
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_Fonts),                        LR"(Fonts)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_PublicDesktop),                LR"(Common Desktop)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_CommonPrograms),               LR"(Common Programs)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_LocalAppDataLow),              LR"(LOCALAPPDATALOW)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_Fonts),                 LR"(Fonts)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_PublicDesktop),         LR"(Common Desktop)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_CommonPrograms),        LR"(Common Programs)"sv });
+    g_vfsFolderMappings.push_back(vfs_folder_mapping{ KnownFolder(FOLDERID_LocalAppDataLow),       LR"(LOCALAPPDATALOW)"sv });
+
+    g_vfsFolderNameIndex.clear();
+    g_vfsFolderPathIndex.clear();
+    for (std::size_t i = g_vfsFolderMappings.size(); i-- > 0; )
+    {
+        g_vfsFolderNameIndex.insert(g_vfsFolderMappings[i].package_vfs_relative_path.native()) = i;
+    }
+    for (std::size_t i = 0; i < g_vfsFolderMappings.size(); ++i)
+    {
+        g_vfsFolderPathIndex.insert(g_vfsFolderMappings[i].path.native()) = i;
+    }
 }
 
 std::filesystem::path path_from_known_folder_string(std::wstring_view str)
@@ -182,51 +254,55 @@ std::filesystem::path path_from_known_folder_string(std::wstring_view str)
         return {};
     }
 
-    return psf::known_folder(id);
+    return KnownFolder(id);
 }
 
-struct path_redirection_spec
-{
-    std::filesystem::path base_path;
-    std::wregex pattern;
-    std::filesystem::path redirect_targetbase;
-    bool isExclusion;
-    bool isReadOnly;
-};
+redirection_rule_set g_redirectionSpecs;
+redirect_prefix_filter g_redirectPrefixFilter;
 
-std::vector<path_redirection_spec> g_redirectionSpecs;
 
 
 
+bool g_logEnabled = true;
+bool g_enumerateShortNames = true;
+bool g_lazyCopyOnWrite = false;
+bool g_readOnlyInPlace = false;
+bool g_lazyLinks = false;
+static std::vector<std::string> g_disabledHookGroups;
+std::atomic<bool> g_initializationDeferred{ false };
 
-void Log(const char* fmt, ...)
+bool IsHookGroupEnabled(const char* group)
+{
+    return std::find(g_disabledHookGroups.begin(), g_disabledHookGroups.end(), group) == g_disabledHookGroups.end();
+}
+
+void LogImpl(const char* fmt, ...)
 {
     try
     {
+        // Nearly all messages fit in the stack buffer; only format a second time for the few that do not
+        char buffer[512];
         va_list args;
         va_start(args, fmt);
-        std::string str;
-        str.resize(256);
-        std::size_t count = std::vsnprintf(str.data(), str.size() + 1, fmt, args);
-        assert(count >= 0);
+        auto count = std::vsnprintf(buffer, std::size(buffer), fmt, args);
         va_end(args);
 
-        if (count > str.size())
+        if (count < 0)
         {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            str.resize(count);
-
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vsnprintf(str.data(), str.size() + 1, fmt, args2);
-            assert(count >= 0);
-            va_end(args2);
+            ::OutputDebugStringA(fmt);
+        }
+        else if (static_cast<std::size_t>(count) < std::size(buffer))
+        {
+            ::OutputDebugStringA(buffer);
+        }
+        else
+        {
+            std::string str(count, '\0');
+            va_start(args, fmt);
+            std::vsnprintf(str.data(), str.size() + 1, fmt, args);
+            va_end(args);
+            ::OutputDebugStringA(str.c_str());
         }
-
-        str.resize(count);
-#if _DEBUG
-        ::OutputDebugStringA(str.c_str());
-#endif
     }
     catch (...)
     {
@@ -235,31 +311,38 @@ void Log(const char* fmt, ...)
     }
 }
 
-void Log(const wchar_t* fmt, ...)  
+void LogImpl(const wchar_t* fmt, ...)
 {
     try
     {
+        // NOTE: Unlike vsnprintf, vswprintf returns a negative number when the output does not fit
+        wchar_t buffer[512];
         va_list args;
         va_start(args, fmt);
-
-        std::wstring wstr;
-        wstr.resize(256);
-        std::size_t count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args);
+        auto count = std::vswprintf(buffer, std::size(buffer), fmt, args);
         va_end(args);
 
-        if (count > wstr.size())
+        if (count >= 0)
         {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            wstr.resize(count);
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args2);
-            va_end(args2);
+            ::OutputDebugStringW(buffer);
+        }
+        else
+        {
+            va_start(args, fmt);
+            count = ::_vscwprintf(fmt, args);
+            va_end(args);
+            if (count < 0)
+            {
+                ::OutputDebugStringW(fmt);
+                return;
+            }
+
+            std::wstring wstr(count, L'\0');
+            va_start(args, fmt);
+            std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args);
+            va_end(args);
+            ::OutputDebugStringW(wstr.c_str());
         }
-        wstr.resize(count);
-#if _DEBUG
-        ::OutputDebugStringW(wstr.c_str());
-#endif
     }
     catch (...)
     {
@@ -268,17 +351,17 @@ void Log(const wchar_t* fmt, ...)
     }
 }
 
-void LogString(const char* name, const char* value)
+void LogStringImpl(const char* name, const char* value)
 {
     Log("%s=%s\n", name, value);
 }
 
-void LogString(const char* name, const wchar_t* value)
+void LogStringImpl(const char* name, const wchar_t* value)
 {
     Log(L"%s=%ls\n", name, value);
 }
 
-void LogString(const wchar_t* name, const char* value)
+void LogStringImpl(const wchar_t* name, const char* value)
 {
     if ((value != NULL && value[1] != 0x0))
     {
@@ -290,7 +373,7 @@ void LogString(const wchar_t* name, const char* value)
     }
 }
 
-void LogString(const wchar_t* name, const wchar_t* value)
+void LogStringImpl(const wchar_t* name, const wchar_t* value)
 {
     if ((value != NULL && ((char*)value)[1] == 0x0))
     {
@@ -302,17 +385,17 @@ void LogString(const wchar_t* name, const wchar_t* value)
     }
 }
 
-void LogString(DWORD inst, const char* name, const char* value)
+void LogStringImpl(DWORD inst, const char* name, const char* value)
 {
     Log("[%d] %s=%s\n", inst, name, value);
 }
 
-void LogString(DWORD inst, const char* name, const wchar_t* value)
+void LogStringImpl(DWORD inst, const char* name, const wchar_t* value)
 {
     Log(L"[%d]%s=%ls\n", inst, name, value);
 }
 
-void LogString(DWORD inst, const wchar_t* name, const char* value)
+void LogStringImpl(DWORD inst, const wchar_t* name, const char* value)
 {
     if ((value != NULL && value[1] != 0x0))
     {
@@ -324,7 +407,7 @@ void LogString(DWORD inst, const wchar_t* name, const char* value)
     }
 }
 
-void LogString(DWORD inst, const wchar_t* name, const wchar_t* value)
+void LogStringImpl(DWORD inst, const wchar_t* name, const wchar_t* value)
 {
     if ((value != NULL && ((char*)value)[1] == 0x0))
     {
@@ -337,103 +420,118 @@ void LogString(DWORD inst, const wchar_t* name, const wchar_t* value)
 }
 
 template <typename CharT>
-bool IsUnderUserAppDataLocalImpl(_In_ const CharT* fileName)
+static user_appdata_location UserAppDataLocationImpl(_In_ const CharT* fileName)
 {
     if (fileName == NULL)
     {
-        return false;
+        return user_appdata_location::none;
     }
+
     constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
     constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
-  
-    if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
+    if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName) ||
+        std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
+    {
+        fileName += 4;
+    }
+
+    // What the folders have in common only needs comparing once, after which each is left with its last component or so
+    auto& local = g_localAppDataPath.native();
+    auto& roaming = g_roamingAppDataPath.native();
+    if (!std::equal(local.begin(), local.begin() + g_userAppDataCommonLength, fileName, psf::path_compare{}))
     {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_LocalAppData));
+        return user_appdata_location::none;
     }
 
-    else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
+    auto remainder = fileName + g_userAppDataCommonLength;
+    if (std::equal(local.begin() + g_userAppDataCommonLength, local.end(), remainder, psf::path_compare{}))
     {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_LocalAppData));
+        auto& packages = g_localAppDataPackagesPath.native();
+        remainder += local.length() - g_userAppDataCommonLength;
+        return std::equal(packages.begin() + local.length(), packages.end(), remainder, psf::path_compare{}) ?
+            user_appdata_location::local_packages : user_appdata_location::local;
     }
 
-    return path_relative_to(fileName, psf::known_folder(FOLDERID_LocalAppData));
+    if (std::equal(roaming.begin() + g_userAppDataCommonLength, roaming.end(), remainder, psf::path_compare{}))
+    {
+        return user_appdata_location::roaming;
+    }
+
+    return user_appdata_location::none;
 }
-bool IsUnderUserAppDataLocal(_In_ const wchar_t* fileName)
+
+user_appdata_location UserAppDataLocation(_In_ const wchar_t* fileName)
 {
-    return IsUnderUserAppDataLocalImpl(fileName);
+    return UserAppDataLocationImpl(fileName);
 }
-bool IsUnderUserAppDataLocal(_In_ const char* fileName)
+
+user_appdata_location UserAppDataLocation(_In_ const char* fileName)
 {
-    return IsUnderUserAppDataLocalImpl(fileName);
+    return UserAppDataLocationImpl(fileName);
 }
 
-
 template <typename CharT>
-bool IsUnderUserAppDataLocalPackagesImpl(_In_ const CharT* fileName)
+bool IsUnderUserAppDataLocalImpl(_In_ const CharT* fileName)
 {
-    if (fileName == NULL)
-    {
-        return false;
-    }
-    constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
-
-    constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
-
-    if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_LocalAppData) / L"Packages");
-    }
-
-    else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_LocalAppData) / L"Packages");
-    }
-
-    return path_relative_to(fileName, psf::known_folder(FOLDERID_LocalAppData) / L"Packages");
+    auto location = UserAppDataLocationImpl(fileName);
+    return (location == user_appdata_location::local) || (location == user_appdata_location::local_packages);
+}
+bool IsUnderUserAppDataLocal(_In_ const wchar_t* fileName)
+{
+    return IsUnderUserAppDataLocalImpl(fileName);
+}
+bool IsUnderUserAppDataLocal(_In_ const char* fileName)
+{
+    return IsUnderUserAppDataLocalImpl(fileName);
 }
 
 bool IsUnderUserAppDataLocalPackages(_In_ const wchar_t* fileName)
 {
-    return IsUnderUserAppDataLocalPackagesImpl(fileName);
+    return UserAppDataLocationImpl(fileName) == user_appdata_location::local_packages;
 }
 
 bool IsUnderUserAppDataLocalPackages(_In_ const char* fileName)
 {
-    return IsUnderUserAppDataLocalPackagesImpl(fileName);
+    return UserAppDataLocationImpl(fileName) == user_appdata_location::local_packages;
 }
 
-
-template <typename CharT>
-bool IsUnderUserAppDataRoamingImpl(_In_ const CharT* fileName)
+bool IsRedirectionBypassed(_In_opt_ const wchar_t* fileName) noexcept
 {
-    if (fileName == NULL)
-    {
-        return false;
-    }
-    constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
-    constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
-
-    if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_RoamingAppData));
-    }
-
-    else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_RoamingAppData));
-    }
+    return g_redirectPrefixFilter.bypasses(fileName);
+}
 
-    return path_relative_to(fileName, psf::known_folder(FOLDERID_RoamingAppData));
+bool IsRedirectionBypassed(_In_opt_ const char* fileName) noexcept
+{
+    return g_redirectPrefixFilter.bypasses(fileName);
 }
 
 bool IsUnderUserAppDataRoaming(_In_ const wchar_t* fileName)
 {
-    return IsUnderUserAppDataRoamingImpl(fileName);
+    return UserAppDataLocationImpl(fileName) == user_appdata_location::roaming;
 }
 
 bool IsUnderUserAppDataRoaming(_In_ const char* fileName)
 {
-    return IsUnderUserAppDataRoamingImpl(fileName);
+    return UserAppDataLocationImpl(fileName) == user_appdata_location::roaming;
+}
+
+// E.g. "${PackageRoot}\VFS\<vfsFolder>\<remainder>", where 'remainder' is whatever follows 'knownFolder' in 'fileName'
+template <typename CharT>
+static std::filesystem::path PackageVFSPathUnder(const CharT* fileName, const std::filesystem::path& knownFolder, std::wstring_view vfsFolder)
+{
+    // A name that can't be converted can't be the name of anything in the package either
+    auto wideFileName = try_widen_argument(fileName, CP_ACP);
+    if (wideFileName.error != ERROR_SUCCESS)
+    {
+        return {};
+    }
+    auto remainder = std::wstring_view(wideFileName.c_str()).substr(knownFolder.native().length() + 1);
+
+    path_builder result(g_packageVfsRootPath.native().length() + vfsFolder.length() + remainder.length() + 2);
+    result.append(g_packageVfsRootPath.native());
+    result.append_component(vfsFolder);
+    result.append_component(remainder);
+    return std::move(result).str();
 }
 
 template <typename CharT>
@@ -444,41 +542,23 @@ std::filesystem::path GetPackageVFSPathImpl(const CharT* fileName)
         constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
         constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
 
-        if (IsUnderUserAppDataLocal(fileName))
+        auto location = UserAppDataLocation(fileName);
+        if ((location == user_appdata_location::local) || (location == user_appdata_location::local_packages))
         {
-            auto lad = psf::known_folder(FOLDERID_LocalAppData);
-            std::filesystem::path foo;
-            if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
+            if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName) ||
+                std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
             {
-                foo = fileName + 4;
+                fileName += 4;
             }
-
-            else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
-            {
-                foo = fileName + 4;
-            }
-
-            else
-            {
-                foo = fileName;
-            }
-            auto testLad = g_packageVfsRootPath / L"Local AppData" / foo.wstring().substr(wcslen(lad.c_str()) + 1).c_str();
-            return testLad;
+            return PackageVFSPathUnder(fileName, g_localAppDataPath, L"Local AppData");
         }
-        else if (IsUnderUserAppDataRoaming(fileName))
+        else if (location == user_appdata_location::roaming)
         {
-            auto rad = psf::known_folder(FOLDERID_RoamingAppData);
-            std::filesystem::path foo;
             if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
             {
-                foo = fileName + 4;
-            }
-            else
-            {
-                foo = fileName;
+                fileName += 4;
             }
-            auto testRad = g_packageVfsRootPath / L"AppData" / foo.wstring().substr(wcslen(rad.c_str()) + 1).c_str();
-            return testRad;
+            return PackageVFSPathUnder(fileName, g_roamingAppDataPath, L"AppData");
         }
     }
     return L"";
@@ -494,23 +574,297 @@ std::filesystem::path GetPackageVFSPath(const char* fileName)
     return GetPackageVFSPathImpl(fileName);
 }
 
+template <typename CharT>
+static std::wstring PackageSourcePathImpl(const CharT* fileName)
+{
+    if (IsUnderUserAppDataLocal(fileName) || IsUnderUserAppDataRoaming(fileName))
+    {
+        std::filesystem::path packageVersion = GetPackageVFSPath(fileName);
+        return PackagePathExists(packageVersion.c_str()) ? packageVersion.native() : std::wstring{};
+    }
+
+    return try_widen(fileName, CP_ACP).value_or(std::wstring{});
+}
+
+std::wstring PackageSourcePath(const wchar_t* fileName)
+{
+    return PackageSourcePathImpl(fileName);
+}
+
+std::wstring PackageSourcePath(const char* fileName)
+{
+    return PackageSourcePathImpl(fileName);
+}
+
+bool IsPackagePath(const wchar_t* path)
+{
+    return path_relative_to(path, g_packageRootPath) || path_relative_to(path, g_finalPackageRootPath);
+}
+
+// True if 'path' is 'basePath' or beneath it, in which case 'relativePath' is what follows 'basePath'
+static bool path_at_or_under(const std::filesystem::path& path, const std::filesystem::path& basePath, std::wstring_view& relativePath)
+{
+    if (!path_relative_to(path.c_str(), basePath))
+    {
+        return false;
+    }
+
+    relativePath = std::wstring_view(path.native()).substr(basePath.native().length());
+    if (!relativePath.empty() && !psf::is_path_separator(relativePath[0]))
+    {
+        return false;
+    }
+
+    while (!relativePath.empty() && psf::is_path_separator(relativePath[0]))
+    {
+        relativePath.remove_prefix(1);
+    }
+    return true;
+}
+
+static void InitializeRedirectPrefixFilter(const std::vector<std::filesystem::path>& bypassedPaths)
+{
+    for (auto& path : bypassedPaths)
+    {
+        // What lies in the package must always go through the fixup, if only to find its way back out of the VFS
+        std::wstring_view relativePath;
+        if (path_at_or_under(path, g_packageRootPath, relativePath) || path_at_or_under(g_packageRootPath, path, relativePath) ||
+            path_at_or_under(path, g_finalPackageRootPath, relativePath) || path_at_or_under(g_finalPackageRootPath, path, relativePath))
+        {
+            Log(L"\t\tFRF bypass ignored, since it overlaps the package: %ls", path.c_str());
+        }
+        else if (!g_redirectPrefixFilter.add_bypass(path.native()))
+        {
+            Log(L"\t\tFRF bypass ignored, since it isn't a full path: %ls", path.c_str());
+        }
+    }
+
+    // Anything in the package may be de-virtualized and then matched against a rule
+    g_redirectPrefixFilter.add(g_packageRootPath.native());
+    g_redirectPrefixFilter.add(g_finalPackageRootPath.native());
+
+    // Rules are matched against the package VFS equivalent of each path, so a rule inside of a VFS folder applies to the
+    // same path under the folder that it maps to, and a rule above a VFS folder applies to all of the folder it maps to
+    for (auto& spec : g_redirectionSpecs.specs())
+    {
+        if (spec.isExclusion)
+        {
+            continue;
+        }
+
+        g_redirectPrefixFilter.add(spec.base_path.native());
+        for (auto& mapping : g_vfsFolderMappings)
+        {
+            auto vfsPath = g_packageVfsRootPath / mapping.package_vfs_relative_path;
+            std::wstring_view relativePath;
+            if (path_at_or_under(spec.base_path, vfsPath, relativePath))
+            {
+                g_redirectPrefixFilter.add((mapping.path / relativePath).native());
+            }
+            else if (path_at_or_under(vfsPath, spec.base_path, relativePath))
+            {
+                g_redirectPrefixFilter.add(mapping.path.native());
+            }
+        }
+    }
+
+    g_redirectPrefixFilter.enable();
+    for (auto& prefix : g_redirectPrefixFilter.prefixes())
+    {
+        Log(L"\t\tFRF redirect prefix: %ls", prefix.c_str());
+    }
+    for (auto& prefix : g_redirectPrefixFilter.bypasses())
+    {
+        Log(L"\t\tFRF bypass prefix: %ls", prefix.c_str());
+    }
+}
+
 void InitializeConfiguration()
 {
     TraceLoggingRegister(g_Log_ETW_ComponentProvider);
     std::wstringstream traceDataStream;
 
+    // Nothing is formatted or scrubbed unless someone is listening; a stream in a failed state ignores whatever is
+    // written to it
+    std::filesystem::path userProfilePath;
+    auto traceEnabled = TraceLoggingProviderEnabled(g_Log_ETW_ComponentProvider, 0, MICROSOFT_KEYWORD_CRITICAL_DATA);
+    if (traceEnabled)
+    {
+        userProfilePath = psf::remove_trailing_path_separators(KnownFolder(FOLDERID_Profile));
+    }
+    else
+    {
+        traceDataStream.setstate(std::ios_base::badbit);
+    }
+    auto scrub = [&](const wchar_t* path) -> const wchar_t*
+    {
+        if (!traceEnabled)
+        {
+            return L"";
+        }
+
+        auto result = RemovePIIfromFilePath(path, userProfilePath.native());
+        return result ? result : L"";
+    };
+
     if (auto rootConfig = ::PSFQueryCurrentDllConfig())
     {
         auto& rootObject = rootConfig->as_object();
         traceDataStream << " config:\n";
+        if (auto loggingValue = rootObject.try_get("logging"))
+        {
+            g_logEnabled = loggingValue->as_boolean().get();
+            traceDataStream << " logging:" << (g_logEnabled ? L"true" : L"false") << " ;\n";
+        }
+        if (auto redirectRootValue = rootObject.try_get("redirectRoot"))
+        {
+            // NOTE: Must come before the redirection rules, which default to g_writablePackageRootPath. The PSF Runtime's
+            //       %MsixWritablePackageRoot% must be kept in sync with this
+            std::filesystem::path redirectRoot = redirectRootValue->as_string().wstring();
+            traceDataStream << " redirectRoot:" << scrub(redirectRootValue->as_string().wide()) << " ;\n";
+            if (redirectRoot.is_absolute())
+            {
+                auto root = psf::remove_trailing_path_separators(redirectRoot) / g_packageFamilyName;
+                g_redirectRootPath = root / L"VFS";
+                g_writablePackageRootPath = root / LR"(Microsoft\WritablePackageRoot)";
+                Log(L"\t\tFRF redirect root: %ls", root.c_str());
+            }
+            else
+            {
+                Log(L"\t\tFRF ignoring redirectRoot that isn't an absolute path: %ls", redirectRoot.c_str());
+            }
+        }
+        if (auto cacheSizeValue = rootObject.try_get("redirectCacheSize"))
+        {
+            auto cacheSize = cacheSizeValue->as_number().get<std::size_t>();
+            traceDataStream << " redirectCacheSize:" << cacheSize << " ;\n";
+            InitializeRedirectCache(cacheSize);
+        }
+        if (auto journalSizeValue = rootObject.try_get("redirectJournalSize"))
+        {
+            auto journalSize = journalSizeValue->as_number().get<std::size_t>();
+            traceDataStream << " redirectJournalSize:" << journalSize << " ;\n";
+            InitializeRedirectJournal(journalSize);
+        }
+        if (auto cacheSizeValue = rootObject.try_get("absentPathCacheSize"))
+        {
+            auto cacheSize = cacheSizeValue->as_number().get<std::size_t>();
+            traceDataStream << " absentPathCacheSize:" << cacheSize << " ;\n";
+            InitializeAbsentPathCache(cacheSize);
+        }
+        if (auto shortNamesValue = rootObject.try_get("enumerateShortNames"))
+        {
+            g_enumerateShortNames = shortNamesValue->as_boolean().get();
+            traceDataStream << " enumerateShortNames:" << (g_enumerateShortNames ? L"true" : L"false") << " ;\n";
+        }
+        if (auto lazyValue = rootObject.try_get("lazyCopyOnWrite"))
+        {
+            g_lazyCopyOnWrite = lazyValue->as_boolean().get();
+            traceDataStream << " lazyCopyOnWrite:" << (g_lazyCopyOnWrite ? L"true" : L"false") << " ;\n";
+        }
+        if (auto readOnlyValue = rootObject.try_get("readOnlyInPlace"))
+        {
+            g_readOnlyInPlace = readOnlyValue->as_boolean().get();
+            traceDataStream << " readOnlyInPlace:" << (g_readOnlyInPlace ? L"true" : L"false") << " ;\n";
+        }
+        if (auto lazyLinksValue = rootObject.try_get("lazyLinks"))
+        {
+            g_lazyLinks = lazyLinksValue->as_boolean().get();
+            traceDataStream << " lazyLinks:" << (g_lazyLinks ? L"true" : L"false") << " ;\n";
+        }
+        if (auto groupsValue = rootObject.try_get("disabledHookGroups"))
+        {
+            // Already read by InitializeAttachConfiguration
+            traceDataStream << " disabledHookGroups:";
+            for (auto& groupValue : groupsValue->as_array())
+            {
+                traceDataStream << " " << groupValue.as_string().wide();
+            }
+            traceDataStream << " ;\n";
+        }
+        if (auto cacheSizeValue = rootObject.try_get("profileCacheSize"))
+        {
+            auto cacheSize = cacheSizeValue->as_number().get<std::size_t>();
+            traceDataStream << " profileCacheSize:" << cacheSize << " ;\n";
+            InitializeProfileCache(cacheSize);
+        }
+        if (auto writeBehindValue = rootObject.try_get("profileWriteBehind"))
+        {
+            auto writeBehind = writeBehindValue->as_boolean().get();
+            traceDataStream << " profileWriteBehind:" << (writeBehind ? L"true" : L"false") << " ;\n";
+            InitializeProfileWriteBehind(writeBehind);
+        }
+        auto listingCacheSize = default_package_listing_cache_size;
+        if (auto cacheSizeValue = rootObject.try_get("packageListingCacheSize"))
+        {
+            listingCacheSize = cacheSizeValue->as_number().get<std::size_t>();
+            traceDataStream << " packageListingCacheSize:" << listingCacheSize << " ;\n";
+        }
+        InitializePackageListingCache(g_packageRootPath, listingCacheSize);
+        bool indexPackageContent = true;
+        if (auto indexValue = rootObject.try_get("packageContentIndex"))
+        {
+            indexPackageContent = indexValue->as_boolean().get();
+            traceDataStream << " packageContentIndex:" << (indexPackageContent ? L"true" : L"false") << " ;\n";
+        }
+        bool sharePackageContent = true;
+        if (auto shareValue = rootObject.try_get("sharePackageContentIndex"))
+        {
+            sharePackageContent = shareValue->as_boolean().get();
+            traceDataStream << " sharePackageContentIndex:" << (sharePackageContent ? L"true" : L"false") << " ;\n";
+        }
+        bool collectStatistics = false;
+        if (auto statisticsValue = rootObject.try_get("redirectionStatistics"))
+        {
+            collectStatistics = statisticsValue->as_boolean().get();
+            traceDataStream << " redirectionStatistics:" << (collectStatistics ? L"true" : L"false") << " ;\n";
+        }
+        std::uint64_t adaptiveRuleOrder = 0;
+        if (auto adaptiveValue = rootObject.try_get("adaptiveRuleOrder"))
+        {
+            adaptiveRuleOrder = adaptiveValue->as_number().get<std::uint64_t>();
+            traceDataStream << " adaptiveRuleOrder:" << adaptiveRuleOrder << " ;\n";
+        }
+        bool deletePackageFiles = false;
+        if (auto deleteValue = rootObject.try_get("deletePackageFiles"))
+        {
+            deletePackageFiles = deleteValue->as_boolean().get();
+            traceDataStream << " deletePackageFiles:" << (deletePackageFiles ? L"true" : L"false") << " ;\n";
+        }
+        bool watchRedirectedArea = false;
+        if (auto watchValue = rootObject.try_get("watchRedirectedArea"))
+        {
+            watchRedirectedArea = watchValue->as_boolean().get();
+            traceDataStream << " watchRedirectedArea:" << (watchRedirectedArea ? L"true" : L"false") << " ;\n";
+        }
+        bool journalCopies = false;
+        if (auto journalValue = rootObject.try_get("journalCopies"))
+        {
+            journalCopies = journalValue->as_boolean().get();
+            traceDataStream << " journalCopies:" << (journalCopies ? L"true" : L"false") << " ;\n";
+        }
+        std::vector<std::filesystem::path> bypassedPaths;
+        if (auto bypassValue = rootObject.try_get("bypass"))
+        {
+            traceDataStream << " bypass:";
+            for (auto& pathValue : bypassValue->as_array())
+            {
+                auto path = psf::remove_trailing_path_separators(psf::expand_variables(pathValue.as_string().wide()));
+                traceDataStream << scrub(pathValue.as_string().wide()) << " ;";
+                bypassedPaths.push_back(std::move(path));
+            }
+            traceDataStream << "\n";
+        }
         if (auto pathsValue = rootObject.try_get("redirectedPaths"))
         {
             traceDataStream << " redirectedPaths:\n";
             auto& redirectedPathsObject = pathsValue->as_object();
-            auto initializeRedirection = [&traceDataStream](const std::filesystem::path & basePath, const psf::json_array & specs, bool traceOnly = false)
+            auto initializeRedirection = [&traceDataStream, &scrub](const std::filesystem::path & basePath, const psf::json_array & specs, const std::string& location, bool traceOnly = false)
             {
+                std::size_t specIndex = 0;
                 for (auto& spec : specs)
                 {
+                    auto specLocation = location + "/" + std::to_string(specIndex++);
                     auto& specObject = spec.as_object();
                     auto path = psf::remove_trailing_path_separators(basePath / specObject.get("base").as_string().wstring());
                     std::filesystem::path redirectTargetBaseValue = g_writablePackageRootPath;
@@ -529,20 +883,22 @@ void InitializeConfiguration()
                         IsReadOnlyValue = specObject.get("isReadOnly").as_boolean().get();
                     }
                   
-                    traceDataStream << " base:" << RemovePIIfromFilePath(specObject.get("base").as_string().wide()) << " ;";
+                    traceDataStream << " base:" << scrub(specObject.get("base").as_string().wide()) << " ;";
                     traceDataStream << " patterns:";
+                    std::size_t patternIndex = 0;
                     for (auto& pattern : specObject.get("patterns").as_array())
                     {
+                        auto patternLocation = specLocation + "/patterns/" + std::to_string(patternIndex++);
                         auto patternString = pattern.as_string().wstring();
                         traceDataStream << pattern.as_string().wide() << " ;";                      
                         if (!traceOnly)
                         {
-                          g_redirectionSpecs.emplace_back();
-                          g_redirectionSpecs.back().base_path = path;
-                          g_redirectionSpecs.back().pattern.assign(patternString.data(), patternString.length());
-                          g_redirectionSpecs.back().redirect_targetbase = redirectTargetBaseValue;
-                          g_redirectionSpecs.back().isExclusion = IsExclusionValue;
-                          g_redirectionSpecs.back().isReadOnly = IsReadOnlyValue;
+                          auto& redirectSpec = g_redirectionSpecs.add(path);
+                          redirectSpec.pattern.assign(patternString.data(), patternString.length());
+                          redirectSpec.redirect_targetbase = redirectTargetBaseValue;
+                          redirectSpec.isExclusion = IsExclusionValue;
+                          redirectSpec.isReadOnly = IsReadOnlyValue;
+                          redirectSpec.config_location = std::move(patternLocation);
                         }
                     }
                     Log("\t\tFRF RULE: Path=%ls retarget=%ls", path.c_str(), redirectTargetBaseValue.c_str());
@@ -552,40 +908,144 @@ void InitializeConfiguration()
             if (auto packageRelativeValue = redirectedPathsObject.try_get("packageRelative"))
             {
                 traceDataStream << " packageRelative:\n";
-                initializeRedirection(g_packageRootPath, packageRelativeValue->as_array());
+                initializeRedirection(g_packageRootPath, packageRelativeValue->as_array(), "/redirectedPaths/packageRelative");
             }
 
             if (auto packageDriveRelativeValue = redirectedPathsObject.try_get("packageDriveRelative"))
             {
                 traceDataStream << " packageDriveRelative:\n";
-                initializeRedirection(g_packageRootPath.root_name(), packageDriveRelativeValue->as_array());
+                initializeRedirection(g_packageRootPath.root_name(), packageDriveRelativeValue->as_array(), "/redirectedPaths/packageDriveRelative");
             }
 
             if (auto knownFoldersValue = redirectedPathsObject.try_get("knownFolders"))
             {
                 traceDataStream << " knownFolders:\n";
+                std::size_t knownFolderIndex = 0;
                 for (auto& knownFolderValue : knownFoldersValue->as_array())
                 {
+                    auto location = "/redirectedPaths/knownFolders/" + std::to_string(knownFolderIndex++) + "/relativePaths";
                     auto& knownFolderObject = knownFolderValue.as_object();
                     auto path = path_from_known_folder_string(knownFolderObject.get("id").as_string().wstring());
                     traceDataStream << " id:" << knownFolderObject.get("id").as_string().wide() << " ;";
 
                     traceDataStream << " relativePaths:\n";
-                    initializeRedirection(path, knownFolderObject.get("relativePaths").as_array(), path.empty());
+                    initializeRedirection(path, knownFolderObject.get("relativePaths").as_array(), location, path.empty());
                 }
             }
         }
-
-        TraceLoggingWrite(
-            g_Log_ETW_ComponentProvider,
-            "FileRedirectionFixupConfigdata",
-            TraceLoggingWideString(traceDataStream.str().c_str(), "FileRedirectionFixupConfig"),
-            TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
-            TelemetryPrivacyDataTag(PDT_ProductAndServiceUsage),
-            TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+
+        // NOTE: These must be in place before anything below that starts redirecting on a background thread
+        InitializeRedirectPrefixFilter(bypassedPaths);
+        g_redirectionSpecs.enable_adaptive_order(adaptiveRuleOrder);
+        if (collectStatistics)
+        {
+            // Next to the default redirect roots, one profile per executable, e.g. for use with PsfRuleOrderer
+            auto profilePath = g_redirectRootPath.parent_path() / (L"PsfRedirectionProfile-" + psf::current_executable_path().stem().native() + L".txt");
+            InitializeRedirectionStatistics(g_redirectionSpecs, std::move(profilePath));
+        }
+
+        if (indexPackageContent && !g_redirectionSpecs.empty())
+        {
+            InitializePackageContentIndex(g_packageRootPath, sharePackageContent);
+        }
+
+        if (deletePackageFiles)
+        {
+            // Next to the default redirect roots, like the redirection profile
+            InitializeWhiteoutIndex(g_redirectRootPath.parent_path());
+        }
+
+        if (watchRedirectedArea)
+        {
+            // Both default redirect roots are below it
+            InitializeChangeWatcher(g_redirectRootPath.parent_path(), { g_redirectRootPath, g_writablePackageRootPath });
+        }
+
+        if (journalCopies)
+        {
+            // Before anything gets copied, e.g. by preCopy below
+            InitializeCopyJournal(g_redirectRootPath.parent_path());
+        }
+
+        if (auto preCopyValue = rootObject.try_get("preCopy"))
+        {
+            traceDataStream << " preCopy:";
+            std::vector<std::wstring> patterns;
+            for (auto& pattern : preCopyValue->as_array())
+            {
+                patterns.emplace_back(pattern.as_string().wstring());
+                traceDataStream << pattern.as_string().wide() << " ;";
+            }
+            traceDataStream << "\n";
+            InitializePreCopy(g_packageRootPath, std::move(patterns));
+        }
+
+        bool recordReadPrefetch = false;
+        if (auto recordValue = rootObject.try_get("recordReadPrefetch"))
+        {
+            recordReadPrefetch = recordValue->as_boolean().get();
+            traceDataStream << " recordReadPrefetch:" << (recordReadPrefetch ? L"true" : L"false") << " ;\n";
+        }
+        InitializeReadPrefetch(g_redirectRootPath.parent_path(), recordReadPrefetch);
+
+        if (traceEnabled)
+        {
+            TraceLoggingWrite(
+                g_Log_ETW_ComponentProvider,
+                "FileRedirectionFixupConfigdata",
+                TraceLoggingWideString(traceDataStream.str().c_str(), "FileRedirectionFixupConfig"),
+                TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
+                TelemetryPrivacyDataTag(PDT_ProductAndServiceUsage),
+                TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+        }
+    }
+
+    TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
+}
+
+bool InitializeAttachConfiguration()
+{
+    bool lazyInitialize = false;
+    if (auto rootConfig = ::PSFQueryCurrentDllConfig())
+    {
+        auto& rootObject = rootConfig->as_object();
+        if (auto groupsValue = rootObject.try_get("disabledHookGroups"))
+        {
+            for (auto& groupValue : groupsValue->as_array())
+            {
+                g_disabledHookGroups.emplace_back(groupValue.as_string().narrow());
+            }
+        }
+        if (auto lazyValue = rootObject.try_get("lazyInitialize"))
+        {
+            lazyInitialize = lazyValue->as_boolean().get();
+        }
     }
 
-    TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
+    g_initializationDeferred.store(lazyInitialize, std::memory_order_release);
+    return lazyInitialize;
+}
+
+void FinishDeferredInitialization() noexcept
+{
+    // Calls that come in on other threads meanwhile wait for it to finish; calls that the initialization itself makes on
+    // this thread never get here, since this thread is inside the guard
+    static std::once_flag initialized;
+    std::call_once(initialized, []() noexcept
+    {
+        try
+        {
+            InitializePaths();
+            InitializeConfiguration();
+        }
+        catch (...)
+        {
+            // There's no PSFInitialize left to fail, so the fixup goes on with whatever was initialized before the error
+            Log("\t\tFRF deferred initialization failed (%d)", win32_from_caught_exception());
+        }
+
+        g_initializationDeferred.store(false, std::memory_order_release);
+    });
 }
 
 template <typename CharT>
@@ -632,34 +1092,13 @@ bool IsColonColonGuid(const wchar_t *path)
     return false;
 }
 
-bool IsBlobColon(const std::string path)
-{
-    size_t found = path.find("blob:", 0);
-    if (found == 0)
-    {
-        return true;
-    }
-    found = path.find("BLOB:", 0);
-    if (found == 0)
-    {
-        return true;
-    }
-    return false;
-}
-
-bool IsBlobColon(const std::wstring path)
+template <typename CharT>
+bool IsBlobColon(std::basic_string_view<CharT> path)
 {
-    size_t found = path.find(L"blob:", 0);
-    if (found == 0)
-    {
-        return true;
-    }
-    found = path.find(L"BLOB:", 0);
-    if (found == 0)
-    {
-        return true;
-    }
-    return false;
+    constexpr CharT lower[] = { 'b', 'l', 'o', 'b', ':' };
+    constexpr CharT upper[] = { 'B', 'L', 'O', 'B', ':' };
+    return (path.length() >= std::size(lower)) &&
+        (std::equal(std::begin(lower), std::end(lower), path.begin()) || std::equal(std::begin(upper), std::end(upper), path.begin()));
 }
 
 // Method to decode a string that includes %xx replacement characters commonly found in URLs with the
@@ -742,57 +1181,41 @@ std::wstring UrlDecode(std::wstring str)
     return ret;
 }
 
-// Method to remove certain URI prefixes (std::string form)
-std::string StripAtStart(std::string old_string, const char* toStrip)
+// Method to remove certain URI prefixes. Since only prefixes are removed, the result remains null terminated if the
+// input was.
+template <typename CharT>
+std::basic_string_view<CharT> StripAtStart(std::basic_string_view<CharT> str, std::basic_string_view<CharT> toStrip)
 {
-    size_t found = old_string.find(toStrip, 0);
-    if (found == 0)
+    if ((str.length() >= toStrip.length()) && (str.compare(0, toStrip.length(), toStrip) == 0))
     {
-        return old_string.substr(strlen(toStrip));
+        str.remove_prefix(toStrip.length());
     }
-    return old_string;
-}
-
-std::string StripFileColonSlash(std::string old_string)
-{
-    std::string sRet = old_string;
-    sRet = StripAtStart(sRet, "file:\\\\");
-    sRet = StripAtStart(sRet, "file://");
-    sRet = StripAtStart(sRet, "FILE:\\\\");
-    sRet = StripAtStart(sRet, "FILE://");
-    sRet = StripAtStart(sRet, "\\\\file\\");
-    sRet = StripAtStart(sRet, "\\\\FILE\\");
-
-    return sRet;
+    return str;
 }
 
-// Method to remove certain URI prefixes (std::wstring form)
-
-std::wstring StripAtStartW(std::wstring old_string, const wchar_t* toStrip)
+std::string_view StripFileColonSlash(std::string_view str)
 {
-    size_t found = old_string.find(toStrip, 0);
-    if (found == 0)
-    {
-        return old_string.substr(wcslen(toStrip));
-    }
-    return old_string;
+    str = StripAtStart(str, "file:\\\\"sv);
+    str = StripAtStart(str, "file://"sv);
+    str = StripAtStart(str, "FILE:\\\\"sv);
+    str = StripAtStart(str, "FILE://"sv);
+    str = StripAtStart(str, "\\\\file\\"sv);
+    str = StripAtStart(str, "\\\\FILE\\"sv);
+    return str;
 }
 
-std::wstring StripFileColonSlash(std::wstring old_string)
+std::wstring_view StripFileColonSlash(std::wstring_view str)
 {
-    std::wstring sRet = old_string;
-    sRet = StripAtStartW(sRet, L"file:\\\\");
-    sRet = StripAtStartW(sRet, L"file://");
-    sRet = StripAtStartW(sRet, L"FILE:\\\\");
-    sRet = StripAtStartW(sRet, L"FILE://");
-    sRet = StripAtStartW(sRet, L"\\\\file\\");
-    sRet = StripAtStartW(sRet, L"\\\\FILE\\");
-
-    return sRet;
+    str = StripAtStart(str, L"file:\\\\"sv);
+    str = StripAtStart(str, L"file://"sv);
+    str = StripAtStart(str, L"FILE:\\\\"sv);
+    str = StripAtStart(str, L"FILE://"sv);
+    str = StripAtStart(str, L"\\\\file\\"sv);
+    str = StripAtStart(str, L"\\\\FILE\\"sv);
+    return str;
 }
 
-template <typename CharT>
-normalized_path NormalizePathImpl(const CharT* path)
+normalized_path NormalizePathImpl(const wchar_t* path)
 {
     normalized_path result;
 
@@ -800,17 +1223,24 @@ normalized_path NormalizePathImpl(const CharT* path)
     if (result.path_type == psf::dos_path_type::root_local_device)
     {
         // Root-local device paths are a direct escape into the object manager, so don't normalize them
-        result.full_path = widen(path);
+        result.full_path = path;
     }
     else if (result.path_type == psf::dos_path_type::local_device)
     {
         // these are a direct escape, but for devices.
-        result.full_path = widen(path); // widen(path + 4);
+        result.full_path = path;
     }
     else if (result.path_type != psf::dos_path_type::unknown)
     {
-        result.full_path = widen(psf::full_path(path));
-        result.path_type = psf::path_type(result.full_path.c_str());
+        // Relative paths are resolved against the fixup's own copy of the current directory, so that GetFullPathName
+        // doesn't have to read it again under the PEB lock
+        psf::path_buffer fullPath;
+        if ((result.path_type != psf::dos_path_type::relative) || !ResolveRelativePath(path, fullPath))
+        {
+            psf::full_path(path, fullPath);
+        }
+        result.full_path = fullPath.view();
+        result.path_type = fullPath.type();
     }
     else // unknown
     {
@@ -848,65 +1278,60 @@ normalized_path NormalizePathImpl(const CharT* path)
     return result;
 }
 
-normalized_path NormalizePath(const char* path)
+// NOTE: The common case - no URL encoding, no "file:" prefix - only allocates for the resulting normalized_path
+template <typename CharT>
+normalized_path NormalizePathCommon(const CharT* path)
 {
-    if (path != NULL && path[0] != 0)
+    if (path == NULL || path[0] == 0)
     {
-        std::string new_string = UrlDecode(path);       // replaces things like %3a with :
-        if (IsColonColonGuid(path))
-        {
-            Log(L"Guid: avoidance");
-            normalized_path npath;
-            npath.full_path = widen(new_string);
-            return npath;
-        }
-        if (IsBlobColon(new_string))  // blog:hexstring has been seen, believed to be associated with writing encrypted data,  Just pass it through as it is not a real file.
-        {
-            Log(L"Blob: avoidance");
-            normalized_path npath;
-            npath.full_path = widen(new_string);
-            return npath;
-        }      
-        new_string = StripFileColonSlash(new_string);        // removes "file:\\" from start of path if present
-        return NormalizePathImpl(new_string.c_str());
+        return CurrentDirectory();
     }
-    else
+
+    std::basic_string<CharT> decoded;
+    std::basic_string_view<CharT> str = path;
+    if (str.find('%') != str.npos)
     {
-        //return NormalizePathImpl(L".");
-        return NormalizePathImpl(std::filesystem::current_path().c_str());
+        decoded = UrlDecode(path);       // replaces things like %3a with :
+        str = decoded;
     }
-}
 
-normalized_path NormalizePath(const wchar_t* path)
-{
-    if (path != NULL && path[0] != 0)
+    if (IsColonColonGuid(path))
     {
-        std::wstring new_wstring = UrlDecode(path);   // replaces things like %3a with :
-        if (IsColonColonGuid(path))
-        {
-            Log(L"Guid: avoidance");
-            normalized_path npath;
-            npath.full_path = widen(new_wstring);
-            return npath;
-        }
-        if (IsBlobColon(new_wstring))  // blog:hexstring has been seen, believed to be associated with writing encrypted data,  Just pass it through as it is not a real file.
-        {
-            Log(L"Blob: avoidance");
-            normalized_path npath;
-            npath.full_path = widen(new_wstring);
-            return npath;
-        }        
+        Log(L"Guid: avoidance");
+        normalized_path npath;
+        npath.full_path = widen(std::basic_string<CharT>(str));
+        return npath;
+    }
+    if (IsBlobColon(str))  // blog:hexstring has been seen, believed to be associated with writing encrypted data,  Just pass it through as it is not a real file.
+    {
+        Log(L"Blob: avoidance");
+        normalized_path npath;
+        npath.full_path = widen(std::basic_string<CharT>(str));
+        return npath;
+    }
 
-        new_wstring = StripFileColonSlash(new_wstring);     // removes "file:\\" from start of path if present
-        return NormalizePathImpl(new_wstring.c_str());
+    str = StripFileColonSlash(str);        // removes "file:\\" from start of path if present
+    if constexpr (std::is_same_v<CharT, wchar_t>)
+    {
+        return NormalizePathImpl(str.data());
     }
     else
     {
-        //return NormalizePathImpl(L".");
-        return NormalizePathImpl(std::filesystem::current_path().c_str());
+        wide_argument_string_with_small_buffer widePath(str);
+        return NormalizePathImpl(widePath.c_str());
     }
 }
 
+normalized_path NormalizePath(const char* path)
+{
+    return NormalizePathCommon(path);
+}
+
+normalized_path NormalizePath(const wchar_t* path)
+{
+    return NormalizePathCommon(path);
+}
+
 
 
 // If the input path is relative to the VFS folder under the package path (e.g. "${PackageRoot}\VFS\SystemX64\foo.txt"),
@@ -919,27 +1344,24 @@ normalized_path DeVirtualizePath(normalized_path path)
         if (psf::is_path_separator(packageRelativePath[0]))
         {
             ++packageRelativePath;
-            for (auto& mapping : g_vfsFolderMappings)
+            const vfs_folder_mapping* match = nullptr;
+            const wchar_t* vfsRelativePath = nullptr;
+            g_vfsFolderNameIndex.walk(packageRelativePath, [&](std::size_t index, const wchar_t* remainder)
             {
-                if (path_relative_to(packageRelativePath, mapping.package_vfs_relative_path))
-                {
-                    auto vfsRelativePath = packageRelativePath + mapping.package_vfs_relative_path.native().length();
-                    if (psf::is_path_separator(vfsRelativePath[0]))
-                    {
-                        ++vfsRelativePath;
-                    }
-                    else if (vfsRelativePath[0])
-                    {
-                        // E.g. AppVSystem32Catroot2, but matched with AppVSystem32Catroot. This is not the match we are
-                        // looking for
-                        continue;
-                    }
+                match = &g_vfsFolderMappings[index];
+                vfsRelativePath = remainder;
+                return false;
+            });
 
-                    // NOTE: We should have already validated that mapping.path is drive-absolute
-                    path.full_path = (mapping.path / vfsRelativePath).native();
-                    path.drive_absolute_path = path.full_path.data();
-                    break;
-                }
+            if (match)
+            {
+                // NOTE: We should have already validated that mapping.path is drive-absolute
+                std::wstring_view remainder = vfsRelativePath;
+                path_builder result(match->path.native().length() + 1 + remainder.length());
+                result.append(match->path.native());
+                result.append_component(remainder);
+                path.full_path = std::move(result).str();
+                path.drive_absolute_path = path.full_path.data();
             }
         }
         // Otherwise a directory/file named something like "VFSx" for some non-path separator/null terminator 'x'
@@ -964,39 +1386,43 @@ normalized_path VirtualizePath(normalized_path path, DWORD impl)
     
     if (path.drive_absolute_path != NULL)
     {
-        for (std::vector<vfs_folder_mapping>::reverse_iterator iter = g_vfsFolderMappings.rbegin(); iter != g_vfsFolderMappings.rend(); ++iter)
+        auto findMapping = [](const wchar_t* input, const wchar_t*& vfsRelativePath) -> const vfs_folder_mapping*
         {
-            auto& mapping = *iter;
-            if (path_relative_to(path.drive_absolute_path, mapping.path))
+            std::size_t best = 0;
+            bool found = false;
+            g_vfsFolderPathIndex.walk(input, [&](std::size_t index, const wchar_t* remainder)
             {
-                LogString(impl, L"\t\t\t mapping entry match on path", mapping.path.wstring().c_str());
-                LogString(impl, L"\t\t\t package_vfs_relative_path", mapping.package_vfs_relative_path.native().c_str());
-                Log(L"[%d]\t\t\t rel length =%d, %d", impl, mapping.path.native().length(), mapping.package_vfs_relative_path.native().length());
-                auto vfsRelativePath = path.drive_absolute_path + mapping.path.native().length();
-                if (psf::is_path_separator(vfsRelativePath[0]))
+                if (!found || (index > best))
                 {
-                    ++vfsRelativePath;
+                    best = index;
+                    vfsRelativePath = remainder;
+                    found = true;
                 }
-                LogString(impl, L"\t\t\t VfsRelativePath", vfsRelativePath);
-                path.full_path = (g_packageVfsRootPath / mapping.package_vfs_relative_path / vfsRelativePath).native();
-                path.drive_absolute_path = path.full_path.data();
-                return path;
-            }
-            else if (path_relative_to(path.full_path.c_str(), mapping.path))
-            {
-                LogString(impl, L"\t\t\t mapping entry match on path", mapping.path.wstring().c_str());
-                LogString(impl, L"\t\t\t package_vfs_relative_path", mapping.package_vfs_relative_path.native().c_str());
-                Log(L"[%d]\t\t\t rel length =%d, %d", impl, mapping.path.native().length(), mapping.package_vfs_relative_path.native().length());
-                auto vfsRelativePath = path.full_path.c_str() + mapping.path.native().length();
-                if (psf::is_path_separator(vfsRelativePath[0]))
-                {
-                    ++vfsRelativePath;
-                }
-                LogString(impl, L"\t\t\t vfsRelativePath", vfsRelativePath);
-                path.full_path = (g_packageVfsRootPath / mapping.package_vfs_relative_path / vfsRelativePath).native();
-                path.drive_absolute_path = path.full_path.data();
-                return path;
-            }
+                return true;
+            });
+            return found ? &g_vfsFolderMappings[best] : nullptr;
+        };
+
+        const wchar_t* vfsRelativePath = nullptr;
+        auto mapping = findMapping(path.drive_absolute_path, vfsRelativePath);
+        if (!mapping && (path.full_path.c_str() != path.drive_absolute_path))
+        {
+            mapping = findMapping(path.full_path.c_str(), vfsRelativePath);
+        }
+
+        if (mapping)
+        {
+            LogString(impl, L"\t\t\t mapping entry match on path", mapping->path.wstring().c_str());
+            LogString(impl, L"\t\t\t package_vfs_relative_path", mapping->package_vfs_relative_path.native().c_str());
+            LogString(impl, L"\t\t\t VfsRelativePath", vfsRelativePath);
+            std::wstring_view remainder = vfsRelativePath;
+            path_builder result(g_packageVfsRootPath.native().length() + mapping->package_vfs_relative_path.native().length() + 2 + remainder.length());
+            result.append(g_packageVfsRootPath.native());
+            result.append_component(mapping->package_vfs_relative_path.native());
+            result.append_component(remainder);
+            path.full_path = std::move(result).str();
+            path.drive_absolute_path = path.full_path.data();
+            return path;
         }
     }
     else
@@ -1009,76 +1435,126 @@ normalized_path VirtualizePath(normalized_path path, DWORD impl)
     return path;
 }
 
-std::wstring GenerateRedirectedPath(std::wstring_view relativePath, bool ensureDirectoryStructure, std::wstring result, DWORD inst=0)
+// Creates each of the directories above the path in 'result', from 'baseLength' - the end of the redirect target's base
+// path - on down
+static void EnsureRedirectedDirectories(path_builder& result, std::size_t baseLength, DWORD inst)
 {
-    if (ensureDirectoryStructure)
+    auto relativePath = result.view().substr(baseLength);
+
+    // The length of 'result' for each of the directories that need to exist, from the top down. Trailing path
+    // separators are ignored; e.g. if the call is to CreateDirectory, we don't want it to "fail" with an "already exists"
+    // error
+    std::vector<std::size_t> directoryLengths;
+    if (!relativePath.empty())
     {
-        for (std::size_t pos = 0; pos < relativePath.length(); )
+        directoryLengths.push_back(baseLength);
+    }
+    for (std::size_t pos = 1; pos + 1 < relativePath.length(); ++pos)
+    {
+        if (psf::is_path_separator(relativePath[pos]))
         {
-            LogString(inst,L"\t\tGenerateRedirectedPath: Create dir", result.c_str());
-            [[maybe_unused]] auto dirResult = impl::CreateDirectory(result.c_str(), nullptr);
-#if _DEBUG
+            directoryLengths.push_back(baseLength + pos);
+        }
+    }
+
+    // Anything above a directory that's known to exist must exist too, so only the directories below the deepest
+    // known one need to be created
+    auto firstMissing = directoryLengths.size();
+    while ((firstMissing > 0) && !IsKnownRedirectedDirectory(result.view().substr(0, directoryLengths[firstMissing - 1])))
+    {
+        --firstMissing;
+    }
+
+    for (auto i = firstMissing; i < directoryLengths.size(); ++i)
+    {
+        result.with_prefix(directoryLengths[i], [&](const wchar_t* directory)
+        {
+            LogString(inst, L"\t\tGenerateRedirectedPath: Create dir", directory);
+            auto dirResult = impl::CreateDirectory(directory, nullptr);
             auto err = ::GetLastError();
             assert(dirResult || (err == ERROR_ALREADY_EXISTS));
-#endif
-            auto nextPos = relativePath.find_first_of(LR"(\/)", pos + 1);
-            if (nextPos == relativePath.length())
+            if (dirResult)
             {
-                // Ignore trailing path separators. E.g. if the call is to CreateDirectory, we don't want it to "fail"
-                // with an "already exists" error
-                nextPos = std::wstring_view::npos;
+                NotifyRedirectedPathCreated(directory);
             }
 
-            result += relativePath.substr(pos, nextPos - pos);
-            pos = nextPos;
-        }
+            if (dirResult || (err == ERROR_ALREADY_EXISTS))
+            {
+                NotifyRedirectedDirectoryExists(directory);
+            }
+        });
     }
-    else
+}
+
+// The default redirect targets are only created once something is first redirected to them, rather than by
+// InitializePaths, so that processes that never get redirected don't pay for it at launch
+static void EnsureRedirectRootsExist() noexcept
+{
+    static std::once_flag createdRoots;
+    std::call_once(createdRoots, []() noexcept
     {
-        result += relativePath;
-    }
+        for (auto root : { &g_redirectRootPath, &g_writablePackageRootPath })
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(*root, ec);
+            if (ec)
+            {
+                Log("\t\tFRF failed to create redirect root %ls (%d)", root->c_str(), ec.value());
+            }
+        }
 
-    return result;
+        InitializeRedirectRootHandles({ g_redirectRootPath, g_writablePackageRootPath });
+    });
+}
+
+// True if 'str' contains 'lowercase', which must already be lowercase, ignoring the case of 'str'
+static bool contains_lowercase(std::wstring_view str, std::wstring_view lowercase) noexcept
+{
+    return std::search(str.begin(), str.end(), lowercase.begin(), lowercase.end(), [](wchar_t lhs, wchar_t rhs)
+    {
+        return static_cast<wchar_t>(towlower(lhs)) == rhs;
+    }) != str.end();
 }
 
 /// <summary>
-/// Figures out the absolute path to redirect to.
+/// Figures out the absolute path to redirect to. Nothing is created; see EnsureRedirectedPath
 /// </summary>
 /// <param name="deVirtualizedPath">The original path from the app</param>
-/// <param name="ensureDirectoryStructure">If true, the deVirtualizedPath will be appended to the allowed write location</param>
+/// <param name="destinationTargetBase">The redirect target of the rule that the path matched</param>
+/// <param name="baseLength">Set to the length of the target's base path at the start of the result, or zero if the path isn't redirected to the redirected area</param>
 /// <returns>The new absolute path.</returns>
-std::wstring RedirectedPath(const normalized_path& deVirtualizedPath, bool ensureDirectoryStructure, std::filesystem::path destinationTargetBase, DWORD inst)
+static std::wstring BuildRedirectedPath(const normalized_path& deVirtualizedPath, const std::filesystem::path& destinationTargetBase, std::size_t& baseLength, DWORD inst)
 {
-    std::wstring result;
-    std::wstring basePath;
-    std::wstring relativePath;
-
     bool shouldredirectToPackageRoot = false;
-    auto deVirtualizedFullPath = deVirtualizedPath.full_path;
 
     ///if (_wcsicmp(destinationTargetBase.c_str(), g_redirectRootPath.c_str()) == 0)
-    if (_wcsicmp(destinationTargetBase.c_str(), g_writablePackageRootPath.c_str()) == 0)
-    {
-        // PSF defaulted destination target.
-        basePath = LR"(\\?\)" + g_writablePackageRootPath.native();
-    }
-    else
+    bool defaultTarget = (_wcsicmp(destinationTargetBase.c_str(), g_writablePackageRootPath.c_str()) == 0);
+    std::wstring_view basePath = defaultTarget ? g_writablePackageRootPath.native() : destinationTargetBase.native();
+    if (!defaultTarget)
     {
-        std::filesystem::path destNoTrailer = psf::remove_trailing_path_separators(destinationTargetBase);
-        basePath = LR"(\\?\)" + destNoTrailer.wstring();
+        // PSF configured destination target; same as psf::remove_trailing_path_separators
+        while (!basePath.empty() && psf::is_path_separator(basePath.back()) &&
+            !((basePath.length() >= 2) && (basePath[basePath.length() - 2] == L':')))
+        {
+            basePath.remove_suffix(1);
+        }
     }
 
-    //Lowercase the full path because .find is case-sensitive.
-    transform(deVirtualizedFullPath.begin(), deVirtualizedFullPath.end(), deVirtualizedFullPath.begin(), towlower);
- 
-    if (deVirtualizedFullPath.find(g_packageRootPath) != std::wstring::npos)
+    // The finished path is the base path, followed by at most a few dozen characters for the package cache and drive
+    // folders, followed by the input path
+    auto result = path_builder::long_path(basePath.length() + g_packageFamilyName.length() + deVirtualizedPath.full_path.length() + 48);
+    result.append(basePath);
+    auto basePathLength = result.length();
+    baseLength = 0;
+
+    if (contains_lowercase(deVirtualizedPath.full_path, g_packageRootPath.native()))
     {
         Log(L"[%d]\t\t\tcase: target in package.",inst);
         LogString(inst,L"      destinationTargetBase:     ", destinationTargetBase.c_str());
         LogString(inst,L"      g_writablePackageRootPath: ", g_writablePackageRootPath.c_str());
 
 		size_t lengthPackageRootPath = 0;
-		auto pathType = psf::path_type(deVirtualizedFullPath.c_str());
+		auto pathType = psf::path_type(deVirtualizedPath.full_path.c_str());
 
 		if (pathType == psf::dos_path_type::drive_absolute)
 		{
@@ -1089,19 +1565,21 @@ std::wstring RedirectedPath(const normalized_path& deVirtualizedPath, bool ensur
 			lengthPackageRootPath = g_finalPackageRootPath.native().length();
 		}
 
-        if (_wcsicmp(destinationTargetBase.c_str(), g_writablePackageRootPath.c_str()) == 0)
+        auto packageRelativePath = std::wstring_view(deVirtualizedPath.full_path).substr(lengthPackageRootPath);
+        if (defaultTarget)
         {
             Log(L"[%d]\t\t\tsubcase: redirect to default.",inst);
             // PSF defaulted destination target.
             shouldredirectToPackageRoot = true;
-            auto stringToTurnIntoAStringView = deVirtualizedPath.full_path.substr(lengthPackageRootPath);
-            relativePath = std::wstring_view(stringToTurnIntoAStringView);
+            result.append(packageRelativePath);
         }
         else
         {
             Log(L"[%d]\t\t\tsubcase: redirect specified.",inst);
             // PSF configured destination target: probably a home drive.
-            relativePath = L"\\PackageCache\\" + psf::current_package_family_name() +  deVirtualizedPath.full_path.substr(lengthPackageRootPath);
+            result.append(L"\\PackageCache\\");
+            result.append(g_packageFamilyName);
+            result.append(packageRelativePath);
         }
     }
     else
@@ -1129,78 +1607,158 @@ std::wstring RedirectedPath(const normalized_path& deVirtualizedPath, bool ensur
             {
                 Log(L"[%d]\t\t\tsubcase: redirect to default.",inst);
                 // PSF defaulted destination target.
-                relativePath = L"\\";
+                result.push_back(L'\\');
             }
             else
             {
                 Log(L"[%d]\t\t\tsubcase: redirect specified.",inst);
                 // PSF  configured destination target: probably a home drive.
-                relativePath = L"\\PackageCache\\" + psf::current_package_family_name() + +L"\\VFS\\PackageDrive";
+                result.append(L"\\PackageCache\\");
+                result.append(g_packageFamilyName);
+                result.append(L"\\VFS\\PackageDrive");
             }
 
             // NTFS doesn't allow colons in filenames, so simplest thing is to just substitute something in; use a dollar sign
             // similar to what's done for UNC paths
             ///// Note: assert here is normal it ignore for FindFileEx with file input "*" case which becomes a different type.
             assert(psf::path_type(deVirtualizedPath.drive_absolute_path) == psf::dos_path_type::drive_absolute);
-            relativePath.push_back(L'\\');
-            relativePath.push_back(deVirtualizedPath.drive_absolute_path[0]);
-            relativePath.push_back('$');
-            auto remainingLength = wcslen(deVirtualizedPath.drive_absolute_path);
-            remainingLength -= 2;
-
-            relativePath.append(deVirtualizedPath.drive_absolute_path + 2, remainingLength);
+            result.push_back(L'\\');
+            result.push_back(deVirtualizedPath.drive_absolute_path[0]);
+            result.push_back('$');
+            result.append(deVirtualizedPath.drive_absolute_path + 2);
         }
     }
 
-    ////Log(L"\tFRF devirt.full_path %ls", deVirtualizedPath.full_path.c_str());
-    ////Log(L"\tFRF devirt.da_path %ls", deVirtualizedPath.drive_absolute_path);
-    LogString(inst,L"\tFRF initial basePath", basePath.c_str());
-    LogString(inst,L"\tFRF initial relative", relativePath.c_str());
+    baseLength = basePathLength;
+    result.with_prefix(baseLength, [&](const wchar_t* base) { LogString(inst,L"\tFRF initial basePath", base); });
+    LogString(inst,L"\tFRF initial relative", result.c_str() + baseLength);
+    if (shouldredirectToPackageRoot)
+    {
+        Log(L"[%d]\t\tFRF shouldredirectToPackageRoot case returns result",inst);
+    }
+    else
+    {
+        Log(L"[%d]\t\tFRF not to PackageRoot case returns result",inst);
+    }
+    return std::move(result).str();
+}
+
+void EnsureRedirectedPath(const resolved_path& path, bool ensureDirectoryStructure, DWORD inst)
+{
+    if (path.redirect_base_length == 0)
+    {
+        return;
+    }
 
     // Create folder structure, if needed
-    if (impl::PathExists( (basePath +  relativePath).c_str()))
+    EnsureRedirectRootsExist();
+    if (RedirectedPathExists(path.redirect_path.c_str()))
     {
-        result = basePath + relativePath;
         Log(L"[%d]\t\tFRF Found that a copy exists in the redirected area so we skip the folder creation.",inst);
     }
-    else
+    else if (ensureDirectoryStructure)
     {
-        std::wstring_view relativePathview = std::wstring_view(relativePath);
+        path_builder result(path.redirect_path.length());
+        result.append(path.redirect_path);
+        EnsureRedirectedDirectories(result, path.redirect_base_length, inst);
+    }
+}
 
-        if (shouldredirectToPackageRoot)
-        {
-            result = GenerateRedirectedPath(relativePath, ensureDirectoryStructure, basePath,inst);
-            Log(L"[%d]\t\tFRF shouldredirectToPackageRoot case returns result",inst);
-            Log(result.c_str());
-        }
-        else
+bool resolved_path::virtualized_exists() const noexcept
+{
+    return (virtualized_presence != package_presence::unknown) ? (virtualized_presence == package_presence::present) :
+        (virtualized.drive_absolute_path && PackagePathExists(virtualized.drive_absolute_path));
+}
+
+bool resolved_path::devirtualized_exists() const noexcept
+{
+    return (devirtualized_presence != package_presence::unknown) ? (devirtualized_presence == package_presence::present) :
+        (devirtualized.drive_absolute_path && PackagePathExists(devirtualized.drive_absolute_path));
+}
+
+static package_presence PresenceOf(const normalized_path& path)
+{
+    if (!path.drive_absolute_path || !IsPackagePath(path.drive_absolute_path))
+    {
+        return package_presence::unknown;
+    }
+    return PackagePathExists(path.drive_absolute_path) ? package_presence::present : package_presence::absent;
+}
+
+static std::shared_ptr<const resolved_path> ResolvePathImpl(const normalized_path& path, DWORD inst)
+{
+    auto result = std::make_shared<resolved_path>();
+    result->virtualized = VirtualizePath(path, inst);
+    result->devirtualized = DeVirtualizePath(path);
+
+    // Paths that aren't drive-absolute (local devices, volume GUID paths and so on) aren't redirected, and are
+    // "redirected" to themselves by anything that asks anyway
+    if ((path.path_type == psf::dos_path_type::local_device) || !result->virtualized.drive_absolute_path)
+    {
+        result->redirect_path = result->virtualized.full_path;
+        return result;
+    }
+
+    // Rules are matched against the package VFS equivalent of the path. The rule set only hands back a spec whose base
+    // path contains the path (an exact match assumes an implicit directory separator at the end, e.g. for matches to
+    // satisfy the first call to CreateDirectory) and whose pattern matches the remaining relative path
+    const std::filesystem::path* targetBase = &g_writablePackageRootPath;
+    const wchar_t* relativePath = nullptr;
+    if (auto redirectSpec = g_redirectionSpecs.find(result->virtualized.drive_absolute_path, &relativePath))
+    {
+        result->rule_index = static_cast<std::size_t>(redirectSpec - g_redirectionSpecs.specs().data());
+        result->excluded = redirectSpec->isExclusion;
+        result->read_only = redirectSpec->isReadOnly;
+        LogString(inst, L"\t\tFRF In ball park of base", redirectSpec->base_path.c_str());
+        LogString(inst, L"\t\t\tFRF relativePath", relativePath);
+        if (!redirectSpec->isExclusion)
         {
-            result = GenerateRedirectedPath(relativePath, ensureDirectoryStructure, basePath,inst);
-            Log(L"[%d]\t\tFRF not to PackageRoot case returns result",inst);
-            Log(result.c_str());
+            targetBase = &redirectSpec->redirect_targetbase;
         }
-       
     }
+
+    result->redirect_path = BuildRedirectedPath(result->virtualized, *targetBase, result->redirect_base_length, inst);
+    result->virtualized_presence = PresenceOf(result->virtualized);
+    result->devirtualized_presence = PresenceOf(result->devirtualized);
     return result;
 }
 
-std::wstring RedirectedPath(const normalized_path& deVirtualizedPath, bool ensureDirectoryStructure,DWORD inst)
+namespace
 {
-    // Only until all code paths use the new version of the interface...
-    return RedirectedPath(deVirtualizedPath, ensureDirectoryStructure, g_writablePackageRootPath.native(), inst);
+    // Resolutions only depend on the configuration and on the package, neither of which change while the process runs,
+    // so they're kept until they're pushed out by others. Each thread keeps its own, so that looking one up never takes
+    // a lock. Direct mapped, by the hash of the normalized path
+    constexpr std::size_t resolution_cache_size = 64;
+
+    struct resolution_cache_entry
+    {
+        std::wstring key;
+        std::shared_ptr<const resolved_path> resolution;
+    };
+
+    thread_local resolution_cache_entry t_resolutions[resolution_cache_size];
 }
 
-template <typename CharT>
-static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags flags, DWORD inst)
+std::shared_ptr<const resolved_path> ResolvePath(const normalized_path& path, DWORD inst)
 {
-    path_redirect_info result;
-
-    if (!path)
+    auto& entry = t_resolutions[std::hash<std::wstring>{}(path.full_path) % resolution_cache_size];
+    if (!entry.resolution || (entry.key != path.full_path))
     {
-        return result;
+        entry.resolution = ResolvePathImpl(path, inst);
+        entry.key = path.full_path;
     }
-    LogString(inst, L"\tFRF Should: for path", widen(path).c_str());
-    
+    else
+    {
+        LogString(inst, L"\t\tFRF cached resolution", entry.resolution->redirect_path.c_str());
+    }
+
+    return entry.resolution;
+}
+
+template <typename CharT>
+static path_redirect_info ResolveRedirect(const CharT* path, const normalized_path& normalizedPath, redirect_flags flags, DWORD inst, bool& cacheable)
+{
+    path_redirect_info result;
 
     bool c_presense = flag_set(flags, redirect_flags::check_file_presence);
     bool c_copy = flag_set(flags, redirect_flags::copy_file);
@@ -1209,8 +1767,6 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
 
     // normalizedPath represents the requested path, redirected to the external system if relevant, or just as requested if not.
     // vfsPath represents this as a package relative path
-    auto normalizedPath = NormalizePath(path);
-    std::filesystem::path destinationTargetBase;
 
     if (normalizedPath.path_type == psf::dos_path_type::local_device)
     {
@@ -1225,97 +1781,45 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
     }
 
     LogString(inst, L"\t\tFRF Normalized", normalizedPath.drive_absolute_path);
-    // To be consistent in where we redirect files, we need to map VFS paths to their non-package-relative equivalent
-    normalizedPath = DeVirtualizePath(std::move(normalizedPath));
-
-    LogString(inst, L"\t\tFRF DeVirtualized", normalizedPath.drive_absolute_path);
-
-	// If you change the below logic, or
-	// you you change what goes into RedirectedPath
-	// you need to mirror all changes in FindFirstFileFixup.cpp
-	
-	// Basically, what goes into RedirectedPath here also needs to go into 
-	// FindFirstFileFixup.cpp
-    auto vfspath = NormalizePath(path);
-    vfspath = VirtualizePath(std::move(vfspath),inst);
+
+    // To be consistent in where we redirect files, we need to map VFS paths to their non-package-relative equivalent,
+    // while rules are matched against the package VFS equivalent. Both, and where the path goes, come from the one
+    // resolution, which the directory enumerations share
+    auto resolution = ResolvePath(normalizedPath, inst);
+    auto& vfspath = resolution->virtualized;
+
+    LogString(inst, L"\t\tFRF DeVirtualized", resolution->devirtualized.drive_absolute_path);
     if (vfspath.drive_absolute_path != NULL)
     {
         LogString(inst, L"\t\tFRF Virtualized", vfspath.drive_absolute_path);
     }
 
-    // Figure out if this is something we need to redirect
-    for (auto& redirectSpec : g_redirectionSpecs)
+    std::size_t specIndex = resolution->rule_index;
+    if (specIndex != resolved_path::no_rule)
     {
-        //LogString(inst, L"\t\tFRF Check against: base", redirectSpec.base_path.c_str());
-        if (path_relative_to(vfspath.drive_absolute_path, redirectSpec.base_path))
+        RecordRedirectSpecMatch(specIndex);
+        if (resolution->excluded)
         {
-            LogString(inst, L"\t\tFRF In ball park of base", redirectSpec.base_path.c_str());
-            auto relativePath = vfspath.drive_absolute_path + redirectSpec.base_path.native().length();
-            if (psf::is_path_separator(relativePath[0]))
-            {
-                ++relativePath;
-            }
-            else if (relativePath[0])
-            {
-                // Otherwise, just a substring match (e.g. we're trying to match against 'foo' but input was 'foobar')
-                continue;
-            }
-            // Otherwise exact match. Assume an implicit directory separator at the end (e.g. for matches to satisfy the
-            // first call to CreateDirectory
-            LogString(inst, L"\t\t\tFRF relativePath",relativePath);
-            if (std::regex_match(relativePath, redirectSpec.pattern))
-            {
-                if (redirectSpec.isExclusion)
-                {
-                    // The impact on isExclusion is that redirection is not needed.
-                    result.should_redirect = false;
-                    LogString(inst, L"\t\tFRF CASE:Exclusion for path", path);
-                }
-                else
-                {
-                    result.should_redirect = true;
-                    result.shouldReadonly = (redirectSpec.isReadOnly == true);			
-
-                    // Check if file exists as VFS path in the package
-                    if (impl::PathExists(vfspath.drive_absolute_path))
-                    {
-                        Log(L"[%d]\t\t\tFRF CASE:match, existing in package.", inst);
-                        destinationTargetBase = redirectSpec.redirect_targetbase;
-                        result.redirect_path = RedirectedPath(vfspath, flag_set(flags, redirect_flags::ensure_directory_structure), destinationTargetBase,inst);
-                    }
-                    else
-                    {
-                        Log(L"[%d]\t\t\tFRF CASE:match, not existing in package.",inst);
-                        // If the folder above it exists, we might want to redirect anyway?
-                        std::filesystem::path abs = vfspath.drive_absolute_path;
-                        if (impl::PathExists(abs.parent_path().c_str()))
-                        {
-                            Log(L"[%d]\t\t\tFRF SUBCASE: parent folder is in package.",inst);
-                            destinationTargetBase = redirectSpec.redirect_targetbase;
-                            //result.redirect_path = RedirectedPath(normalizedPath, flag_set(flags, redirect_flags::ensure_directory_structure), destinationTargetBase);
-                            result.redirect_path = RedirectedPath(vfspath, flag_set(flags, redirect_flags::ensure_directory_structure), destinationTargetBase,inst);
-                        }
-                        else
-                        {
-                            Log(L"[%d]\t\t\tFRF SUBCASE: parent folder is also not in package, but since relative should redirect.", inst);
-                            //result.should_redirect = false;
-                            destinationTargetBase = redirectSpec.redirect_targetbase;
-                            result.redirect_path = RedirectedPath(vfspath, flag_set(flags, redirect_flags::ensure_directory_structure), destinationTargetBase,inst);
-                        }
-                    }
-                    if (result.should_redirect)
-                        LogString(inst, L"\t\tFRF CASE:match on redirect_path", result.redirect_path.c_str());
-                }
-                break;
-            }
-            else
-            {
-                LogString(inst, L"\t\tFRF no match on parse relativePath", relativePath);
-            }
+            // The impact on isExclusion is that redirection is not needed.
+            result.should_redirect = false;
+            LogString(inst, L"\t\tFRF CASE:Exclusion for path", path);
         }
         else
         {
-            LogString(inst, L"\t\tFRF Not in ball park of base", redirectSpec.base_path.c_str());
+            result.should_redirect = true;
+            result.shouldReadonly = resolution->read_only;
+            if (result.shouldReadonly && g_readOnlyInPlace && flag_set(flags, redirect_flags::read_only_in_place))
+            {
+                // The caller serves the file from the package, so there's never anything to copy
+                Log(L"[%d]\t\t\tFRF read-only spec opened in place, no copy", inst);
+                flags &= ~redirect_flags::copy_file;
+            }
+
+            // The path is redirected whether or not the package has it, or even the folder above it
+            Log(L"[%d]\t\t\tFRF CASE:match, %ls in package.", inst, resolution->virtualized_exists() ? L"existing" : L"not existing");
+            EnsureRedirectedPath(*resolution, flag_set(flags, redirect_flags::ensure_directory_structure), inst);
+            result.redirect_path = resolution->redirect_path;
+            LogString(inst, L"\t\tFRF CASE:match on redirect_path", result.redirect_path.c_str());
         }
     }
 
@@ -1330,15 +1834,25 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
 
     Log(L"[%d]\t\tFRF post check 2",inst);
 
-    if (flag_set(flags, redirect_flags::check_file_presence))
+    // Once the package's version has been deleted, the redirected area is all there is: the path exists if, and only if,
+    // it exists there, and there's nothing to copy
+    bool whitedOut = IsWhitedOut(result.redirect_path.native());
+    if (whitedOut)
+    {
+        Log(L"[%d]\t\tFRF package version was deleted", inst);
+    }
+
+    if (flag_set(flags, redirect_flags::check_file_presence) && !whitedOut)
     {
-        if (!impl::PathExists(result.redirect_path.c_str()) &&
-            !impl::PathExists(vfspath.drive_absolute_path) &&
-            !impl::PathExists(normalizedPath.drive_absolute_path))
+        if (!RedirectedPathExists(result.redirect_path.c_str()) &&
+            !resolution->virtualized_exists() &&
+            !resolution->devirtualized_exists())
         {
             result.should_redirect = false;
             result.redirect_path.clear();
 
+            // The file may well be created later on, so this result cannot be remembered
+            cacheable = false;
             LogString(inst, L"\tFRF skipped (redirected not present check failed) for path", path);
             return result;
         }
@@ -1346,18 +1860,22 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
 
     Log(L"[%d]\t\tFRF post check 3",inst);
 
-    if (flag_set(flags, redirect_flags::copy_file))
+    if (flag_set(flags, redirect_flags::copy_file) && !whitedOut)
     {
         Log(L"[%d]\t\tFRF copy_file flag is set",inst);
         [[maybe_unused]] BOOL copyResult = false;
-        if (impl::PathExists(result.redirect_path.c_str()))
+
+        // Another thread (e.g. the pre-copy thread) may already be copying this file; wait for it to finish so that the
+        // check below sees the completed copy
+        redirected_copy_lock copyLock(result.redirect_path.c_str());
+        if (RedirectedPathExists(result.redirect_path.c_str()))
         {
             Log(L"[%d]\t\tFRF Found that a copy exists in the redirected area so we skip the folder creation.",inst);
         }
         else
         {
-            std::filesystem::path CopySource = normalizedPath.drive_absolute_path;
-            if (impl::PathExists(vfspath.drive_absolute_path))
+            std::filesystem::path CopySource = resolution->devirtualized.drive_absolute_path;
+            if (resolution->virtualized_exists())
             {
                 CopySource = vfspath.drive_absolute_path;
             }
@@ -1370,21 +1888,39 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
                 if ((attr & FILE_ATTRIBUTE_DIRECTORY) != FILE_ATTRIBUTE_DIRECTORY)
                 {
                     Log(L"[%d]FRF we have a file to be copied to %ls", inst, result.redirect_path.c_str());
-                    copyResult = impl::CopyFileEx(
-                        CopySource.c_str(), //normalizedPath.drive_absolute_path,
-                        result.redirect_path.c_str(),
-                        nullptr,
-                        nullptr,
-                        nullptr,
-                        COPY_FILE_FAIL_IF_EXISTS | COPY_FILE_NO_BUFFERING);
+
+                    // Another process of the package may have made, or be making, the same copy
+                    copyLock.lock_across_processes();
+                    if (impl::PathExists(result.redirect_path.c_str()))
+                    {
+                        copyResult = FALSE;
+                        ::SetLastError(ERROR_FILE_EXISTS);
+                    }
+                    else
+                    {
+                        journaled_copy journal(result.redirect_path.c_str());
+                        copyResult = CopyFileToRedirectedArea(
+                            CopySource.c_str(), //normalizedPath.drive_absolute_path,
+                            result.redirect_path.c_str(),
+                            true);
+                    }
                     if (copyResult)
                     {
+                        InvalidateRedirectCache(result.redirect_path.c_str());
+                        NotifyRedirectedPathCreated(result.redirect_path.c_str());
+                        RecordRedirectCopy(specIndex, result.redirect_path.c_str());
                         LogString(inst, L"\t\tFRF CopyFile Success From", CopySource.c_str());
                         LogString(inst, L"\t\tFRF CopyFile Success To", result.redirect_path.c_str());
                     }
                     else
                     {
                         auto err = ::GetLastError();
+                        cacheable = (err == ERROR_FILE_EXISTS);
+                        if (err == ERROR_FILE_EXISTS)
+                        {
+                            // Created behind our back
+                            NotifyRedirectedPathCreated(result.redirect_path.c_str());
+                        }
                         Log("[%d]\t\tFRF CopyFile Fail=0x%x", inst, err);
                         LogString(inst, L"\t\tFRF CopyFile Fail From", CopySource.c_str());
                         LogString(inst, L"\t\tFRF CopyFile Fail To", result.redirect_path.c_str());
@@ -1414,11 +1950,19 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
                     copyResult = impl::CreateDirectoryEx(CopySource.c_str(), result.redirect_path.c_str(), nullptr);
                     if (copyResult)
                     {
+                        InvalidateRedirectCache(result.redirect_path.c_str());
+                        NotifyRedirectedPathCreated(result.redirect_path.c_str());
+                        RecordRedirectCopy(specIndex, result.redirect_path.c_str());
                         LogString(inst, L"\t\tFRF CreateDir Success From", CopySource.c_str());
                         LogString(inst, L"\t\tFRF CreateDir Success To", result.redirect_path.c_str());
                     }
                     else
                     {
+                        cacheable = (::GetLastError() == ERROR_ALREADY_EXISTS);
+                        if (cacheable)
+                        {
+                            NotifyRedirectedPathCreated(result.redirect_path.c_str());
+                        }
                         Log("[%d]\t\tFRF CreateDir Fail=0x%x", inst, ::GetLastError());
                         LogString(inst, L"\t\tFRF CreateDir Fail From", CopySource.c_str());
                         LogString(inst, L"\t\tFRF CreateDir Fail To", result.redirect_path.c_str());
@@ -1441,12 +1985,69 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
     return result;
 }
 
+template <typename CharT>
+static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags flags, DWORD inst)
+{
+    if (!path)
+    {
+        return {};
+    }
+    LogString(inst, L"\tFRF Should: for path", widen_argument(path).c_str());
+
+    if (g_redirectPrefixFilter.excludes(path))
+    {
+        Log(L"[%d]\tFRF Should: outside of all redirected paths", inst);
+        return {};
+    }
+
+    auto normalizedPath = NormalizePath(path);
+
+    path_redirect_info result;
+    if (TryGetCachedRedirect(normalizedPath.full_path, flags, result))
+    {
+        LogString(inst, L"\tFRF Should: cached result", result.redirect_path.c_str());
+        return result;
+    }
+
+    bool cacheable = true;
+    result = ResolveRedirect(path, normalizedPath, flags, inst, cacheable);
+    if (cacheable)
+    {
+        CacheRedirect(normalizedPath.full_path, flags, result);
+    }
+
+    return result;
+}
+
 path_redirect_info ShouldRedirect(const char* path, redirect_flags flags, DWORD inst)
 {
-    return ShouldRedirectImpl(path, flags, inst);
+    auto start = RedirectionStatisticsTimestamp();
+
+    // Widen once, up front, so that the rest of the pipeline works on the one copy. URL escapes are decoded as bytes,
+    // so the rare path that has them keeps going through the narrow implementation
+    path_redirect_info result;
+    if (path && !std::strchr(path, '%'))
+    {
+        // Paths that aren't valid UTF-8 are left alone, rather than throwing for the caller to fall back on the original
+        // function, which is what they'd come to anyway
+        auto widePath = try_widen_argument(path);
+        if (widePath.error == ERROR_SUCCESS)
+        {
+            result = ShouldRedirectImpl(widePath.c_str(), flags, inst);
+        }
+    }
+    else
+    {
+        result = ShouldRedirectImpl(path, flags, inst);
+    }
+    RecordShouldRedirect(start, result.should_redirect);
+    return result;
 }
 
 path_redirect_info ShouldRedirect(const wchar_t* path, redirect_flags flags, DWORD inst)
 {
-    return ShouldRedirectImpl(path, flags, inst);
+    auto start = RedirectionStatisticsTimestamp();
+    auto result = ShouldRedirectImpl(path, flags, inst);
+    RecordShouldRedirect(start, result.should_redirect);
+    return result;
 }
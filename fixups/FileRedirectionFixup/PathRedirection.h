@@ -4,8 +4,11 @@
 //-------------------------------------------------------------------------------------------------------
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <dos_paths.h>
+#include <interception_id.h>
 
 enum class redirect_flags
 {
@@ -14,6 +17,10 @@ enum class redirect_flags
     copy_file = 0x0002,
     check_file_presence = 0x0004,
 
+    // The caller opens files that fall under an isReadOnly spec straight from the package, so they need not be copied
+    // into the redirected area. Only has an effect when g_readOnlyInPlace is set
+    read_only_in_place = 0x0008,
+
     copy_on_read = ensure_directory_structure | copy_file,
 };
 DEFINE_ENUM_FLAG_OPERATORS(redirect_flags);
@@ -34,8 +41,60 @@ struct path_redirect_info
 path_redirect_info ShouldRedirect(const char* path, redirect_flags flags, DWORD inst = 0);
 path_redirect_info ShouldRedirect(const wchar_t* path, redirect_flags flags, DWORD inst = 0);
 
+// Discards all cached ShouldRedirect results. Must be called after any operation that adds or removes files or
+// directories in the redirected area outside of ShouldRedirect itself (e.g. deleting a redirected file)
+void InvalidateRedirectCache() noexcept;
+
+// Same as above, but only results that redirect to 'path' - or to something below it - are forgotten by the process
+// wide journal. Preferred whenever the operation is known to have only changed what is at 'path'
+void InvalidateRedirectCache(const wchar_t* path) noexcept;
+
 struct normalized_path
 {
+    normalized_path() = default;
+
+    // drive_absolute_path points into full_path, so copies and moves need to re-point it at their own buffer
+    normalized_path(const normalized_path& other) :
+        full_path(other.full_path),
+        path_type(other.path_type),
+        drive_absolute_path(rebase(other.drive_absolute_offset()))
+    {
+    }
+
+    normalized_path(normalized_path&& other) noexcept :
+        path_type(other.path_type)
+    {
+        auto offset = other.drive_absolute_offset();
+        full_path = std::move(other.full_path);
+        drive_absolute_path = rebase(offset);
+        other.drive_absolute_path = nullptr;
+    }
+
+    normalized_path& operator=(const normalized_path& other)
+    {
+        if (this != &other)
+        {
+            auto offset = other.drive_absolute_offset();
+            full_path = other.full_path;
+            path_type = other.path_type;
+            drive_absolute_path = rebase(offset);
+        }
+        return *this;
+    }
+
+    normalized_path& operator=(normalized_path&& other) noexcept
+    {
+        if (this != &other)
+        {
+            auto offset = other.drive_absolute_offset();
+            full_path = std::move(other.full_path);
+            path_type = other.path_type;
+            drive_absolute_path = rebase(offset);
+            other.drive_absolute_path = nullptr;
+        }
+        return *this;
+    }
+
     // The full_path could either be:
     //      1.  A drive-absolute path. E.g. "C:\foo\bar.txt"
     //      2.  A local device path. E.g. "\\.\C:\foo\bar.txt" or "\\.\COM1"
@@ -44,16 +103,76 @@ struct normalized_path
     // or empty if there was a failure
     std::wstring full_path;
 
-    psf::dos_path_type path_type;
+    psf::dos_path_type path_type = psf::dos_path_type::unknown;
 
     // A pointer inside of full_path if the path explicitly uses a drive symbolic link at the root, otherwise nullptr.
     // Note that this isn't perfect; e.g. we don't handle scenarios such as "\\localhost\C$\foo\bar.txt"
     wchar_t* drive_absolute_path = nullptr;
+
+private:
+    std::ptrdiff_t drive_absolute_offset() const noexcept
+    {
+        return drive_absolute_path ? (drive_absolute_path - full_path.data()) : -1;
+    }
+
+    wchar_t* rebase(std::ptrdiff_t offset) noexcept
+    {
+        return (offset >= 0) ? (full_path.data() + offset) : nullptr;
+    }
 };
 
 normalized_path NormalizePath(const char* path);
 normalized_path NormalizePath(const wchar_t* path);
 
+// Whether the package has a path, where that's known once and for all: the contents of the package never change, but
+// anything outside of it may
+enum class package_presence : std::uint8_t
+{
+    unknown, // Not a package path; ask the file system each time
+    present,
+    absent,
+};
+
+// Everything about a normalized path that deciding where it goes depends on, short of what's in the redirected area: the
+// views of it that rules are matched against and that redirection is based on, the rule that matches it, where it's
+// redirected to, and whether the package has it. ShouldRedirect and the directory enumerations both work from this,
+// so that they always agree on where a path is redirected to
+struct resolved_path
+{
+    // The path with any package VFS folder mapped to its native equivalent (see DeVirtualizePath)
+    normalized_path devirtualized;
+
+    // The path with any native folder mapped to its package VFS equivalent (see VirtualizePath)
+    normalized_path virtualized;
+
+    // Where the path is redirected to: below the target of the rule that matches it or, if no rule does (or the rule is
+    // an exclusion), below the default target. The first 'redirect_base_length' characters are the target's base path,
+    // and zero if the path is not in the redirected area at all, e.g. for a path on a file share
+    std::wstring redirect_path;
+    std::size_t redirect_base_length = 0;
+
+    // The index of the rule that matches the virtualized path, if any, and what it says
+    static constexpr std::size_t no_rule = static_cast<std::size_t>(-1);
+    std::size_t rule_index = no_rule;
+    bool excluded = false;
+    bool read_only = false;
+
+    package_presence virtualized_presence = package_presence::unknown;
+    package_presence devirtualized_presence = package_presence::unknown;
+
+    // Whether the package has the virtualized or devirtualized path, asking the file system only if that isn't known
+    bool virtualized_exists() const noexcept;
+    bool devirtualized_exists() const noexcept;
+};
+
+// Resolves an already normalized path. A resolution only depends on the configuration and the package, so each thread
+// keeps the most recent ones, and the opens, attribute queries and enumerations of the same path share one
+std::shared_ptr<const resolved_path> ResolvePath(const normalized_path& path, DWORD inst = 0);
+
+// Creates the redirect roots and, if 'ensureDirectoryStructure' is true, the directories above the path that 'path'
+// redirects to, unless the redirected path already exists
+void EnsureRedirectedPath(const resolved_path& path, bool ensureDirectoryStructure, DWORD inst = 0);
+
 // If the input path is relative to the VFS folder under the package path (e.g. "${PackageRoot}\VFS\SystemX64\foo.txt"),
 // then modifies that path to its virtualized equivalent (e.g. "C:\Windows\System32\foo.txt")
 normalized_path DeVirtualizePath(normalized_path path);
@@ -64,16 +183,28 @@ normalized_path DeVirtualizePath(normalized_path path);
 normalized_path VirtualizePath(normalized_path path, DWORD impl = 0);
 
 
-
-// Short-circuit to determine what the redirected path would be. No check to see if the path should be redirected is
-// performed.
-std::wstring RedirectedPath(const normalized_path& deVirtualizedPath, bool ensureDirectoryStructure = false, DWORD inst = 0);
-
 // does path start with basePath
 bool path_relative_to(const wchar_t* path, const std::filesystem::path& basePath);
 bool path_relative_to(const char* path, const std::filesystem::path& basePath);
 
 
+// Determines if the path of the filename is beneath one of the directories that the configuration lists under "bypass",
+// which the fixups hand on as-is without so much as logging them
+bool IsRedirectionBypassed(_In_opt_ const wchar_t* fileName) noexcept;
+bool IsRedirectionBypassed(_In_opt_ const char* fileName) noexcept;
+
+// Which of the user's AppData folders, if any, the path of the filename falls under. Local AppData's Packages folder is
+// told apart from the rest of it. All of it is decided in one pass over the path
+enum class user_appdata_location
+{
+    none,
+    local,
+    local_packages,
+    roaming,
+};
+user_appdata_location UserAppDataLocation(_In_ const wchar_t* fileName);
+user_appdata_location UserAppDataLocation(_In_ const char* fileName);
+
 // Determines if the path of the filename falls under the user's appdata local or roaming folders.
 bool IsUnderUserAppDataLocal(_In_ const wchar_t* fileName);
 bool IsUnderUserAppDataLocalPackages(_In_ const wchar_t* fileName);
@@ -86,17 +217,70 @@ bool IsUnderUserAppDataRoaming(_In_ const char* fileName);
 std::filesystem::path GetPackageVFSPath(const wchar_t* fileName);
 std::filesystem::path GetPackageVFSPath(const char* fileName);
 
+// Returns the path of the package's version of 'fileName', or an empty string if the package has no such file. Apart
+// from AppData, which the runtime does not layer the package's VFS into, that's just the path the app asked for
+std::wstring PackageSourcePath(const wchar_t* fileName);
+std::wstring PackageSourcePath(const char* fileName);
+
+// Whether 'path' is the package root or something inside of it
+bool IsPackagePath(const wchar_t* path);
+
+// When false (set through the "enumerateShortNames" config property), the fixup's own directory enumerations use
+// FindExInfoBasic even when the application asked for FindExInfoStandard, and so never return short names
+extern bool g_enumerateShortNames;
+
+// When true (set through the "lazyCopyOnWrite" config property), files are only copied into the redirected area when
+// they are opened with write access, rather than on any open
+extern bool g_lazyCopyOnWrite;
+
+// When true (set through the "readOnlyInPlace" config property), files under isReadOnly specs that are only present in
+// the package are opened from the package with read-only access, instead of being copied into the redirected area first
+extern bool g_readOnlyInPlace;
+
+// When true (set through the "lazyLinks" config property), links to package files that haven't been copied point at the
+// package's file until they are written through (see LazyLinks.h)
+extern bool g_lazyLinks;
+
+// The detours of all of the private profile (.ini file) functions, which applications that don't use them can leave out
+// through the "disabledHookGroups" config property
+constexpr char private_profile_hook_group[] = "privateProfile";
+
+// False for groups listed in the "disabledHookGroups" config property
+bool IsHookGroupEnabled(const char* group);
+
+
+
+
+// Diagnostic output, sent to OutputDebugString. Logging is only compiled into debug builds unless FRF_LOGGING is defined
+// to be non-zero, and can be turned off at runtime through the "logging" config property. Log and LogString are macros
+// so that, whenever logging is compiled out or turned off, their arguments are never evaluated; all that's left is a
+// single branch (or nothing at all).
+#ifndef FRF_LOGGING
+#if _DEBUG
+#define FRF_LOGGING 1
+#else
+#define FRF_LOGGING 0
+#endif
+#endif
 
+extern bool g_logEnabled;
 
+void LogImpl(const char* fmt, ...);
+void LogImpl(const wchar_t* fmt, ...);
+void LogStringImpl(const char* name, const char* value);
+void LogStringImpl(const char* name, const wchar_t* value);
+void LogStringImpl(const wchar_t* name, const char* value);
+void LogStringImpl(const wchar_t* name, const wchar_t* value);
+void LogStringImpl(DWORD inst, const char* name, const char* value);
+void LogStringImpl(DWORD inst, const char* name, const wchar_t* value);
+void LogStringImpl(DWORD inst, const wchar_t* name, const char* value);
+void LogStringImpl(DWORD inst, const wchar_t* name, const wchar_t* value);
 
-void Log(const char* fmt, ...);
-void Log(const wchar_t* fmt, ...);
-void LogString(const char* name, const char* value);
-void LogString(const char* name, const wchar_t* value);
-void LogString(const wchar_t* name, const char* value);
-void LogString(const wchar_t* name, const wchar_t* value);
-void LogString(DWORD inst, const char* name, const char* value);
-void LogString(DWORD inst, const char* name, const wchar_t* value);
-void LogString(DWORD inst, const wchar_t* name, const char* value);
-void LogString(DWORD inst, const wchar_t* name, const wchar_t* value);
-extern DWORD g_FileIntceptInstance;
+#if FRF_LOGGING
+#define Log(...) (g_logEnabled ? LogImpl(__VA_ARGS__) : (void)0)
+#define LogString(...) (g_logEnabled ? LogStringImpl(__VA_ARGS__) : (void)0)
+#else
+// NOTE: The arguments still need to be referenced so that values only computed for logging don't give warnings
+#define Log(...) ((void)sizeof((LogImpl(__VA_ARGS__), 0)))
+#define LogString(...) ((void)sizeof((LogStringImpl(__VA_ARGS__), 0)))
+#endif
@@ -0,0 +1,85 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+
+#include <known_folders.h>
+
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+#include "PreCopy.h"
+#include "RedirectionStatistics.h"
+
+namespace
+{
+    fixup_statistics g_statistics("PreCopy");
+
+    std::size_t pre_copy_pattern(const std::filesystem::path& packageRootPath, std::wstring pattern)
+    {
+        std::replace(pattern.begin(), pattern.end(), L'/', L'\\');
+        pattern.erase(0, pattern.find_first_not_of(L'\\'));
+        auto searchPath = psf::remove_trailing_path_separators(packageRootPath / pattern);
+        auto directory = searchPath.parent_path();
+
+        WIN32_FIND_DATAW data;
+        auto findHandle = impl::FindFirstFileEx(searchPath.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, 0);
+        if (findHandle == INVALID_HANDLE_VALUE)
+        {
+            Log("\t\tFRF pre-copy found nothing for %ls, error=%d", searchPath.c_str(), ::GetLastError());
+            return 0;
+        }
+
+        std::size_t count = 0;
+        do
+        {
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                continue;
+            }
+
+            auto path = directory / data.cFileName;
+            auto inst = psf::next_interception_id();
+            LogString(inst, L"\tFRF pre-copy", path.c_str());
+            if (ShouldRedirect(path.c_str(), redirect_flags::copy_on_read, inst).should_redirect)
+            {
+                ++count;
+            }
+        }
+        while (impl::FindNextFile(findHandle, &data));
+
+        impl::FindClose(findHandle);
+        return count;
+    }
+}
+
+void InitializePreCopy(const std::filesystem::path& packageRootPath, std::vector<std::wstring> patterns)
+{
+    if (patterns.empty())
+    {
+        return;
+    }
+
+    // Ahead of other background work, since the application may soon be waiting for these copies
+    psf::submit_work([packageRootPath, patterns = std::move(patterns)]() noexcept
+    {
+        try
+        {
+            // The hooks may run on this thread once they're attached; the copies themselves must not be redirected
+            auto guard = g_reentrancyGuard.enter();
+            fixup_statistics_scope statisticsScope(g_statistics);
+
+            std::size_t count = 0;
+            for (auto& pattern : patterns)
+            {
+                count += pre_copy_pattern(packageRootPath, pattern);
+            }
+            Log("\t\tFRF pre-copy complete, files=%zu", count);
+        }
+        catch (...)
+        {
+            Log("\t\tFRF pre-copy failed with an exception");
+        }
+    }, psf::work_priority::high);
+}
@@ -0,0 +1,21 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Many applications write to the same few package files (configuration, state, etc.) right after they launch, and each
+// first write has to wait for the file to be copied to the redirected area. Files that are known to be written can be
+// listed in the configuration so that they are copied on a background thread as soon as the fixup is initialized. An
+// open that comes in while one of these files is being copied waits for that copy (see redirected_copy_lock) rather
+// than making a copy of its own.
+
+// Starts copying the package files matched by 'patterns' to wherever the redirection rules send them. Each pattern is a
+// path relative to 'packageRootPath' whose last component may contain the wildcards '*' and '?', e.g.
+// "VFS/AppData/Contoso/settings.ini" or "VFS/AppData/Contoso/*.dat". Files that no redirection rule applies to, or that
+// already have a copy in the redirected area, are skipped
+void InitializePreCopy(const std::filesystem::path& packageRootPath, std::vector<std::wstring> patterns);
@@ -0,0 +1,857 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fancy_handle.h>
+#include <utilities.h>
+
+#include "AbsentPathCache.h"
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+#include "ProfileCache.h"
+
+namespace
+{
+    // Larger files are rare enough, and slow enough to read regardless, that they're left to Windows
+    constexpr DWORD max_cached_profile_size = 4 * 1024 * 1024;
+
+    // The names of sections and keys are both case insensitive, so the maps are keyed by the case folded name
+    using profile_section = std::unordered_map<std::wstring, std::wstring>;
+
+    struct parsed_profile
+    {
+        FILETIME last_write_time;
+        DWORD file_size;
+        std::unordered_map<std::wstring, profile_section> sections;
+    };
+
+    // Writes that are held in memory until they're flushed to disk. The text of the file is kept line by line so that
+    // everything the application doesn't change (comments, formatting, etc.) is written back out as it was
+    struct pending_profile
+    {
+        std::wstring path;
+        bool unicode = false;
+        std::vector<std::wstring> lines;
+
+        // Parsed from 'lines' on demand; null whenever 'lines' has changed since
+        std::shared_ptr<const parsed_profile> parsed;
+    };
+
+    std::size_t g_profileCacheSize = default_profile_cache_size;
+    bool g_profileWriteBehind = false;
+
+    // Pending writes are flushed once the application has stopped writing for this long
+    constexpr LONGLONG profile_flush_delay_ms = 1000;
+
+    // Guards both the parsed profiles and the pending writes
+    std::mutex g_profilesLock;
+    std::unordered_map<std::wstring, std::shared_ptr<const parsed_profile>> g_profiles;
+    std::unordered_map<std::wstring, pending_profile> g_pendingProfiles;
+    std::atomic<bool> g_hasPendingProfiles{ false };
+    PTP_TIMER g_profileFlushTimer = nullptr;
+
+    using unique_file = std::unique_ptr<void, psf::handle_deleter<&::CloseHandle>>;
+
+    std::wstring fold_case(std::wstring_view value)
+    {
+        std::wstring result(value);
+        if (!result.empty())
+        {
+            ::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, result.data(), static_cast<int>(result.length()),
+                result.data(), static_cast<int>(result.length()), nullptr, nullptr, 0);
+        }
+
+        return result;
+    }
+
+    bool is_blank(wchar_t ch) noexcept
+    {
+        return (ch == L' ') || (ch == L'\t');
+    }
+
+    std::wstring_view trim(std::wstring_view value) noexcept
+    {
+        while (!value.empty() && is_blank(value.front()))
+        {
+            value.remove_prefix(1);
+        }
+        while (!value.empty() && is_blank(value.back()))
+        {
+            value.remove_suffix(1);
+        }
+
+        return value;
+    }
+
+    // Reads the file the same way that GetPrivateProfileString would: UTF-16 when the file starts with a byte order
+    // mark, and in the ANSI code page otherwise. Returns false for anything else
+    bool read_profile_text(HANDLE file, DWORD fileSize, std::wstring& result, bool& unicode)
+    {
+        std::string bytes(fileSize, '\0');
+        DWORD bytesRead;
+        if (!::ReadFile(file, bytes.data(), fileSize, &bytesRead, nullptr) || (bytesRead != fileSize))
+        {
+            return false;
+        }
+
+        if ((bytes.length() >= 2) && (bytes[0] == '\xFF') && (bytes[1] == '\xFE'))
+        {
+            result.assign(reinterpret_cast<const wchar_t*>(bytes.data() + 2), (bytes.length() - 2) / sizeof(wchar_t));
+            unicode = true;
+            return true;
+        }
+        else if (bytes.find('\0') != std::string::npos)
+        {
+            // E.g. UTF-16 without a byte order mark, which Windows might or might not detect as such
+            return false;
+        }
+        else if ((bytes.length() >= 3) && (bytes.compare(0, 3, "\xEF\xBB\xBF") == 0))
+        {
+            return false;
+        }
+
+        result = widen(bytes, CP_ACP);
+        unicode = false;
+        return true;
+    }
+
+    std::vector<std::wstring> split_lines(std::wstring_view text)
+    {
+        std::vector<std::wstring> result;
+        while (!text.empty())
+        {
+            auto lineEnd = text.find(L'\n');
+            auto line = text.substr(0, lineEnd);
+            text.remove_prefix((lineEnd == std::wstring_view::npos) ? text.length() : lineEnd + 1);
+            if (!line.empty() && (line.back() == L'\r'))
+            {
+                line.remove_suffix(1);
+            }
+            result.emplace_back(line);
+        }
+
+        return result;
+    }
+
+    bool parse_profile(std::wstring_view text, parsed_profile& result)
+    {
+        profile_section* currentSection = nullptr;
+        while (!text.empty())
+        {
+            auto lineEnd = text.find(L'\n');
+            auto line = text.substr(0, lineEnd);
+            text.remove_prefix((lineEnd == std::wstring_view::npos) ? text.length() : lineEnd + 1);
+            if (!line.empty() && (line.back() == L'\r'))
+            {
+                line.remove_suffix(1);
+            }
+
+            line = trim(line);
+            if (line.empty())
+            {
+                continue;
+            }
+
+            if (line.front() == L'[')
+            {
+                auto nameEnd = line.find_last_of(L']');
+                if (nameEnd == std::wstring_view::npos)
+                {
+                    return false;
+                }
+
+                // Only the first section of a given name is ever searched by Windows
+                auto [itr, inserted] = result.sections.try_emplace(fold_case(trim(line.substr(1, nameEnd - 1))));
+                currentSection = inserted ? &itr->second : nullptr;
+                continue;
+            }
+
+            if (!currentSection)
+            {
+                continue;
+            }
+
+            // A line without an '=' is a key without a value
+            auto separator = line.find(L'=');
+            auto name = trim(line.substr(0, separator));
+            std::wstring_view value;
+            if (separator != std::wstring_view::npos)
+            {
+                value = trim(line.substr(separator + 1));
+                if ((value.length() >= 2) && ((value.front() == L'"') || (value.front() == L'\'')) && (value.front() == value.back()))
+                {
+                    value = value.substr(1, value.length() - 2);
+                }
+            }
+
+            // Similarly, the first key of a given name wins
+            currentSection->try_emplace(fold_case(name), value);
+        }
+
+        return true;
+    }
+
+    std::shared_ptr<const parsed_profile> parse_pending_profile(pending_profile& pending)
+    {
+        if (!pending.parsed)
+        {
+            std::wstring text;
+            for (auto& line : pending.lines)
+            {
+                text += line;
+                text.push_back(L'\n');
+            }
+
+            auto profile = std::make_shared<parsed_profile>();
+            if (!parse_profile(text, *profile))
+            {
+                return nullptr;
+            }
+            pending.parsed = std::move(profile);
+        }
+
+        return pending.parsed;
+    }
+
+    std::shared_ptr<const parsed_profile> load_profile(const wchar_t* path)
+    {
+        if (g_hasPendingProfiles.load(std::memory_order_acquire))
+        {
+            // Reads must see the writes that haven't been flushed yet
+            auto key = fold_case(path);
+            std::lock_guard lock(g_profilesLock);
+            if (auto itr = g_pendingProfiles.find(key); itr != g_pendingProfiles.end())
+            {
+                return parse_pending_profile(itr->second);
+            }
+        }
+
+        if (g_profileCacheSize == 0)
+        {
+            return nullptr;
+        }
+
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (!impl::GetFileAttributesEx(path, GetFileExInfoStandard, &attributes) ||
+            (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+            (attributes.nFileSizeHigh != 0) || (attributes.nFileSizeLow > max_cached_profile_size))
+        {
+            return nullptr;
+        }
+
+        auto key = fold_case(path);
+        {
+            std::lock_guard lock(g_profilesLock);
+            if (auto itr = g_profiles.find(key); itr != g_profiles.end())
+            {
+                auto& profile = *itr->second;
+                if ((::CompareFileTime(&profile.last_write_time, &attributes.ftLastWriteTime) == 0) &&
+                    (profile.file_size == attributes.nFileSizeLow))
+                {
+                    return itr->second;
+                }
+                g_profiles.erase(itr);
+            }
+        }
+
+        unique_file file(impl::CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+        if (!file)
+        {
+            return nullptr;
+        }
+
+        // The file may have changed since its attributes were read, so they're read again through the handle that the
+        // contents are read from
+        BY_HANDLE_FILE_INFORMATION info;
+        if (!::GetFileInformationByHandle(file.get(), &info) || (info.nFileSizeHigh != 0) || (info.nFileSizeLow > max_cached_profile_size))
+        {
+            return nullptr;
+        }
+
+        auto profile = std::make_shared<parsed_profile>();
+        profile->last_write_time = info.ftLastWriteTime;
+        profile->file_size = info.nFileSizeLow;
+
+        std::wstring text;
+        bool unicode;
+        if (!read_profile_text(file.get(), info.nFileSizeLow, text, unicode) || !parse_profile(text, *profile))
+        {
+            Log(L"\t\tFRF profile cache cannot parse %ls", path);
+            return nullptr;
+        }
+
+        std::lock_guard lock(g_profilesLock);
+        if (g_profiles.size() >= g_profileCacheSize)
+        {
+            g_profiles.clear();
+        }
+        g_profiles.insert_or_assign(std::move(key), profile);
+        return profile;
+    }
+
+    // Returns null if the value does not exist
+    const std::wstring* find_value(const parsed_profile& profile, std::wstring_view section, std::wstring_view key)
+    {
+        auto sectionItr = profile.sections.find(fold_case(trim(section)));
+        if (sectionItr == profile.sections.end())
+        {
+            return nullptr;
+        }
+
+        auto keyItr = sectionItr->second.find(fold_case(trim(key)));
+        return (keyItr == sectionItr->second.end()) ? nullptr : &keyItr->second;
+    }
+
+    template <typename CharT>
+    DWORD copy_profile_string(std::basic_string_view<CharT> value, CharT* buffer, DWORD bufferLength) noexcept
+    {
+        if (bufferLength == 0)
+        {
+            return 0;
+        }
+
+        auto length = static_cast<DWORD>(std::min<std::size_t>(value.length(), bufferLength - 1));
+        std::copy_n(value.data(), length, buffer);
+        buffer[length] = 0;
+        return length;
+    }
+
+    template <typename CharT>
+    std::optional<DWORD> get_cached_profile_string(
+        const wchar_t* path,
+        const CharT* section,
+        const CharT* key,
+        const CharT* defaultString,
+        CharT* buffer,
+        DWORD bufferLength)
+    {
+        if (!path || !section || !key || !key[0] || !buffer)
+        {
+            return std::nullopt;
+        }
+
+        auto profile = load_profile(path);
+        if (!profile)
+        {
+            return std::nullopt;
+        }
+
+        const std::wstring* value;
+        if constexpr (psf::is_ansi<CharT>)
+        {
+            value = find_value(*profile, widen(section, CP_ACP), widen(key, CP_ACP));
+            if (value)
+            {
+                return copy_profile_string<char>(narrow(*value, CP_ACP), buffer, bufferLength);
+            }
+        }
+        else
+        {
+            value = find_value(*profile, section, key);
+            if (value)
+            {
+                return copy_profile_string<wchar_t>(*value, buffer, bufferLength);
+            }
+        }
+
+        // Windows removes trailing spaces from the default, but never the first character
+        std::basic_string_view<CharT> defaultValue;
+        if (defaultString)
+        {
+            defaultValue = defaultString;
+            while ((defaultValue.length() > 1) && (defaultValue.back() == ' '))
+            {
+                defaultValue.remove_suffix(1);
+            }
+        }
+        return copy_profile_string(defaultValue, buffer, bufferLength);
+    }
+
+    std::optional<std::wstring_view> section_header_name(std::wstring_view line) noexcept
+    {
+        line = trim(line);
+        if (line.empty() || (line.front() != L'['))
+        {
+            return std::nullopt;
+        }
+
+        auto nameEnd = line.find_last_of(L']');
+        if (nameEnd == std::wstring_view::npos)
+        {
+            return std::nullopt;
+        }
+
+        return trim(line.substr(1, nameEnd - 1));
+    }
+
+    // Makes the same change to the text of the file that WritePrivateProfileString would: a null 'key' removes the
+    // section, a null 'value' removes the key, and anything else sets the (first) key of that name in the (first) section
+    // of that name, adding either if needed
+    void apply_profile_write(std::vector<std::wstring>& lines, std::wstring_view section, const wchar_t* key, const wchar_t* value)
+    {
+        section = trim(section);
+        auto foldedSection = fold_case(section);
+        auto begin = std::find_if(lines.begin(), lines.end(), [&](const std::wstring& line)
+        {
+            auto name = section_header_name(line);
+            return name && (fold_case(*name) == foldedSection);
+        });
+
+        if (begin == lines.end())
+        {
+            if (key && value)
+            {
+                lines.push_back(L"[" + std::wstring(section) + L"]");
+                lines.push_back(std::wstring(trim(key)) + L"=" + value);
+            }
+            return;
+        }
+
+        auto end = std::find_if(begin + 1, lines.end(), [](const std::wstring& line)
+        {
+            return section_header_name(line).has_value();
+        });
+
+        if (!key)
+        {
+            lines.erase(begin, end);
+            return;
+        }
+
+        auto foldedKey = fold_case(trim(key));
+        for (auto itr = begin + 1; itr != end; ++itr)
+        {
+            auto line = trim(*itr);
+            auto name = trim(line.substr(0, line.find(L'=')));
+            if (!line.empty() && (fold_case(name) == foldedKey))
+            {
+                if (value)
+                {
+                    *itr = std::wstring(name) + L"=" + value;
+                }
+                else
+                {
+                    lines.erase(itr);
+                }
+                return;
+            }
+        }
+
+        if (value)
+        {
+            // New keys go after the last key of the section, rather than after any blank lines that separate it from the
+            // next section
+            while ((end - 1 != begin) && trim(*(end - 1)).empty())
+            {
+                --end;
+            }
+            lines.insert(end, std::wstring(trim(key)) + L"=" + value);
+        }
+    }
+
+    bool write_profile_file(const wchar_t* path, const std::string& bytes)
+    {
+        unique_file file(impl::CreateFile(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+        if (!file)
+        {
+            return false;
+        }
+
+        DWORD bytesWritten;
+        return ::WriteFile(file.get(), bytes.data(), static_cast<DWORD>(bytes.length()), &bytesWritten, nullptr) &&
+            (bytesWritten == bytes.length());
+    }
+
+    // Must be called with g_profilesLock held
+    void flush_pending_profile(const pending_profile& pending)
+    {
+        std::wstring text;
+        for (auto& line : pending.lines)
+        {
+            text += line;
+            text += L"\r\n";
+        }
+
+        std::string bytes;
+        if (pending.unicode)
+        {
+            bytes = "\xFF\xFE";
+            bytes.append(reinterpret_cast<const char*>(text.data()), text.length() * sizeof(wchar_t));
+        }
+        else
+        {
+            bytes = narrow(text, CP_ACP);
+        }
+
+        // The file is written next to the original and then swapped into place, so that nothing (including another
+        // process) ever sees a partially written file
+        auto tempPath = pending.path + L".psftmp";
+        if (write_profile_file(tempPath.c_str(), bytes))
+        {
+            if (impl::PathExists(pending.path.c_str()) ?
+                impl::ReplaceFile(pending.path.c_str(), tempPath.c_str(), nullptr, REPLACEFILE_IGNORE_MERGE_ERRORS, nullptr, nullptr) :
+                impl::MoveFileEx(tempPath.c_str(), pending.path.c_str(), MOVEFILE_REPLACE_EXISTING))
+            {
+                Log(L"\t\tFRF profile write-behind flushed %ls, lines=%zu", pending.path.c_str(), pending.lines.size());
+                NotifyRedirectedPathCreated(pending.path.c_str());
+                return;
+            }
+            impl::DeleteFile(tempPath.c_str());
+        }
+
+        // Writing the file in place is still better than losing the application's changes
+        Log(L"\t\tFRF profile write-behind could not replace %ls, error=%d", pending.path.c_str(), ::GetLastError());
+        if (write_profile_file(pending.path.c_str(), bytes))
+        {
+            NotifyRedirectedPathCreated(pending.path.c_str());
+        }
+        else
+        {
+            Log(L"\t\tFRF profile write-behind could not write %ls, error=%d", pending.path.c_str(), ::GetLastError());
+        }
+    }
+
+    void flush_all_pending_profiles() noexcept try
+    {
+        // The hooks may run on this thread; the flush itself must not be redirected
+        auto guard = g_reentrancyGuard.enter();
+
+        std::lock_guard lock(g_profilesLock);
+        for (auto& [key, pending] : g_pendingProfiles)
+        {
+            flush_pending_profile(pending);
+            g_profiles.erase(key);
+        }
+        g_pendingProfiles.clear();
+        g_hasPendingProfiles.store(false, std::memory_order_release);
+    }
+    catch (...)
+    {
+        Log("\t\tFRF profile write-behind flush failed with an exception");
+    }
+
+    void schedule_profile_flush() noexcept
+    {
+        if (!g_profileFlushTimer)
+        {
+            g_profileFlushTimer = ::CreateThreadpoolTimer([](PTP_CALLBACK_INSTANCE, PVOID, PTP_TIMER) noexcept
+            {
+                flush_all_pending_profiles();
+            }, nullptr, nullptr);
+            if (!g_profileFlushTimer)
+            {
+                return;
+            }
+        }
+
+        // Resetting the timer on every write delays the flush until the writes stop
+        ULARGE_INTEGER dueTime;
+        dueTime.QuadPart = static_cast<ULONGLONG>(-profile_flush_delay_ms * 10000);
+        FILETIME dueFileTime{ dueTime.LowPart, dueTime.HighPart };
+        ::SetThreadpoolTimer(g_profileFlushTimer, &dueFileTime, 0, 0);
+    }
+
+    // Returns false if the write should be left to Windows
+    bool write_behind_profile_string(const wchar_t* path, const wchar_t* section, const wchar_t* key, const wchar_t* value)
+    {
+        if (!g_profileWriteBehind || !path || !section || (key && !key[0]))
+        {
+            return false;
+        }
+
+        auto fileKey = fold_case(path);
+        std::lock_guard lock(g_profilesLock);
+        auto itr = g_pendingProfiles.find(fileKey);
+        if (itr == g_pendingProfiles.end())
+        {
+            pending_profile pending;
+            pending.path = path;
+
+            unique_file file(impl::CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+            if (file)
+            {
+                BY_HANDLE_FILE_INFORMATION info;
+                std::wstring text;
+                if (!::GetFileInformationByHandle(file.get(), &info) || (info.nFileSizeHigh != 0) ||
+                    (info.nFileSizeLow > max_cached_profile_size) || !read_profile_text(file.get(), info.nFileSizeLow, text, pending.unicode))
+                {
+                    return false;
+                }
+
+                pending.lines = split_lines(text);
+                if (!parse_pending_profile(pending))
+                {
+                    return false;
+                }
+            }
+            else if (::GetLastError() != ERROR_FILE_NOT_FOUND)
+            {
+                return false;
+            }
+
+            itr = g_pendingProfiles.emplace(fileKey, std::move(pending)).first;
+            g_hasPendingProfiles.store(true, std::memory_order_release);
+        }
+
+        apply_profile_write(itr->second.lines, section, key, value);
+        itr->second.parsed = nullptr;
+        g_profiles.erase(fileKey);
+        schedule_profile_flush();
+        return true;
+    }
+
+    // Matches GetPrivateProfileInt's conversion: leading white space and a sign are allowed, as are the prefixes "0x",
+    // "0o", and "0b", and the conversion stops at the first character that isn't a digit
+    UINT parse_profile_int(std::wstring_view value) noexcept
+    {
+        while (!value.empty() && (value.front() <= L' '))
+        {
+            value.remove_prefix(1);
+        }
+
+        bool negative = false;
+        if (!value.empty() && ((value.front() == L'-') || (value.front() == L'+')))
+        {
+            negative = (value.front() == L'-');
+            value.remove_prefix(1);
+        }
+
+        unsigned base = 10;
+        if ((value.length() >= 2) && (value[0] == L'0'))
+        {
+            switch (value[1])
+            {
+            case L'x': base = 16; break;
+            case L'o': base = 8; break;
+            case L'b': base = 2; break;
+            }
+            if (base != 10)
+            {
+                value.remove_prefix(2);
+            }
+        }
+
+        std::uint32_t result = 0;
+        for (auto ch : value)
+        {
+            unsigned digit;
+            if ((ch >= L'0') && (ch <= L'9'))
+            {
+                digit = ch - L'0';
+            }
+            else if ((ch >= L'a') && (ch <= L'f'))
+            {
+                digit = ch - L'a' + 10;
+            }
+            else if ((ch >= L'A') && (ch <= L'F'))
+            {
+                digit = ch - L'A' + 10;
+            }
+            else
+            {
+                break;
+            }
+
+            if (digit >= base)
+            {
+                break;
+            }
+            result = result * base + digit;
+        }
+
+        return negative ? (0u - result) : result;
+    }
+
+    template <typename CharT>
+    std::optional<UINT> get_cached_profile_int(const wchar_t* path, const CharT* section, const CharT* key, INT defaultValue)
+    {
+        // GetPrivateProfileInt only ever looks at the first 29 characters of the value
+        wchar_t buffer[30];
+        std::optional<DWORD> length;
+        if constexpr (psf::is_ansi<CharT>)
+        {
+            if (!section || !key)
+            {
+                return std::nullopt;
+            }
+            length = get_cached_profile_string<wchar_t>(path, widen(section, CP_ACP).c_str(), widen(key, CP_ACP).c_str(), L"", buffer, 30);
+        }
+        else
+        {
+            length = get_cached_profile_string<wchar_t>(path, section, key, L"", buffer, 30);
+        }
+
+        if (!length)
+        {
+            return std::nullopt;
+        }
+        else if (*length == 0)
+        {
+            return static_cast<UINT>(defaultValue);
+        }
+
+        return parse_profile_int(std::wstring_view(buffer, *length));
+    }
+}
+
+void InitializeProfileCache(std::size_t size) noexcept
+{
+    g_profileCacheSize = size;
+    Log("\t\tFRF profile cache size=%zu", size);
+}
+
+std::optional<DWORD> GetCachedProfileString(
+    const wchar_t* path,
+    const char* section,
+    const char* key,
+    const char* defaultString,
+    char* buffer,
+    DWORD bufferLength) noexcept try
+{
+    return get_cached_profile_string(path, section, key, defaultString, buffer, bufferLength);
+}
+catch (...)
+{
+    return std::nullopt;
+}
+
+std::optional<DWORD> GetCachedProfileString(
+    const wchar_t* path,
+    const wchar_t* section,
+    const wchar_t* key,
+    const wchar_t* defaultString,
+    wchar_t* buffer,
+    DWORD bufferLength) noexcept try
+{
+    return get_cached_profile_string(path, section, key, defaultString, buffer, bufferLength);
+}
+catch (...)
+{
+    return std::nullopt;
+}
+
+std::optional<UINT> GetCachedProfileInt(const wchar_t* path, const char* section, const char* key, INT defaultValue) noexcept try
+{
+    return get_cached_profile_int(path, section, key, defaultValue);
+}
+catch (...)
+{
+    return std::nullopt;
+}
+
+std::optional<UINT> GetCachedProfileInt(const wchar_t* path, const wchar_t* section, const wchar_t* key, INT defaultValue) noexcept try
+{
+    return get_cached_profile_int(path, section, key, defaultValue);
+}
+catch (...)
+{
+    return std::nullopt;
+}
+
+void InitializeProfileWriteBehind(bool enabled) noexcept
+{
+    g_profileWriteBehind = enabled;
+    Log("\t\tFRF profile write-behind=%d", enabled);
+}
+
+std::optional<BOOL> WriteBehindProfileString(const wchar_t* path, const char* section, const char* key, const char* value) noexcept try
+{
+    if (!g_profileWriteBehind || !section)
+    {
+        return std::nullopt;
+    }
+
+    auto wideKey = key ? std::optional<std::wstring>(widen(key, CP_ACP)) : std::nullopt;
+    auto wideValue = value ? std::optional<std::wstring>(widen(value, CP_ACP)) : std::nullopt;
+    if (!write_behind_profile_string(path, widen(section, CP_ACP).c_str(), wideKey ? wideKey->c_str() : nullptr,
+        wideValue ? wideValue->c_str() : nullptr))
+    {
+        return std::nullopt;
+    }
+    return TRUE;
+}
+catch (...)
+{
+    return std::nullopt;
+}
+
+std::optional<BOOL> WriteBehindProfileString(const wchar_t* path, const wchar_t* section, const wchar_t* key, const wchar_t* value) noexcept try
+{
+    if (!write_behind_profile_string(path, section, key, value))
+    {
+        return std::nullopt;
+    }
+    return TRUE;
+}
+catch (...)
+{
+    return std::nullopt;
+}
+
+void FlushPendingProfile(const wchar_t* path) noexcept try
+{
+    if (!path || !g_hasPendingProfiles.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    auto key = fold_case(path);
+    std::lock_guard lock(g_profilesLock);
+    if (auto itr = g_pendingProfiles.find(key); itr != g_pendingProfiles.end())
+    {
+        flush_pending_profile(itr->second);
+        g_pendingProfiles.erase(itr);
+        g_profiles.erase(key);
+        g_hasPendingProfiles.store(!g_pendingProfiles.empty(), std::memory_order_release);
+    }
+}
+catch (...)
+{
+    Log("\t\tFRF profile write-behind flush failed with an exception");
+}
+
+void FlushPendingProfiles() noexcept
+{
+    if (g_profileFlushTimer)
+    {
+        // Any flush that's already running is allowed to finish; one that hasn't started yet is no longer needed
+        ::SetThreadpoolTimer(g_profileFlushTimer, nullptr, 0, 0);
+        ::WaitForThreadpoolTimerCallbacks(g_profileFlushTimer, TRUE);
+    }
+
+    if (g_hasPendingProfiles.load(std::memory_order_acquire))
+    {
+        flush_all_pending_profiles();
+    }
+}
+
+void InvalidateCachedProfile(const wchar_t* path) noexcept try
+{
+    if (!path || (g_profileCacheSize == 0))
+    {
+        return;
+    }
+
+    auto key = fold_case(path);
+    std::lock_guard lock(g_profilesLock);
+    g_profiles.erase(key);
+}
+catch (...)
+{
+    // Should never happen, but if it does, nothing that's been cached can be trusted
+    std::lock_guard lock(g_profilesLock);
+    g_profiles.clear();
+}
@@ -0,0 +1,66 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <optional>
+
+#include <windows.h>
+
+// Applications that keep their settings in INI files commonly read hundreds of values from the same file on startup,
+// and GetPrivateProfileString opens, reads, and parses the whole file for every one of them. Redirected INI files are
+// instead parsed once into memory, and reads of individual values are answered from there for as long as the file's
+// size and last write time stay the same. The WritePrivateProfile* fixups forget the file as soon as they write to it.
+//
+// Only reads of a single value are answered from the cache; enumerating sections or keys, reading structs, and reading
+// files that the cache cannot parse the same way that Windows would (e.g. UTF-8 files with a byte order mark, or files
+// larger than a few megabytes) all still go to Windows.
+//
+// Writes may optionally be held in memory as well ("write-behind"), since WritePrivateProfileString rewrites the whole
+// file for every key that it sets. Pending writes are visible to reads through the cache right away, and are written to
+// disk together, by replacing the file in one go, once the application stops writing for a moment, before the file is
+// used by any of the other file fixups (e.g. opened with CreateFile or moved), and when the fixup is uninitialized.
+
+constexpr std::size_t default_profile_cache_size = 16;
+
+// Sets the maximum number of files that are kept parsed at once. A size of zero disables the cache
+void InitializeProfileCache(std::size_t size) noexcept;
+
+// These behave the same as GetPrivateProfileString and GetPrivateProfileInt when 'section' and 'key' are both provided,
+// or return std::nullopt when the value cannot be read from the cache, in which case the caller should use Windows
+std::optional<DWORD> GetCachedProfileString(
+    const wchar_t* path,
+    const char* section,
+    const char* key,
+    const char* defaultString,
+    char* buffer,
+    DWORD bufferLength) noexcept;
+std::optional<DWORD> GetCachedProfileString(
+    const wchar_t* path,
+    const wchar_t* section,
+    const wchar_t* key,
+    const wchar_t* defaultString,
+    wchar_t* buffer,
+    DWORD bufferLength) noexcept;
+std::optional<UINT> GetCachedProfileInt(const wchar_t* path, const char* section, const char* key, INT defaultValue) noexcept;
+std::optional<UINT> GetCachedProfileInt(const wchar_t* path, const wchar_t* section, const wchar_t* key, INT defaultValue) noexcept;
+
+// Must be called after writing to the INI file at 'path'
+void InvalidateCachedProfile(const wchar_t* path) noexcept;
+
+// Enables or disables holding writes in memory. Disabled by default
+void InitializeProfileWriteBehind(bool enabled) noexcept;
+
+// Behaves the same as WritePrivateProfileString, or returns std::nullopt when the write cannot be held in memory, in
+// which case the caller should flush any pending writes to the file and then use Windows
+std::optional<BOOL> WriteBehindProfileString(const wchar_t* path, const char* section, const char* key, const char* value) noexcept;
+std::optional<BOOL> WriteBehindProfileString(const wchar_t* path, const wchar_t* section, const wchar_t* key, const wchar_t* value) noexcept;
+
+// Writes any pending writes to the INI file at 'path' to disk. Must be called before anything other than the cache uses
+// a redirected file
+void FlushPendingProfile(const wchar_t* path) noexcept;
+
+// Writes all pending writes to disk
+void FlushPendingProfiles() noexcept;
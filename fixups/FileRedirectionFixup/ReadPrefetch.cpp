@@ -0,0 +1,368 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include <path_key.h>
+#include <psf_framework.h>
+#include <psf_utils.h>
+
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+#include "ReadPrefetch.h"
+
+namespace
+{
+    // Only the start of the process is recorded; what's read later doesn't hold up the application's launch
+    constexpr ULONGLONG record_duration_ms = 10 * 1000;
+    constexpr std::size_t max_recorded_files = 4096;
+
+    // Files are only prefetched up to this size, and the list only up to this many bytes overall, so that a file that
+    // happened to be large at the time never has the whole launch of the application waiting on the disk
+    constexpr std::uint64_t max_prefetch_file_size = 64 * 1024 * 1024;
+    constexpr std::uint64_t max_prefetch_total_size = 512 * 1024 * 1024;
+
+    // Lists larger than this are assumed to be corrupt, and are ignored
+    constexpr LONGLONG max_prefetch_list_size = 4 * 1024 * 1024;
+
+    struct prefetch_entry
+    {
+        std::uint64_t size = 0;
+        std::wstring path;
+    };
+
+    std::filesystem::path g_prefetchListPath;
+    std::atomic<bool> g_recording{ false };
+    ULONGLONG g_recordStart = 0;
+
+    std::mutex g_recordMutex;
+    std::vector<prefetch_entry> g_recordedFiles;
+    std::unordered_set<psf::path_key> g_recordedPaths;
+
+    // One list per executable, since each reads different files. The first line is the full name - and therefore the
+    // version - of the package that the list is for, as for DynamicLibraryFixup's DLL load order. Each line that follows
+    // is "<size> <path>", where the size is that of the file when it was recorded
+    std::filesystem::path prefetch_list_path(const std::filesystem::path& directory)
+    {
+        auto exeName = psf::current_executable_path().stem().native();
+        return directory / (L"PsfReadPrefetch." + exeName + L".txt");
+    }
+
+    bool parse_entry(std::wstring_view line, prefetch_entry& entry)
+    {
+        auto separator = line.find(L' ');
+        if ((separator == std::wstring_view::npos) || (separator == 0) || (separator + 1 >= line.length()))
+        {
+            return false;
+        }
+
+        entry.size = 0;
+        for (auto ch : line.substr(0, separator))
+        {
+            if ((ch < L'0') || (ch > L'9'))
+            {
+                return false;
+            }
+            entry.size = entry.size * 10 + static_cast<std::uint64_t>(ch - L'0');
+        }
+
+        entry.path.assign(line.substr(separator + 1));
+        return true;
+    }
+
+    std::vector<prefetch_entry> read_prefetch_list()
+    {
+        std::vector<prefetch_entry> result;
+        auto file = impl::CreateFile(g_prefetchListPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return result;
+        }
+
+        LARGE_INTEGER size{};
+        std::wstring contents;
+        if (::GetFileSizeEx(file, &size) && (size.QuadPart > 0) && (size.QuadPart <= max_prefetch_list_size))
+        {
+            contents.resize(static_cast<std::size_t>(size.QuadPart) / sizeof(wchar_t));
+            DWORD bytesRead = 0;
+            if (!::ReadFile(file, contents.data(), static_cast<DWORD>(contents.length() * sizeof(wchar_t)), &bytesRead, nullptr))
+            {
+                bytesRead = 0;
+            }
+            contents.resize(bytesRead / sizeof(wchar_t));
+        }
+        ::CloseHandle(file);
+
+        // A list recorded against another version of the package names files that may no longer be there, or no longer
+        // be read
+        std::wstring_view remaining(contents);
+        auto end = remaining.find(L'\n');
+        if ((end == std::wstring_view::npos) || (remaining.substr(0, end) != ::PSFQueryPackageFullName()))
+        {
+            return result;
+        }
+
+        for (remaining.remove_prefix(end + 1); !remaining.empty(); remaining.remove_prefix(end + 1))
+        {
+            end = remaining.find(L'\n');
+            if (end == std::wstring_view::npos)
+            {
+                break;
+            }
+
+            prefetch_entry entry;
+            if (parse_entry(remaining.substr(0, end), entry))
+            {
+                result.push_back(std::move(entry));
+            }
+        }
+
+        return result;
+    }
+
+    // Mapping the file and prefetching the view reads it with large, asynchronous reads that the memory manager queues all
+    // at once, rather than one small read at a time. Files that can't be mapped are read the ordinary way instead
+    std::uint64_t prefetch(const prefetch_entry& entry, std::uint64_t budget)
+    {
+        auto file = impl::CreateFile(entry.path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            Log(L"\t\tFRF read prefetch could not open %ls, error=%d", entry.path.c_str(), ::GetLastError());
+            return 0;
+        }
+
+        LARGE_INTEGER size{};
+        std::uint64_t length = 0;
+        if (::GetFileSizeEx(file, &size))
+        {
+            length = std::min({ static_cast<std::uint64_t>(size.QuadPart), max_prefetch_file_size, budget });
+        }
+
+        bool prefetched = false;
+        if (length != 0)
+        {
+            if (auto section = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr))
+            {
+                if (auto view = ::MapViewOfFile(section, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(length)))
+                {
+                    WIN32_MEMORY_RANGE_ENTRY range{ view, static_cast<SIZE_T>(length) };
+                    prefetched = ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0) != FALSE;
+                    ::UnmapViewOfFile(view);
+                }
+                ::CloseHandle(section);
+            }
+        }
+
+        if (!prefetched && (length != 0))
+        {
+            constexpr DWORD buffer_size = 64 * 1024;
+            auto buffer = std::make_unique<std::byte[]>(buffer_size);
+            std::uint64_t remaining = length;
+            DWORD bytesRead;
+            while ((remaining != 0) && ::ReadFile(file, buffer.get(), buffer_size, &bytesRead, nullptr) && (bytesRead != 0))
+            {
+                remaining -= std::min<std::uint64_t>(remaining, bytesRead);
+            }
+        }
+
+        ::CloseHandle(file);
+        return length;
+    }
+
+    void start_prefetch()
+    {
+        auto entries = read_prefetch_list();
+        if (entries.empty())
+        {
+            Log("\t\tFRF has nothing to read prefetch");
+            return;
+        }
+
+        // Behind pre-copying, which the application may be waiting on, but ahead of the background work that it isn't
+        psf::submit_work([entries = std::move(entries)]() noexcept
+        {
+            try
+            {
+                std::uint64_t total = 0;
+                std::size_t count = 0;
+                for (auto& entry : entries)
+                {
+                    if (total >= max_prefetch_total_size)
+                    {
+                        break;
+                    }
+
+                    total += prefetch(entry, max_prefetch_total_size - total);
+                    ++count;
+                }
+
+                Log("\t\tFRF read prefetch complete, files=%zu bytes=%llu", count, total);
+            }
+            catch (...)
+            {
+                Log("\t\tFRF read prefetch failed with an exception");
+            }
+        }, psf::work_priority::normal);
+    }
+
+    bool is_read_open(DWORD desiredAccess, DWORD creationDisposition) noexcept
+    {
+        constexpr DWORD readAccess = GENERIC_READ | GENERIC_ALL | MAXIMUM_ALLOWED | FILE_READ_DATA;
+        return ((desiredAccess & readAccess) != 0) && ((creationDisposition == OPEN_EXISTING) || (creationDisposition == OPEN_ALWAYS));
+    }
+
+    // The path of the file that was actually opened, whatever path it was opened by and wherever it was redirected to
+    std::wstring final_path(HANDLE file)
+    {
+        std::wstring result(MAX_PATH, L'\0');
+        auto length = ::GetFinalPathNameByHandleW(file, result.data(), static_cast<DWORD>(result.length() + 1), FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+        if (length > result.length())
+        {
+            result.resize(length);
+            length = ::GetFinalPathNameByHandleW(file, result.data(), static_cast<DWORD>(result.length() + 1), FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+        }
+        result.resize((length <= result.length()) ? length : 0);
+
+        constexpr std::wstring_view prefix = LR"(\\?\)";
+        if (std::wstring_view(result).substr(0, prefix.length()) == prefix)
+        {
+            result.erase(0, prefix.length());
+        }
+        return result;
+    }
+
+    void record_read(HANDLE file)
+    {
+        FILE_STANDARD_INFO info;
+        if (!::GetFileInformationByHandleEx(file, FileStandardInfo, &info, sizeof(info)) || info.Directory)
+        {
+            return;
+        }
+
+        auto path = final_path(file);
+        if (path.empty() || (!IsPackagePath(path.c_str()) && !path_relative_to(path.c_str(), g_prefetchListPath.parent_path())))
+        {
+            return;
+        }
+
+        psf::path_key key(path);
+        std::lock_guard lock(g_recordMutex);
+        if ((g_recordedFiles.size() < max_recorded_files) && g_recordedPaths.insert(std::move(key)).second)
+        {
+            g_recordedFiles.push_back(prefetch_entry{ static_cast<std::uint64_t>(info.EndOfFile.QuadPart), std::move(path) });
+        }
+    }
+}
+
+void InitializeReadPrefetch(const std::filesystem::path& directory, bool record)
+{
+    g_prefetchListPath = prefetch_list_path(directory);
+    start_prefetch();
+
+    if (record)
+    {
+        g_recordStart = ::GetTickCount64();
+        g_recording = true;
+    }
+}
+
+HANDLE RecordReadOpen(HANDLE file, DWORD desiredAccess, DWORD creationDisposition) noexcept try
+{
+    if (!g_recording.load(std::memory_order_relaxed) || (file == INVALID_HANDLE_VALUE) || !is_read_open(desiredAccess, creationDisposition))
+    {
+        return file;
+    }
+
+    auto lastError = ::GetLastError();
+    if (::GetTickCount64() - g_recordStart > record_duration_ms)
+    {
+        g_recording = false;
+    }
+    else
+    {
+        record_read(file);
+    }
+    ::SetLastError(lastError);
+    return file;
+}
+catch (...)
+{
+    // Only means a shorter list next time
+    return file;
+}
+
+void SaveReadPrefetch() noexcept try
+{
+    if (!g_recording.exchange(false) && (g_recordStart == 0))
+    {
+        return;
+    }
+    g_recordStart = 0;
+
+    std::wstring contents = ::PSFQueryPackageFullName();
+    contents += L'\n';
+    {
+        std::lock_guard lock(g_recordMutex);
+        if (g_recordedFiles.empty())
+        {
+            return;
+        }
+
+        for (auto& entry : g_recordedFiles)
+        {
+            contents += std::to_wstring(entry.size) + L' ' + entry.path + L'\n';
+        }
+    }
+
+    auto openFile = [](const wchar_t* path)
+    {
+        return impl::CreateFile(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    };
+
+    // Written to a file of this process' own first, so that other processes never read a partially written list
+    auto tempPath = g_prefetchListPath.native() + L"." + std::to_wstring(::GetCurrentProcessId());
+    auto file = openFile(tempPath.c_str());
+    if ((file == INVALID_HANDLE_VALUE) && (::GetLastError() == ERROR_PATH_NOT_FOUND))
+    {
+        // Nothing has been redirected yet
+        std::error_code ec;
+        std::filesystem::create_directories(g_prefetchListPath.parent_path(), ec);
+        file = openFile(tempPath.c_str());
+    }
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        Log(L"\t\tFRF could not save the read prefetch list to %ls, error=%d", tempPath.c_str(), ::GetLastError());
+        return;
+    }
+
+    DWORD bytesWritten = 0;
+    auto written = ::WriteFile(file, contents.data(), static_cast<DWORD>(contents.length() * sizeof(wchar_t)), &bytesWritten, nullptr) &&
+        (bytesWritten == contents.length() * sizeof(wchar_t));
+    ::CloseHandle(file);
+
+    if (!written || !impl::MoveFileEx(tempPath.c_str(), g_prefetchListPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        Log(L"\t\tFRF could not save the read prefetch list to %ls", g_prefetchListPath.c_str());
+        impl::DeleteFile(tempPath.c_str());
+    }
+}
+catch (...)
+{
+    // Not fatal; the next process records it again
+}
@@ -0,0 +1,32 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+
+#include <windows.h>
+
+// Large applications read hundreds of package files while they start, one cold read after another, each one waiting on
+// the disk before the application's CPU work can go on. When recording (through the "recordReadPrefetch" config
+// property), the package and redirected files that the process opens for reading during its first seconds are saved,
+// in the order they were first opened and along with their sizes, to a list in 'directory' for this executable and this
+// version of the package. Every later process of that executable then reads those files into the file cache on a
+// background thread as soon as the fixup is initialized, so that much of the disk latency overlaps with the
+// application's own initialization.
+//
+// NOTE: Whole files are prefetched, up to a cap on each file and on the list as a whole, since the fixup does not see
+//       the reads themselves and so can't tell which ranges of a file were read
+
+// Starts prefetching the files on the list saved for this executable, if any, and if 'record' is true, records the files
+// that this process reads for SaveReadPrefetch
+void InitializeReadPrefetch(const std::filesystem::path& directory, bool record);
+
+// Records 'file', the result of a CreateFile call with the given arguments, if it's a package or redirected file that was
+// opened for reading while recording. Returns 'file', with the last error left as it was
+HANDLE RecordReadOpen(HANDLE file, DWORD desiredAccess, DWORD creationDisposition) noexcept;
+
+// Writes the list that has been recorded so far, if anything, and stops recording. Called when the fixup is unloaded or
+// the process exits
+void SaveReadPrefetch() noexcept;
@@ -0,0 +1,360 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include <dos_paths.h>
+#include <psf_runtime.h>
+
+#include "RedirectCache.h"
+
+namespace
+{
+    std::size_t g_redirectCacheSize = default_redirect_cache_size;
+    std::size_t g_redirectJournalSize = default_redirect_journal_size;
+
+    // Incremented whenever the state of the redirected area changes in a way that may change the result of
+    // ShouldRedirect. Each thread compares this against the generation that its cache was filled in.
+    std::atomic<std::uint32_t> g_redirectCacheGeneration{ 0 };
+
+    std::atomic<std::uint64_t> g_redirectCacheHits{ 0 };
+    std::atomic<std::uint64_t> g_redirectCacheMisses{ 0 };
+    std::atomic<std::uint64_t> g_redirectJournalHits{ 0 };
+
+    // The same counts, published while the process runs
+    psf::metric_counter g_redirectCacheHitsMetric("FileRedirectionFixup.redirectCacheHits");
+    psf::metric_counter g_redirectCacheMissesMetric("FileRedirectionFixup.redirectCacheMisses");
+    psf::metric_counter g_redirectJournalHitsMetric("FileRedirectionFixup.redirectJournalHits");
+
+    struct cache_key
+    {
+        std::wstring_view path;
+        redirect_flags flags;
+
+        bool operator==(const cache_key& other) const noexcept
+        {
+            return (flags == other.flags) && (path == other.path);
+        }
+    };
+
+    struct cache_key_hash
+    {
+        std::size_t operator()(const cache_key& key) const noexcept
+        {
+            return std::hash<std::wstring_view>{}(key.path) ^ static_cast<std::size_t>(key.flags);
+        }
+    };
+
+    struct cache_entry
+    {
+        std::wstring path;
+        redirect_flags flags;
+        path_redirect_info info;
+    };
+
+    // Redirect targets are compared ignoring case, separator style, and any "\\?\" prefix; e.g. a file that was copied
+    // by ShouldRedirect is often deleted by a later call that went through a differently spelled path
+    std::wstring make_target_key(const wchar_t* path)
+    {
+        std::wstring result;
+        auto type = psf::path_type(path);
+        if (type == psf::dos_path_type::root_local_device)
+        {
+            result = path + 4;
+        }
+        else if ((type == psf::dos_path_type::drive_absolute) || (type == psf::dos_path_type::unc_absolute))
+        {
+            result = path;
+        }
+        else
+        {
+            result = psf::full_path(path);
+        }
+
+        for (auto& ch : result)
+        {
+            if (ch == L'/')
+            {
+                ch = L'\\';
+            }
+        }
+
+        while (!result.empty() && (result.back() == L'\\'))
+        {
+            result.pop_back();
+        }
+
+        if (!result.empty())
+        {
+            ::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, result.data(), static_cast<int>(result.length()),
+                result.data(), static_cast<int>(result.length()), nullptr, nullptr, 0);
+        }
+
+        return result;
+    }
+
+    // True if 'key' names the same thing as 'prefix', or something below it
+    bool target_key_under(std::wstring_view key, std::wstring_view prefix) noexcept
+    {
+        return (key.length() >= prefix.length()) && (key.compare(0, prefix.length(), prefix) == 0) &&
+            ((key.length() == prefix.length()) || (key[prefix.length()] == L'\\'));
+    }
+
+    struct journal_entry
+    {
+        std::wstring path;
+        redirect_flags flags;
+        path_redirect_info info;
+        std::wstring target_key;
+    };
+
+    // The journal shared by all threads. Entries are only ever removed by invalidating the redirect targets that they
+    // refer to, or - once full - all at once
+    std::shared_mutex g_redirectJournalLock;
+    std::unordered_map<cache_key, std::unique_ptr<journal_entry>, cache_key_hash> g_redirectJournal;
+
+    bool try_get_journaled_redirect(std::wstring_view path, redirect_flags flags, path_redirect_info& result)
+    {
+        std::shared_lock lock(g_redirectJournalLock);
+        auto itr = g_redirectJournal.find(cache_key{ path, flags });
+        if (itr == g_redirectJournal.end())
+        {
+            return false;
+        }
+
+        result = itr->second->info;
+        return true;
+    }
+
+    // 'generation' is the generation that 'info' was resolved in. Invalidations bump the generation while holding the
+    // lock, so a result that raced with one is never journaled
+    void journal_redirect(std::wstring_view path, redirect_flags flags, const path_redirect_info& info, std::uint32_t generation)
+    {
+        // NOTE: The key references the string held by the entry, which never moves for the lifetime of the entry
+        auto entry = std::make_unique<journal_entry>(journal_entry{ std::wstring(path), flags, info, {} });
+        if (info.should_redirect)
+        {
+            entry->target_key = make_target_key(info.redirect_path.c_str());
+        }
+
+        std::unique_lock lock(g_redirectJournalLock);
+        if (g_redirectCacheGeneration.load(std::memory_order_relaxed) != generation)
+        {
+            return;
+        }
+
+        if (g_redirectJournal.size() >= g_redirectJournalSize)
+        {
+            g_redirectJournal.clear();
+        }
+
+        cache_key key{ entry->path, entry->flags };
+        g_redirectJournal.emplace(key, std::move(entry));
+    }
+
+    class redirect_cache
+    {
+    public:
+        bool try_get(std::wstring_view path, redirect_flags flags, path_redirect_info& result)
+        {
+            synchronize();
+
+            auto itr = m_index.find(cache_key{ path, flags });
+            if (itr == m_index.end())
+            {
+                return false;
+            }
+
+            // Move to the front of the list to mark it as the most recently used
+            m_entries.splice(m_entries.begin(), m_entries, itr->second);
+            result = itr->second->info;
+            return true;
+        }
+
+        void insert(std::wstring_view path, redirect_flags flags, const path_redirect_info& info)
+        {
+            // If the redirected area changed since this thread last looked at its cache - i.e. while 'info' was being
+            // resolved - then 'info' may already be out of date
+            if (g_redirectCacheGeneration.load(std::memory_order_acquire) != m_generation)
+            {
+                return;
+            }
+
+            if (m_index.find(cache_key{ path, flags }) != m_index.end())
+            {
+                return;
+            }
+
+            while (!m_entries.empty() && (m_entries.size() >= g_redirectCacheSize))
+            {
+                auto& oldest = m_entries.back();
+                m_index.erase(cache_key{ oldest.path, oldest.flags });
+                m_entries.pop_back();
+            }
+
+            // NOTE: The key references the string held by the list node, which never moves for the lifetime of the entry
+            m_entries.push_front(cache_entry{ std::wstring(path), flags, info });
+            auto& entry = m_entries.front();
+            m_index.emplace(cache_key{ entry.path, entry.flags }, m_entries.begin());
+        }
+
+        // Called after this thread bumped the generation from 'previous'. If nothing else changed since this thread
+        // last looked at its cache, whatever it is resolving right now is still up to date, so it remains allowed to
+        // remember the result (e.g. that of the ShouldRedirect call that made the copy causing the invalidation)
+        void invalidated(std::uint32_t previous)
+        {
+            if (m_generation == previous)
+            {
+                m_index.clear();
+                m_entries.clear();
+                m_generation = previous + 1;
+            }
+        }
+
+        std::uint32_t generation() const noexcept
+        {
+            return m_generation;
+        }
+
+        void synchronize()
+        {
+            auto generation = g_redirectCacheGeneration.load(std::memory_order_acquire);
+            if (generation != m_generation)
+            {
+                m_index.clear();
+                m_entries.clear();
+                m_generation = generation;
+            }
+        }
+
+    private:
+        std::uint32_t m_generation = 0;
+        std::list<cache_entry> m_entries;
+        std::unordered_map<cache_key, std::list<cache_entry>::iterator, cache_key_hash> m_index;
+    };
+
+    thread_local redirect_cache t_redirectCache;
+}
+
+void InitializeRedirectCache(std::size_t size) noexcept
+{
+    g_redirectCacheSize = size;
+    Log("\t\tFRF redirect cache size=%zu", size);
+}
+
+void InitializeRedirectJournal(std::size_t size) noexcept
+{
+    g_redirectJournalSize = size;
+    Log("\t\tFRF redirect journal size=%zu", size);
+}
+
+void InvalidateRedirectCache() noexcept
+{
+    std::unique_lock lock(g_redirectJournalLock);
+    g_redirectJournal.clear();
+    g_redirectCacheGeneration.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void InvalidateRedirectCache(const wchar_t* path) noexcept try
+{
+    if (!path)
+    {
+        return;
+    }
+
+    auto key = make_target_key(path);
+    if (key.empty())
+    {
+        InvalidateRedirectCache();
+        return;
+    }
+
+    std::uint32_t previous;
+    {
+        std::unique_lock lock(g_redirectJournalLock);
+        for (auto itr = g_redirectJournal.begin(); itr != g_redirectJournal.end(); )
+        {
+            if (itr->second->info.should_redirect && target_key_under(itr->second->target_key, key))
+            {
+                itr = g_redirectJournal.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+
+        previous = g_redirectCacheGeneration.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    t_redirectCache.invalidated(previous);
+}
+catch (...)
+{
+    // Should never happen, but if it does we can no longer trust anything that we've remembered
+    InvalidateRedirectCache();
+}
+
+bool TryGetCachedRedirect(std::wstring_view normalizedPath, redirect_flags flags, path_redirect_info& result)
+{
+    if (g_redirectCacheSize != 0)
+    {
+        if (t_redirectCache.try_get(normalizedPath, flags, result))
+        {
+            g_redirectCacheHits.fetch_add(1, std::memory_order_relaxed);
+            g_redirectCacheHitsMetric.increment();
+            return true;
+        }
+    }
+    else
+    {
+        // Still need to know which generation the result of the lookup that follows belongs to
+        t_redirectCache.synchronize();
+    }
+
+    if ((g_redirectJournalSize != 0) && try_get_journaled_redirect(normalizedPath, flags, result))
+    {
+        g_redirectJournalHits.fetch_add(1, std::memory_order_relaxed);
+        g_redirectJournalHitsMetric.increment();
+        if (g_redirectCacheSize != 0)
+        {
+            t_redirectCache.insert(normalizedPath, flags, result);
+        }
+        return true;
+    }
+
+    g_redirectCacheMisses.fetch_add(1, std::memory_order_relaxed);
+    g_redirectCacheMissesMetric.increment();
+    return false;
+}
+
+void CacheRedirect(std::wstring_view normalizedPath, redirect_flags flags, const path_redirect_info& result)
+{
+    auto generation = t_redirectCache.generation();
+    if (g_redirectCacheSize != 0)
+    {
+        t_redirectCache.insert(normalizedPath, flags, result);
+    }
+
+    if (g_redirectJournalSize != 0)
+    {
+        journal_redirect(normalizedPath, flags, result, generation);
+    }
+}
+
+void LogRedirectCacheStatistics()
+{
+    Log("FRF redirect cache: hits=%llu journal hits=%llu misses=%llu invalidations=%u",
+        g_redirectCacheHits.load(std::memory_order_relaxed),
+        g_redirectJournalHits.load(std::memory_order_relaxed),
+        g_redirectCacheMisses.load(std::memory_order_relaxed),
+        g_redirectCacheGeneration.load(std::memory_order_relaxed));
+}
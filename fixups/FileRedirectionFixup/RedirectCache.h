@@ -0,0 +1,36 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "PathRedirection.h"
+
+// Applications tend to query the same set of paths over and over again (e.g. GetFileAttributes followed by CreateFile on
+// the same file), each time paying for VFS mapping, rule matching, and several existence checks. Each thread keeps a
+// small LRU cache of ShouldRedirect results, keyed on the normalized path and the redirect flags, so that repeated
+// queries can skip that work entirely. Caches are per-thread so that lookups never need to take a lock; invalidation is
+// process wide and is applied by each thread the next time it consults its cache.
+//
+// Behind the per-thread caches sits a journal of results shared by the whole process, so that a path resolved on one
+// thread (e.g. the thread that saves a file) is not resolved again on another (e.g. the one that renames it later).
+// Unlike the per-thread caches, which start over after any change to the redirected area, the journal only forgets the
+// results that redirect to, or to somewhere below, the path that was changed.
+
+constexpr std::size_t default_redirect_cache_size = 1024;
+constexpr std::size_t default_redirect_journal_size = 4096;
+
+// Sets the maximum number of entries held by each thread's cache. A size of zero disables caching
+void InitializeRedirectCache(std::size_t size) noexcept;
+
+// Sets the maximum number of entries held by the process wide journal. A size of zero disables the journal
+void InitializeRedirectJournal(std::size_t size) noexcept;
+
+bool TryGetCachedRedirect(std::wstring_view normalizedPath, redirect_flags flags, path_redirect_info& result);
+void CacheRedirect(std::wstring_view normalizedPath, redirect_flags flags, const path_redirect_info& result);
+
+void LogRedirectCacheStatistics();
@@ -0,0 +1,241 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cwctype>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <dos_paths.h>
+
+// Most of the paths that an application uses (documents, temp files, network shares, ...) are nowhere near any of the
+// paths that can be redirected, yet deciding that fully requires normalizing the path and mapping it into and out of
+// the package VFS. The filter holds every drive-absolute prefix under which a redirection rule could possibly apply -
+// in any of the forms a path may take on its way through ShouldRedirect - and rejects paths that are under none of
+// them by looking at the raw input string alone, without allocating.
+//
+// The filter is conservative: anything that could be an alias of some other path (relative paths, "." and ".."
+// components, short names, trailing dots or spaces, device paths other than "\\?\", etc.) is never rejected.
+//
+// Next to those, the filter holds the prefixes that the configuration asks to bypass: directories such as %TEMP% that
+// an application hammers, and that are known to never need redirecting. Paths beneath them are rejected even if a rule
+// could apply to them, under the same conditions.
+class redirect_prefix_filter
+{
+public:
+    // 'prefix' is expected to be drive-absolute; anything else is ignored, since paths in that form are never rejected
+    void add(std::wstring_view prefix)
+    {
+        if (normalize_prefix(prefix))
+        {
+            m_driveMask |= drive_bit(prefix[0]);
+            m_prefixes.emplace_back(prefix);
+        }
+    }
+
+    // Same as add, for the prefixes that are bypassed. Returns false if 'prefix' isn't drive-absolute
+    bool add_bypass(std::wstring_view prefix)
+    {
+        if (!normalize_prefix(prefix))
+        {
+            return false;
+        }
+
+        m_bypassDriveMask |= drive_bit(prefix[0]);
+        m_bypasses.emplace_back(prefix);
+        return true;
+    }
+
+    // Called once all prefixes have been added. Prefixes that are beneath others are dropped, since they can never make
+    // a difference
+    void enable()
+    {
+        remove_nested(m_prefixes);
+        remove_nested(m_bypasses);
+        m_enabled = true;
+    }
+
+    const std::vector<std::wstring>& prefixes() const noexcept
+    {
+        return m_prefixes;
+    }
+
+    const std::vector<std::wstring>& bypasses() const noexcept
+    {
+        return m_bypasses;
+    }
+
+    // Returns true only if 'path' cannot be redirected by any rule, or is beneath one of the bypassed prefixes
+    template <typename CharT>
+    bool excludes(const CharT* path) const noexcept
+    {
+        if (!m_enabled)
+        {
+            return false;
+        }
+
+        path = drive_absolute(path);
+        if (!path)
+        {
+            return false;
+        }
+        else if (!(m_driveMask & drive_bit(path[0])))
+        {
+            return true;
+        }
+
+        return is_canonical(path) &&
+            (std::none_of(m_prefixes.begin(), m_prefixes.end(), [&](const std::wstring& prefix) { return starts_with(path, prefix); }) ||
+            std::any_of(m_bypasses.begin(), m_bypasses.end(), [&](const std::wstring& prefix) { return starts_with(path, prefix); }));
+    }
+
+    // Returns true only if 'path' is beneath one of the bypassed prefixes, in which case the fixups hand it on to the
+    // functions they detour without looking at it any further. Unlike excludes, this is only a handful of compares for
+    // the typical path, since there usually are no more than one or two bypassed prefixes, if any
+    template <typename CharT>
+    bool bypasses(const CharT* path) const noexcept
+    {
+        if (!m_enabled || !m_bypassDriveMask || !path)
+        {
+            return false;
+        }
+
+        path = drive_absolute(path);
+        return path && (m_bypassDriveMask & drive_bit(path[0])) &&
+            std::any_of(m_bypasses.begin(), m_bypasses.end(), [&](const std::wstring& prefix) { return starts_with(path, prefix); }) &&
+            is_canonical(path);
+    }
+
+private:
+    static bool normalize_prefix(std::wstring_view& prefix) noexcept
+    {
+        if ((prefix.length() >= 4) && psf::is_path_separator(prefix[0]) && psf::is_path_separator(prefix[1]) &&
+            (prefix[2] == L'?') && psf::is_path_separator(prefix[3]))
+        {
+            prefix.remove_prefix(4);
+        }
+
+        if ((prefix.length() < 3) || !is_drive_letter(prefix[0]) || (prefix[1] != L':') || !psf::is_path_separator(prefix[2]))
+        {
+            return false;
+        }
+
+        while ((prefix.length() > 3) && psf::is_path_separator(prefix.back()))
+        {
+            prefix.remove_suffix(1);
+        }
+
+        return true;
+    }
+
+    static void remove_nested(std::vector<std::wstring>& prefixes)
+    {
+        std::sort(prefixes.begin(), prefixes.end(), [](const std::wstring& lhs, const std::wstring& rhs)
+        {
+            return lhs.length() < rhs.length();
+        });
+
+        std::vector<std::wstring> result;
+        for (auto& prefix : prefixes)
+        {
+            if (std::none_of(result.begin(), result.end(), [&](const std::wstring& shorter) { return starts_with(prefix.c_str(), shorter); }))
+            {
+                result.push_back(std::move(prefix));
+            }
+        }
+
+        prefixes = std::move(result);
+    }
+
+    // Where the drive-absolute form of 'path' starts, skipping a "\\?\" prefix, or null if it isn't drive-absolute
+    template <typename CharT>
+    static const CharT* drive_absolute(const CharT* path) noexcept
+    {
+        if (psf::is_path_separator(path[0]) && psf::is_path_separator(path[1]) && (path[2] == '?') && psf::is_path_separator(path[3]))
+        {
+            path += 4;
+        }
+
+        if (!is_drive_letter(path[0]) || (path[1] != ':') || !psf::is_path_separator(path[2]))
+        {
+            return nullptr;
+        }
+
+        return path;
+    }
+
+    // False if the drive-absolute 'path' could be an alias of some other path
+    template <typename CharT>
+    static bool is_canonical(const CharT* path) noexcept
+    {
+        for (auto ptr = path + 2; *ptr; ++ptr)
+        {
+            auto ch = static_cast<unsigned>(static_cast<std::make_unsigned_t<CharT>>(*ptr));
+            if ((ch == '~') || (ch == ':') || (ch == '*') || (ch == '?'))
+            {
+                return false;
+            }
+
+            if constexpr (sizeof(CharT) == 1)
+            {
+                // Multi-byte characters would first need to be converted to compare them
+                if (ch > 0x7F)
+                {
+                    return false;
+                }
+            }
+
+            if (psf::is_path_separator(*ptr) || !ptr[1])
+            {
+                // Empty components, "." and "..", and names with trailing dots or spaces all alias other paths
+                auto last = psf::is_path_separator(*ptr) ? ptr[-1] : *ptr;
+                if (psf::is_path_separator(last) || (last == '.') || (last == ' '))
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    template <typename CharT>
+    static bool is_drive_letter(CharT ch) noexcept
+    {
+        return ((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z'));
+    }
+
+    template <typename CharT>
+    static std::uint32_t drive_bit(CharT ch) noexcept
+    {
+        return 1u << (((ch >= 'a') ? (ch - 'a') : (ch - 'A')) & 31);
+    }
+
+    // True if 'prefix' names 'path' or one of its parents, with the same semantics as psf::path_compare
+    template <typename CharT>
+    static bool starts_with(const CharT* path, const std::wstring& prefix) noexcept
+    {
+        std::size_t i = 0;
+        for (; i < prefix.length(); ++i)
+        {
+            if (!path[i] || !psf::path_compare{}(static_cast<wchar_t>(static_cast<std::make_unsigned_t<CharT>>(path[i])), prefix[i]))
+            {
+                return false;
+            }
+        }
+
+        return !path[i] || psf::is_path_separator(path[i]) || psf::is_path_separator(prefix.back());
+    }
+
+    bool m_enabled = false;
+    std::uint32_t m_driveMask = 0;
+    std::vector<std::wstring> m_prefixes;
+    std::uint32_t m_bypassDriveMask = 0;
+    std::vector<std::wstring> m_bypasses;
+};
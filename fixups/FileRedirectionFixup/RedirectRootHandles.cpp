@@ -0,0 +1,339 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cwchar>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <winternl.h>
+
+#include <dos_paths.h>
+#include <fancy_handle.h>
+
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+#include "RedirectRootHandles.h"
+
+namespace winternl
+{
+    // NOTE: Documented, but only declared in the DDK. FILE_BASIC_INFO has the same layout as FILE_BASIC_INFORMATION
+    struct FILE_NETWORK_OPEN_INFORMATION
+    {
+        LARGE_INTEGER CreationTime;
+        LARGE_INTEGER LastAccessTime;
+        LARGE_INTEGER LastWriteTime;
+        LARGE_INTEGER ChangeTime;
+        LARGE_INTEGER AllocationSize;
+        LARGE_INTEGER EndOfFile;
+        ULONG FileAttributes;
+    };
+
+    NTSTATUS __stdcall NtQueryAttributesFile(POBJECT_ATTRIBUTES ObjectAttributes, PFILE_BASIC_INFO FileInformation);
+    NTSTATUS __stdcall NtQueryFullAttributesFile(POBJECT_ATTRIBUTES ObjectAttributes, FILE_NETWORK_OPEN_INFORMATION* FileInformation);
+
+    // NOTE: ntstatus.h can't be included alongside windows.h without WIN32_NO_STATUS, which the rest of the fixup
+    //       doesn't use
+    constexpr NTSTATUS STATUS_OBJECT_NAME_NOT_FOUND = static_cast<NTSTATUS>(0xC0000034L);
+    constexpr NTSTATUS STATUS_OBJECT_PATH_NOT_FOUND = static_cast<NTSTATUS>(0xC000003AL);
+
+    // NOTE: The functions in ntdll are not included in any import lib and therefore must be manually loaded in
+    template <typename Func>
+    inline Func GetNtDllFunction(const char* functionName)
+    {
+        auto result = reinterpret_cast<Func>(::GetProcAddress(::GetModuleHandleW(L"ntdll.dll"), functionName));
+        assert(result);
+        return result;
+    }
+}
+
+namespace impl
+{
+    inline auto NtQueryAttributesFile = winternl::GetNtDllFunction<decltype(&winternl::NtQueryAttributesFile)>("NtQueryAttributesFile");
+    inline auto NtQueryFullAttributesFile = winternl::GetNtDllFunction<decltype(&winternl::NtQueryFullAttributesFile)>("NtQueryFullAttributesFile");
+}
+
+namespace
+{
+    using unique_file = std::unique_ptr<void, psf::handle_deleter<&::CloseHandle>>;
+
+    // The roots, plus the folders right below them that have been found to have something in them. More than enough for
+    // all of the VFS folders of both roots
+    constexpr std::size_t max_directory_handles = 64;
+
+    struct directory_handle
+    {
+        std::wstring path;
+        unique_file handle;
+        bool is_root = false;
+    };
+
+    std::shared_mutex g_directoryHandlesLock;
+    std::vector<directory_handle> g_directoryHandles;
+
+    // What's left of 'path' after 'directory' and the separator that follows it, or nullptr if 'path' isn't below it
+    const wchar_t* path_below(const wchar_t* path, std::size_t pathLength, const std::wstring& directory) noexcept
+    {
+        if ((pathLength <= directory.length() + 1) || !psf::is_path_separator(path[directory.length()]) ||
+            !std::equal(directory.begin(), directory.end(), path, psf::path_compare{}))
+        {
+            return nullptr;
+        }
+
+        return path + directory.length() + 1;
+    }
+
+    unique_file open_directory(const wchar_t* path) noexcept
+    {
+        return unique_file(impl::CreateFile(path, FILE_TRAVERSE | SYNCHRONIZE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr));
+    }
+
+    // True if the folder that 'handle' is open to has been removed since. Those removed with POSIX semantics are no
+    // longer delete pending, but have no links left
+    bool is_removed(HANDLE handle) noexcept
+    {
+        FILE_STANDARD_INFO info;
+        return !::GetFileInformationByHandleEx(handle, FileStandardInfo, &info, sizeof(info)) || info.DeletePending ||
+            (info.NumberOfLinks == 0);
+    }
+
+    enum class query_result
+    {
+        // The query was made relative to an open folder. Its result, or the last error, is that of the Win32 function
+        answered,
+
+        // The Win32 function needs to be asked instead
+        fall_back,
+    };
+}
+
+// Runs 'query', which returns an NTSTATUS, with the OBJECT_ATTRIBUTES of 'path' relative to the deepest open folder
+// above it. Falls back to the Win32 function for anything that NT might see differently from it: paths that would need
+// the Win32 path rules applied to them (forward slashes), failures that the Win32 function may handle in its own way,
+// and queries below a folder that has been removed since it was opened
+template <typename QueryFn>
+static query_result query_relative(const wchar_t* path, QueryFn&& query) noexcept try
+{
+    if (!path)
+    {
+        return query_result::fall_back;
+    }
+
+    auto pathLength = std::wcslen(path);
+    if (std::wmemchr(path, L'/', pathLength))
+    {
+        return query_result::fall_back;
+    }
+
+    NTSTATUS status{};
+    bool stale = false;
+    std::wstring firstFolder;
+    {
+        std::shared_lock lock(g_directoryHandlesLock);
+        const directory_handle* best = nullptr;
+        const wchar_t* relativePath = nullptr;
+        for (auto& directory : g_directoryHandles)
+        {
+            if (auto remainder = path_below(path, pathLength, directory.path);
+                remainder && (!best || (directory.path.length() > best->path.length())))
+            {
+                best = &directory;
+                relativePath = remainder;
+            }
+        }
+
+        if (!best)
+        {
+            return query_result::fall_back;
+        }
+
+        auto relativeLength = pathLength - (relativePath - path);
+        if (relativeLength * sizeof(wchar_t) > 0xFFFE)
+        {
+            return query_result::fall_back;
+        }
+
+        UNICODE_STRING name;
+        name.Buffer = const_cast<wchar_t*>(relativePath);
+        name.Length = static_cast<USHORT>(relativeLength * sizeof(wchar_t));
+        name.MaximumLength = name.Length;
+
+        OBJECT_ATTRIBUTES attributes;
+        InitializeObjectAttributes(&attributes, &name, OBJ_CASE_INSENSITIVE, best->handle.get(), nullptr);
+        status = query(&attributes);
+
+        if ((status == winternl::STATUS_OBJECT_NAME_NOT_FOUND) || (status == winternl::STATUS_OBJECT_PATH_NOT_FOUND))
+        {
+            // Finding nothing is also what a folder that has been removed since it was opened looks like
+            stale = is_removed(best->handle.get());
+        }
+        else if (NT_SUCCESS(status) && best->is_root)
+        {
+            if (auto separator = std::wcschr(relativePath, L'\\'))
+            {
+                firstFolder.assign(path, separator);
+            }
+        }
+    }
+
+    if (stale)
+    {
+        std::unique_lock lock(g_directoryHandlesLock);
+        g_directoryHandles.erase(std::remove_if(g_directoryHandles.begin(), g_directoryHandles.end(), [](const directory_handle& directory)
+        {
+            return is_removed(directory.handle.get());
+        }), g_directoryHandles.end());
+        return query_result::fall_back;
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        if (!firstFolder.empty())
+        {
+            // Something was found below a folder that's right below a root, so the folder exists, and is worth opening
+            std::unique_lock lock(g_directoryHandlesLock);
+            auto known = std::any_of(g_directoryHandles.begin(), g_directoryHandles.end(), [&](const directory_handle& directory)
+            {
+                return (directory.path.length() == firstFolder.length()) &&
+                    std::equal(directory.path.begin(), directory.path.end(), firstFolder.begin(), psf::path_compare{});
+            });
+            if (!known && (g_directoryHandles.size() < max_directory_handles))
+            {
+                if (auto handle = open_directory(firstFolder.c_str()))
+                {
+                    g_directoryHandles.push_back({ std::move(firstFolder), std::move(handle), false });
+                }
+            }
+        }
+
+        return query_result::answered;
+    }
+
+    if (status == winternl::STATUS_OBJECT_NAME_NOT_FOUND)
+    {
+        ::SetLastError(ERROR_FILE_NOT_FOUND);
+        return query_result::answered;
+    }
+    else if (status == winternl::STATUS_OBJECT_PATH_NOT_FOUND)
+    {
+        ::SetLastError(ERROR_PATH_NOT_FOUND);
+        return query_result::answered;
+    }
+
+    return query_result::fall_back;
+}
+catch (...)
+{
+    return query_result::fall_back;
+}
+
+void InitializeRedirectRootHandles(const std::vector<std::filesystem::path>& roots) noexcept try
+{
+    std::unique_lock lock(g_directoryHandlesLock);
+    for (auto& root : roots)
+    {
+        if (auto handle = open_directory(root.c_str()))
+        {
+            auto path = root.native();
+            while (!path.empty() && psf::is_path_separator(path.back()))
+            {
+                path.pop_back();
+            }
+            g_directoryHandles.push_back({ std::move(path), std::move(handle), true });
+        }
+        else
+        {
+            Log("\t\tFRF could not open redirect root %ls (%d)", root.c_str(), ::GetLastError());
+        }
+    }
+}
+catch (...)
+{
+    // Queries fall back to the Win32 functions for whatever couldn't be opened
+}
+
+DWORD QueryRedirectedAttributes(const wchar_t* path) noexcept
+{
+    DWORD result = INVALID_FILE_ATTRIBUTES;
+    auto answer = query_relative(path, [&](POBJECT_ATTRIBUTES attributes) noexcept
+    {
+        FILE_BASIC_INFO info;
+        auto status = impl::NtQueryAttributesFile(attributes, &info);
+        if (NT_SUCCESS(status))
+        {
+            result = info.FileAttributes;
+        }
+        return status;
+    });
+
+    return (answer == query_result::answered) ? result : impl::GetFileAttributes(path);
+}
+
+BOOL QueryRedirectedAttributesEx(const wchar_t* path, GET_FILEEX_INFO_LEVELS infoLevelId, LPVOID fileInformation) noexcept
+{
+    if (infoLevelId != GetFileExInfoStandard)
+    {
+        return impl::GetFileAttributesEx(path, infoLevelId, fileInformation);
+    }
+
+    BOOL result = FALSE;
+    auto answer = query_relative(path, [&](POBJECT_ATTRIBUTES attributes) noexcept
+    {
+        winternl::FILE_NETWORK_OPEN_INFORMATION info;
+        auto status = impl::NtQueryFullAttributesFile(attributes, &info);
+        if (NT_SUCCESS(status))
+        {
+            auto toFileTime = [](const LARGE_INTEGER& value)
+            {
+                return FILETIME{ value.LowPart, static_cast<DWORD>(value.HighPart) };
+            };
+
+            auto data = static_cast<WIN32_FILE_ATTRIBUTE_DATA*>(fileInformation);
+            data->dwFileAttributes = info.FileAttributes;
+            data->ftCreationTime = toFileTime(info.CreationTime);
+            data->ftLastAccessTime = toFileTime(info.LastAccessTime);
+            data->ftLastWriteTime = toFileTime(info.LastWriteTime);
+            data->nFileSizeHigh = static_cast<DWORD>(info.EndOfFile.HighPart);
+            data->nFileSizeLow = info.EndOfFile.LowPart;
+            result = TRUE;
+        }
+        return status;
+    });
+
+    return (answer == query_result::answered) ? result : impl::GetFileAttributesEx(path, infoLevelId, fileInformation);
+}
+
+void NotifyRedirectRootHandlesRemoved(const wchar_t* path) noexcept try
+{
+    if (!path)
+    {
+        return;
+    }
+
+    auto pathLength = std::wcslen(path);
+    while ((pathLength > 0) && psf::is_path_separator(path[pathLength - 1]))
+    {
+        --pathLength;
+    }
+
+    std::unique_lock lock(g_directoryHandlesLock);
+    g_directoryHandles.erase(std::remove_if(g_directoryHandles.begin(), g_directoryHandles.end(), [&](const directory_handle& directory)
+    {
+        return (directory.path.length() >= pathLength) &&
+            std::equal(path, path + pathLength, directory.path.begin(), psf::path_compare{}) &&
+            ((directory.path.length() == pathLength) || psf::is_path_separator(directory.path[pathLength]));
+    }), g_directoryHandles.end());
+}
+catch (...)
+{
+    // Nothing can be trusted to still be where it was
+    std::unique_lock lock(g_directoryHandlesLock);
+    g_directoryHandles.clear();
+}
@@ -0,0 +1,36 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include <windows.h>
+
+// Every question about a path in the redirected area passes the whole path, e.g.
+// "C:\Users\x\AppData\Local\Packages\<PFN>\LocalCache\Local\VFS\ProgramFilesX64\Vendor\file.txt", which the kernel parses
+// and walks from the root of the volume each time. Handles to the redirect roots, and to the folders right below them
+// (the VFS folders such as "ProgramFilesX64" that hold almost everything), are kept open instead, so that the attributes
+// of paths below them are queried with NtQueryAttributesFile relative to the deepest of those folders.
+//
+// NOTE: The handles are opened with FILE_SHARE_DELETE, so they don't keep anything from being removed or renamed. A
+//       folder that's removed while it's open is noticed the next time a query below it finds nothing, and its handle is
+//       closed then. One that's renamed by anything other than this fixup (or one that is watched by ChangeWatcher.h) is
+//       not noticed; only the fixup knows where the redirect roots are, so this is very unlikely
+//
+// NOTE: Only the queries are made relative, not CreateFile itself: the Win32 semantics of CreateFile (dispositions, the
+//       last error on success, security attributes, templates, ...) would all have to be duplicated on top of
+//       NtCreateFile, and the opens of the redirected area are preceded by at least one of these queries anyway
+
+// Opens the handles to the redirect roots. Called once the roots exist
+void InitializeRedirectRootHandles(const std::vector<std::filesystem::path>& roots) noexcept;
+
+// The same as impl::GetFileAttributes(Ex) on 'path', which they fall back to for paths that aren't below an open folder
+DWORD QueryRedirectedAttributes(const wchar_t* path) noexcept;
+BOOL QueryRedirectedAttributesEx(const wchar_t* path, GET_FILEEX_INFO_LEVELS infoLevelId, LPVOID fileInformation) noexcept;
+
+// Must be called after successfully removing, or moving away, something at 'path' in the redirected area. Closes the
+// handles to it and to anything below it
+void NotifyRedirectRootHandlesRemoved(const wchar_t* path) noexcept;
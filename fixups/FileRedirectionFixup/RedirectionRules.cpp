@@ -0,0 +1,178 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cwchar>
+#include <iterator>
+#include <vector>
+
+#include <rule_order.h>
+
+#include "RedirectionRules.h"
+
+using namespace std::literals;
+
+path_redirection_spec& redirection_rule_set::add(const std::filesystem::path& basePath)
+{
+    // Specs are only added while the configuration is read, so the first ordering is simply built up
+    if (m_orderings.empty())
+    {
+        m_orderings.push_back(std::make_unique<ordering>());
+        m_ordering.store(m_orderings.back().get(), std::memory_order_relaxed);
+    }
+
+    auto& order = *m_orderings.back();
+    order.rank.push_back(m_specs.size());
+    order.index.insert(basePath.native()).push_back(m_specs.size());
+    auto& result = m_specs.emplace_back();
+    result.base_path = basePath;
+    return result;
+}
+
+void redirection_rule_set::enable_adaptive_order(std::uint64_t matchCount)
+{
+    if ((matchCount == 0) || (m_specs.size() < 2))
+    {
+        return;
+    }
+
+    m_hits = std::make_unique<std::atomic<std::uint64_t>[]>(m_specs.size());
+    m_adaptiveMatchCount = matchCount;
+    m_adaptivePending.store(true, std::memory_order_relaxed);
+}
+
+void redirection_rule_set::reorder(const std::vector<std::uint64_t>& hits)
+{
+    if (m_specs.empty() || (hits.size() != m_specs.size()))
+    {
+        return;
+    }
+
+    std::lock_guard lock(m_reorderLock);
+    auto current = m_ordering.load(std::memory_order_relaxed);
+    std::vector<std::size_t> order(m_specs.size());
+    for (std::size_t i = 0; i < m_specs.size(); ++i)
+    {
+        order[current->rank[i]] = i;
+    }
+
+    // Exclusions only carve exceptions out of the rules that follow them, so nothing moves across one. Otherwise a
+    // rule may move ahead of another that would have the same effect, or that can't apply to the same paths
+    psf::order_rules_by_hits(order, hits,
+        [&](std::size_t index) { return m_specs[index].isExclusion; },
+        [&](std::size_t lhs, std::size_t rhs)
+        {
+            auto& left = m_specs[lhs];
+            auto& right = m_specs[rhs];
+            return ((left.isReadOnly == right.isReadOnly) && (_wcsicmp(left.redirect_targetbase.c_str(), right.redirect_targetbase.c_str()) == 0)) ||
+                psf::base_paths_disjoint(left.base_path.native(), right.base_path.native());
+        });
+
+    auto result = std::make_unique<ordering>();
+    result->rank.resize(m_specs.size());
+    for (std::size_t position = 0; position < order.size(); ++position)
+    {
+        result->rank[order[position]] = position;
+        result->index.insert(m_specs[order[position]].base_path.native()).push_back(order[position]);
+    }
+
+    m_ordering.store(result.get(), std::memory_order_release);
+    m_orderings.push_back(std::move(result));
+}
+
+void redirection_rule_set::record_match(std::size_t index)
+{
+    m_hits[index].fetch_add(1, std::memory_order_relaxed);
+    if (m_matches.fetch_add(1, std::memory_order_relaxed) + 1 != m_adaptiveMatchCount)
+    {
+        return;
+    }
+
+    // Only the thread that brings the count to the threshold gets here
+    m_adaptivePending.store(false, std::memory_order_relaxed);
+    std::vector<std::uint64_t> hits(m_specs.size());
+    for (std::size_t i = 0; i < hits.size(); ++i)
+    {
+        hits[i] = m_hits[i].load(std::memory_order_relaxed);
+    }
+    reorder(hits);
+}
+
+const path_redirection_spec* redirection_rule_set::find(const wchar_t* path, const wchar_t** relativePath)
+{
+    if (!path || m_specs.empty())
+    {
+        return nullptr;
+    }
+
+    auto& order = *m_ordering.load(std::memory_order_acquire);
+
+    // Walk the trie once, remembering each base path that contains the path along with the remainder beneath it
+    struct candidate
+    {
+        const std::vector<std::size_t>* specs;
+        std::size_t next;
+        const wchar_t* relative;
+    };
+
+    // Paths under more base paths than fit on the stack are rare, but still have to see all of them
+    candidate inlineCandidates[32];
+    std::vector<candidate> overflowCandidates;
+    std::size_t candidateCount = 0;
+
+    order.index.walk(path, [&](const std::vector<std::size_t>& specs, const wchar_t* remainder)
+    {
+        if (candidateCount < std::size(inlineCandidates))
+        {
+            inlineCandidates[candidateCount] = { &specs, 0, remainder };
+        }
+        else
+        {
+            if (overflowCandidates.empty())
+            {
+                overflowCandidates.assign(std::begin(inlineCandidates), std::end(inlineCandidates));
+            }
+            overflowCandidates.push_back({ &specs, 0, remainder });
+        }
+        ++candidateCount;
+        return true;
+    });
+    auto candidates = overflowCandidates.empty() ? inlineCandidates : overflowCandidates.data();
+
+    // Evaluate the candidate specs in order; the first match wins
+    while (true)
+    {
+        candidate* best = nullptr;
+        for (std::size_t i = 0; i < candidateCount; ++i)
+        {
+            auto& entry = candidates[i];
+            if ((entry.next < entry.specs->size()) &&
+                (!best || (order.rank[(*entry.specs)[entry.next]] < order.rank[(*best->specs)[best->next]])))
+            {
+                best = &entry;
+            }
+        }
+
+        if (!best)
+        {
+            return nullptr;
+        }
+
+        auto index = (*best->specs)[best->next++];
+        auto& spec = m_specs[index];
+        if (spec.pattern.match(best->relative))
+        {
+            if (relativePath)
+            {
+                *relativePath = best->relative;
+            }
+            if (m_adaptivePending.load(std::memory_order_relaxed))
+            {
+                record_match(index);
+            }
+            return &spec;
+        }
+    }
+}
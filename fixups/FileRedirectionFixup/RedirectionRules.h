@@ -0,0 +1,96 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <compiled_pattern.h>
+
+#include "PathComponentTrie.h"
+
+struct path_redirection_spec
+{
+    std::filesystem::path base_path;
+    compiled_pattern pattern;
+    std::filesystem::path redirect_targetbase;
+    bool isExclusion;
+    bool isReadOnly;
+
+    // Where the pattern came from, as a JSON pointer into the fixup's configuration, e.g.
+    // "/redirectedPaths/packageRelative/0/patterns/1". Lets a profile of which rules match be mapped back to the
+    // configuration (see PsfRuleOrderer)
+    std::string config_location;
+};
+
+// The complete set of redirection specs, indexed by base path. Base paths are stored in a trie keyed on path components
+// so that a lookup visits each component of the input path once, no matter how many rules are configured. Rules are
+// evaluated in configuration order, so the first matching rule wins just as it always has, unless they have been
+// reordered by how often they match, which only ever moves a rule ahead of others when that cannot change which rule a
+// path matches first (see rule_order.h).
+//
+// NOTE: Decisions aren't cached per directory. A lookup already costs one step per path component, plus a compare
+//       for patterns such as ".*" (see compiled_pattern.h), and finding a directory in a cache would mean hashing
+//       the same components
+class redirection_rule_set
+{
+public:
+    // Appends a new spec for the given base path and returns it so that the caller may fill in the remaining members
+    path_redirection_spec& add(const std::filesystem::path& basePath);
+
+    // Counts how often each spec is matched and, once 'matchCount' paths have been matched, reorders the specs by those
+    // counts. Must be called after all specs have been added, and before the set is first used
+    void enable_adaptive_order(std::uint64_t matchCount);
+
+    // Reorders the specs by 'hits', which is indexed the same as specs(). Safe to call while other threads are finding
+    // specs; they keep using the previous order until their lookup completes
+    void reorder(const std::vector<std::uint64_t>& hits);
+
+    // Returns the first spec whose base path contains 'path' and whose pattern matches the remainder of the path, or
+    // nullptr if there is no such spec. On success, 'relativePath' points inside of 'path' at the matched remainder.
+    const path_redirection_spec* find(const wchar_t* path, const wchar_t** relativePath = nullptr);
+
+    const std::vector<path_redirection_spec>& specs() const noexcept
+    {
+        return m_specs;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_specs.empty();
+    }
+
+private:
+    struct ordering
+    {
+        // The position of each spec in evaluation order
+        std::vector<std::size_t> rank;
+
+        // Indices into m_specs for each base path, in evaluation order
+        path_component_trie<std::vector<std::size_t>> index;
+    };
+
+    void record_match(std::size_t index);
+
+    std::vector<path_redirection_spec> m_specs;
+
+    // Orderings are never freed once they've been replaced, since other threads may still be using them. At most one
+    // reorder happens per process in adaptive mode, so this doesn't grow
+    std::atomic<ordering*> m_ordering{ nullptr };
+    std::vector<std::unique_ptr<ordering>> m_orderings;
+    std::mutex m_reorderLock;
+
+    std::uint64_t m_adaptiveMatchCount = 0;
+    std::atomic<bool> m_adaptivePending{ false };
+    std::atomic<std::uint64_t> m_matches{ 0 };
+    std::unique_ptr<std::atomic<std::uint64_t>[]> m_hits;
+};
@@ -0,0 +1,310 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <psf_runtime.h>
+#include <psf_utils.h>
+#include <Telemetry.h>
+#include <utilities.h>
+
+#include "PathRedirection.h"
+#include "RedirectionRules.h"
+#include "RedirectionStatistics.h"
+
+TRACELOGGING_DECLARE_PROVIDER(g_Log_ETW_ComponentProvider);
+
+namespace
+{
+    bool g_statisticsEnabled = false;
+    std::int64_t g_ticksPerSecond = 1;
+
+    // Constant initialized, so that it is in place before any of the fixup_statistics instances are constructed
+    fixup_statistics* g_fixupStatistics = nullptr;
+    fixup_statistics g_otherStatistics("Other");
+
+    thread_local fixup_statistics* t_currentFixup = nullptr;
+
+    // Published regardless of whether statistics are collected, since they cost next to nothing when they aren't
+    psf::metric_counter g_shouldRedirectMetric("FileRedirectionFixup.shouldRedirect");
+    psf::metric_counter g_redirectsMetric("FileRedirectionFixup.redirects");
+    psf::metric_counter g_copiesMetric("FileRedirectionFixup.copies");
+    psf::metric_counter g_copyBytesMetric("FileRedirectionFixup.copyBytes");
+
+    struct spec_statistics
+    {
+        std::atomic<std::uint64_t> matches{ 0 };
+        std::atomic<std::uint64_t> copies{ 0 };
+        std::atomic<std::uint64_t> bytes_copied{ 0 };
+    };
+
+    const redirection_rule_set* g_specs = nullptr;
+    std::size_t g_specCount = 0;
+    std::unique_ptr<spec_statistics[]> g_specStatistics;
+    std::filesystem::path g_profilePath;
+
+    fixup_statistics& current_fixup() noexcept
+    {
+        return t_currentFixup ? *t_currentFixup : g_otherStatistics;
+    }
+
+    // The profile is a text file that names the executable, followed by one line per rule, each the number of matches,
+    // a tab, and the rule's config_location. Counts from earlier runs are kept, and added to, so that a profile can
+    // cover several runs
+    void write_profile()
+    {
+        std::map<std::string, std::uint64_t> matches;
+        {
+            std::ifstream input(g_profilePath);
+            std::string line;
+            while (std::getline(input, line))
+            {
+                auto tab = line.find('\t');
+                if ((tab == std::string::npos) || (tab == 0) || (line.find_first_not_of("0123456789") != tab))
+                {
+                    continue;
+                }
+                matches[line.substr(tab + 1)] += std::stoull(line.substr(0, tab));
+            }
+        }
+
+        for (std::size_t i = 0; i < g_specCount; ++i)
+        {
+            auto& location = g_specs->specs()[i].config_location;
+            if (!location.empty())
+            {
+                matches[location] += g_specStatistics[i].matches.load(std::memory_order_relaxed);
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::create_directories(g_profilePath.parent_path(), ec);
+        std::ofstream output(g_profilePath, std::ios::trunc);
+        output << "executable\t" << narrow(psf::current_executable_path().stem().native()) << '\n';
+        for (auto& [location, count] : matches)
+        {
+            output << count << '\t' << location << '\n';
+        }
+
+        if (!output)
+        {
+            Log("FRF could not write the rule profile %ls", g_profilePath.c_str());
+        }
+    }
+}
+
+void latency_histogram::record(std::uint64_t microseconds) noexcept
+{
+    std::size_t bucket = 0;
+    while ((microseconds != 0) && (bucket < latency_histogram_buckets - 1))
+    {
+        microseconds >>= 1;
+        ++bucket;
+    }
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+fixup_statistics::fixup_statistics(const char* fixupName) noexcept :
+    name(fixupName),
+    next(g_fixupStatistics)
+{
+    // Only ever called during static initialization, which the loader lock serializes
+    g_fixupStatistics = this;
+}
+
+fixup_statistics_scope::fixup_statistics_scope(fixup_statistics& statistics) noexcept :
+    m_previous(t_currentFixup)
+{
+    t_currentFixup = &statistics;
+}
+
+fixup_statistics_scope::~fixup_statistics_scope()
+{
+    t_currentFixup = m_previous;
+}
+
+void InitializeRedirectionStatistics(const redirection_rule_set& specs, std::filesystem::path profilePath)
+{
+    auto specCount = specs.specs().size();
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    g_ticksPerSecond = frequency.QuadPart;
+
+    g_specStatistics = std::make_unique<spec_statistics[]>(specCount);
+    g_specs = &specs;
+    g_specCount = specCount;
+    g_profilePath = std::move(profilePath);
+    g_statisticsEnabled = true;
+    Log("\t\tFRF redirection statistics enabled, specs=%zu", specCount);
+}
+
+std::int64_t RedirectionStatisticsTimestamp() noexcept
+{
+    if (!g_statisticsEnabled)
+    {
+        return 0;
+    }
+
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+void RecordShouldRedirect(std::int64_t start, bool redirected) noexcept
+{
+    g_shouldRedirectMetric.increment();
+    if (redirected)
+    {
+        g_redirectsMetric.increment();
+    }
+
+    if (start == 0)
+    {
+        return;
+    }
+
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+
+    auto& statistics = current_fixup();
+    statistics.calls.fetch_add(1, std::memory_order_relaxed);
+    if (redirected)
+    {
+        statistics.redirects.fetch_add(1, std::memory_order_relaxed);
+    }
+    statistics.latency.record(static_cast<std::uint64_t>(now.QuadPart - start) * 1'000'000 / g_ticksPerSecond);
+}
+
+void RecordRedirectSpecMatch(std::size_t specIndex) noexcept
+{
+    if (g_statisticsEnabled && (specIndex < g_specCount))
+    {
+        g_specStatistics[specIndex].matches.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void RecordRedirectCopy(std::size_t specIndex, const wchar_t* destination) noexcept
+{
+    if (!g_statisticsEnabled && !g_copyBytesMetric)
+    {
+        return;
+    }
+
+    // Directories are counted as copies too, just without any bytes
+    std::uint64_t size = 0;
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (::GetFileAttributesExW(destination, GetFileExInfoStandard, &data) && !(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        size = static_cast<std::uint64_t>(data.nFileSizeHigh) << 32 | data.nFileSizeLow;
+    }
+
+    g_copiesMetric.increment();
+    g_copyBytesMetric.add(static_cast<std::int64_t>(size));
+    if (!g_statisticsEnabled)
+    {
+        return;
+    }
+
+    auto& statistics = current_fixup();
+    statistics.copies.fetch_add(1, std::memory_order_relaxed);
+    statistics.bytes_copied.fetch_add(size, std::memory_order_relaxed);
+    if (specIndex < g_specCount)
+    {
+        g_specStatistics[specIndex].copies.fetch_add(1, std::memory_order_relaxed);
+        g_specStatistics[specIndex].bytes_copied.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+void LogRedirectionStatistics()
+{
+    if (!g_statisticsEnabled)
+    {
+        return;
+    }
+
+    TraceLoggingRegister(g_Log_ETW_ComponentProvider);
+
+    // Specs are identified by their position in the arrays, which matches the order in which they're traced with the
+    // configuration. All of them go into a single event, since there can be a great many
+    psf::telemetry_counts specMatches;
+    psf::telemetry_counts specCopies;
+    psf::telemetry_counts specBytesCopied;
+    for (std::size_t i = 0; i < g_specCount; ++i)
+    {
+        auto& statistics = g_specStatistics[i];
+        auto matches = statistics.matches.load(std::memory_order_relaxed);
+        auto copies = statistics.copies.load(std::memory_order_relaxed);
+        auto bytesCopied = statistics.bytes_copied.load(std::memory_order_relaxed);
+        Log("FRF spec %zu (%s): matches=%llu copies=%llu bytes copied=%llu", i, g_specs->specs()[i].config_location.c_str(),
+            matches, copies, bytesCopied);
+
+        specMatches.add(matches);
+        specCopies.add(copies);
+        specBytesCopied.add(bytesCopied);
+    }
+
+    TraceLoggingWrite(
+        g_Log_ETW_ComponentProvider,
+        "FileRedirectionFixupSpecStatistics",
+        TraceLoggingUInt64(static_cast<std::uint64_t>(g_specCount), "Specs"),
+        TraceLoggingUInt64Array(specMatches.data(), specMatches.count(), "Matches"),
+        TraceLoggingUInt64Array(specCopies.data(), specCopies.count(), "Copies"),
+        TraceLoggingUInt64Array(specBytesCopied.data(), specBytesCopied.count(), "BytesCopied"),
+        TraceLoggingUInt64(specMatches.total(), "TotalMatches"),
+        TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
+        TelemetryPrivacyDataTag(PDT_ProductAndServicePerformance),
+        TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+
+    for (auto statistics = g_fixupStatistics; statistics; statistics = statistics->next)
+    {
+        auto calls = statistics->calls.load(std::memory_order_relaxed);
+        if (calls == 0)
+        {
+            continue;
+        }
+
+        std::uint64_t latency[latency_histogram_buckets];
+        char latencyText[latency_histogram_buckets * 21 + 1] = {};
+        std::size_t length = 0;
+        for (std::size_t i = 0; i < latency_histogram_buckets; ++i)
+        {
+            latency[i] = statistics->latency.buckets[i].load(std::memory_order_relaxed);
+            auto written = std::snprintf(latencyText + length, std::size(latencyText) - length, " %llu", latency[i]);
+            length = std::min(length + static_cast<std::size_t>(std::max(written, 0)), std::size(latencyText) - 1);
+        }
+
+        auto redirects = statistics->redirects.load(std::memory_order_relaxed);
+        auto copies = statistics->copies.load(std::memory_order_relaxed);
+        auto bytesCopied = statistics->bytes_copied.load(std::memory_order_relaxed);
+        Log("FRF %s: calls=%llu redirects=%llu copies=%llu bytes copied=%llu latency (log2 us):%s",
+            statistics->name, calls, redirects, copies, bytesCopied, latencyText);
+
+        TraceLoggingWrite(
+            g_Log_ETW_ComponentProvider,
+            "FileRedirectionFixupStatistics",
+            TraceLoggingString(statistics->name, "Fixup"),
+            TraceLoggingUInt64(calls, "Calls"),
+            TraceLoggingUInt64(redirects, "Redirects"),
+            TraceLoggingUInt64(copies, "Copies"),
+            TraceLoggingUInt64(bytesCopied, "BytesCopied"),
+            TraceLoggingUInt64FixedArray(latency, latency_histogram_buckets, "LatencyHistogram"),
+            TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
+            TelemetryPrivacyDataTag(PDT_ProductAndServicePerformance),
+            TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+    }
+
+    TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
+
+    write_profile();
+}
@@ -0,0 +1,86 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+class redirection_rule_set;
+
+// Optional instrumentation for tuning configurations. When enabled, the fixup counts how often each redirection spec
+// matches, and how many files (and bytes) were copied to the redirected area because of it, along with how many calls
+// to ShouldRedirect each fixup makes, how many of them redirect, and how long they take. Everything is kept in relaxed
+// atomics so that collecting never takes a lock. The totals are written to the log, and to the ETW provider, when the
+// fixup is uninitialized. The spec matches are also added to a profile file, which PsfRuleOrderer uses to reorder the
+// rules of the configuration.
+//
+// NOTE: Spec matches are counted when a path is resolved, so repeated queries that are answered by the redirect cache
+//       (see RedirectCache.h) count only once. This is also what the order of the specs has an impact on.
+
+// Latencies are bucketed by powers of two of microseconds; the first bucket holds everything under a microsecond and
+// the last one everything from 2^(latency_histogram_buckets - 2) microseconds up
+constexpr std::size_t latency_histogram_buckets = 16;
+
+struct latency_histogram
+{
+    std::atomic<std::uint64_t> buckets[latency_histogram_buckets] = {};
+
+    void record(std::uint64_t microseconds) noexcept;
+};
+
+// One per fixup, each defined at namespace scope in the fixup's source file (e.g. "CreateFile"). Instances register
+// themselves on construction so that they can all be reported on, and must therefore have static storage duration
+struct fixup_statistics
+{
+    explicit fixup_statistics(const char* fixupName) noexcept;
+
+    fixup_statistics(const fixup_statistics&) = delete;
+    fixup_statistics& operator=(const fixup_statistics&) = delete;
+
+    const char* name;
+    fixup_statistics* next;
+
+    std::atomic<std::uint64_t> calls{ 0 };
+    std::atomic<std::uint64_t> redirects{ 0 };
+    std::atomic<std::uint64_t> copies{ 0 };
+    std::atomic<std::uint64_t> bytes_copied{ 0 };
+    latency_histogram latency;
+};
+
+// Attributes the calls to ShouldRedirect made by this thread to 'statistics' for the lifetime of the scope. Calls that
+// are made outside of any scope are attributed to "Other"
+class fixup_statistics_scope
+{
+public:
+    explicit fixup_statistics_scope(fixup_statistics& statistics) noexcept;
+    ~fixup_statistics_scope();
+
+    fixup_statistics_scope(const fixup_statistics_scope&) = delete;
+    fixup_statistics_scope& operator=(const fixup_statistics_scope&) = delete;
+
+private:
+    fixup_statistics* m_previous;
+};
+
+// Enables collection for the given redirection specs. Must be called once the specs are in place and before anything is
+// redirected. The spec matches are added to those already in the profile at 'profilePath' when the fixup is unloaded
+void InitializeRedirectionStatistics(const redirection_rule_set& specs, std::filesystem::path profilePath);
+
+// Returns the start time of a call to ShouldRedirect, or zero if statistics aren't being collected
+std::int64_t RedirectionStatisticsTimestamp() noexcept;
+
+// 'start' is the value returned by RedirectionStatisticsTimestamp
+void RecordShouldRedirect(std::int64_t start, bool redirected) noexcept;
+
+// 'specIndex' is the position of the spec in g_redirectionSpecs
+void RecordRedirectSpecMatch(std::size_t specIndex) noexcept;
+
+// Called after 'destination' was successfully copied to the redirected area because of the spec at 'specIndex'
+void RecordRedirectCopy(std::size_t specIndex, const wchar_t* destination) noexcept;
+
+// Writes the statistics to the log, to the ETW provider, and to the profile
+void LogRedirectionStatistics();
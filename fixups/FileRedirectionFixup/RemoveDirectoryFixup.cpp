@@ -3,8 +3,48 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "RedirectionStatistics.h"
+#include "WhiteoutIndex.h"
+
+static fixup_statistics g_statistics("RemoveDirectory");
+
+// Whether the directory has anything below the redirected area that hasn't been deleted already. The whiteout for the
+// directory would hide all of it, so in that case removing it needs to fail the same way that removing any directory
+// that isn't empty does
+template <typename CharT>
+static bool HasChildrenBelowRedirect(const CharT* pathName, const std::filesystem::path& redirectPath)
+{
+    std::wstring searchPath = PackageSourcePath(pathName);
+    if (searchPath.empty())
+    {
+        searchPath = widen(pathName, CP_ACP);
+    }
+    searchPath += LR"(\*)";
+
+    WIN32_FIND_DATAW data;
+    auto findHandle = impl::FindFirstFileEx(searchPath.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, 0);
+    if (findHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    bool result = false;
+    do
+    {
+        if ((wcscmp(data.cFileName, L".") != 0) && (wcscmp(data.cFileName, L"..") != 0) &&
+            !IsWhitedOut((redirectPath / data.cFileName).native()))
+        {
+            result = true;
+        }
+    }
+    while (!result && impl::FindNextFile(findHandle, &data));
+
+    impl::FindClose(findHandle);
+    return result;
+}
 
 template <typename CharT>
 BOOL __stdcall RemoveDirectoryFixup(_In_ const CharT* pathName) noexcept
@@ -12,9 +52,10 @@ BOOL __stdcall RemoveDirectoryFixup(_In_ const CharT* pathName) noexcept
     auto guard = g_reentrancyGuard.enter();
     try
     {
-        if (guard)
+        if (guard && !IsRedirectionBypassed(pathName))
         {
-            DWORD RemoveDirectoryInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD RemoveDirectoryInstance = psf::next_interception_id();
             LogString(RemoveDirectoryInstance,L"RemoveDirectoryFixup for pathName", pathName);
             
             if (!IsUnderUserAppDataLocalPackages(pathName))
@@ -23,15 +64,34 @@ BOOL __stdcall RemoveDirectoryFixup(_In_ const CharT* pathName) noexcept
                 auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(pathName, redirect_flags::none);
                 if (shouldRedirect)
                 {
-                    if (!impl::PathExists(redirectPath.c_str()) && impl::PathExists(pathName))
+                    bool redirected = RedirectedPathExists(redirectPath.c_str());
+                    bool showsThrough = (!redirected || WhiteoutsEnabled()) && ShowsThroughRedirect(pathName, redirectPath);
+                    if (showsThrough && WhiteoutsEnabled() && HasChildrenBelowRedirect(pathName, redirectPath))
+                    {
+                        ::SetLastError(ERROR_DIR_NOT_EMPTY);
+                        return FALSE;
+                    }
+
+                    if (!redirected && showsThrough)
                     {
                         // If the directory does not exist in the redirected location, but does in the non-redirected
                         // location, then we want to give the "illusion" that the delete succeeded
+                        AddWhiteout(redirectPath.native());
                         return TRUE;
                     }
                     else
                     {
-                        return impl::RemoveDirectory(redirectPath.c_str());
+                        auto result = impl::RemoveDirectory(redirectPath.c_str());
+                        InvalidateRedirectCache(redirectPath.c_str());
+                        if (result)
+                        {
+                            NotifyRedirectedPathRemoved(redirectPath.c_str());
+                            if (showsThrough)
+                            {
+                                AddWhiteout(redirectPath.native());
+                            }
+                        }
+                        return result;
                     }
                 }
             }
@@ -48,4 +108,4 @@ BOOL __stdcall RemoveDirectoryFixup(_In_ const CharT* pathName) noexcept
 
     return impl::RemoveDirectory(pathName);
 }
-DECLARE_STRING_FIXUP(impl::RemoveDirectory, RemoveDirectoryFixup);
+DECLARE_WIDENED_STRING_FIXUP(impl::RemoveDirectory, RemoveDirectoryFixup);
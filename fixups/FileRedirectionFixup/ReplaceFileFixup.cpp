@@ -3,8 +3,13 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("ReplaceFile");
 
 template <typename CharT>
 BOOL __stdcall ReplaceFileFixup(
@@ -20,7 +25,8 @@ BOOL __stdcall ReplaceFileFixup(
     {
         if (guard)
         {
-            DWORD ReplaceFileInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD ReplaceFileInstance = psf::next_interception_id();
             LogString(ReplaceFileInstance,L"ReplaceFileFixup From", replacedFileName);
             LogString(ReplaceFileInstance,L"ReplaceFileFixup To",   replacementFileName);
 
@@ -32,15 +38,38 @@ BOOL __stdcall ReplaceFileFixup(
             auto [redirectTarget, targetRedirectPath, shouldReadonlyTarget] = ShouldRedirect(replacedFileName, redirect_flags::copy_on_read);
             auto [redirectSource, sourceRedirectPath, shouldReadonlySource] = ShouldRedirect(replacementFileName, redirect_flags::copy_on_read);
             auto [redirectBackup, backupRedirectPath, shouldReadonlyDest] = ShouldRedirect(backupFileName, redirect_flags::ensure_directory_structure);
+            if (redirectTarget)
+            {
+                FlushPendingProfile(targetRedirectPath.c_str());
+            }
+            if (redirectSource)
+            {
+                FlushPendingProfile(sourceRedirectPath.c_str());
+            }
             if (redirectTarget || redirectSource || redirectBackup)
             {
-                return impl::ReplaceFile(
+                auto result = impl::ReplaceFile(
                     redirectTarget ? targetRedirectPath.c_str() : widen_argument(replacedFileName).c_str(),
                     redirectSource ? sourceRedirectPath.c_str() : widen_argument(replacementFileName).c_str(),
                     redirectBackup ? backupRedirectPath.c_str() : widen_argument(backupFileName).c_str(),
                     replaceFlags,
                     exclude,
                     reserved);
+                InvalidateRedirectCache(redirectTarget ? targetRedirectPath.c_str() : widen_argument(replacedFileName).c_str());
+                InvalidateRedirectCache(redirectSource ? sourceRedirectPath.c_str() : widen_argument(replacementFileName).c_str());
+                InvalidateRedirectCache(redirectBackup ? backupRedirectPath.c_str() : widen_argument(backupFileName).c_str());
+                if (result)
+                {
+                    if (redirectTarget)
+                    {
+                        NotifyRedirectedPathCreated(targetRedirectPath.c_str());
+                    }
+                    if (redirectBackup)
+                    {
+                        NotifyRedirectedPathCreated(backupRedirectPath.c_str());
+                    }
+                }
+                return result;
             }
         }
     }
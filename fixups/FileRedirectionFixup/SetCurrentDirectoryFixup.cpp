@@ -0,0 +1,22 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include "CurrentDirectoryCache.h"
+#include "FunctionImplementations.h"
+
+// Nothing is redirected here; this only keeps the fixup's copy of the current directory (see CurrentDirectoryCache.h)
+// in sync. That's so whether or not the call comes from within the fixup, hence no reentrancy guard
+template <typename CharT>
+BOOL __stdcall SetCurrentDirectoryFixup(_In_ const CharT* pathName) noexcept
+{
+    auto result = impl::SetCurrentDirectory(pathName);
+    if (result)
+    {
+        NotifyCurrentDirectoryChanged();
+    }
+
+    return result;
+}
+DECLARE_WIDENED_STRING_FIXUP(impl::SetCurrentDirectory, SetCurrentDirectoryFixup);
@@ -0,0 +1,372 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <package_index.h>
+#include <psf_utils.h>
+
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+#include "WhiteoutIndex.h"
+
+namespace
+{
+    constexpr wchar_t whiteout_index_file_name[] = L"PsfWhiteouts.dat";
+    constexpr wchar_t whiteout_journal_file_name[] = L"PsfWhiteouts.log";
+
+    // Journals larger than this are assumed to be corrupt, and are ignored
+    constexpr LONGLONG max_whiteout_journal_size = 64 * 1024 * 1024;
+
+    bool g_whiteoutsEnabled = false;
+    std::filesystem::path g_whiteoutIndexPath;
+    std::filesystem::path g_whiteoutJournalPath;
+
+    // Serializes changes to the files with the other processes of the package, which share the redirected area
+    HANDLE g_whiteoutMutex = nullptr;
+
+    // The index as it was when the process started, and the whiteouts that were added since, sorted. Only the latter
+    // ever changes.
+    std::shared_mutex g_whiteoutsLock;
+    psf::package_index g_whiteoutIndex;
+    std::vector<std::wstring> g_addedWhiteouts;
+    std::atomic<bool> g_haveWhiteouts{ false };
+
+    class whiteout_files_lock
+    {
+    public:
+        whiteout_files_lock() noexcept
+        {
+            if (g_whiteoutMutex)
+            {
+                // NOTE: An abandoned mutex is owned all the same, and the files are never left half written
+                auto result = ::WaitForSingleObject(g_whiteoutMutex, INFINITE);
+                m_owned = (result == WAIT_OBJECT_0) || (result == WAIT_ABANDONED);
+            }
+        }
+
+        ~whiteout_files_lock()
+        {
+            if (m_owned)
+            {
+                ::ReleaseMutex(g_whiteoutMutex);
+            }
+        }
+
+        whiteout_files_lock(const whiteout_files_lock&) = delete;
+        whiteout_files_lock& operator=(const whiteout_files_lock&) = delete;
+
+    private:
+        bool m_owned = false;
+    };
+
+    // Whiteouts are keyed on the redirected path without its "\\?\" prefix, in the same form as package index keys
+    std::wstring make_key(std::wstring_view path)
+    {
+        constexpr std::wstring_view long_path_prefix = LR"(\\?\)";
+        if (path.substr(0, long_path_prefix.length()) == long_path_prefix)
+        {
+            path.remove_prefix(long_path_prefix.length());
+        }
+
+        std::wstring result(path);
+        psf::make_package_index_key(result);
+        return result;
+    }
+
+    bool less_key(std::wstring_view lhs, std::wstring_view rhs) noexcept
+    {
+        return lhs < rhs;
+    }
+
+    // The journal holds one key per line
+    void read_journal(std::vector<std::wstring>& keys)
+    {
+        auto file = impl::CreateFile(g_whiteoutJournalPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+
+        LARGE_INTEGER size{};
+        std::wstring contents;
+        if (::GetFileSizeEx(file, &size) && (size.QuadPart > 0) && (size.QuadPart <= max_whiteout_journal_size))
+        {
+            contents.resize(static_cast<std::size_t>(size.QuadPart) / sizeof(wchar_t));
+            DWORD bytesRead = 0;
+            if (!::ReadFile(file, contents.data(), static_cast<DWORD>(contents.length() * sizeof(wchar_t)), &bytesRead, nullptr))
+            {
+                bytesRead = 0;
+            }
+            contents.resize(bytesRead / sizeof(wchar_t));
+        }
+        ::CloseHandle(file);
+
+        std::size_t start = 0;
+        while (start < contents.length())
+        {
+            auto end = contents.find(L'\n', start);
+            if (end == std::wstring::npos)
+            {
+                // Only the last line can be incomplete, e.g. if the process that was writing it was terminated
+                break;
+            }
+
+            if (end > start)
+            {
+                keys.emplace_back(contents, start, end - start);
+            }
+            start = end + 1;
+        }
+    }
+
+    bool append_to_journal(const std::wstring& key)
+    {
+        auto openJournal = []
+        {
+            return impl::CreateFile(g_whiteoutJournalPath.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        };
+
+        auto file = openJournal();
+        if ((file == INVALID_HANDLE_VALUE) && (::GetLastError() == ERROR_PATH_NOT_FOUND))
+        {
+            // Nothing has been redirected yet
+            std::error_code ec;
+            std::filesystem::create_directories(g_whiteoutJournalPath.parent_path(), ec);
+            file = openJournal();
+        }
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        // Written in one go, so that other processes never see part of a line
+        auto line = key + L'\n';
+        DWORD bytesWritten = 0;
+        auto result = ::WriteFile(file, line.data(), static_cast<DWORD>(line.length() * sizeof(wchar_t)), &bytesWritten, nullptr);
+        ::CloseHandle(file);
+        return result && (bytesWritten == line.length() * sizeof(wchar_t));
+    }
+
+    // Replaces the index with one of 'keys', which must be sorted and unique. Fails if another process has the index
+    // mapped, in which case the journal is kept for a later process to merge
+    bool write_index(const std::vector<std::wstring>& keys)
+    {
+        std::uint64_t stringTableLength = 0;
+        for (auto& key : keys)
+        {
+            stringTableLength += key.length();
+        }
+
+        if ((keys.size() > std::numeric_limits<std::uint32_t>::max()) ||
+            (stringTableLength > std::numeric_limits<std::uint32_t>::max()))
+        {
+            return false;
+        }
+
+        std::vector<char> contents(sizeof(psf::package_index_header) + keys.size() * sizeof(psf::package_index_entry) +
+            static_cast<std::size_t>(stringTableLength) * sizeof(wchar_t));
+        auto header = reinterpret_cast<psf::package_index_header*>(contents.data());
+        auto entries = reinterpret_cast<psf::package_index_entry*>(header + 1);
+        auto strings = reinterpret_cast<wchar_t*>(entries + keys.size());
+        std::uint32_t offset = 0;
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            auto length = static_cast<std::uint32_t>(keys[i].length());
+            entries[i] = psf::package_index_entry{ offset, length, 0 };
+            std::copy_n(keys[i].data(), length, strings + offset);
+            offset += length;
+        }
+
+        header->magic = psf::package_index_magic;
+        header->version = psf::package_index_version;
+        header->entry_count = static_cast<std::uint32_t>(keys.size());
+        header->string_table_length = static_cast<std::uint32_t>(stringTableLength);
+
+        auto tempPath = g_whiteoutIndexPath.native() + L".new";
+        auto file = impl::CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        DWORD bytesWritten = 0;
+        auto written = ::WriteFile(file, contents.data(), static_cast<DWORD>(contents.size()), &bytesWritten, nullptr) &&
+            (bytesWritten == contents.size());
+        ::CloseHandle(file);
+
+        if (!written || !impl::MoveFileEx(tempPath.c_str(), g_whiteoutIndexPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            impl::DeleteFile(tempPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    // Must be called with g_whiteoutsLock held
+    bool find_whiteout(std::wstring_view key) noexcept
+    {
+        return g_whiteoutIndex.find(key) ||
+            std::binary_search(g_addedWhiteouts.begin(), g_addedWhiteouts.end(), key,
+                [](const auto& lhs, const auto& rhs) { return less_key(lhs, rhs); });
+    }
+}
+
+void InitializeWhiteoutIndex(const std::filesystem::path& directory)
+{
+    g_whiteoutIndexPath = directory / whiteout_index_file_name;
+    g_whiteoutJournalPath = directory / whiteout_journal_file_name;
+    g_whiteoutMutex = ::CreateMutexW(nullptr, FALSE, (L"Local\\PsfWhiteouts-" + psf::current_package_family_name()).c_str());
+
+    // NOTE: This runs before the hooks are attached, so there's no concern about redirecting our own file access
+    whiteout_files_lock lock;
+    std::vector<std::wstring> journal;
+    read_journal(journal);
+    std::sort(journal.begin(), journal.end());
+    journal.erase(std::unique(journal.begin(), journal.end()), journal.end());
+
+    if (!journal.empty())
+    {
+        // Merged here, rather than whenever a whiteout gets added, so that the index only gets rewritten once per process
+        std::vector<std::wstring> keys;
+        if (g_whiteoutIndex.open(g_whiteoutIndexPath))
+        {
+            keys.reserve(g_whiteoutIndex.size() + journal.size());
+            for (std::size_t i = 0; i < g_whiteoutIndex.size(); ++i)
+            {
+                keys.emplace_back(g_whiteoutIndex.path_of(g_whiteoutIndex.entry_at(i)));
+            }
+            g_whiteoutIndex.close();
+        }
+
+        std::vector<std::wstring> merged;
+        merged.reserve(keys.size() + journal.size());
+        std::set_union(keys.begin(), keys.end(), journal.begin(), journal.end(), std::back_inserter(merged));
+        if (write_index(merged))
+        {
+            impl::DeleteFile(g_whiteoutJournalPath.c_str());
+            journal.clear();
+        }
+    }
+
+    g_whiteoutIndex.open(g_whiteoutIndexPath);
+    g_addedWhiteouts = std::move(journal);
+    g_whiteoutsEnabled = true;
+    g_haveWhiteouts.store((g_whiteoutIndex.size() + g_addedWhiteouts.size()) != 0, std::memory_order_release);
+    Log("\t\tFRF whiteouts: index=%zu journal=%zu", g_whiteoutIndex.size(), g_addedWhiteouts.size());
+}
+
+bool WhiteoutsEnabled() noexcept
+{
+    return g_whiteoutsEnabled;
+}
+
+bool IsWhitedOut(std::wstring_view redirectPath) noexcept try
+{
+    if (!g_haveWhiteouts.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    auto key = make_key(redirectPath);
+    std::wstring_view path(key);
+
+    std::shared_lock lock(g_whiteoutsLock);
+    while (!path.empty())
+    {
+        if (find_whiteout(path))
+        {
+            return true;
+        }
+
+        auto separator = path.rfind(L'\\');
+        if (separator == std::wstring_view::npos)
+        {
+            break;
+        }
+        path = path.substr(0, separator);
+    }
+
+    return false;
+}
+catch (...)
+{
+    return false;
+}
+
+void AddWhiteout(std::wstring_view redirectPath) noexcept try
+{
+    if (!g_whiteoutsEnabled || IsWhitedOut(redirectPath))
+    {
+        return;
+    }
+
+    auto key = make_key(redirectPath);
+    {
+        whiteout_files_lock lock;
+        if (!append_to_journal(key))
+        {
+            // Still hidden for the rest of this process, just not afterwards
+            Log("\t\tFRF whiteout could not be saved, error=%d", ::GetLastError());
+        }
+    }
+
+    {
+        std::unique_lock lock(g_whiteoutsLock);
+        auto pos = std::lower_bound(g_addedWhiteouts.begin(), g_addedWhiteouts.end(), key);
+        if ((pos == g_addedWhiteouts.end()) || (*pos != key))
+        {
+            g_addedWhiteouts.insert(pos, key);
+        }
+        g_haveWhiteouts.store(true, std::memory_order_release);
+    }
+
+    // Cached decisions may well have been to copy the package's version
+    InvalidateRedirectCache(std::wstring(redirectPath).c_str());
+    LogString(L"\t\tFRF whiteout added", key.c_str());
+}
+catch (...)
+{
+    Log("\t\tFRF whiteout failed with an exception");
+}
+
+template <typename CharT>
+static bool ShowsThroughRedirectImpl(const CharT* fileName, const std::filesystem::path& redirectPath)
+{
+    if (IsWhitedOut(redirectPath.native()))
+    {
+        return false;
+    }
+
+    auto sourcePath = PackageSourcePath(fileName);
+    if (!sourcePath.empty() && impl::PathExists(sourcePath.c_str()))
+    {
+        return true;
+    }
+
+    // The runtime doesn't layer the package into AppData, so what's there is only ever at the path itself
+    return (UserAppDataLocation(fileName) != user_appdata_location::none) && impl::PathExists(fileName);
+}
+
+bool ShowsThroughRedirect(const wchar_t* fileName, const std::filesystem::path& redirectPath)
+{
+    return ShowsThroughRedirectImpl(fileName, redirectPath);
+}
+
+bool ShowsThroughRedirect(const char* fileName, const std::filesystem::path& redirectPath)
+{
+    return ShowsThroughRedirectImpl(fileName, redirectPath);
+}
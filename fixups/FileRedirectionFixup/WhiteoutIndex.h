@@ -0,0 +1,43 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+
+// Files and directories in the package can't actually be deleted, so by default deleting one only gets rid of its copy
+// in the redirected area, after which the package's version shows through again. When enabled (through the
+// "deletePackageFiles" config property), deleting, removing or moving away something that the package has leaves a
+// whiteout in its place instead: a record that the package's version of that path - and of everything below it - is
+// gone. Whiteouts only hide what's below the redirected area, so whatever gets created at the same path afterwards is
+// seen as usual.
+//
+// Whiteouts are kept by their path in the redirected area, in the layout of a package index (see package_index.h), in
+// a file that sits next to the default redirect roots and that is mapped read-only and searched in place. Whiteouts
+// added since it was written are appended to a journal next to it, which is merged into the index the next time that
+// a process of the package starts.
+//
+// NOTE: Other processes of the package that are already running don't observe whiteouts added by this one until they
+//       are started again
+
+// Loads the whiteouts that were left by earlier runs from 'directory'. Until this is called, IsWhitedOut is always
+// false and AddWhiteout does nothing, so that deletions behave as they always have
+void InitializeWhiteoutIndex(const std::filesystem::path& directory);
+
+bool WhiteoutsEnabled() noexcept;
+
+// True if the package's version of 'redirectPath', which is a path in the redirected area as given by ShouldRedirect,
+// or of any directory above it, has been deleted. Nothing but a check of a flag when there are no whiteouts, and
+// otherwise a binary search for the path and for each of its parents
+bool IsWhitedOut(std::wstring_view redirectPath) noexcept;
+
+// Records that the package's version of 'redirectPath' has been deleted. Does nothing if whiteouts are not enabled
+void AddWhiteout(std::wstring_view redirectPath) noexcept;
+
+// Whether there's anything below the redirected area - in the package, or at the path the application asked for - that
+// would show through at 'redirectPath' if nothing was there, i.e. what deleting 'fileName' from the redirected area alone
+// would not get rid of
+bool ShowsThroughRedirect(const wchar_t* fileName, const std::filesystem::path& redirectPath);
+bool ShowsThroughRedirect(const char* fileName, const std::filesystem::path& redirectPath);
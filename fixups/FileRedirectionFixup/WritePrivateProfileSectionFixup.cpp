@@ -3,8 +3,13 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("WritePrivateProfileSection");
 
 template <typename CharT>
 BOOL __stdcall WritePrivateProfileSectionFixup(
@@ -17,7 +22,8 @@ BOOL __stdcall WritePrivateProfileSectionFixup(
     {
         if (guard)
         {
-            DWORD WritePrivateProfileSectionInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD WritePrivateProfileSectionInstance = psf::next_interception_id();
             LogString(WritePrivateProfileSectionInstance,L"WritePrivateProfileSectionFixup for fileName", fileName);
 
             if (fileName != NULL)
@@ -27,15 +33,23 @@ BOOL __stdcall WritePrivateProfileSectionFixup(
                     auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        FlushPendingProfile(redirectPath.c_str());
+                        BOOL result;
                         if constexpr (psf::is_ansi<CharT>)
                         {
-                            return impl::WritePrivateProfileSectionW(widen_argument(appName).c_str(),
+                            result = impl::WritePrivateProfileSectionW(widen_argument(appName).c_str(),
                                 widen_argument(string).c_str(), redirectPath.c_str());
                         }
                         else
                         {
-                            return impl::WritePrivateProfileSection(appName, string, redirectPath.c_str());
+                            result = impl::WritePrivateProfileSection(appName, string, redirectPath.c_str());
+                        }
+                        InvalidateCachedProfile(redirectPath.c_str());
+                        if (result)
+                        {
+                            NotifyRedirectedPathCreated(redirectPath.c_str());
                         }
+                        return result;
                     }
                 }
                 else
@@ -56,4 +70,4 @@ BOOL __stdcall WritePrivateProfileSectionFixup(
 
     return impl::WritePrivateProfileSection(appName, string, fileName);
 }
-DECLARE_STRING_FIXUP(impl::WritePrivateProfileSection, WritePrivateProfileSectionFixup);
+DECLARE_GROUPED_STRING_FIXUP(private_profile_hook_group, impl::WritePrivateProfileSection, WritePrivateProfileSectionFixup);
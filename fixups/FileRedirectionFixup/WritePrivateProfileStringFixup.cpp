@@ -3,8 +3,13 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("WritePrivateProfileString");
 
 template <typename CharT>
 BOOL __stdcall WritePrivateProfileStringFixup(
@@ -18,7 +23,8 @@ BOOL __stdcall WritePrivateProfileStringFixup(
     {
         if (guard)
         {
-            DWORD WritePrivateProfileStringInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD WritePrivateProfileStringInstance = psf::next_interception_id();
             LogString(WritePrivateProfileStringInstance,L"WritePrivateProfileStringFixup for fileName", fileName);
             
             if (fileName != NULL)
@@ -28,15 +34,28 @@ BOOL __stdcall WritePrivateProfileStringFixup(
                     auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        if (auto pendingResult = WriteBehindProfileString(redirectPath.c_str(), appName, keyName, string))
+                        {
+                            return *pendingResult;
+                        }
+
+                        FlushPendingProfile(redirectPath.c_str());
+                        BOOL result;
                         if constexpr (psf::is_ansi<CharT>)
                         {
-                            return impl::WritePrivateProfileStringW(widen_argument(appName).c_str(), widen_argument(keyName).c_str(),
+                            result = impl::WritePrivateProfileStringW(widen_argument(appName).c_str(), widen_argument(keyName).c_str(),
                                 widen_argument(string).c_str(), redirectPath.c_str());
                         }
                         else
                         {
-                            return impl::WritePrivateProfileString(appName, keyName, string, redirectPath.c_str());
+                            result = impl::WritePrivateProfileString(appName, keyName, string, redirectPath.c_str());
+                        }
+                        InvalidateCachedProfile(redirectPath.c_str());
+                        if (result)
+                        {
+                            NotifyRedirectedPathCreated(redirectPath.c_str());
                         }
+                        return result;
                     }
                 }
                 else
@@ -57,4 +76,4 @@ BOOL __stdcall WritePrivateProfileStringFixup(
 
     return impl::WritePrivateProfileString(appName, keyName, string, fileName);
 }
-DECLARE_STRING_FIXUP(impl::WritePrivateProfileString, WritePrivateProfileStringFixup);
+DECLARE_GROUPED_STRING_FIXUP(private_profile_hook_group, impl::WritePrivateProfileString, WritePrivateProfileStringFixup);
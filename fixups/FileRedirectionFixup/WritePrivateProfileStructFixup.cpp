@@ -3,8 +3,13 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include "AbsentPathCache.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
+#include "ProfileCache.h"
+#include "RedirectionStatistics.h"
+
+static fixup_statistics g_statistics("WritePrivateProfileStruct");
 
 template <typename CharT>
 BOOL __stdcall WritePrivateProfileStructFixup(
@@ -19,7 +24,8 @@ BOOL __stdcall WritePrivateProfileStructFixup(
     {
         if (guard)
         {
-            DWORD WritePrivateProfileStructInstance = ++g_FileIntceptInstance;
+            fixup_statistics_scope statisticsScope(g_statistics);
+            DWORD WritePrivateProfileStructInstance = psf::next_interception_id();
             LogString(WritePrivateProfileStructInstance,L"WritePrivateProfileStructFixup for fileName", fileName);
 
             if (fileName != NULL)
@@ -29,15 +35,23 @@ BOOL __stdcall WritePrivateProfileStructFixup(
                     auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        FlushPendingProfile(redirectPath.c_str());
+                        BOOL result;
                         if constexpr (psf::is_ansi<CharT>)
                         {
-                            return impl::WritePrivateProfileStructW(widen_argument(appName).c_str(), widen_argument(keyName).c_str(),
+                            result = impl::WritePrivateProfileStructW(widen_argument(appName).c_str(), widen_argument(keyName).c_str(),
                                 structData, uSizeStruct, redirectPath.c_str());
                         }
                         else
                         {
-                            return impl::WritePrivateProfileStructW(appName, keyName, structData, uSizeStruct, redirectPath.c_str());
+                            result = impl::WritePrivateProfileStructW(appName, keyName, structData, uSizeStruct, redirectPath.c_str());
+                        }
+                        InvalidateCachedProfile(redirectPath.c_str());
+                        if (result)
+                        {
+                            NotifyRedirectedPathCreated(redirectPath.c_str());
                         }
+                        return result;
                     }
                 }
                 else
@@ -58,4 +72,4 @@ BOOL __stdcall WritePrivateProfileStructFixup(
 
     return impl::WritePrivateProfileStruct(appName, keyName, structData, uSizeStruct, fileName);
 }
-DECLARE_STRING_FIXUP(impl::WritePrivateProfileStruct, WritePrivateProfileStructFixup);
+DECLARE_GROUPED_STRING_FIXUP(private_profile_hook_group, impl::WritePrivateProfileStruct, WritePrivateProfileStructFixup);
@@ -7,13 +7,50 @@
 
 void InitializePaths();
 void InitializeConfiguration();
+bool InitializeAttachConfiguration();
+bool IsHookGroupEnabled(const char* group);
+void LogRedirectCacheStatistics();
+void LogRedirectionStatistics();
+void FlushPendingProfiles() noexcept;
+void UninitializeChangeWatcher() noexcept;
+void SaveReadPrefetch() noexcept;
+
+static bool g_configurationInitialized = false;
+
+// With the "lazyInitialize" config property, all that's read here is what attaching the detours depends on. The paths
+// and the rest of the configuration are left to the first call that gets past the fixup's reentrancy guard, so that
+// processes that never make such a call don't pay for them at all
+static void Initialize()
+{
+    if (!InitializeAttachConfiguration())
+    {
+        InitializePaths();
+        InitializeConfiguration();
+    }
+    g_configurationInitialized = true;
+}
 
 extern "C" {
 
+// Reading the configuration is by far the most expensive part of initialization, so it is done here when the PSF
+// Runtime supports it, which lets it happen on another thread while other fixups load
+int __stdcall PSFPreInitialize() noexcept try
+{
+    Initialize();
+    return ERROR_SUCCESS;
+}
+catch (...)
+{
+    return win32_from_caught_exception();
+}
+
 int __stdcall PSFInitialize() noexcept try
 {
-    InitializeConfiguration();
-    psf::attach_all();
+    if (!g_configurationInitialized)
+    {
+        Initialize();
+    }
+    psf::attach_all(IsHookGroupEnabled);
     return ERROR_SUCCESS;
 }
 catch (...)
@@ -24,6 +61,26 @@ catch (...)
 int __stdcall PSFUninitialize() noexcept try
 {
     psf::detach_all();
+    UninitializeChangeWatcher();
+    FlushPendingProfiles();
+    SaveReadPrefetch();
+    LogRedirectCacheStatistics();
+    LogRedirectionStatistics();
+    return ERROR_SUCCESS;
+}
+catch (...)
+{
+    return win32_from_caught_exception();
+}
+
+// The process is exiting, so only what would be lost otherwise: write-behind .ini files, the recorded read prefetch
+// list, and the statistics along with the redirection profile that they are saved to
+int __stdcall PSFFlush() noexcept try
+{
+    FlushPendingProfiles();
+    SaveReadPrefetch();
+    LogRedirectCacheStatistics();
+    LogRedirectionStatistics();
     return ERROR_SUCCESS;
 }
 catch (...)
@@ -32,11 +89,15 @@ catch (...)
 }
 
 #ifdef _M_IX86
+#pragma comment(linker, "/EXPORT:PSFPreInitialize=_PSFPreInitialize@0")
 #pragma comment(linker, "/EXPORT:PSFInitialize=_PSFInitialize@0")
 #pragma comment(linker, "/EXPORT:PSFUninitialize=_PSFUninitialize@0")
+#pragma comment(linker, "/EXPORT:PSFFlush=_PSFFlush@0")
 #else
+#pragma comment(linker, "/EXPORT:PSFPreInitialize=PSFPreInitialize")
 #pragma comment(linker, "/EXPORT:PSFInitialize=PSFInitialize")
 #pragma comment(linker, "/EXPORT:PSFUninitialize=PSFUninitialize")
+#pragma comment(linker, "/EXPORT:PSFFlush=PSFFlush")
 #endif
 
 BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
@@ -44,7 +105,6 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
     if (reason == DLL_PROCESS_ATTACH)
     {
         ::OutputDebugStringA("FileRedirectionFixup attached");
-        InitializePaths();
     }
 
     return TRUE;
@@ -19,7 +19,7 @@
 
 // A much bigger hammer to avoid reentrancy. Still, the impl::* functions are good to have around to prevent the
 // unnecessary invocation of the fixup
-inline thread_local psf::reentrancy_guard g_reentrancyGuard;
+inline const psf::shared_reentrancy_guard g_reentrancyGuard{ psf::reentrancy_owner::registry };
 
 namespace winternl
 {
@@ -151,6 +151,27 @@ namespace winternl
         ULONG Length,
         PULONG ResultLength);
 
+    // NOTE: NtCreateKey, NtOpenKey and NtOpenKeyEx are only documented; they have no declaration
+    NTSTATUS __stdcall NtCreateKey(
+        PHANDLE KeyHandle,
+        ACCESS_MASK DesiredAccess,
+        POBJECT_ATTRIBUTES ObjectAttributes,
+        ULONG TitleIndex,
+        PUNICODE_STRING Class,
+        ULONG CreateOptions,
+        PULONG Disposition);
+
+    NTSTATUS __stdcall NtOpenKey(
+        PHANDLE KeyHandle,
+        ACCESS_MASK DesiredAccess,
+        POBJECT_ATTRIBUTES ObjectAttributes);
+
+    NTSTATUS __stdcall NtOpenKeyEx(
+        PHANDLE KeyHandle,
+        ACCESS_MASK DesiredAccess,
+        POBJECT_ATTRIBUTES ObjectAttributes,
+        ULONG OpenOptions);
+
     NTSTATUS __stdcall NtQueryValueKey(
         HANDLE KeyHandle,
         PUNICODE_STRING ValueName,
@@ -194,6 +215,14 @@ namespace impl
 {
 
     inline auto NtQueryKey = WINTERNL_FUNCTION(winternl::NtQueryKey);
+    inline auto NtCreateKey = WINTERNL_FUNCTION(winternl::NtCreateKey);
+    inline auto NtOpenKey = WINTERNL_FUNCTION(winternl::NtOpenKey);
+    inline auto NtOpenKeyEx = WINTERNL_FUNCTION(winternl::NtOpenKeyEx);
+    inline auto RegCloseKey = &::RegCloseKey;
+    inline auto RegQueryValueExW = &::RegQueryValueExW;
+    inline auto RegGetValueW = &::RegGetValueW;
+    inline auto RegEnumKeyExW = &::RegEnumKeyExW;
+    inline auto RegEnumValueW = &::RegEnumValueW;
     //inline auto NtQueryInformationFile = WINTERNL_FUNCTION(winternl::NtQueryInformationFile);
     //inline auto NtQueryValueKey = WINTERNL_FUNCTION(winternl::NtQueryValueKey);
 
@@ -19,6 +19,9 @@ using namespace std::literals;
 
 #include "FunctionImplementations.h"
 #include "Reg_Remediation_spec.h"
+#include "RegistryMissingKeyCache.h"
+#include "RegistryStatistics.h"
+#include "RegistryValueCache.h"
 
 
 std::vector<Reg_Remediation_Spec>  g_regRemediationSpecs;
@@ -126,6 +129,45 @@ void InitializeFixups()
 }
 
 
+static Modify_Key_Hive_Types ParseHive(const psf::json_object& remediationsItemObject)
+{
+    auto hiveType = remediationsItemObject.try_get("hive")->as_string().wstring();
+    Log(L"Hive: %Ls\n", hiveType.data());
+    if (hiveType.compare(L"HKCU") == 0)
+    {
+        return Modify_Key_Hive_Type_HKCU;
+    }
+    else if (hiveType.compare(L"HKLM") == 0)
+    {
+        return Modify_Key_Hive_Type_HKLM;
+    }
+
+    return Modify_Key_Hive_Type_Unknown;
+}
+
+static void ParsePatterns(const psf::json_object& remediationsItemObject, std::vector<Modify_Key_Pattern>& patterns)
+{
+    for (auto& pattern : remediationsItemObject.get("patterns").as_array())
+    {
+        auto patternString = pattern.as_string().wstring();
+
+        Log(L"Pattern: %Ls\n", patternString.data());
+        Modify_Key_Pattern patternItem;
+        patternItem.pattern = patternString.data();
+        try
+        {
+            patternItem.matcher.assign(patternItem.pattern.c_str(), patternItem.pattern.length());
+        }
+        catch (const std::regex_error&)
+        {
+            // An invalid pattern can never match a key, so it is left out
+            Log(L"RegLegacyFixups: Ignoring invalid pattern %Ls\n", patternString.data());
+            continue;
+        }
+        patterns.push_back(std::move(patternItem));
+    }
+}
+
 void InitializeConfiguration()
 {
     Log("RegLegacyFixups Start InitializeConfiguration()\n");
@@ -148,7 +190,18 @@ void InitializeConfiguration()
                 auto type = specObject.get("type").as_string().wstring();
                 Log("RegLegacyFixups: have type");
                 Log(L"Type: %Ls\n", type.data());
-                if (type.compare(L"ModifyKeyAccess") == 0)
+                if (type.compare(L"Statistics") == 0)
+                {
+                    // Not a remediation, so there is nothing to add to the specs
+                    EnableRegistryStatistics();
+                    continue;
+                }
+                else if (type.compare(L"InterceptNtKeys") == 0)
+                {
+                    EnableNtKeyInterception();
+                    continue;
+                }
+                else if (type.compare(L"ModifyKeyAccess") == 0)
                 {
                     Log("RegLegacyFixups: is ModifyKeyAccess\n");
                     specItem.remeditaionType = Reg_Remediation_Type_ModifyKeyAccess;
@@ -162,30 +215,10 @@ void InitializeConfiguration()
                             Reg_Remediation_Record recordItem;
                             auto& remediationsItemObject = remediationsItem.as_object();
 
-                            auto hiveType = remediationsItemObject.try_get("hive")->as_string().wstring();
-                            Log(L"Hive: %Ls\n", hiveType.data());
-                            if (hiveType.compare(L"HKCU") == 0)
-                            {
-                                recordItem.modifyKeyAccess.hive = Modify_Key_Hive_Type_HKCU;
-                            }
-                            else if (hiveType.compare(L"HKLM") == 0)
-                            {
-                                recordItem.modifyKeyAccess.hive = Modify_Key_Hive_Type_HKLM;
-                            }
-                            else
-                            {
-                                recordItem.modifyKeyAccess.hive = Modify_Key_Hive_Type_Unknown;
-                            }
+                            recordItem.modifyKeyAccess.hive = ParseHive(remediationsItemObject);
                             Log("RegLegacyFixups: have hive\n");
 
-                            for (auto& pattern : remediationsItemObject.get("patterns").as_array())
-                            {
-                                auto patternString = pattern.as_string().wstring();
-                                
-                                Log(L"Pattern: %Ls\n", patternString.data());
-                                recordItem.modifyKeyAccess.patterns.push_back(patternString.data());
-                               
-                            }
+                            ParsePatterns(remediationsItemObject, recordItem.modifyKeyAccess.patterns);
                             Log("RegLegacyFixups: have patterns\n");
 
                             auto accessType = remediationsItemObject.try_get("access")->as_string().wstring();
@@ -222,6 +255,43 @@ void InitializeConfiguration()
                     }
 
                 }
+                else if (type.compare(L"CacheValues") == 0)
+                {
+                    Log("RegLegacyFixups: is CacheValues\n");
+                    specItem.remeditaionType = Reg_Remediation_Type_CacheValues;
+                    if (auto remValue = specObject.try_get("remediation"))
+                    {
+                        for (auto& remediationsItem : remValue->as_array())
+                        {
+                            Reg_Remediation_Record recordItem;
+                            auto& remediationsItemObject = remediationsItem.as_object();
+                            recordItem.cacheValues.hive = ParseHive(remediationsItemObject);
+                            ParsePatterns(remediationsItemObject, recordItem.cacheValues.patterns);
+                            specItem.remediationRecords.push_back(recordItem);
+                        }
+                    }
+                    EnableValueCache();
+                }
+                else if (type.compare(L"CacheMissingKeys") == 0)
+                {
+                    Log("RegLegacyFixups: is CacheMissingKeys\n");
+                    specItem.remeditaionType = Reg_Remediation_Type_CacheMissingKeys;
+                    if (auto remValue = specObject.try_get("remediation"))
+                    {
+                        for (auto& remediationsItem : remValue->as_array())
+                        {
+                            Reg_Remediation_Record recordItem;
+                            auto& remediationsItemObject = remediationsItem.as_object();
+                            recordItem.cacheMissingKeys.hive = ParseHive(remediationsItemObject);
+                            ParsePatterns(remediationsItemObject, recordItem.cacheMissingKeys.patterns);
+                            auto ttl = remediationsItemObject.try_get("ttl");
+                            recordItem.cacheMissingKeys.ttl = ttl ? ttl->as_number().get<std::uint64_t>() : 5000;
+                            Log("RegLegacyFixups: ttl %llu\n", recordItem.cacheMissingKeys.ttl);
+                            specItem.remediationRecords.push_back(recordItem);
+                        }
+                    }
+                    EnableMissingKeyCache();
+                }
                 else
                 {
                     specItem.remeditaionType = Reg_Remediation_Type_Unknown;
@@ -234,6 +304,7 @@ void InitializeConfiguration()
         {
             Log("RegLegacyFixups: Fixup not found in json config.\n");
         }
+        IndexRemediationSpecs();
         Log("RegLegacyFixups End InitializeConfiguration()\n");
     }
 }
\ No newline at end of file
@@ -4,16 +4,22 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 #pragma once
+#include <cstdint>
+#include <string>
 #include <string_view>
 #include <vector>
 
+#include <compiled_pattern.h>
+
 
 using namespace std::literals;
 
 enum  Reg_Remediation_Types
 {
     Reg_Remediation_Type_Unknown = 0,
-    Reg_Remediation_Type_ModifyKeyAccess
+    Reg_Remediation_Type_ModifyKeyAccess,
+    Reg_Remediation_Type_CacheValues,
+    Reg_Remediation_Type_CacheMissingKeys
 };
 
 enum Modify_Key_Access_Types
@@ -32,16 +38,41 @@ enum Modify_Key_Hive_Types
     Modify_Key_Hive_Type_HKCU = 1,
     Modify_Key_Hive_Type_HKLM = 2,
 };
+// Patterns are matched against the part of the key path after the hive, and are compiled when the configuration is
+// read, so that the common literal and literal prefix/suffix patterns never need a regex
+struct Modify_Key_Pattern
+{
+    std::wstring pattern;
+    compiled_pattern matcher;
+};
+
 struct Modify_Key_Access
 {
     Modify_Key_Hive_Types hive;
-    std::vector<std::wstring> patterns;
+    std::vector<Modify_Key_Pattern> patterns;
     Modify_Key_Access_Types access;
 };
 
+// Values of the keys that match are served from memory once read, until the key changes
+struct Cache_Values
+{
+    Modify_Key_Hive_Types hive;
+    std::vector<Modify_Key_Pattern> patterns;
+};
+
+// Failures to open the keys that match are remembered for 'ttl' milliseconds
+struct Cache_Missing_Keys
+{
+    Modify_Key_Hive_Types hive;
+    std::vector<Modify_Key_Pattern> patterns;
+    std::uint64_t ttl = 0;
+};
+
 struct Reg_Remediation_Record
 {
         Modify_Key_Access modifyKeyAccess;
+        Cache_Values cacheValues;
+        Cache_Missing_Keys cacheMissingKeys;
         // for future types
 };
 
@@ -51,4 +82,10 @@ struct Reg_Remediation_Spec
     std::vector<Reg_Remediation_Record> remediationRecords;   
 }; 
 
-extern std::vector<Reg_Remediation_Spec>  g_regRemediationSpecs;
\ No newline at end of file
+extern std::vector<Reg_Remediation_Spec>  g_regRemediationSpecs;
+
+// Builds the index that the ModifyKeyAccess patterns are looked up by, once all of the specs have been read
+void IndexRemediationSpecs();
+
+// Makes the NT key functions, rather than the Win32 ones, decide the access of the keys that are opened
+void EnableNtKeyInterception();
@@ -5,179 +5,294 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 
+#include <interception_id.h>
 #include <psf_framework.h>
 
 #include "FunctionImplementations.h"
 #include "Framework.h"
 #include "Reg_Remediation_Spec.h"
 #include "Logging.h"
+#include "RegistryMissingKeyCache.h"
+#include "RegistryStatistics.h"
+#include "RegistryValueCache.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The full path of the key being opened, i.e. the path of the parent key followed by the sub key. Paths shorter than
+// MAX_PATH - almost all of them - are built in the object itself, so that the common case never touches the heap
+class key_path
+{
+public:
+    key_path() noexcept = default;
+    key_path(const key_path&) = delete;
+    key_path& operator=(const key_path&) = delete;
+
+    void append(std::wstring_view str)
+    {
+        if (!m_onHeap && (m_length + str.length() < std::size(m_buffer)))
+        {
+            std::copy(str.begin(), str.end(), m_buffer + m_length);
+            m_length += str.length();
+            return;
+        }
+
+        if (!m_onHeap)
+        {
+            m_heap.assign(m_buffer, m_length);
+            m_onHeap = true;
+        }
+        m_heap.append(str);
+    }
+
+    template <typename CharT>
+    void append_sub_key(const CharT* subKey)
+    {
+        append(L"\\");
+        if constexpr (psf::is_ansi<CharT>)
+        {
+            // The ANSI registry functions don't reject characters that aren't valid in the code page, they replace them,
+            // so a name that can't be converted exactly is converted the way that they do instead
+            auto wideSubKey = try_widen_argument(subKey, CP_ACP);
+            if (wideSubKey.error == ERROR_SUCCESS)
+            {
+                append(wideSubKey.view());
+            }
+            else
+            {
+                std::string_view name(subKey);
+                std::wstring replaced(name.length(), L'\0');
+                replaced.resize(static_cast<std::size_t>(::MultiByteToWideChar(CP_ACP, 0, name.data(), static_cast<int>(name.length()),
+                    replaced.data(), static_cast<int>(replaced.length()))));
+                append(replaced);
+            }
+        }
+        else if (subKey)
+        {
+            append(subKey);
+        }
+    }
 
-DWORD g_RegIntceptInstance = 0;
+    std::wstring_view view() const noexcept
+    {
+        return m_onHeap ? std::wstring_view(m_heap) : std::wstring_view(m_buffer, m_length);
+    }
 
-REGSAM RegFixupSam(std::string keypath, REGSAM samDesired, DWORD RegLocalInstance)
+private:
+    wchar_t m_buffer[MAX_PATH];
+    std::size_t m_length = 0;
+    std::wstring m_heap;
+    bool m_onHeap = false;
+};
+
+// Appends the path of 'key', as NtQueryKey names it, to 'path'. Returns false, appending nothing, if it can't be queried
+static bool QueryKeyPath(HKEY key, key_path& path)
 {
+    struct
+    {
+        winternl::KEY_NAME_INFORMATION info;
+        wchar_t name[MAX_PATH];
+    } smallName;
+    ULONG size = 0;
+    auto status = impl::NtQueryKey(key, winternl::KeyNameInformation, &smallName, sizeof(smallName), &size);
+    if (NT_SUCCESS(status))
+    {
+        path.append(std::wstring_view(smallName.info.Name, smallName.info.NameLength / sizeof(wchar_t)));
+        return true;
+    }
+    else if ((status == STATUS_BUFFER_TOO_SMALL) || (status == STATUS_BUFFER_OVERFLOW))
+    {
+        auto buffer = std::make_unique<std::uint8_t[]>(size);
+        if (NT_SUCCESS(impl::NtQueryKey(key, winternl::KeyNameInformation, buffer.get(), size, &size)))
+        {
+            auto info = reinterpret_cast<winternl::PKEY_NAME_INFORMATION>(buffer.get());
+            path.append(std::wstring_view(info->Name, info->NameLength / sizeof(wchar_t)));
+            return true;
+        }
+    }
 
-    REGSAM samModified = samDesired;
-    std::string keystring;
+    return false;
+}
 
-    Log("[%d] RegFixupSam: path=%s\n", RegLocalInstance, keypath.c_str());
-    for (auto& spec : g_regRemediationSpecs)
+// The paths of the keys that the fixups below have opened, which are looked up again whenever the app opens a key
+// relative to one of them. Only keys that these fixups returned are remembered, since their lifetime is known: they
+// are dropped again when the app closes them through RegCloseKey. The path is only queried on the first use of a key
+static std::shared_mutex g_keyPathLock;
+static std::unordered_map<HKEY, std::wstring> g_keyPaths;
+
+// Appends the path of 'key' to 'path', the same way that InterpretKeyPath names it
+static void AppendKeyPath(HKEY key, key_path& path)
+{
+    // Predefined keys are never valid handles to NtQueryKey, so they are named the same way InterpretKeyPath names them
+    // when the query fails, without making it
+    if (key == HKEY_LOCAL_MACHINE)
     {
-#ifdef _DEBUG
-        Log("[%d] RegFixupSam: spec.type=%d\n", RegLocalInstance, spec.remeditaionType);
-#endif
-        switch (spec.remeditaionType)
+        path.append(L"HKEY_LOCAL_MACHINE");
+        return;
+    }
+    else if (key == HKEY_CURRENT_USER)
+    {
+        path.append(L"HKEY_CURRENT_USER");
+        return;
+    }
+    else if (key == HKEY_CLASSES_ROOT)
+    {
+        path.append(L"HKEY_CLASSES_ROOT");
+        return;
+    }
+
+    bool remembered = false;
+    {
+        std::shared_lock<std::shared_mutex> lock(g_keyPathLock);
+        if (auto itr = g_keyPaths.find(key); itr != g_keyPaths.end())
         {
-        case Reg_Remediation_Type_ModifyKeyAccess:
-#ifdef _DEBUG
-            Log("[%d] RegFixupSam: is Check ModifyKeyAccess...\n", RegLocalInstance);
-#endif
-            for (auto& rem : spec.remediationRecords)
+            if (!itr->second.empty())
             {
-                switch (rem.modifyKeyAccess.hive)
-                {
-                case Modify_Key_Hive_Type_HKCU:
-                    keystring = "HKEY_CURRENT_USER\\";
-                    if (keypath._Starts_with(keystring))
-                    {
-#ifdef _DEBUG
-                        Log("[%d] RegFixupSam: is HKCU key\n", RegLocalInstance);
-#endif
-                        for (auto& pattern : rem.modifyKeyAccess.patterns)
-                        {
-#ifdef _DEBUG
-                            Log("[%d] RegFixupSam: Check %LS\n", RegLocalInstance, widen(keypath.substr(keystring.size())).c_str());
-                            Log("[%d] RegFixupSam: using %LS\n", RegLocalInstance, pattern.c_str());
-#endif
-                            if (std::regex_match(widen(keypath.substr(keystring.size())), std::wregex(pattern)))
-                            {
+                path.append(itr->second);
+                return;
+            }
+            remembered = true;
+        }
+    }
+
+    auto start = path.view().length();
+    if (QueryKeyPath(key, path) && remembered)
+    {
+        std::unique_lock<std::shared_mutex> lock(g_keyPathLock);
+        if (auto itr = g_keyPaths.find(key); itr != g_keyPaths.end())
+        {
+            itr->second = path.view().substr(start);
+        }
+    }
+}
+
+static void RememberKey(LSTATUS result, PHKEY resultKey) noexcept try
+{
+    if ((result == ERROR_SUCCESS) && resultKey && *resultKey)
+    {
+        std::unique_lock<std::shared_mutex> lock(g_keyPathLock);
+        g_keyPaths[*resultKey].clear();
+    }
+}
+catch (...)
+{
+    // Not remembering the key only means looking up its path again
+}
+
+// The access that a matching ModifyKeyAccess remediation changes 'samDesired' to. The cases of the two hives are kept
+// in the order that they have always been checked in, which matters where one falls through to the next
+static REGSAM ApplyModifyKeyAccess(Modify_Key_Hive_Types hive, Modify_Key_Access_Types access, REGSAM samDesired, DWORD RegLocalInstance)
+{
+    REGSAM samModified = samDesired;
+    if (hive == Modify_Key_Hive_Type_HKCU)
+    {
 #ifdef _DEBUG
-                                Log("[%d] RegFixupSam: is HKCU pattern match.\n", RegLocalInstance);
+        Log("[%d] RegFixupSam: is HKCU pattern match.\n", RegLocalInstance);
 #endif
-                                switch (rem.modifyKeyAccess.access)
-                                {
-                                case Modify_Key_Access_Type_Full2RW:
-                                    if ((samDesired & (KEY_ALL_ACCESS|KEY_CREATE_LINK)) != 0)
-                                    {
-                                        samModified = samDesired & ~(DELETE|KEY_CREATE_LINK);
+        switch (access)
+        {
+        case Modify_Key_Access_Type_Full2RW:
+            if ((samDesired & (KEY_ALL_ACCESS|KEY_CREATE_LINK)) != 0)
+            {
+                samModified = samDesired & ~(DELETE|KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: Full2RW\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2RW\n", RegLocalInstance);
 #endif
-                                    }
-                                    break;
-                                case Modify_Key_Access_Type_Full2MaxAllowed:
-                                    if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
-                                    {
-                                        samModified = MAXIMUM_ALLOWED;
+            }
+            break;
+        case Modify_Key_Access_Type_Full2MaxAllowed:
+            if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = MAXIMUM_ALLOWED;
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: Full2MaxAllowed\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2MaxAllowed\n", RegLocalInstance);
 #endif                                    
-                                    }
-                                case Modify_Key_Access_Type_Full2R:
-                                    if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
-                                    {
-                                        samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
+            }
+        case Modify_Key_Access_Type_Full2R:
+            if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: Full2R\n", RegLocalInstance);  
+                Log("[%d] RegFixupSam: Full2R\n", RegLocalInstance);  
 #endif
-                                    }
-                                case Modify_Key_Access_Type_RW2R:
-                                    if ((samDesired & (KEY_CREATE_LINK|KEY_CREATE_SUB_KEY|KEY_SET_VALUE))  != 0)
-                                    {
-                                        samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
+            }
+        case Modify_Key_Access_Type_RW2R:
+            if ((samDesired & (KEY_CREATE_LINK|KEY_CREATE_SUB_KEY|KEY_SET_VALUE))  != 0)
+            {
+                samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: RW2R\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: RW2R\n", RegLocalInstance);
 #endif
-                                    }
-                                case Modify_Key_Access_Type_RW2MaxAllowed:
-                                    if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE | WRITE_DAC | WRITE_OWNER)) != 0)
-                                    {
-                                        samModified = MAXIMUM_ALLOWED;
+            }
+        case Modify_Key_Access_Type_RW2MaxAllowed:
+            if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE | WRITE_DAC | WRITE_OWNER)) != 0)
+            {
+                samModified = MAXIMUM_ALLOWED;
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: RW2MaxAllowed\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: RW2MaxAllowed\n", RegLocalInstance);
 #endif                                    
-                                    }
-                                default:
-                                    break;
-                                }
-                                return samModified;
-                            }
-                        }
-                    }
-                    break;
-                case Modify_Key_Hive_Type_HKLM:
-                    keystring = "HKEY_LOCAL_MACHINE\\";
-                    if (keypath._Starts_with(keystring))
-                    {
-#ifdef _DEBUG
-                        Log("[%d] RegFixupSam:  is HKLM key\n", RegLocalInstance);
-#endif
-                        for (auto& pattern : rem.modifyKeyAccess.patterns)
-                        {
-                            if (std::regex_match(widen(keypath.substr(keystring.size())), std::wregex(pattern)))
-                            {
+            }
+        default:
+            break;
+        }
+    }
+    else if (hive == Modify_Key_Hive_Type_HKLM)
+    {
 #ifdef _DEBUG
-                                Log("[%d] RegFixupSam: HKLM pattern match.\n", RegLocalInstance);
+        Log("[%d] RegFixupSam: HKLM pattern match.\n", RegLocalInstance);
 #endif
-                                switch (rem.modifyKeyAccess.access)
-                                {
-                                case Modify_Key_Access_Type_Full2RW:
-                                    if ((samDesired & (KEY_ALL_ACCESS | KEY_CREATE_LINK)) != 0)
-                                    {
-                                        samModified = samDesired & ~(DELETE|KEY_CREATE_LINK);
+        switch (access)
+        {
+        case Modify_Key_Access_Type_Full2RW:
+            if ((samDesired & (KEY_ALL_ACCESS | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = samDesired & ~(DELETE|KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: Full2RW\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2RW\n", RegLocalInstance);
 #endif
-                                    }
-                                    break;
-                                case Modify_Key_Access_Type_Full2R:
-                                    if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
-                                    {
-                                        samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
+            }
+            break;
+        case Modify_Key_Access_Type_Full2R:
+            if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: Full2R\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2R\n", RegLocalInstance);
 #endif
-                                    }
-                                case Modify_Key_Access_Type_Full2MaxAllowed:
-                                    if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
-                                    {
-                                        samModified = MAXIMUM_ALLOWED;
+            }
+        case Modify_Key_Access_Type_Full2MaxAllowed:
+            if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = MAXIMUM_ALLOWED;
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: Full2MaxAllowed\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2MaxAllowed\n", RegLocalInstance);
 #endif                                    
-                                    }
-                                case Modify_Key_Access_Type_RW2R:
-                                    if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE)) != 0)
-                                    {
-                                        samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
+            }
+        case Modify_Key_Access_Type_RW2R:
+            if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: RW2R\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: RW2R\n", RegLocalInstance);
 #endif
-                                    }
-                                case Modify_Key_Access_Type_RW2MaxAllowed:
-                                    if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE | WRITE_DAC | WRITE_OWNER)) != 0)
-                                    {
-                                        samModified = MAXIMUM_ALLOWED;
+            }
+        case Modify_Key_Access_Type_RW2MaxAllowed:
+            if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE | WRITE_DAC | WRITE_OWNER)) != 0)
+            {
+                samModified = MAXIMUM_ALLOWED;
 #ifdef _DEBUG
-                                        Log("[%d] RegFixupSam: RW2MaxAllowed\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: RW2MaxAllowed\n", RegLocalInstance);
 #endif                                    
-                                    }
-                                default:
-                                    break;
-                                }
-                                return samModified;
-                            }
-                        }
-                    }
-                    break;
-                case Modify_Key_Hive_Type_Unknown:
-                default:
-                    break;
-                }
             }
-            break;
-        case Reg_Remediation_Type_Unknown:
         default:
             break;
         }
@@ -185,9 +300,231 @@ REGSAM RegFixupSam(std::string keypath, REGSAM samDesired, DWORD RegLocalInstanc
     return samModified;
 }
 
+// Every ModifyKeyAccess pattern, bucketed by hive and, where the pattern can only match paths that start with a literal
+// key name, by that name. A key path is then only checked against the patterns that could match it rather than against
+// every one of them. The order of the patterns in the configuration is kept, since the first one to match still wins
+struct sam_remediation
+{
+    std::size_t order;
+    const Modify_Key_Pattern* pattern;
+    Modify_Key_Access_Types access;
+};
+
+struct sam_remediation_index
+{
+    Modify_Key_Hive_Types hive;
+    std::wstring_view prefix;
+
+    // The keys reference the literals of the patterns, which don't change once the configuration has been read
+    std::unordered_map<std::wstring_view, std::vector<sam_remediation>> byFirstKey;
+    std::vector<sam_remediation> others;
+};
+
+static sam_remediation_index g_samRemediationIndex[] =
+{
+    { Modify_Key_Hive_Type_HKCU, L"HKEY_CURRENT_USER\\"sv },
+    { Modify_Key_Hive_Type_HKLM, L"HKEY_LOCAL_MACHINE\\"sv },
+};
+
+// The name of the first key of every path that 'pattern' matches, if there is only one
+static bool FirstKeyName(const compiled_pattern& pattern, std::wstring_view& name)
+{
+    std::wstring_view literal = pattern.literal;
+    auto pos = literal.find(L'\\');
+    if ((pattern.kind == pattern_kind::literal) || ((pattern.kind == pattern_kind::literal_prefix) && (pos != std::wstring_view::npos)))
+    {
+        name = literal.substr(0, pos);
+        return true;
+    }
+
+    return false;
+}
+
+void IndexRemediationSpecs()
+{
+    std::size_t order = 0;
+    for (auto& spec : g_regRemediationSpecs)
+    {
+        if (spec.remeditaionType != Reg_Remediation_Type_ModifyKeyAccess)
+        {
+            continue;
+        }
+
+        for (auto& rem : spec.remediationRecords)
+        {
+            auto index = std::find_if(std::begin(g_samRemediationIndex), std::end(g_samRemediationIndex), [&](auto& item)
+            {
+                return item.hive == rem.modifyKeyAccess.hive;
+            });
+            if (index == std::end(g_samRemediationIndex))
+            {
+                continue;
+            }
+
+            for (auto& pattern : rem.modifyKeyAccess.patterns)
+            {
+                sam_remediation item{ order++, &pattern, rem.modifyKeyAccess.access };
+                std::wstring_view name;
+                if (FirstKeyName(pattern.matcher, name))
+                {
+                    index->byFirstKey[name].push_back(item);
+                }
+                else
+                {
+                    index->others.push_back(item);
+                }
+            }
+        }
+    }
+}
+
+static REGSAM ComputeFixupSam(std::wstring_view keypath, REGSAM samDesired, DWORD RegLocalInstance)
+{
+#ifdef _DEBUG
+    Log("[%d] RegFixupSam: path=%.*ls\n", RegLocalInstance, static_cast<int>(keypath.length()), keypath.data());
+#endif
+    for (auto& index : g_samRemediationIndex)
+    {
+        if (keypath.substr(0, index.prefix.size()) != index.prefix)
+        {
+            continue;
+        }
+
+        auto subKeypath = keypath.substr(index.prefix.size());
+        static const std::vector<sam_remediation> none;
+        auto itr = index.byFirstKey.find(subKeypath.substr(0, subKeypath.find(L'\\')));
+        auto& keyed = (itr != index.byFirstKey.end()) ? itr->second : none;
+
+        // Both lists are in configuration order, so they are merged to try the patterns in that order
+        auto keyedItr = keyed.begin();
+        auto othersItr = index.others.begin();
+        while ((keyedItr != keyed.end()) || (othersItr != index.others.end()))
+        {
+            auto& item = ((othersItr == index.others.end()) || ((keyedItr != keyed.end()) && (keyedItr->order < othersItr->order))) ?
+                *keyedItr++ : *othersItr++;
+#ifdef _DEBUG
+            Log("[%d] RegFixupSam: Check %.*ls using %LS\n", RegLocalInstance, static_cast<int>(subKeypath.length()), subKeypath.data(), item.pattern->pattern.c_str());
+#endif
+            if (item.pattern->matcher.match(subKeypath))
+            {
+                return ApplyModifyKeyAccess(index.hive, item.access, samDesired, RegLocalInstance);
+            }
+        }
+
+        // The hives don't overlap
+        break;
+    }
+
+    return samDesired;
+}
+
+
+
+// Apps open the same keys with the same access over and over, and the result only depends on the two of them and on the
+// configuration, which never changes. Since patterns are case sensitive, so is the key path. Once full, the cache is
+// simply cleared
+static constexpr std::size_t sam_decision_cache_size = 1024;
+
+// Keys are views so that lookups can be made with the caller's key path as is
+struct sam_decision_key
+{
+    std::wstring_view keypath;
+    REGSAM samDesired;
+
+    bool operator==(const sam_decision_key& other) const noexcept
+    {
+        return (samDesired == other.samDesired) && (keypath == other.keypath);
+    }
+};
+
+struct sam_decision_key_hash
+{
+    std::size_t operator()(const sam_decision_key& key) const noexcept
+    {
+        return std::hash<std::wstring_view>{}(key.keypath) ^ (static_cast<std::size_t>(key.samDesired) * 0x9E3779B9);
+    }
+};
+
+struct sam_decision
+{
+    std::wstring keypath;
+    REGSAM samModified;
+};
+
+static std::shared_mutex g_samDecisionLock;
+static std::unordered_map<sam_decision_key, std::unique_ptr<sam_decision>, sam_decision_key_hash> g_samDecisions;
+static std::atomic<std::uint64_t> g_samDecisionHits{ 0 };
+static std::atomic<std::uint64_t> g_samDecisionMisses{ 0 };
+
+REGSAM RegFixupSam(std::wstring_view keypath, REGSAM samDesired, DWORD RegLocalInstance)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(g_samDecisionLock);
+        if (auto itr = g_samDecisions.find(sam_decision_key{ keypath, samDesired }); itr != g_samDecisions.end())
+        {
+            g_samDecisionHits.fetch_add(1, std::memory_order_relaxed);
+#ifdef _DEBUG
+            Log("[%d] RegFixupSam: cached path=%.*ls\n", RegLocalInstance, static_cast<int>(keypath.length()), keypath.data());
+#endif
+            return itr->second->samModified;
+        }
+    }
+
+    g_samDecisionMisses.fetch_add(1, std::memory_order_relaxed);
+    auto samModified = ComputeFixupSam(keypath, samDesired, RegLocalInstance);
+
+    // NOTE: The key references the string held by the decision, which never moves for the lifetime of the decision
+    auto decision = std::make_unique<sam_decision>(sam_decision{ std::wstring(keypath), samModified });
+    sam_decision_key key{ decision->keypath, samDesired };
+
+    std::unique_lock<std::shared_mutex> lock(g_samDecisionLock);
+    if (g_samDecisions.size() >= sam_decision_cache_size)
+    {
+        g_samDecisions.clear();
+    }
+    g_samDecisions.emplace(key, std::move(decision));
+    return samModified;
+}
+
+// Set by an "InterceptNtKeys" element of the configuration, which makes NtCreateKey, NtOpenKey and NtOpenKeyEx decide
+// the access of every key that is opened, including by native callers and by the Win32 functions that aren't detoured
+static bool g_interceptNtKeys = false;
+
+// The kernel name of the current user's hive, which the Win32 functions open HKEY_CURRENT_USER as
+static std::wstring g_currentUserKeyPath;
+
+void EnableNtKeyInterception()
+{
+    HANDLE token;
+    if (::OpenProcessToken(::GetCurrentProcess(), TOKEN_QUERY, &token))
+    {
+        DWORD size = 0;
+        ::GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+        auto buffer = std::make_unique<std::uint8_t[]>(size);
+        wchar_t* sid = nullptr;
+        if (::GetTokenInformation(token, TokenUser, buffer.get(), size, &size) &&
+            ::ConvertSidToStringSidW(reinterpret_cast<TOKEN_USER*>(buffer.get())->User.Sid, &sid))
+        {
+            g_currentUserKeyPath = L"\\REGISTRY\\USER\\"s + sid;
+            ::LocalFree(sid);
+        }
+        ::CloseHandle(token);
+    }
+
+    g_interceptNtKeys = true;
+    Log("RegLegacyFixups: intercepting NT key functions\n");
+}
+
+void LogSamDecisionCacheStatistics()
+{
+    Log("RegLegacyFixups access decision cache: hits=%llu misses=%llu\n",
+        g_samDecisionHits.load(std::memory_order_relaxed),
+        g_samDecisionMisses.load(std::memory_order_relaxed));
+}
 
 
 auto RegCreateKeyExImpl = psf::detoured_string_function(&::RegCreateKeyExA, &::RegCreateKeyExW);
+static registry_api_statistics g_regCreateKeyExStatistics{ "RegCreateKeyEx" };
 template <typename CharT>
 LSTATUS __stdcall RegCreateKeyExFixup(
     _In_ HKEY key,
@@ -200,19 +537,28 @@ LSTATUS __stdcall RegCreateKeyExFixup(
     _Out_ PHKEY resultKey,
     _Out_opt_ LPDWORD disposition)
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    auto start = RegistryStatisticsTimestamp();
+    DWORD RegLocalInstance = psf::next_interception_id();
 
+#if _DEBUG
     auto entry = LogFunctionEntry();
     Log("[%d] RegCreateKeyEx:\n", RegLocalInstance);
+#endif
 
-
-    std::string keypath = InterpretKeyPath(key) + "\\" + InterpretStringA(subKey);
-    REGSAM samModified = RegFixupSam(keypath, samDesired, RegLocalInstance);
+    key_path keypath;
+    AppendKeyPath(key, keypath);
+    keypath.append_sub_key(subKey);
+    // When the NT functions are intercepted, the access is decided there instead, once per kernel call
+    REGSAM samModified = g_interceptNtKeys ? samDesired : RegFixupSam(keypath.view(), samDesired, RegLocalInstance);
 
     auto result = RegCreateKeyExImpl(key, subKey, reserved, classType, options, samModified, securityAttributes, resultKey, disposition);
-    QueryPerformanceCounter(&TickEnd);
+    if (result == ERROR_SUCCESS)
+    {
+        ForgetMissingKeys();
+    }
+    RememberKey(result, resultKey);
+    CacheKeyValues(result, resultKey, keypath.view(), samModified);
+    RecordRegistryCall(g_regCreateKeyExStatistics, start, samDesired != samModified);
 
 #if _DEBUG
     auto functionResult = from_win32(result);
@@ -255,6 +601,7 @@ DECLARE_STRING_FIXUP(RegCreateKeyExImpl, RegCreateKeyExFixup);
 
 
 auto RegOpenKeyExImpl = psf::detoured_string_function(&::RegOpenKeyExA, &::RegOpenKeyExW);
+static registry_api_statistics g_regOpenKeyExStatistics{ "RegOpenKeyEx" };
 template <typename CharT>
 LSTATUS __stdcall RegOpenKeyExFixup(
     _In_ HKEY key,
@@ -263,20 +610,40 @@ LSTATUS __stdcall RegOpenKeyExFixup(
     _In_ REGSAM samDesired,
     _Out_ PHKEY resultKey)
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    auto start = RegistryStatisticsTimestamp();
+    DWORD RegLocalInstance = psf::next_interception_id();
 
+#if _DEBUG
     auto entry = LogFunctionEntry();
-
     Log("[%d] RegOpenKeyEx:\n", RegLocalInstance);
+#endif
 
+    key_path keypath;
+    AppendKeyPath(key, keypath);
+    keypath.append_sub_key(subKey);
 
-    std::string keypath = InterpretKeyPath(key) + "\\" + InterpretStringA(subKey);
-    REGSAM samModified = RegFixupSam(keypath, samDesired, RegLocalInstance);
+    LSTATUS missingResult;
+    if (LookupMissingKey(keypath.view(), samDesired, missingResult))
+    {
+#if _DEBUG
+        Log("[%d] RegOpenKeyEx: known to fail with %d\n", RegLocalInstance, missingResult);
+#endif
+        if (resultKey)
+        {
+            *resultKey = nullptr;
+        }
+        RecordRegistryCall(g_regOpenKeyExStatistics, start, false);
+        return missingResult;
+    }
+
+    // When the NT functions are intercepted, the access is decided there instead, once per kernel call
+    REGSAM samModified = g_interceptNtKeys ? samDesired : RegFixupSam(keypath.view(), samDesired, RegLocalInstance);
 
     auto result = RegOpenKeyExImpl(key, subKey, options, samModified,  resultKey);
-    QueryPerformanceCounter(&TickEnd);
+    RecordKeyOpen(result, keypath.view(), samDesired);
+    RememberKey(result, resultKey);
+    CacheKeyValues(result, resultKey, keypath.view(), samModified);
+    RecordRegistryCall(g_regOpenKeyExStatistics, start, samDesired != samModified);
 
 #if _DEBUG
     auto functionResult = from_win32(result);
@@ -312,6 +679,7 @@ DECLARE_STRING_FIXUP(RegOpenKeyExImpl, RegOpenKeyExFixup);
 
 
 auto RegOpenKeyTransactedImpl = psf::detoured_string_function(&::RegOpenKeyTransactedA, &::RegOpenKeyTransactedW);
+static registry_api_statistics g_regOpenKeyTransactedStatistics{ "RegOpenKeyTransacted" };
 template <typename CharT>
 LSTATUS __stdcall RegOpenKeyTransactedFixup(
     _In_ HKEY key,
@@ -324,20 +692,23 @@ LSTATUS __stdcall RegOpenKeyTransactedFixup(
 {
 
 
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
-    auto entry = LogFunctionEntry();
+    auto start = RegistryStatisticsTimestamp();
+    DWORD RegLocalInstance = psf::next_interception_id();
 
 #if _DEBUG
+    auto entry = LogFunctionEntry();
     Log("[%d] RegOpenKeyTransacted:\n", RegLocalInstance);
 #endif
 
-    std::string keypath = InterpretKeyPath(key) + "\\" + InterpretStringA(subKey);
-    REGSAM samModified = RegFixupSam(keypath, samDesired, RegLocalInstance);
+    key_path keypath;
+    AppendKeyPath(key, keypath);
+    keypath.append_sub_key(subKey);
+    REGSAM samModified = RegFixupSam(keypath.view(), samDesired, RegLocalInstance);
 
     auto result = RegOpenKeyTransactedImpl(key, subKey, options, samModified, resultKey, hTransaction, pExtendedParameter);
-    QueryPerformanceCounter(&TickEnd);
+    RememberKey(result, resultKey);
+    // Not given to the value cache, since what is read through the transaction may differ from what the key holds
+    RecordRegistryCall(g_regOpenKeyTransactedStatistics, start, samDesired != samModified);
 
 #if _DEBUG
     auto functionResult = from_win32(result);
@@ -371,6 +742,139 @@ LSTATUS __stdcall RegOpenKeyTransactedFixup(
 DECLARE_STRING_FIXUP(RegOpenKeyTransactedImpl, RegOpenKeyTransactedFixup);
 
 
+// Names the key that 'objectAttributes' refers to the way that the Win32 fixups name it, so that the same patterns apply
+static void AppendNtKeyPath(const OBJECT_ATTRIBUTES* objectAttributes, key_path& path)
+{
+    key_path ntPath;
+    if (objectAttributes->RootDirectory)
+    {
+        AppendKeyPath(static_cast<HKEY>(objectAttributes->RootDirectory), ntPath);
+    }
+    if (auto name = objectAttributes->ObjectName; name && name->Length)
+    {
+        if (objectAttributes->RootDirectory)
+        {
+            ntPath.append(L"\\");
+        }
+        ntPath.append(std::wstring_view(name->Buffer, name->Length / sizeof(wchar_t)));
+    }
+
+    // Callers spell the kernel names of the hives in any case
+    auto replacePrefix = [&](std::wstring_view prefix, std::wstring_view win32Name)
+    {
+        auto view = ntPath.view();
+        if (prefix.empty() || (view.length() < prefix.length()) || (_wcsnicmp(view.data(), prefix.data(), prefix.length()) != 0) ||
+            ((view.length() > prefix.length()) && (view[prefix.length()] != L'\\')))
+        {
+            return false;
+        }
+
+        path.append(win32Name);
+        path.append(view.substr(prefix.length()));
+        return true;
+    };
+
+    if (!replacePrefix(L"\\REGISTRY\\MACHINE"sv, L"HKEY_LOCAL_MACHINE"sv) && !replacePrefix(g_currentUserKeyPath, L"HKEY_CURRENT_USER"sv))
+    {
+        path.append(ntPath.view());
+    }
+}
+
+// The decision for each kernel call is made once, however many layers of the Win32 functions it is made through
+static ACCESS_MASK NtFixupAccess(const OBJECT_ATTRIBUTES* objectAttributes, ACCESS_MASK desiredAccess) noexcept try
+{
+    thread_local psf::reentrancy_guard reentrancyGuard;
+    auto guard = reentrancyGuard.enter();
+    if (!guard || !objectAttributes)
+    {
+        return desiredAccess;
+    }
+
+    key_path keypath;
+    AppendNtKeyPath(objectAttributes, keypath);
+    return RegFixupSam(keypath.view(), desiredAccess, psf::next_interception_id());
+}
+catch (...)
+{
+    return desiredAccess;
+}
+
+static registry_api_statistics g_ntCreateKeyStatistics{ "NtCreateKey" };
+NTSTATUS __stdcall NtCreateKeyFixup(
+    _Out_ PHANDLE keyHandle,
+    _In_ ACCESS_MASK desiredAccess,
+    _In_ POBJECT_ATTRIBUTES objectAttributes,
+    _Reserved_ ULONG titleIndex,
+    _In_opt_ PUNICODE_STRING objectClass,
+    _In_ ULONG createOptions,
+    _Out_opt_ PULONG disposition) noexcept
+{
+    if (!g_interceptNtKeys)
+    {
+        return impl::NtCreateKey(keyHandle, desiredAccess, objectAttributes, titleIndex, objectClass, createOptions, disposition);
+    }
+
+    auto start = RegistryStatisticsTimestamp();
+    auto accessModified = NtFixupAccess(objectAttributes, desiredAccess);
+    auto result = impl::NtCreateKey(keyHandle, accessModified, objectAttributes, titleIndex, objectClass, createOptions, disposition);
+    RecordRegistryCall(g_ntCreateKeyStatistics, start, accessModified != desiredAccess);
+    return result;
+}
+DECLARE_FIXUP(impl::NtCreateKey, NtCreateKeyFixup);
+
+static registry_api_statistics g_ntOpenKeyStatistics{ "NtOpenKey" };
+NTSTATUS __stdcall NtOpenKeyFixup(
+    _Out_ PHANDLE keyHandle,
+    _In_ ACCESS_MASK desiredAccess,
+    _In_ POBJECT_ATTRIBUTES objectAttributes) noexcept
+{
+    if (!g_interceptNtKeys)
+    {
+        return impl::NtOpenKey(keyHandle, desiredAccess, objectAttributes);
+    }
+
+    auto start = RegistryStatisticsTimestamp();
+    auto accessModified = NtFixupAccess(objectAttributes, desiredAccess);
+    auto result = impl::NtOpenKey(keyHandle, accessModified, objectAttributes);
+    RecordRegistryCall(g_ntOpenKeyStatistics, start, accessModified != desiredAccess);
+    return result;
+}
+DECLARE_FIXUP(impl::NtOpenKey, NtOpenKeyFixup);
+
+static registry_api_statistics g_ntOpenKeyExStatistics{ "NtOpenKeyEx" };
+NTSTATUS __stdcall NtOpenKeyExFixup(
+    _Out_ PHANDLE keyHandle,
+    _In_ ACCESS_MASK desiredAccess,
+    _In_ POBJECT_ATTRIBUTES objectAttributes,
+    _In_ ULONG openOptions) noexcept
+{
+    if (!g_interceptNtKeys)
+    {
+        return impl::NtOpenKeyEx(keyHandle, desiredAccess, objectAttributes, openOptions);
+    }
+
+    auto start = RegistryStatisticsTimestamp();
+    auto accessModified = NtFixupAccess(objectAttributes, desiredAccess);
+    auto result = impl::NtOpenKeyEx(keyHandle, accessModified, objectAttributes, openOptions);
+    RecordRegistryCall(g_ntOpenKeyExStatistics, start, accessModified != desiredAccess);
+    return result;
+}
+DECLARE_FIXUP(impl::NtOpenKeyEx, NtOpenKeyExFixup);
+
+
+LSTATUS __stdcall RegCloseKeyFixup(_In_ HKEY key) noexcept
+{
+    // Dropped before the handle is closed, since afterwards its value may be handed out again by another thread
+    {
+        std::unique_lock<std::shared_mutex> lock(g_keyPathLock);
+        g_keyPaths.erase(key);
+    }
+    ForgetCachedValues(key);
+    return impl::RegCloseKey(key);
+}
+DECLARE_FIXUP(impl::RegCloseKey, RegCloseKeyFixup);
+
+
 
 
 // Also needed (but we need a Psf detour for apis other than string function pairs):
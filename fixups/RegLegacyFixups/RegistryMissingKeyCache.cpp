@@ -0,0 +1,161 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <psf_framework.h>
+
+#include "Reg_Remediation_Spec.h"
+#include "RegistryMissingKeyCache.h"
+
+// Once full, the cache is simply cleared
+static constexpr std::size_t missing_key_cache_size = 1024;
+
+static bool g_missingKeyCacheEnabled = false;
+
+// Keys are views so that lookups can be made with the caller's key path as is. Since patterns are case sensitive, so is
+// the key path; the same key spelled two ways is just remembered twice
+struct missing_key
+{
+    std::wstring_view keypath;
+    REGSAM samDesired;
+
+    bool operator==(const missing_key& other) const noexcept
+    {
+        return (samDesired == other.samDesired) && (keypath == other.keypath);
+    }
+};
+
+struct missing_key_hash
+{
+    std::size_t operator()(const missing_key& key) const noexcept
+    {
+        return std::hash<std::wstring_view>{}(key.keypath) ^ (static_cast<std::size_t>(key.samDesired) * 0x9E3779B9);
+    }
+};
+
+struct missing_key_result
+{
+    std::wstring keypath;
+    LSTATUS result;
+    ULONGLONG expires; // GetTickCount64
+};
+
+static std::shared_mutex g_missingKeyLock;
+static std::unordered_map<missing_key, std::unique_ptr<missing_key_result>, missing_key_hash> g_missingKeys;
+
+void EnableMissingKeyCache() noexcept
+{
+    g_missingKeyCacheEnabled = true;
+}
+
+// How long failures to open 'keypath' are remembered for, in milliseconds, or zero if the path matches no pattern
+static std::uint64_t MissingKeyTtl(std::wstring_view keypath)
+{
+    for (auto& spec : g_regRemediationSpecs)
+    {
+        if (spec.remeditaionType != Reg_Remediation_Type_CacheMissingKeys)
+        {
+            continue;
+        }
+
+        for (auto& rem : spec.remediationRecords)
+        {
+            std::wstring_view keystring;
+            switch (rem.cacheMissingKeys.hive)
+            {
+            case Modify_Key_Hive_Type_HKCU:
+                keystring = L"HKEY_CURRENT_USER\\"sv;
+                break;
+            case Modify_Key_Hive_Type_HKLM:
+                keystring = L"HKEY_LOCAL_MACHINE\\"sv;
+                break;
+            default:
+                continue;
+            }
+
+            if (keypath.substr(0, keystring.size()) != keystring)
+            {
+                continue;
+            }
+
+            auto subKeypath = keypath.substr(keystring.size());
+            for (auto& pattern : rem.cacheMissingKeys.patterns)
+            {
+                if (pattern.matcher.match(subKeypath))
+                {
+                    return rem.cacheMissingKeys.ttl;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+bool LookupMissingKey(std::wstring_view keypath, REGSAM samDesired, LSTATUS& result) noexcept
+{
+    if (!g_missingKeyCacheEnabled)
+    {
+        return false;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(g_missingKeyLock);
+    auto itr = g_missingKeys.find(missing_key{ keypath, samDesired });
+    if ((itr == g_missingKeys.end()) || (::GetTickCount64() >= itr->second->expires))
+    {
+        // Expired entries are left for the next failure to replace
+        return false;
+    }
+
+    result = itr->second->result;
+    return true;
+}
+
+void RecordKeyOpen(LSTATUS result, std::wstring_view keypath, REGSAM samDesired) noexcept try
+{
+    if (!g_missingKeyCacheEnabled || ((result != ERROR_FILE_NOT_FOUND) && (result != ERROR_ACCESS_DENIED)))
+    {
+        return;
+    }
+
+    auto ttl = MissingKeyTtl(keypath);
+    if (ttl == 0)
+    {
+        return;
+    }
+
+    // NOTE: The key references the string held by the result, which never moves for the lifetime of the result
+    auto entry = std::make_unique<missing_key_result>(missing_key_result{ std::wstring(keypath), result, ::GetTickCount64() + ttl });
+    missing_key key{ entry->keypath, samDesired };
+
+    std::unique_lock<std::shared_mutex> lock(g_missingKeyLock);
+    if (g_missingKeys.size() >= missing_key_cache_size)
+    {
+        g_missingKeys.clear();
+    }
+    g_missingKeys.erase(key);
+    g_missingKeys.emplace(key, std::move(entry));
+}
+catch (...)
+{
+    // Not remembering the failure only means asking the registry again
+}
+
+void ForgetMissingKeys() noexcept
+{
+    if (!g_missingKeyCacheEnabled)
+    {
+        return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(g_missingKeyLock);
+    g_missingKeys.clear();
+}
@@ -0,0 +1,26 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <string_view>
+
+#include <windows.h>
+
+// The CacheMissingKeys remediation. When RegOpenKeyEx fails to open a key whose path matches one of its patterns,
+// because the key doesn't exist or because access to it is denied, the failure is remembered for the remediation's
+// 'ttl'. Until then, opening the same path with the same access fails the same way without going to the registry, or
+// through the ModifyKeyAccess patterns. Keys that this fixup's own RegCreateKeyEx creates forget every remembered
+// failure, since any of them may now be in the way of a key that exists
+
+void EnableMissingKeyCache() noexcept;
+
+// True if opening 'keypath' with 'samDesired' is known to fail, in which case 'result' is set to how
+bool LookupMissingKey(std::wstring_view keypath, REGSAM samDesired, LSTATUS& result) noexcept;
+
+// Called by RegOpenKeyEx once it has tried to open 'keypath' with 'samDesired'; only failures are remembered
+void RecordKeyOpen(LSTATUS result, std::wstring_view keypath, REGSAM samDesired) noexcept;
+
+// Called by RegCreateKeyEx once it has created or opened a key
+void ForgetMissingKeys() noexcept;
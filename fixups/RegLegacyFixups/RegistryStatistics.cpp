@@ -0,0 +1,142 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <Telemetry.h>
+#include <psf_runtime.h>
+
+#include "RegistryStatistics.h"
+
+TRACELOGGING_DECLARE_PROVIDER(g_Log_ETW_ComponentProvider);
+TRACELOGGING_DEFINE_PROVIDER(
+    g_Log_ETW_ComponentProvider,
+    "Microsoft.Windows.PSFRuntime",
+    (0xf7f4e8c4, 0x9981, 0x5221, 0xe6, 0xfb, 0xff, 0x9d, 0xd1, 0xcd, 0xa4, 0xe1),
+    TraceLoggingOptionMicrosoftTelemetry());
+
+void Log(const char* fmt, ...);
+
+namespace
+{
+    bool g_statisticsEnabled = false;
+    std::int64_t g_ticksPerSecond = 1;
+
+    // Constant initialized, so that it is in place before any of the registry_api_statistics instances are constructed
+    registry_api_statistics* g_apiStatistics = nullptr;
+
+    // Published regardless of whether statistics are collected
+    psf::metric_counter g_remediationsMetric("RegLegacyFixups.remediations");
+}
+
+void latency_histogram::record(std::uint64_t microseconds) noexcept
+{
+    std::size_t bucket = 0;
+    while ((microseconds != 0) && (bucket < latency_histogram_buckets - 1))
+    {
+        microseconds >>= 1;
+        ++bucket;
+    }
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+registry_api_statistics::registry_api_statistics(const char* apiName) noexcept :
+    name(apiName),
+    next(g_apiStatistics)
+{
+    // Only ever called during static initialization, which the loader lock serializes
+    g_apiStatistics = this;
+}
+
+void EnableRegistryStatistics() noexcept
+{
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    g_ticksPerSecond = frequency.QuadPart;
+    g_statisticsEnabled = true;
+    Log("RegLegacyFixups: statistics enabled\n");
+}
+
+std::int64_t RegistryStatisticsTimestamp() noexcept
+{
+    if (!g_statisticsEnabled)
+    {
+        return 0;
+    }
+
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+void RecordRegistryCall(registry_api_statistics& statistics, std::int64_t start, bool modified) noexcept
+{
+    if (modified)
+    {
+        g_remediationsMetric.increment();
+    }
+
+    if (start == 0)
+    {
+        return;
+    }
+
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+
+    statistics.calls.fetch_add(1, std::memory_order_relaxed);
+    if (modified)
+    {
+        statistics.modified.fetch_add(1, std::memory_order_relaxed);
+    }
+    statistics.latency.record(static_cast<std::uint64_t>(now.QuadPart - start) * 1'000'000 / g_ticksPerSecond);
+}
+
+void LogRegistryStatistics()
+{
+    if (!g_statisticsEnabled)
+    {
+        return;
+    }
+
+    TraceLoggingRegister(g_Log_ETW_ComponentProvider);
+    for (auto statistics = g_apiStatistics; statistics; statistics = statistics->next)
+    {
+        auto calls = statistics->calls.load(std::memory_order_relaxed);
+        if (calls == 0)
+        {
+            continue;
+        }
+
+        std::uint64_t latency[latency_histogram_buckets];
+        char latencyText[latency_histogram_buckets * 21 + 1] = {};
+        std::size_t length = 0;
+        for (std::size_t i = 0; i < latency_histogram_buckets; ++i)
+        {
+            latency[i] = statistics->latency.buckets[i].load(std::memory_order_relaxed);
+            auto written = std::snprintf(latencyText + length, std::size(latencyText) - length, " %llu", latency[i]);
+            length = std::min(length + static_cast<std::size_t>(std::max(written, 0)), std::size(latencyText) - 1);
+        }
+
+        auto modified = statistics->modified.load(std::memory_order_relaxed);
+        Log("RegLegacyFixups %s: calls=%llu modified=%llu latency (log2 us):%s\n", statistics->name, calls, modified, latencyText);
+
+        TraceLoggingWrite(
+            g_Log_ETW_ComponentProvider,
+            "RegLegacyFixupsStatistics",
+            TraceLoggingString(statistics->name, "Api"),
+            TraceLoggingUInt64(calls, "Calls"),
+            TraceLoggingUInt64(modified, "Modified"),
+            TraceLoggingUInt64FixedArray(latency, latency_histogram_buckets, "LatencyHistogram"),
+            TraceLoggingBoolean(TRUE, "UTCReplace_AppSessionGuid"),
+            TelemetryPrivacyDataTag(PDT_ProductAndServicePerformance),
+            TraceLoggingKeyword(MICROSOFT_KEYWORD_CRITICAL_DATA));
+    }
+    TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
+}
@@ -0,0 +1,52 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Optional instrumentation, enabled by a "Statistics" entry in the fixup's configuration. When enabled, each detoured
+// API counts its calls and how long they take, in relaxed atomics, so that collecting never takes a lock or formats a
+// string. When disabled, the only cost of a call is a flag check. The totals are written to the log, and to the ETW
+// provider, when the fixup is uninitialized.
+
+// Latencies are bucketed by powers of two of microseconds; the first bucket holds everything under a microsecond and
+// the last one everything from 2^(latency_histogram_buckets - 2) microseconds up
+constexpr std::size_t latency_histogram_buckets = 16;
+
+struct latency_histogram
+{
+    std::atomic<std::uint64_t> buckets[latency_histogram_buckets] = {};
+
+    void record(std::uint64_t microseconds) noexcept;
+};
+
+// One per detoured API, each defined at namespace scope next to its fixup. Instances register themselves on construction
+// so that they can all be reported on, and must therefore have static storage duration
+struct registry_api_statistics
+{
+    explicit registry_api_statistics(const char* apiName) noexcept;
+
+    registry_api_statistics(const registry_api_statistics&) = delete;
+    registry_api_statistics& operator=(const registry_api_statistics&) = delete;
+
+    const char* name;
+    registry_api_statistics* next;
+
+    std::atomic<std::uint64_t> calls{ 0 };
+    std::atomic<std::uint64_t> modified{ 0 }; // Calls whose requested access was changed
+    latency_histogram latency;
+};
+
+void EnableRegistryStatistics() noexcept;
+
+// Returns the start time of a call, or zero if statistics aren't being collected
+std::int64_t RegistryStatisticsTimestamp() noexcept;
+
+// 'start' is the value returned by RegistryStatisticsTimestamp
+void RecordRegistryCall(registry_api_statistics& statistics, std::int64_t start, bool modified) noexcept;
+
+void LogRegistryStatistics();
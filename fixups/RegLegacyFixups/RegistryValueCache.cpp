@@ -0,0 +1,759 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <psf_framework.h>
+
+#include "FunctionImplementations.h"
+#include "Reg_Remediation_Spec.h"
+#include "RegistryValueCache.h"
+
+// Larger values are always read from the registry, which bounds how much memory a key's cache can hold
+static constexpr DWORD max_cached_value_size = 4096;
+
+// Once a key has this many values cached, or this many keys are cached, they are simply cleared
+static constexpr std::size_t value_cache_size = 256;
+static constexpr std::size_t key_cache_size = 64;
+
+// Keys with this many sub keys or values, or more, are always enumerated through the registry
+static constexpr std::size_t max_enumerated_names = 4096;
+
+static bool g_valueCacheEnabled = false;
+
+struct cached_value
+{
+    std::wstring name;
+    LSTATUS result; // Either ERROR_SUCCESS or ERROR_FILE_NOT_FOUND, since apps poll for values that don't exist yet too
+    DWORD type;
+    std::vector<BYTE> data;
+};
+
+// A value as RegEnumValueW lists it, when asked for nothing but its name and type
+struct enumerated_value
+{
+    std::wstring name;
+    DWORD type;
+};
+
+static void CALLBACK OnKeyChanged(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WAIT, TP_WAIT_RESULT) noexcept;
+
+// The cached values of one key path, shared by all of the handles that the app has open to it
+struct cached_key
+{
+    cached_key() noexcept = default;
+    cached_key(const cached_key&) = delete;
+    cached_key& operator=(const cached_key&) = delete;
+
+    ~cached_key()
+    {
+        if (wait)
+        {
+            ::SetThreadpoolWait(wait, nullptr, nullptr);
+            ::WaitForThreadpoolWaitCallbacks(wait, TRUE);
+            ::CloseThreadpoolWait(wait);
+        }
+
+        if (changed)
+        {
+            ::CloseHandle(changed);
+        }
+
+        if (key)
+        {
+            impl::RegCloseKey(key);
+        }
+    }
+
+    // Registrations only last until the first change, so this is made again before values are read after each one
+    bool watch() noexcept
+    {
+        // Sub keys being added or removed are a change too, since the names of the sub keys are cached as well
+        if (::RegNotifyChangeKeyValue(key, FALSE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_THREAD_AGNOSTIC, changed, TRUE) != ERROR_SUCCESS)
+        {
+            return false;
+        }
+
+        ::SetThreadpoolWait(wait, changed, nullptr);
+        return true;
+    }
+
+    std::wstring keypath;
+    REGSAM view = 0; // The KEY_WOW64_* flags of the app's handle, since they change which key the path names
+
+    // The fixup's own handle to the key, duplicated from the app's first one, so that the key stays watched for as long
+    // as anything about it is cached
+    HKEY key = nullptr;
+    HANDLE changed = nullptr;
+    PTP_WAIT wait = nullptr;
+
+    // Incremented by the thread pool whenever the registry signals a change. Values are only valid for the generation
+    // that they were read in
+    std::atomic<std::uint32_t> generation{ 0 };
+
+    std::shared_mutex lock;
+    std::uint32_t valuesGeneration = 0;
+
+    // Value names are case insensitive, but are looked up as the app spells them; the same value spelled two ways is
+    // just cached twice. The keys reference the names held by the values, which never move
+    std::unordered_map<std::wstring_view, std::unique_ptr<cached_value>> values;
+
+    // All of the sub keys and values of the key, in the order that the registry enumerates them, once an enumeration
+    // of the key has read them. Valid for the same generation as the values
+    bool hasSubKeys = false;
+    std::vector<std::wstring> subKeys;
+    bool hasValueNames = false;
+    std::vector<enumerated_value> valueNames;
+};
+
+static void CALLBACK OnKeyChanged(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WAIT, TP_WAIT_RESULT) noexcept
+{
+    static_cast<cached_key*>(context)->generation.fetch_add(1, std::memory_order_release);
+}
+
+struct cached_key_path
+{
+    std::wstring_view keypath;
+    REGSAM view;
+
+    bool operator==(const cached_key_path& other) const noexcept
+    {
+        return (view == other.view) && (keypath == other.keypath);
+    }
+};
+
+struct cached_key_path_hash
+{
+    std::size_t operator()(const cached_key_path& key) const noexcept
+    {
+        return std::hash<std::wstring_view>{}(key.keypath) ^ static_cast<std::size_t>(key.view);
+    }
+};
+
+// Cached keys by path, and by the handles that the app has open to them. Neither map is ever destroyed, since tearing
+// down thread pool waits while the process exits isn't safe
+static std::shared_mutex g_cachedKeyLock;
+static auto& g_cachedKeyPaths = *new std::unordered_map<cached_key_path, std::shared_ptr<cached_key>, cached_key_path_hash>();
+static auto& g_cachedKeyHandles = *new std::unordered_map<HKEY, std::shared_ptr<cached_key>>();
+
+void EnableValueCache() noexcept
+{
+    g_valueCacheEnabled = true;
+}
+
+static bool MatchesCacheValues(std::wstring_view keypath)
+{
+    for (auto& spec : g_regRemediationSpecs)
+    {
+        if (spec.remeditaionType != Reg_Remediation_Type_CacheValues)
+        {
+            continue;
+        }
+
+        for (auto& rem : spec.remediationRecords)
+        {
+            std::wstring_view keystring;
+            switch (rem.cacheValues.hive)
+            {
+            case Modify_Key_Hive_Type_HKCU:
+                keystring = L"HKEY_CURRENT_USER\\"sv;
+                break;
+            case Modify_Key_Hive_Type_HKLM:
+                keystring = L"HKEY_LOCAL_MACHINE\\"sv;
+                break;
+            default:
+                continue;
+            }
+
+            if (keypath.substr(0, keystring.size()) != keystring)
+            {
+                continue;
+            }
+
+            auto subKeypath = keypath.substr(keystring.size());
+            for (auto& pattern : rem.cacheValues.patterns)
+            {
+                if (pattern.matcher.match(subKeypath))
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+static std::shared_ptr<cached_key> WatchKey(HKEY key, std::wstring_view keypath, REGSAM view)
+{
+    auto result = std::make_shared<cached_key>();
+    result->keypath = keypath;
+    result->view = view;
+
+    HANDLE duplicate;
+    auto process = ::GetCurrentProcess();
+    if (!::DuplicateHandle(process, key, process, &duplicate, KEY_NOTIFY, FALSE, 0))
+    {
+        return nullptr;
+    }
+    result->key = static_cast<HKEY>(duplicate);
+
+    result->changed = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    result->wait = ::CreateThreadpoolWait(OnKeyChanged, result.get(), nullptr);
+    if (!result->changed || !result->wait || !result->watch())
+    {
+        return nullptr;
+    }
+
+    return result;
+}
+
+void CacheKeyValues(LSTATUS result, PHKEY resultKey, std::wstring_view keypath, REGSAM samModified) noexcept try
+{
+    // Values read through one handle must not be handed to another that isn't allowed to read them
+    if (!g_valueCacheEnabled || (result != ERROR_SUCCESS) || !resultKey || !*resultKey || ((samModified & KEY_QUERY_VALUE) == 0))
+    {
+        return;
+    }
+
+    auto view = samModified & KEY_WOW64_RES;
+    std::shared_ptr<cached_key> cached;
+    {
+        std::shared_lock<std::shared_mutex> lock(g_cachedKeyLock);
+        if (auto itr = g_cachedKeyPaths.find(cached_key_path{ keypath, view }); itr != g_cachedKeyPaths.end())
+        {
+            cached = itr->second;
+        }
+    }
+
+    std::shared_ptr<cached_key> watched;
+    if (!cached)
+    {
+        if (!MatchesCacheValues(keypath))
+        {
+            return;
+        }
+
+        watched = WatchKey(*resultKey, keypath, view);
+        if (!watched)
+        {
+            return;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(g_cachedKeyLock);
+    if (watched)
+    {
+        if (g_cachedKeyPaths.size() >= key_cache_size)
+        {
+            g_cachedKeyPaths.clear();
+        }
+
+        // Another thread may have cached the same path in the meantime, in which case its key is used instead
+        auto [itr, inserted] = g_cachedKeyPaths.emplace(cached_key_path{ watched->keypath, view }, watched);
+        cached = itr->second;
+    }
+    g_cachedKeyHandles[*resultKey] = std::move(cached);
+}
+catch (...)
+{
+    // Not caching the key only means reading its values from the registry
+}
+
+void ForgetCachedValues(HKEY key) noexcept
+{
+    if (!g_valueCacheEnabled)
+    {
+        return;
+    }
+
+    // Released after the lock, since the last reference to a key waits for its thread pool callbacks
+    std::shared_ptr<cached_key> cached;
+    std::unique_lock<std::shared_mutex> lock(g_cachedKeyLock);
+    if (auto itr = g_cachedKeyHandles.find(key); itr != g_cachedKeyHandles.end())
+    {
+        cached = std::move(itr->second);
+        g_cachedKeyHandles.erase(itr);
+    }
+}
+
+static std::shared_ptr<cached_key> FindCachedKey(HKEY key)
+{
+    std::shared_lock<std::shared_mutex> lock(g_cachedKeyLock);
+    auto itr = g_cachedKeyHandles.find(key);
+    return (itr != g_cachedKeyHandles.end()) ? itr->second : nullptr;
+}
+
+// Drops whatever was cached for an earlier generation of the key. Must be called with the key's lock held exclusively
+static bool CatchUp(cached_key& cached) noexcept
+{
+    auto current = cached.generation.load(std::memory_order_acquire);
+    if (cached.valuesGeneration != current)
+    {
+        // The change consumed the registration, so the key is watched again before anything is read from it
+        if (!cached.watch())
+        {
+            return false;
+        }
+
+        cached.values.clear();
+        cached.hasSubKeys = false;
+        cached.subKeys.clear();
+        cached.hasValueNames = false;
+        cached.valueNames.clear();
+        cached.valuesGeneration = current;
+    }
+
+    return true;
+}
+
+// Calls 'serve' with the value named 'valueName' of 'key', reading it from the registry first if it isn't cached yet.
+// Returns false, without calling 'serve', if the value can't be cached, in which case the caller reads it itself
+template <typename ServeFunc>
+static bool WithCachedValue(HKEY key, const wchar_t* valueName, ServeFunc&& serve)
+{
+    auto cached = FindCachedKey(key);
+    if (!cached)
+    {
+        return false;
+    }
+
+    std::wstring_view name = valueName ? valueName : L"";
+    std::uint32_t generation;
+    bool changed;
+    {
+        std::shared_lock<std::shared_mutex> lock(cached->lock);
+        generation = cached->valuesGeneration;
+        changed = (generation != cached->generation.load(std::memory_order_acquire));
+        if (!changed)
+        {
+            if (auto itr = cached->values.find(name); itr != cached->values.end())
+            {
+                serve(*itr->second);
+                return true;
+            }
+        }
+    }
+
+    if (changed)
+    {
+        std::unique_lock<std::shared_mutex> lock(cached->lock);
+        if (!CatchUp(*cached))
+        {
+            return false;
+        }
+        generation = cached->valuesGeneration;
+    }
+
+    auto value = std::make_unique<cached_value>();
+    value->name = name;
+
+    BYTE buffer[max_cached_value_size];
+    DWORD size = sizeof(buffer);
+    value->result = impl::RegQueryValueExW(key, valueName, nullptr, &value->type, buffer, &size);
+    if (value->result == ERROR_FILE_NOT_FOUND)
+    {
+        value->type = REG_NONE;
+    }
+    else if (value->result == ERROR_SUCCESS)
+    {
+        value->data.assign(buffer, buffer + size);
+    }
+    else
+    {
+        // Including values that are too large to cache
+        return false;
+    }
+    serve(*value);
+
+    // A value that was read before a change that has since been seen may be stale, so it is only kept if there was none
+    std::unique_lock<std::shared_mutex> lock(cached->lock);
+    if (cached->valuesGeneration == generation)
+    {
+        if (cached->values.size() >= value_cache_size)
+        {
+            cached->values.clear();
+        }
+
+        std::wstring_view valueKey = value->name;
+        cached->values.emplace(valueKey, std::move(value));
+    }
+    return true;
+}
+
+// Copies a cached value the same way that RegQueryValueExW copies what it reads
+static LSTATUS QueryCachedValue(const cached_value& value, LPDWORD type, LPBYTE data, LPDWORD dataSize) noexcept
+{
+    if (value.result != ERROR_SUCCESS)
+    {
+        return value.result;
+    }
+
+    if (type)
+    {
+        *type = value.type;
+    }
+
+    auto size = static_cast<DWORD>(value.data.size());
+    if (!dataSize)
+    {
+        return ERROR_SUCCESS;
+    }
+
+    if (data)
+    {
+        if (*dataSize < size)
+        {
+            *dataSize = size;
+            return ERROR_MORE_DATA;
+        }
+
+        std::memcpy(data, value.data.data(), size);
+    }
+
+    *dataSize = size;
+    return ERROR_SUCCESS;
+}
+
+// RegGetValueW checks the type of what it reads against 'flags', and may expand or terminate strings. Only the values for
+// which none of that changes anything are served from the cache
+static bool CanGetCachedValue(const cached_value& value, DWORD flags) noexcept
+{
+    if ((flags & RRF_RT_ANY) == 0)
+    {
+        return false;
+    }
+    else if (value.result != ERROR_SUCCESS)
+    {
+        return true;
+    }
+
+    auto size = value.data.size();
+    auto terminated = [&](std::size_t count)
+    {
+        if ((size % sizeof(wchar_t) != 0) || (size < count * sizeof(wchar_t)))
+        {
+            return false;
+        }
+
+        auto text = reinterpret_cast<const wchar_t*>(value.data.data());
+        auto length = size / sizeof(wchar_t);
+        for (std::size_t i = length - count; i < length; ++i)
+        {
+            if (text[i] != L'\0')
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    switch (value.type)
+    {
+    case REG_SZ:
+        return ((flags & RRF_RT_REG_SZ) != 0) && terminated(1);
+    case REG_EXPAND_SZ:
+        return ((flags & RRF_RT_REG_EXPAND_SZ) != 0) && ((flags & RRF_NOEXPAND) != 0) && terminated(1);
+    case REG_MULTI_SZ:
+        return ((flags & RRF_RT_REG_MULTI_SZ) != 0) && terminated(2);
+    case REG_DWORD:
+        return ((flags & RRF_RT_REG_DWORD) != 0) && (size == sizeof(DWORD));
+    case REG_QWORD:
+        return ((flags & RRF_RT_REG_QWORD) != 0) && (size == sizeof(ULONGLONG));
+    default:
+        // E.g. RRF_RT_DWORD also accepts four byte REG_BINARY values, so restricted reads of anything else are left alone
+        return (flags & RRF_RT_ANY) == RRF_RT_ANY;
+    }
+}
+
+LSTATUS __stdcall RegQueryValueExFixup(
+    _In_ HKEY key,
+    _In_opt_ LPCWSTR valueName,
+    _Reserved_ LPDWORD reserved,
+    _Out_opt_ LPDWORD type,
+    _Out_opt_ LPBYTE data,
+    _Inout_opt_ LPDWORD dataSize) noexcept try
+{
+    auto guard = g_reentrancyGuard.enter();
+    if (guard && g_valueCacheEnabled && !reserved && (!data || dataSize))
+    {
+        LSTATUS result = ERROR_SUCCESS;
+        if (WithCachedValue(key, valueName, [&](const cached_value& value)
+        {
+            result = QueryCachedValue(value, type, data, dataSize);
+        }))
+        {
+            return result;
+        }
+    }
+
+    return impl::RegQueryValueExW(key, valueName, reserved, type, data, dataSize);
+}
+catch (...)
+{
+    return impl::RegQueryValueExW(key, valueName, reserved, type, data, dataSize);
+}
+DECLARE_FIXUP(impl::RegQueryValueExW, RegQueryValueExFixup);
+
+LSTATUS __stdcall RegGetValueFixup(
+    _In_ HKEY key,
+    _In_opt_ LPCWSTR subKey,
+    _In_opt_ LPCWSTR valueName,
+    _In_ DWORD flags,
+    _Out_opt_ LPDWORD type,
+    _Out_opt_ PVOID data,
+    _Inout_opt_ LPDWORD dataSize) noexcept try
+{
+    // RegGetValueW reads through RegQueryValueExW, which then must not cache the value a second time
+    auto guard = g_reentrancyGuard.enter();
+
+    // Values of sub keys, and reads that zero the output on failure, are left to the registry
+    if (guard && g_valueCacheEnabled && (!subKey || !*subKey) && (!data || dataSize) &&
+        ((flags & (RRF_ZEROONFAILURE | RRF_SUBKEY_WOW6464KEY | RRF_SUBKEY_WOW6432KEY)) == 0))
+    {
+        LSTATUS result = ERROR_SUCCESS;
+        bool served = false;
+        WithCachedValue(key, valueName, [&](const cached_value& value)
+        {
+            if (CanGetCachedValue(value, flags))
+            {
+                result = QueryCachedValue(value, type, static_cast<LPBYTE>(data), dataSize);
+                served = true;
+            }
+        });
+
+        if (served)
+        {
+            return result;
+        }
+    }
+
+    return impl::RegGetValueW(key, subKey, valueName, flags, type, data, dataSize);
+}
+catch (...)
+{
+    return impl::RegGetValueW(key, subKey, valueName, flags, type, data, dataSize);
+}
+DECLARE_FIXUP(impl::RegGetValueW, RegGetValueFixup);
+
+// Copies a name the same way that RegEnumKeyExW and RegEnumValueW copy what they enumerate
+static LSTATUS CopyEnumeratedName(std::wstring_view name, LPWSTR buffer, LPDWORD length) noexcept
+{
+    if (name.length() >= *length)
+    {
+        return ERROR_MORE_DATA;
+    }
+
+    std::copy(name.begin(), name.end(), buffer);
+    buffer[name.length()] = L'\0';
+    *length = static_cast<DWORD>(name.length());
+    return ERROR_SUCCESS;
+}
+
+// Enumerations of the keys that are cached are served from a snapshot of the names of all of the key's sub keys, or
+// values, that was taken by an enumeration before. Index zero is always read from the registry, which checks that the
+// handle may enumerate the key at all, and takes the snapshot if there is none for the current generation of the key.
+// The indexes after it are then served from memory, until the key changes. A key that the app enumerates once costs
+// the same as without the snapshot; each of its enumerations after that costs a single call to the registry.
+//
+// 'readAll' fills a vector of names by enumerating the key itself, returning false if that can't be done. 'copy' serves
+// an index from the snapshot
+template <typename Entry, typename ReadFunc, typename CopyFunc>
+static bool EnumerateFromSnapshot(
+    HKEY key,
+    DWORD index,
+    bool cached_key::* hasSnapshot,
+    std::vector<Entry> cached_key::* snapshot,
+    LSTATUS firstResult,
+    ReadFunc&& readAll,
+    CopyFunc&& copy,
+    LSTATUS& result)
+{
+    auto cached = FindCachedKey(key);
+    if (!cached)
+    {
+        return false;
+    }
+
+    if (index != 0)
+    {
+        std::shared_lock<std::shared_mutex> lock(cached->lock);
+        if (!((*cached).*hasSnapshot) || (cached->valuesGeneration != cached->generation.load(std::memory_order_acquire)))
+        {
+            return false;
+        }
+
+        auto& entries = (*cached).*snapshot;
+        result = (index < entries.size()) ? copy(entries[index]) : ERROR_NO_MORE_ITEMS;
+        return true;
+    }
+
+    // Index zero was already read, by the caller
+    result = firstResult;
+    std::uint32_t generation;
+    {
+        std::unique_lock<std::shared_mutex> lock(cached->lock);
+        if ((firstResult != ERROR_SUCCESS) || !CatchUp(*cached) || ((*cached).*hasSnapshot))
+        {
+            return true;
+        }
+        generation = cached->valuesGeneration;
+    }
+
+    std::vector<Entry> entries;
+    if (!readAll(entries))
+    {
+        return true;
+    }
+
+    // Names that were read before a change that has since been seen may be stale, so they are only kept if there was none
+    std::unique_lock<std::shared_mutex> lock(cached->lock);
+    if ((cached->valuesGeneration == generation) && (cached->generation.load(std::memory_order_acquire) == generation))
+    {
+        (*cached).*snapshot = std::move(entries);
+        (*cached).*hasSnapshot = true;
+    }
+    return true;
+}
+
+LSTATUS __stdcall RegEnumKeyExFixup(
+    _In_ HKEY key,
+    _In_ DWORD index,
+    _Out_ LPWSTR name,
+    _Inout_ LPDWORD nameLength,
+    _Reserved_ LPDWORD reserved,
+    _Out_opt_ LPWSTR className,
+    _Inout_opt_ LPDWORD classNameLength,
+    _Out_opt_ PFILETIME lastWriteTime) noexcept try
+{
+    // Only the names of the sub keys are kept, so enumerations that ask for more always go to the registry
+    auto guard = g_reentrancyGuard.enter();
+    if (!guard || !g_valueCacheEnabled || reserved || className || classNameLength || lastWriteTime || !name || !nameLength)
+    {
+        return impl::RegEnumKeyExW(key, index, name, nameLength, reserved, className, classNameLength, lastWriteTime);
+    }
+
+    LSTATUS firstResult = ERROR_SUCCESS;
+    if (index == 0)
+    {
+        firstResult = impl::RegEnumKeyExW(key, index, name, nameLength, nullptr, nullptr, nullptr, nullptr);
+    }
+
+    LSTATUS result = ERROR_SUCCESS;
+    auto readAll = [&](std::vector<std::wstring>& entries)
+    {
+        // Key names are at most 255 characters long
+        wchar_t buffer[256];
+        for (DWORD i = 0; entries.size() < max_enumerated_names; ++i)
+        {
+            DWORD length = static_cast<DWORD>(std::size(buffer));
+            auto status = impl::RegEnumKeyExW(key, i, buffer, &length, nullptr, nullptr, nullptr, nullptr);
+            if (status == ERROR_NO_MORE_ITEMS)
+            {
+                return true;
+            }
+            else if (status != ERROR_SUCCESS)
+            {
+                return false;
+            }
+            entries.emplace_back(buffer, length);
+        }
+        return false;
+    };
+    auto copy = [&](const std::wstring& entry)
+    {
+        return CopyEnumeratedName(entry, name, nameLength);
+    };
+
+    if (EnumerateFromSnapshot(key, index, &cached_key::hasSubKeys, &cached_key::subKeys, firstResult, readAll, copy, result))
+    {
+        return result;
+    }
+
+    return (index == 0) ? firstResult : impl::RegEnumKeyExW(key, index, name, nameLength, reserved, className, classNameLength, lastWriteTime);
+}
+catch (...)
+{
+    return impl::RegEnumKeyExW(key, index, name, nameLength, reserved, className, classNameLength, lastWriteTime);
+}
+DECLARE_FIXUP(impl::RegEnumKeyExW, RegEnumKeyExFixup);
+
+LSTATUS __stdcall RegEnumValueFixup(
+    _In_ HKEY key,
+    _In_ DWORD index,
+    _Out_ LPWSTR valueName,
+    _Inout_ LPDWORD valueNameLength,
+    _Reserved_ LPDWORD reserved,
+    _Out_opt_ LPDWORD type,
+    _Out_opt_ LPBYTE data,
+    _Inout_opt_ LPDWORD dataSize) noexcept try
+{
+    // Only the names and types of the values are kept, so enumerations that ask for their data always go to the registry
+    auto guard = g_reentrancyGuard.enter();
+    if (!guard || !g_valueCacheEnabled || reserved || data || dataSize || !valueName || !valueNameLength)
+    {
+        return impl::RegEnumValueW(key, index, valueName, valueNameLength, reserved, type, data, dataSize);
+    }
+
+    LSTATUS firstResult = ERROR_SUCCESS;
+    if (index == 0)
+    {
+        firstResult = impl::RegEnumValueW(key, index, valueName, valueNameLength, nullptr, type, nullptr, nullptr);
+    }
+
+    LSTATUS result = ERROR_SUCCESS;
+    auto readAll = [&](std::vector<enumerated_value>& entries)
+    {
+        // Value names are at most 16383 characters long
+        std::vector<wchar_t> buffer(16384);
+        for (DWORD i = 0; entries.size() < max_enumerated_names; ++i)
+        {
+            DWORD length = static_cast<DWORD>(buffer.size());
+            DWORD valueType = REG_NONE;
+            auto status = impl::RegEnumValueW(key, i, buffer.data(), &length, nullptr, &valueType, nullptr, nullptr);
+            if (status == ERROR_NO_MORE_ITEMS)
+            {
+                return true;
+            }
+            else if (status != ERROR_SUCCESS)
+            {
+                return false;
+            }
+            entries.push_back(enumerated_value{ std::wstring(buffer.data(), length), valueType });
+        }
+        return false;
+    };
+    auto copy = [&](const enumerated_value& entry)
+    {
+        auto status = CopyEnumeratedName(entry.name, valueName, valueNameLength);
+        if ((status == ERROR_SUCCESS) && type)
+        {
+            *type = entry.type;
+        }
+        return status;
+    };
+
+    if (EnumerateFromSnapshot(key, index, &cached_key::hasValueNames, &cached_key::valueNames, firstResult, readAll, copy, result))
+    {
+        return result;
+    }
+
+    return (index == 0) ? firstResult : impl::RegEnumValueW(key, index, valueName, valueNameLength, reserved, type, data, dataSize);
+}
+catch (...)
+{
+    return impl::RegEnumValueW(key, index, valueName, valueNameLength, reserved, type, data, dataSize);
+}
+DECLARE_FIXUP(impl::RegEnumValueW, RegEnumValueFixup);
@@ -0,0 +1,24 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <string_view>
+
+#include <windows.h>
+
+// The CacheValues remediation. Values of the keys whose path matches one of its patterns are read from the registry the
+// first time that the app asks for them, and are then served from memory by RegQueryValueExW and RegGetValueW until the
+// registry signals that something changed the key. What is cached belongs to the key path, so it outlives the handles
+// that the app opens and closes again while polling. The names of the key's sub keys and values are cached the same way
+// once RegEnumKeyExW or RegEnumValueW have enumerated them, so that enumerating the key again costs one registry call
+
+void EnableValueCache() noexcept;
+
+// Called by the fixups that open keys, once they have done so. 'keypath' is the path that the key was opened by, and
+// 'samModified' the access that it was opened with
+void CacheKeyValues(LSTATUS result, PHKEY resultKey, std::wstring_view keypath, REGSAM samModified) noexcept;
+
+// Must be called before 'key' is closed, since its value may then be handed out again for another key
+void ForgetCachedValues(HKEY key) noexcept;
@@ -5,7 +5,6 @@
 //-------------------------------------------------------------------------------------------------------
 #include "pch.h"
 
-#define PSF_DEFINE_EXPORTS
 #include <psf_framework.h>
 
 bool trace_function_entry = false;
@@ -15,16 +14,74 @@ bool m_shouldLog = true;
 void InitializeFixups();
 void InitializeConfiguration();
 void Log(const char* fmt, ...);
+void LogSamDecisionCacheStatistics();
+void LogRegistryStatistics();
+
+static bool g_configurationInitialized = false;
 
 extern "C" {
 
+    // The configuration is read here rather than in DllMain, when the PSF Runtime supports it, so that it isn't done
+    // under the loader lock and can happen at the same time as other fixups load
+    int __stdcall PSFPreInitialize() noexcept try
+    {
+        InitializeConfiguration();
+        g_configurationInitialized = true;
+        return ERROR_SUCCESS;
+    }
+    catch (...)
+    {
+        return win32_from_caught_exception();
+    }
+
+    int __stdcall PSFInitialize() noexcept try
+    {
+        if (!g_configurationInitialized)
+        {
+            InitializeConfiguration();
+        }
+        psf::attach_all();
+        return ERROR_SUCCESS;
+    }
+    catch (...)
+    {
+        return win32_from_caught_exception();
+    }
+
+    int __stdcall PSFUninitialize() noexcept try
+    {
+        LogSamDecisionCacheStatistics();
+        LogRegistryStatistics();
+        psf::detach_all();
+        return ERROR_SUCCESS;
+    }
+    catch (...)
+    {
+        return win32_from_caught_exception();
+    }
+
+    // The process is exiting, so the statistics are all that would be lost
+    int __stdcall PSFFlush() noexcept try
+    {
+        LogSamDecisionCacheStatistics();
+        LogRegistryStatistics();
+        return ERROR_SUCCESS;
+    }
+    catch (...)
+    {
+        return win32_from_caught_exception();
+    }
 
 #ifdef _M_IX86
+#pragma comment(linker, "/EXPORT:PSFPreInitialize=_PSFPreInitialize@0")
 #pragma comment(linker, "/EXPORT:PSFInitialize=_PSFInitialize@0")
 #pragma comment(linker, "/EXPORT:PSFUninitialize=_PSFUninitialize@0")
+#pragma comment(linker, "/EXPORT:PSFFlush=_PSFFlush@0")
 #else
+#pragma comment(linker, "/EXPORT:PSFPreInitialize=PSFPreInitialize")
 #pragma comment(linker, "/EXPORT:PSFInitialize=PSFInitialize")
 #pragma comment(linker, "/EXPORT:PSFUninitialize=PSFUninitialize")
+#pragma comment(linker, "/EXPORT:PSFFlush=PSFFlush")
 #endif
 
     BOOL APIENTRY DllMain(HMODULE, // hModule,
@@ -39,7 +96,6 @@ extern "C" {
             Log("Attaching RegLegacyFixups\n");
 
             InitializeFixups();
-            InitializeConfiguration();
             break;
         case DLL_THREAD_ATTACH:
         case DLL_THREAD_DETACH:
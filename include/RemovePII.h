@@ -1,5 +1,8 @@
 ﻿#pragma once
 
+#include <cwchar>
+#include <string_view>
+
 // Removes PII user info from PCWSTR version - returns what's after :\Users\userName if a user path is found.
 inline static PCWSTR RemovePIIfromFilePath(
     _In_ PCWSTR path)
@@ -22,4 +25,23 @@ inline static PCWSTR RemovePIIfromFilePath(
     // of caution and return null in this case.  So, returning validPath is fine in both cases where
     // userName is found vs not
     return validPath;
+}
+
+// Same as the above, except that paths within 'userProfile' - the current user's profile folder, as the caller has already
+// looked it up, e.g. through PSFQueryKnownFolder - are recognized by comparing that one prefix instead of searching the
+// path. Paths anywhere else, e.g. within another user's profile, are still searched
+inline static PCWSTR RemovePIIfromFilePath(
+    _In_ PCWSTR path,
+    std::wstring_view userProfile)
+{
+    if (path && !userProfile.empty() && (_wcsnicmp(path, userProfile.data(), userProfile.length()) == 0))
+    {
+        auto rest = path + userProfile.length();
+        if ((*rest == L'\\') || (*rest == L'\0'))
+        {
+            return rest;
+        }
+    }
+
+    return RemovePIIfromFilePath(path);
 }
\ No newline at end of file
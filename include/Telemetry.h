@@ -1,4 +1,13 @@
-﻿#define TraceLoggingOptionMicrosoftTelemetry() \
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define TraceLoggingOptionMicrosoftTelemetry() \
     TraceLoggingOptionGroup(0000000000, 00000, 00000, 0000, 0000, 0000, 0000, 0000, 000, 0000, 0000)
 
 #define TelemetryPrivacyDataTag(tag) TraceLoggingUInt64((tag), "PartA_PrivTags")
@@ -10,4 +19,78 @@
 #define PDT_ProductAndServiceUsage             0x0000000002000000u
 #define PDT_SoftwareSetupAndInventory          0x0000000080000000u
 
-#define MICROSOFT_KEYWORD_CRITICAL_DATA 0x0000800000000000 // Bit 47
\ No newline at end of file
+#define MICROSOFT_KEYWORD_CRITICAL_DATA 0x0000800000000000 // Bit 47
+
+namespace psf
+{
+    // The fixups and the launcher summarize what they'd otherwise report one event at a time - an event per rule, per
+    // configured application, etc. - into a few events per process, one field each for the whole collection. A
+    // telemetry_list collects one such field of strings, separated by semicolons
+    class telemetry_list
+    {
+    public:
+
+        void add(std::wstring_view value)
+        {
+            if (m_count != 0)
+            {
+                m_text.push_back(L';');
+            }
+            m_text.append(value);
+            ++m_count;
+        }
+
+        const wchar_t* c_str() const noexcept
+        {
+            return m_text.c_str();
+        }
+
+        std::uint32_t count() const noexcept
+        {
+            return m_count;
+        }
+
+    private:
+
+        std::wstring m_text;
+        std::uint32_t m_count = 0;
+    };
+
+    // Likewise for a field of numbers, which is written with TraceLoggingUInt64Array. Arrays in an event hold no more
+    // than 65535 elements, so any beyond that are counted, but dropped
+    class telemetry_counts
+    {
+    public:
+
+        void add(std::uint64_t value)
+        {
+            if (m_values.size() < max_count)
+            {
+                m_values.push_back(value);
+            }
+            m_total += value;
+        }
+
+        const std::uint64_t* data() const noexcept
+        {
+            return m_values.data();
+        }
+
+        std::uint16_t count() const noexcept
+        {
+            return static_cast<std::uint16_t>(m_values.size());
+        }
+
+        std::uint64_t total() const noexcept
+        {
+            return m_total;
+        }
+
+    private:
+
+        static constexpr std::size_t max_count = (std::numeric_limits<std::uint16_t>::max)();
+
+        std::vector<std::uint64_t> m_values;
+        std::uint64_t m_total = 0;
+    };
+}
@@ -0,0 +1,99 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+
+#include "psf_config.h"
+
+namespace psf
+{
+    // A compiled config is config.json converted at packaging time by PsfConfigCompiler and placed in the root of the
+    // package. The PSF Runtime maps the file read-only and serves the psf::json_value interfaces straight from it,
+    // rather than having to parse config.json in every process. The file consists of:
+    //
+    //      compiled_config_header
+    //      compiled_config_number[number_count]
+    //      compiled_config_string[string_count]
+    //      compiled_config_container[object_count]
+    //      compiled_config_container[array_count]
+    //      compiled_config_member[member_count]    - The members of all objects, each object's sorted by key
+    //      compiled_config_value[element_count]    - The elements of all arrays, in order
+    //      wchar_t[wide_length]                    - UTF-16 versions of all string values, each null terminated
+    //      char[narrow_length]                     - UTF-8 versions of all string values and keys, each null terminated
+    //
+    // Keys are sorted the same way that std::string compares, which is also the order in which objects parsed from
+    // config.json enumerate their members. Identical strings are only stored once.
+    constexpr wchar_t compiled_config_file_name[] = L"PsfConfig.dat";
+    constexpr std::uint32_t compiled_config_magic = 0x43465350; // "PSFC"
+    constexpr std::uint32_t compiled_config_version = 1;
+
+    struct compiled_config_header
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t root; // compiled_config_value
+        std::uint32_t number_count;
+        std::uint32_t string_count;
+        std::uint32_t object_count;
+        std::uint32_t array_count;
+        std::uint32_t member_count;
+        std::uint32_t element_count;
+        std::uint32_t wide_length;
+        std::uint32_t narrow_length;
+        std::uint32_t reserved;
+    };
+
+    // A reference to a value: its json_type in the top four bits and, in the rest, its index into the table for that
+    // type. Null and boolean values have no table; the index of a null is zero and that of a boolean is its value
+    using compiled_config_value = std::uint32_t;
+    constexpr std::uint32_t compiled_config_max_index = 0x0FFFFFFF;
+
+    constexpr compiled_config_value make_compiled_config_value(json_type type, std::uint32_t index) noexcept
+    {
+        return (static_cast<std::uint32_t>(type) << 28) | index;
+    }
+
+    constexpr json_type compiled_config_value_type(compiled_config_value value) noexcept
+    {
+        return static_cast<json_type>(value >> 28);
+    }
+
+    constexpr std::uint32_t compiled_config_value_index(compiled_config_value value) noexcept
+    {
+        return value & compiled_config_max_index;
+    }
+
+    // 'kind' is 0 for signed, 1 for unsigned, and 2 for floating point values, whose bits are the double's
+    struct compiled_config_number
+    {
+        std::uint32_t kind;
+        std::uint32_t reserved;
+        std::uint64_t bits;
+    };
+
+    // Offsets and lengths are in characters of the respective string table, lengths not including the null terminator
+    struct compiled_config_string
+    {
+        std::uint32_t narrow_offset;
+        std::uint32_t narrow_length;
+        std::uint32_t wide_offset;
+        std::uint32_t wide_length;
+    };
+
+    // The range of an object's members, or of an array's elements
+    struct compiled_config_container
+    {
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+    struct compiled_config_member
+    {
+        std::uint32_t key_offset;
+        std::uint32_t key_length;
+        compiled_config_value value;
+    };
+}
@@ -0,0 +1,185 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <string_view>
+
+#include "pattern_dfa.h"
+
+// The shapes a configured pattern can be reduced to. The vast majority of configurations only ever use patterns such as
+// ".*", ".*\.log" or "Foo\.txt$", all of which can be answered with a single string comparison. Most of the rest, e.g.
+// ".*\.(exe|dll)" or "Logs\\[^\\]+\.txt", are compiled to a pattern_dfa, and only what that doesn't support falls back
+// to std::wregex. Matching is the same as std::regex_match with the pattern as an ECMAScript expression
+enum class pattern_kind
+{
+    match_all,      // E.g. ".*"
+    literal,        // E.g. "Foo\.txt$"
+    literal_prefix, // E.g. "Foo\\.*"
+    literal_suffix, // E.g. ".*\.log"
+    dfa,            // E.g. ".*\.(exe|dll)"
+    regex,
+};
+
+struct compiled_pattern
+{
+    pattern_kind kind = pattern_kind::regex;
+    std::wstring literal;
+    pattern_dfa dfa;
+
+    // Only allocated for the patterns that need it, and shared between copies
+    std::shared_ptr<const std::wregex> regex;
+
+    // Throws std::regex_error if the pattern requires a regex and is not a valid ECMAScript expression
+    void assign(const wchar_t* pattern, std::size_t length);
+
+    bool match(std::wstring_view value) const;
+};
+
+namespace pattern_details
+{
+    constexpr bool is_regex_special(wchar_t ch)
+    {
+        switch (ch)
+        {
+        case L'^': case L'$': case L'\\': case L'.': case L'*': case L'+': case L'?':
+        case L'(': case L')': case L'[': case L']': case L'{': case L'}': case L'|':
+            return true;
+        }
+        return false;
+    }
+
+    constexpr bool is_identity_escape(wchar_t ch)
+    {
+        // ECMAScript only treats an escaped character as itself when it is not an identifier character; "\d", "\w",
+        // "\b", "\0", etc. all carry special meaning
+        return !(((ch >= L'a') && (ch <= L'z')) || ((ch >= L'A') && (ch <= L'Z')) || ((ch >= L'0') && (ch <= L'9')) || (ch == L'_'));
+    }
+
+    // Attempts to decode 'pattern' as a sequence of literal characters. Returns false if the pattern uses any regex
+    // construct other than escaped punctuation
+    inline bool decode_literal(std::wstring_view pattern, std::wstring& result)
+    {
+        result.clear();
+        result.reserve(pattern.length());
+        for (std::size_t i = 0; i < pattern.length(); ++i)
+        {
+            auto ch = pattern[i];
+            if (ch == L'\\')
+            {
+                if ((++i == pattern.length()) || !is_identity_escape(pattern[i]))
+                {
+                    return false;
+                }
+                result.push_back(pattern[i]);
+            }
+            else if (is_regex_special(ch))
+            {
+                return false;
+            }
+            else
+            {
+                result.push_back(ch);
+            }
+        }
+
+        return true;
+    }
+
+    inline bool is_escaped(std::wstring_view pattern, std::size_t pos)
+    {
+        std::size_t count = 0;
+        while ((pos > 0) && (pattern[--pos] == L'\\'))
+        {
+            ++count;
+        }
+        return (count % 2) != 0;
+    }
+}
+
+inline void compiled_pattern::assign(const wchar_t* pattern, std::size_t length)
+{
+    std::wstring_view body(pattern, length);
+
+    // regex_match must consume the entire input, so explicit anchors are redundant
+    if (!body.empty() && (body.front() == L'^'))
+    {
+        body.remove_prefix(1);
+    }
+    if (!body.empty() && (body.back() == L'$') && !pattern_details::is_escaped(body, body.length() - 1))
+    {
+        body.remove_suffix(1);
+    }
+    auto anchoredBody = body;
+
+    bool leadingWildcard = false;
+    while ((body.length() >= 2) && (body.substr(0, 2) == L".*"))
+    {
+        leadingWildcard = true;
+        body.remove_prefix(2);
+    }
+
+    bool trailingWildcard = false;
+    while ((body.length() >= 2) && (body.substr(body.length() - 2) == L".*") && !pattern_details::is_escaped(body, body.length() - 2))
+    {
+        trailingWildcard = true;
+        body.remove_suffix(2);
+    }
+
+    literal.clear();
+    dfa.clear();
+    regex.reset();
+    if (leadingWildcard && body.empty())
+    {
+        kind = pattern_kind::match_all;
+    }
+    else if (!(leadingWildcard && trailingWildcard) && pattern_details::decode_literal(body, literal))
+    {
+        kind = leadingWildcard ? pattern_kind::literal_suffix :
+            trailingWildcard ? pattern_kind::literal_prefix :
+            pattern_kind::literal;
+    }
+    else
+    {
+        literal.clear();
+        if (dfa.build(anchoredBody))
+        {
+            kind = pattern_kind::dfa;
+        }
+        else
+        {
+            kind = pattern_kind::regex;
+            regex = std::make_shared<const std::wregex>(pattern, length);
+        }
+    }
+}
+
+inline bool compiled_pattern::match(std::wstring_view value) const
+{
+    switch (kind)
+    {
+    case pattern_kind::match_all:
+        return true;
+
+    case pattern_kind::literal:
+        return value == literal;
+
+    case pattern_kind::literal_prefix:
+        return (value.length() >= literal.length()) && (value.compare(0, literal.length(), literal) == 0);
+
+    case pattern_kind::literal_suffix:
+        return (value.length() >= literal.length()) &&
+            (value.compare(value.length() - literal.length(), literal.length(), literal) == 0);
+
+    case pattern_kind::dfa:
+        return dfa.match(value);
+
+    case pattern_kind::regex:
+    default:
+        return std::regex_match(value.begin(), value.end(), *regex);
+    }
+}
@@ -6,7 +6,10 @@
 
 #include <cassert>
 #include <cwctype>
+#include <iterator>
+#include <optional>
 #include <string>
+#include <string_view>
 
 #include <windows.h>
 
@@ -99,37 +102,152 @@ namespace psf
         return ::GetFullPathNameW(path, length, buffer, filePart);
     }
 
-    // Wrapper around GetFullPathName
-    // NOTE: We prefer this over std::filesystem::absolute since it saves one allocation/copy in the best case and is
-    //       equivalent in the worst case since there's no generic null-terminated-string overload. It also gives us
-    //       future flexibility to fixup GetFullPathName, which is something that we can't control in the implementation
-    //       of the <filesystem> header
+    // Null terminated path storage for intermediate results. Paths shorter than MAX_PATH - i.e. almost all of them - live
+    // inside the object, and so on the stack; longer paths spill over to the heap. The path_type of the contents is
+    // worked out the first time that it's asked for, and then kept until the contents change
     template <typename CharT>
-    inline std::basic_string<CharT> full_path(const CharT* path)
+    class basic_path_buffer
+    {
+    public:
+        basic_path_buffer() = default;
+        basic_path_buffer(const basic_path_buffer&) = delete;
+        basic_path_buffer& operator=(const basic_path_buffer&) = delete;
+
+        // Returns a buffer with room for 'length' characters plus a null terminator. Existing contents are not preserved
+        CharT* reserve(std::size_t length)
+        {
+            if (length < std::size(m_buffer))
+            {
+                m_data = m_buffer;
+            }
+            else
+            {
+                m_heap.resize(length);
+                m_data = m_heap.data();
+            }
+            set_length(0);
+            return m_data;
+        }
+
+        // Sets the length of the contents of the current buffer, which must not exceed capacity()
+        void set_length(std::size_t length) noexcept
+        {
+            assert(length <= capacity());
+            m_data[length] = '\0';
+            m_length = length;
+            m_type.reset();
+        }
+
+        std::size_t capacity() const noexcept
+        {
+            return (m_data == m_buffer) ? (std::size(m_buffer) - 1) : m_heap.length();
+        }
+
+        const CharT* c_str() const noexcept
+        {
+            return m_data;
+        }
+
+        std::basic_string_view<CharT> view() const noexcept
+        {
+            return { m_data, m_length };
+        }
+
+        std::size_t length() const noexcept
+        {
+            return m_length;
+        }
+
+        dos_path_type type() const noexcept
+        {
+            if (!m_type)
+            {
+                m_type = path_type(m_data);
+            }
+            return *m_type;
+        }
+
+    private:
+        CharT m_buffer[MAX_PATH];
+        std::basic_string<CharT> m_heap;
+        CharT* m_data = m_buffer;
+        std::size_t m_length = 0;
+        mutable std::optional<dos_path_type> m_type;
+    };
+
+    using path_buffer = basic_path_buffer<wchar_t>;
+
+    // Wrapper around GetFullPathName, into a path_buffer. For the paths that fit in its inline buffer, GetFullPathName is
+    // only called once, and nothing is allocated. Returns false, leaving 'result' empty, if an error occurred
+    template <typename CharT>
+    inline bool full_path(const CharT* path, basic_path_buffer<CharT>& result)
     {
         // Root-local device paths are forwarded to the object manager with minimal modification, so we shouldn't be
         // trying to expand them here
         assert(path_type(path) != dos_path_type::root_local_device);
 
-        auto len = get_full_path_name(path, 0, nullptr);
+        auto buffer = result.reserve(0);
+        auto len = get_full_path_name(path, static_cast<DWORD>(result.capacity() + 1), buffer);
+        if (len > result.capacity())
+        {
+            // Too small; 'len' is the required size, including the null terminator
+            buffer = result.reserve(len - 1);
+            len = get_full_path_name(path, len, buffer);
+            if (len > result.capacity())
+            {
+                assert(false);
+                result.set_length(0);
+                return false;
+            }
+        }
+
         if (!len)
         {
             // Error occurred. We don't expect to ever see this, but in the event that we do, give back an empty path
             // and let the caller decide how to handle it
             assert(false);
-            return {};
+            return false;
         }
 
-        std::basic_string<CharT> buffer(len - 1, '\0');
-        len = get_full_path_name(path, len, buffer.data());
-        assert(len <= buffer.length());
-        if (!len || (len > buffer.length()))
+        result.set_length(len);
+        return true;
+    }
+
+    // Wrapper around GetFullPathName
+    // NOTE: We prefer this over std::filesystem::absolute since it saves one allocation/copy in the best case and is
+    //       equivalent in the worst case since there's no generic null-terminated-string overload. It also gives us
+    //       future flexibility to fixup GetFullPathName, which is something that we can't control in the implementation
+    //       of the <filesystem> header
+    template <typename CharT>
+    inline std::basic_string<CharT> full_path(const CharT* path)
+    {
+        basic_path_buffer<CharT> buffer;
+        if (!full_path(path, buffer))
         {
-            assert(false);
             return {};
         }
 
-        buffer.resize(len);
-        return buffer;
+        return std::basic_string<CharT>(buffer.view());
+    }
+
+    // The current directory, into a path_buffer. Returns false, leaving 'result' empty, if an error occurred
+    inline bool current_directory(path_buffer& result)
+    {
+        auto buffer = result.reserve(0);
+        auto len = ::GetCurrentDirectoryW(static_cast<DWORD>(result.capacity() + 1), buffer);
+        if (len > result.capacity())
+        {
+            // Too small; 'len' is the required size, including the null terminator. The directory may change in between
+            buffer = result.reserve(len - 1);
+            len = ::GetCurrentDirectoryW(len, buffer);
+            if (len > result.capacity())
+            {
+                result.set_length(0);
+                return false;
+            }
+        }
+
+        result.set_length(len);
+        return len != 0;
     }
 }
@@ -0,0 +1,55 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Generates identifiers that fixups use to correlate the log output of a single intercepted call. Identifiers are
+// unique within a module (until the 32-bit space wraps), but are not ordered across threads. Each thread reserves a
+// block of identifiers from a shared counter and hands them out locally, so that the shared cache line is only touched
+// once every 'interception_id_block_size' calls rather than on every call. E.g. Use might look like:
+//      void FooFixup()
+//      {
+//          auto instance = psf::next_interception_id();
+//          Log("[%d] FooFixup\n", instance);
+//          ...
+//      }
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace psf
+{
+    constexpr std::uint32_t interception_id_block_size = 1024;
+
+    namespace details
+    {
+        inline std::atomic<std::uint32_t> next_interception_id_block{ 0 };
+
+        struct interception_id_range
+        {
+            std::uint32_t next = 0;
+            std::uint32_t end = 0;
+        };
+
+        inline thread_local interception_id_range thread_interception_ids;
+    }
+
+    // Identifiers start at one so that zero can continue to mean "no identifier"
+    inline std::uint32_t next_interception_id() noexcept
+    {
+        auto& range = details::thread_interception_ids;
+        if (range.next == range.end)
+        {
+            auto block = details::next_interception_id_block.fetch_add(1, std::memory_order_relaxed);
+            range.next = block * interception_id_block_size;
+            range.end = range.next + interception_id_block_size;
+            if (range.next == 0)
+            {
+                ++range.next;
+            }
+        }
+
+        return range.next++;
+    }
+}
@@ -0,0 +1,219 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace psf
+{
+    // A compressor and decompressor for the LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+    // for data that's written far more often than it's read, e.g. traces that are kept on disk just in case. Compression
+    // is a single greedy pass with a small hash table - a few hundred megabytes a second - which is all that repetitive
+    // data such as trace records needs to shrink several times over. The blocks are standard LZ4 blocks, so any LZ4
+    // implementation can decompress them too.
+    namespace details
+    {
+        constexpr std::size_t lz4_min_match = 4;
+        constexpr std::size_t lz4_last_literals = 5; // The last bytes of a block are always literals
+        constexpr std::size_t lz4_match_start_limit = 12; // No match starts this close to the end of a block
+        constexpr std::size_t lz4_max_offset = 65535;
+        constexpr unsigned lz4_hash_bits = 12;
+
+        inline std::uint32_t lz4_read32(const std::uint8_t* data) noexcept
+        {
+            std::uint32_t result;
+            std::memcpy(&result, data, sizeof(result));
+            return result;
+        }
+
+        inline std::uint32_t lz4_hash(std::uint32_t sequence) noexcept
+        {
+            return (sequence * 2654435761u) >> (32 - lz4_hash_bits);
+        }
+    }
+
+    // The size that compressing 'size' bytes can come to at worst, i.e. for data that doesn't compress at all
+    constexpr std::size_t lz4_compress_bound(std::size_t size) noexcept
+    {
+        return size + size / 255 + 16;
+    }
+
+    // Compresses 'size' bytes into 'output' as a single block, returning the size of the block, or 0 if it would not fit
+    // in 'capacity' bytes
+    inline std::size_t lz4_compress(const void* input, std::size_t size, void* output, std::size_t capacity) noexcept
+    {
+        using namespace details;
+
+        auto src = static_cast<const std::uint8_t*>(input);
+        auto out = static_cast<std::uint8_t*>(output);
+        auto outEnd = out + capacity;
+
+        auto writeLength = [&](std::size_t length) noexcept
+        {
+            for (length -= 15; length >= 255; length -= 255)
+            {
+                *out++ = 255;
+            }
+            *out++ = static_cast<std::uint8_t>(length);
+        };
+
+        // Everything from 'anchor' up to 'position' is literals that are still to be written
+        auto emit = [&](std::size_t anchor, std::size_t position, std::size_t matchLength, std::size_t offset) noexcept
+        {
+            auto literals = position - anchor;
+            auto needed = 1 + literals / 255 + 1 + literals + (matchLength ? 2 + matchLength / 255 + 1 : 0);
+            if (static_cast<std::size_t>(outEnd - out) < needed)
+            {
+                return false;
+            }
+
+            auto token = out++;
+            *token = static_cast<std::uint8_t>(((literals < 15) ? literals : 15) << 4);
+            if (literals >= 15)
+            {
+                writeLength(literals);
+            }
+            if (literals)
+            {
+                std::memcpy(out, src + anchor, literals);
+                out += literals;
+            }
+
+            if (matchLength)
+            {
+                *out++ = static_cast<std::uint8_t>(offset);
+                *out++ = static_cast<std::uint8_t>(offset >> 8);
+
+                auto extra = matchLength - lz4_min_match;
+                *token |= static_cast<std::uint8_t>((extra < 15) ? extra : 15);
+                if (extra >= 15)
+                {
+                    writeLength(extra);
+                }
+            }
+            return true;
+        };
+
+        std::size_t anchor = 0;
+        if (size > lz4_match_start_limit)
+        {
+            // Positions of earlier sequences, by their hash. Candidates are always compared, so stale or unset entries only
+            // cost a missed match
+            std::uint32_t table[1 << lz4_hash_bits] = {};
+            auto matchEnd = size - lz4_last_literals;
+            for (std::size_t position = 0; position + lz4_match_start_limit < size; )
+            {
+                auto sequence = lz4_read32(src + position);
+                auto& entry = table[lz4_hash(sequence)];
+                std::size_t candidate = entry;
+                entry = static_cast<std::uint32_t>(position);
+
+                if ((candidate >= position) || (position - candidate > lz4_max_offset) || (lz4_read32(src + candidate) != sequence))
+                {
+                    ++position;
+                    continue;
+                }
+
+                auto matchLength = lz4_min_match;
+                while ((position + matchLength < matchEnd) && (src[candidate + matchLength] == src[position + matchLength]))
+                {
+                    ++matchLength;
+                }
+
+                if (!emit(anchor, position, matchLength, position - candidate))
+                {
+                    return 0;
+                }
+                position += matchLength;
+                anchor = position;
+            }
+        }
+
+        if (!emit(anchor, size, 0, 0))
+        {
+            return 0;
+        }
+        return static_cast<std::size_t>(out - static_cast<std::uint8_t*>(output));
+    }
+
+    // Decompresses a block that holds exactly 'size' bytes into 'output'. Returns false if the block is corrupt or doesn't
+    // decompress to 'size' bytes; the block is never read, nor 'output' written, out of bounds either way
+    inline bool lz4_decompress(const void* input, std::size_t inputSize, void* output, std::size_t size) noexcept
+    {
+        auto src = static_cast<const std::uint8_t*>(input);
+        auto dst = static_cast<std::uint8_t*>(output);
+        std::size_t in = 0;
+        std::size_t out = 0;
+
+        auto readLength = [&](std::size_t& length) noexcept
+        {
+            std::uint8_t value;
+            do
+            {
+                if (in == inputSize)
+                {
+                    return false;
+                }
+                value = src[in++];
+                length += value;
+            } while (value == 255);
+            return true;
+        };
+
+        while (in < inputSize)
+        {
+            auto token = src[in++];
+            std::size_t literals = token >> 4;
+            if ((literals == 15) && !readLength(literals))
+            {
+                return false;
+            }
+            if ((literals > inputSize - in) || (literals > size - out))
+            {
+                return false;
+            }
+            if (literals)
+            {
+                std::memcpy(dst + out, src + in, literals);
+                in += literals;
+                out += literals;
+            }
+
+            // The last sequence has no match
+            if (in == inputSize)
+            {
+                break;
+            }
+
+            if (inputSize - in < 2)
+            {
+                return false;
+            }
+            std::size_t offset = src[in] | (static_cast<std::size_t>(src[in + 1]) << 8);
+            in += 2;
+
+            std::size_t matchLength = token & 15;
+            if ((matchLength == 15) && !readLength(matchLength))
+            {
+                return false;
+            }
+            matchLength += details::lz4_min_match;
+            if ((offset == 0) || (offset > out) || (matchLength > size - out))
+            {
+                return false;
+            }
+
+            // Matches may overlap what they produce, e.g. a run of one byte, so they're copied a byte at a time
+            for (auto end = out + matchLength; out < end; ++out)
+            {
+                dst[out] = dst[out - offset];
+            }
+        }
+
+        return out == size;
+    }
+}
@@ -0,0 +1,252 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include <windows.h>
+
+#include "path_key.h"
+
+namespace psf
+{
+    // A package index is a list of every file and directory in a package layout, generated at packaging time by
+    // PsfPackageIndexer and placed in the root of the package. Fixups map the file read-only and search it in place,
+    // rather than having to walk the package on startup. The file consists of:
+    //
+    //      package_index_header
+    //      package_index_entry[entry_count]    - Sorted by path
+    //      wchar_t[string_table_length]        - The paths of all entries, not null terminated
+    //
+    // Paths are relative to the package root and in the form produced by make_package_index_key. The same layout is
+    // used for indices that a process shares with the other processes of its package through a section of named shared
+    // memory, in which case the entries' attributes are not recorded.
+    constexpr wchar_t package_index_file_name[] = L"PsfPackageIndex.dat";
+    constexpr std::uint32_t package_index_magic = 0x49465350; // "PSFI"
+    constexpr std::uint32_t package_index_version = 1;
+
+    struct package_index_header
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t entry_count;
+        std::uint32_t string_table_length;
+    };
+
+    struct package_index_entry
+    {
+        std::uint32_t path_offset;
+        std::uint32_t path_length;
+        std::uint32_t attributes;
+    };
+
+    // Converts a package relative path to the form that's used for lookups: backslash separated, without a trailing
+    // separator, and case folded the same way that the file system would
+    inline void make_package_index_key(std::wstring& path)
+    {
+        for (auto& ch : path)
+        {
+            if (ch == L'/')
+            {
+                ch = L'\\';
+            }
+        }
+
+        while (!path.empty() && (path.back() == L'\\'))
+        {
+            path.pop_back();
+        }
+
+        fold_path(path.data(), path.length());
+    }
+
+    // A read-only view of a package index file
+    class package_index
+    {
+    public:
+        package_index() noexcept = default;
+        package_index(const package_index&) = delete;
+        package_index& operator=(const package_index&) = delete;
+
+        ~package_index()
+        {
+            close();
+        }
+
+        // Returns false if the file does not exist or is not a valid package index
+        bool open(const std::filesystem::path& path) noexcept
+        {
+            close();
+
+            auto file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+
+            LARGE_INTEGER size{};
+            if (::GetFileSizeEx(file, &size) && (size.QuadPart >= static_cast<LONGLONG>(sizeof(package_index_header))))
+            {
+                m_mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            }
+            ::CloseHandle(file);
+
+            if (m_mapping)
+            {
+                m_view = ::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+            }
+
+            if (!m_view || !validate(static_cast<std::uint64_t>(size.QuadPart), true))
+            {
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        // Same as above, but for an index in the section of shared memory named 'name'. Since sections are sized in
+        // whole pages, the index may be followed by unused space. Returns false if there is no such section, or if the
+        // index in it is not valid (e.g. because the process that created it has not finished writing it yet)
+        bool open_shared(const wchar_t* name) noexcept
+        {
+            close();
+
+            m_mapping = ::OpenFileMappingW(FILE_MAP_READ, FALSE, name);
+            if (m_mapping)
+            {
+                m_view = ::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+            }
+
+            MEMORY_BASIC_INFORMATION info{};
+            if (!m_view || !::VirtualQuery(m_view, &info, sizeof(info)) || !validate(info.RegionSize, false))
+            {
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        void close() noexcept
+        {
+            if (m_view)
+            {
+                ::UnmapViewOfFile(m_view);
+                m_view = nullptr;
+            }
+
+            if (m_mapping)
+            {
+                ::CloseHandle(m_mapping);
+                m_mapping = nullptr;
+            }
+
+            m_entries = nullptr;
+            m_strings = nullptr;
+            m_count = 0;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_entries != nullptr;
+        }
+
+        std::size_t size() const noexcept
+        {
+            return m_count;
+        }
+
+        // 'key' is expected to already be in the form produced by make_package_index_key
+        const package_index_entry* find(std::wstring_view key) const noexcept
+        {
+            std::size_t low = 0;
+            std::size_t high = m_count;
+            while (low < high)
+            {
+                auto mid = low + (high - low) / 2;
+                auto cmp = path_of(m_entries[mid]).compare(key);
+                if (cmp == 0)
+                {
+                    return &m_entries[mid];
+                }
+                else if (cmp < 0)
+                {
+                    low = mid + 1;
+                }
+                else
+                {
+                    high = mid;
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Entries are sorted by path
+        const package_index_entry& entry_at(std::size_t index) const noexcept
+        {
+            assert(index < m_count);
+            return m_entries[index];
+        }
+
+        std::wstring_view path_of(const package_index_entry& entry) const noexcept
+        {
+            return std::wstring_view(m_strings + entry.path_offset, entry.path_length);
+        }
+
+    private:
+        // 'exactSize' is false when the index may be followed by unused space
+        bool validate(std::uint64_t size, bool exactSize) noexcept
+        {
+            if (size < sizeof(package_index_header))
+            {
+                return false;
+            }
+
+            auto header = static_cast<const package_index_header*>(m_view);
+            if ((header->magic != package_index_magic) || (header->version != package_index_version))
+            {
+                return false;
+            }
+
+            // The magic is written last when sharing an index, so everything else is only read once it's been seen
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            auto expectedSize = sizeof(package_index_header) +
+                static_cast<std::uint64_t>(header->entry_count) * sizeof(package_index_entry) +
+                static_cast<std::uint64_t>(header->string_table_length) * sizeof(wchar_t);
+            if (exactSize ? (expectedSize != size) : (expectedSize > size))
+            {
+                return false;
+            }
+
+            auto entries = reinterpret_cast<const package_index_entry*>(header + 1);
+            for (std::uint32_t i = 0; i < header->entry_count; ++i)
+            {
+                if (static_cast<std::uint64_t>(entries[i].path_offset) + entries[i].path_length > header->string_table_length)
+                {
+                    return false;
+                }
+            }
+
+            m_entries = entries;
+            m_strings = reinterpret_cast<const wchar_t*>(entries + header->entry_count);
+            m_count = header->entry_count;
+            return true;
+        }
+
+        HANDLE m_mapping = nullptr;
+        const void* m_view = nullptr;
+        const package_index_entry* m_entries = nullptr;
+        const wchar_t* m_strings = nullptr;
+        std::uint32_t m_count = 0;
+    };
+}
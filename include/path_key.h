@@ -0,0 +1,127 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include <windows.h>
+
+#include "utilities.h"
+
+namespace psf
+{
+    // Upper cases 'path' in place, the same way that the file system compares names, i.e. as the invariant locale does.
+    // This is the one case folding that the fixups' caches and indices - including the package index files that
+    // PsfPackageIndexer writes - are keyed on. ASCII is folded without calling into Win32, a block at a time where SSE2
+    // is available, and only whatever follows the first non-ASCII character goes through LCMapStringEx
+    inline void fold_path(wchar_t* path, std::size_t length) noexcept
+    {
+        std::size_t index = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+        constexpr auto block_size = details::case_fold_block_size<wchar_t>;
+        for (; index + block_size <= length; index += block_size)
+        {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(path + index));
+            if (!details::is_ascii_block<wchar_t>(block))
+            {
+                break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(path + index), details::fold_ascii_block<wchar_t>(block));
+        }
+#endif
+
+        for (; index < length; ++index)
+        {
+            auto ch = path[index];
+            if (ch >= 0x80)
+            {
+                ::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, path + index, static_cast<int>(length - index),
+                    path + index, static_cast<int>(length - index), nullptr, nullptr, 0);
+                return;
+            }
+            else if ((ch >= L'a') && (ch <= L'z'))
+            {
+                path[index] = static_cast<wchar_t>(ch - (L'a' - L'A'));
+            }
+        }
+    }
+
+    // A path in the form that the fixups compare paths in - backslash separated and folded by fold_path - along with a
+    // hash of it that's worked out once, up front. Meant as the key of any cache or index of paths, so that each fixup
+    // doesn't need case handling of its own, and so that equality is a compare of the hashes followed by a memcmp
+    class path_key
+    {
+    public:
+
+        path_key() = default;
+
+        explicit path_key(std::wstring_view path) :
+            m_path(path)
+        {
+            for (auto& ch : m_path)
+            {
+                if (ch == L'/')
+                {
+                    ch = L'\\';
+                }
+            }
+
+            fold_path(m_path.data(), m_path.length());
+
+            // 64-bit FNV-1a, with the high half mixed into the low one for 32-bit builds
+            std::uint64_t hash = 14695981039346656037ull;
+            for (auto ch : m_path)
+            {
+                hash = (hash ^ ch) * 1099511628211ull;
+            }
+            m_hash = static_cast<std::size_t>(hash ^ (hash >> 32));
+        }
+
+        const std::wstring& str() const noexcept
+        {
+            return m_path;
+        }
+
+        std::size_t hash() const noexcept
+        {
+            return m_hash;
+        }
+
+        bool empty() const noexcept
+        {
+            return m_path.empty();
+        }
+
+        friend bool operator==(const path_key& lhs, const path_key& rhs) noexcept
+        {
+            return (lhs.m_hash == rhs.m_hash) && (lhs.m_path.length() == rhs.m_path.length()) &&
+                (std::wmemcmp(lhs.m_path.data(), rhs.m_path.data(), lhs.m_path.length()) == 0);
+        }
+
+        friend bool operator!=(const path_key& lhs, const path_key& rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+
+    private:
+
+        std::wstring m_path;
+        std::size_t m_hash = 0;
+    };
+}
+
+template <>
+struct std::hash<psf::path_key>
+{
+    std::size_t operator()(const psf::path_key& key) const noexcept
+    {
+        return key.hash();
+    }
+};
@@ -0,0 +1,685 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <map>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pattern_details
+{
+    // Limits past which a pattern is left to std::wregex
+    constexpr std::size_t max_nfa_states = 4096;
+    constexpr std::size_t max_dfa_states = 512;
+    constexpr std::size_t max_classes = 255;
+    constexpr unsigned max_repeat = 32;
+
+    constexpr std::uint32_t max_char = static_cast<std::uint32_t>(WCHAR_MAX);
+}
+
+// A deterministic automaton for the part of the ECMAScript syntax that configured patterns use beyond plain strings:
+// escaped punctuation, ".", character classes with ranges and negation, groups, alternation, and the "*", "+", "?" and
+// "{n,m}" quantifiers (greedy or not, which makes no difference to whether the whole input matches). build() gives up on
+// anything else - anchors anywhere but at the ends, back references, assertions, "\d", "\w" and the other classes whose
+// meaning depends on the locale, etc. - as well as on patterns whose automaton would be too large, and those are left to
+// std::wregex. Matching is then one table lookup per character of the input, without any allocation or backtracking, and
+// gives the same answer as std::regex_match
+class pattern_dfa
+{
+public:
+    // 'pattern' is expected to have had its leading "^" and trailing "$", if any, removed already
+    bool build(std::wstring_view pattern);
+
+    bool match(std::wstring_view value) const noexcept
+    {
+        std::size_t state = start_state;
+        for (auto ch : value)
+        {
+            state = m_transitions[state * m_classCount + char_class(ch)];
+            if (state == dead_state)
+            {
+                return false;
+            }
+        }
+
+        return m_accepting[state];
+    }
+
+    void clear() noexcept
+    {
+        m_classCount = 0;
+        m_segmentStarts.clear();
+        m_segmentClasses.clear();
+        m_transitions.clear();
+        m_accepting.clear();
+    }
+
+private:
+    static constexpr std::size_t dead_state = 0;
+    static constexpr std::size_t start_state = 1;
+
+    std::uint8_t char_class(wchar_t ch) const noexcept
+    {
+        auto value = static_cast<std::uint32_t>(ch);
+        if (value < std::size(m_asciiClasses))
+        {
+            return m_asciiClasses[value];
+        }
+
+        auto segment = std::upper_bound(m_segmentStarts.begin(), m_segmentStarts.end(), value) - m_segmentStarts.begin() - 1;
+        return m_segmentClasses[segment];
+    }
+
+    // Characters are grouped into the classes that nothing in the pattern tells apart, so that the transition table has a
+    // column per class rather than per character. Each segment is a range of characters, starting at its entry in
+    // m_segmentStarts and running up to the next one; those below 128 are also looked up directly
+    std::size_t m_classCount = 0;
+    std::uint8_t m_asciiClasses[128] = {};
+    std::vector<std::uint32_t> m_segmentStarts;
+    std::vector<std::uint8_t> m_segmentClasses;
+
+    // The state following 'state' on a character of class 'c' is m_transitions[state * m_classCount + c]. State 0 is the
+    // dead state, which every mismatch leads to and which never leaves
+    std::vector<std::uint16_t> m_transitions;
+    std::vector<bool> m_accepting;
+};
+
+namespace pattern_details
+{
+    using char_range = std::pair<std::uint32_t, std::uint32_t>;
+
+    // A Thompson NFA, built while parsing. Each state either moves on a character of one of 'sets' to 'next', or on
+    // nothing to each of 'epsilon'
+    class pattern_nfa
+    {
+    public:
+        struct state
+        {
+            int set = -1;
+            int next = -1;
+            std::vector<int> epsilon;
+        };
+
+        struct fragment
+        {
+            int start = -1;
+            int end = -1;
+        };
+
+        std::vector<state> states;
+        std::vector<std::vector<char_range>> sets;
+        bool too_large = false;
+
+        explicit pattern_nfa(std::wstring_view pattern) : m_pattern(pattern)
+        {
+        }
+
+        // The whole pattern, or false if it uses anything that isn't supported
+        bool parse(fragment& result)
+        {
+            std::size_t pos = 0;
+            return parse_alternation(pos, result) && (pos == m_pattern.length()) && !too_large;
+        }
+
+    private:
+        std::wstring_view m_pattern;
+
+        int new_state()
+        {
+            if (states.size() >= max_nfa_states)
+            {
+                too_large = true;
+            }
+            states.emplace_back();
+            return static_cast<int>(states.size() - 1);
+        }
+
+        void link(int from, int to)
+        {
+            states[from].epsilon.push_back(to);
+        }
+
+        fragment empty()
+        {
+            auto s = new_state();
+            return { s, s };
+        }
+
+        fragment set_fragment(std::vector<char_range> ranges)
+        {
+            auto start = new_state();
+            auto end = new_state();
+            states[start].set = static_cast<int>(sets.size());
+            states[start].next = end;
+            sets.push_back(std::move(ranges));
+            return { start, end };
+        }
+
+        fragment concat(fragment lhs, fragment rhs)
+        {
+            link(lhs.end, rhs.start);
+            return { lhs.start, rhs.end };
+        }
+
+        fragment optional(fragment inner)
+        {
+            auto start = new_state();
+            auto end = new_state();
+            link(start, inner.start);
+            link(start, end);
+            link(inner.end, end);
+            return { start, end };
+        }
+
+        fragment star(fragment inner)
+        {
+            auto start = new_state();
+            auto end = new_state();
+            link(start, inner.start);
+            link(start, end);
+            link(inner.end, inner.start);
+            link(inner.end, end);
+            return { start, end };
+        }
+
+        bool parse_alternation(std::size_t& pos, fragment& result)
+        {
+            if (!parse_sequence(pos, result))
+            {
+                return false;
+            }
+
+            while ((pos < m_pattern.length()) && (m_pattern[pos] == L'|'))
+            {
+                fragment branch;
+                if (!parse_sequence(++pos, branch))
+                {
+                    return false;
+                }
+
+                auto start = new_state();
+                auto end = new_state();
+                link(start, result.start);
+                link(start, branch.start);
+                link(result.end, end);
+                link(branch.end, end);
+                result = { start, end };
+            }
+
+            return true;
+        }
+
+        bool parse_sequence(std::size_t& pos, fragment& result)
+        {
+            result = empty();
+            while ((pos < m_pattern.length()) && (m_pattern[pos] != L'|') && (m_pattern[pos] != L')'))
+            {
+                fragment item;
+                if (!parse_quantified(pos, item))
+                {
+                    return false;
+                }
+                result = concat(result, item);
+            }
+
+            return true;
+        }
+
+        static bool parse_number(std::wstring_view pattern, std::size_t& pos, unsigned& value)
+        {
+            auto begin = pos;
+            value = 0;
+            while ((pos < pattern.length()) && (pattern[pos] >= L'0') && (pattern[pos] <= L'9'))
+            {
+                value = value * 10 + static_cast<unsigned>(pattern[pos++] - L'0');
+                if (value > max_repeat)
+                {
+                    return false;
+                }
+            }
+            return pos != begin;
+        }
+
+        bool parse_quantified(std::size_t& pos, fragment& result)
+        {
+            // Repeating an atom a fixed number of times needs a copy of its states for each time, which is simplest to get
+            // by parsing it again
+            auto atomPos = pos;
+            if (!parse_atom(pos, result))
+            {
+                return false;
+            }
+
+            if (pos == m_pattern.length())
+            {
+                return true;
+            }
+
+            unsigned minimum = 1;
+            unsigned maximum = 1;
+            bool unbounded = false;
+            switch (m_pattern[pos])
+            {
+            case L'*':
+                minimum = 0;
+                unbounded = true;
+                ++pos;
+                break;
+
+            case L'+':
+                unbounded = true;
+                ++pos;
+                break;
+
+            case L'?':
+                minimum = 0;
+                ++pos;
+                break;
+
+            case L'{':
+                ++pos;
+                if (!parse_number(m_pattern, pos, minimum))
+                {
+                    return false;
+                }
+                maximum = minimum;
+                if ((pos < m_pattern.length()) && (m_pattern[pos] == L','))
+                {
+                    ++pos;
+                    if ((pos < m_pattern.length()) && (m_pattern[pos] == L'}'))
+                    {
+                        unbounded = true;
+                    }
+                    else if (!parse_number(m_pattern, pos, maximum) || (maximum < minimum))
+                    {
+                        return false;
+                    }
+                }
+                if ((pos == m_pattern.length()) || (m_pattern[pos] != L'}'))
+                {
+                    return false;
+                }
+                ++pos;
+                break;
+
+            default:
+                return true;
+            }
+
+            // Non-greedy quantifiers match the same inputs, only in a different order
+            if ((pos < m_pattern.length()) && (m_pattern[pos] == L'?'))
+            {
+                ++pos;
+            }
+            if ((pos < m_pattern.length()) && std::wstring_view(L"*+?{").find(m_pattern[pos]) != std::wstring_view::npos)
+            {
+                return false;
+            }
+
+            // E.g. "a{2,4}" becomes "aaa?a?" and "a{2,}" becomes "aaa*"
+            auto copies = minimum + (unbounded ? 1 : maximum - minimum);
+            std::vector<fragment> atoms;
+            if (copies > 0)
+            {
+                atoms.push_back(result);
+            }
+            while (atoms.size() < copies)
+            {
+                auto atomEnd = atomPos;
+                if (!parse_atom(atomEnd, atoms.emplace_back()) || too_large)
+                {
+                    return false;
+                }
+            }
+
+            fragment repeated = empty();
+            for (unsigned i = 0; i < minimum; ++i)
+            {
+                repeated = concat(repeated, atoms[i]);
+            }
+            if (unbounded)
+            {
+                repeated = concat(repeated, star(atoms[minimum]));
+            }
+            else
+            {
+                for (unsigned i = minimum; i < maximum; ++i)
+                {
+                    repeated = concat(repeated, optional(atoms[i]));
+                }
+            }
+
+            result = repeated;
+            return !too_large;
+        }
+
+        bool parse_atom(std::size_t& pos, fragment& result)
+        {
+            auto ch = m_pattern[pos];
+            switch (ch)
+            {
+            case L'(':
+                ++pos;
+                if ((pos < m_pattern.length()) && (m_pattern[pos] == L'?'))
+                {
+                    // Only non-capturing groups; lookaheads aren't supported
+                    if ((pos + 1 >= m_pattern.length()) || (m_pattern[pos + 1] != L':'))
+                    {
+                        return false;
+                    }
+                    pos += 2;
+                }
+                if (!parse_alternation(pos, result) || (pos == m_pattern.length()) || (m_pattern[pos] != L')'))
+                {
+                    return false;
+                }
+                ++pos;
+                return true;
+
+            case L'[':
+                return parse_class(++pos, result);
+
+            case L'.':
+                // As with std::wregex, anything but a line break
+                ++pos;
+                result = set_fragment({ { 0, L'\n' - 1 }, { L'\n' + 1, L'\r' - 1 }, { L'\r' + 1, max_char } });
+                return true;
+
+            case L'\\':
+            {
+                std::uint32_t value;
+                if (!parse_escape(++pos, value))
+                {
+                    return false;
+                }
+                result = set_fragment({ { value, value } });
+                return true;
+            }
+
+            case L'^': case L'$': case L'*': case L'+': case L'?': case L')': case L']': case L'{': case L'}': case L'|':
+                return false;
+
+            default:
+                ++pos;
+                result = set_fragment({ { static_cast<std::uint32_t>(ch), static_cast<std::uint32_t>(ch) } });
+                return true;
+            }
+        }
+
+        // The character that an escape stands for, for those escapes that stand for a single character
+        bool parse_escape(std::size_t& pos, std::uint32_t& value)
+        {
+            if (pos == m_pattern.length())
+            {
+                return false;
+            }
+
+            auto ch = m_pattern[pos++];
+            switch (ch)
+            {
+            case L't': value = L'\t'; return true;
+            case L'n': value = L'\n'; return true;
+            case L'v': value = L'\v'; return true;
+            case L'f': value = L'\f'; return true;
+            case L'r': value = L'\r'; return true;
+            }
+
+            if (!is_identity_escape(ch))
+            {
+                return false;
+            }
+
+            value = static_cast<std::uint32_t>(ch);
+            return true;
+        }
+
+        static constexpr bool is_identity_escape(wchar_t ch)
+        {
+            return !(((ch >= L'a') && (ch <= L'z')) || ((ch >= L'A') && (ch <= L'Z')) || ((ch >= L'0') && (ch <= L'9')) || (ch == L'_'));
+        }
+
+        bool parse_class_char(std::size_t& pos, std::uint32_t& value)
+        {
+            if (pos == m_pattern.length())
+            {
+                return false;
+            }
+
+            auto ch = m_pattern[pos];
+            if (ch == L'\\')
+            {
+                return parse_escape(++pos, value);
+            }
+            else if ((ch == L'[') || (ch == L']'))
+            {
+                // "[:alpha:]" and the like, as well as a "]" where it would make the class empty
+                return false;
+            }
+
+            ++pos;
+            value = static_cast<std::uint32_t>(ch);
+            return true;
+        }
+
+        bool parse_class(std::size_t& pos, fragment& result)
+        {
+            bool negate = false;
+            if ((pos < m_pattern.length()) && (m_pattern[pos] == L'^'))
+            {
+                negate = true;
+                ++pos;
+            }
+
+            std::vector<char_range> ranges;
+            do
+            {
+                std::uint32_t low;
+                if (!parse_class_char(pos, low))
+                {
+                    return false;
+                }
+
+                auto high = low;
+                if ((pos + 1 < m_pattern.length()) && (m_pattern[pos] == L'-') && (m_pattern[pos + 1] != L']'))
+                {
+                    if (!parse_class_char(++pos, high) || (high < low))
+                    {
+                        return false;
+                    }
+                }
+                ranges.emplace_back(low, high);
+            } while ((pos < m_pattern.length()) && (m_pattern[pos] != L']'));
+
+            if (pos == m_pattern.length())
+            {
+                return false;
+            }
+            ++pos;
+
+            std::sort(ranges.begin(), ranges.end());
+            std::vector<char_range> merged;
+            for (auto& range : ranges)
+            {
+                if (!merged.empty() && (range.first <= merged.back().second + 1))
+                {
+                    merged.back().second = std::max(merged.back().second, range.second);
+                }
+                else
+                {
+                    merged.push_back(range);
+                }
+            }
+
+            if (negate)
+            {
+                std::vector<char_range> complement;
+                std::uint32_t next = 0;
+                for (auto& range : merged)
+                {
+                    if (range.first > next)
+                    {
+                        complement.emplace_back(next, range.first - 1);
+                    }
+                    next = range.second + 1;
+                }
+                if (next <= max_char)
+                {
+                    complement.emplace_back(next, max_char);
+                }
+                merged = std::move(complement);
+            }
+
+            if (merged.empty())
+            {
+                return false;
+            }
+
+            result = set_fragment(std::move(merged));
+            return true;
+        }
+    };
+
+    inline void epsilon_closure(const pattern_nfa& nfa, std::vector<int>& states)
+    {
+        std::vector<bool> seen(nfa.states.size());
+        for (auto s : states)
+        {
+            seen[s] = true;
+        }
+
+        for (std::size_t i = 0; i < states.size(); ++i)
+        {
+            for (auto next : nfa.states[states[i]].epsilon)
+            {
+                if (!seen[next])
+                {
+                    seen[next] = true;
+                    states.push_back(next);
+                }
+            }
+        }
+
+        std::sort(states.begin(), states.end());
+    }
+}
+
+inline bool pattern_dfa::build(std::wstring_view pattern)
+{
+    using namespace pattern_details;
+    clear();
+
+    pattern_nfa nfa(pattern);
+    pattern_nfa::fragment whole;
+    if (!nfa.parse(whole))
+    {
+        return false;
+    }
+
+    // Split the characters at every boundary of every set, then merge the segments that are in the same sets
+    std::vector<std::uint32_t> boundaries = { 0 };
+    for (auto& set : nfa.sets)
+    {
+        for (auto& range : set)
+        {
+            boundaries.push_back(range.first);
+            if (range.second < max_char)
+            {
+                boundaries.push_back(range.second + 1);
+            }
+        }
+    }
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+
+    std::map<std::vector<bool>, std::uint8_t> classesBySets;
+    std::vector<std::vector<bool>> classSets;
+    for (auto start : boundaries)
+    {
+        std::vector<bool> inSets(nfa.sets.size());
+        for (std::size_t i = 0; i < nfa.sets.size(); ++i)
+        {
+            for (auto& range : nfa.sets[i])
+            {
+                if ((start >= range.first) && (start <= range.second))
+                {
+                    inSets[i] = true;
+                    break;
+                }
+            }
+        }
+
+        auto [itr, inserted] = classesBySets.emplace(inSets, static_cast<std::uint8_t>(classSets.size()));
+        if (inserted)
+        {
+            if (classSets.size() == max_classes)
+            {
+                return false;
+            }
+            classSets.push_back(std::move(inSets));
+        }
+        m_segmentStarts.push_back(start);
+        m_segmentClasses.push_back(itr->second);
+    }
+    m_classCount = classSets.size();
+
+    for (std::uint32_t ch = 0; ch < std::size(m_asciiClasses); ++ch)
+    {
+        auto segment = std::upper_bound(m_segmentStarts.begin(), m_segmentStarts.end(), ch) - m_segmentStarts.begin() - 1;
+        m_asciiClasses[ch] = m_segmentClasses[segment];
+    }
+
+    // Subset construction, with state 0 kept for the empty set of NFA states
+    std::map<std::vector<int>, std::uint16_t> dfaStates;
+    std::vector<std::vector<int>> pending;
+    auto addState = [&](std::vector<int> nfaStates) -> std::uint16_t
+    {
+        auto [itr, inserted] = dfaStates.emplace(std::move(nfaStates), static_cast<std::uint16_t>(dfaStates.size()));
+        if (inserted)
+        {
+            pending.push_back(itr->first);
+            m_accepting.push_back(std::binary_search(itr->first.begin(), itr->first.end(), whole.end));
+            m_transitions.resize(m_transitions.size() + m_classCount, static_cast<std::uint16_t>(dead_state));
+        }
+        return itr->second;
+    };
+
+    addState({});
+    std::vector<int> initial = { whole.start };
+    epsilon_closure(nfa, initial);
+    addState(std::move(initial));
+
+    for (std::size_t current = start_state; current < pending.size(); ++current)
+    {
+        if (pending.size() > max_dfa_states)
+        {
+            clear();
+            return false;
+        }
+
+        for (std::size_t c = 0; c < m_classCount; ++c)
+        {
+            std::vector<int> next;
+            for (auto s : pending[current])
+            {
+                auto& nfaState = nfa.states[s];
+                if ((nfaState.set >= 0) && classSets[c][nfaState.set])
+                {
+                    next.push_back(nfaState.next);
+                }
+            }
+            epsilon_closure(nfa, next);
+            next.erase(std::unique(next.begin(), next.end()), next.end());
+
+            auto target = addState(std::move(next));
+            m_transitions[current * m_classCount + c] = target;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,187 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <cwchar>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <windows.h>
+
+namespace psf
+{
+    namespace details
+    {
+        // Not in all of the SDKs that PSF builds with
+        constexpr int process_io_priority_class = 33; // ProcessIoPriority
+        constexpr int process_power_throttling_class = 4; // ProcessPowerThrottling
+        constexpr ULONG power_throttling_execution_speed = 0x1;
+
+        struct power_throttling_state
+        {
+            ULONG Version;
+            ULONG ControlMask;
+            ULONG StateMask;
+        };
+    }
+
+    // The part of an application's "resourcePolicy" that's per process: its priority, I/O priority, memory priority,
+    // EcoQoS and CPU sets. The job object, and with it the CPU rate, memory and affinity limits, is inherited by every
+    // process that the application goes on to create, but none of these are, so PsfLauncher hands them down in
+    // process_policy_variable (see psf_constants.h), and the PSF Runtime applies them to each process that it creates while that's still
+    // suspended. Processes that are given an environment of their own don't pass them any further
+    struct process_policy
+    {
+        DWORD priority_class = 0;           // e.g. BELOW_NORMAL_PRIORITY_CLASS, or 0 to leave it be
+        int io_priority = -1;               // 0 (very low), 1 (low) or 2 (normal), or -1 to leave it be
+        int memory_priority = -1;           // MEMORY_PRIORITY_VERY_LOW through MEMORY_PRIORITY_NORMAL, or -1
+        int eco_qos = -1;                   // 1 to turn EcoQoS on, 0 to keep it off, or -1 to leave it to Windows
+        std::vector<ULONG> cpu_sets;        // CPU set ids, as reported by GetSystemCpuSetInformation
+
+        bool empty() const noexcept
+        {
+            return (priority_class == 0) && (io_priority < 0) && (memory_priority < 0) && (eco_qos < 0) && cpu_sets.empty();
+        }
+
+        // E.g. "priority=16384;io=1;memory=2;ecoqos=1;cpusets=256,257"
+        std::wstring to_string() const
+        {
+            std::wstring result;
+            auto append = [&](const wchar_t* name, std::uint64_t value)
+            {
+                if (!result.empty())
+                {
+                    result += L';';
+                }
+                result += name;
+                result += L'=';
+                result += std::to_wstring(value);
+            };
+
+            if (priority_class != 0) append(L"priority", priority_class);
+            if (io_priority >= 0) append(L"io", static_cast<std::uint64_t>(io_priority));
+            if (memory_priority >= 0) append(L"memory", static_cast<std::uint64_t>(memory_priority));
+            if (eco_qos >= 0) append(L"ecoqos", static_cast<std::uint64_t>(eco_qos));
+            if (!cpu_sets.empty())
+            {
+                append(L"cpusets", cpu_sets.front());
+                for (std::size_t i = 1; i < cpu_sets.size(); ++i)
+                {
+                    result += L',';
+                    result += std::to_wstring(cpu_sets[i]);
+                }
+            }
+
+            return result;
+        }
+
+        // The reverse of to_string. Anything that it doesn't recognize is left out
+        static process_policy from_string(const wchar_t* value)
+        {
+            process_policy result;
+            while (*value)
+            {
+                auto separator = std::wcschr(value, L'=');
+                if (!separator)
+                {
+                    break;
+                }
+
+                std::wstring_view name(value, separator - value);
+                wchar_t* end;
+                auto number = std::wcstoul(separator + 1, &end, 10);
+                if (name == L"priority")
+                {
+                    result.priority_class = number;
+                }
+                else if (name == L"io")
+                {
+                    result.io_priority = static_cast<int>(number);
+                }
+                else if (name == L"memory")
+                {
+                    result.memory_priority = static_cast<int>(number);
+                }
+                else if (name == L"ecoqos")
+                {
+                    result.eco_qos = (number != 0) ? 1 : 0;
+                }
+                else if (name == L"cpusets")
+                {
+                    result.cpu_sets.push_back(number);
+                    while (*end == L',')
+                    {
+                        result.cpu_sets.push_back(std::wcstoul(end + 1, &end, 10));
+                    }
+                }
+
+                while (*end && (*end != L';'))
+                {
+                    ++end;
+                }
+                value = (*end == L';') ? end + 1 : end;
+            }
+
+            return result;
+        }
+
+        // Applies each of the settings to 'process', which needs PROCESS_SET_INFORMATION access. All of them are tried,
+        // even when one fails, and the first error is what gets returned
+        DWORD apply(HANDLE process) const noexcept
+        {
+            DWORD result = ERROR_SUCCESS;
+            auto check = [&](BOOL succeeded)
+            {
+                if (!succeeded && (result == ERROR_SUCCESS))
+                {
+                    result = ::GetLastError();
+                }
+            };
+
+            if (priority_class != 0)
+            {
+                check(::SetPriorityClass(process, priority_class));
+            }
+
+            if (io_priority >= 0)
+            {
+                // NOTE: Only through ntdll, and the high and critical priorities need a privilege that's not expected here
+                using NtSetInformationProcessFn = LONG(NTAPI*)(HANDLE, int, PVOID, ULONG);
+                static auto ntSetInformationProcess = reinterpret_cast<NtSetInformationProcessFn>(
+                    ::GetProcAddress(::GetModuleHandleW(L"ntdll.dll"), "NtSetInformationProcess"));
+                ULONG hint = static_cast<ULONG>(io_priority);
+                if ((!ntSetInformationProcess ||
+                    (ntSetInformationProcess(process, details::process_io_priority_class, &hint, sizeof(hint)) < 0)) &&
+                    (result == ERROR_SUCCESS))
+                {
+                    result = ERROR_NOT_SUPPORTED;
+                }
+            }
+
+            if (memory_priority >= 0)
+            {
+                MEMORY_PRIORITY_INFORMATION info = { static_cast<ULONG>(memory_priority) };
+                check(::SetProcessInformation(process, ProcessMemoryPriority, &info, sizeof(info)));
+            }
+
+            if (eco_qos >= 0)
+            {
+                details::power_throttling_state state = { 1, details::power_throttling_execution_speed,
+                    (eco_qos != 0) ? details::power_throttling_execution_speed : 0 };
+                check(::SetProcessInformation(process, static_cast<PROCESS_INFORMATION_CLASS>(details::process_power_throttling_class),
+                    &state, sizeof(state)));
+            }
+
+            if (!cpu_sets.empty())
+            {
+                check(::SetProcessDefaultCpuSets(process, cpu_sets.data(), static_cast<ULONG>(cpu_sets.size())));
+            }
+
+            return result;
+        }
+    };
+}
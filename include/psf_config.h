@@ -5,9 +5,14 @@
 #pragma once
 
 #include <cstdint>
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <typeinfo>
+#include <vector>
 
 #include "utilities.h"
 
@@ -620,4 +625,145 @@ namespace psf
             return rend();
         }
     };
+
+    // Binding of configuration into plain structs, so that a fixup walks its configuration once, at initialization, and
+    // its hot paths then read ordinary members with neither virtual calls nor key lookups. A struct takes part by
+    // describing the fields to bind, e.g.:
+    //
+    //      struct dll_spec
+    //      {
+    //          std::wstring name;
+    //          std::optional<std::wstring> file_path;
+    //
+    //          static constexpr auto json_fields()
+    //          {
+    //              return std::make_tuple(
+    //                  psf::json_field("name", &dll_spec::name, psf::json_required),
+    //                  psf::json_field("filepath", &dll_spec::file_path));
+    //          }
+    //      };
+    //
+    //      auto specs = psf::json_bind<std::vector<dll_spec>>(rootObject.get("relativeDllPaths"));
+    //
+    // Besides such structs, values may bind to bool, arithmetic types, std::string, std::wstring, and std::optional and
+    // std::vector of any of these. Optional fields that are absent keep their default value. Type mismatches throw the
+    // same exceptions as the as_* functions do
+    constexpr bool json_required = true;
+
+    template <typename Struct, typename T>
+    struct json_field_descriptor
+    {
+        const char* key;
+        T Struct::* member;
+        bool required;
+    };
+
+    template <typename Struct, typename T>
+    constexpr json_field_descriptor<Struct, T> json_field(const char* key, T Struct::* member, bool required = false) noexcept
+    {
+        return { key, member, required };
+    }
+
+    namespace details
+    {
+        template <typename T>
+        constexpr bool json_dependent_false = false;
+
+        template <typename T, typename = void>
+        struct has_json_fields : std::false_type {};
+
+        template <typename T>
+        struct has_json_fields<T, std::void_t<decltype(T::json_fields())>> : std::true_type {};
+
+        template <typename T>
+        struct is_json_optional : std::false_type {};
+
+        template <typename T>
+        struct is_json_optional<std::optional<T>> : std::true_type {};
+
+        template <typename T>
+        struct is_json_vector : std::false_type {};
+
+        template <typename T, typename Alloc>
+        struct is_json_vector<std::vector<T, Alloc>> : std::true_type {};
+    }
+
+    template <typename T>
+    void json_bind(const json_value& value, T& result);
+
+    template <typename Struct, typename T>
+    void json_bind_field(const json_object& object, Struct& result, const json_field_descriptor<Struct, T>& field)
+    {
+        if (auto value = object.try_get(field.key))
+        {
+            json_bind(*value, result.*(field.member));
+        }
+        else if (field.required)
+        {
+            auto message = std::string{ "Key '" } + field.key + "' does not exist in the JSON object";
+            throw std::out_of_range(message);
+        }
+    }
+
+    template <typename T>
+    void json_bind(const json_value& value, T& result)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            result = value.as_boolean().get();
+        }
+        else if constexpr (std::is_arithmetic_v<T>)
+        {
+            result = value.as_number().get<T>();
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            result = value.as_string().string();
+        }
+        else if constexpr (std::is_same_v<T, std::wstring>)
+        {
+            result = value.as_string().wstring();
+        }
+        else if constexpr (details::is_json_optional<T>::value)
+        {
+            if (value.try_as_null())
+            {
+                result.reset();
+            }
+            else
+            {
+                json_bind(value, result.emplace());
+            }
+        }
+        else if constexpr (details::is_json_vector<T>::value)
+        {
+            auto& array = value.as_array();
+            result.clear();
+            result.resize(array.size());
+            for (unsigned i = 0; i < array.size(); ++i)
+            {
+                json_bind(array.get_at(i), result[i]);
+            }
+        }
+        else if constexpr (details::has_json_fields<T>::value)
+        {
+            auto& object = value.as_object();
+            std::apply([&](const auto&... fields)
+            {
+                (json_bind_field(object, result, fields), ...);
+            }, T::json_fields());
+        }
+        else
+        {
+            static_assert(details::json_dependent_false<T>, "Type cannot be bound to JSON; did you forget json_fields?");
+        }
+    }
+
+    template <typename T>
+    T json_bind(const json_value& value)
+    {
+        T result{};
+        json_bind(value, result);
+        return result;
+    }
 }
@@ -12,6 +12,7 @@ namespace psf
 #ifdef _M_IX86
     // 32-bit
     constexpr wchar_t runtime_dll_name[] = L"PsfRuntime32.dll";
+    constexpr wchar_t other_runtime_dll_name[] = L"PsfRuntime64.dll";
 
     // 32-bit binaries should invoke the 64-bit version of PsfRunDll
     constexpr char run_dll_name[] = "PsfRunDll64.exe";
@@ -20,8 +21,10 @@ namespace psf
     constexpr char arch_string[] = "32";
     constexpr wchar_t warch_string[] = L"32";
 #else
-    // 64 bit
+    // 64 bit, which for ARM64 builds means ARM64. Their 64-bit binaries can't be loaded into the x64 processes that ARM64
+    // devices run under emulation, so the PSF Runtime leaves those be
     constexpr wchar_t runtime_dll_name[] = L"PsfRuntime64.dll";
+    constexpr wchar_t other_runtime_dll_name[] = L"PsfRuntime32.dll";
 
     // 64-bit binaries should invoke the 32-bit version of PsfRunDll
     constexpr char run_dll_name[] = "PsfRunDll32.exe";
@@ -30,4 +33,13 @@ namespace psf
     constexpr char arch_string[] = "64";
     constexpr wchar_t warch_string[] = L"64";
 #endif
+
+    // Set by PsfLauncher for the processes it starts: when it started, and when it created the process, as two
+    // QueryPerformanceCounter values separated by a semicolon. Read, and then removed, by the PSF Runtime in the child
+    constexpr wchar_t launcher_timestamps_variable[] = L"PSF_LAUNCHER_TIMESTAMPS";
+
+    // Set by PsfLauncher for the application it starts when its "resourcePolicy" has settings that Windows doesn't carry
+    // over from a process to the processes that it creates, as written by psf::process_policy::to_string. Left in place,
+    // so that the PSF Runtime of each process in the tree applies them to the processes that it creates in turn
+    constexpr wchar_t process_policy_variable[] = L"PSF_PROCESS_POLICY";
 }
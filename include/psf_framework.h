@@ -5,11 +5,17 @@
 #pragma once
 
 #include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <windows.h>
 
 #include "psf_runtime.h"
+#include "utilities.h"
 #include "win32_error.h"
 
 // Sections where the detour mappings are stored so that DllMain can enumerate through them
@@ -22,6 +28,8 @@
 #pragma section("psf$m", read)
 #pragma section("psf$z", read)
 
+extern "C" IMAGE_DOS_HEADER __ImageBase;
+
 namespace psf
 {
     // Representation of the mapping from target function -> detoured function. This is used by DllMain when calling
@@ -36,6 +44,15 @@ namespace psf
         Func& Target;
         Func Detour;
         bool Registered = false;
+        const char* Group = nullptr; // See DECLARE_GROUPED_FIXUP
+
+        // When CPU accounting is on, 'AccountedDetour' is registered in place of 'Detour', with 'AccountedImpl' as where
+        // the detoured function is kept in place of 'Target', which then points to 'AccountedTarget' instead; see
+        // PSFCpuAccountingEnabled. All null for detours whose signature can't be wrapped
+        Func AccountedDetour = nullptr;
+        Func AccountedTarget = nullptr;
+        Func* AccountedImpl = nullptr;
+        bool Accounted = false;
     };
 
     namespace details
@@ -47,9 +64,172 @@ namespace psf
             void*& Target;
             void* Detour;
             bool Registered;
+            const char* Group;
+            void* AccountedDetour;
+            void* AccountedTarget;
+            void** AccountedImpl;
+            bool Accounted;
         };
         static_assert(sizeof(detour_pair<void(*)()>) == sizeof(detour_function_pair));
 
+        // Switches which dll the thread's cycles are charged to for the lifetime of the object
+        class cpu_accounting_scope
+        {
+        public:
+            cpu_accounting_scope(HMODULE module, bool isCall) noexcept :
+                m_previous(::PSFCpuAccountingSwitch(module, isCall))
+            {
+            }
+
+            cpu_accounting_scope(const cpu_accounting_scope&) = delete;
+            cpu_accounting_scope& operator=(const cpu_accounting_scope&) = delete;
+
+            ~cpu_accounting_scope()
+            {
+                ::PSFCpuAccountingSwitch(m_previous, false);
+            }
+
+        private:
+            HMODULE m_previous;
+        };
+
+        // The wrappers of the 'Fixup' detour of a function of type 'Func' that CPU accounting registers: 'detour' charges
+        // the dll for the time spent in 'Fixup', and 'target', which calls the function that 'Fixup' detours, stops
+        // charging for as long as that function runs. Functions that can't be forwarded to, e.g. variadic ones, are
+        // left unwrapped
+        template <typename Func, Func Fixup>
+        struct accounted_detour
+        {
+            static constexpr Func detour = nullptr;
+            static constexpr Func target = nullptr;
+            static constexpr Func* impl = nullptr;
+        };
+
+#define PSF_DEFINE_ACCOUNTED_DETOUR(CallingConvention) \
+        template <typename Result, typename... Args, Result (CallingConvention* Fixup)(Args...)> \
+        struct accounted_detour<Result (CallingConvention*)(Args...), Fixup> \
+        { \
+            using func_type = Result (CallingConvention*)(Args...); \
+            static inline func_type impl_fn = nullptr; \
+            static Result CallingConvention detour_fn(Args... args) \
+            { \
+                cpu_accounting_scope scope(reinterpret_cast<HMODULE>(&__ImageBase), true); \
+                return Fixup(std::forward<Args>(args)...); \
+            } \
+            static Result CallingConvention target_fn(Args... args) \
+            { \
+                cpu_accounting_scope scope(nullptr, false); \
+                return impl_fn(std::forward<Args>(args)...); \
+            } \
+            static constexpr func_type detour = &detour_fn; \
+            static constexpr func_type target = &target_fn; \
+            static constexpr func_type* impl = &impl_fn; \
+        };
+
+        PSF_DEFINE_ACCOUNTED_DETOUR(__stdcall)
+#if defined(_M_IX86)
+        // Everywhere else, there is only the one calling convention
+        PSF_DEFINE_ACCOUNTED_DETOUR(__cdecl)
+#endif
+#undef PSF_DEFINE_ACCOUNTED_DETOUR
+
+        // An ANSI string argument converted the way that the ANSI Win32 functions convert their arguments themselves: with
+        // the code page that the file functions use, and with characters that have no mapping replaced rather than failing
+        // the call. As with wide_argument_string_with_small_buffer, strings shorter than MAX_PATH are converted into the
+        // object itself, so it is only meant to be used as a temporary
+        class widened_ansi_argument
+        {
+        public:
+            widened_ansi_argument(const char* str, UINT codePage)
+            {
+                if (!str)
+                {
+                    return;
+                }
+
+                // No code page produces more UTF-16 characters than the number of bytes it was given
+                auto length = std::strlen(str);
+                auto buffer = m_smallBuffer;
+                if (length >= std::size(m_smallBuffer))
+                {
+                    m_buffer.resize(length);
+                    buffer = m_buffer.data();
+                }
+
+                // The ASCII prefix can't end within a multi-byte character, since lead bytes are never ASCII
+                auto converted = ::details::widen_ascii(str, length, buffer);
+                if (converted < length)
+                {
+                    auto remaining = static_cast<int>(length - converted);
+                    converted += ::MultiByteToWideChar(codePage, 0, str + converted, remaining, buffer + converted, remaining);
+                }
+
+                buffer[converted] = L'\0';
+                m_value = buffer;
+            }
+
+            widened_ansi_argument(const widened_ansi_argument&) = delete;
+            widened_ansi_argument& operator=(const widened_ansi_argument&) = delete;
+
+            const wchar_t* get() const noexcept
+            {
+                return m_value;
+            }
+
+        private:
+            const wchar_t* m_value = nullptr;
+            wchar_t m_smallBuffer[MAX_PATH];
+            std::wstring m_buffer;
+        };
+
+        inline widened_ansi_argument widen_ansi_argument(const char* str, UINT codePage)
+        {
+            return widened_ansi_argument{ str, codePage };
+        }
+
+        inline const wchar_t* unwrap_argument(const widened_ansi_argument& arg) noexcept
+        {
+            return arg.get();
+        }
+
+        // Everything that isn't an ANSI string is passed on as it is
+        template <typename T>
+        inline T widen_ansi_argument(T value, UINT) noexcept
+        {
+            return value;
+        }
+
+        template <typename T>
+        inline T unwrap_argument(T value) noexcept
+        {
+            return value;
+        }
+
+        // The ANSI detour that DECLARE_WIDENED_STRING_FIXUP registers for a function of type 'Func': it converts each of
+        // the ANSI string arguments once and calls 'WideFixup' with them, along with the rest of the arguments as they are
+        template <typename Func, auto WideFixup>
+        struct widening_detour
+        {
+            static_assert(std::is_same_v<Func, void>, "Cannot forward to the wide fixup from a function of this type");
+        };
+
+#define PSF_DEFINE_WIDENING_DETOUR(CallingConvention) \
+        template <typename Result, typename... Args, auto WideFixup> \
+        struct widening_detour<Result (CallingConvention*)(Args...), WideFixup> \
+        { \
+            static Result CallingConvention detour(Args... args) \
+            { \
+                auto codePage = ::AreFileApisANSI() ? CP_ACP : CP_OEMCP; \
+                return WideFixup(unwrap_argument(widen_ansi_argument(args, codePage))...); \
+            } \
+        };
+
+        PSF_DEFINE_WIDENING_DETOUR(__stdcall)
+#if defined(_M_IX86)
+        PSF_DEFINE_WIDENING_DETOUR(__cdecl)
+#endif
+#undef PSF_DEFINE_WIDENING_DETOUR
+
         inline __declspec(allocate("psf$a")) detour_function_pair* const fixups_begin_v = nullptr;
         inline __declspec(allocate("psf$z")) detour_function_pair* const fixups_end_v = nullptr;
 
@@ -58,16 +238,46 @@ namespace psf
         inline const auto fixups_end = &fixups_end_v;
     }
 
-    inline void attach_all()
+    // Attaches all detours that are not part of a group, along with those of every group for which 'shouldAttach' returns
+    // true. Detours of groups that are left out cost nothing, which matters for fixups that hook large API families. All
+    // of them are handed to PSFRegisterMany at once, which is cheaper than registering each on its own
+    template <typename Pred>
+    inline void attach_all(Pred&& shouldAttach)
     {
-        std::for_each(details::fixups_begin, details::fixups_end, [](details::detour_function_pair* target)
+        auto accounting = ::PSFCpuAccountingEnabled();
+        std::vector<details::detour_function_pair*> targets;
+        std::vector<detour_registration> registrations;
+        std::for_each(details::fixups_begin, details::fixups_end, [&](details::detour_function_pair* target)
         {
-            if (target && !target->Registered)
+            if (target && !target->Registered && (!target->Group || shouldAttach(target->Group)))
             {
-                check_win32(::PSFRegister(&target->Target, target->Detour));
-                target->Registered = true;
+                targets.push_back(target);
+                if (accounting && target->AccountedDetour && !target->Accounted)
+                {
+                    // The detour calls through 'Target', which must stop charging it while the detoured function runs.
+                    // The trampoline is only written to 'AccountedImpl' once the transaction commits; until then, that
+                    // is the function itself. Stays this way once detached, so that attaching again doesn't wrap twice
+                    *target->AccountedImpl = target->Target;
+                    target->Target = target->AccountedTarget;
+                    target->Accounted = true;
+                }
+
+                registrations.push_back(target->Accounted ?
+                    detour_registration{ target->AccountedImpl, target->AccountedDetour } :
+                    detour_registration{ &target->Target, target->Detour });
             }
         });
+
+        check_win32(::PSFRegisterMany(registrations.data(), static_cast<unsigned>(registrations.size())));
+        for (auto target : targets)
+        {
+            target->Registered = true;
+        }
+    }
+
+    inline void attach_all()
+    {
+        attach_all([](const char*) { return true; });
     }
 
     inline void detach_all()
@@ -76,8 +286,16 @@ namespace psf
         {
             if (target && target->Registered)
             {
-                // Best effort; ignore failures since there's not much we can do
-                ::PSFUnregister(&target->Target, target->Detour);
+                // Best effort; ignore failures since there's not much we can do. 'Target' of an accounted detour keeps
+                // calling through 'AccountedImpl', which goes back to the function itself once the transaction commits
+                if (target->Accounted)
+                {
+                    ::PSFUnregister(target->AccountedImpl, target->AccountedDetour);
+                }
+                else
+                {
+                    ::PSFUnregister(&target->Target, target->Detour);
+                }
                 target->Registered = false;
             }
         });
@@ -168,14 +386,58 @@ namespace psf
 #define PSF_LINKER_INCLUDE(Name) __pragma(comment(linker, "/include:" #Name))
 #endif
 
+// The AccountedDetour, AccountedTarget and AccountedImpl of a detour_pair
+#define PSF_ACCOUNTED_DETOUR(Func, DetouredFunc) \
+    psf::details::accounted_detour<Func, DetouredFunc>::detour, \
+    psf::details::accounted_detour<Func, DetouredFunc>::target, \
+    psf::details::accounted_detour<Func, DetouredFunc>::impl
+
 #define DECLARE_FIXUP(TargetFunc, DetouredFunc) \
-    static psf::detour_pair<decltype(TargetFunc)> DetouredFunc##_Fixup{ TargetFunc, DetouredFunc }; \
+    static psf::detour_pair<decltype(TargetFunc)> DetouredFunc##_Fixup{ TargetFunc, DetouredFunc, false, nullptr, \
+        PSF_ACCOUNTED_DETOUR(decltype(TargetFunc), DetouredFunc) }; \
     extern "C" __declspec(allocate("psf$m")) auto DetouredFunc##_Fixup_v = &DetouredFunc##_Fixup; \
     PSF_LINKER_INCLUDE(DetouredFunc##_Fixup_v)
 
 #define DECLARE_STRING_FIXUP(StringFunctions, DetouredFunc) \
-    static psf::detour_pair<decltype(StringFunctions.ansi)> DetouredFunc##Ansi_Fixup{ StringFunctions.ansi, DetouredFunc<char> }; \
-    static psf::detour_pair<decltype(StringFunctions.wide)> DetouredFunc##Wide_Fixup{ StringFunctions.wide, DetouredFunc<wchar_t> }; \
+    static psf::detour_pair<decltype(StringFunctions.ansi)> DetouredFunc##Ansi_Fixup{ StringFunctions.ansi, DetouredFunc<char>, false, nullptr, \
+        PSF_ACCOUNTED_DETOUR(decltype(StringFunctions.ansi), DetouredFunc<char>) }; \
+    static psf::detour_pair<decltype(StringFunctions.wide)> DetouredFunc##Wide_Fixup{ StringFunctions.wide, DetouredFunc<wchar_t>, false, nullptr, \
+        PSF_ACCOUNTED_DETOUR(decltype(StringFunctions.wide), DetouredFunc<wchar_t>) }; \
+    extern "C" __declspec(allocate("psf$m")) auto DetouredFunc##Ansi_Fixup_v = &DetouredFunc##Ansi_Fixup; \
+    extern "C" __declspec(allocate("psf$m")) auto DetouredFunc##Wide_Fixup_v = &DetouredFunc##Wide_Fixup; \
+    PSF_LINKER_INCLUDE(DetouredFunc##Ansi_Fixup_v) \
+    PSF_LINKER_INCLUDE(DetouredFunc##Wide_Fixup_v)
+
+// Same as DECLARE_STRING_FIXUP, except that only DetouredFunc<wchar_t> is instantiated. The ANSI function is detoured by
+// a wrapper that converts the ANSI strings among its arguments once, into buffers on the stack for all but the longest
+// of them, and then calls the wide fixup, so that there is a single copy of the fixup's code and ANSI callers pay for no
+// more than the one conversion. Only for functions whose ANSI and wide variants take the same arguments other than
+// 'const char*' for 'const wchar_t*', i.e. with no ANSI output buffers or structures, and which convert their strings
+// with the file functions' code page. The wide fixup then calls the wide function for ANSI callers too
+#define DECLARE_WIDENED_STRING_FIXUP(StringFunctions, DetouredFunc) \
+    using DetouredFunc##Ansi_Widening = psf::details::widening_detour<decltype(StringFunctions.ansi), &DetouredFunc<wchar_t>>; \
+    static psf::detour_pair<decltype(StringFunctions.ansi)> DetouredFunc##Ansi_Fixup{ StringFunctions.ansi, DetouredFunc##Ansi_Widening::detour, \
+        false, nullptr, PSF_ACCOUNTED_DETOUR(decltype(StringFunctions.ansi), DetouredFunc##Ansi_Widening::detour) }; \
+    static psf::detour_pair<decltype(StringFunctions.wide)> DetouredFunc##Wide_Fixup{ StringFunctions.wide, DetouredFunc<wchar_t>, false, nullptr, \
+        PSF_ACCOUNTED_DETOUR(decltype(StringFunctions.wide), DetouredFunc<wchar_t>) }; \
+    extern "C" __declspec(allocate("psf$m")) auto DetouredFunc##Ansi_Fixup_v = &DetouredFunc##Ansi_Fixup; \
+    extern "C" __declspec(allocate("psf$m")) auto DetouredFunc##Wide_Fixup_v = &DetouredFunc##Wide_Fixup; \
+    PSF_LINKER_INCLUDE(DetouredFunc##Ansi_Fixup_v) \
+    PSF_LINKER_INCLUDE(DetouredFunc##Wide_Fixup_v)
+
+// Same as DECLARE_FIXUP and DECLARE_STRING_FIXUP, but the detours belong to the named group, which the fixup may choose
+// not to attach; see the psf::attach_all overload that takes a predicate
+#define DECLARE_GROUPED_FIXUP(Group, TargetFunc, DetouredFunc) \
+    static psf::detour_pair<decltype(TargetFunc)> DetouredFunc##_Fixup{ TargetFunc, DetouredFunc, false, Group, \
+        PSF_ACCOUNTED_DETOUR(decltype(TargetFunc), DetouredFunc) }; \
+    extern "C" __declspec(allocate("psf$m")) auto DetouredFunc##_Fixup_v = &DetouredFunc##_Fixup; \
+    PSF_LINKER_INCLUDE(DetouredFunc##_Fixup_v)
+
+#define DECLARE_GROUPED_STRING_FIXUP(Group, StringFunctions, DetouredFunc) \
+    static psf::detour_pair<decltype(StringFunctions.ansi)> DetouredFunc##Ansi_Fixup{ StringFunctions.ansi, DetouredFunc<char>, false, Group, \
+        PSF_ACCOUNTED_DETOUR(decltype(StringFunctions.ansi), DetouredFunc<char>) }; \
+    static psf::detour_pair<decltype(StringFunctions.wide)> DetouredFunc##Wide_Fixup{ StringFunctions.wide, DetouredFunc<wchar_t>, false, Group, \
+        PSF_ACCOUNTED_DETOUR(decltype(StringFunctions.wide), DetouredFunc<wchar_t>) }; \
     extern "C" __declspec(allocate("psf$m")) auto DetouredFunc##Ansi_Fixup_v = &DetouredFunc##Ansi_Fixup; \
     extern "C" __declspec(allocate("psf$m")) auto DetouredFunc##Wide_Fixup_v = &DetouredFunc##Wide_Fixup; \
     PSF_LINKER_INCLUDE(DetouredFunc##Ansi_Fixup_v) \
@@ -204,12 +466,20 @@ catch (...)
     return win32_from_caught_exception();
 }
 
+// Nothing is buffered, so there is nothing to persist when the process exits
+int __stdcall PSFFlush() noexcept
+{
+    return ERROR_SUCCESS;
+}
+
 #ifdef _M_IX86
 #pragma comment(linker, "/EXPORT:PSFInitialize=_PSFInitialize@0")
 #pragma comment(linker, "/EXPORT:PSFUninitialize=_PSFUninitialize@0")
+#pragma comment(linker, "/EXPORT:PSFFlush=_PSFFlush@0")
 #else
 #pragma comment(linker, "/EXPORT:PSFInitialize=PSFInitialize")
 #pragma comment(linker, "/EXPORT:PSFUninitialize=PSFUninitialize")
+#pragma comment(linker, "/EXPORT:PSFFlush=PSFFlush")
 #endif
 
 }
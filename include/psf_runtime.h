@@ -4,6 +4,11 @@
 //-------------------------------------------------------------------------------------------------------
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
 #include <windows.h>
 
 #include "psf_config.h"
@@ -20,6 +25,115 @@
 using PSFInitializeProc = int (__stdcall *)() noexcept;
 using PSFUninitializeProc = int (__stdcall *)() noexcept;
 
+// Optional fixup export, called after the fixup is loaded and before PSFInitialize, but outside of any transaction and,
+// when the process loads its fixups in parallel, on a thread of its own. Must not call PSFRegister
+using PSFPreInitializeProc = int (__stdcall *)() noexcept;
+
+// Optional fixup export, called in place of PSFUninitialize when the process is exiting. Should only persist what would
+// otherwise be lost, e.g. buffered writes and statistics, since the detours stay attached and the dll is never freed.
+// Fixups that don't export it are uninitialized as usual
+using PSFFlushProc = int (__stdcall *)() noexcept;
+
+// Background work submitted through PSFSubmitWork
+using PSFWorkProc = void (__stdcall *)(void* context) noexcept;
+
+namespace psf
+{
+    // When a phase of the PSF Runtime's startup began and ended, as QueryPerformanceCounter values. Both are zero for
+    // phases that haven't happened (yet)
+    struct startup_phase
+    {
+        std::int64_t start;
+        std::int64_t end;
+    };
+
+    struct startup_fixup_timings
+    {
+        const wchar_t* dll; // As configured
+        startup_phase load; // LoadLibrary, along with finding the dll if it isn't at the package root
+        startup_phase pre_initialize; // PSFPreInitialize, if the fixup exports it
+        startup_phase initialize; // PSFInitialize
+        startup_phase commit; // Shared by all fixups that were initialized within the same transaction
+    };
+
+    struct startup_timings
+    {
+        std::int64_t frequency; // QueryPerformanceCounter ticks per second
+        startup_phase config_read; // Finding and opening config.json, or mapping the compiled config
+        startup_phase config_parse; // Parsing config.json, and finding the configuration of the current executable
+        startup_phase runtime_attach; // The PSF Runtime's own detours, including the transaction commit
+        startup_phase fixups; // All of load_fixups, which runs just before the application's entry point
+        const startup_fixup_timings* fixup_timings; // In the order that the fixups are configured
+        unsigned fixup_count;
+
+        // When PsfLauncher started, and when it created this process. Both are zero for processes that PsfLauncher didn't
+        // start. QueryPerformanceCounter values are comparable across processes
+        std::int64_t launcher_start;
+        std::int64_t launcher_create_process;
+    };
+
+    // One of the detours given to PSFRegisterMany; the same as the arguments to PSFRegister
+    struct detour_registration
+    {
+        void** impl_fn;
+        void* fixup_fn;
+    };
+
+    // The heap allocations made while one detour ran, counting those of the functions that it calls, but not those of
+    // other detours that it calls into. Reallocations count as allocations of their new size
+    struct allocation_statistics
+    {
+        const void* fixup_fn; // As given to PSFRegister; null for allocations made outside of any detour
+        const void* target_fn; // The function that the detour replaces, as it was before being detoured
+        std::uint64_t allocations;
+        std::uint64_t bytes;
+    };
+
+    // The cycles spent in the detours of one dll, not counting those spent in the functions that they detour; see
+    // PSFQueryCpuAccounting
+    struct cpu_accounting_statistics
+    {
+        HMODULE module;
+        std::uint64_t cycles; // As counted by ReadTimeStampCounter
+        std::uint64_t calls;
+    };
+
+    // When the current executable's config sets "metrics", the counters that are registered through PSFRegisterMetric
+    // are published in a shared memory section named metrics_section_prefix followed by the process id in decimal, e.g.
+    // "Local\PsfMetrics-1234", for PsfShimMonitor or any other collector to poll. The section holds a metrics_header,
+    // followed by 'capacity' entries of 'entry_size' bytes each. 'count' only ever grows, and an entry's name is written
+    // before 'count' grows past it. Each value is updated atomically on its own, but the values aren't a consistent set
+    constexpr wchar_t metrics_section_prefix[] = L"Local\\PsfMetrics-";
+    constexpr std::uint32_t metrics_layout_version = 1;
+
+    struct metrics_header
+    {
+        std::uint32_t version; // metrics_layout_version; readers should ignore sections of versions that they don't know
+        std::uint32_t header_size; // Where the first entry starts
+        std::uint32_t entry_size;
+        std::uint32_t capacity;
+        volatile std::uint32_t count;
+        std::uint32_t process_id;
+        std::int64_t frequency; // QueryPerformanceCounter ticks per second, for the metrics that are durations
+        std::int64_t created; // QueryPerformanceCounter value from when the section was created
+        std::uint8_t reserved[24];
+    };
+
+    struct metric_entry
+    {
+        char name[56]; // Null terminated, and by convention "<component>.<metric>", e.g. "FileRedirectionFixup.redirects"
+        volatile std::int64_t value;
+    };
+
+    // Which work submitted through PSFSubmitWork the thread pool starts first, when there's more than it has threads for
+    enum class work_priority : std::uint32_t
+    {
+        high, // Work that the application may soon be waiting for, e.g. copying files that it's about to write
+        normal,
+        low, // Work that only makes later calls faster, e.g. building indices
+    };
+}
+
 // PsfRuntime exports
 // NOTE: Unless stated otherwise, all memory returned is allocated by the PsfRuntime and remains valid so long as the
 //       dll is loaded.
@@ -29,6 +143,11 @@ extern "C" {
 PSFAPI DWORD __stdcall PSFRegister(_Inout_ void** implFn, _In_ void* fixupFn) noexcept;
 PSFAPI DWORD __stdcall PSFUnregister(_Inout_ void** implFn, _In_ void* fixupFn) noexcept;
 
+// Same as calling PSFRegister for each of the detours, except that they are attached in the order of their targets'
+// addresses. Targets in the same module then share trampoline regions and page protection changes, which is cheaper for
+// fixups with many detours. Stops at, and returns, the first failure
+PSFAPI DWORD __stdcall PSFRegisterMany(_In_reads_(count) const psf::detour_registration* detours, unsigned count) noexcept;
+
 // Simplifications around the package query API from appmodel.h
 // NOTE: These functions are guaranteed to succeed as PsfRuntime will fail to load if they can't be set (e.g. when
 //       running outside of a package)
@@ -38,6 +157,17 @@ PSFAPI const wchar_t* __stdcall PSFQueryApplicationId() noexcept;
 PSFAPI const wchar_t* __stdcall PSFQueryPackageRootPath() noexcept;
 PSFAPI const wchar_t* __stdcall PSFQueryFinalPackageRootPath() noexcept;
 
+// Same as psf::known_folder (without any flags), except that each folder is only looked up once per process and the
+// result is shared by all of the fixups. Returns null if the folder could not be found
+PSFAPI const wchar_t* __stdcall PSFQueryKnownFolder(_In_ const GUID& id) noexcept;
+
+// Replaces the %MsixPackageRoot% and %MsixWritablePackageRoot% pseudo-variables in 'input' - along with environment
+// variables, when 'expandEnvironment' is set - in a single pass over the string. The values of the pseudo-variables are
+// only worked out once per process, and, like ExpandEnvironmentStrings, references to variables that aren't set are left
+// as they are. Fills in 'buffer' when the result fits in 'capacity' characters, including the null terminator, and
+// returns the number of characters that the result needs, including the null terminator. Returns 0 if an error occurred
+PSFAPI DWORD __stdcall PSFExpandVariables(_In_ const wchar_t* input, bool expandEnvironment, _Out_writes_opt_(capacity) wchar_t* buffer, DWORD capacity) noexcept;
+
 PSFAPI const psf::json_value* __stdcall PSFQueryConfigRoot() noexcept;
 
 PSFAPI const psf::json_object* __stdcall PSFQueryAppLaunchConfig(_In_ const wchar_t* applicationId, bool verbose) noexcept;
@@ -59,4 +189,145 @@ inline const psf::json_value* PSFQueryCurrentDllConfig()
 
 PSFAPI void __stdcall PSFReportError(const wchar_t* error) noexcept;
 
+// Where the time went while the PSF Runtime started up in the current process. The fixup timings are only filled in once
+// all fixups have been loaded; the same timings are also written as a single "StartupTimings" event to the
+// Microsoft.Windows.PSFRuntime ETW provider at that point
+PSFAPI const psf::startup_timings* __stdcall PSFQueryStartupTimings() noexcept;
+
+// The TLS slot that holds the state of every psf::shared_reentrancy_guard on each thread; see reentrancy_guard.h. The
+// slot is allocated before any fixup is loaded, and is always one that lives in the TEB, i.e. less than
+// TLS_MINIMUM_AVAILABLE. Returns TLS_OUT_OF_INDEXES if no such slot was available
+PSFAPI DWORD __stdcall PSFQueryReentrancySlot() noexcept;
+
+// When the current executable's config sets "allocationTracking", the heap allocations of the PSF Runtime and of its
+// fixups are counted for each detour. Fills in up to 'capacity' entries, the first of which is the allocations made
+// outside of any detour, and returns how many there are. Returns 0 when allocation tracking is off
+PSFAPI unsigned __stdcall PSFQueryAllocationStatistics(_Out_writes_opt_(capacity) psf::allocation_statistics* statistics, unsigned capacity) noexcept;
+
+// When the current executable's config sets "cpuAccounting", psf::attach_all registers each detour through a thin
+// wrapper that charges the cycles spent in it to the dll that it's in, and that stops charging while the detour calls
+// the function that it detours through its impl pointer. Returns false otherwise
+PSFAPI bool __stdcall PSFCpuAccountingEnabled() noexcept;
+
+// Used by those wrappers. Charges the cycles that the thread has spent since its last switch to the dll that it ran the
+// code of, if any, and charges those from now on to 'module', or to no one when 'module' is null. Counts a call of
+// 'module' when 'isCall' is set. Returns the dll that was charged until now, for switching back to it
+PSFAPI HMODULE __stdcall PSFCpuAccountingSwitch(_In_opt_ HMODULE module, bool isCall) noexcept;
+
+// Fills in up to 'capacity' entries, one for each dll that has been charged for any detour, with the totals of all
+// threads, and returns how many there are. The same totals are also written to the debug output, and as "FixupCpuCycles"
+// events to the Microsoft.Windows.PSFRuntime ETW provider, when the PSF Runtime unloads. Returns 0 when CPU accounting
+// is off
+PSFAPI unsigned __stdcall PSFQueryCpuAccounting(_Out_writes_opt_(capacity) psf::cpu_accounting_statistics* statistics, unsigned capacity) noexcept;
+
+// Adds a counter named 'name' to the published metrics (see psf::metrics_header), or returns the existing counter of that
+// name, and returns where its value lives. Names longer than fit in psf::metric_entry are truncated. Returns null when
+// metrics aren't published, or when all of the entries are in use. Meant to be called from the fixups' static
+// initialization, with the values then updated through psf::metric_counter
+PSFAPI volatile std::int64_t* __stdcall PSFRegisterMetric(_In_ const char* name) noexcept;
+
+// Runs 'callback' with 'context' on the process's thread pool, so that fixups don't each need threads of their own for
+// their background work. When the PSF Runtime unloads, before any fixup is freed, work that hasn't started yet is
+// cancelled - 'callback' is then never called - and work that has is waited for, so work must not wait on anything that
+// needs the loader lock. Returns false, with the last error set, if the work couldn't be submitted, in which case the
+// caller should do the work some other way
+PSFAPI bool __stdcall PSFSubmitWork(_In_ PSFWorkProc callback, _In_opt_ void* context, psf::work_priority priority) noexcept;
+
+}
+
+namespace psf
+{
+    inline std::wstring expand_variables(_In_ const wchar_t* input, bool expandEnvironment = true)
+    {
+        std::wstring result(MAX_PATH, L'\0');
+        while (true)
+        {
+            // NOTE: The null terminator that std::wstring keeps past the end may be overwritten with another null
+            auto size = ::PSFExpandVariables(input, expandEnvironment, result.data(), static_cast<DWORD>(result.size() + 1));
+            if (size == 0)
+            {
+                throw_last_error();
+            }
+
+            auto fits = (size <= result.size() + 1);
+            result.resize(size - 1);
+            if (fits)
+            {
+                return result;
+            }
+        }
+    }
+
+    // Runs 'work', a callable that must not throw, through PSFSubmitWork, or on a thread of its own if it couldn't be
+    // submitted. Work that the PSF Runtime cancels is never run, and whatever it holds is never freed
+    template <typename Fn>
+    inline void submit_work(Fn&& work, work_priority priority)
+    {
+        using work_type = std::decay_t<Fn>;
+        auto state = std::make_unique<work_type>(std::forward<Fn>(work));
+        auto run = [](void* context) noexcept
+        {
+            std::unique_ptr<work_type> submitted(static_cast<work_type*>(context));
+            (*submitted)();
+        };
+        if (::PSFSubmitWork(run, state.get(), priority))
+        {
+            state.release();
+            return;
+        }
+
+        std::thread([state = std::move(state)]() noexcept
+        {
+            (*state)();
+        }).detach();
+    }
+
+    // One of the published metrics; see PSFRegisterMetric. Costs no more than a branch when metrics aren't published.
+    // Meant to have static storage duration
+    class metric_counter
+    {
+    public:
+        explicit metric_counter(_In_ const char* name) noexcept :
+            m_value(::PSFRegisterMetric(name))
+        {
+        }
+
+        metric_counter(const metric_counter&) = delete;
+        metric_counter& operator=(const metric_counter&) = delete;
+
+        void add(std::int64_t value) noexcept
+        {
+            if (m_value)
+            {
+                ::InterlockedExchangeAdd64(reinterpret_cast<volatile LONG64*>(m_value), value);
+            }
+        }
+
+        void increment() noexcept
+        {
+            if (m_value)
+            {
+                ::InterlockedIncrement64(reinterpret_cast<volatile LONG64*>(m_value));
+            }
+        }
+
+        // For time spent, as QueryPerformanceCounter ticks; see psf::metrics_header::frequency
+        void add_ticks_since(std::int64_t start) noexcept
+        {
+            if (m_value)
+            {
+                LARGE_INTEGER now;
+                ::QueryPerformanceCounter(&now);
+                add(now.QuadPart - start);
+            }
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_value != nullptr;
+        }
+
+    private:
+        volatile std::int64_t* m_value;
+    };
 }
@@ -12,10 +12,20 @@
 //          if (guard) { /*fixup code here*/ }
 //          return FooImpl();
 //      }
+//
+// Fixups that guard all of their functions with one guard should prefer 'shared_reentrancy_guard', which isn't declared
+// 'thread_local' at all. Its state lives in a TLS slot owned by the PsfRuntime and read straight from the TEB, so
+// entering it costs no TLS lookup of the fixup's own, and every fixup can see which of the others the thread is inside
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <utility>
 
+#include <windows.h>
+
+#include <psf_runtime.h>
+
 namespace psf
 {
     namespace details
@@ -56,6 +66,75 @@ namespace psf
             bool* m_target;
             bool m_restoreValue;
         };
+
+        // Same as the above, but for the whole of the thread's shared state
+        struct restore_state_on_exit
+        {
+            restore_state_on_exit(std::uintptr_t* target, std::uintptr_t restoreValue) noexcept :
+                m_target(target),
+                m_restoreValue(restoreValue)
+            {
+            }
+
+            restore_state_on_exit(const restore_state_on_exit&) = delete;
+            restore_state_on_exit& operator=(const restore_state_on_exit&) = delete;
+
+            restore_state_on_exit(restore_state_on_exit&& other) noexcept :
+                m_target(other.m_target),
+                m_restoreValue(other.m_restoreValue)
+            {
+                other.m_target = nullptr;
+            }
+
+            ~restore_state_on_exit()
+            {
+                if (m_target)
+                {
+                    *m_target = m_restoreValue;
+                }
+            }
+
+            // Reentrant calls leave the state untouched, and so have nothing to restore
+            explicit operator bool() const noexcept
+            {
+                return m_target != nullptr;
+            }
+
+        private:
+
+            std::uintptr_t* m_target;
+            std::uintptr_t m_restoreValue;
+        };
+
+        // The low bits of the state are one per fixup, as given by reentrancy_owner, and the rest count how many guards
+        // the thread has entered
+        constexpr std::uintptr_t reentrancy_owner_mask = 0xFFFF;
+        constexpr std::uintptr_t reentrancy_depth_shift = 16;
+
+        // Where the TEB keeps the first TLS_MINIMUM_AVAILABLE slots, which is what TlsGetValue reads. TlsGetValue itself
+        // isn't used since it clears the thread's last error, which fixups are expected to preserve
+#if _WIN64
+        constexpr std::size_t teb_tls_slots_offset = 0x1480;
+#else
+        constexpr std::size_t teb_tls_slots_offset = 0xE10;
+#endif
+
+        // Read once, when the fixup is loaded; TLS_OUT_OF_INDEXES if the PsfRuntime couldn't allocate a slot in the TEB
+        inline const DWORD reentrancy_slot = ::PSFQueryReentrancySlot();
+
+        // Only used when there's no shared slot, in which case each fixup only sees its own state
+        inline thread_local std::uintptr_t fallback_reentrancy_state = 0;
+
+        inline std::uintptr_t* reentrancy_state() noexcept
+        {
+            if (reentrancy_slot < TLS_MINIMUM_AVAILABLE)
+            {
+                auto slots = reinterpret_cast<std::uintptr_t*>(reinterpret_cast<std::byte*>(::NtCurrentTeb()) + teb_tls_slots_offset);
+                return slots + reentrancy_slot;
+            }
+
+            return &fallback_reentrancy_state;
+        }
     }
 
     class reentrancy_guard
@@ -72,4 +151,65 @@ namespace psf
 
         bool m_isReentrant = false;
     };
+
+    // The bit of each fixup that uses a shared_reentrancy_guard. New fixups get the next unused bit
+    enum class reentrancy_owner : std::uintptr_t
+    {
+        file_redirection = 0x0001,
+        dynamic_library = 0x0002,
+        registry = 0x0004,
+        electron = 0x0008,
+    };
+
+    class shared_reentrancy_guard
+    {
+    public:
+
+        explicit constexpr shared_reentrancy_guard(reentrancy_owner owner) noexcept :
+            m_owner(static_cast<std::uintptr_t>(owner))
+        {
+        }
+
+        details::restore_state_on_exit enter() const noexcept
+        {
+            auto state = details::reentrancy_state();
+            auto restoreValue = *state;
+            if (restoreValue & m_owner)
+            {
+                return details::restore_state_on_exit{ nullptr, restoreValue };
+            }
+
+            *state = (restoreValue | m_owner) + (std::uintptr_t{ 1 } << details::reentrancy_depth_shift);
+            return details::restore_state_on_exit{ state, restoreValue };
+        }
+
+    private:
+
+        std::uintptr_t m_owner;
+    };
+
+    // Whether the calling thread is inside a function of the given fixup, e.g. so that a fixup that the other calls into
+    // can skip work that the outer one has already done
+    inline bool reentrancy_entered(reentrancy_owner owner) noexcept
+    {
+        return (*details::reentrancy_state() & static_cast<std::uintptr_t>(owner)) != 0;
+    }
+
+    // Marks the given fixup as entered on the calling thread for as long as the result is in scope, so that its detours
+    // go straight to the native function, just as they do for reentrant calls. This is for fixups that know the other has
+    // nothing to do with a call, e.g. ElectronFixup's pipe calls, which FileRedirectionFixup never redirects, and so that
+    // the same path isn't processed twice. Only works across fixups when the PsfRuntime provided the shared slot
+    inline details::restore_state_on_exit bypass_fixup(reentrancy_owner owner) noexcept
+    {
+        auto state = details::reentrancy_state();
+        auto restoreValue = *state;
+        *state = restoreValue | static_cast<std::uintptr_t>(owner);
+        return details::restore_state_on_exit{ state, restoreValue };
+    }
+
+    // How many fixups' functions are on the calling thread's stack
+    inline unsigned reentrancy_depth() noexcept
+    {
+        return static_cast<unsigned>(*details::reentrancy_state() >> details::reentrancy_depth_shift);
+    }
 }
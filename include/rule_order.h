@@ -0,0 +1,73 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cwctype>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace psf
+{
+    // The File Redirection Fixup evaluates its rules in configuration order and uses the first one that matches. Rules
+    // that match frequently are cheaper to put first, but moving a rule ahead of another is only allowed if that can't
+    // change which rule a path matches, i.e. if the two rules would have the same effect on any path that they both
+    // match, or if no path can match both of them. This is the rule ordering shared by the fixup's adaptive mode and by
+    // PsfRuleOrderer, which rewrites a configuration from a recorded profile.
+
+    // True if neither of the two base paths is the same as, or contains, the other; no path can then be under both of
+    // them. Comparisons ignore case and the direction of separators
+    inline bool base_paths_disjoint(std::wstring_view lhs, std::wstring_view rhs) noexcept
+    {
+        auto isSeparator = [](wchar_t ch) { return (ch == L'\\') || (ch == L'/'); };
+        auto trim = [&](std::wstring_view& path) { while (!path.empty() && isSeparator(path.back())) path.remove_suffix(1); };
+        trim(lhs);
+        trim(rhs);
+
+        auto& shorter = (lhs.length() <= rhs.length()) ? lhs : rhs;
+        auto& longer = (lhs.length() <= rhs.length()) ? rhs : lhs;
+        for (std::size_t i = 0; i < shorter.length(); ++i)
+        {
+            auto a = shorter[i];
+            auto b = longer[i];
+            if (!(isSeparator(a) && isSeparator(b)) && (std::towupper(a) != std::towupper(b)))
+            {
+                return true;
+            }
+        }
+
+        return (longer.length() != shorter.length()) && !isSeparator(longer[shorter.length()]);
+    }
+
+    // Reorders 'order' - the rules' indices, in evaluation order - so that rules with more 'hits' come first. A rule is
+    // only ever moved ahead of its neighbor if 'interchangeable' says that doing so is safe, and rules for which
+    // 'isBarrier' returns true (e.g. exclusions, which rely on being found before the rules they carve an exception out
+    // of) are never moved, nor is anything moved across them. Rules with the same number of hits keep their order.
+    template <typename IsBarrier, typename Interchangeable>
+    void order_rules_by_hits(std::vector<std::size_t>& order, const std::vector<std::uint64_t>& hits, IsBarrier&& isBarrier,
+        Interchangeable&& interchangeable)
+    {
+        for (std::size_t i = 1; i < order.size(); ++i)
+        {
+            if (isBarrier(order[i]))
+            {
+                continue;
+            }
+
+            for (auto j = i; j > 0; --j)
+            {
+                auto current = order[j];
+                auto previous = order[j - 1];
+                if (isBarrier(previous) || (hits[current] <= hits[previous]) || !interchangeable(current, previous))
+                {
+                    break;
+                }
+                std::swap(order[j], order[j - 1]);
+            }
+        }
+    }
+}
@@ -6,12 +6,215 @@
 // Random functions/types that are broadly useful
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <iterator>
+#include <memory>
+#include <new>
 #include <string_view>
+#include <type_traits>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 #include "win32_error.h"
+#include "win32_result.h"
+
+namespace details
+{
+    // The whole of the Basic Multilingual Plane, folded to upper case the same way that NTFS compares names, i.e. one
+    // UTF-16 code unit at a time and without regard for the locale. Built the first time that a non-ASCII character
+    // is compared, since most strings only ever contain ASCII
+    inline const wchar_t* upcase_table() noexcept
+    {
+        static const auto table = []() noexcept
+        {
+            // NOTE: Never freed, since comparisons may still be made while the module's globals are being destroyed
+            constexpr int size = 0x10000;
+            auto identity = std::unique_ptr<wchar_t[]>(new (std::nothrow) wchar_t[size]);
+            auto result = new (std::nothrow) wchar_t[size];
+            if (!identity || !result)
+            {
+                delete[] result;
+                return static_cast<wchar_t*>(nullptr);
+            }
+
+            for (int i = 0; i < size; ++i)
+            {
+                identity[i] = static_cast<wchar_t>(i);
+            }
+
+            if (::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, identity.get(), size, result, size, nullptr, nullptr, 0) != size)
+            {
+                // Should never happen, but leaving non-ASCII characters as they are is better than not comparing
+                std::copy_n(identity.get(), size, result);
+            }
+            return result;
+        }();
+
+        return table;
+    }
+
+    template <typename CharT>
+    inline CharT fold_case(CharT ch) noexcept
+    {
+        if ((ch >= 'a') && (ch <= 'z'))
+        {
+            return static_cast<CharT>(ch - ('a' - 'A'));
+        }
+
+        if constexpr (sizeof(CharT) > 1)
+        {
+            // NOTE: Narrow strings only get ASCII folded, the same as std::tolower does in the "C" locale
+            auto value = static_cast<std::make_unsigned_t<CharT>>(ch);
+            if ((value >= 0x80) && (value <= 0xFFFF))
+            {
+                if (auto table = upcase_table())
+                {
+                    return static_cast<CharT>(table[value]);
+                }
+            }
+        }
+
+        return ch;
+    }
+
+    template <typename CharT>
+    inline int compare_folded(CharT lhs, CharT rhs) noexcept
+    {
+        using unsigned_type = std::make_unsigned_t<CharT>;
+        auto lc = static_cast<unsigned_type>(fold_case(lhs));
+        auto rc = static_cast<unsigned_type>(fold_case(rhs));
+        return (lc < rc) ? -1 : (lc > rc) ? 1 : 0;
+    }
+
+    // How many characters the vectorized compare and find look at at once. Whatever they can't decide for a block - one
+    // that holds non-ASCII characters, or the one that holds a match - is then looked at one character at a time
+#if defined(_M_IX86) || defined(_M_X64)
+    template <typename CharT>
+    constexpr std::size_t case_fold_block_size = ((sizeof(CharT) == 1) || (sizeof(CharT) == 2)) ? (sizeof(__m128i) / sizeof(CharT)) : 1;
+
+    template <typename CharT>
+    inline bool is_ascii_block(__m128i block) noexcept
+    {
+        if constexpr (sizeof(CharT) == 1)
+        {
+            return _mm_movemask_epi8(block) == 0;
+        }
+        else
+        {
+            auto high = _mm_and_si128(block, _mm_set1_epi16(static_cast<short>(0xFF80)));
+            return _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF;
+        }
+    }
+
+    // NOTE: Only valid for blocks that are all ASCII
+    template <typename CharT>
+    inline __m128i fold_ascii_block(__m128i block) noexcept
+    {
+        if constexpr (sizeof(CharT) == 1)
+        {
+            auto lower = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('z' + 1)));
+            return _mm_sub_epi8(block, _mm_and_si128(lower, _mm_set1_epi8('a' - 'A')));
+        }
+        else
+        {
+            auto lower = _mm_and_si128(_mm_cmpgt_epi16(block, _mm_set1_epi16('a' - 1)), _mm_cmplt_epi16(block, _mm_set1_epi16('z' + 1)));
+            return _mm_sub_epi16(block, _mm_and_si128(lower, _mm_set1_epi16('a' - 'A')));
+        }
+    }
+
+    template <typename CharT>
+    inline __m128i equal_block(__m128i lhs, __m128i rhs) noexcept
+    {
+        if constexpr (sizeof(CharT) == 1)
+        {
+            return _mm_cmpeq_epi8(lhs, rhs);
+        }
+        else
+        {
+            return _mm_cmpeq_epi16(lhs, rhs);
+        }
+    }
+
+    template <typename CharT>
+    inline __m128i broadcast(CharT ch) noexcept
+    {
+        if constexpr (sizeof(CharT) == 1)
+        {
+            return _mm_set1_epi8(static_cast<char>(ch));
+        }
+        else
+        {
+            return _mm_set1_epi16(static_cast<short>(ch));
+        }
+    }
+
+    // Returns the index of the first block, starting at 'index', that isn't all ASCII and equal ignoring case
+    template <typename CharT>
+    inline std::size_t skip_equal_ascii(const CharT* lhs, const CharT* rhs, std::size_t index, std::size_t count) noexcept
+    {
+        constexpr auto block_size = case_fold_block_size<CharT>;
+        if constexpr (block_size > 1)
+        {
+            for (; index + block_size <= count; index += block_size)
+            {
+                auto lb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + index));
+                auto rb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + index));
+                if (!is_ascii_block<CharT>(_mm_or_si128(lb, rb)) ||
+                    (_mm_movemask_epi8(equal_block<CharT>(fold_ascii_block<CharT>(lb), fold_ascii_block<CharT>(rb))) != 0xFFFF))
+                {
+                    break;
+                }
+            }
+        }
+
+        return index;
+    }
+
+    // Returns the index of the first block, starting at 'index', that isn't all ASCII or that holds 'folded'
+    template <typename CharT>
+    inline std::size_t skip_ascii_without(const CharT* str, std::size_t index, std::size_t count, CharT folded) noexcept
+    {
+        constexpr auto block_size = case_fold_block_size<CharT>;
+        if constexpr (block_size > 1)
+        {
+            auto target = broadcast(folded);
+            for (; index + block_size <= count; index += block_size)
+            {
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + index));
+                if (!is_ascii_block<CharT>(block) || _mm_movemask_epi8(equal_block<CharT>(fold_ascii_block<CharT>(block), target)))
+                {
+                    break;
+                }
+            }
+        }
+
+        return index;
+    }
+#else
+    template <typename CharT>
+    constexpr std::size_t case_fold_block_size = 1;
+
+    template <typename CharT>
+    inline std::size_t skip_equal_ascii(const CharT*, const CharT*, std::size_t index, std::size_t) noexcept
+    {
+        return index;
+    }
+
+    template <typename CharT>
+    inline std::size_t skip_ascii_without(const CharT*, std::size_t index, std::size_t, CharT) noexcept
+    {
+        return index;
+    }
+#endif
+}
 
+// Compares ordinally, ignoring case the way that NTFS does: ASCII letters are folded without any table lookups - 16
+// bytes at a time where SSE2 is available - and everything else in the Basic Multilingual Plane through a table of
+// the invariant locale's upper case mappings
 template <typename CharT>
 struct case_insensitive_char_traits : std::char_traits<CharT>
 {
@@ -33,45 +236,62 @@ struct case_insensitive_char_traits : std::char_traits<CharT>
     //      eof
     //      not_eof
 
-    static constexpr bool eq(char_type lhs, char_type rhs) noexcept
+    static bool eq(char_type lhs, char_type rhs) noexcept
     {
-        return std::tolower(lhs) == std::tolower(rhs);
+        return details::fold_case(lhs) == details::fold_case(rhs);
     }
 
-    static constexpr bool lt(char_type lhs, char_type rhs) noexcept
+    static bool lt(char_type lhs, char_type rhs) noexcept
     {
-        return std::tolower(lhs) < std::tolower(rhs);
+        return details::compare_folded(lhs, rhs) < 0;
     }
 
-    static constexpr int compare(const char_type* lhs, const char_type* rhs, std::size_t count) noexcept
+    static int compare(const char_type* lhs, const char_type* rhs, std::size_t count) noexcept
     {
         // NOTE: There's currently no wmemicmp/_wmemicmp function
-        char_type lc = 0, rc = 0;
-        for (; count && (lc == rc); --count)
+        std::size_t index = 0;
+        while (index < count)
         {
-            lc = static_cast<char_type>(std::tolower(*lhs++));
-            rc = static_cast<char_type>(std::tolower(*rhs++));
+            index = details::skip_equal_ascii(lhs, rhs, index, count);
+            auto blockEnd = (std::min)(count, index + details::case_fold_block_size<char_type>);
+            for (; index < blockEnd; ++index)
+            {
+                if (auto result = details::compare_folded(lhs[index], rhs[index]))
+                {
+                    return result;
+                }
+            }
         }
 
-        return (lc < rc) ? -1 : (lc > rc) ? 1 : 0;
+        return 0;
     }
 
-    static constexpr const char_type* find(const char_type* str, std::size_t count, const char_type& ch) noexcept
+    static const char_type* find(const char_type* str, std::size_t count, const char_type& ch) noexcept
     {
         // NOTE: There's currently no wmemichr/_wmemichr function
-        auto c = std::tolower(ch);
-        for (; count; --count)
+        auto c = details::fold_case(ch);
+        std::size_t index = 0;
+        while (index < count)
         {
-            if (std::tolower(*str) == c) return str;
-            ++str;
+            index = details::skip_ascii_without(str, index, count, c);
+            auto blockEnd = (std::min)(count, index + details::case_fold_block_size<char_type>);
+            for (; index < blockEnd; ++index)
+            {
+                if (details::fold_case(str[index]) == c) return str + index;
+            }
         }
 
         return nullptr;
     }
 
-    static constexpr bool eq_int_type(int_type lhs, int_type rhs) noexcept
+    static bool eq_int_type(int_type lhs, int_type rhs) noexcept
     {
-        return std::tolower(lhs) == std::tolower(rhs);
+        if (MyBase::eq_int_type(lhs, MyBase::eof()) || MyBase::eq_int_type(rhs, MyBase::eof()))
+        {
+            return MyBase::eq_int_type(lhs, rhs);
+        }
+
+        return eq(MyBase::to_char_type(lhs), MyBase::to_char_type(rhs));
     }
 };
 
@@ -99,36 +319,130 @@ inline constexpr iwstring_view operator""_isv(const wchar_t* str, std::size_t le
 inline constexpr iu16string_view operator""_isv(const char16_t* str, std::size_t length) { return iu16string_view(str, length); }
 inline constexpr iu32string_view operator""_isv(const char32_t* str, std::size_t length) { return iu32string_view(str, length); }
 
+namespace details
+{
+    // Code pages that ASCII is the same in, and that Windows can use for the ANSI or OEM code page. Which excludes
+    // UTF-7, which gives '+' a meaning of its own, and EBCDIC
+    inline bool is_ascii_compatible(UINT codePage) noexcept
+    {
+        return (codePage == CP_UTF8) || (codePage == CP_ACP) || (codePage == CP_OEMCP) || (codePage == CP_THREAD_ACP);
+    }
 
-inline std::wstring widen(std::string_view str, UINT codePage = CP_UTF8)
+    // Copies the leading ASCII characters of 'str' to 'dest', returning how many there were. Nearly all of the paths and
+    // config strings that get converted are ASCII through and through, and so need nothing else
+    inline std::size_t widen_ascii(const char* str, std::size_t length, wchar_t* dest) noexcept
+    {
+        std::size_t index = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+        for (; index + sizeof(__m128i) <= length; index += sizeof(__m128i))
+        {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + index));
+            if (_mm_movemask_epi8(block))
+            {
+                break;
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + index), _mm_unpacklo_epi8(block, _mm_setzero_si128()));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + index + 8), _mm_unpackhi_epi8(block, _mm_setzero_si128()));
+        }
+#endif
+
+        for (; (index < length) && (static_cast<unsigned char>(str[index]) < 0x80); ++index)
+        {
+            dest[index] = str[index];
+        }
+
+        return index;
+    }
+
+    inline std::size_t narrow_ascii(const wchar_t* str, std::size_t length, char* dest) noexcept
+    {
+        std::size_t index = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+        for (; index + 16 <= length; index += 16)
+        {
+            auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + index));
+            auto high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + index + 8));
+            auto nonAscii = _mm_and_si128(_mm_or_si128(low, high), _mm_set1_epi16(static_cast<short>(0xFF80)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, _mm_setzero_si128())) != 0xFFFF)
+            {
+                break;
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + index), _mm_packus_epi16(low, high));
+        }
+#endif
+
+        for (; (index < length) && (str[index] < 0x80); ++index)
+        {
+            dest[index] = static_cast<char>(str[index]);
+        }
+
+        return index;
+    }
+}
+
+// The try_widen and try_narrow functions are the same as widen and narrow, except that they report failures - e.g. a
+// string that isn't valid in the code page, or a buffer that's too small - as the Win32 error instead of throwing it,
+// for the fixups' hot paths (see win32_result.h). Only running out of memory still throws.
+
+// Converts into caller-supplied storage, returning the number of characters written. Fails if 'capacity' is too small;
+// 'str.length()' characters is always enough. Like MultiByteToWideChar, the result is not null terminated
+inline psf::win32_result<std::size_t> try_widen(std::string_view str, wchar_t* buffer, std::size_t capacity, UINT codePage = CP_UTF8) noexcept
 {
-    std::wstring result;
     if (str.empty())
     {
         // MultiByteToWideChar fails when given a length of zero
-        return result;
+        return std::size_t{ 0 };
     }
 
-    // UTF-16 should occupy at most as many characters as UTF-8
-    result.resize(str.length());
+    if (details::is_ascii_compatible(codePage) && (str.length() <= capacity) &&
+        (details::widen_ascii(str.data(), str.length(), buffer) == str.length()))
+    {
+        return str.length();
+    }
 
-    // NOTE: Since we call MultiByteToWideChar with a non-negative input string size, the resulting string is not null
-    //       terminated, so we don't need to '+1' the size on input and '-1' the size on resize
-    if (auto size = ::MultiByteToWideChar(
+    auto size = ::MultiByteToWideChar(
         codePage,
         MB_ERR_INVALID_CHARS,
         str.data(), static_cast<int>(str.length()),
-        result.data(), static_cast<int>(result.length())))
+        buffer, static_cast<int>(capacity));
+    if (!size)
     {
-        assert(static_cast<std::size_t>(size) <= result.length());
-        result.resize(size);
+        return psf::last_win32_failure();
     }
-    else
+
+    return static_cast<std::size_t>(size);
+}
+
+// Same as above, except that it throws if the conversion fails
+inline std::size_t widen(std::string_view str, wchar_t* buffer, std::size_t capacity, UINT codePage = CP_UTF8)
+{
+    return try_widen(str, buffer, capacity, codePage).value();
+}
+
+inline psf::win32_result<std::wstring> try_widen(std::string_view str, UINT codePage = CP_UTF8)
+{
+    std::wstring result;
+
+    // UTF-16 should occupy at most as many characters as UTF-8
+    result.resize(str.length());
+
+    // NOTE: Since the result is not null terminated, we don't need to '+1' the size on input and '-1' the size on resize
+    auto size = try_widen(str, result.data(), result.length(), codePage);
+    if (!size)
     {
-        throw_last_error();
+        return psf::win32_failure(size.error());
     }
+    assert(*size <= result.length());
+    result.resize(*size);
 
     return result;
+}
+
+inline std::wstring widen(std::string_view str, UINT codePage = CP_UTF8)
+{
+    return try_widen(str, codePage).value();
 };
 
 inline std::wstring widen(std::wstring str, UINT = CP_UTF8)
@@ -136,7 +450,48 @@ inline std::wstring widen(std::wstring str, UINT = CP_UTF8)
     return str;
 }
 
-inline std::string narrow(std::wstring_view str, UINT codePage = CP_UTF8)
+inline psf::win32_result<std::wstring> try_widen(std::wstring str, UINT = CP_UTF8)
+{
+    return str;
+}
+
+// Converts into caller-supplied storage, returning the number of characters written. Fails if 'capacity' is too small.
+// Like WideCharToMultiByte, the result is not null terminated
+inline psf::win32_result<std::size_t> try_narrow(std::wstring_view str, char* buffer, std::size_t capacity, UINT codePage = CP_UTF8) noexcept
+{
+    if (str.empty())
+    {
+        // WideCharToMultiByte fails when given a length of zero
+        return std::size_t{ 0 };
+    }
+
+    if (details::is_ascii_compatible(codePage) && (str.length() <= capacity) &&
+        (details::narrow_ascii(str.data(), str.length(), buffer) == str.length()))
+    {
+        return str.length();
+    }
+
+    auto size = ::WideCharToMultiByte(
+        codePage,
+        (codePage == CP_UTF8) ? WC_ERR_INVALID_CHARS : 0,
+        str.data(), static_cast<int>(str.length()),
+        buffer, static_cast<int>(capacity),
+        nullptr, nullptr);
+    if (!size)
+    {
+        return psf::last_win32_failure();
+    }
+
+    return static_cast<std::size_t>(size);
+}
+
+// Same as above, except that it throws if the conversion fails
+inline std::size_t narrow(std::wstring_view str, char* buffer, std::size_t capacity, UINT codePage = CP_UTF8)
+{
+    return try_narrow(str, buffer, capacity, codePage).value();
+}
+
+inline psf::win32_result<std::string> try_narrow(std::wstring_view str, UINT codePage = CP_UTF8)
 {
     std::string result;
     if (str.empty())
@@ -145,6 +500,16 @@ inline std::string narrow(std::wstring_view str, UINT codePage = CP_UTF8)
         return result;
     }
 
+    if (details::is_ascii_compatible(codePage))
+    {
+        result.resize(str.length());
+        if (details::narrow_ascii(str.data(), str.length(), result.data()) == str.length())
+        {
+            return result;
+        }
+        result.clear();
+    }
+
     // UTF-8 can occupy more characters than an equivalent UTF-16 string. WideCharToMultiByte gives us the required
     // size, so leverage it before we resize the buffer on the first pass of the loop
     for (int size = 0; ; )
@@ -171,22 +536,36 @@ inline std::string narrow(std::wstring_view str, UINT codePage = CP_UTF8)
         }
         else
         {
-            throw_last_error();
+            return psf::last_win32_failure();
         }
     }
 
     return result;
 }
 
+inline std::string narrow(std::wstring_view str, UINT codePage = CP_UTF8)
+{
+    return try_narrow(str, codePage).value();
+}
+
 inline std::string narrow(std::string str, UINT = CP_UTF8)
 {
     return str;
 }
 
+inline psf::win32_result<std::string> try_narrow(std::string str, UINT = CP_UTF8)
+{
+    return str;
+}
+
 // A convenience type to avoid a copy for already-wide function argument strings
 struct wide_argument_string
 {
     const wchar_t* value = nullptr;
+
+    // Only ever set by try_widen_argument, to the error that the conversion failed with, in which case 'value' is null
+    DWORD error = ERROR_SUCCESS;
+
     const wchar_t* c_str() const noexcept
     {
         return value;
@@ -205,21 +584,98 @@ struct wide_argument_string_with_buffer : wide_argument_string
     }
 };
 
-inline wide_argument_string_with_buffer widen_argument(const char* str)
+// Same as wide_argument_string_with_buffer, except that strings shorter than MAX_PATH - i.e. almost all paths - are
+// converted into storage inside the object, so that widening an argument does not touch the heap. Since the value can
+// point into the object itself, it can be neither copied nor moved and is meant to be used as a temporary, e.g. as in
+// 'widen_argument(str).c_str()'
+struct wide_argument_string_with_small_buffer : wide_argument_string
+{
+    wchar_t small_buffer[MAX_PATH];
+    std::wstring buffer;
+    std::size_t length = 0;
+
+    wide_argument_string_with_small_buffer() = default;
+    wide_argument_string_with_small_buffer(std::string_view str, UINT codePage = CP_UTF8) :
+        wide_argument_string_with_small_buffer(str, codePage, std::nothrow)
+    {
+        check_win32(static_cast<int>(error));
+    }
+
+    // Same as above, except that a failed conversion is left in 'error' rather than thrown
+    wide_argument_string_with_small_buffer(std::string_view str, UINT codePage, std::nothrow_t)
+    {
+        // No code page produces more UTF-16 characters than the number of bytes it was given
+        if (str.length() >= std::size(small_buffer))
+        {
+            auto result = try_widen(str, codePage);
+            if (!result)
+            {
+                error = result.error();
+                return;
+            }
+
+            buffer = std::move(*result);
+            value = buffer.c_str();
+            length = buffer.length();
+            return;
+        }
+
+        // NOTE: As with widen, the result is not null terminated
+        auto result = try_widen(str, small_buffer, std::size(small_buffer) - 1, codePage);
+        if (!result)
+        {
+            error = result.error();
+            return;
+        }
+
+        length = *result;
+        small_buffer[length] = L'\0';
+        value = small_buffer;
+    }
+
+    wide_argument_string_with_small_buffer(const wide_argument_string_with_small_buffer&) = delete;
+    wide_argument_string_with_small_buffer& operator=(const wide_argument_string_with_small_buffer&) = delete;
+
+    std::wstring_view view() const noexcept
+    {
+        return value ? std::wstring_view(value, length) : std::wstring_view{};
+    }
+};
+
+inline wide_argument_string_with_small_buffer widen_argument(const char* str, UINT codePage = CP_UTF8)
+{
+    if (str)
+    {
+        return wide_argument_string_with_small_buffer{ str, codePage };
+    }
+    else
+    {
+        // Calling widen with a null pointer will crash. Default constructed wide_argument_string_with_small_buffer
+        // will preserve the null argument
+        return wide_argument_string_with_small_buffer{};
+    }
+}
+
+inline wide_argument_string widen_argument(const wchar_t* str, UINT = CP_UTF8) noexcept
+{
+    return wide_argument_string{ str };
+}
+
+// Same as widen_argument, except that a string that can't be converted is reported in the result's 'error' rather than
+// thrown, so that arguments that aren't valid in their code page cost the fixups no more than any other failure
+inline wide_argument_string_with_small_buffer try_widen_argument(const char* str, UINT codePage = CP_UTF8)
 {
     if (str)
     {
-        return wide_argument_string_with_buffer{ widen(str) };
+        return wide_argument_string_with_small_buffer{ str, codePage, std::nothrow };
     }
     else
     {
-        // Calling widen with a null pointer will crash. Default constructed wide_argument_string_with_buffer will
-        // preserve the null argument
-        return wide_argument_string_with_buffer{};
+        return wide_argument_string_with_small_buffer{};
     }
 }
 
-inline wide_argument_string widen_argument(const wchar_t* str) noexcept
+inline wide_argument_string try_widen_argument(const wchar_t* str, UINT = CP_UTF8) noexcept
 {
     return wide_argument_string{ str };
 }
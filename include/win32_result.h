@@ -0,0 +1,138 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+#include <windows.h>
+
+#include "win32_error.h"
+
+namespace psf
+{
+    // The error that a win32_result is constructed from when the operation failed, e.g. 'return win32_failure(err);'
+    struct win32_failure
+    {
+        DWORD code;
+
+        explicit win32_failure(DWORD errorCode) noexcept :
+            code(errorCode)
+        {
+            assert(errorCode != ERROR_SUCCESS);
+        }
+    };
+
+    inline win32_failure last_win32_failure() noexcept
+    {
+        auto err = ::GetLastError();
+        return win32_failure((err != ERROR_SUCCESS) ? err : ERROR_GEN_FAILURE);
+    }
+
+    // Either the value that an operation produced, or the Win32 error code that it failed with, in the style of
+    // std::expected. Fixups are free to fail on paths that the application takes all of the time - probing for files
+    // that don't exist, names that can't be converted, and so on - where unwinding an exception costs far more than the
+    // failure itself, so the helpers that those paths use report their failures with this rather than by throwing. The
+    // value is default constructed when the operation failed, so 'T' needs to be default constructible.
+    template <typename T>
+    class win32_result
+    {
+    public:
+        win32_result() = default;
+
+        win32_result(T value) noexcept(std::is_nothrow_move_constructible_v<T>) :
+            m_value(std::move(value))
+        {
+        }
+
+        win32_result(win32_failure failure) noexcept(std::is_nothrow_default_constructible_v<T>) :
+            m_error(failure.code)
+        {
+        }
+
+        bool has_value() const noexcept
+        {
+            return m_error == ERROR_SUCCESS;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return has_value();
+        }
+
+        // ERROR_SUCCESS when there's a value
+        DWORD error() const noexcept
+        {
+            return m_error;
+        }
+
+        // The value, which is only there when has_value() is true; use value() instead where failures are exceptional
+        T& operator*() & noexcept
+        {
+            assert(has_value());
+            return m_value;
+        }
+
+        const T& operator*() const & noexcept
+        {
+            assert(has_value());
+            return m_value;
+        }
+
+        T&& operator*() && noexcept
+        {
+            assert(has_value());
+            return std::move(m_value);
+        }
+
+        T* operator->() noexcept
+        {
+            assert(has_value());
+            return &m_value;
+        }
+
+        const T* operator->() const noexcept
+        {
+            assert(has_value());
+            return &m_value;
+        }
+
+        // The value, or - for callers that would rather handle failures with exceptions - throws the error as a
+        // std::system_error, the same way that throw_win32 does
+        T& value() &
+        {
+            check_win32(static_cast<int>(m_error));
+            return m_value;
+        }
+
+        const T& value() const &
+        {
+            check_win32(static_cast<int>(m_error));
+            return m_value;
+        }
+
+        T&& value() &&
+        {
+            check_win32(static_cast<int>(m_error));
+            return std::move(m_value);
+        }
+
+        template <typename U>
+        T value_or(U&& defaultValue) const &
+        {
+            return has_value() ? m_value : static_cast<T>(std::forward<U>(defaultValue));
+        }
+
+        template <typename U>
+        T value_or(U&& defaultValue) &&
+        {
+            return has_value() ? std::move(m_value) : static_cast<T>(std::forward<U>(defaultValue));
+        }
+
+    private:
+        T m_value{};
+        DWORD m_error = ERROR_SUCCESS;
+    };
+}
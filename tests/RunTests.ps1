@@ -6,6 +6,15 @@ $pfxPath = "$PSScriptRoot\scenarios\signing\CentennialFixupsTestSigningCertifica
 function RunTest($Arch, $Config)
 {
     Write-host "<<<<<<<<<<<<<<<<<<<< Test Pass for $($Arch)  $($Config) >>>>>>>>>>>>>>>>>>>>>"
+    # The pattern match test only reads configuration files, so it runs unpackaged. Its input is piped so that it doesn't
+    # wait for a key press once it's done
+    $platform = if ($Arch -eq "x86") { "Win32" } else { $Arch }
+    '' | & "$PSScriptRoot\$platform\$Config\PatternMatchTest.exe" | Out-Host
+    if ($LASTEXITCODE -ne 0)
+    {
+        $global:failedTests += 1
+    }
+
     # For any directory under the "scenarios" directory that has a "FileMapping.txt", generate an appx for it
     Remove-Item "$PSScriptRoot\scenarios\Appx\*"
     foreach ($dir in (Get-ChildItem -Directory "$PSScriptRoot\scenarios"))
@@ -33,6 +42,10 @@ function RunTest($Arch, $Config)
 
         # Finally, execute the actual test. Note that the architecture of the runner doesn't actually matter
         #. x64\Release\TestRunner.exe /onlyPrintSummary
+        # Packages can also be run side by side, with each application reporting on its own pipe
+        #. x64\Release\TestRunner.exe /parallel
+        # ... and can send their messages through shared memory instead of the pipe
+        #. x64\Release\TestRunner.exe /sharedMemory
         . x64\Release\TestRunner.exe
         $global:failedTests += $LASTEXITCODE
     }
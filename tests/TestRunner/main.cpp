@@ -6,7 +6,10 @@
 #include <conio.h>
 #include <fcntl.h>
 #include <io.h>
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <ShObjIdl.h>
@@ -16,6 +19,7 @@
 #include <test_runner.h>
 
 #include "message_pipe.h"
+#include "message_ring_reader.h"
 
 using namespace Microsoft::WRL;
 using namespace std::literals;
@@ -42,6 +46,18 @@ static constexpr const wchar_t* g_applications[] =
 
 bool g_onlyPrintSummary = false;
 
+// Has the applications send their messages through a shared memory ring (see message_ring.h) instead of the pipe
+bool g_useMessageRing = false;
+
+// When running in parallel, the output of the different applications would interleave, so only the launch and exit of
+// each application gets printed as it happens, along with the summary at the end
+std::size_t g_workerCount = 1;
+
+bool print_test_output() noexcept
+{
+    return !g_onlyPrintSummary && (g_workerCount == 1);
+}
+
 DWORD CancelIOAndWait(HANDLE file, LPOVERLAPPED overlapped)
 {
     if (!::CancelIoEx(file, overlapped))
@@ -79,31 +95,61 @@ struct test_app
 
 struct state
 {
+    // NOTE: One entry per application in 'g_applications', in the same order, so that the summary doesn't depend on the
+    //       order in which the applications finish when running in parallel
     std::vector<test_app> test_apps;
+};
+
+state g_state;
+
+// The applications that one worker is running, one at a time, along with the pipe that they report their results on.
+// Applications of the same package are always run by the same worker, since they share state such as the package's
+// redirection folders
+struct test_session
+{
+    test_session(std::wstring pipeName, std::wstring ringName) :
+        pipe_name(std::move(pipeName)),
+        pipe(pipe_name.c_str())
+    {
+        if (!ringName.empty())
+        {
+            ring = std::make_unique<message_ring_reader>(std::move(ringName));
+        }
+    }
+
+    std::wstring pipe_name;
+    message_pipe pipe;
+
+    // NOTE: The pipe is still used to learn when the application disconnects, even when its messages come through the ring
+    std::unique_ptr<message_ring_reader> ring;
+
+    // Indices into 'g_applications' of the applications that are still to be run
+    std::vector<std::size_t> pending_apps;
+
+    test_app* running_app = nullptr;
+    unique_handle process;
 
     // NOTE: Pointers (as opposed to '.back()' calls) to identify extraneous messages and/or missing messages
     test_app* active_app = nullptr;
     test* active_test = nullptr;
 };
 
-state g_state;
-
-void handle_message(const init_test_message* msg)
+void handle_message(test_session& session, const init_test_message* msg)
 {
-    if (g_state.active_app)
+    if (session.active_app)
     {
         // Caller should ensure that apps that don't send a 'cleanup' message are properly cleaned up, so this should
         // imply that the same app sent multiple 'init' messages
         std::wcout << error_text() << "ERROR: Application sent more than one init message\n";
         return;
     }
-    assert(!g_state.active_test);
+    assert(!session.active_test);
 
-    g_state.active_app = &g_state.test_apps.back();
-    g_state.active_app->name = msg->name;
-    g_state.active_app->test_count = msg->count;
+    session.active_app = session.running_app;
+    session.active_app->name = msg->name;
+    session.active_app->test_count = msg->count;
 
-    if (!g_onlyPrintSummary)
+    if (print_test_output())
     {
         std::wcout << console::change_foreground(console::color::cyan) <<
             "================================================================================\n" <<
@@ -114,11 +160,11 @@ void handle_message(const init_test_message* msg)
     }
 }
 
-void cleanup_current_app(bool isForcedCleanup = false)
+void cleanup_current_app(test_session& session, bool isForcedCleanup = false)
 {
-    assert(g_state.active_app);
+    assert(session.active_app);
 
-    if (g_state.active_test)
+    if (session.active_test)
     {
         if (!isForcedCleanup)
         {
@@ -126,19 +172,19 @@ void cleanup_current_app(bool isForcedCleanup = false)
         }
 
         // Act like we got a failure message for the test and then continue cleanup as normal
-        ++g_state.active_app->failure_count;
-        g_state.active_test->result = ERROR_CANCELLED;
-        g_state.active_test = nullptr;
+        ++session.active_app->failure_count;
+        session.active_test->result = ERROR_CANCELLED;
+        session.active_test = nullptr;
     }
 
-    auto app = g_state.active_app;
+    auto app = session.active_app;
     auto blockedCount = (app->test_count - (app->success_count + app->failure_count));
     if (blockedCount)
     {
         std::wcout << error_text() << "ERROR: Reported test count does not match the number of test results\n";
     }
 
-    if (!g_onlyPrintSummary)
+    if (print_test_output())
     {
         std::wcout << console::change_foreground(console::color::cyan) <<
             "================================================================================\n" <<
@@ -151,61 +197,61 @@ void cleanup_current_app(bool isForcedCleanup = false)
             "================================================================================\n";
     }
 
-    g_state.active_app = nullptr;
+    session.active_app = nullptr;
 }
 
-void handle_message([[maybe_unused]] const cleanup_test_message* msg)
+void handle_message(test_session& session, [[maybe_unused]] const cleanup_test_message* msg)
 {
-    if (!g_state.active_app)
+    if (!session.active_app)
     {
         std::wcout << error_text() << "ERROR: Application either sent multiple cleanup messages or didn't send an init message\n";
-        assert(!g_state.active_test);
+        assert(!session.active_test);
         return;
     }
 
-    cleanup_current_app();
+    cleanup_current_app(session);
 }
 
-void handle_message(const test_begin_message* msg)
+void handle_message(test_session& session, const test_begin_message* msg)
 {
-    if (!g_state.active_app)
+    if (!session.active_app)
     {
         std::wcout << error_text() << "ERROR: Unexpected test begin message\n";
         std::wcout << error_text() << "ERROR: Name is: " << error_info_text() << msg->name << "\n";
         return;
     }
-    else if (g_state.active_test)
+    else if (session.active_test)
     {
         std::wcout << error_text() << "ERROR: Test begin message received while another test was already running\n";
         std::wcout << error_text() << "ERROR: Name is: " << error_info_text() << msg->name << "\n";
         return;
     }
 
-    if (!g_onlyPrintSummary)
+    if (print_test_output())
     {
         std::wcout << console::change_foreground(console::color::magenta) << "vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv\n";
         std::wcout << "Test Begin: " << info_text() << msg->name << "\n";
         std::wcout << "--------------------------------------------------------------------------------\n";
     }
 
-    g_state.active_app->tests.push_back(test{ msg->name });
-    g_state.active_test = &g_state.active_app->tests.back();
+    session.active_app->tests.push_back(test{ msg->name });
+    session.active_test = &session.active_app->tests.back();
 }
 
-void handle_message(const test_end_message* msg)
+void handle_message(test_session& session, const test_end_message* msg)
 {
-    if (!g_state.active_app)
+    if (!session.active_app)
     {
         std::wcout << error_text() << "ERROR: Unexpected test end message\n";
         return;
     }
-    else if (!g_state.active_test)
+    else if (!session.active_test)
     {
         std::wcout << error_text() << "ERROR: Test end message received while no test was in progress\n";
         return;
     }
 
-    if (!g_onlyPrintSummary)
+    if (print_test_output())
     {
         std::wcout << "--------------------------------------------------------------------------------\n";
         std::wcout << "Test End\n" << "Result: ";
@@ -213,8 +259,8 @@ void handle_message(const test_end_message* msg)
 
     if (msg->result)
     {
-        ++g_state.active_app->failure_count;
-        if (!g_onlyPrintSummary)
+        ++session.active_app->failure_count;
+        if (print_test_output())
         {
             std::wcout << error_text() << "FAILED\n";
             std::wcout << "Error Code: " << error_text() << msg->result;
@@ -223,26 +269,26 @@ void handle_message(const test_end_message* msg)
     }
     else
     {
-        ++g_state.active_app->success_count;
-        if (!g_onlyPrintSummary)
+        ++session.active_app->success_count;
+        if (print_test_output())
         {
             std::wcout << success_text() << "SUCCESS\n";
         }
     }
 
-    if (!g_onlyPrintSummary)
+    if (print_test_output())
     {
         std::wcout << console::change_foreground(console::color::magenta) << "^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n";
     }
 
-    g_state.active_test->result = msg->result;
-    g_state.active_test = nullptr;
+    session.active_test->result = msg->result;
+    session.active_test = nullptr;
 }
 
-void handle_message(const test_trace_message* msg)
+void handle_message(test_session& session, const test_trace_message* msg)
 {
     // We shouldn't be trying to trace output while a test isn't running
-    if (!g_state.active_test || g_onlyPrintSummary)
+    if (!session.active_test || !print_test_output())
     {
         return;
     }
@@ -254,18 +300,170 @@ void handle_message(const test_trace_message* msg)
     }
 }
 
+void dispatch_message(test_session& session, const test_message* msg)
+{
+    switch (msg->type)
+    {
+    case test_message_type::init:
+        handle_message(session, reinterpret_cast<const init_test_message*>(msg));
+        break;
+
+    case test_message_type::cleanup:
+        handle_message(session, reinterpret_cast<const cleanup_test_message*>(msg));
+        break;
+
+    case test_message_type::begin:
+        handle_message(session, reinterpret_cast<const test_begin_message*>(msg));
+        break;
+
+    case test_message_type::end:
+        handle_message(session, reinterpret_cast<const test_end_message*>(msg));
+        break;
+
+    case test_message_type::trace:
+        handle_message(session, reinterpret_cast<const test_trace_message*>(msg));
+        break;
+
+    default:
+        assert(false);
+    }
+}
+
+// Activates the session's next pending application that can be activated, if any. Applications that fail to activate
+// are recorded as such and skipped
+int launch_next_app(IApplicationActivationManager* activationManager, test_session& session)
+{
+    assert(!session.process);
+
+    while (!session.pending_apps.empty())
+    {
+        auto index = session.pending_apps.front();
+        session.pending_apps.erase(session.pending_apps.begin());
+
+        auto aumid = g_applications[index];
+        if (!g_onlyPrintSummary)
+        {
+            std::wcout << "\nLaunching: " << info_text() << aumid << "\n";
+        }
+
+        auto& currentApp = g_state.test_apps[index];
+        session.running_app = &currentApp;
+
+        // NOTE: Only pass the pipe name along when it's not the default one, so that sequential runs launch the
+        //       applications exactly as before
+        auto arguments = L"/mode:test"s;
+        if (session.pipe_name != test_runner_pipe_name)
+        {
+            arguments += L" /pipe:" + session.pipe_name;
+        }
+
+        if (session.ring)
+        {
+            arguments += L" /ring:" + session.ring->name();
+        }
+
+        DWORD pid;
+        currentApp.activation_result = activationManager->ActivateApplication(aumid, arguments.c_str(), AO_NONE, &pid);
+        if (FAILED(currentApp.activation_result))
+        {
+            print_error(currentApp.activation_result, "Failed to activate application");
+            if (print_test_output())
+            {
+                std::wcout << "\n\n";
+            }
+
+            continue;
+        }
+
+        if (!g_onlyPrintSummary)
+        {
+            std::wcout << "Process created with process id: " << info_text() << pid << "\n";
+        }
+
+        session.process.reset(::OpenProcess(SYNCHRONIZE | PROCESS_QUERY_INFORMATION, false, pid));
+        if (!session.process)
+        {
+            return print_last_error("Failed to open process handle");
+        }
+
+        break;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+int finish_app(test_session& session)
+{
+    assert(session.process && session.running_app);
+    assert(session.pipe.state() != pipe_state::connected);
+
+    DWORD exitCode;
+    if (!::GetExitCodeProcess(session.process.get(), &exitCode))
+    {
+        return print_last_error("Failed to get process exit code");
+    }
+
+    auto& currentApp = *session.running_app;
+    if (!currentApp.test_count)
+    {
+        assert(!session.active_app);
+        std::wcout << error_text() << "ERROR: Application terminated without sending an init message\n";
+    }
+    else if (session.active_app)
+    {
+        std::wcout << error_text() << "ERROR: Application terminated without sending a cleanup message\n";
+        cleanup_current_app(session, true);
+    }
+
+    if (print_test_output())
+    {
+        std::wcout << "Process exited with code: " << info_text() << exitCode << "\n";
+        std::wcout << "\n\n";
+    }
+    else if (!g_onlyPrintSummary)
+    {
+        std::wcout << "Finished: " << info_text() << g_applications[&currentApp - g_state.test_apps.data()] <<
+            console::revert_foreground() << " (exit code " << info_text() << exitCode << console::revert_foreground() << ")\n";
+    }
+
+    session.process.reset();
+    session.running_app = nullptr;
+    return ERROR_SUCCESS;
+}
+
 int wmain(int argc, const wchar_t** argv)
 {
     // Display UTF-16 correctly...
     // NOTE: The CRT will assert if we try and use 'cout' with this set
     _setmode(_fileno(stdout), _O_U16TEXT);
 
+    // NOTE: Zero means one worker per package
+    std::size_t requestedWorkers = 1;
     for (int i = 1; i < argc; ++i)
     {
-        if (argv[i] == L"/onlyPrintSummary"sv)
+        std::wstring_view arg = argv[i];
+        if (arg == L"/onlyPrintSummary"sv)
         {
             g_onlyPrintSummary = true;
         }
+        else if (arg == L"/sharedMemory"sv)
+        {
+            g_useMessageRing = true;
+        }
+        else if (arg == L"/parallel"sv)
+        {
+            requestedWorkers = 0;
+        }
+        else if (arg.substr(0, 10) == L"/parallel:"sv)
+        {
+            wchar_t* end;
+            requestedWorkers = std::wcstoul(argv[i] + 10, &end, 10);
+            if (*end || (requestedWorkers == 0))
+            {
+                std::wcout << error_text() << "ERROR: Invalid worker count: " << error_info_text() << argv[i] << "\n";
+                return ERROR_INVALID_PARAMETER;
+            }
+        }
         else
         {
             std::wcout << error_text() << "ERROR: Unknown argument: " << error_info_text() << argv[i] << "\n";
@@ -285,134 +483,181 @@ int wmain(int argc, const wchar_t** argv)
         return print_error(hr, "Failed to activate ApplicationActivationManager");
     }
 
-    message_pipe pipe;
-    HANDLE waitArray[2] = { pipe.wait_handle() };
-
-    for (auto& aumid : g_applications)
+    // Group the applications by package, keeping both the packages and the applications within them in the order that
+    // they are declared in
+    g_state.test_apps.resize(std::size(g_applications));
+    std::vector<std::vector<std::size_t>> packages;
+    for (std::size_t index = 0; index < std::size(g_applications); ++index)
     {
-        if (!g_onlyPrintSummary)
-        {
-            std::wcout << "\nLaunching: " << info_text() << aumid << "\n";
-        }
-
-        g_state.test_apps.emplace_back();
-        auto& currentApp = g_state.test_apps.back();
+        auto aumid = g_applications[index];
+        auto& currentApp = g_state.test_apps[index];
         currentApp.package_family_name.assign(aumid, std::wcschr(aumid, L'!'));
 
-        DWORD pid;
-        currentApp.activation_result = activationManager->ActivateApplication(aumid, L"/mode:test", AO_NONE, &pid);
-        if (FAILED(currentApp.activation_result))
+        auto itr = std::find_if(packages.begin(), packages.end(), [&](const std::vector<std::size_t>& package)
         {
-            print_error(currentApp.activation_result, "Failed to activate application");
+            return g_state.test_apps[package.front()].package_family_name == currentApp.package_family_name;
+        });
+        if (itr == packages.end())
+        {
+            packages.emplace_back();
+            itr = std::prev(packages.end());
         }
-        else
+        itr->push_back(index);
+    }
+
+    // NOTE: Each busy worker waits on both its pipe and its process, as well as its ring when there is one, so the number
+    //       of workers is bound by the number of handles that WaitForMultipleObjects accepts
+    const std::size_t handlesPerWorker = g_useMessageRing ? 3 : 2;
+    g_workerCount = requestedWorkers ? requestedWorkers : packages.size();
+    g_workerCount = std::clamp<std::size_t>(g_workerCount, 1, std::min<std::size_t>(packages.size(), MAXIMUM_WAIT_OBJECTS / handlesPerWorker));
+
+    std::vector<std::unique_ptr<test_session>> sessions;
+    for (std::size_t i = 0; i < g_workerCount; ++i)
+    {
+        // Sequential runs use the well known pipe name, so that scenarios can still be run by hand against a TestRunner
+        auto pipeName = (g_workerCount == 1) ? std::wstring(test_runner_pipe_name) :
+            test_runner_pipe_name + L"-"s + std::to_wstring(::GetCurrentProcessId()) + L"-" + std::to_wstring(i);
+        auto ringName = g_useMessageRing ?
+            L"Local\\"s + test_runner_ring_name + L"-" + std::to_wstring(::GetCurrentProcessId()) + L"-" + std::to_wstring(i) : L""s;
+        sessions.push_back(std::make_unique<test_session>(std::move(pipeName), std::move(ringName)));
+    }
+
+    // Hands packages out to the workers as they become idle, starting the next application of the worker's current
+    // package if it has one left
+    std::size_t nextPackage = 0;
+    auto launchNext = [&](test_session& session) -> int
+    {
+        while (!session.process)
         {
-            if (!g_onlyPrintSummary)
+            if (session.pending_apps.empty())
             {
-                std::wcout << "Process created with process id: " << info_text() << pid << "\n";
+                if (nextPackage == packages.size())
+                {
+                    break;
+                }
+
+                session.pending_apps = packages[nextPackage++];
             }
 
-            unique_handle process(::OpenProcess(SYNCHRONIZE | PROCESS_QUERY_INFORMATION, false, pid));
-            if (!process)
+            if (auto err = launch_next_app(activationManager.Get(), session))
             {
-                return print_last_error("Failed to open process handle");
+                return err;
             }
+        }
 
-            // NOTE: WaitForMultipleObjects will return the index of the first signalled handle in the array, so the
-            //       process handle must be last so that we process all data it sends back before continuing
-            waitArray[1] = process.get();
+        return ERROR_SUCCESS;
+    };
 
-            while (true)
-            {
-                auto waitResult = ::WaitForMultipleObjects(
-                    static_cast<DWORD>(std::size(waitArray)),
-                    waitArray,
-                    false,
-                    INFINITE);
-                if ((waitResult >= WAIT_OBJECT_0) && (waitResult < WAIT_ABANDONED_0))
-                {
-                    auto index = waitResult - WAIT_OBJECT_0;
-                    assert(index < std::size(waitArray));
+    for (auto& session : sessions)
+    {
+        if (auto err = launchNext(*session))
+        {
+            return err;
+        }
+    }
 
-                    if (index == 1)
-                    {
-                        // Process terminated
-                        break;
-                    }
-                    else
-                    {
-                        pipe.on_signalled([](const test_message* msg)
-                        {
-                            switch (msg->type)
-                            {
-                            case test_message_type::init:
-                                handle_message(reinterpret_cast<const init_test_message*>(msg));
-                                break;
-
-                            case test_message_type::cleanup:
-                                handle_message(reinterpret_cast<const cleanup_test_message*>(msg));
-                                break;
-
-                            case test_message_type::begin:
-                                handle_message(reinterpret_cast<const test_begin_message*>(msg));
-                                break;
-
-                            case test_message_type::end:
-                                handle_message(reinterpret_cast<const test_end_message*>(msg));
-                                break;
-
-                            case test_message_type::trace:
-                                handle_message(reinterpret_cast<const test_trace_message*>(msg));
-                                break;
-
-                            default:
-                                assert(false);
-                            }
-                        });
-                    }
-                }
-                else if (waitResult == WAIT_FAILED)
-                {
-                    return print_last_error("Failed to wait for process to send data or exit");
-                }
-                else
-                {
-                    assert(false);
-                    std::wcout << error_text() << "ERROR: Unexpected failure waiting for process to send data or exit\n";
-                    return ERROR_ASSERTION_FAILURE;
-                }
+    std::vector<HANDLE> waitHandles;
+    std::vector<test_session*> busySessions;
+    std::vector<test_session*> ringSessions;
+    while (true)
+    {
+        // NOTE: WaitForMultipleObjects will return the index of the first signalled handle in the array, so the
+        //       process handles must come after all of the pipe and ring handles so that we process all data a process
+        //       sends back before handling its exit
+        waitHandles.clear();
+        busySessions.clear();
+        for (auto& session : sessions)
+        {
+            if (session->process)
+            {
+                busySessions.push_back(session.get());
+                waitHandles.push_back(session->pipe.wait_handle());
             }
+        }
 
-            assert(pipe.state() != pipe_state::connected);
+        if (busySessions.empty())
+        {
+            break;
+        }
 
-            DWORD exitCode;
-            if (!::GetExitCodeProcess(process.get(), &exitCode))
+        // Ring handles are numbered by the index of their session in 'ringSessions', after the pipe handles
+        ringSessions.clear();
+        for (auto session : busySessions)
+        {
+            if (session->ring)
             {
-                return print_last_error("Failed to get process exit code");
+                ringSessions.push_back(session);
+                waitHandles.push_back(session->ring->wait_handle());
             }
+        }
+
+        auto processIndex = waitHandles.size();
+        for (auto session : busySessions)
+        {
+            waitHandles.push_back(session->process.get());
+        }
+
+        auto waitResult = ::WaitForMultipleObjects(
+            static_cast<DWORD>(waitHandles.size()),
+            waitHandles.data(),
+            false,
+            INFINITE);
+        if ((waitResult >= WAIT_OBJECT_0) && (waitResult < WAIT_ABANDONED_0))
+        {
+            auto index = waitResult - WAIT_OBJECT_0;
+            assert(index < waitHandles.size());
 
-            if (!currentApp.test_count)
+            if (index < busySessions.size())
             {
-                assert(!g_state.active_app);
-                std::wcout << error_text() << "ERROR: Application terminated without sending an init message\n";
+                auto& session = *busySessions[index];
+                session.pipe.on_signalled([&](const test_message* msg)
+                {
+                    dispatch_message(session, msg);
+                });
             }
-            else if (g_state.active_app)
+            else if (index < processIndex)
             {
-                std::wcout << error_text() << "ERROR: Application terminated without sending a cleanup message\n";
-                cleanup_current_app(true);
+                auto& session = *ringSessions[index - busySessions.size()];
+                session.ring->on_signalled([&](const test_message* msg)
+                {
+                    dispatch_message(session, msg);
+                });
             }
-
-            if (!g_onlyPrintSummary)
+            else
             {
-                std::wcout << "Process exited with code: " << info_text() << exitCode << "\n";
-            }
+                // Process terminated
+                auto& session = *busySessions[index - processIndex];
 
-            waitArray[1] = nullptr;
-        }
+                // NOTE: The ring's event only gets set when the runner is waiting for more, so whatever the application
+                //       wrote last may not have been picked up yet
+                if (session.ring)
+                {
+                    session.ring->on_signalled([&](const test_message* msg)
+                    {
+                        dispatch_message(session, msg);
+                    });
+                }
 
-        if (!g_onlyPrintSummary)
+                if (auto err = finish_app(session))
+                {
+                    return err;
+                }
+
+                if (auto err = launchNext(session))
+                {
+                    return err;
+                }
+            }
+        }
+        else if (waitResult == WAIT_FAILED)
+        {
+            return print_last_error("Failed to wait for process to send data or exit");
+        }
+        else
         {
-            std::wcout << "\n\n";
+            assert(false);
+            std::wcout << error_text() << "ERROR: Unexpected failure waiting for process to send data or exit\n";
+            return ERROR_ASSERTION_FAILURE;
         }
     }
 
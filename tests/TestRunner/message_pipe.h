@@ -21,11 +21,11 @@ class message_pipe
 {
 public:
 
-    message_pipe()
+    explicit message_pipe(const wchar_t* name = test_runner_pipe_name)
     {
         m_buffer = std::make_unique<char[]>(m_bufferCapacity);
         m_pipeHandle.reset(::CreateNamedPipeW(
-            test_runner_pipe_name,
+            name,
             PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED,
             PIPE_TYPE_BYTE,
             PIPE_UNLIMITED_INSTANCES,      // MaxInstances
@@ -49,6 +49,10 @@ public:
         InitiateConnection();
     }
 
+    // NOTE: The pipe has an overlapped operation outstanding for its whole lifetime, so it must stay where it is
+    message_pipe(const message_pipe&) = delete;
+    message_pipe& operator=(const message_pipe&) = delete;
+
     pipe_state state() const noexcept
     {
         return m_state;
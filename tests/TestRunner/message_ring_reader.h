@@ -0,0 +1,124 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <new>
+#include <string>
+
+#include <error_logging.h>
+#include <fancy_handle.h>
+#include <message_ring.h>
+#include <test_runner.h>
+
+// The runner's side of a message ring (see message_ring.h). The ring is created once per worker and reused by each of
+// the applications that the worker runs, since they run one at a time
+class message_ring_reader
+{
+public:
+
+    explicit message_ring_reader(std::wstring name) :
+        m_name(std::move(name))
+    {
+        m_mapping.reset(::CreateFileMappingW(
+            INVALID_HANDLE_VALUE,
+            nullptr,
+            PAGE_READWRITE,
+            0,
+            static_cast<DWORD>(sizeof(message_ring_header) + message_ring_capacity),
+            m_name.c_str()));
+        if (!m_mapping)
+        {
+            throw_win32(print_last_error("Failed to create message ring"));
+        }
+
+        auto view = ::MapViewOfFile(m_mapping.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+        if (!view)
+        {
+            throw_win32(print_last_error("Failed to map message ring"));
+        }
+
+        m_ring = new (view) message_ring_header;
+        m_ring->data.reset(reinterpret_cast<std::uint8_t*>(m_ring + 1));
+
+        m_dataEvent.reset(::CreateEventW(nullptr, false, false, message_ring_data_event_name(m_name).c_str()));
+        m_spaceEvent.reset(::CreateEventW(nullptr, false, false, message_ring_space_event_name(m_name).c_str()));
+        if (!m_dataEvent || !m_spaceEvent)
+        {
+            throw_win32(print_last_error("Failed to create event"));
+        }
+    }
+
+    message_ring_reader(const message_ring_reader&) = delete;
+    message_ring_reader& operator=(const message_ring_reader&) = delete;
+
+    ~message_ring_reader()
+    {
+        if (m_ring)
+        {
+            ::UnmapViewOfFile(m_ring);
+        }
+    }
+
+    const std::wstring& name() const noexcept
+    {
+        return m_name;
+    }
+
+    HANDLE wait_handle() const noexcept
+    {
+        return m_dataEvent.get();
+    }
+
+    // Handles every message in the ring, including those that get written while it does so. Safe to call when the event
+    // isn't signalled, which is how whatever is left gets picked up once the application has exited
+    template <typename Handler> // void(const test_message*)
+    void on_signalled(Handler&& handler)
+    {
+        auto capacity = m_ring->capacity;
+        auto buffer = m_ring->data.get();
+        auto position = m_ring->read_position.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto end = m_ring->write_position.load();
+            if (position == end)
+            {
+                // Going back to waiting races with the writer, which only sets the event when it sees the flag, so look
+                // again once the flag is set
+                m_ring->reader_waiting.store(1);
+                end = m_ring->write_position.load();
+                if (position == end)
+                {
+                    break;
+                }
+                m_ring->reader_waiting.store(0);
+            }
+
+            while (position != end)
+            {
+                auto msg = reinterpret_cast<const test_message*>(buffer + position % capacity);
+                auto recordSize = message_ring_record_size(msg->size);
+                if (msg->type != test_message_type::ring_padding)
+                {
+                    handler(msg);
+                }
+
+                position += recordSize;
+                m_ring->read_position.store(position);
+                if (m_ring->writer_waiting.exchange(0))
+                {
+                    ::SetEvent(m_spaceEvent.get());
+                }
+            }
+        }
+    }
+
+private:
+
+    std::wstring m_name;
+    unique_handle m_mapping;
+    message_ring_header* m_ring = nullptr;
+    unique_handle m_dataEvent;
+    unique_handle m_spaceEvent;
+};
@@ -0,0 +1,165 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "test_runner.h"
+
+// The shared memory that a test application reports to instead of the pipe when the runner names one with
+// "/ring:<name>". Messages are copied into the ring exactly as they would be written to the pipe - the strings that
+// follow them are referenced with offset_ptr, so they're found wherever the ring is mapped - and the runner handles them
+// where they are. Sending a message is then a copy, plus a SetEvent only when the runner has run out of messages and is
+// waiting for more, so tests that trace a lot aren't held up by a pipe round trip for every line. The pipe is still
+// connected alongside the ring, since that's how the runner learns that an application is done with it, but nothing is
+// written to it.
+//
+// NOTE: There's one writer at a time, as there is for the pipe: test applications send their messages from one thread
+static constexpr std::uint32_t message_ring_capacity = 1024 * 1024;
+
+// Messages start on this boundary, so that their fields are aligned wherever they are in the ring
+static constexpr std::uint32_t message_ring_alignment = 8;
+
+struct message_ring_header
+{
+    std::uint32_t capacity = message_ring_capacity;
+    offset_ptr<std::uint8_t> data;
+
+    // The number of bytes written to and read from the ring since it was created. Both only ever grow, and the bytes in
+    // the ring are the difference. Each side sets its 'waiting' flag before it waits on its event, and the other side
+    // only sets the event when the flag was set
+    std::atomic<std::uint64_t> write_position{ 0 };
+    std::atomic<std::int32_t> reader_waiting{ 1 };
+    std::atomic<std::uint64_t> read_position{ 0 };
+    std::atomic<std::int32_t> writer_waiting{ 0 };
+};
+
+inline std::uint32_t message_ring_record_size(std::int32_t messageSize) noexcept
+{
+    return (static_cast<std::uint32_t>(messageSize) + message_ring_alignment - 1) & ~(message_ring_alignment - 1);
+}
+
+// Set by the writer whenever it has written to a ring that the reader had emptied, and by the reader whenever it has made
+// room in a ring that the writer found full, respectively
+inline std::wstring message_ring_data_event_name(const std::wstring& name)
+{
+    return name + L"-data";
+}
+
+inline std::wstring message_ring_space_event_name(const std::wstring& name)
+{
+    return name + L"-space";
+}
+
+class message_ring_writer
+{
+public:
+    message_ring_writer() = default;
+
+    message_ring_writer(const message_ring_writer&) = delete;
+    message_ring_writer& operator=(const message_ring_writer&) = delete;
+
+    ~message_ring_writer()
+    {
+        if (m_ring)
+        {
+            ::UnmapViewOfFile(m_ring);
+        }
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return m_ring != nullptr;
+    }
+
+    int open(const std::wstring& name)
+    {
+        m_dataEvent.reset(::OpenEventW(EVENT_MODIFY_STATE, false, message_ring_data_event_name(name).c_str()));
+        m_spaceEvent.reset(::OpenEventW(SYNCHRONIZE, false, message_ring_space_event_name(name).c_str()));
+        unique_handle mapping(::OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, false, name.c_str()));
+        if (!m_dataEvent || !m_spaceEvent || !mapping)
+        {
+            return ::GetLastError();
+        }
+
+        m_ring = static_cast<message_ring_header*>(::MapViewOfFile(mapping.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0));
+        return m_ring ? ERROR_SUCCESS : ::GetLastError();
+    }
+
+    // Copies 'message', whose 'size' includes the 'dataSize' bytes of 'data' that follow it, into the ring. Waits for the
+    // reader to make room if it has to
+    int write(const test_message* message, std::size_t messageSize, const void* data, std::size_t dataSize)
+    {
+        auto capacity = m_ring->capacity;
+        auto recordSize = message_ring_record_size(message->size);
+        if (recordSize > capacity)
+        {
+            return ERROR_INSUFFICIENT_BUFFER;
+        }
+
+        // A record is never split across the end of the ring, so what's left before the end is skipped when it's too small
+        auto position = m_ring->write_position.load(std::memory_order_relaxed);
+        auto offset = static_cast<std::uint32_t>(position % capacity);
+        std::uint32_t skipped = (capacity - offset < recordSize) ? capacity - offset : 0;
+        if (auto err = wait_for_space(position + skipped + recordSize))
+        {
+            return err;
+        }
+
+        auto buffer = m_ring->data.get();
+        if (skipped)
+        {
+            auto padding = reinterpret_cast<test_message*>(buffer + offset);
+            padding->type = test_message_type::ring_padding;
+            padding->size = static_cast<std::int32_t>(skipped);
+            offset = 0;
+        }
+
+        std::memcpy(buffer + offset, message, messageSize);
+        if (dataSize)
+        {
+            std::memcpy(buffer + offset + messageSize, data, dataSize);
+        }
+        m_ring->write_position.store(position + skipped + recordSize);
+        if (m_ring->reader_waiting.exchange(0))
+        {
+            ::SetEvent(m_dataEvent.get());
+        }
+
+        return ERROR_SUCCESS;
+    }
+
+private:
+    int wait_for_space(std::uint64_t end)
+    {
+        using namespace std::literals;
+        constexpr auto waitTimeout = std::chrono::duration_cast<std::chrono::milliseconds>(20s);
+
+        while (end - m_ring->read_position.load() > m_ring->capacity)
+        {
+            m_ring->writer_waiting.store(1);
+            if (end - m_ring->read_position.load() <= m_ring->capacity)
+            {
+                break;
+            }
+
+            // The runner not making any room for this long means that it has gone away
+            if (::WaitForSingleObject(m_spaceEvent.get(), static_cast<DWORD>(waitTimeout.count())) != WAIT_OBJECT_0)
+            {
+                return ERROR_TIMEOUT;
+            }
+        }
+
+        return ERROR_SUCCESS;
+    }
+
+    message_ring_header* m_ring = nullptr;
+    unique_handle m_dataEvent;
+    unique_handle m_spaceEvent;
+};
@@ -11,9 +11,13 @@
 #include <utilities.h>
 
 #include "error_logging.h"
+#include "message_ring.h"
 #include "test_runner.h"
 
 inline unique_handle g_testRunnerPipe;
+inline std::wstring g_testRunnerPipeName = test_runner_pipe_name;
+inline message_ring_writer g_testRunnerRing;
+inline std::wstring g_testRunnerRingName;
 inline std::int32_t g_testCount = 0;
 inline std::int32_t g_successCount = 0;
 inline std::int32_t g_failureCount = 0;
@@ -22,6 +26,7 @@ inline int parse_args(int argc, const wchar_t** argv, std::map<std::wstring_view
 {
     using namespace std::literals;
 
+    bool isTestMode = false;
     for (int i = 1; i < argc; ++i)
     {
         const auto str = argv[i];
@@ -37,14 +42,20 @@ inline int parse_args(int argc, const wchar_t** argv, std::map<std::wstring_view
             {
                 if (value == L"test")
                 {
-                    g_testRunnerPipe = test_client_connect();
-                    if (!g_testRunnerPipe)
-                    {
-                        return print_last_error("Failed to open pipe");
-                    }
+                    isTestMode = true;
                     handled = true;
                 }
             }
+            else if (arg == L"/pipe"sv)
+            {
+                g_testRunnerPipeName = value;
+                handled = true;
+            }
+            else if (arg == L"/ring"sv)
+            {
+                g_testRunnerRingName = value;
+                handled = true;
+            }
             else if (auto itr = allowedArgs.find(arg); itr != allowedArgs.end())
             {
                 itr->second = value;
@@ -59,6 +70,47 @@ inline int parse_args(int argc, const wchar_t** argv, std::map<std::wstring_view
         }
     }
 
+    // Only once all arguments are known, since "/pipe" may come after "/mode"
+    if (isTestMode)
+    {
+        g_testRunnerPipe = test_client_connect(g_testRunnerPipeName.c_str());
+        if (!g_testRunnerPipe)
+        {
+            return print_last_error("Failed to open pipe");
+        }
+
+        if (!g_testRunnerRingName.empty())
+        {
+            if (auto err = g_testRunnerRing.open(g_testRunnerRingName))
+            {
+                return print_error(err, "Failed to open message ring");
+            }
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+// Sends 'msg' - and the 'dataSize' bytes of 'data' that follow it, which its size includes - to the test runner, through
+// the message ring if the runner named one, and down the pipe otherwise
+template <typename MessageT>
+inline int send_test_message(const MessageT& msg, const void* data = nullptr, std::size_t dataSize = 0)
+{
+    if (g_testRunnerRing)
+    {
+        return g_testRunnerRing.write(&msg.header, sizeof(msg), data, dataSize);
+    }
+
+    if (!::WriteFile(g_testRunnerPipe.get(), &msg, sizeof(msg), nullptr, nullptr))
+    {
+        return ::GetLastError();
+    }
+
+    if (dataSize && !::WriteFile(g_testRunnerPipe.get(), data, static_cast<DWORD>(dataSize), nullptr, nullptr))
+    {
+        return ::GetLastError();
+    }
+
     return ERROR_SUCCESS;
 }
 
@@ -120,14 +172,9 @@ inline int test_initialize(null_terminated_string_view name, std::int32_t testCo
         msg.count = testCount;
         msg.name.reset(reinterpret_cast<char*>(&msg + 1));
 
-        if (!::WriteFile(g_testRunnerPipe.get(), &msg, sizeof(msg), nullptr, nullptr))
+        if (auto err = send_test_message(msg, name.ptr, name.length + 1))
         {
-            return print_last_error("Failed to send init message to test server");
-        }
-
-        if (!::WriteFile(g_testRunnerPipe.get(), name.ptr, static_cast<DWORD>(name.length + 1), nullptr, nullptr))
-        {
-            return print_last_error("Failed to send init message to test server");
+            return print_error(err, "Failed to send init message to test server");
         }
     }
     else
@@ -151,9 +198,9 @@ inline int test_cleanup()
         cleanup_test_message msg = {};
         msg.header.size = sizeof(msg);
 
-        if (!::WriteFile(g_testRunnerPipe.get(), &msg, sizeof(msg), nullptr, nullptr))
+        if (auto err = send_test_message(msg))
         {
-            return print_last_error("Failed to send cleanup message to test server");
+            return print_error(err, "Failed to send cleanup message to test server");
         }
     }
     else
@@ -178,14 +225,9 @@ inline int test_begin(null_terminated_string_view name)
         msg.header.size = static_cast<std::int32_t>(sizeof(msg) + name.length + 1);
         msg.name.reset(reinterpret_cast<char*>(&msg + 1));
 
-        if (!::WriteFile(g_testRunnerPipe.get(), &msg, sizeof(msg), nullptr, nullptr))
+        if (auto err = send_test_message(msg, name.ptr, name.length + 1))
         {
-            return print_last_error("Failed to send test begin message to test server");
-        }
-
-        if (!::WriteFile(g_testRunnerPipe.get(), name.ptr, static_cast<DWORD>(name.length + 1), nullptr, nullptr))
-        {
-            return print_last_error("Failed to send test begin message to test server");
+            return print_error(err, "Failed to send test begin message to test server");
         }
     }
     else
@@ -206,9 +248,9 @@ inline int test_end(std::int32_t result)
         msg.header.size = static_cast<std::int32_t>(sizeof(msg));
         msg.result = result;
 
-        if (!::WriteFile(g_testRunnerPipe.get(), &msg, sizeof(msg), nullptr, nullptr))
+        if (auto err = send_test_message(msg))
         {
-            return print_last_error("Failed to send test begin message to test server");
+            return print_error(err, "Failed to send test begin message to test server");
         }
     }
     else
@@ -247,14 +289,9 @@ inline void trace_message(
         msg.print_new_line = newLine;
         msg.text.reset(reinterpret_cast<wchar_t*>(&msg + 1));
 
-        if (!::WriteFile(g_testRunnerPipe.get(), &msg, sizeof(msg), nullptr, nullptr))
-        {
-            throw_win32(print_last_error("Failed to send test begin message to test server"));
-        }
-
-        if (!::WriteFile(g_testRunnerPipe.get(), message.ptr, static_cast<DWORD>((message.length + 1) * 2), nullptr, nullptr))
+        if (auto err = send_test_message(msg, message.ptr, (message.length + 1) * 2))
         {
-            throw_win32(print_last_error("Failed to send test begin message to test server"));
+            throw_win32(print_error(err, "Failed to send test begin message to test server"));
         }
     }
     else
@@ -14,11 +14,16 @@
 #include "console_output.h"
 #include "offset_ptr.h"
 
+// The pipe that test applications report to, unless the runner names a different one with "/pipe:<name>", as it does
+// when running several applications at once
 static constexpr wchar_t test_runner_pipe_name[] = LR"(\\.\pipe\CentennialFixupsTests)";
 
+// The base name of the shared memory that the runner's workers create when it's run with "/sharedMemory"
+static constexpr wchar_t test_runner_ring_name[] = L"CentennialFixupsTests";
+
 using unique_handle = std::unique_ptr<void, psf::handle_deleter<::CloseHandle>>;
 
-inline unique_handle test_client_connect()
+inline unique_handle test_client_connect(const wchar_t* pipeName = test_runner_pipe_name)
 {
     using namespace std::literals;
     constexpr auto waitTimeout = std::chrono::duration_cast<std::chrono::milliseconds>(20s);
@@ -26,7 +31,7 @@ inline unique_handle test_client_connect()
     unique_handle result;
     while (!result)
     {
-        if (!::WaitNamedPipeW(test_runner_pipe_name, static_cast<DWORD>(waitTimeout.count())))
+        if (!::WaitNamedPipeW(pipeName, static_cast<DWORD>(waitTimeout.count())))
         {
             print_last_error("Failed waiting for named pipe to become available");
             break;
@@ -36,7 +41,7 @@ inline unique_handle test_client_connect()
             // Pipe is available. Try and connect to it. Note that we could fail if someone else beats us, but that's
             // okay. We shouldn't get starved since there's a finite number of tests
             result.reset(::CreateFileW(
-                test_runner_pipe_name,
+                pipeName,
                 GENERIC_WRITE,
                 FILE_SHARE_READ | FILE_SHARE_WRITE,
                 nullptr,
@@ -58,6 +63,10 @@ enum class test_message_type : std::int16_t
     end,
 
     trace,
+
+    // Only ever in a message ring (see message_ring.h), where it fills what's left before the end of the ring when the
+    // next message doesn't fit there
+    ring_padding,
 };
 
 struct test_message
@@ -4,6 +4,10 @@
 //-------------------------------------------------------------------------------------------------------
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
 #include <ntstatus.h>
 #include <windows.h>
 #include <winternl.h>
@@ -13,8 +17,30 @@ enum class trace_method
     printf,
     output_debug_string,
     eventlog,
+    ring_buffer,
+    binary,
+    etw_events,
 };
 
+// Both write to per thread rings, see TraceRing.h
+inline bool uses_trace_rings(trace_method method)
+{
+    return (method == trace_method::ring_buffer) || (method == trace_method::binary);
+}
+
+// Fixups that support it write call records - raw values, rather than formatted text - for these methods
+inline bool writes_call_records(trace_method method)
+{
+    return (method == trace_method::binary) || (method == trace_method::etw_events);
+}
+
+// Whether a traced call's output is written under g_outputMutex, so that its lines stay together. Output to the rings
+// and to ETW is attributed to its thread anyway
+inline bool needs_output_lock(trace_method method)
+{
+    return !uses_trace_rings(method) && (method != trace_method::etw_events);
+}
+
 enum class function_result
 {
     // The function succeeded
@@ -158,6 +184,40 @@ enum class function_type
     dynamic_link_library,
 };
 
+inline constexpr std::size_t function_type_count = 4;
+
+// The name of each function_type in the configuration, e.g. in 'traceLevels'. Also the group that the detours of the
+// type's functions are declared in, so that PSFInitialize only attaches those of the types that can produce any output
+inline constexpr const char* function_type_config_key(function_type type) noexcept
+{
+    switch (type)
+    {
+    case function_type::filesystem:
+        return "filesystem";
+
+    case function_type::registry:
+        return "registry";
+
+    case function_type::process_and_thread:
+        return "processAndThread";
+
+    case function_type::dynamic_link_library:
+        return "dynamicLinkLibrary";
+    }
+
+    return "";
+}
+
+// The detours that keep track of handle names (see HandleNames.h), which are needed when either of the types that open
+// the named handles is attached
+inline constexpr char handle_names_group[] = "handleNames";
+
+#define DECLARE_TRACE_FIXUP(FunctionType, TargetFunc, DetouredFunc) \
+    DECLARE_GROUPED_FIXUP(function_type_config_key(FunctionType), TargetFunc, DetouredFunc)
+
+#define DECLARE_TRACE_STRING_FIXUP(FunctionType, StringFunctions, DetouredFunc) \
+    DECLARE_GROUPED_STRING_FIXUP(function_type_config_key(FunctionType), StringFunctions, DetouredFunc)
+
 // NOTE: Function entry tracing unaffected by these settings
 enum class trace_level
 {
@@ -184,15 +244,97 @@ extern bool wait_for_debugger;
 extern bool trace_function_entry;
 extern bool trace_calling_module;
 extern bool ignore_dll_load;
+extern bool profile_calls;
+
+// The 'oneIn' of the 'profileStacks' configuration. Zero when stacks aren't profiled
+extern std::uint32_t profile_stack_one_in;
+
+// The 'slowCallThreshold' configuration, in QueryPerformanceCounter ticks. Zero when every call is logged
+extern std::int64_t slow_call_ticks;
+
+// Whether 'pathFilters' has any prefixes. See PathFilters.h
+extern bool path_filters_enabled;
+
+// Whether fixups need to measure how long each call takes
+inline bool times_calls() noexcept
+{
+    return profile_calls || (profile_stack_one_in != 0) || (slow_call_ticks != 0);
+}
 
 extern void Log_ETW_PostMsgA(const char *);
 extern void Log_ETW_PostMsgW(const wchar_t *);
 extern void Log_ETW_PostMsgOperationA(const char *operation, const char *inputs, const char *result, const char *outputs, const char *caller, LARGE_INTEGER TickStart, LARGE_INTEGER TickEnd );
 
+struct trace_function;
+extern void Log_ETW_PostCall(const trace_function& function, function_result result, DWORD error, LARGE_INTEGER TickStart, LARGE_INTEGER TickEnd, const wchar_t* path, std::size_t pathLength, const std::uint64_t* args, std::size_t argCount) noexcept;
+
 struct result_configuration
 {
     bool should_log;
     bool should_break;
 };
 
-result_configuration configured_result(function_type type, function_result result);
+// For each function_type, the function_result values - as bits - that should be logged or broken on. Computed once from
+// the configuration as the fixup attaches, so that deciding what to do with a result never takes the output lock
+extern std::atomic<std::uint8_t> g_resultLogMasks[function_type_count];
+extern std::atomic<std::uint8_t> g_resultBreakMasks[function_type_count];
+
+// The 'sampling' configuration of a function_type, which thins out what would otherwise be logged. Set as the fixup
+// attaches, and only read afterwards
+struct sampling_configuration
+{
+    // Log one of every 'one_in' calls, counted separately by each thread
+    std::uint32_t one_in = 1;
+
+    // At most this many calls of the type are logged in the same second, by all threads together. Zero means no limit
+    std::uint32_t max_per_second = 0;
+
+    // The function_result values - as bits - that are always logged, whatever the above say
+    std::uint8_t always_mask = 0;
+};
+
+extern bool sampling_enabled;
+extern sampling_configuration g_sampling[function_type_count];
+
+bool sampling_rate_allows(function_type type) noexcept;
+
+inline bool sampled(function_type type, function_result result) noexcept
+{
+    auto index = static_cast<std::size_t>(type);
+    auto& config = g_sampling[index];
+    if (config.always_mask & (1 << static_cast<int>(result)))
+    {
+        return true;
+    }
+
+    if (config.one_in > 1)
+    {
+        static thread_local std::uint32_t skipped[function_type_count] = {};
+        if (++skipped[index] < config.one_in)
+        {
+            return false;
+        }
+        skipped[index] = 0;
+    }
+
+    return (config.max_per_second == 0) || sampling_rate_allows(type);
+}
+
+// Whether traceLevels would have a result logged, before any path filters or sampling
+inline bool result_logged(function_type type, function_result result)
+{
+    auto bit = static_cast<std::uint8_t>(1 << static_cast<int>(result));
+    return (g_resultLogMasks[static_cast<std::size_t>(type)].load(std::memory_order_relaxed) & bit) != 0;
+}
+
+// 'included' is whether the call passed the path filters, which come before sampling so that only calls that could be
+// logged are counted towards it
+inline result_configuration configured_result(function_type type, function_result result, bool included = true)
+{
+    auto index = static_cast<std::size_t>(type);
+    auto bit = static_cast<std::uint8_t>(1 << static_cast<int>(result));
+    auto shouldLog = included && ((g_resultLogMasks[index].load(std::memory_order_relaxed) & bit) != 0);
+    return {
+        shouldLog && (!sampling_enabled || sampled(type, result)),
+        (g_resultBreakMasks[index].load(std::memory_order_relaxed) & bit) != 0 };
+}
@@ -117,7 +117,7 @@ BOOL __stdcall CreateProcessFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(CreateProcessImpl, CreateProcessFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::process_and_thread, CreateProcessImpl, CreateProcessFixup);
 
 auto CreateProcessAsUserImpl = psf::detoured_string_function(&::CreateProcessAsUserA, &::CreateProcessAsUserW);
 template <typename CharT>
@@ -229,4 +229,4 @@ BOOL __stdcall CreateProcessAsUserFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(CreateProcessAsUserImpl, CreateProcessAsUserFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::process_and_thread, CreateProcessAsUserImpl, CreateProcessAsUserFixup);
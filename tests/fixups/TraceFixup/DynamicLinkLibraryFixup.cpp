@@ -69,7 +69,7 @@ DLL_DIRECTORY_COOKIE __stdcall AddDllDirectoryFixup(_In_ PCWSTR newDirectory)
 
     return result;
 }
-DECLARE_FIXUP(AddDllDirectoryImpl, AddDllDirectoryFixup);
+DECLARE_TRACE_FIXUP(function_type::dynamic_link_library, AddDllDirectoryImpl, AddDllDirectoryFixup);
 
 auto LoadLibraryImpl = psf::detoured_string_function(&::LoadLibraryA, &::LoadLibraryW);
 template <typename CharT>
@@ -82,9 +82,14 @@ HMODULE __stdcall LoadLibraryFixup(_In_ const CharT* libFileName)
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result != NULL);
-    if (auto lock = acquire_output_lock(function_type::dynamic_link_library, functionResult))
+    if (auto lock = acquire_output_lock(function_type::dynamic_link_library, functionResult, libFileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::dynamic_link_library, "LoadLibrary", "Module");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, libFileName, { trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -134,7 +139,7 @@ HMODULE __stdcall LoadLibraryFixup(_In_ const CharT* libFileName)
 
     return result;
 }
-DECLARE_STRING_FIXUP(LoadLibraryImpl, LoadLibraryFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::dynamic_link_library, LoadLibraryImpl, LoadLibraryFixup);
 
 auto LoadLibraryExImpl = psf::detoured_string_function(&::LoadLibraryExA, &::LoadLibraryExW);
 template <typename CharT>
@@ -147,9 +152,14 @@ HMODULE __stdcall LoadLibraryExFixup(_In_ const CharT* libFileName, _Reserved_ H
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result != NULL);
-    if (auto lock = acquire_output_lock(function_type::dynamic_link_library, functionResult))
+    if (auto lock = acquire_output_lock(function_type::dynamic_link_library, functionResult, libFileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::dynamic_link_library, "LoadLibraryEx", "Flags Module");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, libFileName, { trace_arg(flags), trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -201,7 +211,7 @@ HMODULE __stdcall LoadLibraryExFixup(_In_ const CharT* libFileName, _Reserved_ H
 
     return result;
 }
-DECLARE_STRING_FIXUP(LoadLibraryExImpl, LoadLibraryExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::dynamic_link_library, LoadLibraryExImpl, LoadLibraryExFixup);
 
 auto LoadModuleImpl = &::LoadModule;
 DWORD __stdcall LoadModuleFixup(_In_ LPCSTR moduleName, _In_ LPVOID parameterBlock)
@@ -213,7 +223,7 @@ DWORD __stdcall LoadModuleFixup(_In_ LPCSTR moduleName, _In_ LPVOID parameterBlo
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = (result > 31) ? function_result::success : (result == 0) ? function_result::failure : from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::dynamic_link_library, functionResult))
+    if (auto lock = acquire_output_lock(function_type::dynamic_link_library, functionResult, moduleName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -258,7 +268,7 @@ DWORD __stdcall LoadModuleFixup(_In_ LPCSTR moduleName, _In_ LPVOID parameterBlo
 
     return result;
 }
-DECLARE_FIXUP(LoadModuleImpl, LoadModuleFixup);
+DECLARE_TRACE_FIXUP(function_type::dynamic_link_library, LoadModuleImpl, LoadModuleFixup);
 
 auto LoadPackagedLibraryImpl = &::LoadPackagedLibrary;
 HMODULE __stdcall LoadPackagedLibraryFixup(_In_ LPCWSTR libFileName, _Reserved_ DWORD reserved)
@@ -270,9 +280,14 @@ HMODULE __stdcall LoadPackagedLibraryFixup(_In_ LPCWSTR libFileName, _Reserved_
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result != NULL);
-    if (auto lock = acquire_output_lock(function_type::dynamic_link_library, functionResult))
+    if (auto lock = acquire_output_lock(function_type::dynamic_link_library, functionResult, libFileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::dynamic_link_library, "LoadPackagedLibrary", "Module");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, libFileName, { trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -315,7 +330,7 @@ HMODULE __stdcall LoadPackagedLibraryFixup(_In_ LPCWSTR libFileName, _Reserved_
 
     return result;
 }
-DECLARE_FIXUP(LoadPackagedLibraryImpl, LoadPackagedLibraryFixup);
+DECLARE_TRACE_FIXUP(function_type::dynamic_link_library, LoadPackagedLibraryImpl, LoadPackagedLibraryFixup);
 
 auto RemoveDllDirectoryImpl = &::RemoveDllDirectory;
 BOOL __stdcall RemoveDllDirectoryFixup(_In_ DLL_DIRECTORY_COOKIE cookie)
@@ -372,7 +387,7 @@ BOOL __stdcall RemoveDllDirectoryFixup(_In_ DLL_DIRECTORY_COOKIE cookie)
 
     return result;
 }
-DECLARE_FIXUP(RemoveDllDirectoryImpl, RemoveDllDirectoryFixup);
+DECLARE_TRACE_FIXUP(function_type::dynamic_link_library, RemoveDllDirectoryImpl, RemoveDllDirectoryFixup);
 
 auto SetDefaultDllDirectoriesImpl = &::SetDefaultDllDirectories;
 BOOL __stdcall SetDefaultDllDirectoriesFixup(_In_ DWORD directoryFlags)
@@ -429,7 +444,7 @@ BOOL __stdcall SetDefaultDllDirectoriesFixup(_In_ DWORD directoryFlags)
 
     return result;
 }
-DECLARE_FIXUP(SetDefaultDllDirectoriesImpl, SetDefaultDllDirectoriesFixup);
+DECLARE_TRACE_FIXUP(function_type::dynamic_link_library, SetDefaultDllDirectoriesImpl, SetDefaultDllDirectoriesFixup);
 
 auto SetDllDirectoryImpl = psf::detoured_string_function(&::SetDllDirectoryA, &::SetDllDirectoryW);
 template <typename CharT>
@@ -494,7 +509,7 @@ BOOL __stdcall SetDllDirectoryFixup(_In_opt_ const CharT* pathName)
 
     return result;
 }
-DECLARE_STRING_FIXUP(SetDllDirectoryImpl, SetDllDirectoryFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::dynamic_link_library, SetDllDirectoryImpl, SetDllDirectoryFixup);
 
 // NOTE: The following is a list of functions taken from https://msdn.microsoft.com/en-us/library/windows/desktop/ms682599(v=vs.85).aspx
 //       that are _not_ present above. This is just a convenient collection of what's missing; it is not a collection of
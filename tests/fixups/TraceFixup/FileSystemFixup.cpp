@@ -32,9 +32,15 @@ HANDLE __stdcall CreateFileFixup(
     preserve_last_error preserveError;
 
     auto functionResult = from_win32_bool(result != INVALID_HANDLE_VALUE);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::filesystem, "CreateFile", "DesiredAccess ShareMode CreationDisposition FlagsAndAttributes Handle");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, fileName,
+                { trace_arg(desiredAccess), trace_arg(shareMode), trace_arg(creationDisposition), trace_arg(flagsAndAttributes), trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -98,7 +104,7 @@ HANDLE __stdcall CreateFileFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(CreateFileImpl, CreateFileFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, CreateFileImpl, CreateFileFixup);
 
 auto CreateFile2Impl = &::CreateFile2;
 HANDLE __stdcall CreateFile2Fixup(
@@ -116,9 +122,15 @@ HANDLE __stdcall CreateFile2Fixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result != INVALID_HANDLE_VALUE);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::filesystem, "CreateFile2", "DesiredAccess ShareMode CreationDisposition Handle");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, fileName,
+                { trace_arg(desiredAccess), trace_arg(shareMode), trace_arg(creationDisposition), trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -187,7 +199,7 @@ HANDLE __stdcall CreateFile2Fixup(
 
     return result;
 }
-DECLARE_FIXUP(CreateFile2Impl, CreateFile2Fixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, CreateFile2Impl, CreateFile2Fixup);
 
 auto CopyFileImpl = psf::detoured_string_function(&::CopyFileA, &::CopyFileW);
 template <typename CharT>
@@ -201,7 +213,7 @@ BOOL __stdcall CopyFileFixup(_In_ const CharT* existingFileName, _In_ const Char
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, existingFileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -258,7 +270,7 @@ BOOL __stdcall CopyFileFixup(_In_ const CharT* existingFileName, _In_ const Char
 
     return result;
 }
-DECLARE_STRING_FIXUP(CopyFileImpl, CopyFileFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, CopyFileImpl, CopyFileFixup);
 
 auto CopyFile2Impl = &::CopyFile2;
 HRESULT __stdcall CopyFile2Fixup(
@@ -273,7 +285,7 @@ HRESULT __stdcall CopyFile2Fixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_hresult(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, existingFileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -330,7 +342,7 @@ HRESULT __stdcall CopyFile2Fixup(
 
     return result;
 }
-DECLARE_FIXUP(CopyFile2Impl, CopyFile2Fixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, CopyFile2Impl, CopyFile2Fixup);
 
 auto CopyFileExImpl = psf::detoured_string_function(&::CopyFileExA, &::CopyFileExW);
 template <typename CharT>
@@ -350,7 +362,7 @@ BOOL __stdcall CopyFileExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, existingFileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -406,7 +418,7 @@ BOOL __stdcall CopyFileExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(CopyFileExImpl, CopyFileExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, CopyFileExImpl, CopyFileExFixup);
 
 auto CreateHardLinkImpl = psf::detoured_string_function(&::CreateHardLinkA, &::CreateHardLinkW);
 template <typename CharT>
@@ -423,7 +435,7 @@ BOOL __stdcall CreateHardLinkFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -477,7 +489,7 @@ BOOL __stdcall CreateHardLinkFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(CreateHardLinkImpl, CreateHardLinkFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, CreateHardLinkImpl, CreateHardLinkFixup);
 
 auto CreateSymbolicLinkImpl = psf::detoured_string_function(&::CreateSymbolicLinkA, &::CreateSymbolicLinkW);
 template <typename CharT>
@@ -494,7 +506,7 @@ BOOLEAN __stdcall CreateSymbolicLinkFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, symlinkFileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -550,7 +562,7 @@ BOOLEAN __stdcall CreateSymbolicLinkFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(CreateSymbolicLinkImpl, CreateSymbolicLinkFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, CreateSymbolicLinkImpl, CreateSymbolicLinkFixup);
 
 auto DeleteFileImpl = psf::detoured_string_function(&::DeleteFileA, &::DeleteFileW);
 template <typename CharT>
@@ -564,9 +576,15 @@ BOOL __stdcall DeleteFileFixup(_In_ const CharT* fileName)
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::filesystem, "DeleteFile", "Result");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, fileName,
+                { trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -616,7 +634,7 @@ BOOL __stdcall DeleteFileFixup(_In_ const CharT* fileName)
 
     return result;
 }
-DECLARE_STRING_FIXUP(DeleteFileImpl, DeleteFileFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, DeleteFileImpl, DeleteFileFixup);
 
 auto MoveFileImpl = psf::detoured_string_function(&::MoveFileA, &::MoveFileW);
 template <typename CharT>
@@ -630,7 +648,7 @@ BOOL __stdcall MoveFileFixup(_In_ const CharT* existingFileName, _In_ const Char
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, existingFileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -684,7 +702,7 @@ BOOL __stdcall MoveFileFixup(_In_ const CharT* existingFileName, _In_ const Char
 
     return result;
 }
-DECLARE_STRING_FIXUP(MoveFileImpl, MoveFileFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, MoveFileImpl, MoveFileFixup);
 
 auto MoveFileExImpl = psf::detoured_string_function(&::MoveFileExA, &::MoveFileExW);
 template <typename CharT>
@@ -698,7 +716,7 @@ BOOL __stdcall MoveFileExFixup(_In_ const CharT* existingFileName, _In_opt_ cons
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, existingFileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -754,7 +772,7 @@ BOOL __stdcall MoveFileExFixup(_In_ const CharT* existingFileName, _In_opt_ cons
 
     return result;
 }
-DECLARE_STRING_FIXUP(MoveFileExImpl, MoveFileExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, MoveFileExImpl, MoveFileExFixup);
 
 auto ReplaceFileImpl = psf::detoured_string_function(&::ReplaceFileA, &::ReplaceFileW);
 template <typename CharT>
@@ -774,7 +792,7 @@ BOOL __stdcall ReplaceFileFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, replacedFileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -833,7 +851,7 @@ BOOL __stdcall ReplaceFileFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(ReplaceFileImpl, ReplaceFileFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, ReplaceFileImpl, ReplaceFileFixup);
 
 template <typename CharT>
 using win32_find_data_t = std::conditional_t<psf::is_ansi<CharT>, WIN32_FIND_DATAA, WIN32_FIND_DATAW>;
@@ -852,7 +870,7 @@ HANDLE __stdcall FindFirstFileFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result != INVALID_HANDLE_VALUE);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -920,7 +938,7 @@ HANDLE __stdcall FindFirstFileFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(FindFirstFileImpl, FindFirstFileFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, FindFirstFileImpl, FindFirstFileFixup);
 
 auto FindFirstFileExImpl = psf::detoured_string_function(&::FindFirstFileExA, &::FindFirstFileExW);
 template <typename CharT>
@@ -940,9 +958,15 @@ HANDLE __stdcall FindFirstFileExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result != INVALID_HANDLE_VALUE);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::filesystem, "FindFirstFileEx", "InfoLevel SearchOp AdditionalFlags Handle");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, fileName,
+                { trace_arg(infoLevelId), trace_arg(searchOp), trace_arg(additionalFlags), trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1016,7 +1040,7 @@ HANDLE __stdcall FindFirstFileExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(FindFirstFileExImpl, FindFirstFileExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, FindFirstFileExImpl, FindFirstFileExFixup);
 
 auto FindNextFileImpl = psf::detoured_string_function(&::FindNextFileA, &::FindNextFileW);
 template <typename CharT>
@@ -1094,7 +1118,7 @@ BOOL __stdcall FindNextFileFixup(_In_ HANDLE findFile, _Out_ win32_find_data_t<C
 
     return result;
 }
-DECLARE_STRING_FIXUP(FindNextFileImpl, FindNextFileFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, FindNextFileImpl, FindNextFileFixup);
 
 auto FindCloseImpl = &::FindClose;
 BOOL __stdcall FindCloseFixup(_Inout_ HANDLE findFile)
@@ -1159,7 +1183,7 @@ BOOL __stdcall FindCloseFixup(_Inout_ HANDLE findFile)
 
     return result;
 }
-DECLARE_FIXUP(FindCloseImpl, FindCloseFixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, FindCloseImpl, FindCloseFixup);
 
 auto CreateDirectoryImpl = psf::detoured_string_function(&::CreateDirectoryA, &::CreateDirectoryW);
 template <typename CharT>
@@ -1173,7 +1197,7 @@ BOOL __stdcall CreateDirectoryFixup(_In_ const CharT* pathName, _In_opt_ LPSECUR
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, pathName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1227,7 +1251,7 @@ BOOL __stdcall CreateDirectoryFixup(_In_ const CharT* pathName, _In_opt_ LPSECUR
 
     return result;
 }
-DECLARE_STRING_FIXUP(CreateDirectoryImpl, CreateDirectoryFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, CreateDirectoryImpl, CreateDirectoryFixup);
 
 auto CreateDirectoryExImpl = psf::detoured_string_function(&::CreateDirectoryExA, &::CreateDirectoryExW);
 template <typename CharT>
@@ -1244,7 +1268,7 @@ BOOL __stdcall CreateDirectoryExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, newDirectory))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1300,7 +1324,7 @@ BOOL __stdcall CreateDirectoryExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(CreateDirectoryExImpl, CreateDirectoryExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, CreateDirectoryExImpl, CreateDirectoryExFixup);
 
 auto RemoveDirectoryImpl = psf::detoured_string_function(&::RemoveDirectoryA, &::RemoveDirectoryW);
 template <typename CharT>
@@ -1314,7 +1338,7 @@ BOOL __stdcall RemoveDirectoryFixup(_In_ const CharT* pathName)
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, pathName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1366,7 +1390,7 @@ BOOL __stdcall RemoveDirectoryFixup(_In_ const CharT* pathName)
 
     return result;
 }
-DECLARE_STRING_FIXUP(RemoveDirectoryImpl, RemoveDirectoryFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, RemoveDirectoryImpl, RemoveDirectoryFixup);
 
 auto SetCurrentDirectoryImpl = psf::detoured_string_function(&::SetCurrentDirectoryA, &::SetCurrentDirectoryW);
 template <typename CharT>
@@ -1380,7 +1404,7 @@ BOOL __stdcall SetCurrentDirectoryFixup(_In_ const CharT* pathName)
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, pathName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1432,7 +1456,7 @@ BOOL __stdcall SetCurrentDirectoryFixup(_In_ const CharT* pathName)
 
     return result;
 }
-DECLARE_STRING_FIXUP(SetCurrentDirectoryImpl, SetCurrentDirectoryFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, SetCurrentDirectoryImpl, SetCurrentDirectoryFixup);
 
 auto GetCurrentDirectoryImpl = psf::detoured_string_function(&::GetCurrentDirectoryA, &::GetCurrentDirectoryW);
 template <typename CharT>
@@ -1505,7 +1529,7 @@ DWORD __stdcall GetCurrentDirectoryFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(GetCurrentDirectoryImpl, GetCurrentDirectoryFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, GetCurrentDirectoryImpl, GetCurrentDirectoryFixup);
 
 auto GetFileAttributesImpl = psf::detoured_string_function(&::GetFileAttributesA, &::GetFileAttributesW);
 template <typename CharT>
@@ -1519,9 +1543,15 @@ DWORD __stdcall GetFileAttributesFixup(_In_ const CharT* fileName)
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result != INVALID_FILE_ATTRIBUTES);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::filesystem, "GetFileAttributes", "Attributes");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, fileName,
+                { trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1579,7 +1609,7 @@ DWORD __stdcall GetFileAttributesFixup(_In_ const CharT* fileName)
 
     return result;
 }
-DECLARE_STRING_FIXUP(GetFileAttributesImpl, GetFileAttributesFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, GetFileAttributesImpl, GetFileAttributesFixup);
 
 auto SetFileAttributesImpl = psf::detoured_string_function(&::SetFileAttributesA, &::SetFileAttributesW);
 template <typename CharT>
@@ -1593,7 +1623,7 @@ BOOL __stdcall SetFileAttributesFixup(_In_ const CharT* fileName, _In_ DWORD fil
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1647,7 +1677,7 @@ BOOL __stdcall SetFileAttributesFixup(_In_ const CharT* fileName, _In_ DWORD fil
 
     return result;
 }
-DECLARE_STRING_FIXUP(SetFileAttributesImpl, SetFileAttributesFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, SetFileAttributesImpl, SetFileAttributesFixup);
 
 auto GetFileAttributesExImpl = psf::detoured_string_function(&::GetFileAttributesExA, &::GetFileAttributesExW);
 template <typename CharT>
@@ -1664,9 +1694,15 @@ BOOL __stdcall GetFileAttributesExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32_bool(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::filesystem, "GetFileAttributesEx", "InfoLevel Result");
+            LogCallRecord(functionId, functionResult, ::GetLastError(), TickStart, TickEnd, fileName,
+                { trace_arg(infoLevelId), trace_arg(result) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1729,7 +1765,7 @@ BOOL __stdcall GetFileAttributesExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(GetFileAttributesExImpl, GetFileAttributesExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, GetFileAttributesExImpl, GetFileAttributesExFixup);
 
 auto LZOpenFileImpl = psf::detoured_string_function(&::LZOpenFileA, &::LZOpenFileW);
 template <typename CharT>
@@ -1742,7 +1778,7 @@ INT __stdcall LZOpenFileFixup(_In_ CharT* fileName, _Inout_ LPOFSTRUCT reOpenBuf
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_lzerror(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, fileName))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1800,7 +1836,7 @@ INT __stdcall LZOpenFileFixup(_In_ CharT* fileName, _Inout_ LPOFSTRUCT reOpenBuf
 
     return result;
 }
-DECLARE_STRING_FIXUP(LZOpenFileImpl, LZOpenFileFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, LZOpenFileImpl, LZOpenFileFixup);
 
 
 // Detours seems to only handle string pairs.  Need to figure out how to do something like this...
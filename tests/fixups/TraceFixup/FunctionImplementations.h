@@ -609,6 +609,28 @@ namespace winternl
         PVOID KeyValueInformation,
         ULONG Length,
         PULONG ResultLength);
+
+    // NOTE: The loader notification types are documented, but only declared in the DDK. The notification data is really a
+    //       union with the unloaded data, which has the same layout
+    struct LDR_DLL_LOADED_NOTIFICATION_DATA
+    {
+        ULONG Flags;
+        PCUNICODE_STRING FullDllName;
+        PCUNICODE_STRING BaseDllName;
+        PVOID DllBase;
+        ULONG SizeOfImage;
+    };
+
+    constexpr ULONG LDR_DLL_NOTIFICATION_REASON_LOADED = 1;
+    constexpr ULONG LDR_DLL_NOTIFICATION_REASON_UNLOADED = 2;
+
+    using LDR_DLL_NOTIFICATION_FUNCTION = VOID(CALLBACK*)(ULONG NotificationReason, const LDR_DLL_LOADED_NOTIFICATION_DATA* NotificationData, PVOID Context);
+
+    NTSTATUS __stdcall LdrRegisterDllNotification(
+        ULONG Flags,
+        LDR_DLL_NOTIFICATION_FUNCTION NotificationFunction,
+        PVOID Context,
+        PVOID* Cookie);
 }
 
 // NOTE: The functions in winternl.h are not included in any import lib and therefore must be manually loaded in
@@ -637,4 +659,5 @@ namespace impl
     inline auto NtQueryKey = WINTERNL_FUNCTION(winternl::NtQueryKey);
     inline auto NtQueryInformationFile = WINTERNL_FUNCTION(winternl::NtQueryInformationFile);
     inline auto NtQueryValueKey = WINTERNL_FUNCTION(winternl::NtQueryValueKey);
+    inline auto LdrRegisterDllNotification = WINTERNL_FUNCTION(winternl::LdrRegisterDllNotification);
 }
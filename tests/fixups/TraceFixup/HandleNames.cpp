@@ -0,0 +1,142 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <windows.h>
+#include <winternl.h>
+
+#include "HandleNames.h"
+
+namespace
+{
+    // Opens and closes happen on every thread, so the table is split into shards by handle value, each with a lock of
+    // its own. Handle values are multiples of four, which the shard index leaves out
+    constexpr std::size_t shard_count = 16;
+
+    struct handle_name_shard
+    {
+        std::shared_mutex lock;
+        std::unordered_map<HANDLE, std::wstring> names;
+    };
+
+    handle_name_shard g_shards[shard_count];
+
+    // So that closing a handle doesn't need to look when nothing has been remembered, as is the case for most processes
+    // most of the time
+    std::atomic<std::size_t> g_nameCount{ 0 };
+
+    handle_name_shard& shard_of(HANDLE handle) noexcept
+    {
+        return g_shards[(reinterpret_cast<std::uintptr_t>(handle) >> 2) % shard_count];
+    }
+
+    std::wstring_view relative_name(POBJECT_ATTRIBUTES objectAttributes) noexcept
+    {
+        if (!objectAttributes || !objectAttributes->ObjectName || !objectAttributes->ObjectName->Buffer)
+        {
+            return {};
+        }
+
+        return { objectAttributes->ObjectName->Buffer, objectAttributes->ObjectName->Length / sizeof(wchar_t) };
+    }
+
+    bool has_root(POBJECT_ATTRIBUTES objectAttributes) noexcept
+    {
+        return objectAttributes && objectAttributes->RootDirectory && (objectAttributes->RootDirectory != INVALID_HANDLE_VALUE);
+    }
+
+    // Returns false when the name is relative to a handle that isn't known
+    bool full_name(POBJECT_ATTRIBUTES objectAttributes, std::wstring& result)
+    {
+        auto name = relative_name(objectAttributes);
+        if (!has_root(objectAttributes))
+        {
+            result.assign(name);
+            return true;
+        }
+
+        if (!TryGetHandleName(objectAttributes->RootDirectory, result))
+        {
+            return false;
+        }
+
+        if (!name.empty())
+        {
+            if (result.empty() || (result.back() != L'\\'))
+            {
+                result.push_back(L'\\');
+            }
+            result.append(name);
+        }
+
+        return true;
+    }
+}
+
+void RememberHandleName(HANDLE handle, POBJECT_ATTRIBUTES objectAttributes) noexcept try
+{
+    std::wstring name;
+    if (!handle || !full_name(objectAttributes, name) || name.empty())
+    {
+        return;
+    }
+
+    auto& shard = shard_of(handle);
+    std::unique_lock<std::shared_mutex> lock(shard.lock);
+    if (shard.names.insert_or_assign(handle, std::move(name)).second)
+    {
+        g_nameCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+catch (...)
+{
+    // Not remembering the name only means that the kernel is asked for it, as before
+}
+
+void ForgetHandleName(HANDLE handle) noexcept
+{
+    if (g_nameCount.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+
+    auto& shard = shard_of(handle);
+    std::unique_lock<std::shared_mutex> lock(shard.lock);
+    if (shard.names.erase(handle))
+    {
+        g_nameCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+bool TryGetHandleName(HANDLE handle, std::wstring& result)
+{
+    auto& shard = shard_of(handle);
+    std::shared_lock<std::shared_mutex> lock(shard.lock);
+    auto itr = shard.names.find(handle);
+    if (itr == shard.names.end())
+    {
+        return false;
+    }
+
+    result = itr->second;
+    return true;
+}
+
+std::wstring_view ObjectAttributesName(POBJECT_ATTRIBUTES objectAttributes, std::wstring& buffer)
+{
+    if (has_root(objectAttributes) && full_name(objectAttributes, buffer))
+    {
+        return buffer;
+    }
+
+    return relative_name(objectAttributes);
+}
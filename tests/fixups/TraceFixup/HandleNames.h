@@ -0,0 +1,23 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <windows.h>
+#include <winternl.h>
+
+// The full names of the files, directories and keys opened through the NT functions that TraceFixup traces, by handle.
+// Opens relative to one of these handles are then logged with their full name without asking the kernel for the name of
+// the root, which is both a lot cheaper and works for handles opened without the access needed to query them. Handles
+// from anywhere else - e.g. duplicated handles, or ones opened before TraceFixup was loaded - aren't known
+void RememberHandleName(HANDLE handle, POBJECT_ATTRIBUTES objectAttributes) noexcept;
+void ForgetHandleName(HANDLE handle) noexcept;
+bool TryGetHandleName(HANDLE handle, std::wstring& result);
+
+// The full name of the object that 'objectAttributes' names, if it is either absolute or relative to a known handle.
+// Otherwise, the name as given, relative to its root. 'buffer' holds the name when it needs to be put together
+std::wstring_view ObjectAttributesName(POBJECT_ATTRIBUTES objectAttributes, std::wstring& buffer);
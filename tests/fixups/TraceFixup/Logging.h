@@ -4,11 +4,17 @@
 //-------------------------------------------------------------------------------------------------------
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <cwchar>
+#include <initializer_list>
+#include <iterator>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 #include <intrin.h>
 #include <windows.h>
@@ -18,6 +24,11 @@
 #include <psf_utils.h>
 
 #include "Config.h"
+#include "HandleNames.h"
+#include "ModuleCache.h"
+#include "PathFilters.h"
+#include "TraceProfile.h"
+#include "TraceRing.h"
 
 // Conditionally define flags introduced after RS1 (14393) SDK
 #ifndef FILE_ATTRIBUTE_PINNED
@@ -59,7 +70,21 @@ inline void Log(const char* fmt, ...)
         std::vprintf(fmt, args);
         va_end(args);
     }
-    else // trace_method::output_debug_string
+    else if (uses_trace_rings(output_method))
+    {
+        // Formatted on the stack, since this is the traced thread's time; overly long records are truncated
+        char buffer[1024];
+        va_list args;
+        va_start(args, fmt);
+        auto count = std::vsnprintf(buffer, std::size(buffer), fmt, args);
+        va_end(args);
+
+        if (count > 0)
+        {
+            WriteTraceRecord(buffer, std::min(static_cast<std::size_t>(count), std::size(buffer) - 1));
+        }
+    }
+    else // trace_method::output_debug_string, or trace_method::etw_events
     {
         std::string str;
         str.resize(256);
@@ -84,7 +109,15 @@ inline void Log(const char* fmt, ...)
 
         str.resize(count);
 
-        ::OutputDebugStringA(str.c_str());
+        if (output_method == trace_method::etw_events)
+        {
+            // Only the fixups that don't write call records get here
+            Log_ETW_PostMsgA(str.c_str());
+        }
+        else
+        {
+            ::OutputDebugStringA(str.c_str());
+        }
     }
 }
 
@@ -97,7 +130,25 @@ inline void Log(const wchar_t* fmt, ...)
         std::vwprintf(fmt, args);
         va_end(args);
     }
-    else // trace_method::output_debug_string
+    else if (uses_trace_rings(output_method))
+    {
+        wchar_t buffer[1024];
+        va_list args;
+        va_start(args, fmt);
+        auto count = ::_vsnwprintf_s(buffer, std::size(buffer), _TRUNCATE, fmt, args);
+        va_end(args);
+
+        // Truncation is reported as a failure, but leaves what fit in the buffer
+        count = (count < 0) ? static_cast<int>(std::wcslen(buffer)) : count;
+
+        char utf8[3 * std::size(buffer)];
+        auto length = ::WideCharToMultiByte(CP_UTF8, 0, buffer, count, utf8, static_cast<int>(std::size(utf8)), nullptr, nullptr);
+        if (length > 0)
+        {
+            WriteTraceRecord(utf8, static_cast<std::size_t>(length));
+        }
+    }
+    else // trace_method::output_debug_string, or trace_method::etw_events
     {
         try
         {
@@ -121,7 +172,14 @@ inline void Log(const wchar_t* fmt, ...)
                 assert(count >= 0);
             }
             wstr.resize(count);
-            ::OutputDebugStringW(wstr.c_str());
+            if (output_method == trace_method::etw_events)
+            {
+                Log_ETW_PostMsgW(wstr.c_str());
+            }
+            else
+            {
+                ::OutputDebugStringW(wstr.c_str());
+            }
         }
         catch (...)
         {
@@ -580,13 +638,9 @@ inline std::string InterpretLZError(INT err)
 #define LogCallingModule() \
     if (trace_calling_module) \
     { \
-        HMODULE moduleHandle; \
-        if (::GetModuleHandleExW( \
-            GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, \
-            reinterpret_cast<const wchar_t*>(_ReturnAddress()), \
-            &moduleHandle)) \
+        if (auto callingModule = FindCallingModule(_ReturnAddress())) \
         { \
-            Log("\tCalling Module=%ls\n", psf::get_module_path(moduleHandle).c_str()); \
+            Log("\tCalling Module=%ls\n", callingModule->path.c_str()); \
         } \
     }
 
@@ -600,15 +654,11 @@ inline std::string InterpretLZError(INT err)
 #define InterpretCallingModulePart1() \
     if (trace_calling_module) \
     { \
-        HMODULE moduleHandle; \
-        if (::GetModuleHandleExW( \
-            GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, \
-            reinterpret_cast<const wchar_t*>(_ReturnAddress()), \
-            &moduleHandle)) \
+        if (auto callingModule = FindCallingModule(_ReturnAddress())) \
         { 
 
 #define InterpretCallingModulePart2() \
-     psf::get_module_path(moduleHandle).generic_string();
+     callingModule->generic_path;
 
 #define InterpretCallingModulePart3() \
         } \
@@ -633,30 +683,68 @@ inline std::string InterpretLZError(INT err)
 //    return sout.str();
 //}
 
-// RAII type to acquire/release the output lock that also tracks/exposes whether or not the function result should be logged
+// RAII type to acquire/release the output lock that also tracks/exposes whether or not the function result should be logged.
+// The lock is only taken when the result is going to be logged; most results are filtered out without it. Nor is it taken
+// for the ring buffer, where each thread's output goes to a ring of its own and so never interleaves with others'
 struct output_lock
 {
-    // Don't let function calls made while processing output cause more output. This is effectively a "were we the first
-    // to acquire the lock" check
-    static inline bool processing_output = false;
+    // Don't let function calls made while processing output cause more output. Only this thread can be processing output
+    // while it holds the lock, so this is effectively a "were we the first to acquire the lock" check
+    static inline thread_local bool processing_output = false;
 
-    output_lock(function_type type, function_result result)
+    // 'ticks' is how long the call took, or negative when that isn't known. 'included' is whether the call passed the
+    // path filters
+    output_lock(function_type type, function_result result, std::int64_t ticks, bool included)
     {
-        g_outputMutex.lock();
-        m_inhibitOutput = std::exchange(processing_output, true);
+        auto [shouldLog, shouldBreak] = configured_result(type, result, included);
+        if (shouldLog && (slow_call_ticks != 0))
+        {
+            // Only calls that took at least the threshold are logged, along with where they were called from
+            shouldLog = ticks >= slow_call_ticks;
+            if (shouldLog)
+            {
+                m_ticks = ticks;
+                m_frameCount = ::RtlCaptureStackBackTrace(1, static_cast<DWORD>(std::size(m_frames)), m_frames, nullptr);
+            }
+        }
+
+        if (shouldLog)
+        {
+            if (needs_output_lock(output_method))
+            {
+                g_outputMutex.lock();
+                m_locked = true;
+            }
+            m_logging = true;
+            m_inhibitOutput = std::exchange(processing_output, true);
+            m_shouldLog = !m_inhibitOutput;
+        }
 
-        auto [shouldLog, shouldBreak] = configured_result(type, result);
-        m_shouldLog = !m_inhibitOutput && shouldLog;
         if (shouldBreak)
         {
             ::DebugBreak();
         }
     }
 
+    output_lock(const output_lock&) = delete;
+    output_lock& operator=(const output_lock&) = delete;
+
     ~output_lock()
     {
-        processing_output = m_inhibitOutput;
-        g_outputMutex.unlock();
+        if (m_shouldLog && (m_ticks >= 0))
+        {
+            LogSlowCall(m_ticks, m_frames, m_frameCount);
+        }
+
+        if (m_logging)
+        {
+            processing_output = m_inhibitOutput;
+        }
+
+        if (m_locked)
+        {
+            g_outputMutex.unlock();
+        }
     }
 
     explicit operator bool() const noexcept
@@ -666,64 +754,242 @@ struct output_lock
 
 private:
 
-    bool m_inhibitOutput;
-    bool m_shouldLog;
+    bool m_locked = false;
+    bool m_logging = false;
+    bool m_inhibitOutput = false;
+    bool m_shouldLog = false;
+
+    std::int64_t m_ticks = -1;
+    void* m_frames[32];
+    USHORT m_frameCount = 0;
 };
 
+inline output_lock acquire_filtered_output_lock(function_type type, function_result result, bool included)
+{
+    // Fixups acquire the lock as soon as the function they trace returns, which makes it the end of the call's time
+    std::int64_t ticks = -1;
+    if (times_calls() && !output_lock::processing_output)
+    {
+        if (auto call = t_profiledCall; call && !call->recorded)
+        {
+            call->recorded = true;
+            ticks = profile_timestamp() - call->start;
+            if (profile_calls)
+            {
+                RecordProfiledCall(call->name, static_cast<std::uint8_t>(result), ticks);
+            }
+            if (profile_stack_one_in != 0)
+            {
+                RecordProfiledStack(*call, ticks);
+            }
+        }
+    }
+
+    return output_lock(type, result, ticks, included);
+}
+
 inline output_lock acquire_output_lock(function_type type, function_result result)
 {
-    return output_lock(type, result);
+    return acquire_filtered_output_lock(type, result, true);
+}
+
+// The same as the above, for calls that name a path, key or DLL that 'pathFilters' can filter on. The path is only looked
+// at when traceLevels would otherwise have the result logged
+inline bool path_filter_applies(function_type type, function_result result)
+{
+    return path_filters_enabled && result_logged(type, result) && !output_lock::processing_output;
 }
 
-// RAII helper for handling the 'traceFunctionEntry' configuration
+inline output_lock acquire_output_lock(function_type type, function_result result, const wchar_t* path)
+{
+    return acquire_filtered_output_lock(type, result,
+        !path_filter_applies(type, result) || !path || PathIncluded(type, path));
+}
+
+inline output_lock acquire_output_lock(function_type type, function_result result, const char* path)
+{
+    return acquire_filtered_output_lock(type, result,
+        !path_filter_applies(type, result) || !path || PathIncluded(type, widen(path)));
+}
+
+inline output_lock acquire_output_lock(function_type type, function_result result, POBJECT_ATTRIBUTES objectAttributes)
+{
+    auto included = true;
+    if (path_filter_applies(type, result))
+    {
+        std::wstring name;
+        included = PathIncluded(type, ObjectAttributesName(objectAttributes, name));
+    }
+
+    return acquire_filtered_output_lock(type, result, included);
+}
+
+inline output_lock acquire_output_lock(function_type type, function_result result, HKEY key)
+{
+    return acquire_filtered_output_lock(type, result, !path_filter_applies(type, result) || KeyIncluded(key, {}));
+}
+
+inline output_lock acquire_output_lock(function_type type, function_result result, HKEY key, const wchar_t* subKey)
+{
+    return acquire_filtered_output_lock(type, result,
+        !path_filter_applies(type, result) || KeyIncluded(key, subKey ? subKey : L""));
+}
+
+inline output_lock acquire_output_lock(function_type type, function_result result, HKEY key, const char* subKey)
+{
+    return acquire_filtered_output_lock(type, result,
+        !path_filter_applies(type, result) || KeyIncluded(key, subKey ? widen(subKey) : std::wstring{}));
+}
+
+// Converts an argument to the raw value that call records hold
+template <typename T>
+inline std::uint64_t trace_arg(T value) noexcept
+{
+    if constexpr (std::is_pointer_v<T>)
+    {
+        return reinterpret_cast<std::uintptr_t>(value);
+    }
+    else
+    {
+        return static_cast<std::uint64_t>(value);
+    }
+}
+
+inline std::uint16_t RegisterTraceFunction(function_type type, const char* name, const char* argumentNames) noexcept
+{
+    return RegisterTraceFunction(trace_function{ name, argumentNames, static_cast<std::uint8_t>(type) });
+}
+
+// Writes a call record for the 'binary' or 'etwEvents' trace method, in place of formatting the call as text. The string
+// is whichever argument best identifies what the call was about, e.g. a path or a value name, and may be empty
+template <typename CharT>
+inline void LogCallRecord(
+    std::uint16_t functionId,
+    function_result result,
+    DWORD error,
+    LARGE_INTEGER start,
+    LARGE_INTEGER end,
+    std::basic_string_view<CharT> string,
+    std::initializer_list<std::uint64_t> args) noexcept
+{
+    if (output_method == trace_method::binary)
+    {
+        WriteCallRecord(functionId, static_cast<std::uint8_t>(result), error, start.QuadPart, end.QuadPart,
+            string.data(), string.length() * sizeof(CharT), std::is_same_v<CharT, wchar_t>, args.begin(), args.size());
+    }
+    else if constexpr (std::is_same_v<CharT, wchar_t>)
+    {
+        Log_ETW_PostCall(TraceFunction(functionId), result, error, start, end, string.data(), string.length(), args.begin(), args.size());
+    }
+    else
+    {
+        // ETW events always carry the string as UTF-16; ANSI strings are rare enough to convert on the stack
+        wchar_t buffer[MAX_PATH];
+        auto length = string.empty() ? 0 : ::MultiByteToWideChar(CP_ACP, 0, string.data(), static_cast<int>(std::min<std::size_t>(string.length(), MAX_PATH)), buffer, MAX_PATH);
+        Log_ETW_PostCall(TraceFunction(functionId), result, error, start, end, buffer, static_cast<std::size_t>(length), args.begin(), args.size());
+    }
+}
+
+template <typename CharT>
+inline void LogCallRecord(
+    std::uint16_t functionId,
+    function_result result,
+    DWORD error,
+    LARGE_INTEGER start,
+    LARGE_INTEGER end,
+    const CharT* string,
+    std::initializer_list<std::uint64_t> args) noexcept
+{
+    LogCallRecord(functionId, result, error, start, end, string ? std::basic_string_view<CharT>(string) : std::basic_string_view<CharT>{}, args);
+}
+
+// Most functions are named "SomeFunctionFixup" where the target API is "SomeFunction". Logging the API is much more
+// helpful than the Fixup function name, so remove the "Fixup" suffix, if present. Given __FUNCTION__, this is folded
+// away at compile time
+constexpr std::string_view traced_function_name(std::string_view functionName) noexcept
+{
+    constexpr std::string_view fixupSuffix = "Fixup";
+    if ((functionName.length() >= fixupSuffix.length()) &&
+        (functionName.substr(functionName.length() - fixupSuffix.length()) == fixupSuffix))
+    {
+        return functionName.substr(0, functionName.length() - fixupSuffix.length());
+    }
+
+    return functionName;
+}
+
+// RAII helper for handling the 'traceFunctionEntry' configuration. There's no lock to take unless the trace method
+// needs one to keep a separator and the entry that follows it together, so that, with the ring buffer methods, entry
+// tracing costs no more than a record in the thread's own ring
 struct function_entry_tracker
 {
     // Used for printing function entry/exit separators
     static inline thread_local std::size_t function_call_depth = 0;
 
-    function_entry_tracker(const char* functionName)
+    function_entry_tracker(const char* functionName, std::string_view tracedName)
     {
-        if (trace_function_entry)
+        if (times_calls())
         {
-            std::lock_guard<std::recursive_mutex> lock(g_outputMutex);
-            if (!output_lock::processing_output)
-            {
-                if (++function_call_depth == 1)
-                {
-                    Log("vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv\n");
-                }
+            m_profiledCall = { functionName, 0, std::exchange(t_profiledCall, &m_profiledCall), false };
+            m_profiling = true;
+        }
 
-                // Most functions are named "SomeFunctionFixup" where the target API is "SomeFunction". Logging the API
-                // is much more helpful than the Fixup function name, so remove the "Fixup" suffix, if present
-                using namespace std::literals;
-                constexpr auto fixupSuffix = "Fixup"sv;
-                std::string name = functionName;
-                if ((name.length() >= fixupSuffix.length()) && (name.substr(name.length() - fixupSuffix.length()) == fixupSuffix))
-                {
-                    name.resize(name.length() - fixupSuffix.length());
-                }
+        if (trace_function_entry && !output_lock::processing_output)
+        {
+            std::unique_lock<std::recursive_mutex> lock(g_outputMutex, std::defer_lock);
+            if (needs_output_lock(output_method))
+            {
+                lock.lock();
+            }
 
-                Log("Function Entry: %s\n", name.c_str());
+            if (++function_call_depth == 1)
+            {
+                Log("vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv\n");
             }
+
+            Log("Function Entry: %.*s\n", static_cast<int>(tracedName.length()), tracedName.data());
+        }
+
+        // Last, so that none of the above is counted as part of the call
+        if (m_profiling)
+        {
+            m_profiledCall.start = profile_timestamp();
         }
     }
 
+    function_entry_tracker(const function_entry_tracker&) = delete;
+    function_entry_tracker& operator=(const function_entry_tracker&) = delete;
+
     ~function_entry_tracker()
     {
-        if (trace_function_entry)
+        // The depth is per thread, but the separator still needs the lock of the methods that have one: their records are
+        // written by several Log calls under it, and an unlocked line from another thread could land in the middle of one
+        if (trace_function_entry && !output_lock::processing_output)
         {
-            std::lock_guard<std::recursive_mutex> lock(g_outputMutex);
-            if (!output_lock::processing_output)
+            if (--function_call_depth == 0)
             {
-                if (--function_call_depth == 0)
+                std::unique_lock<std::recursive_mutex> lock(g_outputMutex, std::defer_lock);
+                if (needs_output_lock(output_method))
                 {
-                    Log("^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n");
+                    lock.lock();
                 }
+
+                Log("^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n");
             }
         }
+
+        if (m_profiling)
+        {
+            t_profiledCall = m_profiledCall.outer;
+        }
     }
+
+private:
+
+    profiled_call m_profiledCall = {};
+    bool m_profiling = false;
 };
-#define LogFunctionEntry() function_entry_tracker{ __FUNCTION__ }
+#define LogFunctionEntry() function_entry_tracker{ __FUNCTION__, traced_function_name(__FUNCTION__) }
 
 // Logging functions for enums, flags, and other defines
 template <typename T, typename U>
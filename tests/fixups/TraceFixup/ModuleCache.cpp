@@ -0,0 +1,175 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <winternl.h>
+
+#include <psf_utils.h>
+
+#include "FunctionImplementations.h"
+#include "ModuleCache.h"
+
+namespace
+{
+    // Sorted by base address. Snapshots are immutable once published; each change to the set of modules publishes a new
+    // one, and the old ones are kept for the threads that might still be searching them
+    using module_snapshot = std::vector<const cached_module*>;
+
+    std::atomic<const module_snapshot*> g_modules{ nullptr };
+
+    std::mutex g_modulesLock;
+    std::vector<std::unique_ptr<module_snapshot>> g_snapshots;
+    std::vector<std::unique_ptr<cached_module>> g_cachedModules;
+
+    const cached_module* make_module(std::uintptr_t base, std::uintptr_t size, std::wstring path)
+    {
+        auto module = std::make_unique<cached_module>();
+        module->base = base;
+        module->end = base + size;
+        module->generic_path = std::filesystem::path(path).generic_string();
+        module->path = std::move(path);
+
+        g_cachedModules.push_back(std::move(module));
+        return g_cachedModules.back().get();
+    }
+
+    // Must hold g_modulesLock
+    void publish(module_snapshot modules)
+    {
+        std::sort(modules.begin(), modules.end(), [](const cached_module* lhs, const cached_module* rhs)
+        {
+            return lhs->base < rhs->base;
+        });
+
+        g_snapshots.push_back(std::make_unique<module_snapshot>(std::move(modules)));
+        g_modules.store(g_snapshots.back().get(), std::memory_order_release);
+    }
+
+    std::uintptr_t image_size(const void* base) noexcept
+    {
+        auto dosHeader = static_cast<const IMAGE_DOS_HEADER*>(base);
+        auto ntHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(static_cast<const std::uint8_t*>(base) + dosHeader->e_lfanew);
+        return ntHeaders->OptionalHeader.SizeOfImage;
+    }
+
+    std::wstring unicode_string(PCUNICODE_STRING str)
+    {
+        return str->Buffer ? std::wstring(str->Buffer, str->Length / sizeof(wchar_t)) : std::wstring{};
+    }
+
+    VOID CALLBACK on_dll_notification(ULONG reason, const winternl::LDR_DLL_LOADED_NOTIFICATION_DATA* data, PVOID) noexcept try
+    {
+        auto base = reinterpret_cast<std::uintptr_t>(data->DllBase);
+
+        std::lock_guard<std::mutex> lock(g_modulesLock);
+        auto current = g_modules.load(std::memory_order_relaxed);
+        if (!current)
+        {
+            return;
+        }
+
+        auto modules = *current;
+        modules.erase(std::remove_if(modules.begin(), modules.end(), [&](const cached_module* module)
+        {
+            return module->base == base;
+        }), modules.end());
+
+        if (reason == winternl::LDR_DLL_NOTIFICATION_REASON_LOADED)
+        {
+            modules.push_back(make_module(base, data->SizeOfImage, unicode_string(data->FullDllName)));
+        }
+
+        publish(std::move(modules));
+    }
+    catch (...)
+    {
+        // The loader must not see exceptions. The module is found the slow way instead
+    }
+
+    const cached_module* find_in_snapshot(const module_snapshot& modules, std::uintptr_t address) noexcept
+    {
+        auto itr = std::upper_bound(modules.begin(), modules.end(), address, [](std::uintptr_t value, const cached_module* module)
+        {
+            return value < module->base;
+        });
+
+        if ((itr != modules.begin()) && (address < (*--itr)->end))
+        {
+            return *itr;
+        }
+
+        return nullptr;
+    }
+}
+
+void InitializeModuleCache() noexcept try
+{
+    std::lock_guard<std::mutex> lock(g_modulesLock);
+    if (g_modules.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    // Registered before the list is read - both while holding the loader lock - so that no module is missed
+    PVOID cookie;
+    if (!NT_SUCCESS(impl::LdrRegisterDllNotification(0, &on_dll_notification, nullptr, &cookie)))
+    {
+        return;
+    }
+
+    module_snapshot modules;
+    auto loaderData = ::NtCurrentTeb()->ProcessEnvironmentBlock->Ldr;
+    auto head = &loaderData->InMemoryOrderModuleList;
+    for (auto link = head->Flink; link != head; link = link->Flink)
+    {
+        auto entry = CONTAINING_RECORD(link, LDR_DATA_TABLE_ENTRY, InMemoryOrderLinks);
+        modules.push_back(make_module(reinterpret_cast<std::uintptr_t>(entry->DllBase), image_size(entry->DllBase), unicode_string(&entry->FullDllName)));
+    }
+
+    publish(std::move(modules));
+}
+catch (...)
+{
+    // Without the cache, modules are found the slow way
+}
+
+const cached_module* FindCallingModule(const void* address) noexcept try
+{
+    if (auto modules = g_modules.load(std::memory_order_acquire))
+    {
+        if (auto module = find_in_snapshot(*modules, reinterpret_cast<std::uintptr_t>(address)))
+        {
+            return module;
+        }
+    }
+
+    HMODULE moduleHandle;
+    if (!::GetModuleHandleExW(
+        GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        static_cast<const wchar_t*>(address),
+        &moduleHandle))
+    {
+        return nullptr;
+    }
+
+    static thread_local cached_module lookedUp;
+    lookedUp.base = reinterpret_cast<std::uintptr_t>(moduleHandle);
+    lookedUp.end = lookedUp.base + image_size(moduleHandle);
+    lookedUp.path = psf::get_module_path(moduleHandle).native();
+    lookedUp.generic_path = std::filesystem::path(lookedUp.path).generic_string();
+    return &lookedUp;
+}
+catch (...)
+{
+    return nullptr;
+}
@@ -0,0 +1,27 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// The address range and path of a module loaded in the process. Never freed, even once the module is unloaded, so that
+// threads that found one don't need to hold on to anything while using it
+struct cached_module
+{
+    std::uintptr_t base;
+    std::uintptr_t end;
+    std::wstring path;
+    std::string generic_path;   // As std::filesystem::path::generic_string, for the eventlog trace method
+};
+
+// Starts keeping a sorted array of the loaded modules, updated by loader notifications. Must be called during DllMain,
+// where the loader lock keeps the list of modules still while it is first read
+void InitializeModuleCache() noexcept;
+
+// The module that contains 'address', found by a binary search once the cache is initialized. Before then, or for an
+// address the cache doesn't know, falls back to asking the loader, in which case the result is only valid until the
+// thread's next call. Returns null when no module contains the address
+const cached_module* FindCallingModule(const void* address) noexcept;
@@ -0,0 +1,339 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdint>
+#include <cwctype>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <windows.h>
+#include <sddl.h>
+
+#include <psf_framework.h>
+#include <psf_runtime.h>
+#include <utilities.h>
+
+#include "Config.h"
+#include "HandleNames.h"
+#include "PathFilters.h"
+
+using namespace std::literals;
+
+namespace
+{
+    enum class filter_action : std::uint8_t
+    {
+        none,
+        include,
+        exclude,
+    };
+
+    // Nodes are stored in a single array, with each node's children sorted by character. Built once during DllMain and
+    // only read afterwards
+    struct trie_node
+    {
+        std::vector<std::pair<wchar_t, std::uint32_t>> children;
+        filter_action action = filter_action::none;
+    };
+
+    std::vector<trie_node> g_trie(1);
+    bool g_hasIncludes = false;
+
+    inline wchar_t fold(wchar_t ch) noexcept
+    {
+        if (ch == L'/')
+        {
+            return L'\\';
+        }
+        else if (ch < 0x80)
+        {
+            return ((ch >= L'A') && (ch <= L'Z')) ? static_cast<wchar_t>(ch - L'A' + L'a') : ch;
+        }
+
+        return static_cast<wchar_t>(std::towlower(ch));
+    }
+
+    inline bool is_separator(wchar_t ch) noexcept
+    {
+        return (ch == L'\\') || (ch == L'/');
+    }
+
+    std::wstring_view strip_prefix(std::wstring_view path) noexcept
+    {
+        for (auto prefix : { LR"(\\?\)"sv, LR"(\??\)"sv })
+        {
+            if ((path.length() >= prefix.length()) && (path.substr(0, prefix.length()) == prefix))
+            {
+                return path.substr(prefix.length());
+            }
+        }
+
+        return path;
+    }
+
+    void add_filter(std::wstring_view prefix, filter_action action)
+    {
+        // A trailing separator would keep the prefix from matching the folder itself
+        while (!prefix.empty() && is_separator(prefix.back()))
+        {
+            prefix.remove_suffix(1);
+        }
+
+        if (prefix.empty())
+        {
+            return;
+        }
+
+        std::uint32_t index = 0;
+        for (auto ch : prefix)
+        {
+            auto folded = fold(ch);
+            auto& children = g_trie[index].children;
+            auto itr = std::lower_bound(children.begin(), children.end(), folded, [](auto& child, wchar_t value)
+            {
+                return child.first < value;
+            });
+
+            if ((itr != children.end()) && (itr->first == folded))
+            {
+                index = itr->second;
+            }
+            else
+            {
+                auto child = static_cast<std::uint32_t>(g_trie.size());
+                children.insert(itr, { folded, child });
+                g_trie.emplace_back();
+                index = child;
+            }
+        }
+
+        g_trie[index].action = action;
+        g_hasIncludes = g_hasIncludes || (action == filter_action::include);
+    }
+
+    std::wstring current_user_key()
+    {
+        std::wstring result = LR"(\REGISTRY\USER\)";
+
+        HANDLE token;
+        if (::OpenProcessToken(::GetCurrentProcess(), TOKEN_QUERY, &token))
+        {
+            DWORD size = 0;
+            ::GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+            auto buffer = std::make_unique<std::uint8_t[]>(size);
+            LPWSTR sid;
+            if (::GetTokenInformation(token, TokenUser, buffer.get(), size, &size) &&
+                ::ConvertSidToStringSidW(reinterpret_cast<TOKEN_USER*>(buffer.get())->User.Sid, &sid))
+            {
+                result += sid;
+                ::LocalFree(sid);
+            }
+            ::CloseHandle(token);
+        }
+
+        return result;
+    }
+
+    // The kernel's names for the predefined keys
+    struct predefined_key
+    {
+        HKEY key;
+        std::wstring_view short_name;
+        std::wstring name;
+    };
+    std::vector<predefined_key> g_predefinedKeys;
+
+    void initialize_predefined_keys()
+    {
+        g_predefinedKeys = {
+            { HKEY_LOCAL_MACHINE, L"HKLM"sv, LR"(\REGISTRY\MACHINE)" },
+            { HKEY_USERS, L"HKU"sv, LR"(\REGISTRY\USER)" },
+            { HKEY_CURRENT_USER, L"HKCU"sv, current_user_key() },
+            // NOTE: HKCR is really a merged view of this and the user's classes, which are matched by their own name
+            { HKEY_CLASSES_ROOT, L"HKCR"sv, LR"(\REGISTRY\MACHINE\SOFTWARE\Classes)" },
+        };
+    }
+
+    // Registry prefixes are given as e.g. "HKLM\..." or "HKEY_LOCAL_MACHINE\...", and compiled as the kernel's names
+    bool add_key_filter(std::wstring_view prefix, filter_action action)
+    {
+        static constexpr std::pair<std::wstring_view, std::wstring_view> longNames[] =
+        {
+            { L"HKEY_LOCAL_MACHINE"sv, L"HKLM"sv },
+            { L"HKEY_USERS"sv, L"HKU"sv },
+            { L"HKEY_CURRENT_USER"sv, L"HKCU"sv },
+            { L"HKEY_CLASSES_ROOT"sv, L"HKCR"sv },
+        };
+
+        auto root = prefix.substr(0, prefix.find_first_of(L"\\/"));
+        auto rest = prefix.substr(root.length());
+        for (auto& [longName, shortName] : longNames)
+        {
+            if (iwstring_view(root.data(), root.length()) == iwstring_view(longName.data(), longName.length()))
+            {
+                root = shortName;
+            }
+        }
+
+        for (auto& predefined : g_predefinedKeys)
+        {
+            if (iwstring_view(root.data(), root.length()) == iwstring_view(predefined.short_name.data(), predefined.short_name.length()))
+            {
+                add_filter(predefined.name + std::wstring(rest), action);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool is_absolute(std::wstring_view path) noexcept
+    {
+        return ((path.length() >= 2) && (path[1] == L':')) || (!path.empty() && is_separator(path[0]));
+    }
+
+    void add_configured_filter(std::wstring_view prefix, filter_action action)
+    {
+        if (add_key_filter(prefix, action))
+        {
+            return;
+        }
+
+        prefix = strip_prefix(prefix);
+        if (is_absolute(prefix))
+        {
+            add_filter(prefix, action);
+            return;
+        }
+
+        // Relative to the package root, which is either of the two forms of it
+        for (auto root : { ::PSFQueryPackageRootPath(), ::PSFQueryFinalPackageRootPath() })
+        {
+            if (root && *root)
+            {
+                auto path = std::wstring(strip_prefix(root));
+                if (!is_separator(path.back()))
+                {
+                    path.push_back(L'\\');
+                }
+                add_filter(path + std::wstring(prefix), action);
+            }
+        }
+    }
+
+    // The action of the longest prefix of 'path' that ends on a separator or at the end of the path
+    filter_action match(std::wstring_view path) noexcept
+    {
+        auto result = filter_action::none;
+        std::uint32_t index = 0;
+        for (std::size_t i = 0; i <= path.length(); ++i)
+        {
+            auto& node = g_trie[index];
+            if ((node.action != filter_action::none) && ((i == path.length()) || is_separator(path[i])))
+            {
+                result = node.action;
+            }
+
+            if (i == path.length())
+            {
+                break;
+            }
+
+            auto folded = fold(path[i]);
+            auto itr = std::lower_bound(node.children.begin(), node.children.end(), folded, [](auto& child, wchar_t value)
+            {
+                return child.first < value;
+            });
+            if ((itr == node.children.end()) || (itr->first != folded))
+            {
+                break;
+            }
+            index = itr->second;
+        }
+
+        return result;
+    }
+
+    bool included(filter_action action) noexcept
+    {
+        return (action == filter_action::include) || ((action == filter_action::none) && !g_hasIncludes);
+    }
+}
+
+void CompilePathFilters(const psf::json_object& config)
+{
+    initialize_predefined_keys();
+
+    auto addAll = [](const psf::json_value* prefixes, filter_action action)
+    {
+        if (prefixes)
+        {
+            for (auto& prefix : prefixes->as_array())
+            {
+                add_configured_filter(prefix.as_string().wstring(), action);
+            }
+        }
+    };
+    addAll(config.try_get("include"), filter_action::include);
+    addAll(config.try_get("exclude"), filter_action::exclude);
+
+    path_filters_enabled = g_trie.size() > 1;
+}
+
+bool PathIncluded(function_type type, std::wstring_view path) noexcept
+{
+    if (path.empty())
+    {
+        return true;
+    }
+
+    path = strip_prefix(path);
+    auto action = match(path);
+    if ((type == function_type::dynamic_link_library) && (action == filter_action::none))
+    {
+        auto separator = path.find_last_of(L"\\/");
+        if (separator != std::wstring_view::npos)
+        {
+            action = match(path.substr(separator + 1));
+        }
+    }
+
+    return included(action);
+}
+
+bool KeyIncluded(HKEY key, std::wstring_view subKey) noexcept try
+{
+    std::wstring path;
+    auto isPredefined = false;
+    for (auto& predefined : g_predefinedKeys)
+    {
+        if (predefined.key == key)
+        {
+            path = predefined.name;
+            isPredefined = true;
+            break;
+        }
+    }
+
+    if (!isPredefined && !TryGetHandleName(key, path))
+    {
+        return true;
+    }
+
+    if (!subKey.empty())
+    {
+        path.push_back(L'\\');
+        path.append(subKey);
+    }
+
+    return included(match(path));
+}
+catch (...)
+{
+    return true;
+}
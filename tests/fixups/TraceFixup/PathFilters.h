@@ -0,0 +1,34 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <string_view>
+
+#include <windows.h>
+
+#include "Config.h"
+
+namespace psf
+{
+    struct json_object;
+}
+
+// The 'pathFilters' configuration: 'include' and 'exclude' arrays of path prefixes, compiled into a single trie. Prefixes
+// may be:
+//      * Absolute file paths, e.g. "C:\Users". The "\\?\" and "\??\" forms of paths are treated the same
+//      * Registry keys, e.g. "HKLM\Software\Vendor", which are matched against the kernel's names for keys
+//      * Anything else, which is relative to the package root, e.g. "VFS\ProgramFilesX86\Vendor"
+// Matching is case insensitive and only ever ends on a path separator or at the end of the path. The longest matching
+// prefix decides, so that e.g. part of an included subtree can be excluded. When there are include prefixes, paths that
+// match none of them are filtered out. Calls that don't name a path are never filtered
+void CompilePathFilters(const psf::json_object& config);
+
+// For dynamic_link_library calls, the file name on its own is checked as well, so that e.g. "vendor" matches both
+// "vendor.dll" and "C:\Vendor\vendor.dll"
+bool PathIncluded(function_type type, std::wstring_view path) noexcept;
+
+// The path of 'subKey' is put together from the name of 'key', which is either predefined, e.g. HKEY_LOCAL_MACHINE, or
+// one opened through the traced NT functions. Subkeys of unknown keys are never filtered
+bool KeyIncluded(HKEY key, std::wstring_view subKey) noexcept;
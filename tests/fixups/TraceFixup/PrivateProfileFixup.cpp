@@ -78,7 +78,7 @@ UINT __stdcall GetPrivateProfileIntFixup(
     }
     return result;
 }    
-DECLARE_STRING_FIXUP(GetPrivateProfileIntImpl, GetPrivateProfileIntFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, GetPrivateProfileIntImpl, GetPrivateProfileIntFixup);
 
 
 
@@ -146,7 +146,7 @@ DWORD __stdcall GetPrivateProfileSectionFixup(
     }
     return result;
 }
-DECLARE_STRING_FIXUP(GetPrivateProfileSectionImpl, GetPrivateProfileSectionFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, GetPrivateProfileSectionImpl, GetPrivateProfileSectionFixup);
 
 
 
@@ -211,7 +211,7 @@ DWORD __stdcall GetPrivateProfileSectionNamesFixup(
     }
     return result;
 }
-DECLARE_STRING_FIXUP(GetPrivateProfileSectionNamesImpl, GetPrivateProfileSectionNamesFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, GetPrivateProfileSectionNamesImpl, GetPrivateProfileSectionNamesFixup);
 
 
 
@@ -285,7 +285,7 @@ DWORD __stdcall GetPrivateProfileStringFixup(
     }
     return result;
 }
-DECLARE_STRING_FIXUP(GetPrivateProfileStringImpl, GetPrivateProfileStringFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, GetPrivateProfileStringImpl, GetPrivateProfileStringFixup);
 
 
 
@@ -356,7 +356,7 @@ BOOL __stdcall GetPrivateProfileStructFixup(
     }
     return result;
 }
-DECLARE_STRING_FIXUP(GetPrivateProfileStructImpl, GetPrivateProfileStructFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, GetPrivateProfileStructImpl, GetPrivateProfileStructFixup);
 
 
 
@@ -426,7 +426,7 @@ BOOL __stdcall WritePrivateProfileSectionFixup(
     }
     return result;
 }
-DECLARE_STRING_FIXUP(WritePrivateProfileSectionImpl, WritePrivateProfileSectionFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, WritePrivateProfileSectionImpl, WritePrivateProfileSectionFixup);
 
 
 
@@ -497,7 +497,7 @@ BOOL __stdcall WritePrivateProfileStringFixup(
     }
     return result;
 }
-DECLARE_STRING_FIXUP(WritePrivateProfileStringImpl, WritePrivateProfileStringFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, WritePrivateProfileStringImpl, WritePrivateProfileStringFixup);
 
 
 
@@ -567,6 +567,6 @@ BOOL __stdcall WritePrivateProfileStructFixup(
     }
     return result;
 }
-DECLARE_STRING_FIXUP(WritePrivateProfileStructImpl, WritePrivateProfileStructFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::filesystem, WritePrivateProfileStructImpl, WritePrivateProfileStructFixup);
 
 
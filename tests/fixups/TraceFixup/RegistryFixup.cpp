@@ -83,7 +83,7 @@ LSTATUS __stdcall RegCreateKeyFixup(_In_ HKEY key, _In_opt_ const CharT* subKey,
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -143,7 +143,7 @@ LSTATUS __stdcall RegCreateKeyFixup(_In_ HKEY key, _In_opt_ const CharT* subKey,
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegCreateKeyImpl, RegCreateKeyFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegCreateKeyImpl, RegCreateKeyFixup);
 
 auto RegCreateKeyExImpl = psf::detoured_string_function(&::RegCreateKeyExA, &::RegCreateKeyExW);
 template <typename CharT>
@@ -165,9 +165,15 @@ LSTATUS __stdcall RegCreateKeyExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::registry, "RegCreateKeyEx", "Key Options SamDesired ResultKey Disposition");
+            LogCallRecord(functionId, functionResult, result, TickStart, TickEnd, subKey,
+                { trace_arg(key), trace_arg(options), trace_arg(samDesired), trace_arg((resultKey && (result == ERROR_SUCCESS)) ? *resultKey : nullptr), trace_arg((disposition && (result == ERROR_SUCCESS)) ? *disposition : 0) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -240,7 +246,7 @@ LSTATUS __stdcall RegCreateKeyExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegCreateKeyExImpl, RegCreateKeyExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegCreateKeyExImpl, RegCreateKeyExFixup);
 
 auto RegOpenKeyImpl = psf::detoured_string_function(&::RegOpenKeyA, &::RegOpenKeyW);
 template <typename CharT>
@@ -253,7 +259,7 @@ LSTATUS __stdcall RegOpenKeyFixup(_In_ HKEY key, _In_opt_ const CharT* subKey, _
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -316,7 +322,7 @@ LSTATUS __stdcall RegOpenKeyFixup(_In_ HKEY key, _In_opt_ const CharT* subKey, _
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegOpenKeyImpl, RegOpenKeyFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegOpenKeyImpl, RegOpenKeyFixup);
 
 auto RegOpenKeyExImpl = psf::detoured_string_function(&::RegOpenKeyExA, &::RegOpenKeyExW);
 template <typename CharT>
@@ -334,9 +340,15 @@ LSTATUS __stdcall RegOpenKeyExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::registry, "RegOpenKeyEx", "Key Options SamDesired ResultKey");
+            LogCallRecord(functionId, functionResult, result, TickStart, TickEnd, subKey,
+                { trace_arg(key), trace_arg(options), trace_arg(samDesired), trace_arg((resultKey && (result == ERROR_SUCCESS)) ? *resultKey : nullptr) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = ""; 
             std::string outputs = "";
@@ -402,7 +414,7 @@ LSTATUS __stdcall RegOpenKeyExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegOpenKeyExImpl, RegOpenKeyExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegOpenKeyExImpl, RegOpenKeyExFixup);
 
 auto RegGetValueImpl = psf::detoured_string_function(&::RegGetValueA, &::RegGetValueW);
 template <typename CharT>
@@ -426,9 +438,15 @@ LSTATUS __stdcall RegGetValueFixup(
     if (type)
         *type = lclType;
 
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::registry, "RegGetValue", "Key Flags Type DataSize");
+            LogCallRecord(functionId, functionResult, result, TickStart, TickEnd, value,
+                { trace_arg(key), trace_arg(flags), trace_arg(type ? *type : 0), trace_arg(dataSize ? *dataSize : 0) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -500,7 +518,7 @@ LSTATUS __stdcall RegGetValueFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegGetValueImpl, RegGetValueFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegGetValueImpl, RegGetValueFixup);
 
 auto RegQueryValueImpl = psf::detoured_string_function(&::RegQueryValueA, &::RegQueryValueW);
 template <typename CharT>
@@ -517,7 +535,7 @@ LSTATUS __stdcall RegQueryValueFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -579,7 +597,7 @@ LSTATUS __stdcall RegQueryValueFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegQueryValueImpl, RegQueryValueFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegQueryValueImpl, RegQueryValueFixup);
 
 auto RegQueryValueExImpl = psf::detoured_string_function(&::RegQueryValueExA, &::RegQueryValueExW);
 template <typename CharT>
@@ -598,9 +616,15 @@ LSTATUS __stdcall RegQueryValueExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::registry, "RegQueryValueEx", "Key Type DataSize");
+            LogCallRecord(functionId, functionResult, result, TickStart, TickEnd, valueName,
+                { trace_arg(key), trace_arg(type ? *type : 0), trace_arg(dataSize ? *dataSize : 0) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -665,7 +689,7 @@ LSTATUS __stdcall RegQueryValueExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegQueryValueExImpl, RegQueryValueExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegQueryValueExImpl, RegQueryValueExFixup);
 
 auto RegSetKeyValueImpl = psf::detoured_string_function(&::RegSetKeyValueA, &::RegSetKeyValueW);
 template <typename CharT>
@@ -684,7 +708,7 @@ LSTATUS __stdcall RegSetKeyValueFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -749,7 +773,7 @@ LSTATUS __stdcall RegSetKeyValueFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegSetKeyValueImpl, RegSetKeyValueFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegSetKeyValueImpl, RegSetKeyValueFixup);
 
 auto RegSetValueImpl = psf::detoured_string_function(&::RegSetValueA, &::RegSetValueW);
 template <typename CharT>
@@ -767,7 +791,7 @@ LSTATUS __stdcall RegSetValueFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -828,7 +852,7 @@ LSTATUS __stdcall RegSetValueFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegSetValueImpl, RegSetValueFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegSetValueImpl, RegSetValueFixup);
 
 auto RegSetValueExImpl = psf::detoured_string_function(&::RegSetValueExA, &::RegSetValueExW);
 template <typename CharT>
@@ -847,9 +871,15 @@ LSTATUS __stdcall RegSetValueExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::registry, "RegSetValueEx", "Key Type DataSize");
+            LogCallRecord(functionId, functionResult, result, TickStart, TickEnd, valueName,
+                { trace_arg(key), trace_arg(type), trace_arg(dataSize) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -908,7 +938,7 @@ LSTATUS __stdcall RegSetValueExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegSetValueExImpl, RegSetValueExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegSetValueExImpl, RegSetValueExFixup);
 
 auto RegDeleteKeyImpl = psf::detoured_string_function(&::RegDeleteKeyA, &::RegDeleteKeyW);
 template <typename CharT>
@@ -921,7 +951,7 @@ LSTATUS __stdcall RegDeleteKeyFixup(_In_ HKEY key, _In_ const CharT* subKey)
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -977,7 +1007,7 @@ LSTATUS __stdcall RegDeleteKeyFixup(_In_ HKEY key, _In_ const CharT* subKey)
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegDeleteKeyImpl, RegDeleteKeyFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegDeleteKeyImpl, RegDeleteKeyFixup);
 
 auto RegDeleteKeyExImpl = psf::detoured_string_function(&::RegDeleteKeyExA, &::RegDeleteKeyExW);
 template <typename CharT>
@@ -994,7 +1024,7 @@ LSTATUS __stdcall RegDeleteKeyExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1052,7 +1082,7 @@ LSTATUS __stdcall RegDeleteKeyExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegDeleteKeyExImpl, RegDeleteKeyExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegDeleteKeyExImpl, RegDeleteKeyExFixup);
 
 auto RegDeleteKeyValueImpl = psf::detoured_string_function(&::RegDeleteKeyValueA, &::RegDeleteKeyValueW);
 template <typename CharT>
@@ -1065,7 +1095,7 @@ LSTATUS __stdcall RegDeleteKeyValueFixup(_In_ HKEY key, _In_opt_ const CharT* su
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1124,7 +1154,7 @@ LSTATUS __stdcall RegDeleteKeyValueFixup(_In_ HKEY key, _In_opt_ const CharT* su
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegDeleteKeyValueImpl, RegDeleteKeyValueFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegDeleteKeyValueImpl, RegDeleteKeyValueFixup);
 
 auto RegDeleteValueImpl = psf::detoured_string_function(&::RegDeleteValueA, &::RegDeleteValueW);
 template <typename CharT>
@@ -1137,7 +1167,7 @@ LSTATUS __stdcall RegDeleteValueFixup(_In_ HKEY key, _In_opt_ const CharT* value
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1193,7 +1223,7 @@ LSTATUS __stdcall RegDeleteValueFixup(_In_ HKEY key, _In_opt_ const CharT* value
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegDeleteValueImpl, RegDeleteValueFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegDeleteValueImpl, RegDeleteValueFixup);
 
 auto RegDeleteTreeImpl = psf::detoured_string_function(&::RegDeleteTreeA, &::RegDeleteTreeW);
 template <typename CharT>
@@ -1206,7 +1236,7 @@ LSTATUS __stdcall RegDeleteTreeFixup(_In_ HKEY key, _In_opt_ const CharT* subKey
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1262,7 +1292,7 @@ LSTATUS __stdcall RegDeleteTreeFixup(_In_ HKEY key, _In_opt_ const CharT* subKey
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegDeleteTreeImpl, RegDeleteTreeFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegDeleteTreeImpl, RegDeleteTreeFixup);
 
 auto RegCopyTreeImpl = psf::detoured_string_function(&::RegCopyTreeA, &::RegCopyTreeW);
 template <typename CharT>
@@ -1275,7 +1305,7 @@ LSTATUS __stdcall RegCopyTreeFixup(_In_ HKEY keySrc, _In_opt_ const CharT* subKe
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, keySrc, subKey))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1334,7 +1364,7 @@ LSTATUS __stdcall RegCopyTreeFixup(_In_ HKEY keySrc, _In_opt_ const CharT* subKe
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegCopyTreeImpl, RegCopyTreeFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegCopyTreeImpl, RegCopyTreeFixup);
 
 auto RegEnumKeyImpl = psf::detoured_string_function(&::RegEnumKeyA, &::RegEnumKeyW);
 template <typename CharT>
@@ -1351,7 +1381,7 @@ LSTATUS __stdcall RegEnumKeyFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1415,7 +1445,7 @@ LSTATUS __stdcall RegEnumKeyFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegEnumKeyImpl, RegEnumKeyFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegEnumKeyImpl, RegEnumKeyFixup);
 
 auto RegEnumKeyExImpl = psf::detoured_string_function(&::RegEnumKeyExA, &::RegEnumKeyExW);
 template <typename CharT>
@@ -1436,7 +1466,7 @@ LSTATUS __stdcall RegEnumKeyExFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1503,7 +1533,7 @@ LSTATUS __stdcall RegEnumKeyExFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegEnumKeyExImpl, RegEnumKeyExFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegEnumKeyExImpl, RegEnumKeyExFixup);
 
 auto RegEnumValueImpl = psf::detoured_string_function(&::RegEnumValueA, &::RegEnumValueW);
 template <typename CharT>
@@ -1524,7 +1554,7 @@ LSTATUS __stdcall RegEnumValueFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_win32(result);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, key))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -1597,7 +1627,7 @@ LSTATUS __stdcall RegEnumValueFixup(
 
     return result;
 }
-DECLARE_STRING_FIXUP(RegEnumValueImpl, RegEnumValueFixup);
+DECLARE_TRACE_STRING_FIXUP(function_type::registry, RegEnumValueImpl, RegEnumValueFixup);
 
 // NOTE: The following is a list of functions taken from https://msdn.microsoft.com/en-us/library/windows/desktop/ms724875(v=vs.85).aspx
 //       that are _not_ present above. This is just a convenient collection of what's missing; it is not a collection of
@@ -0,0 +1,271 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <windows.h>
+
+#include <lz4_block.h>
+
+#include "TraceBlocks.h"
+#include "TraceRing.h"
+
+namespace
+{
+#pragma pack(push, 1)
+    struct block_file_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t block_size;
+        std::uint32_t block_count;
+        std::uint32_t names_capacity;
+        std::int64_t frequency;
+        std::uint64_t data_offset;
+        std::uint32_t names_length;
+        std::uint32_t reserved;
+    };
+
+    struct block_index_entry
+    {
+        std::uint64_t sequence;
+        std::int64_t first_timestamp;
+        std::int64_t last_timestamp;
+        std::uint64_t thread_mask;
+        std::uint32_t stored_size;
+        std::uint32_t uncompressed_size;
+        std::uint32_t record_count;
+        std::uint32_t flags;
+    };
+
+    // The same as the record header of a 'binary' trace file
+    struct block_record_header
+    {
+        std::int64_t timestamp;
+        std::uint32_t thread_id;
+        trace_record_kind kind;
+        std::uint16_t reserved;
+        std::uint32_t length;
+    };
+
+    struct chunk_header
+    {
+        std::uint32_t stored_size;
+        std::uint32_t uncompressed_size;
+    };
+#pragma pack(pop)
+
+    constexpr std::uint32_t block_size = 256 * 1024;
+    constexpr std::uint32_t chunk_size = 64 * 1024; // Uncompressed. Larger than the largest record that a ring holds
+    constexpr std::uint32_t chunk_stored_uncompressed = 0x80000000;
+    constexpr std::uint32_t names_capacity = 64 * 1024;
+    constexpr std::uint64_t min_block_count = 4;
+    constexpr std::uint64_t max_block_count = 64 * 1024;
+    constexpr ULONGLONG rewrite_interval = 1000; // Milliseconds
+
+    HANDLE g_file = INVALID_HANDLE_VALUE;
+    block_file_header g_header{};
+    std::uint64_t g_sequence = 0;
+    std::string g_names;
+
+    // The block that's being filled, as it's stored in its slot, and the records of its next chunk
+    std::string g_block;
+    block_index_entry g_entry{};
+    bool g_blockDirty = false;
+    ULONGLONG g_blockWritten = 0;
+    std::string g_chunk;
+    block_index_entry g_chunkEntry{};
+    std::string g_compressed;
+
+    bool write_at(std::uint64_t offset, const void* data, std::size_t size) noexcept
+    {
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        DWORD written;
+        return ::WriteFile(g_file, data, static_cast<DWORD>(size), &written, &overlapped) && (written == size);
+    }
+
+    std::uint64_t index_offset(std::uint64_t slot) noexcept
+    {
+        return sizeof(block_file_header) + slot * sizeof(block_index_entry);
+    }
+
+    std::uint64_t names_offset() noexcept
+    {
+        return index_offset(g_header.block_count);
+    }
+
+    // Adds what 'from' describes - the records of a chunk - to what 'to' describes
+    void merge_entry(block_index_entry& to, const block_index_entry& from) noexcept
+    {
+        if (from.first_timestamp != 0)
+        {
+            to.first_timestamp = to.first_timestamp ? std::min(to.first_timestamp, from.first_timestamp) : from.first_timestamp;
+        }
+        to.last_timestamp = std::max(to.last_timestamp, from.last_timestamp);
+        to.thread_mask |= from.thread_mask;
+        to.uncompressed_size += from.uncompressed_size;
+        to.record_count += from.record_count;
+    }
+
+    void start_block()
+    {
+        g_block.clear();
+        g_entry = {};
+        g_entry.sequence = ++g_sequence;
+    }
+
+    void write_block()
+    {
+        auto slot = (g_entry.sequence - 1) % g_header.block_count;
+        g_entry.stored_size = static_cast<std::uint32_t>(g_block.size());
+
+        block_index_entry cleared{};
+        if (write_at(index_offset(slot), &cleared, sizeof(cleared)) &&
+            write_at(g_header.data_offset + slot * block_size, g_block.data(), g_block.size()))
+        {
+            write_at(index_offset(slot), &g_entry, sizeof(g_entry));
+        }
+
+        g_blockDirty = false;
+        g_blockWritten = ::GetTickCount64();
+    }
+
+    // Compresses the chunk and adds it to the block, first writing the block and starting the next one if it doesn't fit
+    void close_chunk()
+    {
+        if (g_chunk.empty())
+        {
+            return;
+        }
+
+        // Stored as is if it doesn't get any smaller
+        g_compressed.resize(sizeof(chunk_header) + g_chunk.size());
+        auto size = psf::lz4_compress(g_chunk.data(), g_chunk.size(), g_compressed.data() + sizeof(chunk_header), g_chunk.size() - 1);
+        chunk_header header{ static_cast<std::uint32_t>(size), static_cast<std::uint32_t>(g_chunk.size()) };
+        if (size == 0)
+        {
+            header.stored_size = static_cast<std::uint32_t>(g_chunk.size()) | chunk_stored_uncompressed;
+            std::memcpy(g_compressed.data() + sizeof(chunk_header), g_chunk.data(), g_chunk.size());
+            size = g_chunk.size();
+        }
+        std::memcpy(g_compressed.data(), &header, sizeof(header));
+
+        if (g_block.size() + sizeof(header) + size > block_size)
+        {
+            write_block();
+            start_block();
+        }
+
+        g_block.append(g_compressed.data(), sizeof(header) + size);
+        g_chunkEntry.uncompressed_size = static_cast<std::uint32_t>(g_chunk.size());
+        merge_entry(g_entry, g_chunkEntry);
+        g_blockDirty = true;
+
+        g_chunk.clear();
+        g_chunkEntry = {};
+    }
+
+    void add_name(std::string_view record)
+    {
+        if (g_names.size() + record.size() > names_capacity)
+        {
+            return;
+        }
+
+        g_names.append(record);
+        g_header.names_length = static_cast<std::uint32_t>(g_names.size());
+        write_at(names_offset() + g_names.size() - record.size(), record.data(), record.size());
+        write_at(0, &g_header, sizeof(g_header));
+    }
+
+    void add_record(const block_record_header& header, std::string_view record)
+    {
+        if (record.size() > chunk_size)
+        {
+            return;
+        }
+
+        if (g_chunk.size() + record.size() > chunk_size)
+        {
+            close_chunk();
+        }
+
+        g_chunk.append(record);
+        ++g_chunkEntry.record_count;
+        g_chunkEntry.thread_mask |= std::uint64_t{ 1 } << ((header.thread_id / 4) % 64);
+
+        // Records that aren't from a call, e.g. the count of dropped records, have no timestamp
+        if (header.timestamp != 0)
+        {
+            g_chunkEntry.first_timestamp = g_chunkEntry.first_timestamp ? std::min(g_chunkEntry.first_timestamp, header.timestamp) : header.timestamp;
+            g_chunkEntry.last_timestamp = std::max(g_chunkEntry.last_timestamp, header.timestamp);
+        }
+    }
+}
+
+bool StartTraceBlocks(HANDLE file, std::uint64_t sizeLimit, std::int64_t frequency) noexcept try
+{
+    g_file = file;
+
+    auto blockCount = std::clamp(sizeLimit / block_size, min_block_count, max_block_count);
+    g_header = block_file_header{ { 'P', 'S', 'F', 'T', 'R', 'B', 'L', 'K' }, 1, block_size, static_cast<std::uint32_t>(blockCount),
+        names_capacity, frequency, 0, 0, 0 };
+
+    // Slots start on a page boundary
+    g_header.data_offset = (names_offset() + names_capacity + 4095) & ~std::uint64_t{ 4095 };
+
+    std::vector<char> empty(static_cast<std::size_t>(g_header.data_offset - sizeof(g_header)));
+    if (!write_at(0, &g_header, sizeof(g_header)) || !write_at(sizeof(g_header), empty.data(), empty.size()))
+    {
+        return false;
+    }
+
+    g_names.reserve(names_capacity);
+    g_block.reserve(block_size);
+    g_chunk.reserve(chunk_size);
+    start_block();
+    return true;
+}
+catch (...)
+{
+    return false;
+}
+
+void WriteTraceBlocks(std::string_view records, bool flush)
+{
+    while (records.size() >= sizeof(block_record_header))
+    {
+        block_record_header header;
+        std::memcpy(&header, records.data(), sizeof(header));
+
+        auto size = std::min(sizeof(header) + header.length, records.size());
+        auto record = records.substr(0, size);
+        records.remove_prefix(size);
+
+        if (header.kind == trace_record_kind::function)
+        {
+            add_name(record);
+        }
+        else
+        {
+            add_record(header, record);
+        }
+    }
+
+    // The chunk is closed early, rather than compressed twice, so that what's been written to the block is all there is
+    if ((g_blockDirty || !g_chunk.empty()) && (flush || (::GetTickCount64() - g_blockWritten >= rewrite_interval)))
+    {
+        close_chunk();
+        write_block();
+    }
+}
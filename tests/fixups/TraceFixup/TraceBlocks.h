@@ -0,0 +1,44 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include <windows.h>
+
+// The 'traceFileSizeLimit' option of the 'binary' trace method, for tracing an app for hours or days, until a problem
+// that's hard to reproduce shows up. Instead of growing without bound, the file is a fixed number of fixed-size block
+// slots: the drained records are compressed with LZ4, a chunk at a time, and packed into a block until it's full, and once
+// all of the slots are used, each new block overwrites the oldest. The file then always holds the last stretch of the
+// trace, however long the app runs. An index of the slots, with the time span and threads of each block, lets a viewer go
+// straight to the blocks of a time or a thread without decompressing the others.
+//
+// The block that's being filled is rewritten to its slot every second and on flush, so at most a second of records is
+// lost if the process is terminated. Function names are kept apart from the blocks, so that overwriting a block never
+// loses the name of a function that later blocks still refer to. The layout, all little endian and without padding, is:
+//
+//      file header:    char magic[8] = "PSFTRBLK", uint32 version = 1, uint32 block size, uint32 block count,
+//                      uint32 names capacity, int64 QPC frequency, uint64 offset of the first slot,
+//                      uint32 names length, uint32 reserved
+//      index:          block count entries of: uint64 sequence (1 for the first block written, 0 for an empty slot),
+//                      int64 earliest and latest non-zero record timestamps, uint64 thread mask (bit (thread id / 4) % 64
+//                      is set for each thread with a record in the block), uint32 stored size, uint32 uncompressed
+//                      size, uint32 record count, uint32 reserved
+//      names:          names capacity bytes, of which the first names length are the function records of the trace
+//      slots:          block count slots of block size bytes, from the offset in the header
+//
+// The first stored size bytes of a slot are its block's chunks, each a uint32 stored size (with the high bit set if the
+// chunk is stored uncompressed), a uint32 uncompressed size, and then the chunk as a single LZ4 block. A chunk, after
+// decompression, is a run of whole records with the same headers and payloads as a 'binary' trace file (see TraceRing.h).
+// A block is cleared from the index while its slot is rewritten, so that a block that's only partly written is never
+// read.
+
+// Writes the header and an empty index to 'file', sized to about 'sizeLimit' bytes of slots
+bool StartTraceBlocks(HANDLE file, std::uint64_t sizeLimit, std::int64_t frequency) noexcept;
+
+// Adds the binary records that were drained from the rings to the file. With 'flush', the block that's being filled is
+// written as well. Only ever called by one thread at a time
+void WriteTraceBlocks(std::string_view records, bool flush);
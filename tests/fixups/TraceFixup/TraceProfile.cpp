@@ -0,0 +1,606 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <windows.h>
+
+#include "Config.h"
+#include "Logging.h"
+#include "TraceProfile.h"
+
+using namespace std::literals;
+
+namespace
+{
+    // Log-linear buckets of QueryPerformanceCounter ticks: four per power of two, so that each is within 25% of the
+    // values that fall into it. With the usual 10MHz counter, the last bucket starts at about a second
+    constexpr std::size_t bucket_count = 96;
+    constexpr std::size_t result_count = 4; // function_result
+
+    std::size_t bucket_of(std::uint64_t ticks) noexcept
+    {
+        if (ticks < 4)
+        {
+            return static_cast<std::size_t>(ticks);
+        }
+
+        unsigned long msb;
+        if (auto high = static_cast<unsigned long>(ticks >> 32))
+        {
+            ::_BitScanReverse(&msb, high);
+            msb += 32;
+        }
+        else
+        {
+            ::_BitScanReverse(&msb, static_cast<unsigned long>(ticks));
+        }
+
+        auto bucket = (msb - 1) * 4 + ((ticks >> (msb - 2)) & 3);
+        return std::min(static_cast<std::size_t>(bucket), bucket_count - 1);
+    }
+
+    std::uint64_t bucket_start(std::size_t bucket) noexcept
+    {
+        if (bucket < 4)
+        {
+            return bucket;
+        }
+
+        auto msb = bucket / 4 + 1;
+        return static_cast<std::uint64_t>(4 + bucket % 4) << (msb - 2);
+    }
+
+    // Only ever written by the thread that owns the shard, and so updated with plain loads and stores; the atomics are for
+    // the summary, which reads them from another thread
+    struct function_stats
+    {
+        explicit function_stats(const char* functionName) noexcept : name(functionName) {}
+
+        const char* name;
+        std::atomic<std::uint64_t> counts[result_count] = {};
+        std::atomic<std::uint64_t> total_ticks{ 0 };
+        std::atomic<std::uint64_t> max_ticks{ 0 };
+        std::atomic<std::uint32_t> buckets[bucket_count] = {};
+    };
+
+    template <typename T>
+    void increase(std::atomic<T>& value, T amount) noexcept
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    // Functions are found by the address of their name, which is the same for every call from the same fixup
+    struct profile_shard
+    {
+        static constexpr std::size_t capacity = 512; // Must be a power of two, and well above the number of fixups
+
+        function_stats* find(const char* functionName)
+        {
+            auto index = (reinterpret_cast<std::uintptr_t>(functionName) >> 3) & (capacity - 1);
+            for (std::size_t probe = 0; probe < capacity; ++probe, index = (index + 1) & (capacity - 1))
+            {
+                auto stats = functions[index].load(std::memory_order_relaxed);
+                if (!stats)
+                {
+                    stats = new function_stats(functionName);
+                    functions[index].store(stats, std::memory_order_release);
+                    return stats;
+                }
+                else if (stats->name == functionName)
+                {
+                    return stats;
+                }
+            }
+
+            return nullptr;
+        }
+
+        std::atomic<function_stats*> functions[capacity] = {};
+        profile_shard* next = nullptr;
+    };
+
+    // Shards outlive their threads, so that their calls still count. New ones are pushed onto the front of the list
+    std::atomic<profile_shard*> g_shards{ nullptr };
+    thread_local profile_shard* t_shard = nullptr;
+
+    profile_shard* current_shard()
+    {
+        if (!t_shard)
+        {
+            auto shard = new profile_shard();
+            auto head = g_shards.load(std::memory_order_relaxed);
+            do
+            {
+                shard->next = head;
+            } while (!g_shards.compare_exchange_weak(head, shard, std::memory_order_release, std::memory_order_relaxed));
+            t_shard = shard;
+        }
+
+        return t_shard;
+    }
+
+    struct function_summary
+    {
+        std::uint64_t counts[result_count] = {};
+        std::uint64_t total_ticks = 0;
+        std::uint64_t max_ticks = 0;
+        std::uint64_t buckets[bucket_count] = {};
+
+        std::uint64_t calls() const noexcept
+        {
+            std::uint64_t result = 0;
+            for (auto count : counts)
+            {
+                result += count;
+            }
+            return result;
+        }
+
+        // The start of the bucket that the 'fraction'th call falls into
+        std::uint64_t percentile(double fraction) const noexcept
+        {
+            auto target = static_cast<std::uint64_t>(fraction * static_cast<double>(calls()));
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < bucket_count; ++i)
+            {
+                seen += buckets[i];
+                if (seen > target)
+                {
+                    return bucket_start(i);
+                }
+            }
+            return max_ticks;
+        }
+    };
+
+    HANDLE g_profileEvent = nullptr;
+}
+
+void EnableTraceProfile()
+{
+    auto name = L"Local\\PsfTraceFixupProfile_" + std::to_wstring(::GetCurrentProcessId());
+    g_profileEvent = ::CreateEventW(nullptr, FALSE, FALSE, name.c_str());
+    if (!g_profileEvent)
+    {
+        Log("TraceFixup could not create the profile event, error=%d\n", ::GetLastError());
+        return;
+    }
+
+    Log("TraceFixup profile summaries are written on exit, and when %ls is set\n", name.c_str());
+    std::thread([]() noexcept
+    {
+        while (::WaitForSingleObject(g_profileEvent, INFINITE) == WAIT_OBJECT_0)
+        {
+            LogTraceProfile();
+        }
+    }).detach();
+}
+
+void RecordProfiledCall(const char* functionName, std::uint8_t result, std::int64_t ticks) noexcept try
+{
+    auto stats = current_shard()->find(functionName);
+    if (!stats || (result >= result_count))
+    {
+        return;
+    }
+
+    auto value = static_cast<std::uint64_t>(std::max<std::int64_t>(ticks, 0));
+    increase(stats->counts[result], std::uint64_t{ 1 });
+    increase(stats->total_ticks, value);
+    increase(stats->buckets[bucket_of(value)], std::uint32_t{ 1 });
+    if (value > stats->max_ticks.load(std::memory_order_relaxed))
+    {
+        stats->max_ticks.store(value, std::memory_order_relaxed);
+    }
+}
+catch (...)
+{
+    // Only reached if a shard could not be allocated; the call goes uncounted
+}
+
+void LogSlowCall(std::int64_t ticks, void* const* frames, unsigned frameCount) noexcept try
+{
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    Log("\tDuration=%.3fms\n", static_cast<double>(ticks) * 1000.0 / static_cast<double>(frequency.QuadPart));
+    Log("\tStack:\n");
+    for (unsigned i = 0; i < frameCount; ++i)
+    {
+        if (auto module = FindCallingModule(frames[i]))
+        {
+            auto offset = reinterpret_cast<std::uintptr_t>(frames[i]) - module->base;
+            auto fileName = module->path.c_str() + module->path.find_last_of(L'\\') + 1; // npos + 1 is the whole path
+            Log("\t\t%ls+0x%zx\n", fileName, static_cast<std::size_t>(offset));
+        }
+        else
+        {
+            Log("\t\t%p\n", frames[i]);
+        }
+    }
+}
+catch (...)
+{
+    ::OutputDebugStringA("TraceFixup could not write the stack of a slow call");
+}
+
+void LogTraceProfile() noexcept try
+{
+    // Fixups of both character types share a name, and are reported together
+    std::map<std::string_view, function_summary> summaries;
+    for (auto shard = g_shards.load(std::memory_order_acquire); shard; shard = shard->next)
+    {
+        for (auto& entry : shard->functions)
+        {
+            auto stats = entry.load(std::memory_order_acquire);
+            if (!stats)
+            {
+                continue;
+            }
+
+            auto& summary = summaries[stats->name];
+            for (std::size_t i = 0; i < result_count; ++i)
+            {
+                summary.counts[i] += stats->counts[i].load(std::memory_order_relaxed);
+            }
+            summary.total_ticks += stats->total_ticks.load(std::memory_order_relaxed);
+            summary.max_ticks = std::max(summary.max_ticks, stats->max_ticks.load(std::memory_order_relaxed));
+            for (std::size_t i = 0; i < bucket_count; ++i)
+            {
+                summary.buckets[i] += stats->buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string_view, const function_summary*>> sorted;
+    for (auto& [name, summary] : summaries)
+    {
+        sorted.emplace_back(name, &summary);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto& lhs, auto& rhs)
+    {
+        return lhs.second->total_ticks > rhs.second->total_ticks;
+    });
+
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    auto us = [&](std::uint64_t ticks)
+    {
+        return static_cast<double>(ticks) * 1000000.0 / static_cast<double>(frequency.QuadPart);
+    };
+
+    std::lock_guard<std::recursive_mutex> lock(g_outputMutex);
+    Log("TraceFixup profile, by total time:\n");
+    Log("%-36s %10s %10s %10s %10s %12s %10s %10s %10s %10s\n",
+        "Function", "Calls", "Success", "Expected", "Failure", "Total us", "p50 us", "p90 us", "p99 us", "Max us");
+    for (auto& [name, summary] : sorted)
+    {
+        // Most functions are named "SomeFunctionFixup" where the target API is "SomeFunction"
+        auto displayName = name;
+        if ((displayName.length() > 5) && (displayName.substr(displayName.length() - 5) == "Fixup"sv))
+        {
+            displayName.remove_suffix(5);
+        }
+
+        Log("%-36.*s %10llu %10llu %10llu %10llu %12.0f %10.1f %10.1f %10.1f %10.1f\n",
+            static_cast<int>(displayName.length()), displayName.data(),
+            summary->calls(),
+            summary->counts[static_cast<int>(function_result::success)] + summary->counts[static_cast<int>(function_result::indeterminate)],
+            summary->counts[static_cast<int>(function_result::expected_failure)],
+            summary->counts[static_cast<int>(function_result::failure)],
+            us(summary->total_ticks),
+            us(summary->percentile(0.5)),
+            us(summary->percentile(0.9)),
+            us(summary->percentile(0.99)),
+            us(summary->max_ticks));
+    }
+}
+catch (...)
+{
+    ::OutputDebugStringA("TraceFixup could not write the profile summary");
+}
+
+extern "C" IMAGE_DOS_HEADER __ImageBase;
+
+namespace
+{
+    constexpr std::size_t max_stack_frames = 62; // The most that RtlCaptureStackBackTrace captures on older versions of Windows
+
+    // Return addresses, leaf first, except for the frames set in 'name_mask', which are the names of outer fixup calls.
+    // Written before the stack is published to its shard, and never changed after
+    struct stack_stats
+    {
+        std::uint64_t hash;
+        const char* name;
+        std::uint64_t name_mask;
+        unsigned frame_count;
+        const void* frames[max_stack_frames];
+        std::atomic<std::uint64_t> calls{ 0 };
+        std::atomic<std::uint64_t> total_ticks{ 0 };
+
+        bool same_stack(const stack_stats& other) const noexcept
+        {
+            return (name == other.name) && (name_mask == other.name_mask) && (frame_count == other.frame_count) &&
+                std::equal(frames, frames + frame_count, other.frames);
+        }
+    };
+
+    // The same as profile_shard, keyed by the stack and the function
+    struct stack_shard
+    {
+        static constexpr std::size_t capacity = 4096; // Must be a power of two
+
+        stack_stats* find(const stack_stats& stack)
+        {
+            auto index = static_cast<std::size_t>(stack.hash) & (capacity - 1);
+            for (std::size_t probe = 0; probe < capacity; ++probe, index = (index + 1) & (capacity - 1))
+            {
+                auto stats = stacks[index].load(std::memory_order_relaxed);
+                if (!stats)
+                {
+                    stats = new stack_stats();
+                    stats->hash = stack.hash;
+                    stats->name = stack.name;
+                    stats->name_mask = stack.name_mask;
+                    stats->frame_count = stack.frame_count;
+                    std::copy(stack.frames, stack.frames + stack.frame_count, stats->frames);
+                    stacks[index].store(stats, std::memory_order_release);
+                    return stats;
+                }
+                else if ((stats->hash == stack.hash) && stats->same_stack(stack))
+                {
+                    return stats;
+                }
+            }
+
+            return nullptr;
+        }
+
+        std::atomic<stack_stats*> stacks[capacity] = {};
+        stack_shard* next = nullptr;
+    };
+
+    std::atomic<stack_shard*> g_stackShards{ nullptr };
+    thread_local stack_shard* t_stackShard = nullptr;
+    thread_local std::uint32_t t_unsampledStackCalls = 0;
+    std::atomic<std::uint64_t> g_droppedStacks{ 0 };
+
+    std::filesystem::path g_stackProfilePath;
+    std::uintptr_t g_imageBase = 0;
+    std::uintptr_t g_imageEnd = 0;
+
+    stack_shard* current_stack_shard()
+    {
+        if (!t_stackShard)
+        {
+            auto shard = new stack_shard();
+            auto head = g_stackShards.load(std::memory_order_relaxed);
+            do
+            {
+                shard->next = head;
+            } while (!g_stackShards.compare_exchange_weak(head, shard, std::memory_order_release, std::memory_order_relaxed));
+            t_stackShard = shard;
+        }
+
+        return t_stackShard;
+    }
+
+    bool in_trace_fixup(const void* address) noexcept
+    {
+        auto value = reinterpret_cast<std::uintptr_t>(address);
+        return (value >= g_imageBase) && (value < g_imageEnd);
+    }
+
+    // FNV-1a over the values that tell stacks apart
+    std::uint64_t hash_stack(const stack_stats& stack) noexcept
+    {
+        std::uint64_t result = 14695981039346656037ull;
+        auto add = [&](std::uint64_t value)
+        {
+            result = (result ^ value) * 1099511628211ull;
+        };
+
+        add(reinterpret_cast<std::uintptr_t>(stack.name));
+        add(stack.name_mask);
+        for (unsigned i = 0; i < stack.frame_count; ++i)
+        {
+            add(reinterpret_cast<std::uintptr_t>(stack.frames[i]));
+        }
+        return result;
+    }
+
+    // Neither semicolons nor line breaks can be part of a frame's name
+    void append_frame_name(std::string& line, std::string_view name)
+    {
+        for (auto ch : name)
+        {
+            line.push_back(((ch == ';') || (ch == '\r') || (ch == '\n')) ? '_' : ch);
+        }
+    }
+
+    bool write_file(const std::filesystem::path& path, std::string_view contents) noexcept
+    {
+        auto file = ::CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        DWORD written;
+        auto result = ::WriteFile(file, contents.data(), static_cast<DWORD>(contents.size()), &written, nullptr) && (written == contents.size());
+        ::CloseHandle(file);
+        return result;
+    }
+}
+
+void EnableProfiledStacks(std::filesystem::path path)
+{
+    auto ntHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(reinterpret_cast<const std::uint8_t*>(&__ImageBase) + __ImageBase.e_lfanew);
+    g_imageBase = reinterpret_cast<std::uintptr_t>(&__ImageBase);
+    g_imageEnd = g_imageBase + ntHeaders->OptionalHeader.SizeOfImage;
+
+    g_stackProfilePath = std::move(path);
+    Log("TraceFixup stacks of one in every %u calls are written to %ls on exit\n", profile_stack_one_in, g_stackProfilePath.c_str());
+}
+
+void RecordProfiledStack(const profiled_call& call, std::int64_t ticks) noexcept try
+{
+    if (++t_unsampledStackCalls < profile_stack_one_in)
+    {
+        return;
+    }
+    t_unsampledStackCalls = 0;
+
+    void* captured[max_stack_frames];
+    auto capturedCount = ::RtlCaptureStackBackTrace(0, static_cast<DWORD>(std::size(captured)), captured, nullptr);
+
+    // The first frames are this fixup and the tracing around it. Past those, each run of TraceFixup frames is the fixup
+    // of the call that this one was made from, if any
+    stack_stats stack;
+    stack.name = call.name;
+    stack.name_mask = 0;
+    stack.frame_count = 0;
+
+    unsigned i = 0;
+    while ((i < capturedCount) && in_trace_fixup(captured[i]))
+    {
+        ++i;
+    }
+
+    auto outer = call.outer;
+    bool inFixup = false;
+    for (; i < capturedCount; ++i)
+    {
+        if (!in_trace_fixup(captured[i]))
+        {
+            stack.frames[stack.frame_count++] = captured[i];
+            inFixup = false;
+        }
+        else if (!inFixup)
+        {
+            inFixup = true;
+            if (outer)
+            {
+                stack.name_mask |= std::uint64_t{ 1 } << stack.frame_count;
+                stack.frames[stack.frame_count++] = outer->name;
+                outer = outer->outer;
+            }
+        }
+    }
+    stack.hash = hash_stack(stack);
+
+    auto stats = current_stack_shard()->find(stack);
+    if (!stats)
+    {
+        g_droppedStacks.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    increase(stats->calls, std::uint64_t{ 1 });
+    increase(stats->total_ticks, static_cast<std::uint64_t>(std::max<std::int64_t>(ticks, 0)));
+}
+catch (...)
+{
+    // Only reached if a shard could not be allocated; the call goes unrecorded
+}
+
+void WriteProfiledStacks() noexcept try
+{
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+
+    // Threads that called from the same stack are reported together. Ordered, so that the file is sorted the way that
+    // flame graph tools expect
+    std::map<std::string, std::uint64_t> totals;
+    std::vector<const cached_module*> modules;
+    std::string line;
+    for (auto shard = g_stackShards.load(std::memory_order_acquire); shard; shard = shard->next)
+    {
+        for (auto& entry : shard->stacks)
+        {
+            auto stats = entry.load(std::memory_order_acquire);
+            if (!stats)
+            {
+                continue;
+            }
+
+            line.clear();
+            char address[32];
+            for (auto i = stats->frame_count; i-- > 0;)
+            {
+                if (stats->name_mask & (std::uint64_t{ 1 } << i))
+                {
+                    append_frame_name(line, traced_function_name(static_cast<const char*>(stats->frames[i])));
+                }
+                else if (auto module = FindCallingModule(stats->frames[i]))
+                {
+                    if (std::find(modules.begin(), modules.end(), module) == modules.end())
+                    {
+                        modules.push_back(module);
+                    }
+
+                    auto fileName = module->path.substr(module->path.find_last_of(L'\\') + 1); // npos + 1 is the whole path
+                    append_frame_name(line, narrow(fileName));
+                    std::snprintf(address, std::size(address), "+0x%zx", static_cast<std::size_t>(reinterpret_cast<std::uintptr_t>(stats->frames[i]) - module->base));
+                    line += address;
+                }
+                else
+                {
+                    std::snprintf(address, std::size(address), "0x%p", stats->frames[i]);
+                    line += address;
+                }
+                line.push_back(';');
+            }
+            append_frame_name(line, traced_function_name(stats->name));
+
+            totals[line] += stats->total_ticks.load(std::memory_order_relaxed);
+        }
+    }
+
+    // In whole microseconds, rounded up, since flame graph tools leave out stacks with no time at all
+    std::string output;
+    for (auto& [stack, ticks] : totals)
+    {
+        auto microseconds = static_cast<std::uint64_t>(std::ceil(static_cast<double>(ticks) * 1000000.0 / static_cast<double>(frequency.QuadPart)));
+        output += stack;
+        output += ' ';
+        output += std::to_string(std::max<std::uint64_t>(microseconds, 1));
+        output += '\n';
+    }
+
+    std::string moduleList;
+    for (auto module : modules)
+    {
+        moduleList += narrow(module->path);
+        moduleList += '\n';
+    }
+
+    auto modulesPath = g_stackProfilePath;
+    modulesPath += L".modules";
+    if (!write_file(g_stackProfilePath, output) || !write_file(modulesPath, moduleList))
+    {
+        Log("TraceFixup could not write the stack profile to %ls, error=%d\n", g_stackProfilePath.c_str(), ::GetLastError());
+    }
+    else if (auto dropped = g_droppedStacks.load(std::memory_order_relaxed))
+    {
+        Log("TraceFixup stack profile left out %llu sampled calls, from threads with too many different stacks\n", dropped);
+    }
+}
+catch (...)
+{
+    ::OutputDebugStringA("TraceFixup could not write the stack profile");
+}
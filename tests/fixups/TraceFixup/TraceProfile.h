@@ -0,0 +1,60 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include <windows.h>
+
+// The 'profile' mode. Rather than a log of every call, this answers which of the traced functions the app spends its
+// time in: for each function, how many calls succeeded, failed and so on, and a histogram of how long they took. Each
+// thread counts into a shard of its own, so counting never contends, and the shards are only combined for the summary,
+// which is written through Log on exit, and whenever the event named by ProfileEventName() is set.
+//
+// A call's time is measured from LogFunctionEntry - i.e. just before the fixup calls the function it traces - to the
+// fixup's acquire_output_lock - i.e. just after that call returns - so that formatting the output isn't counted. The
+// same measurement is what 'slowCallThreshold' is compared against
+void EnableTraceProfile();
+void LogTraceProfile() noexcept;
+
+void RecordProfiledCall(const char* functionName, std::uint8_t result, std::int64_t ticks) noexcept;
+
+// Writes how long a call over the 'slowCallThreshold' took, and the return addresses that were on the stack, each as
+// module+offset
+void LogSlowCall(std::int64_t ticks, void* const* frames, unsigned frameCount) noexcept;
+
+// The fixup call that this thread is currently in, and the one it was called from, if any
+struct profiled_call
+{
+    const char* name;
+    std::int64_t start;
+    profiled_call* outer;
+    bool recorded;
+};
+
+inline thread_local profiled_call* t_profiledCall = nullptr;
+
+// The 'profileStacks' mode, which tells which of the app's call sites the time in the traced functions comes from. For one
+// in every 'oneIn' calls on each thread, the stack is captured when the call returns, and the call's time is added to the
+// thread's own total for that stack and function. The frames of TraceFixup itself are left out, except that a fixup that
+// another traced call was made from shows up as a frame of its own, named after the function.
+//
+// On exit, the totals of all threads are written to 'path' in the collapsed stack format that flame graph tools read: one
+// line per stack, root first, with the frames separated by semicolons, the traced function as the last frame, and then
+// the total microseconds of the sampled calls. Return addresses are written as module+offset, so that symbols can be
+// resolved offline, and the paths of their modules are written to 'path' with ".modules" appended (see PsfTraceCollector's
+// symbolize command)
+void EnableProfiledStacks(std::filesystem::path path);
+void WriteProfiledStacks() noexcept;
+
+void RecordProfiledStack(const profiled_call& call, std::int64_t ticks) noexcept;
+
+inline std::int64_t profile_timestamp() noexcept
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
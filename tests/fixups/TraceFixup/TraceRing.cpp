@@ -0,0 +1,437 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <windows.h>
+
+#include "TraceBlocks.h"
+#include "TraceRing.h"
+
+namespace
+{
+    struct trace_record_header
+    {
+        std::int64_t timestamp;
+        std::uint32_t length;
+        trace_record_kind kind;
+        std::uint16_t reserved;
+    };
+
+#pragma pack(push, 1)
+    struct file_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t reserved;
+        std::int64_t frequency;
+    };
+
+    struct file_record_header
+    {
+        std::int64_t timestamp;
+        std::uint32_t thread_id;
+        trace_record_kind kind;
+        std::uint16_t reserved;
+        std::uint32_t length;
+    };
+
+    struct call_record
+    {
+        std::uint16_t function_id;
+        std::uint8_t result;
+        std::uint8_t flags;
+        std::uint32_t error;
+        std::int64_t elapsed;
+        std::uint16_t arg_count;
+        std::uint16_t string_length;
+    };
+#pragma pack(pop)
+
+    constexpr std::size_t max_call_args = 16;
+    constexpr std::size_t max_call_string_bytes = 2048;
+    constexpr std::size_t max_trace_functions = 1024;
+
+    // Single producer - the thread that owns the ring - and single consumer - whoever holds g_drainLock. The positions
+    // only ever increase, and are reduced to offsets into the buffer as it is accessed
+    class trace_ring
+    {
+    public:
+        static constexpr std::size_t capacity = 64 * 1024; // Must be a power of two
+
+        trace_ring() noexcept :
+            m_threadId(::GetCurrentThreadId())
+        {
+        }
+
+        // The payload may be given in pieces, which are written one after the other
+        bool write(const trace_record_header& header, std::initializer_list<std::pair<const void*, std::size_t>> payload) noexcept
+        {
+            auto size = sizeof(header) + header.length;
+            auto head = m_head.load(std::memory_order_relaxed);
+            if (capacity - (head - m_tail.load(std::memory_order_acquire)) < size)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            copy_in(head, &header, sizeof(header));
+            auto position = head + sizeof(header);
+            for (auto& [data, length] : payload)
+            {
+                copy_in(position, data, length);
+                position += length;
+            }
+            m_head.store(head + size, std::memory_order_release);
+            return true;
+        }
+
+        // Appends every record that is in the ring to 'output', as text lines or as binary records. 'processId' is
+        // only written when non-zero
+        void drain(std::string& output, bool binary, DWORD processId)
+        {
+            auto tail = m_tail.load(std::memory_order_relaxed);
+            auto head = m_head.load(std::memory_order_acquire);
+            while (tail != head)
+            {
+                trace_record_header header;
+                copy_out(tail, &header, sizeof(header));
+
+                if (binary)
+                {
+                    file_record_header fileHeader{ header.timestamp, m_threadId, header.kind, 0, header.length };
+                    output.append(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+                }
+                else
+                {
+                    char prefix[64];
+                    auto prefixLength = processId ?
+                        std::snprintf(prefix, sizeof(prefix), "%lld %5lu %5lu ", header.timestamp, processId, m_threadId) :
+                        std::snprintf(prefix, sizeof(prefix), "%lld %5lu ", header.timestamp, m_threadId);
+                    output.append(prefix, prefixLength);
+                }
+
+                auto offset = output.size();
+                output.resize(offset + header.length);
+                copy_out(tail + sizeof(header), output.data() + offset, header.length);
+                tail += sizeof(header) + header.length;
+            }
+            m_tail.store(tail, std::memory_order_release);
+
+            if (auto dropped = m_dropped.exchange(0, std::memory_order_relaxed))
+            {
+                auto text = "TraceFixup: thread " + std::to_string(m_threadId) + " dropped " + std::to_string(dropped) + " records\n";
+                if (binary)
+                {
+                    file_record_header fileHeader{ 0, m_threadId, trace_record_kind::text, 0, static_cast<std::uint32_t>(text.size()) };
+                    output.append(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+                }
+                output += text;
+            }
+        }
+
+        trace_ring* next() const noexcept
+        {
+            return m_next;
+        }
+
+        void set_next(trace_ring* next) noexcept
+        {
+            m_next = next;
+        }
+
+    private:
+        void copy_in(std::uint64_t position, const void* data, std::size_t size) noexcept
+        {
+            if (size == 0)
+            {
+                return;
+            }
+
+            auto offset = static_cast<std::size_t>(position & (capacity - 1));
+            auto first = std::min(size, capacity - offset);
+            std::memcpy(m_data + offset, data, first);
+            std::memcpy(m_data, static_cast<const char*>(data) + first, size - first);
+        }
+
+        void copy_out(std::uint64_t position, void* data, std::size_t size) const noexcept
+        {
+            auto offset = static_cast<std::size_t>(position & (capacity - 1));
+            auto first = std::min(size, capacity - offset);
+            std::memcpy(data, m_data + offset, first);
+            std::memcpy(static_cast<char*>(data) + first, m_data, size - first);
+        }
+
+        trace_ring* m_next = nullptr;
+        DWORD m_threadId;
+        std::atomic<std::uint64_t> m_head{ 0 };
+        std::atomic<std::uint64_t> m_tail{ 0 };
+        std::atomic<std::uint64_t> m_dropped{ 0 };
+        char m_data[capacity];
+    };
+
+    // Rings are never freed, since their threads may exit before their records are drained. New ones are pushed onto
+    // the front of the list, which is otherwise never modified
+    std::atomic<trace_ring*> g_rings{ nullptr };
+    thread_local trace_ring* t_ring = nullptr;
+
+    HANDLE g_traceFile = INVALID_HANDLE_VALUE;
+    bool g_binary = false;
+    bool g_blocks = false; // Only set with 'traceFileSizeLimit'
+    DWORD g_treeProcessId = 0; // Only set with 'processTree'
+
+    // Function names are written to the file by the writer, ahead of the records it drains, rather than through the
+    // rings, so that a full ring can never lose one. Only the writer - whoever holds g_draining - reads g_namesWritten
+    trace_function g_functions[max_trace_functions];
+    std::atomic<std::uint16_t> g_functionCount{ 0 };
+    std::atomic<std::uint16_t> g_functionsPublished{ 0 };
+    std::uint16_t g_namesWritten = 0;
+    std::atomic<bool> g_draining{ false };
+    LPTOP_LEVEL_EXCEPTION_FILTER g_previousFilter = nullptr;
+
+    trace_ring* current_ring()
+    {
+        if (!t_ring)
+        {
+            auto ring = new trace_ring();
+            auto head = g_rings.load(std::memory_order_relaxed);
+            do
+            {
+                ring->set_next(head);
+            } while (!g_rings.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+            t_ring = ring;
+        }
+
+        return t_ring;
+    }
+
+    void drain_rings(bool force)
+    {
+        // The consumer side of the rings must only be used by one thread at a time. At exit and on a crash, the writer
+        // may have been terminated while draining, in which case nobody is going to release it, and so flushes only wait
+        // for it for so long
+        for (int attempt = 0; g_draining.exchange(true, std::memory_order_acquire); ++attempt)
+        {
+            if (!force)
+            {
+                return;
+            }
+            else if (attempt == 100)
+            {
+                break;
+            }
+            ::Sleep(1);
+        }
+
+        std::string output;
+        if (g_binary)
+        {
+            // Ids are published in order, so everything up to the published count has its name in place
+            for (auto count = g_functionsPublished.load(std::memory_order_acquire); g_namesWritten < count; ++g_namesWritten)
+            {
+                std::string_view name = g_functions[g_namesWritten].name;
+                file_record_header fileHeader{ 0, 0, trace_record_kind::function, 0, static_cast<std::uint32_t>(sizeof(std::uint16_t) + name.size()) };
+                output.append(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+                output.append(reinterpret_cast<const char*>(&g_namesWritten), sizeof(g_namesWritten));
+                output.append(name);
+            }
+        }
+
+        for (auto ring = g_rings.load(std::memory_order_acquire); ring; ring = ring->next())
+        {
+            ring->drain(output, g_binary, g_treeProcessId);
+        }
+
+        DWORD written;
+        if (g_blocks)
+        {
+            WriteTraceBlocks(output, force);
+        }
+        else if (!output.empty())
+        {
+            ::WriteFile(g_traceFile, output.data(), static_cast<DWORD>(output.size()), &written, nullptr);
+        }
+
+        g_draining.store(false, std::memory_order_release);
+    }
+
+    LONG WINAPI flush_on_crash(EXCEPTION_POINTERS* exceptionInfo)
+    {
+        FlushTraceRings();
+        return g_previousFilter ? g_previousFilter(exceptionInfo) : EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    void start_writer()
+    {
+        g_previousFilter = ::SetUnhandledExceptionFilter(&flush_on_crash);
+        std::thread([]() noexcept
+        {
+            while (true)
+            {
+                ::Sleep(50);
+                try
+                {
+                    drain_rings(false);
+                }
+                catch (...)
+                {
+                    // Unable to log should not crash an app. The records stay in the rings for the next attempt
+                }
+            }
+        }).detach();
+    }
+}
+
+void StartTraceRings(const std::filesystem::path& filePath, bool binary, std::uint64_t sizeLimit)
+{
+    g_traceFile = ::CreateFileW(filePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (g_traceFile == INVALID_HANDLE_VALUE)
+    {
+        ::OutputDebugStringW((L"TraceFixup could not create the trace file " + filePath.native()).c_str());
+        return;
+    }
+
+    g_binary = binary;
+    if (binary && sizeLimit)
+    {
+        LARGE_INTEGER frequency;
+        ::QueryPerformanceFrequency(&frequency);
+        g_blocks = StartTraceBlocks(g_traceFile, sizeLimit, frequency.QuadPart);
+        if (!g_blocks)
+        {
+            ::OutputDebugStringW((L"TraceFixup could not write the trace file " + filePath.native()).c_str());
+            ::CloseHandle(g_traceFile);
+            g_traceFile = INVALID_HANDLE_VALUE;
+            return;
+        }
+    }
+    else if (binary)
+    {
+        LARGE_INTEGER frequency;
+        ::QueryPerformanceFrequency(&frequency);
+        file_header header{ { 'P', 'S', 'F', 'T', 'R', 'A', 'C', 'E' }, 1, 0, frequency.QuadPart };
+
+        DWORD written;
+        ::WriteFile(g_traceFile, &header, sizeof(header), &written, nullptr);
+    }
+
+    start_writer();
+}
+
+void StartProcessTreeTraceRings(const std::filesystem::path& filePath, bool isRoot)
+{
+    // Only appending - and not writing at a position of its own - is what makes each process' writes land whole at the
+    // end of the file, no matter what the others write at the same time
+    if (isRoot)
+    {
+        ::DeleteFileW(filePath.c_str());
+    }
+    g_traceFile = ::CreateFileW(filePath.c_str(), FILE_APPEND_DATA | SYNCHRONIZE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (g_traceFile == INVALID_HANDLE_VALUE)
+    {
+        ::OutputDebugStringW((L"TraceFixup could not open the process tree's trace file " + filePath.native()).c_str());
+        return;
+    }
+
+    g_treeProcessId = ::GetCurrentProcessId();
+    start_writer();
+}
+
+void FlushTraceRings() noexcept try
+{
+    if (g_traceFile != INVALID_HANDLE_VALUE)
+    {
+        drain_rings(true);
+        ::FlushFileBuffers(g_traceFile);
+    }
+}
+catch (...)
+{
+    // Unable to log should not crash an app
+}
+
+void WriteTraceRecord(const char* data, std::size_t length) noexcept try
+{
+    LARGE_INTEGER timestamp;
+    ::QueryPerformanceCounter(&timestamp);
+
+    auto size = std::min(length, trace_ring::capacity / 2);
+    trace_record_header header{ timestamp.QuadPart, static_cast<std::uint32_t>(size), trace_record_kind::text, 0 };
+    current_ring()->write(header, { { data, size } });
+}
+catch (...)
+{
+    // Only reached if a ring could not be allocated; the record is dropped
+}
+
+std::uint16_t RegisterTraceFunction(const trace_function& function) noexcept
+{
+    // Past the limit, calls are all attributed to the last function; there are far fewer traced functions than that
+    auto id = g_functionCount.fetch_add(1, std::memory_order_relaxed);
+    if (id >= max_trace_functions)
+    {
+        return static_cast<std::uint16_t>(max_trace_functions - 1);
+    }
+
+    g_functions[id] = function;
+
+    // Registrations that started earlier may still be writing their names; publish in id order
+    auto expected = id;
+    while (!g_functionsPublished.compare_exchange_weak(expected, static_cast<std::uint16_t>(id + 1), std::memory_order_release, std::memory_order_relaxed))
+    {
+        expected = id;
+        ::SwitchToThread();
+    }
+
+    return id;
+}
+
+const trace_function& TraceFunction(std::uint16_t id) noexcept
+{
+    return g_functions[id];
+}
+
+void WriteCallRecord(
+    std::uint16_t functionId,
+    std::uint8_t result,
+    std::uint32_t error,
+    std::int64_t start,
+    std::int64_t end,
+    const void* string,
+    std::size_t stringBytes,
+    bool wideString,
+    const std::uint64_t* args,
+    std::size_t argCount) noexcept try
+{
+    argCount = std::min(argCount, max_call_args);
+    stringBytes = string ? std::min(stringBytes, max_call_string_bytes) : 0;
+
+    call_record record{
+        functionId,
+        result,
+        static_cast<std::uint8_t>(wideString ? 1 : 0),
+        error,
+        end - start,
+        static_cast<std::uint16_t>(argCount),
+        static_cast<std::uint16_t>(stringBytes) };
+
+    auto argBytes = argCount * sizeof(std::uint64_t);
+    trace_record_header header{ start, static_cast<std::uint32_t>(sizeof(record) + argBytes + stringBytes), trace_record_kind::call, 0 };
+    current_ring()->write(header, { { &record, sizeof(record) }, { args, argBytes }, { string, stringBytes } });
+}
+catch (...)
+{
+    // Only reached if a ring could not be allocated; the record is dropped
+}
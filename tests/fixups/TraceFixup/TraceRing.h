@@ -0,0 +1,83 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// The 'ringBuffer' trace method. Each thread writes its records into a ring of its own, without taking any lock, and a
+// background thread drains all of the rings to a file. Tracing therefore costs the traced thread little more than a copy,
+// which keeps it from changing the app's timing - and with it the problem being traced - the way that a global lock and
+// OutputDebugString do. A record that does not fit in the thread's ring is dropped, and counted, rather than waited on.
+//
+// The rings are flushed as the process exits or crashes. Each line of the file starts with the QueryPerformanceCounter
+// timestamp of the record and the id of the thread that wrote it, so that the output of different threads can be merged.
+//
+// The 'binary' trace method uses the same rings, but the fixups that support it write call records - the function, its
+// raw argument values, its result, and its string argument, if any - instead of formatting text, and the file is left
+// for a viewer to decode. Its layout, all little endian and without padding, is:
+//
+//      file header:    char magic[8] = "PSFTRACE", uint32 version = 1, uint32 reserved, int64 QPC frequency
+//      record header:  int64 QPC timestamp, uint32 thread id, uint16 kind, uint16 reserved, uint32 payload length
+//
+// followed by the payload of the record, which depends on its kind:
+//
+//      trace_record_kind::text:        UTF-8 text, as passed to Log, from fixups that only write text
+//      trace_record_kind::function:    uint16 function id, UTF-8 function name. Always before the first call with the id
+//      trace_record_kind::call:        uint16 function id, uint8 function_result, uint8 flags (1: the string is UTF-16),
+//                                      uint32 error, int64 QPC ticks taken by the call, uint16 argument count,
+//                                      uint16 string length in bytes, uint64 arguments[argument count], string
+//      trace_record_kind::thread:      uint32 process id of the record's thread. Only written by PsfTraceCollector,
+//                                      whose captures hold the calls of many processes, before the thread's first record
+//
+// With a 'sizeLimit' - the 'traceFileSizeLimit' option - the 'binary' records are instead written to a file of compressed
+// blocks that's overwritten oldest block first once it reaches the limit; see TraceBlocks.h
+enum class trace_record_kind : std::uint16_t
+{
+    text,
+    function,
+    call,
+    thread,
+};
+
+void StartTraceRings(const std::filesystem::path& filePath, bool binary, std::uint64_t sizeLimit = 0);
+
+// The 'processTree' option of the 'ringBuffer' trace method, with which all of the traced processes of a process tree
+// write to the one file. The root of the tree creates it, and the others each append what they drain from their rings
+// in a single write, so that lines of different processes never run into each other. Each line then also has the id of
+// the process, between the timestamp and the thread id. QueryPerformanceCounter is the same for all of the processes,
+// so sorting on the timestamp puts the file in the order that things happened across the tree
+void StartProcessTreeTraceRings(const std::filesystem::path& filePath, bool isRoot);
+
+// Drains every ring to the file, from whatever thread calls it. Called on detach and on an unhandled exception
+void FlushTraceRings() noexcept;
+
+void WriteTraceRecord(const char* data, std::size_t length) noexcept;
+
+// A function that writes call records. The strings must outlive the process, e.g. be literals. The argument names are
+// space separated, in the order that the calls pass their arguments, and only used by the 'etwEvents' trace method
+struct trace_function
+{
+    const char* name;
+    const char* argument_names;
+    std::uint8_t type; // function_type
+};
+
+// Assigns the id that call records of 'function' are written with
+std::uint16_t RegisterTraceFunction(const trace_function& function) noexcept;
+const trace_function& TraceFunction(std::uint16_t id) noexcept;
+
+void WriteCallRecord(
+    std::uint16_t functionId,
+    std::uint8_t result,
+    std::uint32_t error,
+    std::int64_t start,
+    std::int64_t end,
+    const void* string,
+    std::size_t stringBytes,
+    bool wideString,
+    const std::uint64_t* args,
+    std::size_t argCount) noexcept;
@@ -15,6 +15,7 @@
 
 #include "Config.h"
 #include "FunctionImplementations.h"
+#include "HandleNames.h"
 #include "PreserveError.h"
 #include "WinternlLogging.h"
 
@@ -93,9 +94,16 @@ NTSTATUS __stdcall NtCreateFileFixup(
     QueryPerformanceCounter(&TickEnd);
 
     auto functionResult = from_ntstatus(result);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, objectAttributes))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::filesystem, "NtCreateFile", "DesiredAccess FileAttributes ShareAccess CreateDisposition CreateOptions Handle");
+            std::wstring objectName;
+            LogCallRecord(functionId, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, ObjectAttributesName(objectAttributes, objectName),
+                { trace_arg(desiredAccess), trace_arg(fileAttributes), trace_arg(shareAccess), trace_arg(createDisposition), trace_arg(createOptions), trace_arg(NT_SUCCESS(result) ? *fileHandle : nullptr) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -180,9 +188,14 @@ NTSTATUS __stdcall NtCreateFileFixup(
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        RememberHandleName(*fileHandle, objectAttributes);
+    }
+
     return result;
 }
-DECLARE_FIXUP(NtCreateFileImpl, NtCreateFileFixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, NtCreateFileImpl, NtCreateFileFixup);
 
 auto NtOpenFileImpl = WINTERNL_FUNCTION(NtOpenFile);
 NTSTATUS __stdcall NtOpenFileFixup(
@@ -205,9 +218,16 @@ NTSTATUS __stdcall NtOpenFileFixup(
 
     auto functionResult = from_ntstatus(result);
     QueryPerformanceCounter(&TickEnd);
-    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
+    if (auto lock = acquire_output_lock(function_type::filesystem, functionResult, objectAttributes))
     {
-        if (output_method == trace_method::eventlog)
+        if (writes_call_records(output_method))
+        {
+            static const auto functionId = RegisterTraceFunction(function_type::filesystem, "NtOpenFile", "DesiredAccess ShareAccess OpenOptions Handle");
+            std::wstring objectName;
+            LogCallRecord(functionId, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, ObjectAttributesName(objectAttributes, objectName),
+                { trace_arg(desiredAccess), trace_arg(shareAccess), trace_arg(openOptions), trace_arg(NT_SUCCESS(result) ? *fileHandle : nullptr) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -288,9 +308,14 @@ NTSTATUS __stdcall NtOpenFileFixup(
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        RememberHandleName(*fileHandle, objectAttributes);
+    }
+
     return result;
 }
-DECLARE_FIXUP(NtOpenFileImpl, NtOpenFileFixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, NtOpenFileImpl, NtOpenFileFixup);
 
 // NOTE: NtCreateDirectoryObject is only documented; it has no declaration
 NTSTATUS WINAPI NtCreateDirectoryObject(
@@ -366,9 +391,14 @@ NTSTATUS __stdcall NtCreateDirectoryObjectFixup(
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        RememberHandleName(*directoryHandle, objectAttributes);
+    }
+
     return result;
 }
-DECLARE_FIXUP(NtCreateDirectoryObjectImpl, NtCreateDirectoryObjectFixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, NtCreateDirectoryObjectImpl, NtCreateDirectoryObjectFixup);
 
 // NOTE: NtOpenDirectoryObject is only documented; it has no declaration
 NTSTATUS WINAPI NtOpenDirectoryObject(
@@ -444,9 +474,14 @@ NTSTATUS __stdcall NtOpenDirectoryObjectFixup(
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        RememberHandleName(*directoryHandle, objectAttributes);
+    }
+
     return result;
 }
-DECLARE_FIXUP(NtOpenDirectoryObjectImpl, NtOpenDirectoryObjectFixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, NtOpenDirectoryObjectImpl, NtOpenDirectoryObjectFixup);
 
 // NOTE: NtQueryDirectoryObject is only documented; it has no declaration
 NTSTATUS WINAPI NtQueryDirectoryObject(
@@ -579,7 +614,7 @@ NTSTATUS __stdcall NtQueryDirectoryObjectFixup(
 
     return result;
 }
-DECLARE_FIXUP(NtQueryDirectoryObjectImpl, NtQueryDirectoryObjectFixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, NtQueryDirectoryObjectImpl, NtQueryDirectoryObjectFixup);
 
 // NOTE: NtOpenSymbolicLinkObject is only documented; it has no declaration
 NTSTATUS WINAPI NtOpenSymbolicLinkObject(
@@ -657,7 +692,7 @@ NTSTATUS __stdcall NtOpenSymbolicLinkObjectFixup(
 
     return result;
 }
-DECLARE_FIXUP(NtOpenSymbolicLinkObjectImpl, NtOpenSymbolicLinkObjectFixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, NtOpenSymbolicLinkObjectImpl, NtOpenSymbolicLinkObjectFixup);
 
 // NOTE: NtQuerySymbolicLinkObject is only documented; it has no declaration
 NTSTATUS WINAPI NtQuerySymbolicLinkObject(
@@ -745,7 +780,7 @@ NTSTATUS WINAPI NtQuerySymbolicLinkObjectFixup(
 
     return result;
 }
-DECLARE_FIXUP(NtQuerySymbolicLinkObjectImpl, NtQuerySymbolicLinkObjectFixup);
+DECLARE_TRACE_FIXUP(function_type::filesystem, NtQuerySymbolicLinkObjectImpl, NtQuerySymbolicLinkObjectFixup);
 
 // NOTE: NtCreateKey is only documented; it has no declaration
 NTSTATUS WINAPI NtCreateKey(
@@ -773,7 +808,7 @@ NTSTATUS __stdcall NtCreateKeyFixup(
 
     auto functionResult = from_ntstatus(result);
     QueryPerformanceCounter(&TickEnd);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, objectAttributes))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -837,9 +872,14 @@ NTSTATUS __stdcall NtCreateKeyFixup(
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        RememberHandleName(*keyHandle, objectAttributes);
+    }
+
     return result;
 }
-DECLARE_FIXUP(NtCreateKeyImpl, NtCreateKeyFixup);
+DECLARE_TRACE_FIXUP(function_type::registry, NtCreateKeyImpl, NtCreateKeyFixup);
 
 // NOTE: NtOpenKey is only documented; it has no declaration
 NTSTATUS WINAPI NtOpenKey(_Out_ PHANDLE KeyHandle, _In_ ACCESS_MASK DesiredAccess, _In_ POBJECT_ATTRIBUTES ObjectAttributes);
@@ -853,7 +893,7 @@ NTSTATUS __stdcall NtOpenKeyFixup(_Out_ PHANDLE keyHandle, _In_ ACCESS_MASK desi
 
     auto functionResult = from_ntstatus(result);
     QueryPerformanceCounter(&TickEnd);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, objectAttributes))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -909,9 +949,14 @@ NTSTATUS __stdcall NtOpenKeyFixup(_Out_ PHANDLE keyHandle, _In_ ACCESS_MASK desi
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        RememberHandleName(*keyHandle, objectAttributes);
+    }
+
     return result;
 }
-DECLARE_FIXUP(NtOpenKeyImpl, NtOpenKeyFixup);
+DECLARE_TRACE_FIXUP(function_type::registry, NtOpenKeyImpl, NtOpenKeyFixup);
 
 // NOTE: NtOpenKeyEx is only documented; it has no declaration
 NTSTATUS WINAPI NtOpenKeyEx(
@@ -933,7 +978,7 @@ NTSTATUS __stdcall NtOpenKeyExFixup(
 
     auto functionResult = from_ntstatus(result);
     QueryPerformanceCounter(&TickEnd);
-    if (auto lock = acquire_output_lock(function_type::registry, functionResult))
+    if (auto lock = acquire_output_lock(function_type::registry, functionResult, objectAttributes))
     {
         if (output_method == trace_method::eventlog)
         {
@@ -991,9 +1036,14 @@ NTSTATUS __stdcall NtOpenKeyExFixup(
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        RememberHandleName(*keyHandle, objectAttributes);
+    }
+
     return result;
 }
-DECLARE_FIXUP(NtOpenKeyExImpl, NtOpenKeyExFixup);
+DECLARE_TRACE_FIXUP(function_type::registry, NtOpenKeyExImpl, NtOpenKeyExFixup);
 
 // NOTE: NtSetValueKey is only documented; it has no declaration
 NTSTATUS WINAPI NtSetValueKey(
@@ -1077,7 +1127,7 @@ NTSTATUS __stdcall NtSetValueKeyFixup(
 
     return result;
 }
-DECLARE_FIXUP(NtSetValueKeyImpl, NtSetValueKeyFixup);
+DECLARE_TRACE_FIXUP(function_type::registry, NtSetValueKeyImpl, NtSetValueKeyFixup);
 
 // NOTE: NtQueryValueKey is only documented; it has no declaration
 NTSTATUS __stdcall NtQueryValueKeyFixup(
@@ -1284,4 +1334,16 @@ NTSTATUS __stdcall NtQueryValueKeyFixup(
 
     return result;
 }
-DECLARE_FIXUP(impl::NtQueryValueKey, NtQueryValueKeyFixup);
+DECLARE_TRACE_FIXUP(function_type::registry, impl::NtQueryValueKey, NtQueryValueKeyFixup);
+
+
+// NOTE: NtClose isn't traced; it only keeps the names of handles known to be open, so that the name of a closed handle
+//       is never mistaken for that of a later handle with the same value. Forgotten before the handle is closed, since
+//       its value can be reused by another thread as soon as it is
+auto NtCloseImpl = WINTERNL_FUNCTION(NtClose);
+NTSTATUS __stdcall NtCloseFixup(_In_ HANDLE handle)
+{
+    ForgetHandleName(handle);
+    return NtCloseImpl(handle);
+}
+DECLARE_GROUPED_FIXUP(handle_names_group, NtCloseImpl, NtCloseFixup);
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "FunctionImplementations.h"
+#include "HandleNames.h"
 #include "Logging.h"
 
 inline void LogObjectAttributes(ULONG attributes)
@@ -434,6 +435,7 @@ inline void LogObjectAttributes(POBJECT_ATTRIBUTES objectAttributes)
     std::wstring rootDir;
     if (objectAttributes->RootDirectory && (objectAttributes->RootDirectory != INVALID_HANDLE_VALUE))
     {
+        TryGetHandleName(objectAttributes->RootDirectory, rootDir) ||
         TryGetDirectoryPath(objectAttributes->RootDirectory, rootDir) ||
         TryGetKeyPath(objectAttributes->RootDirectory, rootDir);
     }
@@ -450,7 +452,8 @@ inline std::string InterpretObjectAttributes(POBJECT_ATTRIBUTES objectAttributes
     std::wstring rootDir;
     if (objectAttributes->RootDirectory && (objectAttributes->RootDirectory != INVALID_HANDLE_VALUE))
     {
-        TryGetDirectoryPath(objectAttributes->RootDirectory, rootDir) ||
+        TryGetHandleName(objectAttributes->RootDirectory, rootDir) ||
+            TryGetDirectoryPath(objectAttributes->RootDirectory, rootDir) ||
             TryGetKeyPath(objectAttributes->RootDirectory, rootDir);
     }
 
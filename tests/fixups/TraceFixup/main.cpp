@@ -7,7 +7,6 @@
 
 #include <debug.h>
 
-#define PSF_DEFINE_EXPORTS
 #include <psf_framework.h>
 
 #include "Config.h"
@@ -35,13 +34,61 @@ bool wait_for_debugger = false;
 bool trace_function_entry = false;
 bool trace_calling_module = true;
 bool ignore_dll_load = true;
+bool profile_calls = false;
+std::uint32_t profile_stack_one_in = 0;
+std::int64_t slow_call_ticks = 0;
+bool path_filters_enabled = false;
 
-static const psf::json_object* g_traceLevels = nullptr;
+// The traceLevels and breakOn objects, bound once while the configuration is read
+struct trace_levels_config
+{
+    std::optional<std::string> default_level;
+    std::optional<std::string> filesystem;
+    std::optional<std::string> registry;
+    std::optional<std::string> process_and_thread;
+    std::optional<std::string> dynamic_link_library;
+
+    static constexpr auto json_fields()
+    {
+        return std::make_tuple(
+            psf::json_field("default", &trace_levels_config::default_level),
+            psf::json_field(function_type_config_key(function_type::filesystem), &trace_levels_config::filesystem),
+            psf::json_field(function_type_config_key(function_type::registry), &trace_levels_config::registry),
+            psf::json_field(function_type_config_key(function_type::process_and_thread), &trace_levels_config::process_and_thread),
+            psf::json_field(function_type_config_key(function_type::dynamic_link_library), &trace_levels_config::dynamic_link_library));
+    }
+
+    const std::optional<std::string>& level(function_type type) const noexcept
+    {
+        switch (type)
+        {
+        case function_type::filesystem:
+            return filesystem;
+        case function_type::registry:
+            return registry;
+        case function_type::process_and_thread:
+            return process_and_thread;
+        case function_type::dynamic_link_library:
+            return dynamic_link_library;
+        }
+
+        static const std::optional<std::string> none;
+        return none;
+    }
+};
+
+static trace_levels_config g_traceLevels;
 static trace_level g_defaultTraceLevel = trace_level::unexpected_failures;
 
-static const psf::json_object* g_breakLevels = nullptr;
+static trace_levels_config g_breakLevels;
 static trace_level g_defaultBreakLevel = trace_level::ignore;
 
+std::atomic<std::uint8_t> g_resultLogMasks[function_type_count];
+std::atomic<std::uint8_t> g_resultBreakMasks[function_type_count];
+
+bool sampling_enabled = false;
+sampling_configuration g_sampling[function_type_count];
+
 
 
 
@@ -73,85 +120,172 @@ static trace_level trace_level_from_configuration(std::string_view str, trace_le
     return defaultLevel;
 }
 
-static trace_level configured_level(function_type type, const psf::json_object* configuredLevels, trace_level defaultLevel)
+static trace_level configured_level(function_type type, const trace_levels_config& configuredLevels, trace_level defaultLevel)
 {
-    if (!configuredLevels)
+    if (auto& level = configuredLevels.level(type))
     {
-        return defaultLevel;
+        return trace_level_from_configuration(*level, defaultLevel);
     }
 
-    auto impl = [&](const char* configKey)
-    {
-        if (auto config = configuredLevels->try_get(configKey))
-        {
-            return trace_level_from_configuration(config->as_string().string(), defaultLevel);
-        }
+    return defaultLevel;
+}
+
+static trace_level configured_trace_level(function_type type)
+{
+    return configured_level(type, g_traceLevels, g_defaultTraceLevel);
+}
 
-        return defaultLevel;
-    };
+static trace_level configured_break_level(function_type type)
+{
+    return configured_level(type, g_breakLevels, g_defaultBreakLevel);
+}
 
-    switch (type)
+static bool level_includes(trace_level level, function_result result)
+{
+    switch (level)
     {
-    case function_type::filesystem:
-        return impl("filesystem");
+    case trace_level::always:
+        return result >= function_result::success;
+        break;
 
-    case function_type::registry:
-        return impl("registry");
+    case trace_level::ignore_success:
+        return result >= function_result::indeterminate;
+        break;
 
-    case function_type::process_and_thread:
-        return impl("processAndThread");
+    case trace_level::all_failures:
+        return result >= function_result::expected_failure;
         break;
 
-    case function_type::dynamic_link_library:
-        return impl("dynamicLinkLibrary");
+    case trace_level::unexpected_failures:
+        return result >= function_result::failure;
         break;
+
+    case trace_level::ignore:
+    default:
+        return false;
     }
+}
 
-    // Fallback to default
-    return defaultLevel;
+static std::uint8_t result_mask(trace_level level)
+{
+    std::uint8_t mask = 0;
+    for (auto result : { function_result::success, function_result::indeterminate, function_result::expected_failure, function_result::failure })
+    {
+        if (level_includes(level, result))
+        {
+            mask |= static_cast<std::uint8_t>(1 << static_cast<int>(result));
+        }
+    }
+
+    return mask;
 }
 
-static trace_level configured_trace_level(function_type type)
+// Must be called once the configuration has been read, and before any fixup is called
+static void compute_result_masks()
 {
-    return configured_level(type, g_traceLevels, g_defaultTraceLevel);
+    for (std::size_t i = 0; i < function_type_count; ++i)
+    {
+        auto type = static_cast<function_type>(i);
+        g_resultLogMasks[i].store(result_mask(configured_trace_level(type)), std::memory_order_relaxed);
+        g_resultBreakMasks[i].store(result_mask(configured_break_level(type)), std::memory_order_relaxed);
+    }
 }
 
-static trace_level configured_break_level(function_type type)
+// Whether calls to functions of 'type' can produce any output, i.e. whether its detours are worth attaching. Function
+// entry tracing and profiling cover every call, no matter what traceLevels says
+static bool function_type_traced(function_type type)
 {
-    return configured_level(type, g_breakLevels, g_defaultBreakLevel);
+    auto index = static_cast<std::size_t>(type);
+    return trace_function_entry || profile_calls || (profile_stack_one_in != 0) ||
+        (g_resultLogMasks[index].load(std::memory_order_relaxed) != 0) ||
+        (g_resultBreakMasks[index].load(std::memory_order_relaxed) != 0);
 }
 
-result_configuration configured_result(function_type type, function_result result)
+static bool trace_group_enabled(const char* group)
 {
-    auto impl = [&](trace_level level)
+    if (std::strcmp(group, handle_names_group) == 0)
     {
-        switch (level)
+        return function_type_traced(function_type::filesystem) || function_type_traced(function_type::registry);
+    }
+
+    for (std::size_t i = 0; i < function_type_count; ++i)
+    {
+        auto type = static_cast<function_type>(i);
+        if (std::strcmp(group, function_type_config_key(type)) == 0)
         {
-        case trace_level::always:
-            return result >= function_result::success;
-            break;
+            return function_type_traced(type);
+        }
+    }
+
+    return true;
+}
 
-        case trace_level::ignore_success:
-            return result >= function_result::indeterminate;
-            break;
 
-        case trace_level::all_failures:
-            return result >= function_result::expected_failure;
-            break;
+static void read_sampling_configuration(const psf::json_object& config, sampling_configuration& sampling)
+{
+    if (auto oneIn = config.try_get("oneIn"))
+    {
+        sampling.one_in = std::max(oneIn->as_number().get<std::uint32_t>(), 1u);
+    }
 
-        case trace_level::unexpected_failures:
-            return result >= function_result::failure;
-            break;
+    if (auto maxPerSecond = config.try_get("maxPerSecond"))
+    {
+        sampling.max_per_second = maxPerSecond->as_number().get<std::uint32_t>();
+    }
 
-        case trace_level::ignore:
-        default:
-            return false;
+    if (auto alwaysLog = config.try_get("alwaysLog"))
+    {
+        // The same levels as traceLevels, e.g. "allFailures" to keep every failure no matter how heavily successes are
+        // sampled
+        sampling.always_mask = result_mask(trace_level_from_configuration(alwaysLog->as_string().string(), trace_level::ignore));
+    }
+}
+
+static void read_sampling_configuration(const psf::json_object& config)
+{
+    sampling_configuration defaultSampling;
+    if (auto defaultConfig = config.try_get("default"))
+    {
+        read_sampling_configuration(defaultConfig->as_object(), defaultSampling);
+    }
+
+    for (std::size_t i = 0; i < function_type_count; ++i)
+    {
+        g_sampling[i] = defaultSampling;
+        if (auto typeConfig = config.try_get(function_type_config_key(static_cast<function_type>(i))))
+        {
+            read_sampling_configuration(typeConfig->as_object(), g_sampling[i]);
         }
-    };
 
-    return { impl(configured_trace_level(type)), impl(configured_break_level(type)) };
+        if ((g_sampling[i].one_in > 1) || (g_sampling[i].max_per_second != 0))
+        {
+            sampling_enabled = true;
+        }
+    }
 }
 
+// Only the calls that make it past 'oneIn' - a small fraction when sampling heavily - are counted here. The count is
+// shared by all threads, and is started over by whichever thread first sees that a new second has begun
+struct sampling_window
+{
+    std::atomic<std::uint64_t> second{ 0 };
+    std::atomic<std::uint32_t> count{ 0 };
+};
+static sampling_window g_samplingWindows[function_type_count];
+
+bool sampling_rate_allows(function_type type) noexcept
+{
+    auto index = static_cast<std::size_t>(type);
+    auto& window = g_samplingWindows[index];
+    auto now = ::GetTickCount64() / 1000;
+    auto second = window.second.load(std::memory_order_relaxed);
+    if ((second != now) && window.second.compare_exchange_strong(second, now, std::memory_order_relaxed))
+    {
+        window.count.store(0, std::memory_order_relaxed);
+    }
+
+    return window.count.fetch_add(1, std::memory_order_relaxed) < g_sampling[index].max_per_second;
+}
 
 // Set up the ETW Provider
 void Log_ETW_Register()
@@ -204,6 +338,46 @@ void Log_ETW_PostMsgOperationA(const char* operation, const char* inputs, const
     }
 }
 
+// One event per traced call, with its values as typed fields rather than text. The keyword is the call's function_type,
+// so that sessions can filter whole classes of functions out before the events ever leave the process. Keywords have to
+// be constant, hence one TraceLoggingWrite per type
+void Log_ETW_PostCall(const trace_function& function, function_result result, DWORD error, LARGE_INTEGER TickStart, LARGE_INTEGER TickEnd, const wchar_t* path, std::size_t pathLength, const std::uint64_t* args, std::size_t argCount) noexcept
+{
+#define TRACE_FIXUP_CALL_EVENT(keyword) \
+    TraceLoggingWrite(g_Log_ETW_ComponentProvider, \
+        "ApiCall", \
+        TraceLoggingKeyword(keyword), \
+        TraceLoggingString(function.name, "Function"), \
+        TraceLoggingCountedWideString(path, static_cast<USHORT>(pathLength), "Path"), \
+        TraceLoggingString(function.argument_names, "ArgumentNames"), \
+        TraceLoggingUInt64Array(args, static_cast<UINT16>(argCount), "Arguments"), \
+        TraceLoggingHexUInt32(error, "Error"), \
+        TraceLoggingUInt8(static_cast<UINT8>(result), "Result"), \
+        TraceLoggingInt64(TickStart.QuadPart, "Start"), \
+        TraceLoggingInt64(TickEnd.QuadPart - TickStart.QuadPart, "Duration"))
+
+    switch (static_cast<function_type>(function.type))
+    {
+    case function_type::filesystem:
+        TRACE_FIXUP_CALL_EVENT(0x1);
+        break;
+
+    case function_type::registry:
+        TRACE_FIXUP_CALL_EVENT(0x2);
+        break;
+
+    case function_type::process_and_thread:
+        TRACE_FIXUP_CALL_EVENT(0x4);
+        break;
+
+    case function_type::dynamic_link_library:
+        TRACE_FIXUP_CALL_EVENT(0x8);
+        break;
+    }
+
+#undef TRACE_FIXUP_CALL_EVENT
+}
+
 void Log_ETW_PostMsgW(const wchar_t* s)
 {
     try
@@ -234,6 +408,48 @@ void Log_ETW_UnRegister()
     }
 }
 
+// A file per process in the temp folder, named '<prefix>.<executable>.<process id><extension>'
+static std::filesystem::path process_temp_file_path(const wchar_t* prefix, const wchar_t* extension)
+{
+    wchar_t tempPath[MAX_PATH + 1];
+    auto length = ::GetTempPathW(static_cast<DWORD>(std::size(tempPath)), tempPath);
+    std::filesystem::path result((length != 0) && (length < std::size(tempPath)) ? tempPath : L".");
+    return result / (prefix + (L"." + psf::current_executable_path().stem().native()) + L"." + std::to_wstring(::GetCurrentProcessId()) + extension);
+}
+
+// Where the 'ringBuffer' and 'binary' trace methods write to: 'traceFile' if given, otherwise a file per process in the
+// temp folder
+static std::filesystem::path trace_file_path(const psf::json_object& configObj, const wchar_t* extension)
+{
+    if (auto fileConfig = configObj.try_get("traceFile"))
+    {
+        return fileConfig->as_string().wide();
+    }
+
+    return process_temp_file_path(L"PsfTrace", extension);
+}
+
+// Set by the root of a 'processTree' trace, and inherited by the children that it and they create
+static constexpr wchar_t process_tree_file_variable[] = L"PSF_TRACE_PROCESS_TREE_FILE";
+
+// With 'processTree', the first traced process of the tree decides on the file, as it would without it, and the rest of
+// the tree finds it in the environment. Children created with an environment of their own start a tree of their own
+static std::filesystem::path process_tree_file_path(const psf::json_object& configObj, bool& isRoot)
+{
+    wchar_t inherited[MAX_PATH + 1];
+    auto length = ::GetEnvironmentVariableW(process_tree_file_variable, inherited, static_cast<DWORD>(std::size(inherited)));
+    if ((length != 0) && (length < std::size(inherited)))
+    {
+        isRoot = false;
+        return inherited;
+    }
+
+    isRoot = true;
+    auto result = trace_file_path(configObj, L".log");
+    ::SetEnvironmentVariableW(process_tree_file_variable, result.c_str());
+    return result;
+}
+
 BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
 {
     if (reason == DLL_PROCESS_ATTACH)
@@ -262,6 +478,41 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
                     output_method = trace_method::eventlog;
                     Log("config traceMethod is eventlog");
                 }
+                else if (methodStr == "ringBuffer"sv)
+                {
+                    output_method = trace_method::ring_buffer;
+                    auto processTree = configObj.try_get("processTree");
+                    if (processTree && processTree->try_as_boolean() && processTree->try_as_boolean()->get())
+                    {
+                        traceDataStream << " processTree:true ;";
+                        bool isRoot;
+                        StartProcessTreeTraceRings(process_tree_file_path(configObj, isRoot), isRoot);
+                    }
+                    else
+                    {
+                        StartTraceRings(trace_file_path(configObj, L".log"), false);
+                    }
+                    Log("config traceMethod is ringBuffer");
+                }
+                else if (methodStr == "etwEvents"sv)
+                {
+                    output_method = trace_method::etw_events;
+                    Log("config traceMethod is etwEvents");
+                }
+                else if (methodStr == "binary"sv)
+                {
+                    output_method = trace_method::binary;
+
+                    // In megabytes; the file is then a ring of compressed blocks that never grows past it
+                    std::uint64_t sizeLimit = 0;
+                    if (auto limitConfig = configObj.try_get("traceFileSizeLimit"))
+                    {
+                        auto megabytes = limitConfig->as_number().get<double>();
+                        traceDataStream << " traceFileSizeLimit:" << megabytes << " ;";
+                        sizeLimit = (megabytes > 0) ? static_cast<std::uint64_t>(megabytes * 1024 * 1024) : 0;
+                    }
+                    StartTraceRings(trace_file_path(configObj, L".bin"), true, sizeLimit);
+                }
                 else {
                     // Otherwise, use the default (OutputDebugString)
                     Log("config traceMethod is default");
@@ -270,30 +521,56 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
 
             if (auto levels = configObj.try_get("traceLevels"))
             {
-                g_traceLevels = &levels->as_object();
+                psf::json_bind(*levels, g_traceLevels);
                 traceDataStream << " traceLevels:\n";
 
                 // Set default level immediately for fallback purposes
-                if (auto defaultLevel = g_traceLevels->try_get("default"))
+                if (auto& defaultLevel = g_traceLevels.default_level)
                 {
-                    traceDataStream << " default:" << defaultLevel->as_string().wide() << " ;";
-                    g_defaultTraceLevel = trace_level_from_configuration(defaultLevel->as_string().string(), g_defaultTraceLevel);
+                    traceDataStream << " default:" << widen(*defaultLevel) << " ;";
+                    g_defaultTraceLevel = trace_level_from_configuration(*defaultLevel, g_defaultTraceLevel);
                 }
             }
 
             if (auto levels = configObj.try_get("breakOn"))
             {
-                g_breakLevels = &levels->as_object();
+                psf::json_bind(*levels, g_breakLevels);
                 traceDataStream << " breakOn:\n";
 
                 // Set default level immediately for fallback purposes
-                if (auto defaultLevel = g_breakLevels->try_get("default"))
+                if (auto& defaultLevel = g_breakLevels.default_level)
                 {
-                    traceDataStream << " default:" << defaultLevel->as_string().wide() << " ;";
-                    g_defaultBreakLevel = trace_level_from_configuration(defaultLevel->as_string().string(), g_defaultBreakLevel);
+                    traceDataStream << " default:" << widen(*defaultLevel) << " ;";
+                    g_defaultBreakLevel = trace_level_from_configuration(*defaultLevel, g_defaultBreakLevel);
                 }
             }
 
+            if (auto slowConfig = configObj.try_get("slowCallThreshold"))
+            {
+                // In milliseconds, e.g. 5 for calls long enough to make a UI thread stutter
+                auto milliseconds = slowConfig->as_number().get<double>();
+                traceDataStream << " slowCallThreshold:" << milliseconds << " ;";
+
+                if (milliseconds > 0)
+                {
+                    LARGE_INTEGER frequency;
+                    ::QueryPerformanceFrequency(&frequency);
+                    slow_call_ticks = std::max<std::int64_t>(static_cast<std::int64_t>(milliseconds * static_cast<double>(frequency.QuadPart) / 1000.0), 1);
+                }
+            }
+
+            if (auto filterConfig = configObj.try_get("pathFilters"))
+            {
+                CompilePathFilters(filterConfig->as_object());
+                traceDataStream << " pathFilters:" << path_filters_enabled << " ;";
+            }
+
+            if (auto samplingConfig = configObj.try_get("sampling"))
+            {
+                read_sampling_configuration(samplingConfig->as_object());
+                traceDataStream << " sampling:" << sampling_enabled << " ;";
+            }
+
             if (auto debuggerConfig = configObj.try_get("waitForDebugger"))
             {
                 traceDataStream << " waitForDebugger:" << static_cast<bool>(debuggerConfig->as_boolean()) << " ;";
@@ -317,6 +594,26 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
                 traceDataStream << " ignoreDllLoad:" << static_cast<bool>(ignoreDllConfig->as_boolean()) << " ;";
                 ignore_dll_load = static_cast<bool>(ignoreDllConfig->as_boolean());
             }
+
+            if (auto profileConfig = configObj.try_get("profile"))
+            {
+                traceDataStream << " profile:" << static_cast<bool>(profileConfig->as_boolean()) << " ;";
+                profile_calls = static_cast<bool>(profileConfig->as_boolean());
+            }
+
+            if (auto stacksConfig = configObj.try_get("profileStacks"))
+            {
+                auto& stacksObj = stacksConfig->as_object();
+                profile_stack_one_in = 16;
+                if (auto oneIn = stacksObj.try_get("oneIn"))
+                {
+                    profile_stack_one_in = std::max(oneIn->as_number().get<std::uint32_t>(), 1u);
+                }
+                traceDataStream << " profileStacks:" << profile_stack_one_in << " ;";
+
+                auto fileConfig = stacksObj.try_get("file");
+                EnableProfiledStacks(fileConfig ? std::filesystem::path(fileConfig->as_string().wide()) : process_temp_file_path(L"PsfProfile", L".folded"));
+            }
             try
             {
                 TraceLoggingWrite(
@@ -334,6 +631,18 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
             }
         }
 
+        compute_result_masks();
+
+        if (trace_calling_module || (slow_call_ticks != 0) || (profile_stack_one_in != 0))
+        {
+            InitializeModuleCache();
+        }
+
+        if (profile_calls)
+        {
+            EnableTraceProfile();
+        }
+
         if (wait_for_debugger)
         {
             psf::wait_for_debugger();
@@ -341,6 +650,19 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
     }
     else if (reason == DLL_PROCESS_DETACH)
     {
+        // Before the rings are flushed, so that the summary is part of what they write
+        if (profile_calls)
+        {
+            LogTraceProfile();
+        }
+        if (profile_stack_one_in != 0)
+        {
+            WriteProfiledStacks();
+        }
+        if (uses_trace_rings(output_method))
+        {
+            FlushTraceRings();
+        }
         Log_ETW_UnRegister();
     }
 
@@ -351,3 +673,45 @@ catch (...)
     ::SetLastError(win32_from_caught_exception());
     return FALSE;
 }
+
+extern "C" {
+
+// The configuration has been read by DllMain by now, so only the detours of the function types that are traced get
+// attached, e.g. a registry only trace adds nothing to file I/O
+int __stdcall PSFInitialize() noexcept try
+{
+    psf::attach_all(trace_group_enabled);
+    return ERROR_SUCCESS;
+}
+catch (...)
+{
+    return win32_from_caught_exception();
+}
+
+int __stdcall PSFUninitialize() noexcept try
+{
+    psf::detach_all();
+    return ERROR_SUCCESS;
+}
+catch (...)
+{
+    return win32_from_caught_exception();
+}
+
+// The trace rings are flushed when the DLL is unloaded
+int __stdcall PSFFlush() noexcept
+{
+    return ERROR_SUCCESS;
+}
+
+#ifdef _M_IX86
+#pragma comment(linker, "/EXPORT:PSFInitialize=_PSFInitialize@0")
+#pragma comment(linker, "/EXPORT:PSFUninitialize=_PSFUninitialize@0")
+#pragma comment(linker, "/EXPORT:PSFFlush=_PSFFlush@0")
+#else
+#pragma comment(linker, "/EXPORT:PSFInitialize=PSFInitialize")
+#pragma comment(linker, "/EXPORT:PSFUninitialize=PSFUninitialize")
+#pragma comment(linker, "/EXPORT:PSFFlush=PSFFlush")
+#endif
+
+}
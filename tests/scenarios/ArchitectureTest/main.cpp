@@ -81,7 +81,7 @@ int wmain(int argc, const wchar_t** argv)
             {
                 // Relenquish the pipe so that our child process can connect
                 g_testRunnerPipe.reset();
-                launchString += L" /mode:test";
+                launchString += L" /mode:test /pipe:" + g_testRunnerPipeName;
             }
 
             std::wcout << L"Launching \"" << targetExe << L"\"\n";
@@ -116,7 +116,7 @@ int wmain(int argc, const wchar_t** argv)
 
             if (isTestMode)
             {
-                g_testRunnerPipe = test_client_connect();
+                g_testRunnerPipe = test_client_connect(g_testRunnerPipeName.c_str());
             }
 
             test_cleanup();
@@ -0,0 +1,707 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Times how the cost of loading a configuration grows with its size, for configurations that it synthesizes at increasing
+// sizes: parsing config.json into the PSF Runtime's DOM, finding the configuration of the executable, and what the File
+// Redirection, RegLegacy and Dynamic Library fixups make of theirs. Like the Pattern Match Test, it isn't packaged, since
+// nothing that it times depends on the package.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fcntl.h>
+#include <filesystem>
+#include <io.h>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <compiled_pattern.h>
+#include <known_folders.h>
+#include <path_key.h>
+#include <psf_constants.h>
+#include <rapidjson/encodedstream.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
+
+#include <test_config.h>
+
+#include "../../../PsfRuntime/JsonConfig.h"
+#include "../../../fixups/DynamicLibraryFixup/dll_location_spec.h"
+#include "../../../fixups/FileRedirectionFixup/RedirectionRules.h"
+#include "../../../fixups/RegLegacyFixups/Reg_Remediation_Spec.h"
+
+using namespace std::literals;
+
+// Where the fixups would find the package. Nothing is ever read from it
+static const std::filesystem::path g_packageRootPath = LR"(C:\Program Files\WindowsApps\Contoso.ConfigScaling_1.0.0.0_x64__8wekyb3d8bbwe)";
+
+static std::int64_t timestamp()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+static std::int64_t frequency()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceFrequency(&value);
+    return value.QuadPart;
+}
+
+// The size of a synthesized configuration. Every process configuration has all three fixups, each with the same number
+// of patterns, the way that generated configurations repeat the same fixups for each executable
+struct config_shape
+{
+    std::size_t processes;
+    std::size_t patterns; // Of the File Redirection Fixup and of the RegLegacy Fixups each
+    std::size_t dlls;
+};
+
+static std::string json_string(std::string_view value)
+{
+    std::string result = "\"";
+    for (auto ch : value)
+    {
+        if ((ch == '\\') || (ch == '"'))
+        {
+            result.push_back('\\');
+        }
+        result.push_back(ch);
+    }
+    result.push_back('"');
+    return result;
+}
+
+static std::string process_name(std::size_t index)
+{
+    auto number = std::to_string(index);
+    return "App" + std::string(4 - std::min<std::size_t>(number.length(), 4), '0') + number;
+}
+
+// The shapes that compiled_pattern tells apart, in turn: literals, literal prefixes and suffixes, and patterns that need
+// a DFA
+static std::string file_pattern(std::size_t index)
+{
+    auto number = std::to_string(index);
+    switch (index % 4)
+    {
+    case 0: return "Settings" + number + R"(\.ini)";
+    case 1: return "Logs" + number + R"(\\.*)";
+    case 2: return R"(.*\.ext)" + number;
+    default: return "Cache" + number + R"(\\[^\\]+\.dat)";
+    }
+}
+
+static std::string key_pattern(std::size_t index)
+{
+    auto number = std::to_string(index);
+    switch (index % 4)
+    {
+    case 0: return R"(SOFTWARE\\Contoso\\Key)" + number;
+    case 1: return R"(SOFTWARE\\Contoso)" + number + R"(\\.*)";
+    case 2: return R"(.*\\Settings)" + number;
+    default: return R"(SOFTWARE\\Contoso)" + number + R"(\\[^\\]+\\Options)";
+    }
+}
+
+// Patterns come in groups of eight, one group to each "base" or remediation
+constexpr std::size_t patterns_per_group = 8;
+
+static std::string redirection_config(std::size_t patterns)
+{
+    std::string result = R"({"dll":"FileRedirectionFixup.dll","config":{"redirectedPaths":{"packageRelative":[)";
+    for (std::size_t group = 0; group * patterns_per_group < patterns; ++group)
+    {
+        result += group ? "," : "";
+        result += R"({"base":)" + json_string(R"(VFS\Data\Folder)" + std::to_string(group)) + R"(,"patterns":[)";
+        for (auto i = group * patterns_per_group; i < std::min(patterns, (group + 1) * patterns_per_group); ++i)
+        {
+            result += (i % patterns_per_group) ? "," : "";
+            result += json_string(file_pattern(i));
+        }
+        result += "]}";
+    }
+    return result + "]}}}";
+}
+
+static std::string registry_config(std::size_t patterns)
+{
+    std::string result = R"({"dll":"RegLegacyFixups.dll","config":[{"type":"ModifyKeyAccess","remediation":[)";
+    for (std::size_t group = 0; group * patterns_per_group < patterns; ++group)
+    {
+        result += group ? "," : "";
+        result += R"({"hive":")" + std::string((group % 2) ? "HKLM" : "HKCU") + R"(","patterns":[)";
+        for (auto i = group * patterns_per_group; i < std::min(patterns, (group + 1) * patterns_per_group); ++i)
+        {
+            result += (i % patterns_per_group) ? "," : "";
+            result += json_string(key_pattern(i));
+        }
+        result += R"(],"access":"Full2RW"})";
+    }
+    return result + "]}]}";
+}
+
+static std::string dll_config(std::size_t dlls)
+{
+    std::string result = R"({"dll":"DynamicLibraryFixup.dll","config":{"forcePackageDllUse":true,"relativeDllPaths":[)";
+    for (std::size_t i = 0; i < dlls; ++i)
+    {
+        auto name = "Library" + std::to_string(i) + ".dll";
+        result += i ? "," : "";
+        result += R"({"name":)" + json_string(name) + R"(,"filepath":)" + json_string(R"(VFS\ProgramFilesX64\Contoso\)" + name) + "}";
+    }
+    return result + "]}}";
+}
+
+// Every fourth executable is a regular expression, which the PSF Runtime has to match in order, rather than look up
+static std::string make_config(const config_shape& shape)
+{
+    auto fixups = redirection_config(shape.patterns) + "," + registry_config(shape.patterns) + "," + dll_config(shape.dlls);
+
+    std::string result = R"({"applications":[{"id":"App","executable":"App0000.exe"}],"processes":[)";
+    for (std::size_t i = 0; i < shape.processes; ++i)
+    {
+        auto name = process_name(i);
+        result += i ? "," : "";
+        result += R"({"executable":)" + json_string((i % 4 == 3) ? name + "(64)?" : name) + R"(,"fixups":[)" + fixups + "]}";
+    }
+    return result + "]}";
+}
+
+// Parsed the same way that load_json parses config.json, from memory instead of a file
+static std::unique_ptr<json_dom_builder> parse_config(const std::string& text)
+{
+    auto result = std::make_unique<json_dom_builder>();
+    rapidjson::MemoryStream stream(text.data(), text.size());
+    rapidjson::AutoUTFInputStream<char32_t, rapidjson::MemoryStream> autoStream(stream);
+
+    rapidjson::GenericReader<rapidjson::AutoUTF<char32_t>, rapidjson::UTF8<>> reader;
+    auto parseResult = reader.Parse(autoStream, *result);
+    if (parseResult.IsError())
+    {
+        throw std::runtime_error(std::string("Could not parse the configuration: ") + rapidjson::GetParseError_En(parseResult.Code()));
+    }
+
+    result->finish();
+    return result;
+}
+
+// The same as the PSF Runtime's compile_exe_patterns, index_configs and match_exe_pattern, in Config.cpp
+struct exe_pattern
+{
+    const psf::json_object* config;
+    std::wstring_view pattern;
+    bool is_literal;
+    bool is_valid;
+    compiled_pattern matcher;
+};
+
+struct fixup_config_key
+{
+    const psf::json_object* exe_config;
+    iwstring_view dll;
+
+    friend bool operator==(const fixup_config_key& lhs, const fixup_config_key& rhs) noexcept
+    {
+        return (lhs.exe_config == rhs.exe_config) && (lhs.dll == rhs.dll);
+    }
+};
+
+struct fixup_config_key_hash
+{
+    std::size_t operator()(const fixup_config_key& key) const noexcept
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (auto ch : key.dll)
+        {
+            hash = (hash ^ details::fold_case(ch)) * 1099511628211ull;
+        }
+        return static_cast<std::size_t>(hash ^ (hash >> 32)) ^ (reinterpret_cast<std::uintptr_t>(key.exe_config) * 0x9E3779B9);
+    }
+};
+
+struct exe_index
+{
+    std::vector<exe_pattern> patterns;
+    std::unordered_map<std::wstring_view, std::size_t> literals;
+    std::vector<std::size_t> regexes;
+    std::unordered_map<fixup_config_key, const psf::json_value*, fixup_config_key_hash> fixup_configs;
+    const psf::json_object* match = nullptr;
+};
+
+static iwstring_view remove_suffix_if(iwstring_view str, iwstring_view suffix)
+{
+    if ((str.length() >= suffix.length()) && (str.substr(str.length() - suffix.length()) == suffix))
+    {
+        str.remove_suffix(suffix.length());
+    }
+
+    return str;
+}
+
+static iwstring_view dll_base_name(iwstring_view dll)
+{
+    return remove_suffix_if(remove_suffix_if(dll, L".dll"_isv), psf::warch_string);
+}
+
+static std::unique_ptr<exe_index> index_processes(const psf::json_value& root, std::wstring_view exeName)
+{
+    auto result = std::make_unique<exe_index>();
+    if (auto processes = root.as_object().try_get("processes"))
+    {
+        auto& processesArray = processes->as_array();
+        result->patterns.reserve(processesArray.size());
+        for (auto& processConfig : processesArray)
+        {
+            auto& obj = processConfig.as_object();
+            auto exe = obj.get("executable").as_string().wstring();
+            auto index = result->patterns.size();
+            auto isLiteral = exe.find_first_of(LR"(\^$.|?*+()[]{})") == std::wstring_view::npos;
+            auto& entry = result->patterns.emplace_back(exe_pattern{ &obj, exe, isLiteral, false, {} });
+            if (entry.is_literal)
+            {
+                result->literals.emplace(exe, index);
+            }
+            else
+            {
+                result->regexes.push_back(index);
+                try
+                {
+                    entry.matcher.assign(exe.data(), exe.length());
+                    entry.is_valid = true;
+                }
+                catch (std::regex_error&)
+                {
+                }
+            }
+        }
+    }
+
+    for (auto& entry : result->patterns)
+    {
+        if (auto fixups = entry.config->try_get("fixups"))
+        {
+            for (auto& fixupConfig : fixups->as_array())
+            {
+                auto& fixupConfigObj = fixupConfig.as_object();
+                auto dllStr = fixupConfigObj.get("dll").as_string().wstring();
+                auto dll = dll_base_name(iwstring_view(dllStr.data(), dllStr.length()));
+                result->fixup_configs.emplace(fixup_config_key{ entry.config, dll }, fixupConfigObj.try_get("config"));
+            }
+        }
+    }
+
+    auto literal = result->literals.find(exeName);
+    auto limit = (literal != result->literals.end()) ? literal->second : result->patterns.size();
+    for (auto index : result->regexes)
+    {
+        if (index >= limit)
+        {
+            break;
+        }
+
+        auto& entry = result->patterns[index];
+        if (entry.is_valid && entry.matcher.match(exeName))
+        {
+            result->match = entry.config;
+            return result;
+        }
+    }
+
+    result->match = (literal != result->literals.end()) ? result->patterns[literal->second].config : nullptr;
+    return result;
+}
+
+static const psf::json_value& fixup_config(const exe_index& index, iwstring_view dll)
+{
+    auto itr = index.fixup_configs.find(fixup_config_key{ index.match, dll });
+    if ((itr == index.fixup_configs.end()) || !itr->second)
+    {
+        throw std::runtime_error("The configuration of a fixup is missing");
+    }
+    return *itr->second;
+}
+
+// The same as the File Redirection Fixup's InitializeConfiguration does for "packageRelative" rules, without logging
+static std::unique_ptr<redirection_rule_set> build_redirection_rules(const psf::json_value& config)
+{
+    auto result = std::make_unique<redirection_rule_set>();
+    auto& redirectedPaths = config.as_object().get("redirectedPaths").as_object();
+    if (auto packageRelativeValue = redirectedPaths.try_get("packageRelative"))
+    {
+        std::size_t specIndex = 0;
+        for (auto& spec : packageRelativeValue->as_array())
+        {
+            auto specLocation = "/redirectedPaths/packageRelative/" + std::to_string(specIndex++);
+            auto& specObject = spec.as_object();
+            auto path = psf::remove_trailing_path_separators(g_packageRootPath / specObject.get("base").as_string().wstring());
+            std::size_t patternIndex = 0;
+            for (auto& pattern : specObject.get("patterns").as_array())
+            {
+                auto patternString = pattern.as_string().wstring();
+                auto& redirectSpec = result->add(path);
+                redirectSpec.pattern.assign(patternString.data(), patternString.length());
+                redirectSpec.redirect_targetbase = g_packageRootPath;
+                redirectSpec.isExclusion = false;
+                redirectSpec.isReadOnly = false;
+                redirectSpec.config_location = specLocation + "/patterns/" + std::to_string(patternIndex++);
+            }
+        }
+    }
+
+    return result;
+}
+
+// The same as the RegLegacy Fixups' InitializeConfiguration and IndexRemediationSpecs do for ModifyKeyAccess remediations,
+// copies and all, without logging
+struct registry_specs
+{
+    std::vector<Reg_Remediation_Spec> specs;
+    std::unordered_map<std::wstring_view, std::vector<const Modify_Key_Pattern*>> by_first_key[2];
+    std::vector<const Modify_Key_Pattern*> others[2];
+    std::size_t pattern_count = 0;
+};
+
+static std::unique_ptr<registry_specs> build_registry_specs(const psf::json_value& config)
+{
+    auto result = std::make_unique<registry_specs>();
+    for (auto& spec : config.as_array())
+    {
+        Reg_Remediation_Spec specItem;
+        auto& specObject = spec.as_object();
+        specItem.remeditaionType = Reg_Remediation_Type_ModifyKeyAccess;
+        if (auto remValue = specObject.try_get("remediation"))
+        {
+            for (auto& remediationsItem : remValue->as_array())
+            {
+                Reg_Remediation_Record recordItem;
+                auto& remediationsItemObject = remediationsItem.as_object();
+                auto hiveType = remediationsItemObject.get("hive").as_string().wstring();
+                recordItem.modifyKeyAccess.hive = (hiveType == L"HKCU") ? Modify_Key_Hive_Type_HKCU : Modify_Key_Hive_Type_HKLM;
+                for (auto& pattern : remediationsItemObject.get("patterns").as_array())
+                {
+                    Modify_Key_Pattern patternItem;
+                    patternItem.pattern = pattern.as_string().wstring();
+                    patternItem.matcher.assign(patternItem.pattern.c_str(), patternItem.pattern.length());
+                    recordItem.modifyKeyAccess.patterns.push_back(std::move(patternItem));
+                }
+                recordItem.modifyKeyAccess.access = Modify_Key_Access_Type_Full2RW;
+                specItem.remediationRecords.push_back(recordItem);
+            }
+        }
+        result->specs.push_back(specItem);
+    }
+
+    for (auto& spec : result->specs)
+    {
+        for (auto& rem : spec.remediationRecords)
+        {
+            auto hive = (rem.modifyKeyAccess.hive == Modify_Key_Hive_Type_HKCU) ? 0 : 1;
+            for (auto& pattern : rem.modifyKeyAccess.patterns)
+            {
+                std::wstring_view literal = pattern.matcher.literal;
+                auto pos = literal.find(L'\\');
+                if ((pattern.matcher.kind == pattern_kind::literal) || ((pattern.matcher.kind == pattern_kind::literal_prefix) && (pos != std::wstring_view::npos)))
+                {
+                    result->by_first_key[hive][literal.substr(0, pos)].push_back(&pattern);
+                }
+                else
+                {
+                    result->others[hive].push_back(&pattern);
+                }
+                ++result->pattern_count;
+            }
+        }
+    }
+
+    return result;
+}
+
+// The same as the Dynamic Library Fixup's InitializeConfiguration does with "relativeDllPaths", without the DLL
+// directories
+struct relative_dll_config
+{
+    std::wstring name;
+    std::wstring filepath;
+
+    static constexpr auto json_fields()
+    {
+        return std::make_tuple(
+            psf::json_field("name", &relative_dll_config::name, psf::json_required),
+            psf::json_field("filepath", &relative_dll_config::filepath, psf::json_required));
+    }
+};
+
+struct dynamic_library_config
+{
+    bool force_package_dll_use = false;
+    std::vector<relative_dll_config> relative_dll_paths;
+
+    static constexpr auto json_fields()
+    {
+        return std::make_tuple(
+            psf::json_field("forcePackageDllUse", &dynamic_library_config::force_package_dll_use),
+            psf::json_field("relativeDllPaths", &dynamic_library_config::relative_dll_paths));
+    }
+};
+
+struct dll_specs
+{
+    dynamic_library_config config;
+    std::vector<dll_location_spec> specs;
+    std::unordered_map<std::wstring_view, const dll_location_spec*> index;
+};
+
+static std::unique_ptr<dll_specs> build_dll_specs(const psf::json_value& config)
+{
+    auto result = std::make_unique<dll_specs>();
+    psf::json_bind(config, result->config);
+    for (auto& spec : result->config.relative_dll_paths)
+    {
+        result->specs.emplace_back();
+        result->specs.back().full_filepath = g_packageRootPath / spec.filepath;
+        result->specs.back().filename = spec.name;
+    }
+
+    for (auto& spec : result->specs)
+    {
+        spec.folded_filename = spec.filename;
+        fold_dll_name(spec.folded_filename.data(), spec.folded_filename.length());
+    }
+    for (auto& spec : result->specs)
+    {
+        std::wstring_view name = spec.folded_filename;
+        result->index.emplace(name, &spec);
+        if ((name.length() > 4) && (name.substr(name.length() - 4) == L".DLL"sv))
+        {
+            result->index.emplace(name.substr(0, name.length() - 4), &spec);
+        }
+    }
+
+    return result;
+}
+
+struct phase_timing
+{
+    std::int64_t ticks = std::numeric_limits<std::int64_t>::max();
+    std::size_t count = 0;
+};
+
+// The shortest of 'iterations' runs of 'build', since it's the size of the configuration, not the state of the heap or the
+// caches, that's being measured. What it builds is freed outside of the time, and 'count' says how much was built
+template <typename Build, typename Count>
+static phase_timing time_phase(std::size_t iterations, Build&& build, Count&& count)
+{
+    phase_timing result;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        auto start = timestamp();
+        auto value = build();
+        auto elapsed = timestamp() - start;
+        result.ticks = std::min(result.ticks, elapsed);
+        result.count = count(value);
+    }
+    return result;
+}
+
+constexpr std::size_t phase_count = 5;
+constexpr const wchar_t* phase_names[phase_count] = { L"parse", L"process", L"redirection", L"registry", L"dll" };
+
+struct scale_timings
+{
+    std::size_t scale;
+    std::size_t config_bytes;
+    std::int64_t ticks[phase_count];
+};
+
+static std::wstring microseconds(std::int64_t ticks)
+{
+    return std::to_wstring(ticks * 1000000 / frequency()) + L"us";
+}
+
+static int run_scale(const config_shape& shape, std::size_t iterations, scale_timings& timings)
+{
+    auto text = make_config(shape);
+    timings.config_bytes = text.size();
+
+    auto parse = time_phase(iterations, [&] { return parse_config(text); }, [](auto& dom) { return dom->root ? std::size_t{ 1 } : 0; });
+    auto dom = parse_config(text);
+
+    // The last process configuration, after all of the regular expressions before it, is the most expensive to find
+    auto exeName = widen(process_name(shape.processes - 1));
+    auto process = time_phase(iterations, [&] { return index_processes(*dom->root, exeName); }, [](auto& index) { return index->match ? std::size_t{ 1 } : 0; });
+    auto index = index_processes(*dom->root, exeName);
+
+    auto& redirectionConfig = fixup_config(*index, L"FileRedirectionFixup"_isv);
+    auto redirection = time_phase(iterations, [&] { return build_redirection_rules(redirectionConfig); }, [](auto& rules) { return rules->specs().size(); });
+
+    auto& registryConfig = fixup_config(*index, L"RegLegacyFixups"_isv);
+    auto registry = time_phase(iterations, [&] { return build_registry_specs(registryConfig); }, [](auto& specs) { return specs->pattern_count; });
+
+    auto& dllConfig = fixup_config(*index, L"DynamicLibraryFixup"_isv);
+    auto dll = time_phase(iterations, [&] { return build_dll_specs(dllConfig); }, [](auto& specs) { return specs->specs.size(); });
+
+    // Anything missing means that the configuration wasn't read the way that the fixups read theirs
+    if ((parse.count != 1) || (process.count != 1) || (redirection.count != shape.patterns) || (registry.count != shape.patterns) || (dll.count != shape.dlls))
+    {
+        return print_error(ERROR_ASSERTION_FAILURE, "Not all of the configuration was read");
+    }
+
+    phase_timing phases[phase_count] = { parse, process, redirection, registry, dll };
+    std::wostringstream line;
+    line << L"Scale " << timings.scale << L": " << shape.processes << L" processes, " << shape.patterns << L" patterns, " << shape.dlls
+        << L" DLLs, " << (timings.config_bytes + 512) / 1024 << L"KB ";
+    trace_messages(line.str());
+    for (std::size_t i = 0; i < phase_count; ++i)
+    {
+        timings.ticks[i] = phases[i].ticks;
+        trace_messages(L" ", phase_names[i], L": ", info_color, microseconds(phases[i].ticks));
+    }
+    trace_message(L"\n");
+    return ERROR_SUCCESS;
+}
+
+// How each phase grows from the smallest scale to the largest, as the power of the scale: about 1 for linear growth, and
+// about 2 for quadratic growth. Times too short to measure don't have one
+static void print_growth(const std::vector<scale_timings>& timings)
+{
+    auto& first = timings.front();
+    auto& last = timings.back();
+    if (last.scale <= first.scale)
+    {
+        return;
+    }
+
+    trace_messages(L"Growth, as a power of the scale:");
+    for (std::size_t i = 0; i < phase_count; ++i)
+    {
+        std::wostringstream growth;
+        if ((first.ticks[i] > 0) && (last.ticks[i] > 0))
+        {
+            growth.precision(2);
+            auto ratio = static_cast<double>(last.ticks[i]) / static_cast<double>(first.ticks[i]);
+            growth << std::fixed << std::log(ratio) / std::log(static_cast<double>(last.scale) / static_cast<double>(first.scale));
+        }
+        else
+        {
+            growth << L"-";
+        }
+        trace_messages(L" ", phase_names[i], L": ", info_color, growth.str());
+    }
+    trace_message(L"\n");
+}
+
+// One of the two series: the number of process configurations, or the size of each fixup's configuration, is multiplied
+// by each scale in turn, and the other is left as is
+static int run_series(const char* name, const config_shape& base, bool scaleProcesses, const std::vector<std::size_t>& scales, std::size_t iterations)
+{
+    test_begin(name);
+
+    int result = ERROR_SUCCESS;
+    std::vector<scale_timings> timings;
+    try
+    {
+        for (auto scale : scales)
+        {
+            auto shape = base;
+            if (scaleProcesses)
+            {
+                shape.processes *= scale;
+            }
+            else
+            {
+                shape.patterns *= scale;
+                shape.dlls *= scale;
+            }
+
+            auto& entry = timings.emplace_back(scale_timings{ scale, 0, {} });
+            result = run_scale(shape, iterations, entry);
+            if (result != ERROR_SUCCESS)
+            {
+                break;
+            }
+        }
+    }
+    catch (...)
+    {
+        result = print_error(win32_from_caught_exception(), message_from_caught_exception().c_str());
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        print_growth(timings);
+    }
+
+    test_end(result);
+    return result;
+}
+
+static std::vector<std::size_t> parse_scales(const std::wstring& value)
+{
+    std::vector<std::size_t> result;
+    std::wistringstream stream(value);
+    std::wstring scale;
+    while (std::getline(stream, scale, L','))
+    {
+        result.push_back(static_cast<std::size_t>(std::wcstoul(scale.c_str(), nullptr, 10)));
+    }
+    return result;
+}
+
+int wmain(int argc, const wchar_t** argv)
+{
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/scales", L"1,2,4,8,16" },
+        { L"/processes", L"16" },
+        { L"/patterns", L"128" },
+        { L"/iterations", L"5" },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    auto scales = parse_scales(allowedArgs[L"/scales"]);
+    config_shape base{};
+    base.processes = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/processes"].c_str(), nullptr, 10));
+    base.patterns = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/patterns"].c_str(), nullptr, 10));
+    base.dlls = base.patterns / 4;
+    auto iterations = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/iterations"].c_str(), nullptr, 10));
+    if ((result == ERROR_SUCCESS) && (scales.empty() || (std::find(scales.begin(), scales.end(), 0) != scales.end()) ||
+        (base.processes == 0) || (base.patterns < 4) || (iterations == 0)))
+    {
+        std::wcout << error_text() << "ERROR: /scales must be positive numbers separated by commas, /processes and /iterations must be positive, and /patterns must be at least 4\n";
+        result = ERROR_INVALID_PARAMETER;
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        std::sort(scales.begin(), scales.end());
+        test_initialize("Config Scaling Benchmarks", 2);
+
+        result = run_series("Process configurations", base, true, scales, iterations);
+        auto patternsResult = run_series("Fixup configurations", base, false, scales, iterations);
+        result = result ? result : patternsResult;
+
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -0,0 +1,94 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <vector>
+
+#include <windows.h>
+#include <psapi.h>
+
+#include "AllocationCounter.h"
+
+using HeapAlloc_t = LPVOID(WINAPI*)(HANDLE, DWORD, SIZE_T);
+
+static std::atomic<std::uint64_t> g_allocationCount{ 0 };
+static HeapAlloc_t g_heapAlloc = nullptr;
+
+static LPVOID WINAPI CountingHeapAlloc(HANDLE heap, DWORD flags, SIZE_T bytes)
+{
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return g_heapAlloc(heap, flags, bytes);
+}
+
+static void patch_imports(HMODULE module)
+{
+    auto base = reinterpret_cast<std::uint8_t*>(module);
+    auto dosHeader = reinterpret_cast<IMAGE_DOS_HEADER*>(base);
+    auto ntHeaders = reinterpret_cast<IMAGE_NT_HEADERS*>(base + dosHeader->e_lfanew);
+    auto& directory = ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+    if (directory.VirtualAddress == 0)
+    {
+        return;
+    }
+
+    // HeapAlloc is forwarded to ntdll, so every import of it - whether through kernel32 or an API set - is resolved to
+    // the same address, which is what's looked for instead of the names
+    for (auto descriptor = reinterpret_cast<IMAGE_IMPORT_DESCRIPTOR*>(base + directory.VirtualAddress); descriptor->Name; ++descriptor)
+    {
+        for (auto thunk = reinterpret_cast<IMAGE_THUNK_DATA*>(base + descriptor->FirstThunk); thunk->u1.Function; ++thunk)
+        {
+            if (reinterpret_cast<HeapAlloc_t>(thunk->u1.Function) != g_heapAlloc)
+            {
+                continue;
+            }
+
+            DWORD oldProtect;
+            if (::VirtualProtect(&thunk->u1.Function, sizeof(thunk->u1.Function), PAGE_READWRITE, &oldProtect))
+            {
+                thunk->u1.Function = reinterpret_cast<ULONG_PTR>(&CountingHeapAlloc);
+                ::VirtualProtect(&thunk->u1.Function, sizeof(thunk->u1.Function), oldProtect, &oldProtect);
+            }
+        }
+    }
+}
+
+void StartCountingAllocations()
+{
+    if (g_heapAlloc)
+    {
+        return;
+    }
+
+    g_heapAlloc = reinterpret_cast<HeapAlloc_t>(::GetProcAddress(::GetModuleHandleW(L"kernel32.dll"), "HeapAlloc"));
+
+    std::vector<HMODULE> modules(256);
+    DWORD size = 0;
+    while (::K32EnumProcessModules(::GetCurrentProcess(), modules.data(), static_cast<DWORD>(modules.size() * sizeof(HMODULE)), &size) &&
+        (size > modules.size() * sizeof(HMODULE)))
+    {
+        modules.resize(size / sizeof(HMODULE));
+    }
+    modules.resize(size / sizeof(HMODULE));
+
+    // Windows' own modules are left alone, along with their allocations
+    wchar_t windowsPath[MAX_PATH];
+    auto windowsLength = ::GetSystemWindowsDirectoryW(windowsPath, MAX_PATH);
+    for (auto module : modules)
+    {
+        wchar_t path[MAX_PATH];
+        if ((windowsLength > 0) && ::GetModuleFileNameW(module, path, MAX_PATH) &&
+            (_wcsnicmp(path, windowsPath, windowsLength) == 0))
+        {
+            continue;
+        }
+
+        patch_imports(module);
+    }
+}
+
+std::uint64_t AllocationCount() noexcept
+{
+    return g_allocationCount.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,14 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+
+// Starts counting heap allocations by pointing the HeapAlloc imports of every module that's loaded at the time - the
+// test itself, the PSF dlls, and their static CRTs - at a function that counts them. Allocations made inside Windows
+// aren't counted, so what's counted is what the fixups, rather than the functions they call, allocate
+void StartCountingAllocations();
+
+std::uint64_t AllocationCount() noexcept;
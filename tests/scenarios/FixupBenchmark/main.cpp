@@ -0,0 +1,234 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cwctype>
+#include <fcntl.h>
+#include <io.h>
+#include <vector>
+
+#include <known_folders.h>
+#include <psf_runtime.h>
+
+#include <test_config.h>
+
+#include "AllocationCounter.h"
+
+static std::filesystem::path g_packageFilePath;
+static std::filesystem::path g_packageFindPattern;
+static std::filesystem::path g_systemFilePath;
+
+static std::int64_t timestamp()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+static std::int64_t frequency()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceFrequency(&value);
+    return value.QuadPart;
+}
+
+static std::wstring nanoseconds(double ticks)
+{
+    return std::to_wstring(static_cast<std::int64_t>(ticks * 1000000000 / frequency())) + L"ns";
+}
+
+// Times each of 'iterations' calls to 'operation' on its own, after a tenth as many to warm up the caches - the
+// system's as well as the fixups' own. The test fails if any call does
+template <typename Func>
+static int benchmark(const char* name, std::size_t iterations, Func&& operation)
+{
+    test_begin(name);
+
+    int result = ERROR_SUCCESS;
+    for (std::size_t i = 0; (i < iterations / 10) && (result == ERROR_SUCCESS); ++i)
+    {
+        result = operation();
+    }
+
+    std::vector<std::int64_t> samples(iterations);
+    auto allocations = AllocationCount();
+    for (std::size_t i = 0; (i < iterations) && (result == ERROR_SUCCESS); ++i)
+    {
+        auto start = timestamp();
+        result = operation();
+        samples[i] = timestamp() - start;
+    }
+    allocations = AllocationCount() - allocations;
+
+    if (result == ERROR_SUCCESS)
+    {
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        for (auto sample : samples)
+        {
+            total += static_cast<double>(sample);
+        }
+
+        auto percentile = [&](std::size_t percent)
+        {
+            return nanoseconds(static_cast<double>(samples[(samples.size() - 1) * percent / 100]));
+        };
+
+        trace_messages(
+            L"ns/op: ", info_color, nanoseconds(total / iterations), console::color::gray,
+            L"  allocations/op: ", info_color, std::to_wstring(static_cast<double>(allocations) / iterations), console::color::gray,
+            L"  p50: ", info_color, percentile(50), console::color::gray,
+            L"  p90: ", info_color, percentile(90), console::color::gray,
+            L"  p99: ", info_color, percentile(99), console::color::gray,
+            L"  max: ", info_color, nanoseconds(static_cast<double>(samples.back())), new_line);
+    }
+    else
+    {
+        print_error(result, "Benchmarked call failed");
+    }
+
+    test_end(result);
+    return result;
+}
+
+static int win32_result(BOOL succeeded)
+{
+    return succeeded ? ERROR_SUCCESS : ::GetLastError();
+}
+
+static int open_file(const std::filesystem::path& path)
+{
+    auto file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return ::GetLastError();
+    }
+
+    ::CloseHandle(file);
+    return ERROR_SUCCESS;
+}
+
+static int get_attributes(const std::filesystem::path& path)
+{
+    return win32_result(::GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES);
+}
+
+static int find_files(const std::filesystem::path& pattern)
+{
+    WIN32_FIND_DATAW data;
+    auto find = ::FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, 0);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return ::GetLastError();
+    }
+
+    ::FindClose(find);
+    return ERROR_SUCCESS;
+}
+
+static int open_key()
+{
+    HKEY key;
+    auto status = ::RegOpenKeyExW(HKEY_CURRENT_USER, L"Software", 0, KEY_READ, &key);
+    if (status == ERROR_SUCCESS)
+    {
+        ::RegCloseKey(key);
+    }
+
+    return status;
+}
+
+static int load_library()
+{
+    // Already loaded, so this only measures finding it, which is the part that the Dynamic Library Fixup changes
+    auto module = ::LoadLibraryW(L"kernel32.dll");
+    if (!module)
+    {
+        return ::GetLastError();
+    }
+
+    ::FreeLibrary(module);
+    return ERROR_SUCCESS;
+}
+
+// Not intercepted by anything, but what the fixups match paths with, so it's measured here along with them
+static int compare_paths()
+{
+    static const std::wstring lhs = (psf::current_package_path() / LR"(VFS\ProgramFilesX64\Vendor\Application\Resources\Strings.dat)").native();
+    static const std::wstring rhs = [] { auto result = lhs; std::transform(result.begin(), result.end(), result.begin(), ::towupper); return result; }();
+    return (iwstring_view(lhs.data(), lhs.size()) == iwstring_view(rhs.data(), rhs.size())) ? ERROR_SUCCESS : ERROR_INVALID_DATA;
+}
+
+static int find_in_path()
+{
+    static const std::wstring path = (psf::current_package_path() / LR"(VFS\ProgramFilesX64\Vendor\Application\Resources\Strings.dat)").native();
+    return (iwstring_view(path.data(), path.size()).find(L".DAT"_isv) == path.size() - 4) ? ERROR_SUCCESS : ERROR_INVALID_DATA;
+}
+
+static int run(std::size_t iterations)
+{
+    int result = ERROR_SUCCESS;
+    auto check = [&](int testResult)
+    {
+        result = result ? result : testResult;
+    };
+
+    check(benchmark("CreateFileW (package file)", iterations, [] { return open_file(g_packageFilePath); }));
+    check(benchmark("CreateFileW (system file)", iterations, [] { return open_file(g_systemFilePath); }));
+    check(benchmark("GetFileAttributesW (package file)", iterations, [] { return get_attributes(g_packageFilePath); }));
+    check(benchmark("GetFileAttributesW (system file)", iterations, [] { return get_attributes(g_systemFilePath); }));
+    check(benchmark("FindFirstFileExW (package folder)", iterations, [] { return find_files(g_packageFindPattern); }));
+    check(benchmark("RegOpenKeyExW (HKCU\\Software)", iterations, [] { return open_key(); }));
+    check(benchmark("LoadLibraryW (loaded dll)", iterations, [] { return load_library(); }));
+    check(benchmark("iwstring_view compare (package path)", iterations, [] { return compare_paths(); }));
+    check(benchmark("iwstring_view find (package path)", iterations, [] { return find_in_path(); }));
+
+    return result;
+}
+
+int wmain(int argc, const wchar_t** argv)
+{
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/iterations", L"10000" },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    auto iterations = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/iterations"].c_str(), nullptr, 10));
+    if ((result == ERROR_SUCCESS) && (iterations == 0))
+    {
+        std::wcout << error_text() << "ERROR: /iterations must be a positive number\n";
+        result = ERROR_INVALID_PARAMETER;
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        test_initialize("Fixup Benchmarks", 9);
+
+        // Each configuration to measure - which fixups, and how many rules they have - runs the same executable under a
+        // name of its own, since that's what config.json matches processes by
+        trace_messages(L"Configuration: ", info_color, psf::current_executable_path().stem().native(), new_line);
+
+        auto packagePath = psf::current_package_path();
+        g_packageFilePath = packagePath / L"Benchmark.dat";
+        g_packageFindPattern = packagePath / L"*.dat";
+        g_systemFilePath = psf::known_folder(FOLDERID_System) / L"kernel32.dll";
+
+        StartCountingAllocations();
+        result = run(iterations);
+
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -0,0 +1,139 @@
+<#
+.DESCRIPTION
+    Generates the contents of a large package for the LargePackageBenchmark scenario, and adds them to the
+    architecture/configuration-specific FileMapping.txt files. Run this after building, and before running MakeAppx.ps1
+    for the scenario; it runs UpdateFileMappings.ps1 itself, so re-running that script afterwards drops the generated
+    files from the package again.
+
+    The files are spread evenly over folders that are all -Depth levels below "VFS\Common AppData\LargePackage", with
+    -FanOut sub-folders in each folder above them. Next to them, "CopyOnWrite\<size>" holds -CopyCount files of each of
+    the -CopySizes, for timing copy-on-write. The layout is written to LargePackage.txt at the root of the package, which
+    is how the benchmark finds out what to expect.
+
+.PARAMETER FileCount
+    The number of files to generate, between 1 and 500000
+
+.PARAMETER Depth
+    How many levels of folders the files are placed below
+
+.PARAMETER FanOut
+    The number of sub-folders of each folder above the last level
+
+.PARAMETER FilesPerFolder
+    The number of files in each folder of the last level
+
+.PARAMETER CopySizes
+    The sizes, in bytes, of the files used for timing copy-on-write
+
+.PARAMETER CopyCount
+    The number of files of each of the -CopySizes
+#>
+
+[CmdletBinding()]
+Param (
+    [Parameter(Mandatory=$False)]
+    [ValidateRange(1, 500000)]
+    [int]$FileCount = 10000,
+
+    [Parameter(Mandatory=$False)]
+    [ValidateRange(1, 32)]
+    [int]$Depth = 6,
+
+    [Parameter(Mandatory=$False)]
+    [ValidateRange(1, 64)]
+    [int]$FanOut = 8,
+
+    [Parameter(Mandatory=$False)]
+    [ValidateRange(1, 100000)]
+    [int]$FilesPerFolder = 100,
+
+    [Parameter(Mandatory=$False)]
+    [int[]]$CopySizes = @(4KB, 64KB, 1MB, 16MB),
+
+    [Parameter(Mandatory=$False)]
+    [ValidateRange(1, 100)]
+    [int]$CopyCount = 4
+)
+
+$name = "LargePackageBenchmark"
+$generatedRoot = "$PSScriptRoot\Generated"
+$vfsRoot = "VFS\Common AppData\LargePackage"
+
+$folderCount = [Math]::Ceiling($FileCount / $FilesPerFolder)
+if ($folderCount -gt [Math]::Pow($FanOut, $Depth))
+{
+    throw "ERROR: $FileCount files don't fit in $FanOut^$Depth folders of $FilesPerFolder files each"
+}
+
+# Start from scratch so that files of an earlier, larger, package don't linger
+if (Test-Path "$generatedRoot")
+{
+    Remove-Item -Recurse -Force "$generatedRoot"
+}
+
+$mappings = New-Object System.Collections.Generic.List[string]
+function AddFile($relativePath, $bytes)
+{
+    $path = "$generatedRoot\$relativePath"
+    [System.IO.Directory]::CreateDirectory([System.IO.Path]::GetDirectoryName($path)) | Out-Null
+    [System.IO.File]::WriteAllBytes($path, $bytes)
+    $mappings.Add("`"Generated\$relativePath`" `"$relativePath`"")
+}
+
+Write-Host -NoNewline "Generating "
+Write-Host -NoNewline -ForegroundColor Green $FileCount
+Write-Host " files..."
+
+$contents = [System.Text.Encoding]::ASCII.GetBytes("You are reading from the package path")
+for ($folder = 0; $folder -lt $folderCount; ++$folder)
+{
+    # Each folder's path spells out its index in base -FanOut, one digit per level
+    $folderPath = $vfsRoot
+    $remaining = $folder
+    $digits = New-Object string[] $Depth
+    for ($level = $Depth - 1; $level -ge 0; --$level)
+    {
+        $digits[$level] = "Dir" + ($remaining % $FanOut)
+        $remaining = [Math]::Floor($remaining / $FanOut)
+    }
+    $folderPath += "\" + ($digits -join "\")
+
+    $first = $folder * $FilesPerFolder
+    $last = [Math]::Min($first + $FilesPerFolder, $FileCount)
+    for ($file = $first; $file -lt $last; ++$file)
+    {
+        AddFile ("$folderPath\File{0:D6}.dat" -f $file) $contents
+    }
+}
+
+Write-Host "Generating copy-on-write files..."
+foreach ($size in $CopySizes)
+{
+    $bytes = New-Object byte[] $size
+    (New-Object System.Random 0).NextBytes($bytes)
+    for ($copy = 0; $copy -lt $CopyCount; ++$copy)
+    {
+        AddFile ("$vfsRoot\CopyOnWrite\$size\File{0:D2}.dat" -f $copy) $bytes
+    }
+}
+
+$layout = @(
+    "files=$FileCount",
+    "depth=$Depth",
+    "fanOut=$FanOut",
+    "filesPerFolder=$FilesPerFolder",
+    "copySizes=$($CopySizes -join ';')",
+    "copyCount=$CopyCount")
+AddFile "LargePackage.txt" ([System.Text.Encoding]::ASCII.GetBytes(($layout -join "`r`n") + "`r`n"))
+
+# Like the rest of the mappings, the generated ones are relative to the scenario's folder, which is where MakeAppx.ps1
+# runs makeappx from
+& "$PSScriptRoot\..\UpdateFileMappings.ps1" -Name "$PSScriptRoot"
+foreach ($target in @("x64Debug", "x64Release", "x86Debug", "x86Release"))
+{
+    Add-Content -Path "$PSScriptRoot\$target\FileMapping.txt" -Value $mappings
+}
+
+Write-Host -NoNewline "Added "
+Write-Host -NoNewline -ForegroundColor Green $mappings.Count
+Write-Host " files to the FileMapping.txt files of $name"
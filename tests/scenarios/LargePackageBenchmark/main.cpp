@@ -0,0 +1,395 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <fstream>
+#include <io.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <known_folders.h>
+#include <psf_runtime.h>
+
+#include <file_paths.h>
+#include <test_config.h>
+
+// What GeneratePackage.ps1 put in the package, as described by LargePackage.txt
+struct package_layout
+{
+    std::size_t files = 0;
+    std::size_t depth = 0;
+    std::size_t fan_out = 0;
+    std::size_t files_per_folder = 0;
+    std::vector<std::size_t> copy_sizes;
+    std::size_t copy_count = 0;
+};
+
+static package_layout g_layout;
+
+// The generated files are under 'Common AppData' in the package's VFS folder, so they're accessed through the native
+// ProgramData path, which is what the File Redirection Fixup maps to the package
+static std::filesystem::path g_rootPath;
+
+static std::int64_t timestamp()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+static double seconds(std::int64_t ticks)
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceFrequency(&value);
+    return static_cast<double>(ticks) / value.QuadPart;
+}
+
+static std::wstring format(double value, const wchar_t* units)
+{
+    wchar_t buffer[64];
+    swprintf_s(buffer, L"%.2f%ls", value, units);
+    return buffer;
+}
+
+static bool read_layout(const std::filesystem::path& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        auto separator = line.find('=');
+        if (separator == std::string::npos)
+        {
+            continue;
+        }
+
+        auto key = line.substr(0, separator);
+        auto value = line.substr(separator + 1);
+        if (key == "files")
+        {
+            g_layout.files = std::stoull(value);
+        }
+        else if (key == "depth")
+        {
+            g_layout.depth = std::stoull(value);
+        }
+        else if (key == "fanOut")
+        {
+            g_layout.fan_out = std::stoull(value);
+        }
+        else if (key == "filesPerFolder")
+        {
+            g_layout.files_per_folder = std::stoull(value);
+        }
+        else if (key == "copySizes")
+        {
+            for (std::size_t start = 0; start < value.length();)
+            {
+                auto end = std::min(value.find(';', start), value.length());
+                g_layout.copy_sizes.push_back(std::stoull(value.substr(start, end - start)));
+                start = end + 1;
+            }
+        }
+        else if (key == "copyCount")
+        {
+            g_layout.copy_count = std::stoull(value);
+        }
+    }
+
+    return (g_layout.files > 0) && (g_layout.depth > 0) && (g_layout.fan_out > 0) && (g_layout.files_per_folder > 0);
+}
+
+// The same path that GeneratePackage.ps1 gives the file with index 'index'
+static std::filesystem::path file_path(std::size_t index)
+{
+    std::vector<std::wstring> digits(g_layout.depth);
+    auto remaining = index / g_layout.files_per_folder;
+    for (auto itr = digits.rbegin(); itr != digits.rend(); ++itr)
+    {
+        *itr = L"Dir" + std::to_wstring(remaining % g_layout.fan_out);
+        remaining /= g_layout.fan_out;
+    }
+
+    auto result = g_rootPath;
+    for (auto& digit : digits)
+    {
+        result /= digit;
+    }
+
+    wchar_t fileName[32];
+    swprintf_s(fileName, L"File%06zu.dat", index);
+    return result / fileName;
+}
+
+static std::filesystem::path copy_path(std::size_t size, std::size_t index)
+{
+    wchar_t fileName[32];
+    swprintf_s(fileName, L"File%02zu.dat", index);
+    return g_rootPath / L"CopyOnWrite" / std::to_wstring(size) / fileName;
+}
+
+struct enumeration_counts
+{
+    std::size_t files = 0;
+    std::size_t directories = 0;
+};
+
+static int enumerate(const std::filesystem::path& path, enumeration_counts& counts)
+{
+    WIN32_FIND_DATAW data;
+    auto find = ::FindFirstFileW((path / L"*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return ::GetLastError();
+    }
+
+    int result = ERROR_SUCCESS;
+    do
+    {
+        if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+        {
+            ++counts.files;
+        }
+        else if ((std::wcscmp(data.cFileName, L".") != 0) && (std::wcscmp(data.cFileName, L"..") != 0))
+        {
+            ++counts.directories;
+            result = enumerate(path / data.cFileName, counts);
+        }
+    } while ((result == ERROR_SUCCESS) && ::FindNextFileW(find, &data));
+
+    if ((result == ERROR_SUCCESS) && (::GetLastError() != ERROR_NO_MORE_FILES))
+    {
+        result = ::GetLastError();
+    }
+
+    ::FindClose(find);
+    return result;
+}
+
+// Walks the whole of the generated tree and checks that every file was found, exactly once. The first walk builds the
+// fixup's listings of the package's folders; later ones are answered from them
+static int enumerate_test(const char* name)
+{
+    test_begin(name);
+
+    enumeration_counts counts;
+    auto start = timestamp();
+    auto result = enumerate(g_rootPath, counts);
+    auto elapsed = seconds(timestamp() - start);
+
+    auto expected = g_layout.files + g_layout.copy_sizes.size() * g_layout.copy_count;
+    if (result != ERROR_SUCCESS)
+    {
+        print_error(result, "Failed to enumerate the package");
+    }
+    else if (counts.files != expected)
+    {
+        trace_messages(error_color, L"ERROR: Expected ", error_info_color, std::to_wstring(expected), error_color,
+            L" files, but found ", error_info_color, std::to_wstring(counts.files), new_line);
+        result = ERROR_ASSERTION_FAILURE;
+    }
+    else
+    {
+        auto entries = counts.files + counts.directories;
+        trace_messages(
+            L"entries: ", info_color, std::to_wstring(entries), console::color::gray,
+            L"  total: ", info_color, format(elapsed * 1000, L"ms"), console::color::gray,
+            L"  per entry: ", info_color, format(elapsed * 1000000 / entries, L"us"), new_line);
+    }
+
+    test_end(result);
+    return result;
+}
+
+// Opens each of the files of one size for writing, which makes the fixup copy it out of the package first. Copies left
+// over from earlier runs are deleted beforehand, so that every open has to copy
+static int copy_on_write_test(std::size_t size)
+{
+    auto name = "Copy on write (" + std::to_string(size) + " bytes)";
+    test_begin(name);
+
+    clean_redirection_path();
+
+    int result = ERROR_SUCCESS;
+    auto start = timestamp();
+    for (std::size_t i = 0; (i < g_layout.copy_count) && (result == ERROR_SUCCESS); ++i)
+    {
+        auto path = copy_path(size, i);
+        auto file = ::CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            result = ::GetLastError();
+            print_error(result, ("Failed to open " + narrow(path.native()) + " for writing").c_str());
+            break;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!::GetFileSizeEx(file, &fileSize) || (static_cast<std::size_t>(fileSize.QuadPart) != size))
+        {
+            trace_messages(error_color, L"ERROR: The copy of ", error_info_color, path.native(), error_color, L" has the wrong size", new_line);
+            result = ERROR_ASSERTION_FAILURE;
+        }
+
+        ::CloseHandle(file);
+    }
+    auto elapsed = seconds(timestamp() - start);
+
+    if (result == ERROR_SUCCESS)
+    {
+        auto bytes = static_cast<double>(size) * g_layout.copy_count;
+        trace_messages(
+            L"per file: ", info_color, format(elapsed * 1000000 / g_layout.copy_count, L"us"), console::color::gray,
+            L"  throughput: ", info_color, format(bytes / (1024 * 1024) / elapsed, L"MB/s"), new_line);
+    }
+
+    test_end(result);
+    return result;
+}
+
+// Calls GetFileAttributesW on package files from 'threadCount' threads at once, 'iterations' calls between them, to see
+// whether the fixup's redirection decisions scale with the number of cores. The files are spread over the whole package,
+// and there are more of them than a thread's redirect cache holds, so most calls decide from scratch
+static int attributes_test(const std::vector<std::filesystem::path>& paths, std::size_t threadCount, std::size_t iterations, double& baseline)
+{
+    auto name = "GetFileAttributesW (" + std::to_string(threadCount) + " threads)";
+    test_begin(name);
+
+    auto startEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    std::atomic<int> result = ERROR_SUCCESS;
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < threadCount; ++i)
+    {
+        threads.emplace_back([&, i]
+        {
+            ::WaitForSingleObject(startEvent, INFINITE);
+
+            // Each thread starts in a different place, so that they don't all look at the same file at the same time
+            auto index = i * paths.size() / threadCount;
+            for (std::size_t call = 0; call < iterations / threadCount; ++call)
+            {
+                if (::GetFileAttributesW(paths[index].c_str()) == INVALID_FILE_ATTRIBUTES)
+                {
+                    int expected = ERROR_SUCCESS;
+                    result.compare_exchange_strong(expected, static_cast<int>(::GetLastError()));
+                    break;
+                }
+
+                index = (index + 1) % paths.size();
+            }
+        });
+    }
+
+    auto start = timestamp();
+    ::SetEvent(startEvent);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    auto elapsed = seconds(timestamp() - start);
+    ::CloseHandle(startEvent);
+
+    if (result == ERROR_SUCCESS)
+    {
+        auto callsPerSecond = (iterations / threadCount) * threadCount / elapsed;
+        if (threadCount == 1)
+        {
+            baseline = callsPerSecond;
+        }
+
+        trace_messages(
+            L"calls/s: ", info_color, format(callsPerSecond, L""), console::color::gray,
+            L"  per call: ", info_color, format(elapsed * 1000000000 * threadCount / iterations, L"ns"), console::color::gray,
+            L"  scaling: ", info_color, format(callsPerSecond / baseline, L"x"), new_line);
+    }
+    else
+    {
+        print_error(result, "GetFileAttributesW failed");
+    }
+
+    test_end(result);
+    return result;
+}
+
+int wmain(int argc, const wchar_t** argv)
+{
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/iterations", L"100000" },
+        { L"/threads", std::to_wstring(std::max(std::thread::hardware_concurrency(), 1u)) },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    auto iterations = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/iterations"].c_str(), nullptr, 10));
+    auto maxThreads = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/threads"].c_str(), nullptr, 10));
+    if ((result == ERROR_SUCCESS) && ((iterations == 0) || (maxThreads == 0)))
+    {
+        std::wcout << error_text() << "ERROR: /iterations and /threads must be positive numbers\n";
+        result = ERROR_INVALID_PARAMETER;
+    }
+
+    if ((result == ERROR_SUCCESS) && !read_layout(psf::current_package_path() / L"LargePackage.txt"))
+    {
+        std::wcout << error_text() << "ERROR: LargePackage.txt is missing or incomplete. Was the package made with GeneratePackage.ps1?\n";
+        result = ERROR_FILE_NOT_FOUND;
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        g_rootPath = psf::known_folder(FOLDERID_ProgramData) / L"LargePackage";
+
+        // Doubling the number of threads each time, and ending with all of them
+        std::vector<std::size_t> threadCounts;
+        for (std::size_t count = 1; count < maxThreads; count *= 2)
+        {
+            threadCounts.push_back(count);
+        }
+        threadCounts.push_back(maxThreads);
+
+        test_initialize("Large Package Benchmarks", static_cast<int>(2 + g_layout.copy_sizes.size() + threadCounts.size()));
+        trace_messages(L"Package files: ", info_color, std::to_wstring(g_layout.files), new_line);
+
+        auto check = [&](int testResult)
+        {
+            result = result ? result : testResult;
+        };
+
+        check(enumerate_test("FindFirstFileW/FindNextFileW (first walk)"));
+        check(enumerate_test("FindFirstFileW/FindNextFileW (second walk)"));
+
+        for (auto size : g_layout.copy_sizes)
+        {
+            check(copy_on_write_test(size));
+        }
+
+        // Paths are made up front so that the threads only measure the calls themselves
+        std::vector<std::filesystem::path> paths;
+        auto pathCount = std::min<std::size_t>(g_layout.files, 4096);
+        for (std::size_t i = 0; i < pathCount; ++i)
+        {
+            paths.push_back(file_path(i * g_layout.files / pathCount));
+        }
+
+        double baseline = 0;
+        for (auto count : threadCounts)
+        {
+            check(attributes_test(paths, count, iterations, baseline));
+        }
+
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -0,0 +1,191 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <string>
+
+#include <test_config.h>
+
+#include "paths.h"
+
+// The lengths, in characters, of the folders under the test path that each operation is timed in. The longest is short
+// of the 32k that Windows allows a path, since both the package path and the redirected path that the File Redirection
+// Fixup turns its paths into are longer than the test path that's in front of it
+static constexpr std::size_t g_benchmarkPathLengths[] = { 100, 1000, 8000, 30000 };
+static constexpr int g_benchmarkOperationCount = 4;
+
+// Components are capped at 255 characters, but otherwise the number of them doesn't matter to the fixup as much as the
+// length of the path does
+static constexpr std::size_t g_maxComponentLength = 200;
+
+static std::int64_t timestamp()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+static std::int64_t frequency()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceFrequency(&value);
+    return value.QuadPart;
+}
+
+static int win32_result(BOOL succeeded)
+{
+    return succeeded ? ERROR_SUCCESS : ::GetLastError();
+}
+
+// Creates - through the fixup, so in the redirected path - the folders that make up a path of 'length' characters under
+// the test path, along with the file that the operations that need one work with
+static int create_long_directory(std::size_t length, std::filesystem::path& result)
+{
+    // NOTE: The paths are well past MAX_PATH, so they have to be passed along with the "\\?\" prefix
+    result = LR"(\\?\)" + g_testPath.native();
+    std::size_t currentLength = 0;
+    for (std::size_t i = 0; currentLength < length; ++i)
+    {
+        auto component = std::to_wstring(i) + L"_";
+        component.resize(std::min(g_maxComponentLength, length - currentLength), L'x');
+        currentLength += component.length() + 1;
+
+        result /= component;
+        if (!::CreateDirectoryW(result.c_str(), nullptr) && (::GetLastError() != ERROR_ALREADY_EXISTS))
+        {
+            return trace_last_error(L"CreateDirectory failed");
+        }
+    }
+
+    if (!write_entire_file((result / L"file.txt").c_str(), g_expectedFileContents))
+    {
+        return trace_last_error(L"Failed to create the file to benchmark with");
+    }
+
+    return ERROR_SUCCESS;
+}
+
+// Calls 'operation' 'iterations' times, after a tenth as many to warm up, and reports how many it managed per second
+template <typename Func>
+static int benchmark(const std::string& name, std::size_t iterations, Func&& operation)
+{
+    test_begin(name);
+
+    int result = ERROR_SUCCESS;
+    for (std::size_t i = 0; (i < iterations / 10) && (result == ERROR_SUCCESS); ++i)
+    {
+        result = operation();
+    }
+
+    auto start = timestamp();
+    for (std::size_t i = 0; (i < iterations) && (result == ERROR_SUCCESS); ++i)
+    {
+        result = operation();
+    }
+    auto elapsed = timestamp() - start;
+
+    if (result == ERROR_SUCCESS)
+    {
+        auto seconds = static_cast<double>(elapsed) / frequency();
+        trace_messages(
+            L"ops/sec: ", info_color, std::to_wstring(static_cast<std::int64_t>(iterations / seconds)), console::color::gray,
+            L"  us/op: ", info_color, std::to_wstring(seconds * 1000000 / iterations), new_line);
+    }
+    else
+    {
+        trace_error(result, L"Benchmarked call failed");
+    }
+
+    test_end(result);
+    return result;
+}
+
+static int benchmark_path_length(std::size_t length, std::size_t iterations)
+{
+    std::filesystem::path directory;
+    auto result = create_long_directory(length, directory);
+    if (result != ERROR_SUCCESS)
+    {
+        // Still report each of the operations, so that the number of tests matches what was announced
+        for (int i = 0; i < g_benchmarkOperationCount; ++i)
+        {
+            test_begin("Long path setup (" + std::to_string(length) + " characters)");
+            test_end(result);
+        }
+        return result;
+    }
+
+    auto filePath = directory / L"file.txt";
+    auto newPath = directory / L"new.txt";
+    auto copyPath = directory / L"copy.txt";
+    auto findPattern = directory / L"*";
+    auto suffix = " (" + std::to_string(length) + " characters)";
+
+    auto check = [&](int testResult)
+    {
+        result = result ? result : testResult;
+    };
+
+    check(benchmark("CreateFile/DeleteFile" + suffix, iterations, [&]() -> int
+    {
+        auto file = ::CreateFileW(newPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return ::GetLastError();
+        }
+
+        ::CloseHandle(file);
+        return win32_result(::DeleteFileW(newPath.c_str()));
+    }));
+
+    check(benchmark("GetFileAttributes" + suffix, iterations, [&]() -> int
+    {
+        return win32_result(::GetFileAttributesW(filePath.c_str()) != INVALID_FILE_ATTRIBUTES);
+    }));
+
+    check(benchmark("CopyFile" + suffix, iterations, [&]() -> int
+    {
+        return win32_result(::CopyFileW(filePath.c_str(), copyPath.c_str(), false));
+    }));
+
+    check(benchmark("FindFirstFile/FindNextFile" + suffix, iterations, [&]() -> int
+    {
+        WIN32_FIND_DATAW data;
+        auto findHandle = ::FindFirstFileW(findPattern.c_str(), &data);
+        if (findHandle == INVALID_HANDLE_VALUE)
+        {
+            return ::GetLastError();
+        }
+
+        while (::FindNextFileW(findHandle, &data))
+        {
+        }
+
+        auto err = ::GetLastError();
+        ::FindClose(findHandle);
+        return (err == ERROR_NO_MORE_FILES) ? ERROR_SUCCESS : err;
+    }));
+
+    return result;
+}
+
+int LongPathsBenchmarkTestCount()
+{
+    return static_cast<int>(std::size(g_benchmarkPathLengths)) * g_benchmarkOperationCount;
+}
+
+int LongPathsBenchmark(std::size_t iterations)
+{
+    clean_redirection_path();
+
+    int result = ERROR_SUCCESS;
+    for (auto length : g_benchmarkPathLengths)
+    {
+        auto testResult = benchmark_path_length(length, iterations);
+        result = result ? result : testResult;
+    }
+
+    return result;
+}
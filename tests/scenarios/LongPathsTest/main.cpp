@@ -25,6 +25,10 @@ int CreateRemoveDirectoryTest();
 int CreateDeleteFileTest();
 int FileEnumerationTest();
 
+// Only run when asked for with "/benchmark:<iterations>", in place of the tests above
+int LongPathsBenchmarkTestCount();
+int LongPathsBenchmark(std::size_t iterations);
+
 int RunTests()
 {
     int result = ERROR_SUCCESS;
@@ -47,10 +51,23 @@ int RunTests()
 
 int wmain(int argc, const wchar_t** argv)
 {
-    auto result = parse_args(argc, argv);
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/benchmark", L"0" },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    auto benchmarkIterations = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/benchmark"].c_str(), nullptr, 10));
     if (result == ERROR_SUCCESS)
     {
-        test_initialize("Long Paths Tests", 4);
+        if (benchmarkIterations)
+        {
+            test_initialize("Long Paths Benchmarks", LongPathsBenchmarkTestCount());
+        }
+        else
+        {
+            test_initialize("Long Paths Tests", 4);
+        }
 
         // The whole purpose of this test is that the application should _think_ that it is accessing files with path
         // lengths that are less than MAX_PATH, when in reality it isn't. Validate that first since otherwise the remainder
@@ -69,7 +86,7 @@ int wmain(int argc, const wchar_t** argv)
             return ERROR_ASSERTION_FAILURE;
         }
 
-        result = RunTests();
+        result = benchmarkIterations ? LongPathsBenchmark(benchmarkIterations) : RunTests();
 
         test_cleanup();
     }
@@ -0,0 +1,268 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <io.h>
+#include <vector>
+
+#include <windows.h>
+#include <psapi.h>
+
+#include <known_folders.h>
+#include <psf_runtime.h>
+
+#include <test_config.h>
+
+static std::wstring kilobytes(std::uint64_t bytes)
+{
+    return std::to_wstring((bytes + 512) / 1024) + L"KB";
+}
+
+static std::vector<HMODULE> loaded_modules()
+{
+    std::vector<HMODULE> modules(256);
+    DWORD size = 0;
+    while (::K32EnumProcessModules(::GetCurrentProcess(), modules.data(), static_cast<DWORD>(modules.size() * sizeof(HMODULE)), &size) &&
+        (size > modules.size() * sizeof(HMODULE)))
+    {
+        modules.resize(size / sizeof(HMODULE));
+    }
+    modules.resize(size / sizeof(HMODULE));
+    return modules;
+}
+
+// Makes the calls that the fixups have state for, so that whatever they only set up on first use - caches, trace
+// buffers, etc. - is there when memory is measured
+static void warm_up()
+{
+    auto packageFile = psf::current_package_path() / L"AppxManifest.xml";
+    auto file = ::CreateFileW(packageFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(file);
+    }
+    ::GetFileAttributesW((psf::known_folder(FOLDERID_ProgramFilesX64) / L"Vendor\\Application.exe").c_str());
+
+    HKEY key;
+    if (::RegOpenKeyExW(HKEY_CURRENT_USER, L"Software", 0, KEY_READ, &key) == ERROR_SUCCESS)
+    {
+        ::RegCloseKey(key);
+    }
+
+    if (auto module = ::LoadLibraryW(L"kernel32.dll"))
+    {
+        ::FreeLibrary(module);
+    }
+}
+
+static int measure_process()
+{
+    test_begin("Process");
+
+    PROCESS_MEMORY_COUNTERS_EX counters = { sizeof(counters) };
+    int result = ERROR_SUCCESS;
+    if (::K32GetProcessMemoryInfo(::GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters)))
+    {
+        trace_messages(L"Private bytes: ", info_color, kilobytes(counters.PrivateUsage), console::color::gray,
+            L"  working set: ", info_color, kilobytes(counters.WorkingSetSize), console::color::gray,
+            L"  peak working set: ", info_color, kilobytes(counters.PeakWorkingSetSize), new_line);
+    }
+    else
+    {
+        result = print_last_error("Failed to query the memory of the process");
+    }
+
+    test_end(result);
+    return result;
+}
+
+// The blocks in use in all of the process's heaps. The PSF dlls link the CRT statically, but all of those CRTs
+// allocate from the process heap, so this is where the config DOM, the fixups' rules, caches, etc. all end up
+static int measure_heaps()
+{
+    test_begin("Heaps");
+
+    std::vector<HANDLE> heaps(::GetProcessHeaps(0, nullptr));
+    heaps.resize(::GetProcessHeaps(static_cast<DWORD>(heaps.size()), heaps.data()));
+
+    std::uint64_t used = 0;
+    std::uint64_t committed = 0;
+    std::uint64_t blocks = 0;
+    for (auto heap : heaps)
+    {
+        if (!::HeapLock(heap))
+        {
+            continue;
+        }
+
+        PROCESS_HEAP_ENTRY entry = {};
+        while (::HeapWalk(heap, &entry))
+        {
+            if (entry.wFlags & PROCESS_HEAP_ENTRY_BUSY)
+            {
+                used += entry.cbData;
+                ++blocks;
+            }
+            else if (entry.wFlags & PROCESS_HEAP_REGION)
+            {
+                committed += entry.Region.dwCommittedSize;
+            }
+        }
+        ::HeapUnlock(heap);
+    }
+
+    trace_messages(L"Heaps: ", info_color, std::to_wstring(heaps.size()), console::color::gray,
+        L"  in use: ", info_color, kilobytes(used), console::color::gray,
+        L"  blocks: ", info_color, std::to_wstring(blocks), console::color::gray,
+        L"  committed: ", info_color, kilobytes(committed), new_line);
+
+    test_end(ERROR_SUCCESS);
+    return ERROR_SUCCESS;
+}
+
+// The image of each module that isn't Windows' own: how much of it is in the working set, and how much of that is private
+// to this process, which is the globals that have been written to and the pages that had to be relocated
+static int measure_modules()
+{
+    test_begin("Modules");
+
+    SYSTEM_INFO systemInfo;
+    ::GetSystemInfo(&systemInfo);
+    auto pageSize = systemInfo.dwPageSize;
+
+    wchar_t windowsPath[MAX_PATH];
+    auto windowsLength = ::GetSystemWindowsDirectoryW(windowsPath, MAX_PATH);
+
+    int result = ERROR_SUCCESS;
+    std::uint64_t totalResident = 0;
+    std::uint64_t totalPrivate = 0;
+    for (auto module : loaded_modules())
+    {
+        wchar_t path[MAX_PATH];
+        if (!::GetModuleFileNameW(module, path, MAX_PATH) || ((windowsLength > 0) && (_wcsnicmp(path, windowsPath, windowsLength) == 0)))
+        {
+            continue;
+        }
+
+        MODULEINFO info;
+        if (!::K32GetModuleInformation(::GetCurrentProcess(), module, &info, sizeof(info)))
+        {
+            result = print_last_error("Failed to query a module");
+            continue;
+        }
+
+        std::vector<PSAPI_WORKING_SET_EX_INFORMATION> pages(info.SizeOfImage / pageSize);
+        for (std::size_t i = 0; i < pages.size(); ++i)
+        {
+            pages[i].VirtualAddress = static_cast<std::uint8_t*>(info.lpBaseOfDll) + i * pageSize;
+        }
+        if (!::K32QueryWorkingSetEx(::GetCurrentProcess(), pages.data(), static_cast<DWORD>(pages.size() * sizeof(pages[0]))))
+        {
+            result = print_last_error("Failed to query the working set of a module");
+            continue;
+        }
+
+        std::uint64_t resident = 0;
+        std::uint64_t privateBytes = 0;
+        for (auto& page : pages)
+        {
+            if (page.VirtualAttributes.Valid)
+            {
+                resident += pageSize;
+                privateBytes += page.VirtualAttributes.Shared ? 0 : pageSize;
+            }
+        }
+        totalResident += resident;
+        totalPrivate += privateBytes;
+
+        trace_messages(L"Module: ", info_color, std::filesystem::path(path).filename().native(), console::color::gray,
+            L"  image: ", info_color, kilobytes(info.SizeOfImage), console::color::gray,
+            L"  working set: ", info_color, kilobytes(resident), console::color::gray,
+            L"  private: ", info_color, kilobytes(privateBytes), new_line);
+    }
+
+    trace_messages(L"All modules", console::color::gray,
+        L"  working set: ", info_color, kilobytes(totalResident), console::color::gray,
+        L"  private: ", info_color, kilobytes(totalPrivate), new_line);
+
+    test_end(result);
+    return result;
+}
+
+// Detours puts the trampolines that call the original functions in executable memory of its own, near the modules
+// whose functions it detours. Nothing else in this process allocates executable memory, so that's what this finds
+static int measure_trampolines()
+{
+    test_begin("Detours trampolines");
+
+    std::uint64_t committed = 0;
+    std::uint64_t resident = 0;
+    std::size_t regions = 0;
+    MEMORY_BASIC_INFORMATION info;
+    for (auto address = static_cast<std::uint8_t*>(nullptr);
+        ::VirtualQuery(address, &info, sizeof(info)) == sizeof(info);
+        address = static_cast<std::uint8_t*>(info.BaseAddress) + info.RegionSize)
+    {
+        constexpr DWORD executable = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+        if ((info.State != MEM_COMMIT) || (info.Type != MEM_PRIVATE) || !(info.Protect & executable))
+        {
+            continue;
+        }
+
+        ++regions;
+        committed += info.RegionSize;
+
+        PSAPI_WORKING_SET_EX_INFORMATION page = {};
+        page.VirtualAddress = info.BaseAddress;
+        if (::K32QueryWorkingSetEx(::GetCurrentProcess(), &page, sizeof(page)) && page.VirtualAttributes.Valid)
+        {
+            resident += info.RegionSize;
+        }
+    }
+
+    trace_messages(L"Regions: ", info_color, std::to_wstring(regions), console::color::gray,
+        L"  committed: ", info_color, kilobytes(committed), console::color::gray,
+        L"  working set: ", info_color, kilobytes(resident), new_line);
+
+    test_end(ERROR_SUCCESS);
+    return ERROR_SUCCESS;
+}
+
+int wmain(int argc, const wchar_t** argv)
+{
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    auto result = parse_args(argc, argv);
+    if (result == ERROR_SUCCESS)
+    {
+        test_initialize("Memory Benchmarks", 4);
+
+        // Each configuration to measure runs the same executable under a name of its own, since that's what config.json
+        // matches processes by
+        trace_messages(L"Configuration: ", info_color, psf::current_executable_path().stem().native(), new_line);
+
+        warm_up();
+
+        // The process as a whole goes first, before measuring the rest allocates anything
+        auto check = [&](int testResult)
+        {
+            result = result ? result : testResult;
+        };
+        check(measure_process());
+        check(measure_heaps());
+        check(measure_modules());
+        check(measure_trampolines());
+
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -0,0 +1,446 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Checks that compiled_pattern, which the fixups match their configured patterns with, agrees with std::regex_match on
+// every pattern in every configuration that it's given, for inputs made up from the pattern itself and from the rest of
+// the configuration, and reports how much faster it is. Unlike the other scenarios, it isn't packaged, since it only
+// looks at configuration files.
+
+#include <algorithm>
+#include <cwctype>
+#include <fcntl.h>
+#include <filesystem>
+#include <io.h>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include <compiled_pattern.h>
+#include <rapidjson/document.h>
+#include <rapidjson/encodedstream.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/filereadstream.h>
+
+#include <test_config.h>
+
+struct config_pattern
+{
+    std::wstring pattern;
+    std::string location; // As a JSON pointer, e.g. "/processes/1/fixups/0/config/redirectedPaths/packageRelative/0/patterns/2"
+};
+
+struct config_strings
+{
+    std::vector<config_pattern> patterns;
+    std::set<std::wstring> values;
+};
+
+// Keeps the timed calls from being optimized away
+static volatile std::size_t g_matchCount = 0;
+
+static std::int64_t timestamp()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+// Patterns are the "patterns" of any fixup's configuration and the "executable" of each process configuration. Every
+// other string is kept as an input to match them against, since configurations tend to name the files and keys that
+// their patterns are meant for
+static void collect_strings(const rapidjson::Value& value, const std::string& location, bool isPattern, config_strings& result)
+{
+    if (value.IsObject())
+    {
+        for (auto& member : value.GetObject())
+        {
+            std::string name(member.name.GetString(), member.name.GetStringLength());
+            bool memberIsPattern = (name == "patterns") ||
+                ((name == "executable") && (location.compare(0, 11, "/processes/") == 0) && (location.find('/', 11) == std::string::npos));
+            collect_strings(member.value, location + "/" + name, memberIsPattern, result);
+        }
+    }
+    else if (value.IsArray())
+    {
+        for (rapidjson::SizeType i = 0; i < value.Size(); ++i)
+        {
+            collect_strings(value[i], location + "/" + std::to_string(i), isPattern, result);
+        }
+    }
+    else if (value.IsString())
+    {
+        auto str = widen(std::string_view(value.GetString(), value.GetStringLength()));
+        if (isPattern)
+        {
+            result.patterns.push_back(config_pattern{ std::move(str), location });
+        }
+        else
+        {
+            result.values.insert(std::move(str));
+        }
+    }
+}
+
+// What 'pattern' looks like spelled out, with each ".*" replaced by 'filler': its escapes and anchors removed, any other
+// wildcard replaced by a character that it matches, and only the first of any alternatives kept. Close to what the
+// pattern matches, which is where the two engines are most likely to disagree
+static std::wstring spell_out(std::wstring_view pattern, std::wstring_view filler)
+{
+    std::wstring result;
+    for (std::size_t i = 0; i < pattern.length(); ++i)
+    {
+        auto ch = pattern[i];
+        switch (ch)
+        {
+        case L'\\':
+            if (++i < pattern.length())
+            {
+                result.push_back(pattern[i]);
+            }
+            break;
+
+        case L'.':
+            if ((i + 1 < pattern.length()) && (pattern[i + 1] == L'*'))
+            {
+                result += filler;
+                ++i;
+            }
+            else
+            {
+                result.push_back(L'q');
+            }
+            break;
+
+        case L'[':
+            if ((i + 1 < pattern.length()) && (pattern[i + 1] != L'^'))
+            {
+                result.push_back(pattern[i + 1]);
+            }
+            i = std::min(pattern.find(L']', i + 1), pattern.length());
+            break;
+
+        case L'|':
+            return result;
+
+        case L'^': case L'$': case L'(': case L')': case L'*': case L'+': case L'?':
+            break;
+
+        case L'{':
+            i = std::min(pattern.find(L'}', i), pattern.length());
+            break;
+
+        default:
+            result.push_back(ch);
+            break;
+        }
+    }
+
+    return result;
+}
+
+static std::vector<std::wstring> make_corpus(std::wstring_view pattern, const std::set<std::wstring>& values)
+{
+    std::set<std::wstring> result(values.begin(), values.end());
+    for (auto input : { L"", L"a", L".", L"\\", L"/", L"*", L"$", L"..", L"foo.txt", L"FOO.TXT", L"log", L"logs\\app.log",
+        L"Data\\Settings.ini", L"a.b.c", L"PsfLauncher32", L"PrimaryApp", L"SOFTWARE\\Vendor\\Application",
+        L"VFS\\ProgramFilesX64\\Vendor\\app.exe" })
+    {
+        result.insert(input);
+    }
+
+    for (auto filler : { L"", L"x", L"xyz\\", L"...", L"a\\b.c" })
+    {
+        auto base = spell_out(pattern, filler);
+        std::wstring upper = base;
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::towupper);
+        std::wstring slashes = base;
+        std::replace(slashes.begin(), slashes.end(), L'\\', L'/');
+
+        result.insert(base);
+        result.insert(upper);
+        result.insert(slashes);
+        result.insert(base + L"x");
+        result.insert(L"x" + base);
+        result.insert(base + L"\\x");
+        result.insert(L"x\\" + base);
+        if (!base.empty())
+        {
+            result.insert(base.substr(1));
+            result.insert(base.substr(0, base.length() - 1));
+        }
+    }
+
+    return { result.begin(), result.end() };
+}
+
+struct match_timings
+{
+    std::int64_t compiled = 0;
+    std::int64_t regex = 0;
+};
+
+static match_timings time_matches(const compiled_pattern& compiled, const std::wregex& regex, const std::vector<std::wstring>& corpus, std::size_t iterations)
+{
+    std::size_t count = 0;
+    match_timings result;
+    auto start = timestamp();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        for (auto& input : corpus)
+        {
+            count += compiled.match(input) ? 1 : 0;
+        }
+    }
+    result.compiled = timestamp() - start;
+
+    start = timestamp();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        for (auto& input : corpus)
+        {
+            count += std::regex_match(input, regex) ? 1 : 0;
+        }
+    }
+    result.regex = timestamp() - start;
+
+    g_matchCount = g_matchCount + count;
+    return result;
+}
+
+static const wchar_t* kind_name(pattern_kind kind)
+{
+    switch (kind)
+    {
+    case pattern_kind::match_all: return L"match_all";
+    case pattern_kind::literal: return L"literal";
+    case pattern_kind::literal_prefix: return L"literal_prefix";
+    case pattern_kind::literal_suffix: return L"literal_suffix";
+    case pattern_kind::dfa: return L"dfa";
+    case pattern_kind::regex: return L"regex";
+    }
+    return L"unknown";
+}
+
+// The number of disagreements, or -1 if only one of the two rejected the pattern
+static int check_pattern(const config_pattern& pattern, const std::set<std::wstring>& values, std::size_t iterations)
+{
+    compiled_pattern compiled;
+    std::wregex regex;
+    bool compiledValid = true;
+    bool regexValid = true;
+    try
+    {
+        compiled.assign(pattern.pattern.c_str(), pattern.pattern.length());
+    }
+    catch (std::regex_error&)
+    {
+        compiledValid = false;
+    }
+
+    try
+    {
+        regex.assign(pattern.pattern);
+    }
+    catch (std::regex_error&)
+    {
+        regexValid = false;
+    }
+
+    if (compiledValid != regexValid)
+    {
+        trace_messages(error_color, L"Only ", compiledValid ? L"std::regex" : L"compiled_pattern", L" rejects ",
+            error_info_color, pattern.pattern, error_color, L" at ", error_info_color, widen(pattern.location), new_line);
+        return -1;
+    }
+    else if (!regexValid)
+    {
+        trace_messages(warning_color, L"Both reject ", warning_info_color, pattern.pattern, new_line);
+        return 0;
+    }
+
+    auto corpus = make_corpus(pattern.pattern, values);
+    int disagreements = 0;
+    for (auto& input : corpus)
+    {
+        bool expected = std::regex_match(input, regex);
+        if (compiled.match(input) != expected)
+        {
+            ++disagreements;
+            trace_messages(error_color, L"Disagreement: ", error_info_color, pattern.pattern, error_color,
+                expected ? L" matches \"" : L" doesn't match \"", error_info_color, input, error_color,
+                L"\" but compiled_pattern (", kind_name(compiled.kind), L") says otherwise, at ", error_info_color,
+                widen(pattern.location), new_line);
+        }
+    }
+
+    if (disagreements == 0)
+    {
+        auto timings = time_matches(compiled, regex, corpus, iterations);
+        auto speedup = static_cast<double>(timings.regex) / std::max<std::int64_t>(timings.compiled, 1);
+        std::wostringstream speedupText;
+        speedupText.precision(1);
+        speedupText << std::fixed << speedup << L"x";
+        trace_messages(L"Pattern: ", info_color, pattern.pattern, console::color::gray,
+            L"  kind: ", info_color, kind_name(compiled.kind), console::color::gray,
+            L"  inputs: ", info_color, std::to_wstring(corpus.size()), console::color::gray,
+            L"  speedup: ", info_color, speedupText.str(), new_line);
+    }
+
+    return disagreements;
+}
+
+static int check_patterns(const config_strings& strings, std::size_t iterations)
+{
+    int result = ERROR_SUCCESS;
+    std::set<std::wstring> checked;
+    for (auto& pattern : strings.patterns)
+    {
+        if (checked.insert(pattern.pattern).second && (check_pattern(pattern, strings.values, iterations) != 0))
+        {
+            result = ERROR_ASSERTION_FAILURE;
+        }
+    }
+
+    return result;
+}
+
+// Patterns that no configuration here uses, but that are close to the shapes that compiled_pattern recognizes, and so
+// are the most likely to be mistaken for one of them
+static int check_edge_cases(std::size_t iterations)
+{
+    test_begin("Edge cases");
+
+    config_strings strings;
+    for (auto pattern : { LR"(^.*$)", LR"(.*.*)", LR"(.*\..*)", LR"(.*\.log$)", LR"(.*\$)", LR"(Foo\$)", LR"(Foo\\$)", LR"(Foo\\\$)",
+        LR"(\.*)", LR"(Foo\\.*)", LR"(Foo\d)", LR"(Foo\n)", LR"(Foo\\)", LR"(.*Foo.*)", LR"(Foo.*Bar)", LR"(Foo|Bar)",
+        LR"(Fo+)", LR"([Ff]oo)", LR"(Foo.)", LR"(.*\\)", LR"(\^Foo)", LR"(Foo\.*.*)", LR"(.*?)", LR"(.+)", LR"(\w+\.exe)",
+        LR"(.*\.(exe|dll))", LR"(Logs\\[^\\]+\.txt)", LR"([a-z-]+)", LR"((?:Foo)+?Bar)", LR"(Fo{2,3})", LR"(F(o|)*)",
+        LR"([^]Foo)", LR"([\]]Foo)", LR"(Foo{,2})", LR"((?=F)Foo)", LR"(\bFoo)" })
+    {
+        strings.patterns.push_back(config_pattern{ pattern, "(edge case)" });
+    }
+
+    auto result = check_patterns(strings, iterations);
+    test_end(result);
+    return result;
+}
+
+static int check_config(const std::filesystem::path& path, std::size_t iterations)
+{
+    auto name = narrow(path.parent_path().filename().native());
+    test_begin(name.c_str());
+
+    // Read the same way as the PSF Runtime reads config.json, so that both accept the same files
+    int result = ERROR_SUCCESS;
+    rapidjson::Document document;
+#pragma warning(suppress:4996) // Nonsense warning; _wfopen is perfectly safe
+    auto file = _wfopen(path.c_str(), L"rb");
+    if (file)
+    {
+        char buffer[2048];
+        rapidjson::FileReadStream stream(file, buffer, std::size(buffer));
+        rapidjson::AutoUTFInputStream<char32_t, rapidjson::FileReadStream> autoStream(stream);
+        document.ParseStream<rapidjson::kParseDefaultFlags, rapidjson::AutoUTF<char32_t>>(autoStream);
+        fclose(file);
+    }
+
+    if (!file)
+    {
+        result = print_error(ERROR_FILE_NOT_FOUND, "Could not read the configuration");
+    }
+    else if (document.HasParseError())
+    {
+        trace_messages(error_color, L"Could not parse ", error_info_color, path.native(), error_color, L": ",
+            error_info_color, widen(rapidjson::GetParseError_En(document.GetParseError())), new_line);
+        result = ERROR_INVALID_DATA;
+    }
+    else
+    {
+        config_strings strings;
+        collect_strings(document, "", false, strings);
+        trace_messages(L"Configuration: ", info_color, path.native(), console::color::gray,
+            L"  patterns: ", info_color, std::to_wstring(strings.patterns.size()), new_line);
+        result = check_patterns(strings, iterations);
+    }
+
+    test_end(result);
+    return result;
+}
+
+// Each of 'paths' is either a configuration file, or a folder whose own config.json, and those of the folders below it,
+// are checked. Anything else in the folders is left alone
+static std::vector<std::filesystem::path> find_configs(const std::wstring& paths)
+{
+    std::vector<std::filesystem::path> result;
+    std::wistringstream stream(paths);
+    std::wstring path;
+    while (std::getline(stream, path, L';'))
+    {
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(path, ec))
+        {
+            result.push_back(path);
+            continue;
+        }
+
+        for (auto itr = std::filesystem::recursive_directory_iterator(path, ec); !ec && (itr != std::filesystem::recursive_directory_iterator()); itr.increment(ec))
+        {
+            if (itr->is_regular_file() && (_wcsicmp(itr->path().filename().c_str(), L"config.json") == 0))
+            {
+                result.push_back(itr->path());
+            }
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+int wmain(int argc, const wchar_t** argv)
+{
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    // Built to tests\<platform>\<configuration>, so by default this is the scenarios' and the samples' configurations
+    wchar_t modulePath[MAX_PATH];
+    ::GetModuleFileNameW(nullptr, modulePath, MAX_PATH);
+    auto testsPath = std::filesystem::path(modulePath).parent_path().parent_path().parent_path();
+
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/configs", (testsPath / L"scenarios").native() + L";" + (testsPath.parent_path() / L"samples").native() },
+        { L"/iterations", L"100" },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    auto iterations = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/iterations"].c_str(), nullptr, 10));
+    if ((result == ERROR_SUCCESS) && (iterations == 0))
+    {
+        std::wcout << error_text() << "ERROR: /iterations must be a positive number\n";
+        result = ERROR_INVALID_PARAMETER;
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        auto configs = find_configs(allowedArgs[L"/configs"]);
+        test_initialize("Pattern Match Tests", static_cast<std::int32_t>(configs.size() + 1));
+
+        result = check_edge_cases(iterations);
+        for (auto& config : configs)
+        {
+            auto configResult = check_config(config, iterations);
+            result = result ? result : configResult;
+        }
+
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -0,0 +1,188 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <io.h>
+#include <vector>
+
+#include <known_folders.h>
+#include <psf_constants.h>
+#include <psf_runtime.h>
+
+#include <test_config.h>
+
+#ifdef _M_IX86
+constexpr wchar_t package_child[] = L"SpawnBenchmark32.exe";
+constexpr wchar_t cross_package_child[] = L"SpawnBenchmark64.exe";
+constexpr char architecture[] = "x86";
+#else
+constexpr wchar_t package_child[] = L"SpawnBenchmark64.exe";
+constexpr wchar_t cross_package_child[] = L"SpawnBenchmark32.exe";
+constexpr char architecture[] = "x64";
+#endif
+
+static std::int64_t timestamp()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+static std::int64_t microseconds(std::int64_t ticks)
+{
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    return ticks * 1000000 / frequency.QuadPart;
+}
+
+// Out of package children are cmd.exe, which exits again right away. A 32-bit process reaches the 64-bit one through
+// Sysnative, since System32 is redirected to SysWOW64 for it
+static std::filesystem::path system_child(bool crossArchitecture)
+{
+    auto windows = psf::known_folder(FOLDERID_Windows);
+#ifdef _M_IX86
+    return windows / (crossArchitecture ? L"Sysnative" : L"SysWOW64") / L"cmd.exe";
+#else
+    return windows / (crossArchitecture ? L"SysWOW64" : L"System32") / L"cmd.exe";
+#endif
+}
+
+// Starts 'path' 'spawns' times, one after the other, and times each from CreateProcessW until the child has exited
+static int benchmark(const char* name, const std::filesystem::path& path, const wchar_t* arguments, int spawns,
+    const std::string& prefix, std::ofstream& output)
+{
+    test_begin(name);
+
+    std::vector<std::int64_t> samples;
+    int result = ERROR_SUCCESS;
+    for (int i = 0; (i < spawns) && (result == ERROR_SUCCESS); ++i)
+    {
+        auto commandLine = L"\"" + path.native() + L"\" " + arguments;
+        STARTUPINFOW startupInfo = { sizeof(startupInfo) };
+        PROCESS_INFORMATION processInfo;
+
+        auto start = timestamp();
+        if (!::CreateProcessW(path.c_str(), commandLine.data(), nullptr, nullptr, false, CREATE_NO_WINDOW, nullptr, nullptr, &startupInfo, &processInfo))
+        {
+            result = trace_last_error(L"CreateProcessW failed");
+            break;
+        }
+
+        ::WaitForSingleObject(processInfo.hProcess, INFINITE);
+        samples.push_back(timestamp() - start);
+
+        DWORD exitCode;
+        if (::GetExitCodeProcess(processInfo.hProcess, &exitCode) && (exitCode != 0))
+        {
+            trace_messages(error_color, L"ERROR: The child exited with ", error_info_color, std::to_wstring(exitCode), new_line);
+            result = static_cast<int>(exitCode);
+        }
+
+        ::CloseHandle(processInfo.hThread);
+        ::CloseHandle(processInfo.hProcess);
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        std::int64_t total = 0;
+        for (auto sample : samples)
+        {
+            total += sample;
+        }
+        std::sort(samples.begin(), samples.end());
+
+        auto mean = microseconds(total / spawns);
+        auto p50 = microseconds(samples[samples.size() / 2]);
+        auto p90 = microseconds(samples[(samples.size() - 1) * 90 / 100]);
+        auto max = microseconds(samples.back());
+        trace_messages(L"Per spawn: mean ", info_color, std::to_wstring(mean) + L"us", console::color::gray,
+            L", p50 ", info_color, std::to_wstring(p50) + L"us", console::color::gray,
+            L", p90 ", info_color, std::to_wstring(p90) + L"us", console::color::gray,
+            L", max ", info_color, std::to_wstring(max) + L"us", new_line);
+
+        output << prefix << "," << name << "," << spawns << "," << mean << "," << p50 << "," << p90 << "," << max << "\n";
+    }
+
+    test_end(result);
+    return result;
+}
+
+int wmain(int argc, const wchar_t** argv)
+{
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/child", L"false" },
+        { L"/spawns", L"100" },
+        { L"/output", L"" },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    if (allowedArgs[L"/child"] == L"true")
+    {
+        // Only the cost of starting the process, and of whatever was injected into it, is of interest
+        return result;
+    }
+
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    auto spawns = std::wcstol(allowedArgs[L"/spawns"].c_str(), nullptr, 10);
+    if ((result == ERROR_SUCCESS) && (spawns <= 0))
+    {
+        std::wcout << error_text() << "ERROR: /spawns must be a positive number\n";
+        result = ERROR_INVALID_PARAMETER;
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        test_initialize("Spawn Benchmarks", 4);
+
+        // Without the PSF Runtime, CreateProcessW isn't hooked, which is the baseline that the fixed runs compare to
+        auto hooked = ::GetModuleHandleW(psf::runtime_dll_name) != nullptr;
+        trace_messages(L"CreateProcessW: ", info_color, hooked ? L"hooked by the PSF Runtime" : L"not hooked", new_line);
+
+        std::filesystem::path outputPath = allowedArgs[L"/output"];
+        if (outputPath.empty())
+        {
+            outputPath = std::filesystem::temp_directory_path() / L"SpawnBenchmark.csv";
+        }
+
+        auto exists = std::filesystem::exists(outputPath);
+        std::ofstream output(outputPath, std::ios::app);
+        if (!exists)
+        {
+            output << "date,parent,hooked,child,spawns,mean_us,p50_us,p90_us,max_us\n";
+        }
+        trace_messages(L"Results: ", info_color, outputPath.native(), new_line);
+
+        SYSTEMTIME now;
+        ::GetSystemTime(&now);
+        char prefix[64];
+        std::snprintf(prefix, std::size(prefix), "%04u-%02u-%02uT%02u:%02u:%02uZ,%s,%s", now.wYear, now.wMonth, now.wDay,
+            now.wHour, now.wMinute, now.wSecond, architecture, hooked ? "true" : "false");
+
+        auto packagePath = psf::current_package_path();
+        auto check = [&](int testResult)
+        {
+            result = result ? result : testResult;
+        };
+        check(benchmark("In package, same architecture", packagePath / package_child, L"/child:true", spawns, prefix, output));
+        check(benchmark("In package, cross architecture", packagePath / cross_package_child, L"/child:true", spawns, prefix, output));
+        check(benchmark("Out of package, same architecture", system_child(false), L"/c exit 0", spawns, prefix, output));
+        check(benchmark("Out of package, cross architecture", system_child(true), L"/c exit 0", spawns, prefix, output));
+
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -0,0 +1,167 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <fcntl.h>
+#include <io.h>
+#include <vector>
+
+#include <psf_runtime.h>
+
+#include <test_config.h>
+
+static std::filesystem::path g_packageFilePath;
+
+static std::int64_t timestamp()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+static std::int64_t frequency()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceFrequency(&value);
+    return value.QuadPart;
+}
+
+static std::wstring nanoseconds(double ticks)
+{
+    return std::to_wstring(static_cast<std::int64_t>(ticks * 1000000000 / frequency())) + L"ns";
+}
+
+// Times each of 'iterations' calls to 'operation' on its own, after a tenth as many to warm up. The test fails if any
+// call does
+template <typename Func>
+static int benchmark(const char* name, std::size_t iterations, Func&& operation)
+{
+    test_begin(name);
+
+    int result = ERROR_SUCCESS;
+    for (std::size_t i = 0; (i < iterations / 10) && (result == ERROR_SUCCESS); ++i)
+    {
+        result = operation();
+    }
+
+    std::vector<std::int64_t> samples(iterations);
+    for (std::size_t i = 0; (i < iterations) && (result == ERROR_SUCCESS); ++i)
+    {
+        auto start = timestamp();
+        result = operation();
+        samples[i] = timestamp() - start;
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        for (auto sample : samples)
+        {
+            total += static_cast<double>(sample);
+        }
+
+        auto percentile = [&](std::size_t percent)
+        {
+            return nanoseconds(static_cast<double>(samples[(samples.size() - 1) * percent / 100]));
+        };
+
+        trace_messages(
+            L"ns/op: ", info_color, nanoseconds(total / iterations), console::color::gray,
+            L"  p50: ", info_color, percentile(50), console::color::gray,
+            L"  p90: ", info_color, percentile(90), console::color::gray,
+            L"  p99: ", info_color, percentile(99), console::color::gray,
+            L"  max: ", info_color, nanoseconds(static_cast<double>(samples.back())), new_line);
+    }
+    else
+    {
+        print_error(result, "Benchmarked call failed");
+    }
+
+    test_end(result);
+    return result;
+}
+
+// What the stacked copies of the Composition Test Fixup intercept. None of them change this text - they only fix the
+// message that CompositionTest sends - so each one adds nothing but its hop along the chain
+static int convert_text()
+{
+    constexpr char text[] = "This text is left as it is";
+    wchar_t buffer[64];
+    auto size = ::MultiByteToWideChar(CP_ACP, 0, text, static_cast<int>(std::size(text) - 1), buffer, static_cast<int>(std::size(buffer)));
+    return (size == static_cast<int>(std::size(text) - 1)) ? ERROR_SUCCESS : ERROR_INVALID_DATA;
+}
+
+static int open_file(const std::filesystem::path& path)
+{
+    auto file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return ::GetLastError();
+    }
+
+    ::CloseHandle(file);
+    return ERROR_SUCCESS;
+}
+
+static int get_attributes(const std::filesystem::path& path)
+{
+    return (::GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES) ? ERROR_SUCCESS : ::GetLastError();
+}
+
+static int run(std::size_t iterations)
+{
+    int result = ERROR_SUCCESS;
+    auto check = [&](int testResult)
+    {
+        result = result ? result : testResult;
+    };
+
+    check(benchmark("MultiByteToWideChar", iterations, [] { return convert_text(); }));
+    check(benchmark("CreateFileW (package file)", iterations, [] { return open_file(g_packageFilePath); }));
+    check(benchmark("GetFileAttributesW (package file)", iterations, [] { return get_attributes(g_packageFilePath); }));
+
+    return result;
+}
+
+int wmain(int argc, const wchar_t** argv)
+{
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/iterations", L"10000" },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    auto iterations = static_cast<std::size_t>(std::wcstoul(allowedArgs[L"/iterations"].c_str(), nullptr, 10));
+    if ((result == ERROR_SUCCESS) && (iterations == 0))
+    {
+        std::wcout << error_text() << "ERROR: /iterations must be a positive number\n";
+        result = ERROR_INVALID_PARAMETER;
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        test_initialize("Stacking Benchmarks", 3);
+
+        // Each configuration to measure - which fixups are stacked, and how many - runs the same executable under a name
+        // of its own, since that's what config.json matches processes by
+        trace_messages(L"Configuration: ", info_color, psf::current_executable_path().stem().native(), new_line);
+
+        g_packageFilePath = psf::current_package_path() / L"Benchmark.dat";
+        result = run(iterations);
+
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -0,0 +1,283 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <io.h>
+#include <sstream>
+#include <vector>
+
+#include <known_folders.h>
+#include <psf_constants.h>
+#include <psf_runtime.h>
+
+#include <test_config.h>
+
+// The same executable is packaged twice: as StartupBenchmark.exe, which launches PsfLauncher over and over, and as
+// StartupBenchmarkApp.exe, the application that PsfLauncher then starts, which writes down how long that took
+static constexpr wchar_t app_executable_name[] = L"StartupBenchmarkApp";
+
+// Each launch's timings, in microseconds, in the order written to the results
+static constexpr const char* timing_names[] =
+{
+    "launcher",         // PsfLauncher's wWinMain until it created the application's process
+    "injection",        // Creating the process, injecting the PSF Runtime, and loading it
+    "config_read",
+    "config_parse",
+    "runtime_attach",
+    "fixup_load",       // LoadLibrary and PSFPreInitialize of all fixups
+    "fixup_initialize", // PSFInitialize and the transaction commits of all fixups
+    "fixups",           // All of the above for fixups, along with the work in between
+    "entry",            // The PSF Runtime handing over to the application until its wmain runs
+    "total",            // PsfLauncher's wWinMain until the application's wmain
+};
+static constexpr std::size_t timing_count = std::size(timing_names);
+
+static std::int64_t timestamp()
+{
+    LARGE_INTEGER value;
+    ::QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+static int record_startup(const std::wstring& resultsPath)
+{
+    auto entry = timestamp();
+
+    // Looked up rather than imported, so that the executable also runs without the PSF Runtime
+    using PSFQueryStartupTimings_t = const psf::startup_timings*(__stdcall*)();
+#if _M_IX86
+    constexpr char queryName[] = "_PSFQueryStartupTimings@0";
+#else
+    constexpr char queryName[] = "PSFQueryStartupTimings";
+#endif
+    auto runtime = ::GetModuleHandleW(psf::runtime_dll_name);
+    auto query = runtime ? reinterpret_cast<PSFQueryStartupTimings_t>(::GetProcAddress(runtime, queryName)) : nullptr;
+    auto timings = query ? query() : nullptr;
+    if (!timings || !timings->launcher_start)
+    {
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    auto microseconds = [&](std::int64_t start, std::int64_t end)
+    {
+        return (end > start) ? (end - start) * 1000000 / timings->frequency : 0;
+    };
+
+    std::int64_t fixupLoad = 0;
+    std::int64_t fixupInitialize = 0;
+    for (unsigned i = 0; i < timings->fixup_count; ++i)
+    {
+        auto& fixup = timings->fixup_timings[i];
+        fixupLoad += microseconds(fixup.load.start, fixup.load.end) + microseconds(fixup.pre_initialize.start, fixup.pre_initialize.end);
+        fixupInitialize += microseconds(fixup.initialize.start, fixup.initialize.end) + microseconds(fixup.commit.start, fixup.commit.end);
+    }
+
+    const std::int64_t values[timing_count] =
+    {
+        microseconds(timings->launcher_start, timings->launcher_create_process),
+        microseconds(timings->launcher_create_process, timings->config_read.start),
+        microseconds(timings->config_read.start, timings->config_read.end),
+        microseconds(timings->config_parse.start, timings->config_parse.end),
+        microseconds(timings->runtime_attach.start, timings->runtime_attach.end),
+        fixupLoad,
+        fixupInitialize,
+        microseconds(timings->fixups.start, timings->fixups.end),
+        microseconds(timings->fixups.end, entry),
+        microseconds(timings->launcher_start, entry),
+    };
+
+    std::ofstream results(resultsPath, std::ios::trunc);
+    for (std::size_t i = 0; i < timing_count; ++i)
+    {
+        results << (i ? "," : "") << values[i];
+    }
+    results << "\n";
+
+    return results ? ERROR_SUCCESS : ERROR_WRITE_FAULT;
+}
+
+// "Cold" can't mean an empty file cache without administrator rights, so it means that nothing that the PSF keeps for
+// the package between launches - the locations of the files it looks for, and the DLL preload lists - is left
+static void clear_package_caches()
+{
+    auto localCache = psf::known_folder(FOLDERID_LocalAppData) / L"Packages" / psf::current_package_family_name() / L"LocalCache";
+    std::error_code ec;
+    for (auto& entry : std::filesystem::directory_iterator(localCache, ec))
+    {
+        if (_wcsnicmp(entry.path().filename().c_str(), L"Psf", 3) == 0)
+        {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+}
+
+static int launch(const std::filesystem::path& launcherPath, const std::filesystem::path& resultsPath, std::vector<std::int64_t>& values)
+{
+    std::filesystem::remove(resultsPath);
+
+    // The launcher passes its own arguments on to the application
+    auto commandLine = L"\"" + launcherPath.native() + L"\" /results:\"" + resultsPath.native() + L"\"";
+    STARTUPINFOW startupInfo = { sizeof(startupInfo) };
+    PROCESS_INFORMATION processInfo;
+    if (!::CreateProcessW(launcherPath.c_str(), commandLine.data(), nullptr, nullptr, false, 0, nullptr, nullptr, &startupInfo, &processInfo))
+    {
+        return print_last_error("Failed to launch PsfLauncher");
+    }
+
+    ::WaitForSingleObject(processInfo.hProcess, INFINITE);
+    ::CloseHandle(processInfo.hThread);
+    ::CloseHandle(processInfo.hProcess);
+
+    std::ifstream results(resultsPath);
+    std::string line;
+    if (!std::getline(results, line))
+    {
+        trace_messages(error_color, L"ERROR: The application didn't write its timings", new_line);
+        return ERROR_NOT_FOUND;
+    }
+
+    values.clear();
+    std::istringstream stream(line);
+    for (std::string value; std::getline(stream, value, ',');)
+    {
+        values.push_back(std::stoll(value));
+    }
+
+    if (values.size() != timing_count)
+    {
+        trace_messages(error_color, L"ERROR: Unexpected timings: ", error_info_color, widen(line), new_line);
+        return ERROR_BAD_FORMAT;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static int benchmark(const char* mode, bool cold, int runs, const std::filesystem::path& launcherPath, const std::string& date, std::ofstream& output)
+{
+    test_begin(std::string(mode) + " launches");
+
+    auto resultsPath = std::filesystem::temp_directory_path() / (L"StartupBenchmark." + std::to_wstring(::GetCurrentProcessId()) + L".txt");
+    std::vector<std::vector<std::int64_t>> launches;
+    std::vector<std::int64_t> values;
+    int result = ERROR_SUCCESS;
+    if (!cold)
+    {
+        // Make sure that whatever the last cold launch left behind is all there is to start with
+        result = launch(launcherPath, resultsPath, values);
+    }
+
+    for (int run = 0; (run < runs) && (result == ERROR_SUCCESS); ++run)
+    {
+        if (cold)
+        {
+            clear_package_caches();
+        }
+
+        result = launch(launcherPath, resultsPath, values);
+        if (result == ERROR_SUCCESS)
+        {
+            output << date << "," << mode << "," << run;
+            for (auto value : values)
+            {
+                output << "," << value;
+            }
+            output << "\n";
+            launches.push_back(values);
+        }
+    }
+    std::filesystem::remove(resultsPath);
+
+    if (result == ERROR_SUCCESS)
+    {
+        for (std::size_t i = 0; i < timing_count; ++i)
+        {
+            std::vector<std::int64_t> timing;
+            for (auto& launchValues : launches)
+            {
+                timing.push_back(launchValues[i]);
+            }
+            std::sort(timing.begin(), timing.end());
+
+            trace_messages(widen(timing_names[i]), L": median ", info_color, std::to_wstring(timing[timing.size() / 2]) + L"us",
+                console::color::gray, L", max ", info_color, std::to_wstring(timing.back()) + L"us", new_line);
+        }
+    }
+
+    test_end(result);
+    return result;
+}
+
+int wmain(int argc, const wchar_t** argv)
+{
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/results", L"" },
+        { L"/runs", L"10" },
+        { L"/output", L"" },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    if ((result == ERROR_SUCCESS) && (psf::current_executable_path().stem().native() == app_executable_name))
+    {
+        return record_startup(allowedArgs[L"/results"]);
+    }
+
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    auto runs = std::wcstol(allowedArgs[L"/runs"].c_str(), nullptr, 10);
+    if ((result == ERROR_SUCCESS) && (runs <= 0))
+    {
+        std::wcout << error_text() << "ERROR: /runs must be a positive number\n";
+        result = ERROR_INVALID_PARAMETER;
+    }
+
+    if (result == ERROR_SUCCESS)
+    {
+        test_initialize("Startup Benchmarks", 2);
+
+        std::filesystem::path outputPath = allowedArgs[L"/output"];
+        if (outputPath.empty())
+        {
+            outputPath = std::filesystem::temp_directory_path() / L"StartupBenchmark.csv";
+        }
+
+        // Appended to, so that the file collects results over time; the header is only written to a new file
+        auto exists = std::filesystem::exists(outputPath);
+        std::ofstream output(outputPath, std::ios::app);
+        if (!exists)
+        {
+            output << "date,mode,run";
+            for (auto name : timing_names)
+            {
+                output << "," << name << "_us";
+            }
+            output << "\n";
+        }
+        trace_messages(L"Results: ", info_color, outputPath.native(), new_line);
+
+        SYSTEMTIME now;
+        ::GetSystemTime(&now);
+        char date[32];
+        std::snprintf(date, std::size(date), "%04u-%02u-%02uT%02u:%02u:%02uZ", now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond);
+
+        auto launcherPath = psf::current_package_path() / L"PsfLauncher.exe";
+        result = benchmark("cold", true, runs, launcherPath, date, output);
+        auto warmResult = benchmark("warm", false, runs, launcherPath, date, output);
+        result = result ? result : warmResult;
+
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -0,0 +1,578 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <test_config.h>
+#include <winternl.h>
+
+#include "Replay.h"
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#endif
+
+using namespace std::literals;
+
+namespace
+{
+    enum class replay_result
+    {
+        succeeded,
+        failed,
+        skipped,    // The call couldn't be made, e.g. because it uses a handle opened before tracing started
+    };
+
+    // Maps the handles that were recorded to the ones that replaying the same calls opened. Handle values get reused once
+    // closed, and since closing isn't traced, a handle is only closed once its recorded value is handed out again
+    class handle_table
+    {
+    public:
+        handle_table() = default;
+        handle_table(const handle_table&) = delete;
+        handle_table& operator=(const handle_table&) = delete;
+
+        ~handle_table()
+        {
+            for (auto& [recorded, handle] : m_files)
+            {
+                ::CloseHandle(handle);
+            }
+
+            for (auto& [recorded, key] : m_keys)
+            {
+                ::RegCloseKey(key);
+            }
+
+            for (auto module : m_modules)
+            {
+                ::FreeLibrary(module);
+            }
+        }
+
+        void add_file(std::uint64_t recorded, HANDLE handle)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (auto [itr, inserted] = m_files.emplace(recorded, handle); !inserted)
+            {
+                ::CloseHandle(itr->second);
+                itr->second = handle;
+            }
+        }
+
+        void add_key(std::uint64_t recorded, HKEY key)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (auto [itr, inserted] = m_keys.emplace(recorded, key); !inserted)
+            {
+                ::RegCloseKey(itr->second);
+                itr->second = key;
+            }
+        }
+
+        void add_module(HMODULE module)
+        {
+            // Modules are reference counted, so there's no harm in holding on to every load until the end
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_modules.push_back(module);
+        }
+
+        // Returns false for keys the trace never saw being opened
+        bool find_key(std::uint64_t recorded, HKEY& key)
+        {
+            // Predefined keys are sign extended by 64-bit processes, but not by 32-bit ones
+            auto low = static_cast<std::uint32_t>(recorded);
+            auto high = static_cast<std::uint32_t>(recorded >> 32);
+            if ((low >= 0x80000000) && (low <= 0x80000007) && ((high == 0) || (high == 0xFFFFFFFF)))
+            {
+                key = reinterpret_cast<HKEY>(static_cast<LONG_PTR>(static_cast<LONG>(low)));
+                return true;
+            }
+
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (auto itr = m_keys.find(recorded); itr != m_keys.end())
+            {
+                key = itr->second;
+                return true;
+            }
+
+            return false;
+        }
+
+    private:
+        std::mutex m_lock;
+        std::map<std::uint64_t, HANDLE> m_files;
+        std::map<std::uint64_t, HKEY> m_keys;
+        std::vector<HMODULE> m_modules;
+    };
+
+    std::uint64_t arg(const traced_call& call, std::size_t index)
+    {
+        return (index < call.args.size()) ? call.args[index] : 0;
+    }
+
+    template <typename T>
+    T arg_as(const traced_call& call, std::size_t index)
+    {
+        return static_cast<T>(arg(call, index));
+    }
+
+    replay_result from_bool(bool succeeded)
+    {
+        return succeeded ? replay_result::succeeded : replay_result::failed;
+    }
+
+    replay_result from_win32(LSTATUS status)
+    {
+        return from_bool(status == ERROR_SUCCESS);
+    }
+
+    replay_result add_file(handle_table& handles, const traced_call& call, std::size_t handleIndex, HANDLE handle)
+    {
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            return replay_result::failed;
+        }
+
+        handles.add_file(arg(call, handleIndex), handle);
+        return replay_result::succeeded;
+    }
+
+    // Data isn't recorded, so values are given a buffer of the recorded size and are written as zeros of that size
+    std::vector<BYTE> data_buffer(const traced_call& call, std::size_t sizeIndex)
+    {
+        return std::vector<BYTE>(arg_as<std::size_t>(call, sizeIndex));
+    }
+
+    replay_result replay_CreateFile(const traced_call& call, handle_table& handles)
+    {
+        auto handle = ::CreateFileW(call.path.c_str(), arg_as<DWORD>(call, 0), arg_as<DWORD>(call, 1), nullptr,
+            arg_as<DWORD>(call, 2), arg_as<DWORD>(call, 3), nullptr);
+        return add_file(handles, call, 4, handle);
+    }
+
+    replay_result replay_CreateFile2(const traced_call& call, handle_table& handles)
+    {
+        auto handle = ::CreateFile2(call.path.c_str(), arg_as<DWORD>(call, 0), arg_as<DWORD>(call, 1), arg_as<DWORD>(call, 2), nullptr);
+        return add_file(handles, call, 3, handle);
+    }
+
+    replay_result replay_DeleteFile(const traced_call& call, handle_table&)
+    {
+        return from_bool(::DeleteFileW(call.path.c_str()) != FALSE);
+    }
+
+    replay_result replay_FindFirstFileEx(const traced_call& call, handle_table&)
+    {
+        // FindNextFile isn't recorded, so there's nothing to do with the handle but close it again
+        WIN32_FIND_DATAW data;
+        auto handle = ::FindFirstFileExW(call.path.c_str(), arg_as<FINDEX_INFO_LEVELS>(call, 0), &data,
+            arg_as<FINDEX_SEARCH_OPS>(call, 1), nullptr, arg_as<DWORD>(call, 2));
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            return replay_result::failed;
+        }
+
+        ::FindClose(handle);
+        return replay_result::succeeded;
+    }
+
+    replay_result replay_GetFileAttributes(const traced_call& call, handle_table&)
+    {
+        return from_bool(::GetFileAttributesW(call.path.c_str()) != INVALID_FILE_ATTRIBUTES);
+    }
+
+    replay_result replay_GetFileAttributesEx(const traced_call& call, handle_table&)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        return from_bool(::GetFileAttributesExW(call.path.c_str(), arg_as<GET_FILEEX_INFO_LEVELS>(call, 0), &data) != FALSE);
+    }
+
+    replay_result replay_RegCreateKeyEx(const traced_call& call, handle_table& handles)
+    {
+        HKEY key;
+        if (!handles.find_key(arg(call, 0), key))
+        {
+            return replay_result::skipped;
+        }
+
+        HKEY result;
+        DWORD disposition;
+        auto status = ::RegCreateKeyExW(key, call.path.c_str(), 0, nullptr, arg_as<DWORD>(call, 1), arg_as<REGSAM>(call, 2),
+            nullptr, &result, &disposition);
+        if (status == ERROR_SUCCESS)
+        {
+            handles.add_key(arg(call, 3), result);
+        }
+
+        return from_win32(status);
+    }
+
+    replay_result replay_RegOpenKeyEx(const traced_call& call, handle_table& handles)
+    {
+        HKEY key;
+        if (!handles.find_key(arg(call, 0), key))
+        {
+            return replay_result::skipped;
+        }
+
+        HKEY result;
+        auto status = ::RegOpenKeyExW(key, call.path.c_str(), arg_as<DWORD>(call, 1), arg_as<REGSAM>(call, 2), &result);
+        if (status == ERROR_SUCCESS)
+        {
+            handles.add_key(arg(call, 3), result);
+        }
+
+        return from_win32(status);
+    }
+
+    replay_result replay_RegGetValue(const traced_call& call, handle_table& handles)
+    {
+        // The sub key isn't recorded, so the value is always read from the key itself
+        HKEY key;
+        if (!handles.find_key(arg(call, 0), key))
+        {
+            return replay_result::skipped;
+        }
+
+        auto data = data_buffer(call, 3);
+        auto size = static_cast<DWORD>(data.size());
+        return from_win32(::RegGetValueW(key, nullptr, call.path.c_str(), arg_as<DWORD>(call, 1), nullptr,
+            data.empty() ? nullptr : data.data(), &size));
+    }
+
+    replay_result replay_RegQueryValueEx(const traced_call& call, handle_table& handles)
+    {
+        HKEY key;
+        if (!handles.find_key(arg(call, 0), key))
+        {
+            return replay_result::skipped;
+        }
+
+        auto data = data_buffer(call, 2);
+        auto size = static_cast<DWORD>(data.size());
+        return from_win32(::RegQueryValueExW(key, call.path.c_str(), nullptr, nullptr, data.empty() ? nullptr : data.data(), &size));
+    }
+
+    replay_result replay_RegSetValueEx(const traced_call& call, handle_table& handles)
+    {
+        HKEY key;
+        if (!handles.find_key(arg(call, 0), key))
+        {
+            return replay_result::skipped;
+        }
+
+        auto data = data_buffer(call, 2);
+        return from_win32(::RegSetValueExW(key, call.path.c_str(), 0, arg_as<DWORD>(call, 1), data.data(), static_cast<DWORD>(data.size())));
+    }
+
+    // The Nt functions are looked up rather than linked against so that the test doesn't need ntdll.lib
+    template <typename Func>
+    Func* ntdll_function(const char* name)
+    {
+        return reinterpret_cast<Func*>(::GetProcAddress(::GetModuleHandleW(L"ntdll.dll"), name));
+    }
+
+    // Only names that were recorded in full can be replayed; ones relative to a root directory handle can't be
+    bool object_attributes(const traced_call& call, UNICODE_STRING& name, OBJECT_ATTRIBUTES& attributes)
+    {
+        if (call.path.empty() || (call.path[0] != L'\\'))
+        {
+            return false;
+        }
+
+        name.Buffer = const_cast<wchar_t*>(call.path.c_str());
+        name.Length = static_cast<USHORT>(call.path.length() * sizeof(wchar_t));
+        name.MaximumLength = name.Length;
+        InitializeObjectAttributes(&attributes, &name, OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+        return true;
+    }
+
+    replay_result replay_NtCreateFile(const traced_call& call, handle_table& handles)
+    {
+        static const auto ntCreateFile = ntdll_function<decltype(::NtCreateFile)>("NtCreateFile");
+
+        UNICODE_STRING name;
+        OBJECT_ATTRIBUTES attributes;
+        if (!ntCreateFile || !object_attributes(call, name, attributes))
+        {
+            return replay_result::skipped;
+        }
+
+        HANDLE handle;
+        IO_STATUS_BLOCK ioStatus;
+        auto status = ntCreateFile(&handle, arg_as<ACCESS_MASK>(call, 0), &attributes, &ioStatus, nullptr, arg_as<ULONG>(call, 1),
+            arg_as<ULONG>(call, 2), arg_as<ULONG>(call, 3), arg_as<ULONG>(call, 4), nullptr, 0);
+        return add_file(handles, call, 5, NT_SUCCESS(status) ? handle : INVALID_HANDLE_VALUE);
+    }
+
+    replay_result replay_NtOpenFile(const traced_call& call, handle_table& handles)
+    {
+        static const auto ntOpenFile = ntdll_function<decltype(::NtOpenFile)>("NtOpenFile");
+
+        UNICODE_STRING name;
+        OBJECT_ATTRIBUTES attributes;
+        if (!ntOpenFile || !object_attributes(call, name, attributes))
+        {
+            return replay_result::skipped;
+        }
+
+        HANDLE handle;
+        IO_STATUS_BLOCK ioStatus;
+        auto status = ntOpenFile(&handle, arg_as<ACCESS_MASK>(call, 0), &attributes, &ioStatus, arg_as<ULONG>(call, 1), arg_as<ULONG>(call, 2));
+        return add_file(handles, call, 3, NT_SUCCESS(status) ? handle : INVALID_HANDLE_VALUE);
+    }
+
+    replay_result add_module(handle_table& handles, HMODULE module)
+    {
+        if (!module)
+        {
+            return replay_result::failed;
+        }
+
+        handles.add_module(module);
+        return replay_result::succeeded;
+    }
+
+    replay_result replay_LoadLibrary(const traced_call& call, handle_table& handles)
+    {
+        return add_module(handles, ::LoadLibraryW(call.path.c_str()));
+    }
+
+    replay_result replay_LoadLibraryEx(const traced_call& call, handle_table& handles)
+    {
+        return add_module(handles, ::LoadLibraryExW(call.path.c_str(), nullptr, arg_as<DWORD>(call, 0)));
+    }
+
+    replay_result replay_LoadPackagedLibrary(const traced_call& call, handle_table& handles)
+    {
+        return add_module(handles, ::LoadPackagedLibrary(call.path.c_str(), 0));
+    }
+
+    using replay_function = replay_result (*)(const traced_call&, handle_table&);
+
+    // By the names that TraceFixup registers for the functions that it writes call records for
+    const std::map<std::string_view, replay_function> replay_functions =
+    {
+        { "CreateFile"sv, replay_CreateFile },
+        { "CreateFile2"sv, replay_CreateFile2 },
+        { "DeleteFile"sv, replay_DeleteFile },
+        { "FindFirstFileEx"sv, replay_FindFirstFileEx },
+        { "GetFileAttributes"sv, replay_GetFileAttributes },
+        { "GetFileAttributesEx"sv, replay_GetFileAttributesEx },
+        { "RegCreateKeyEx"sv, replay_RegCreateKeyEx },
+        { "RegOpenKeyEx"sv, replay_RegOpenKeyEx },
+        { "RegGetValue"sv, replay_RegGetValue },
+        { "RegQueryValueEx"sv, replay_RegQueryValueEx },
+        { "RegSetValueEx"sv, replay_RegSetValueEx },
+        { "NtCreateFile"sv, replay_NtCreateFile },
+        { "NtOpenFile"sv, replay_NtOpenFile },
+        { "LoadLibrary"sv, replay_LoadLibrary },
+        { "LoadLibraryEx"sv, replay_LoadLibraryEx },
+        { "LoadPackagedLibrary"sv, replay_LoadPackagedLibrary },
+    };
+
+    std::int64_t timestamp()
+    {
+        LARGE_INTEGER value;
+        ::QueryPerformanceCounter(&value);
+        return value.QuadPart;
+    }
+
+    std::int64_t frequency()
+    {
+        LARGE_INTEGER value;
+        ::QueryPerformanceFrequency(&value);
+        return value.QuadPart;
+    }
+
+    // Maps the recorded timestamps onto this process' clock, compressed by the replay speed
+    class replay_clock
+    {
+    public:
+        replay_clock(const trace_capture& trace, double speed) :
+            m_start(timestamp()),
+            m_first(trace.calls.front().timestamp),
+            m_ratio((speed > 0) ? frequency() / (trace.frequency * speed) : 0)
+        {
+        }
+
+        void wait_for(std::int64_t recorded) const
+        {
+            if (m_ratio == 0)
+            {
+                return;
+            }
+
+            auto target = m_start + static_cast<std::int64_t>((recorded - m_first) * m_ratio);
+            for (auto now = timestamp(); now < target; now = timestamp())
+            {
+                // Sleeps are only good to about a millisecond, so the last of the wait is spent yielding instead
+                auto milliseconds = (target - now) * 1000 / frequency();
+                if (milliseconds > 1)
+                {
+                    ::Sleep(static_cast<DWORD>(milliseconds - 1));
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        std::int64_t m_start;
+        std::int64_t m_first;
+        double m_ratio;
+    };
+
+    struct function_statistics
+    {
+        std::size_t calls = 0;
+        std::size_t skipped = 0;
+        std::size_t differences = 0;    // Calls that succeeded when recorded and failed when replayed, or the other way around
+        std::int64_t recorded_ticks = 0;
+        std::int64_t replayed_ticks = 0;
+    };
+
+    std::vector<function_statistics> replay_thread(
+        const std::vector<const traced_call*>& calls,
+        const std::vector<replay_function>& functions,
+        const replay_clock& clock,
+        handle_table& handles)
+    {
+        std::vector<function_statistics> result(functions.size());
+        for (auto call : calls)
+        {
+            auto function = functions[call->function_id];
+            auto& statistics = result[call->function_id];
+            clock.wait_for(call->timestamp);
+
+            auto start = timestamp();
+            auto replayed = function(*call, handles);
+            auto end = timestamp();
+
+            ++statistics.calls;
+            if (replayed == replay_result::skipped)
+            {
+                ++statistics.skipped;
+                continue;
+            }
+
+            statistics.recorded_ticks += call->ticks;
+            statistics.replayed_ticks += end - start;
+            if ((replayed == replay_result::succeeded) != traced_call_succeeded(call->result))
+            {
+                ++statistics.differences;
+            }
+        }
+
+        return result;
+    }
+
+    std::wstring microseconds(std::int64_t ticks, std::int64_t ticksPerSecond, std::size_t count)
+    {
+        return std::to_wstring((count == 0) ? 0 : ticks * 1000000 / ticksPerSecond / static_cast<std::int64_t>(count)) + L"us";
+    }
+}
+
+int replay(const trace_capture& trace, const replay_options& options)
+{
+    std::vector<replay_function> functions(trace.function_names.size());
+    for (std::size_t i = 0; i < functions.size(); ++i)
+    {
+        if (auto itr = replay_functions.find(trace.function_names[i]); itr != replay_functions.end())
+        {
+            functions[i] = itr->second;
+        }
+        else if (!trace.function_names[i].empty())
+        {
+            trace_messages(warning_color, L"WARNING: Calls to ", warning_info_color, widen(trace.function_names[i]),
+                warning_color, L" can't be replayed and will be ignored", new_line);
+        }
+    }
+
+    // Group the calls by the thread that made them, keeping each thread's calls in order
+    std::map<std::uint32_t, std::vector<const traced_call*>> threadCalls;
+    std::size_t replayableCount = 0;
+    for (auto& call : trace.calls)
+    {
+        if ((call.function_id < functions.size()) && functions[call.function_id])
+        {
+            threadCalls[options.threads ? call.thread_id : 0].push_back(&call);
+            ++replayableCount;
+        }
+    }
+
+    if (replayableCount == 0)
+    {
+        trace_messages(error_color, L"ERROR: The trace has no calls that can be replayed", new_line);
+        return ERROR_NO_DATA;
+    }
+
+    trace_messages(L"Replaying ", info_color, std::to_wstring(replayableCount), console::color::gray, L" calls made by ",
+        info_color, std::to_wstring(threadCalls.size()), console::color::gray, L" thread(s)", new_line);
+
+    std::vector<function_statistics> statistics(functions.size());
+    auto start = timestamp();
+    {
+        handle_table handles;
+        replay_clock clock(trace, options.speed);
+
+        std::vector<std::vector<function_statistics>> threadStatistics(threadCalls.size());
+        std::vector<std::thread> threads;
+        std::size_t index = 0;
+        for (auto& [threadId, calls] : threadCalls)
+        {
+            threads.emplace_back([&, &threadResult = threadStatistics[index++], &callList = calls]()
+            {
+                threadResult = replay_thread(callList, functions, clock, handles);
+            });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        for (auto& threadResult : threadStatistics)
+        {
+            for (std::size_t i = 0; i < statistics.size(); ++i)
+            {
+                statistics[i].calls += threadResult[i].calls;
+                statistics[i].skipped += threadResult[i].skipped;
+                statistics[i].differences += threadResult[i].differences;
+                statistics[i].recorded_ticks += threadResult[i].recorded_ticks;
+                statistics[i].replayed_ticks += threadResult[i].replayed_ticks;
+            }
+        }
+    }
+    auto end = timestamp();
+
+    for (std::size_t i = 0; i < statistics.size(); ++i)
+    {
+        auto& function = statistics[i];
+        if (function.calls == 0)
+        {
+            continue;
+        }
+
+        auto replayed = function.calls - function.skipped;
+        trace_messages(info_color, widen(trace.function_names[i]), console::color::gray,
+            L": calls=" + std::to_wstring(function.calls) +
+            L" skipped=" + std::to_wstring(function.skipped) +
+            L" differences=" + std::to_wstring(function.differences) +
+            L" recorded=" + microseconds(function.recorded_ticks, trace.frequency, replayed) +
+            L" replayed=" + microseconds(function.replayed_ticks, frequency(), replayed),
+            new_line);
+    }
+
+    trace_messages(L"Replay took ", info_color, std::to_wstring((end - start) * 1000 / frequency()) + L"ms", new_line);
+    return ERROR_SUCCESS;
+}
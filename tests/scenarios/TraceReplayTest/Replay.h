@@ -0,0 +1,21 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include "TraceFile.h"
+
+struct replay_options
+{
+    // How much faster than recorded to make the calls; 1 keeps the recorded gaps between calls, and 0 doesn't wait at all
+    double speed = 1.0;
+
+    // Replays the calls of each recorded thread on a thread of its own, as opposed to all of them on this thread
+    bool threads = true;
+};
+
+// Makes the calls of the trace, through whichever fixups the package has configured, and reports how the results differ
+// from what was recorded. Differences aren't failures since they're expected whenever the machine or the package's state
+// isn't the same as when the trace was captured. Only a trace with nothing to replay fails the test
+int replay(const trace_capture& trace, const replay_options& options);
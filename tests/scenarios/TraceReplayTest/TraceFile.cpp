@@ -0,0 +1,156 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <test_config.h>
+
+#include "TraceFile.h"
+
+namespace
+{
+    // The same layouts as TraceRing.cpp in TraceFixup writes, which has no padding
+#pragma pack(push, 1)
+    struct file_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t reserved;
+        std::int64_t frequency;
+    };
+
+    struct record_header
+    {
+        std::int64_t timestamp;
+        std::uint32_t thread_id;
+        std::uint16_t kind;
+        std::uint16_t reserved;
+        std::uint32_t length;
+    };
+
+    struct call_record
+    {
+        std::uint16_t function_id;
+        std::uint8_t result;
+        std::uint8_t flags;
+        std::uint32_t error;
+        std::int64_t ticks;
+        std::uint16_t arg_count;
+        std::uint16_t string_bytes;
+    };
+#pragma pack(pop)
+
+    constexpr std::uint16_t text_record = 0;
+    constexpr std::uint16_t function_record = 1;
+    constexpr std::uint16_t call_record_kind = 2;
+    constexpr std::uint8_t wide_string_flag = 1;
+
+    template <typename T>
+    bool read_from(const std::vector<char>& payload, std::size_t& offset, T& value)
+    {
+        if (payload.size() - offset < sizeof(T))
+        {
+            return false;
+        }
+
+        std::memcpy(&value, payload.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+}
+
+int read_trace(const std::filesystem::path& path, trace_capture& result)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        trace_messages(error_color, L"ERROR: Could not open the trace ", error_info_color, path.native(), new_line);
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    file_header header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        (std::memcmp(header.magic, "PSFTRACE", sizeof(header.magic)) != 0) ||
+        (header.version != 1) ||
+        (header.frequency <= 0))
+    {
+        trace_messages(error_color, L"ERROR: Not a binary TraceFixup trace: ", error_info_color, path.native(), new_line);
+        return ERROR_BAD_FORMAT;
+    }
+    result.frequency = header.frequency;
+
+    record_header record;
+    std::vector<char> payload;
+    while (file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+    {
+        payload.resize(record.length);
+        if (!file.read(payload.data(), record.length))
+        {
+            // The process was killed while the file was being written; everything before is still good
+            trace_messages(warning_color, L"WARNING: The trace ends with an incomplete record", new_line);
+            break;
+        }
+
+        std::size_t offset = 0;
+        if (record.kind == text_record)
+        {
+            ++result.text_records;
+        }
+        else if (record.kind == function_record)
+        {
+            std::uint16_t id;
+            if (read_from(payload, offset, id))
+            {
+                if (result.function_names.size() <= id)
+                {
+                    result.function_names.resize(id + 1);
+                }
+                result.function_names[id].assign(payload.data() + offset, payload.size() - offset);
+            }
+        }
+        else if (record.kind == call_record_kind)
+        {
+            call_record call;
+            if (!read_from(payload, offset, call) ||
+                (payload.size() - offset < call.arg_count * sizeof(std::uint64_t) + call.string_bytes))
+            {
+                continue;
+            }
+
+            traced_call& traced = result.calls.emplace_back();
+            traced.timestamp = record.timestamp;
+            traced.thread_id = record.thread_id;
+            traced.function_id = call.function_id;
+            traced.result = call.result;
+            traced.error = call.error;
+            traced.ticks = call.ticks;
+            traced.args.resize(call.arg_count);
+            std::memcpy(traced.args.data(), payload.data() + offset, call.arg_count * sizeof(std::uint64_t));
+            offset += call.arg_count * sizeof(std::uint64_t);
+
+            auto string = payload.data() + offset;
+            if (call.flags & wide_string_flag)
+            {
+                traced.path.resize(call.string_bytes / sizeof(wchar_t));
+                std::memcpy(traced.path.data(), string, traced.path.length() * sizeof(wchar_t));
+            }
+            else
+            {
+                // Narrow strings are whatever the app passed to the ANSI version of the function
+                traced.path = widen(std::string_view(string, call.string_bytes), CP_ACP);
+            }
+        }
+    }
+
+    // Each thread's records are in order, but the rings of different threads are written to the file in turn
+    std::stable_sort(result.calls.begin(), result.calls.end(), [](const traced_call& lhs, const traced_call& rhs)
+    {
+        return lhs.timestamp < rhs.timestamp;
+    });
+
+    return ERROR_SUCCESS;
+}
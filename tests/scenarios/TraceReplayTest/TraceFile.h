@@ -0,0 +1,39 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// A call record written by TraceFixup's 'binary' trace method. See TraceRing.h in TraceFixup for the file format
+struct traced_call
+{
+    std::int64_t timestamp;
+    std::uint32_t thread_id;
+    std::uint16_t function_id;
+    std::uint8_t result;        // TraceFixup's function_result; success, indeterminate, expected_failure, or failure
+    std::uint32_t error;
+    std::int64_t ticks;
+    std::vector<std::uint64_t> args;
+    std::wstring path;
+};
+
+inline bool traced_call_succeeded(std::uint8_t result)
+{
+    return result <= 1;
+}
+
+struct trace_capture
+{
+    std::int64_t frequency = 0;
+    std::vector<std::string> function_names;    // By function id
+    std::vector<traced_call> calls;             // Sorted by timestamp
+    std::size_t text_records = 0;
+};
+
+// Returns an error code, having printed why, if the file can't be read or isn't a binary trace
+int read_trace(const std::filesystem::path& path, trace_capture& result);
@@ -0,0 +1,64 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <io.h>
+
+#include <psf_runtime.h>
+
+#include <test_config.h>
+
+#include "Replay.h"
+#include "TraceFile.h"
+
+int wmain(int argc, const wchar_t** argv)
+{
+    // Display UTF-16 correctly...
+    _setmode(_fileno(stdout), _O_U16TEXT);
+
+    std::map<std::wstring_view, std::wstring> allowedArgs
+    {
+        { L"/trace", L"" },
+        { L"/speed", L"1" },
+        { L"/threads", L"true" },
+    };
+
+    auto result = parse_args(argc, argv, allowedArgs);
+    if (result == ERROR_SUCCESS)
+    {
+        test_initialize("Trace Replay Tests", 1);
+        test_begin("Replay a TraceFixup binary trace");
+
+        // Without a path, the trace is the one that was packaged along with the test
+        std::filesystem::path tracePath = allowedArgs[L"/trace"];
+        if (tracePath.empty())
+        {
+            tracePath = psf::current_package_path() / L"PsfTrace.bin";
+        }
+
+        replay_options options;
+        options.speed = std::wcstod(allowedArgs[L"/speed"].c_str(), nullptr);
+        options.threads = allowedArgs[L"/threads"] != L"false";
+
+        trace_capture trace;
+        result = read_trace(tracePath, trace);
+        if (result == ERROR_SUCCESS)
+        {
+            trace_messages(L"Trace: ", info_color, tracePath.native(), console::color::gray, L" (",
+                info_color, std::to_wstring(trace.calls.size()), console::color::gray, L" call records)", new_line);
+            result = replay(trace, options);
+        }
+
+        test_end(result);
+        test_cleanup();
+    }
+
+    if (!g_testRunnerPipe)
+    {
+        system("pause");
+    }
+
+    return result;
+}
@@ -16,6 +16,9 @@
             <xsl:if test="stopOnScriptError">
             ,"stopOnScriptError": "<xsl:value-of select="stopOnScriptError"/>"
             </xsl:if>
+            <xsl:if test="hostScripts">
+            , "hostScripts": <xsl:value-of select="hostScripts"/>
+            </xsl:if>
             <xsl:if test="monitor">
             , "monitor" :
             {
@@ -27,6 +30,9 @@
                 <xsl:if test="wait">
                     ,"wait": "<xsl:value-of select="monitor/wait"/>"
                 </xsl:if>
+                <xsl:if test="monitor/readyTimeout">
+                    , "readyTimeout": <xsl:value-of select="monitor/readyTimeout"/>
+                </xsl:if>
             }
             </xsl:if>
             <xsl:if test="startScript">
@@ -48,6 +54,10 @@
                     , "waitForScriptToFinish": <xsl:value-of select="$startScriptHeader/waitForScriptToFinish"/>
                     </xsl:if>
                     
+                    <xsl:if test="$startScriptHeader/waitForReadySignal">
+                    , "waitForReadySignal": <xsl:value-of select="$startScriptHeader/waitForReadySignal"/>
+                    </xsl:if>
+                    
                     <xsl:if test="$startScriptHeader/timeout">
                     , "timeout": "<xsl:value-of select="$startScriptHeader/timeout"/>"
                     </xsl:if>
@@ -90,12 +100,34 @@
     <xsl:for-each select="processes/process">
         {
             "executable": "<xsl:value-of select="executable"/>"
+            <xsl:if test="batchFixupInitialization">
+            ,"batchFixupInitialization": <xsl:value-of select="batchFixupInitialization"/>
+            </xsl:if>
+            <xsl:if test="parallelFixupLoading">
+            ,"parallelFixupLoading": <xsl:value-of select="parallelFixupLoading"/>
+            </xsl:if>
+            <xsl:if test="persistentInjectionHelper">
+            ,"persistentInjectionHelper": <xsl:value-of select="persistentInjectionHelper"/>
+            </xsl:if>
+            <xsl:if test="propagateFixups">
+            ,"propagateFixups": <xsl:value-of select="propagateFixups"/>
+            </xsl:if>
             <xsl:if test="fixups/fixup">
             ,"fixups": [
                 <xsl:for-each select="fixups/fixup">
                 {
                     <xsl:variable name="dllName" select="dll" />
                     "dll": "<xsl:value-of select="dll"/>"
+                    <xsl:if test="importHookModules">
+                        , "importHookModules": [
+                        <xsl:for-each select="importHookModules/module">
+                            "<xsl:value-of select="."/>"
+                            <xsl:if test="position()!=last()">
+                                ,
+                            </xsl:if>
+                        </xsl:for-each>
+                        ]
+                    </xsl:if>
                     <xsl:if test="contains($dllName, 'WaitForDebuggerFixup')">
                         , "config" :
                         {
@@ -239,6 +271,96 @@
                                     ]
                                 </xsl:if>
                             }
+                            <xsl:if test="config/redirectCacheSize">
+                                , "redirectCacheSize": <xsl:value-of select="config/redirectCacheSize"/>
+                            </xsl:if>
+                            <xsl:if test="config/redirectJournalSize">
+                                , "redirectJournalSize": <xsl:value-of select="config/redirectJournalSize"/>
+                            </xsl:if>
+                            <xsl:if test="config/absentPathCacheSize">
+                                , "absentPathCacheSize": <xsl:value-of select="config/absentPathCacheSize"/>
+                            </xsl:if>
+                            <xsl:if test="config/logging">
+                                , "logging": <xsl:value-of select="config/logging"/>
+                            </xsl:if>
+                            <xsl:if test="config/packageContentIndex">
+                                , "packageContentIndex": <xsl:value-of select="config/packageContentIndex"/>
+                            </xsl:if>
+                            <xsl:if test="config/sharePackageContentIndex">
+                                , "sharePackageContentIndex": <xsl:value-of select="config/sharePackageContentIndex"/>
+                            </xsl:if>
+                            <xsl:if test="config/redirectionStatistics">
+                                , "redirectionStatistics": <xsl:value-of select="config/redirectionStatistics"/>
+                            </xsl:if>
+                            <xsl:if test="config/adaptiveRuleOrder">
+                                , "adaptiveRuleOrder": <xsl:value-of select="config/adaptiveRuleOrder"/>
+                            </xsl:if>
+                            <xsl:if test="config/disabledHookGroups">
+                                , "disabledHookGroups": [
+                                <xsl:for-each select="config/disabledHookGroups/disabledHookGroup">
+                                    "<xsl:value-of select="."/>"
+                                    <xsl:if test="position()!=last()">
+                                        ,
+                                    </xsl:if>
+                                </xsl:for-each>
+                                ]
+                            </xsl:if>
+                            <xsl:if test="config/bypass">
+                                , "bypass": [
+                                <xsl:for-each select="config/bypass/path">
+                                    "<xsl:value-of select="."/>"
+                                    <xsl:if test="position()!=last()">
+                                        ,
+                                    </xsl:if>
+                                </xsl:for-each>
+                                ]
+                            </xsl:if>
+                            <xsl:if test="config/enumerateShortNames">
+                                , "enumerateShortNames": <xsl:value-of select="config/enumerateShortNames"/>
+                            </xsl:if>
+                            <xsl:if test="config/lazyCopyOnWrite">
+                                , "lazyCopyOnWrite": <xsl:value-of select="config/lazyCopyOnWrite"/>
+                            </xsl:if>
+                            <xsl:if test="config/readOnlyInPlace">
+                                , "readOnlyInPlace": <xsl:value-of select="config/readOnlyInPlace"/>
+                            </xsl:if>
+                            <xsl:if test="config/lazyLinks">
+                                , "lazyLinks": <xsl:value-of select="config/lazyLinks"/>
+                            </xsl:if>
+                            <xsl:if test="config/journalCopies">
+                                , "journalCopies": <xsl:value-of select="config/journalCopies"/>
+                            </xsl:if>
+                            <xsl:if test="config/redirectRoot">
+                                , "redirectRoot": "<xsl:value-of select="config/redirectRoot"/>"
+                            </xsl:if>
+                            <xsl:if test="config/watchRedirectedArea">
+                                , "watchRedirectedArea": <xsl:value-of select="config/watchRedirectedArea"/>
+                            </xsl:if>
+                            <xsl:if test="config/deletePackageFiles">
+                                , "deletePackageFiles": <xsl:value-of select="config/deletePackageFiles"/>
+                            </xsl:if>
+                            <xsl:if test="config/lazyInitialize">
+                                , "lazyInitialize": <xsl:value-of select="config/lazyInitialize"/>
+                            </xsl:if>
+                            <xsl:if test="config/packageListingCacheSize">
+                                , "packageListingCacheSize": <xsl:value-of select="config/packageListingCacheSize"/>
+                            </xsl:if>
+                            <xsl:if test="config/profileCacheSize">
+                                , "profileCacheSize": <xsl:value-of select="config/profileCacheSize"/>
+                            </xsl:if>
+                            <xsl:if test="config/profileWriteBehind">
+                                , "profileWriteBehind": <xsl:value-of select="config/profileWriteBehind"/>
+                            </xsl:if>
+                            <xsl:if test="config/preCopy">
+                                , "preCopy": [
+                                <xsl:for-each select="config/preCopy/pattern">
+                                    "<xsl:value-of select="current()"/>"
+                                    <xsl:if test="position()!=last()">
+                                        ,
+                                    </xsl:if>
+                                </xsl:for-each>
+                                ]
+                            </xsl:if>
                         }
                     </xsl:if>
                 }
@@ -254,6 +376,16 @@
         </xsl:if>
     </xsl:for-each>
     ]
+    <xsl:if test="fixupSearchPaths">
+    , "fixupSearchPaths" : [
+    <xsl:for-each select="fixupSearchPaths/fixupSearchPath">
+        "<xsl:value-of select="."/>"
+        <xsl:if test="position()!=last()">
+            ,
+        </xsl:if>
+    </xsl:for-each>
+    ]
+    </xsl:if>
 }
     </xsl:template>
     <xsl:output omit-xml-declaration="yes"/>